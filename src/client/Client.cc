@@ -146,7 +146,7 @@ bool Client::CommandHook::call(std::string command, cmdmap_t& cmdmap,
 // -------------
 
 dir_result_t::dir_result_t(Inode *in)
-  : inode(in), offset(0), this_offset(2), next_offset(2),
+  : inode(in), offset(0), this_offset(2), next_offset(2), key_order(false),
     release_count(0), ordered_count(0), start_shared_gen(0),
     buffer(0) {
   inode->get();
@@ -172,15 +172,17 @@ Client::Client(Messenger *m, MonClient *mc)
     interrupt_finisher(m->cct),
     remount_finisher(m->cct),
     objecter_finisher(m->cct),
+    objectcacher_finisher(m->cct),
     tick_event(NULL),
     monclient(mc), messenger(m), whoami(m->get_myname().num()),
     cap_epoch_barrier(0),
-    last_tid(0), oldest_tid(0), last_flush_seq(0),
+    last_tid(0), oldest_tid(0), last_flush_seq(0), layout_policy_gen(0),
     initialized(false), authenticated(false),
     mounted(false), unmounting(false),
     local_osd(-1), local_osd_epoch(0),
     unsafe_sync_write(0),
-    client_lock("Client::client_lock")
+    client_lock("Client::client_lock", false, true, false, m->cct),
+    objectcacher_lock("Client::objectcacher_lock")
 {
   monclient->set_messenger(m);
 
@@ -209,8 +211,8 @@ Client::Client(Messenger *m, MonClient *mc)
 			  0, 0);
   objecter->set_client_incarnation(0);  // client always 0, for now.
   writeback_handler = new ObjecterWriteback(objecter, &objecter_finisher,
-					    &client_lock);
-  objectcacher = new ObjectCacher(cct, "libcephfs", *writeback_handler, client_lock,
+					    &objectcacher_lock);
+  objectcacher = new ObjectCacher(cct, "libcephfs", *writeback_handler, objectcacher_lock,
 				  client_flush_set_callback,    // all commit callback
 				  (void*)this,
 				  cct->_conf->client_oc_size,
@@ -220,6 +222,7 @@ Client::Client(Messenger *m, MonClient *mc)
 				  cct->_conf->client_oc_max_dirty_age,
 				  true);
   objecter_finisher.start();
+  objectcacher_finisher.start();
   filer = new Filer(objecter, &objecter_finisher);
 }
 
@@ -419,6 +422,10 @@ int Client::init()
   plb.add_time_avg(l_c_reply, "reply", "Latency of receiving a reply on metadata request");
   plb.add_time_avg(l_c_lat, "lat", "Latency of processing a metadata request");
   plb.add_time_avg(l_c_wrlat, "wrlat", "Latency of a file data write operation");
+  plb.add_u64_counter(l_c_async_create, "async_create", "Files created without waiting for the MDS");
+  plb.add_u64_counter(l_c_readdir_prefetch, "readdir_prefetch", "Readdir chunks requested before the reader needed them");
+  plb.add_u64_counter(l_c_readahead, "readahead", "Readahead requests issued");
+  plb.add_u64_counter(l_c_readahead_bytes, "readahead_bytes", "Bytes requested by readahead");
   logger = plb.create_perf_counters();
   cct->get_perfcounters_collection()->add(logger);
 
@@ -524,6 +531,8 @@ void Client::shutdown()
 
   objecter_finisher.wait_for_empty();
   objecter_finisher.stop();
+  objectcacher_finisher.wait_for_empty();
+  objectcacher_finisher.stop();
 
   monclient->shutdown();
 
@@ -654,7 +663,9 @@ void Client::update_inode_file_bits(Inode *in,
       ldout(cct, 10) << "truncate_seq " << in->truncate_seq << " -> "
 	       << truncate_seq << dendl;
       in->truncate_seq = truncate_seq;
+      objectcacher_lock.Lock();
       in->oset.truncate_seq = truncate_seq;
+      objectcacher_lock.Unlock();
 
       // truncate cached file data
       if (prior_size > size) {
@@ -675,7 +686,9 @@ void Client::update_inode_file_bits(Inode *in,
       ldout(cct, 10) << "truncate_size " << in->truncate_size << " -> "
 	       << truncate_size << dendl;
       in->truncate_size = truncate_size;
+      objectcacher_lock.Lock();
       in->oset.truncate_size = truncate_size;
+      objectcacher_lock.Unlock();
     } else {
       ldout(cct, 0) << "Hmmm, truncate_seq && truncate_size changed on non-file inode!" << dendl;
     }
@@ -807,6 +820,9 @@ Inode * Client::add_update_inode(InodeStat *st, utime_t from,
       invalidate_quota_tree(in);
     in->quota = st->quota;
 
+    if (!was_new && in->is_dir() &&
+	memcmp(&in->layout, &st->layout, sizeof(in->layout)))
+      _layout_policy_changed(in);
     in->layout = st->layout;
 
     update_inode_file_bits(in, st->truncate_seq, st->truncate_size, st->size,
@@ -823,6 +839,8 @@ Inode * Client::add_update_inode(InodeStat *st, utime_t from,
       st->xattr_version > in->xattr_version) {
     bufferlist::iterator p = st->xattrbl.begin();
     ::decode(in->xattrs, p);
+    if (!was_new && in->is_dir())
+      _layout_policy_changed(in);
     in->xattr_version = st->xattr_version;
   }
 
@@ -1068,6 +1086,17 @@ void Client::insert_readdir_results(MetaRequest *request, MetaSession *session,
     }
     request->readdir_last_name = dname;
 
+    // an mds that knows CEPH_MDS_FLAG_READDIR_KEY_ORDER says which
+    // order the listing is in
+    __u8 key_order = 0;
+    if ((request->head.flags & CEPH_MDS_FLAG_READDIR_KEY_ORDER) && !p.end())
+      ::decode(key_order, p);
+    request->readdir_key_order = key_order;
+    if (key_order)
+      dir->key_order_frags.insert(fg);
+    else
+      dir->key_order_frags.erase(fg);
+
     if (dir->is_empty())
       close_dir(dir);
   }
@@ -1461,6 +1490,8 @@ int Client::make_request(MetaRequest *request,
 {
   int r = 0;
 
+  wait_on_async_creates(request);
+
   // assign a unique tid
   ceph_tid_t tid = ++last_tid;
   request->set_tid(tid);
@@ -1594,6 +1625,30 @@ int Client::make_request(MetaRequest *request,
   return r;
 }
 
+/*
+ * the mds may run requests from one session concurrently, so one that
+ * names a file we created asynchronously (or lists a dir we did so
+ * in) could overtake the create.  wait until the mds has replied to
+ * those creates.
+ */
+void Client::wait_on_async_creates(MetaRequest *req)
+{
+  Inode *ins[5] = { req->inode(), req->old_inode(), req->other_inode(),
+		    req->dentry() ? req->dentry()->inode : NULL,
+		    req->old_dentry() ? req->old_dentry()->inode : NULL };
+  for (int i = 0; i < 5; i++) {
+    Inode *in = ins[i];
+    if (!in || !in->async_creates_unacked)
+      continue;
+    in->get();
+    while (in->async_creates_unacked) {
+      ldout(cct, 10) << "wait_on_async_creates " << *in << dendl;
+      wait_on_list(in->waitfor_caps);
+    }
+    put_inode(in);
+  }
+}
+
 void Client::unregister_request(MetaRequest *req)
 {
   mds_requests.erase(req->tid);
@@ -2013,7 +2068,32 @@ void Client::handle_client_request_forward(MClientRequestForward *fwd)
   request->mds = -1;
   request->num_fwd = fwd->get_num_fwd();
   request->resend_mds = fwd->get_dest_mds();
-  request->caller_cond->Signal();
+  if (request->async && request->get_op() == CEPH_MDS_OP_CREATE) {
+    // the ino an async create names was delegated by this mds; no other
+    // mds will take it.  the dir's auth has moved, so stop using what
+    // this one delegated too, until it delegates again.
+    ldout(cct, 10) << "handle_client_request_forward failing async create tid "
+		   << tid << ", dropping inos delegated by mds." << mds << dendl;
+    session->delegated_inos.clear();
+    request->item.remove_myself();
+    _async_reply(request, -ESTALE, true, true);
+    unregister_request(request);
+  } else if (request->async) {
+    // no make_request() loop to resend it; do it here.
+    request->item.remove_myself();
+    mds_rank_t dest = request->resend_mds;
+    request->resend_mds = -1;
+    if (have_open_session(dest)) {
+      send_request(request, mds_sessions[dest]);
+    } else {
+      lderr(cct) << "handle_client_request_forward no session to mds." << dest
+		 << ", failing async request tid " << tid << dendl;
+      _async_reply(request, -ESTALE, true, true);
+      unregister_request(request);
+    }
+  } else {
+    request->caller_cond->Signal();
+  }
 
   fwd->put();
 }
@@ -2066,7 +2146,13 @@ void Client::handle_client_reply(MClientReply *reply)
     return;
   }
 
-  if (-ESTALE == reply->get_result()) { // see if we can get to proper MDS
+  if (!reply->deleg_inos.empty()) {
+    ldout(cct, 10) << "handle_client_reply mds." << mds_num << " delegated "
+		   << reply->deleg_inos << dendl;
+    session->delegated_inos.union_of(reply->deleg_inos);
+  }
+
+  if (-ESTALE == reply->get_result() && !request->async) { // see if we can get to proper MDS
     ldout(cct, 20) << "got ESTALE on tid " << request->tid
 		   << " from mds." << request->mds << dendl;
     request->send_to_auth = true;
@@ -2088,7 +2174,12 @@ void Client::handle_client_reply(MClientReply *reply)
   
   assert(request->reply == NULL);
   request->reply = reply;
-  insert_trace(request, session);
+  // insert_trace points target at the inode the reply traces; an async
+  // create keeps its own, and checks the two match
+  Inode *async_target = request->async ? request->target : NULL;
+  Inode *traced = insert_trace(request, session);
+  if (request->async)
+    request->target = async_target;
 
   // Handle unsafe reply
   if (!is_safe) {
@@ -2101,9 +2192,15 @@ void Client::handle_client_reply(MClientReply *reply)
     }
   }
 
-  // Only signal the caller once (on the first reply):
-  // Either its an unsafe reply, or its a safe reply and no unsafe reply was sent.
-  if (!is_safe || !request->got_unsafe) {
+  if (request->async) {
+    // nobody is waiting for this one
+    int r = reply->get_result();
+    request->reply = NULL;
+    reply->put();
+    _async_reply(request, r, !is_safe || !request->got_unsafe, is_safe, traced);
+  } else if (!is_safe || !request->got_unsafe) {
+    // Only signal the caller once (on the first reply):
+    // Either its an unsafe reply, or its a safe reply and no unsafe reply was sent.
     Cond cond;
     request->dispatch_cond = &cond;
 
@@ -2158,6 +2255,7 @@ void Client::_handle_full_flag(int64_t pool)
        i != inode_map.end(); ++i)
   {
     Inode *inode = i->second;
+    Mutex::Locker l(objectcacher_lock);
     if (inode->oset.dirty_or_tx
         && (pool == -1 || inode->layout.fl_pg_pool == pool)) {
       ldout(cct, 4) << __func__ << ": FULL: inode 0x" << std::hex << i->first << std::dec
@@ -2303,6 +2401,10 @@ void Client::handle_mds_map(MMDSMap* m)
   mdsmap = new MDSMap;
   mdsmap->decode(m->get_encoded());
 
+  // new files with no layout policy above them go to the first pool
+  if (oldmap->get_data_pools() != mdsmap->get_data_pools())
+    ++layout_policy_gen;
+
   // Cancel any commands for missing or laggy GIDs
   std::list<ceph_tid_t> cancel_ops;
   for (std::map<ceph_tid_t, CommandOp>::iterator i = commands.begin();
@@ -2394,6 +2496,8 @@ void Client::send_reconnect(MetaSession *session)
 
   // reset my cap seq number
   session->seq = 0;
+  // the mds doesn't remember what it delegated to us
+  session->delegated_inos.clear();
   //connect to the mds' offload targets
   connect_mds_targets(mds);
   //make sure unsafe requests get saved
@@ -2407,6 +2511,11 @@ void Client::send_reconnect(MetaSession *session)
        p != inode_map.end();
        ++p) {
     Inode *in = p->second;
+    if (in->caps.count(mds) && in->caps[mds]->cap_id == 0) {
+      // assumed by an async create; the resent create brings the real cap
+      ldout(cct, 10) << " skipping unacked async create " << p->first << dendl;
+      continue;
+    }
     if (in->caps.count(mds)) {
       ldout(cct, 10) << " caps on " << p->first
 	       << " " << ccap_string(in->caps[mds]->issued)
@@ -2499,6 +2608,12 @@ void Client::kick_requests_closed(MetaSession *session)
 	req->unsafe_item.remove_myself();
 	req->unsafe_dir_item.remove_myself();
 	signal_cond_list(req->waitfor_safe);
+	if (req->async)
+	  _async_reply(req, 0, false, true);
+	unregister_request(req);
+      } else if (req->async) {
+	lderr(cct) << "kick_requests_closed failing async request " << req->get_tid() << dendl;
+	_async_reply(req, -EIO, true, true);
 	unregister_request(req);
       }
     }
@@ -2575,8 +2690,11 @@ void Client::put_inode(Inode *in, int n)
     remove_all_caps(in);
 
     ldout(cct, 10) << "put_inode deleting " << *in << dendl;
+    objectcacher_lock.Lock();
     bool unclean = objectcacher->release_set(&in->oset);
     assert(!unclean);
+    bool leftover = !in->oset.objects.empty();
+    objectcacher_lock.Unlock();
     put_qtree(in);
     if (in->snapdir_parent)
       put_inode(in->snapdir_parent);
@@ -2593,10 +2711,10 @@ void Client::put_inode(Inode *in, int n)
       }
     }
 
-    if (!in->oset.objects.empty()) {
+    if (leftover) {
       ldout(cct, 0) << __func__ << ": leftover objects on inode 0x"
         << std::hex << in->ino << std::dec << dendl;
-      assert(in->oset.objects.empty());
+      assert(!leftover);
     }
 
     delete in->fcntl_locks;
@@ -2882,9 +3000,11 @@ int Client::get_caps(Inode *in, int need, int want, int *phave, loff_t endoff)
 int Client::get_caps_used(Inode *in)
 {
   unsigned used = in->caps_used();
-  if (!(used & CEPH_CAP_FILE_CACHE) &&
-      !objectcacher->set_is_empty(&in->oset))
-    used |= CEPH_CAP_FILE_CACHE;
+  if (!(used & CEPH_CAP_FILE_CACHE)) {
+    Mutex::Locker l(objectcacher_lock);
+    if (!objectcacher->set_is_empty(&in->oset))
+      used |= CEPH_CAP_FILE_CACHE;
+  }
   return used;
 }
 
@@ -3035,6 +3155,12 @@ void Client::check_caps(Inode *in, bool is_delayed)
   if (in->caps.empty())
     return;   // guard if at end of func
 
+  if (!in->is_dir() && in->async_creates_unacked) {
+    // the mds doesn't know this inode yet; we'll check again on its reply
+    ldout(cct, 10) << "check_caps async create not yet acked, deferring" << dendl;
+    return;
+  }
+
   if (!in->cap_snaps.empty())
     flush_snaps(in);
 
@@ -3346,8 +3472,10 @@ void Client::_invalidate_inode_cache(Inode *in)
   ldout(cct, 10) << "_invalidate_inode_cache " << *in << dendl;
 
   // invalidate our userspace inode cache
-  if (cct->_conf->client_oc)
+  if (cct->_conf->client_oc) {
+    Mutex::Locker l(objectcacher_lock);
     objectcacher->release_set(&in->oset);
+  }
 
   _schedule_invalidate_callback(in, 0, 0, false);
 }
@@ -3360,6 +3488,7 @@ void Client::_invalidate_inode_cache(Inode *in, int64_t off, int64_t len)
   if (cct->_conf->client_oc) {
     vector<ObjectExtent> ls;
     Striper::file_to_extents(cct, in->ino, &in->layout, off, len, in->truncate_size, ls);
+    Mutex::Locker l(objectcacher_lock);
     objectcacher->discard_set(&in->oset, ls);
   }
 
@@ -3374,11 +3503,17 @@ void Client::_release(Inode *in)
   }
 }
 
+/*
+ * onfinish is completed with client_lock held: here, or from
+ * objectcacher_finisher once the flush commits.
+ */
 bool Client::_flush(Inode *in, Context *onfinish)
 {
   ldout(cct, 10) << "_flush " << *in << dendl;
 
+  objectcacher_lock.Lock();
   if (!in->oset.dirty_or_tx) {
+    objectcacher_lock.Unlock();
     ldout(cct, 10) << " nothing to flush" << dendl;
     onfinish->complete(0);
     return true;
@@ -3387,19 +3522,24 @@ bool Client::_flush(Inode *in, Context *onfinish)
   if (objecter->osdmap_pool_full(in->layout.fl_pg_pool)) {
     ldout(cct, 1) << __func__ << ": FULL, purging for ENOSPC" << dendl;
     objectcacher->purge_set(&in->oset);
+    objectcacher_lock.Unlock();
     if (onfinish) {
       onfinish->complete(-ENOSPC);
     }
     return true;
   }
 
-  return objectcacher->flush_set(&in->oset, onfinish);
+  bool ret = objectcacher->flush_set(&in->oset, _oc_callback(onfinish));
+  objectcacher_lock.Unlock();
+  return ret;
 }
 
 void Client::_flush_range(Inode *in, int64_t offset, uint64_t size)
 {
   assert(client_lock.is_locked());
+  objectcacher_lock.Lock();
   if (!in->oset.dirty_or_tx) {
+    objectcacher_lock.Unlock();
     ldout(cct, 10) << " nothing to flush" << dendl;
     return;
   }
@@ -3410,6 +3550,7 @@ void Client::_flush_range(Inode *in, int64_t offset, uint64_t size)
   Context *onflush = new C_SafeCond(&flock, &cond, &safe);
   bool ret = objectcacher->file_flush(&in->oset, &in->layout, in->snaprealm->get_snap_context(),
 				      offset, size, onflush);
+  objectcacher_lock.Unlock();
   if (!ret) {
     // wait for flush
     client_lock.Unlock();
@@ -3421,13 +3562,48 @@ void Client::_flush_range(Inode *in, int64_t offset, uint64_t size)
   }
 }
 
+class C_Client_Flushed : public Context {
+  Client *client;
+  Inode *in;
+public:
+  C_Client_Flushed(Client *c, Inode *i) : client(c), in(i) {}
+  void finish(int r) {
+    assert(client->client_lock.is_locked_by_me());
+    client->_flushed(in);
+  }
+};
+
+class C_Client_OCCallback : public Context {
+  Client *client;
+  Context *fin;
+public:
+  C_Client_OCCallback(Client *c, Context *f) : client(c), fin(f) {}
+  ~C_Client_OCCallback() {
+    delete fin;
+  }
+  void finish(int r) {
+    client->objectcacher_finisher.queue(new C_Lock(&client->client_lock, fin), r);
+    fin = NULL;
+  }
+};
+
+/*
+ * wrap a Context the objectcacher completes (with objectcacher_lock
+ * held) so that it runs with client_lock instead.  deleting the wrapper
+ * unused deletes c.
+ */
+Context *Client::_oc_callback(Context *c)
+{
+  return new C_Client_OCCallback(this, c);
+}
+
 void Client::flush_set_callback(ObjectCacher::ObjectSet *oset)
 {
-  //  Mutex::Locker l(client_lock);
-  assert(client_lock.is_locked());   // will be called via dispatch() -> objecter -> ...
+  assert(objectcacher_lock.is_locked_by_me());
   Inode *in = static_cast<Inode *>(oset->parent);
   assert(in);
-  _flushed(in);
+  // the FILE_BUFFER ref this drops keeps in around until then
+  _oc_callback(new C_Client_Flushed(this, in))->complete(0);
 }
 
 void Client::_flushed(Inode *in)
@@ -3515,6 +3691,11 @@ void Client::add_update_cap(Inode *in, MetaSession *mds_session, uint64_t cap_id
     }
   }
 
+  if (cap->cap_id == 0 && cap_id) {
+    // assumed by _async_create; the mds' grant is authoritative
+    cap->issued = cap->implemented = 0;
+  }
+
   unsigned old_caps = cap->issued;
   cap->cap_id = cap_id;
   cap->issued |= issued;
@@ -4477,6 +4658,8 @@ void Client::handle_cap_grant(MetaSession *session, Inode *in, Cap *cap, MClient
 		<< " was " << ccap_string(old_caps) << dendl;
   cap->seq = m->get_seq();
 
+  if (in->is_dir() && memcmp(&in->layout, &m->get_layout(), sizeof(in->layout)))
+    _layout_policy_changed(in);
   in->layout = m->get_layout();
 
   // update inode
@@ -4501,6 +4684,8 @@ void Client::handle_cap_grant(MetaSession *session, Inode *in, Cap *cap, MClient
       m->head.xattr_version > in->xattr_version) {
     bufferlist::iterator p = m->xattrbl.begin();
     ::decode(in->xattrs, p);
+    if (in->is_dir())
+      _layout_policy_changed(in);
     in->xattr_version = m->head.xattr_version;
   }
   update_inode_file_bits(in, m->get_truncate_seq(), m->get_truncate_size(), m->get_size(),
@@ -5772,6 +5957,70 @@ int Client::lstat(const char *relpath, struct stat *stbuf,
   return r;
 }
 
+/*
+ * lstat, but only the fields in buf->st_litemask (S_STATLITE_*) need to
+ * be current; the base fields always are.  When the caps we hold from
+ * readdir cover those, this avoids the getattr round trip lstat would
+ * make, e.g. for the size of a file another client is writing.  On
+ * return st_litemask has the optional fields that are valid.
+ */
+int Client::lstatlite(const char *relpath, struct statlite *buf)
+{
+  ldout(cct, 3) << "lstatlite enter (relpath " << relpath << " litemask "
+		<< buf->st_litemask << ")" << dendl;
+  Mutex::Locker lock(client_lock);
+  tout(cct) << "lstatlite" << std::endl;
+  tout(cct) << relpath << std::endl;
+  filepath path(relpath);
+  Inode *in;
+  int r = path_walk(path, &in, false);
+  if (r < 0)
+    return r;
+
+  int mask = CEPH_STAT_CAP_INODE | CEPH_STAT_CAP_MODE | CEPH_STAT_CAP_UID |
+    CEPH_STAT_CAP_GID | CEPH_STAT_CAP_NLINK;
+  if (S_ISVALIDSIZE(buf->st_litemask) || S_ISVALIDBLOCKS(buf->st_litemask))
+    mask |= CEPH_STAT_CAP_SIZE;
+  if (S_ISVALIDMTIME(buf->st_litemask) || S_ISVALIDCTIME(buf->st_litemask))
+    mask |= CEPH_STAT_CAP_MTIME;
+  if (S_ISVALIDATIME(buf->st_litemask))
+    mask |= CEPH_STAT_CAP_ATIME;
+  r = _getattr(in, mask);
+  if (r < 0) {
+    ldout(cct, 3) << "lstatlite exit on error!" << dendl;
+    return r;
+  }
+
+  struct stat st;
+  int issued = fill_stat(in, &st);
+  buf->st_dev = st.st_dev;
+  buf->st_ino = st.st_ino;
+  buf->st_mode = st.st_mode;
+  buf->st_nlink = st.st_nlink;
+  buf->st_uid = st.st_uid;
+  buf->st_gid = st.st_gid;
+  buf->st_rdev = st.st_rdev;
+  buf->st_size = st.st_size;
+  buf->st_blksize = st.st_blksize;
+  buf->st_blocks = st.st_blocks;
+  buf->st_atim.tv_sec = stat_get_atime_sec(&st);
+  buf->st_atim.tv_nsec = stat_get_atime_nsec(&st);
+  buf->st_mtim.tv_sec = stat_get_mtime_sec(&st);
+  buf->st_mtim.tv_nsec = stat_get_mtime_nsec(&st);
+  buf->st_ctim.tv_sec = stat_get_ctime_sec(&st);
+  buf->st_ctim.tv_nsec = stat_get_ctime_nsec(&st);
+
+  // anything we hold Fs for is current, asked for or not
+  int litemask = buf->st_litemask | S_STATLITE_BLKSIZE;
+  if ((issued & CEPH_CAP_FILE_SHARED) || in->is_dir())
+    litemask |= S_STATLITE_SIZE | S_STATLITE_BLOCKS | S_STATLITE_ATIME |
+      S_STATLITE_MTIME | S_STATLITE_CTIME;
+  buf->st_litemask = litemask;
+  ldout(cct, 3) << "lstatlite exit (relpath " << relpath << " litemask "
+		<< litemask << ")" << dendl;
+  return 0;
+}
+
 int Client::fill_stat(Inode *in, struct stat *st, frag_info_t *dirstat, nest_info_t *rstat)
 {
   ldout(cct, 10) << "fill_stat on " << in->ino << " snap/dev" << in->snapid
@@ -6043,6 +6292,7 @@ void Client::_closedir(dir_result_t *dirp)
     dirp->inode = 0;
   }
   _readdir_drop_dirp_buffer(dirp);
+  _readdir_drop_prefetch(dirp);
   delete dirp;
 }
 
@@ -6053,6 +6303,7 @@ void Client::rewinddir(dir_result_t *dirp)
   ldout(cct, 3) << "rewinddir(" << dirp << ")" << dendl;
   dir_result_t *d = static_cast<dir_result_t*>(dirp);
   _readdir_drop_dirp_buffer(d);
+  _readdir_drop_prefetch(d);
   d->reset();
 }
  
@@ -6074,6 +6325,7 @@ void Client::seekdir(dir_result_t *dirp, loff_t offset)
       dir_result_t::fpos_frag(offset) != d->frag() ||
       dir_result_t::fpos_off(offset) < d->fragpos()) {
     _readdir_drop_dirp_buffer(d);
+    _readdir_drop_prefetch(d);
     d->reset();
   }
 
@@ -6112,6 +6364,18 @@ void Client::fill_dirent(struct dirent *de, const char *name, int type, uint64_t
 #endif
 }
 
+/*
+ * a new listing of a frag may come back in dentry key order (see
+ * Server::_readdir_should_stream); the rest of it must be asked for in
+ * the same order.
+ */
+static int readdir_flags(const string& start, bool key_order)
+{
+  if (start.empty() || key_order)
+    return CEPH_MDS_FLAG_READDIR_KEY_ORDER;
+  return 0;
+}
+
 void Client::_readdir_next_frag(dir_result_t *dirp)
 {
   frag_t fg = dirp->frag();
@@ -6166,27 +6430,60 @@ int Client::_readdir_get_frag(dir_result_t *dirp)
 
   Inode *diri = dirp->inode;
 
-  MetaRequest *req = new MetaRequest(op);
-  filepath path;
-  diri->make_nosnap_relative_path(path);
-  req->set_filepath(path); 
-  req->set_inode(diri);
-  req->head.args.readdir.frag = fg;
-  if (dirp->last_name.length()) {
-    req->path2.set_path(dirp->last_name.c_str());
-    req->readdir_start = dirp->last_name;
+  // did we already ask for this chunk?
+  MetaRequest *req = _readdir_take_prefetch(dirp, fg, dirp->last_name,
+					    dirp->next_offset, dirp->key_order);
+  int res;
+  if (req) {
+    while (!req->readdir_done)
+      wait_on_list(req->waitfor_safe);
+    dirp->prefetch.remove(req);
+    req->readdir_dirp = NULL;
+    res = req->readdir_r;
+    if (res < 0) {
+      // start over with a plain request; anything fetched past this
+      // point has landed out of order.
+      ldout(cct, 10) << "_readdir_get_frag prefetch got " << res
+		     << ", refetching" << dendl;
+      _readdir_put_prefetch(req);
+      _readdir_drop_prefetch(dirp);
+      if (diri->dir)
+	diri->dir->ordered_count++;
+      req = NULL;
+    } else {
+      logger->inc(l_c_readdir_prefetch);
+    }
   }
-  req->readdir_offset = dirp->next_offset;
-  req->readdir_frag = fg;
+
+  bool prefetched = (req != NULL);
+  if (!req) {
+    _readdir_drop_prefetch(dirp);
+
+    req = new MetaRequest(op);
+    filepath path;
+    diri->make_nosnap_relative_path(path);
+    req->set_filepath(path); 
+    req->set_inode(diri);
+    req->head.args.readdir.frag = fg;
+    if (dirp->last_name.length()) {
+      req->path2.set_path(dirp->last_name.c_str());
+      req->readdir_start = dirp->last_name;
+    }
+    if (op == CEPH_MDS_OP_READDIR)
+      req->head.flags = req->head.flags |
+	readdir_flags(dirp->last_name, dirp->key_order);
+    req->readdir_offset = dirp->next_offset;
+    req->readdir_frag = fg;
   
   
-  bufferlist dirbl;
-  int res = make_request(req, -1, -1, NULL, NULL, -1, &dirbl);
+    bufferlist dirbl;
+    res = make_request(req, -1, -1, NULL, NULL, -1, &dirbl);
   
-  if (res == -EAGAIN) {
-    ldout(cct, 10) << "_readdir_get_frag got EAGAIN, retrying" << dendl;
-    _readdir_rechoose_frag(dirp);
-    return _readdir_get_frag(dirp);
+    if (res == -EAGAIN) {
+      ldout(cct, 10) << "_readdir_get_frag got EAGAIN, retrying" << dendl;
+      _readdir_rechoose_frag(dirp);
+      return _readdir_get_frag(dirp);
+    }
   }
 
   if (res == 0) {
@@ -6214,12 +6511,14 @@ int Client::_readdir_get_frag(dir_result_t *dirp)
 
     if (req->readdir_end) {
       dirp->last_name.clear();
+      dirp->key_order = false;
       if (fg.is_rightmost())
 	dirp->next_offset = 2;
       else
 	dirp->next_offset = 0;
     } else {
       dirp->last_name = req->readdir_last_name;
+      dirp->key_order = req->readdir_key_order;
       dirp->next_offset += req->readdir_num;
     }
   } else {
@@ -6227,9 +6526,235 @@ int Client::_readdir_get_frag(dir_result_t *dirp)
     dirp->set_end();
   }
 
+  if (prefetched)
+    put_request(req);
+  if (res == 0)
+    _readdir_prefetch(dirp);
   return res;
 }
 
+/*
+ * Readdir prefetch
+ *
+ * A huge directory comes back from the mds one chunk at a time.
+ * Rather than wait for each chunk until the reader gets to it, keep up
+ * to client_readdir_prefetch chunks requested ahead.  The chunks of one
+ * frag have to be fetched in order (each starts after the last name of
+ * the one before), but frags are independent, so while a frag's next
+ * chunk is in flight we fetch ahead in the frags after it.  Replies are
+ * installed into the cache as they arrive, like any other readdir.
+ */
+bool Client::_readdir_send_prefetch(dir_result_t *dirp, frag_t fg,
+				    const string& start, uint64_t offset,
+				    bool key_order)
+{
+  Inode *diri = dirp->inode;
+  if (diri->async_creates_unacked)
+    return false;  // make_request() would wait for those first
+
+  MetaRequest *req = new MetaRequest(CEPH_MDS_OP_READDIR);
+  filepath path;
+  diri->make_nosnap_relative_path(path);
+  req->set_filepath(path);
+  req->set_inode(diri);
+  req->head.args.readdir.frag = fg;
+  if (start.length()) {
+    req->path2.set_path(start.c_str());
+    req->readdir_start = start;
+  }
+  req->head.flags = req->head.flags | readdir_flags(start, key_order);
+  req->readdir_offset = offset;
+  req->readdir_frag = fg;
+
+  // only bother when we can send it right away
+  mds_rank_t mds = choose_target_mds(req);
+  if (mds < 0 || !mdsmap->is_active_or_stopping(mds) ||
+      !have_open_session(mds)) {
+    put_request(req);
+    return false;
+  }
+
+  req->async = true;
+  req->readdir_dirp = dirp;
+  ceph_tid_t tid = ++last_tid;
+  req->set_tid(tid);
+  req->op_stamp = ceph_clock_now(NULL);
+  mds_requests[tid] = req->get();
+  if (oldest_tid == 0)
+    oldest_tid = tid;
+  req->set_caller_uid(geteuid());
+  req->set_caller_gid(getegid());
+  req->set_oldest_client_tid(oldest_tid);
+  dirp->prefetch.push_back(req);  // the list holds our ref
+  ldout(cct, 10) << "_readdir_send_prefetch " << dirp << " fg " << fg
+		 << " start '" << start << "' offset " << offset
+		 << " tid " << tid << dendl;
+  send_request(req, mds_sessions[mds]);
+  return true;
+}
+
+MetaRequest *Client::_readdir_find_prefetch(dir_result_t *dirp, frag_t fg,
+					    const string& start, uint64_t offset,
+					    bool key_order)
+{
+  int flags = readdir_flags(start, key_order);
+  for (list<MetaRequest*>::iterator p = dirp->prefetch.begin();
+       p != dirp->prefetch.end();
+       ++p) {
+    MetaRequest *req = *p;
+    if (req->readdir_frag == fg && req->readdir_offset == offset &&
+	req->readdir_start == start &&
+	(int)(req->head.flags & CEPH_MDS_FLAG_READDIR_KEY_ORDER) == flags)
+      return req;
+  }
+  return NULL;
+}
+
+static bool readdir_pos_before(MetaRequest *a, MetaRequest *b)
+{
+  if (a->readdir_frag.value() != b->readdir_frag.value())
+    return a->readdir_frag.value() < b->readdir_frag.value();
+  return a->readdir_offset < b->readdir_offset;
+}
+
+/*
+ * find the prefetch for the reader's position (if any), and forget
+ * those for positions it has moved past.  it stays on the list until
+ * the reader has its reply, so the walk in _readdir_prefetch can see
+ * it.
+ */
+MetaRequest *Client::_readdir_take_prefetch(dir_result_t *dirp, frag_t fg,
+					    const string& start, uint64_t offset,
+					    bool key_order)
+{
+  MetaRequest *req = _readdir_find_prefetch(dirp, fg, start, offset, key_order);
+  if (!req)
+    return NULL;
+  for (list<MetaRequest*>::iterator p = dirp->prefetch.begin();
+       p != dirp->prefetch.end(); ) {
+    MetaRequest *other = *p;
+    if (other != req && readdir_pos_before(other, req)) {
+      dirp->prefetch.erase(p++);
+      other->readdir_dirp = NULL;
+      _readdir_put_prefetch(other);
+    } else {
+      ++p;
+    }
+  }
+  return req;
+}
+
+void Client::_readdir_put_prefetch(MetaRequest *req)
+{
+  if (req->readdir_done) {
+    for (unsigned i = 0; i < req->readdir_result.size(); i++)
+      put_inode(req->readdir_result[i].second);
+    req->readdir_result.clear();
+  }
+  put_request(req);
+}
+
+void Client::_readdir_drop_prefetch(dir_result_t *dirp)
+{
+  if (dirp->prefetch.empty())
+    return;
+  ldout(cct, 10) << "_readdir_drop_prefetch " << dirp << " dropping "
+		 << dirp->prefetch.size() << dendl;
+  while (!dirp->prefetch.empty()) {
+    MetaRequest *req = dirp->prefetch.front();
+    dirp->prefetch.pop_front();
+    req->readdir_dirp = NULL;
+    _readdir_put_prefetch(req);
+  }
+}
+
+void Client::_readdir_prefetch(dir_result_t *dirp)
+{
+  int max = cct->_conf->client_readdir_prefetch;
+  Inode *diri = dirp->inode;
+  if (max <= 0 || !diri || diri->snapid == CEPH_SNAPDIR ||
+      dirp->at_end() || !dirp->buffer)
+    return;
+
+  // walk forward from the chunk the reader holds
+  frag_t fg = dirp->buffer_frag;
+  string start = dirp->last_name;
+  uint64_t offset = dirp->next_offset;
+  bool key_order = dirp->key_order;
+  bool frag_end = start.empty();
+  for (int n = 0; n < max; n++) {
+    if (frag_end) {
+      if (fg.is_rightmost())
+	break;
+      fg = diri->dirfragtree[fg.next().value()];
+      start.clear();
+      offset = 0;
+      key_order = false;
+    }
+    MetaRequest *req = _readdir_find_prefetch(dirp, fg, start, offset, key_order);
+    if (!req) {
+      if (!_readdir_send_prefetch(dirp, fg, start, offset, key_order))
+	break;
+      req = dirp->prefetch.back();
+    }
+    if (!req->readdir_done) {
+      // where this frag goes next isn't known yet
+      frag_end = true;
+      continue;
+    }
+    if (req->readdir_r < 0 || req->readdir_reply_frag != fg)
+      break;  // let the reader sort it out
+    if (req->readdir_end) {
+      frag_end = true;
+    } else {
+      start = req->readdir_last_name;
+      offset += req->readdir_num;
+      key_order = req->readdir_key_order;
+      frag_end = false;
+    }
+  }
+}
+
+void Client::_readdir_prefetch_reply(MetaRequest *req, int r)
+{
+  ldout(cct, 10) << "_readdir_prefetch_reply tid " << req->get_tid()
+		 << " r=" << r << " " << req->readdir_result.size()
+		 << " entries" << dendl;
+  req->readdir_done = true;
+  req->readdir_r = r;
+
+  dir_result_t *dirp = req->readdir_dirp;
+  Inode *diri = req->inode();
+  if (r == 0 && diri->dir) {
+    // the cache's dentry list is only in readdir order if chunks were
+    // inserted in order.
+    bool ordered = (dirp != NULL);
+    if (dirp) {
+      for (list<MetaRequest*>::iterator p = dirp->prefetch.begin();
+	   p != dirp->prefetch.end();
+	   ++p) {
+	if (!(*p)->readdir_done && readdir_pos_before(*p, req)) {
+	  ordered = false;
+	  break;
+	}
+      }
+    }
+    if (!ordered)
+      diri->dir->ordered_count++;
+  }
+
+  if (!dirp) {
+    // nobody wants it any more
+    for (unsigned i = 0; i < req->readdir_result.size(); i++)
+      put_inode(req->readdir_result[i].second);
+    req->readdir_result.clear();
+  }
+  signal_cond_list(req->waitfor_safe);
+
+  if (dirp && r == 0)
+    _readdir_prefetch(dirp);
+}
+
 int Client::_readdir_cache_cb(dir_result_t *dirp, add_dirent_cb_t cb, void *p)
 {
   assert(client_lock.is_locked());
@@ -6385,7 +6910,9 @@ int Client::readdir_r_cb(dir_result_t *d, add_dirent_cb_t cb, void *p)
       return err;
   }
   if (dirp->at_cache_name.length()) {
+    // go on from the mds in the order the cache was listed in
     dirp->last_name = dirp->at_cache_name;
+    dirp->key_order = diri->dir && diri->dir->key_order_frags.count(dirp->frag());
     dirp->at_cache_name.clear();
   }
 
@@ -6871,6 +7398,8 @@ Fh *Client::_create_fh(Inode *in, int flags, int cmode)
   alignments.push_back(p);
   alignments.push_back(in->layout.fl_stripe_unit);
   f->readahead.set_alignments(alignments);
+  f->readahead.set_max_streams(conf->client_readahead_streams);
+  f->readahead.set_stride_detection(conf->client_readahead_stride);
 
   return f;
 }
@@ -6881,14 +7410,28 @@ int Client::_release_fh(Fh *f)
   //ldout(cct, 3) << "op: open_files.erase( " << fh << " );" << dendl;
   Inode *in = f->inode;
   ldout(cct, 5) << "_release_fh " << f << " mode " << f->mode << " on " << *in << dendl;
+  vector<Readahead::stream_stat_t> streams;
+  f->readahead.get_stream_stats(&streams);
+  for (vector<Readahead::stream_stat_t>::iterator p = streams.begin();
+       p != streams.end();
+       ++p)
+    ldout(cct, 10) << "_release_fh " << f << " readahead stream at " << p->pos
+		   << " stride " << p->stride << " reads " << p->reads
+		   << " readahead " << p->readahead_requests << " requests "
+		   << p->readahead_bytes << " bytes" << dendl;
 
   if (in->snapid == CEPH_NOSNAP) {
     if (in->put_open_ref(f->mode)) {
       _flush(in, new C_Client_FlushComplete(this, in));
       // release clean pages too, if we dont want RDCACHE
+      bool cached;
+      {
+	Mutex::Locker l(objectcacher_lock);
+	cached = !objectcacher->set_is_empty(&in->oset);
+      }
       if (in->cap_refs[CEPH_CAP_FILE_CACHE] == 0 &&
 	  !(in->caps_wanted() & CEPH_CAP_FILE_CACHE) &&
-	  !objectcacher->set_is_empty(&in->oset))
+	  cached)
 	_invalidate_inode_cache(in);
       else
 	check_caps(in, false);
@@ -7113,22 +7656,28 @@ int Client::uninline_data(Inode *in, Context *onfinish)
 
 int Client::read(int fd, char *buf, loff_t size, loff_t offset)
 {
-  Mutex::Locker lock(client_lock);
-  tout(cct) << "read" << std::endl;
-  tout(cct) << fd << std::endl;
-  tout(cct) << size << std::endl;
-  tout(cct) << offset << std::endl;
+  bufferlist bl;
+  int r;
+  {
+    Mutex::Locker lock(client_lock);
+    tout(cct) << "read" << std::endl;
+    tout(cct) << fd << std::endl;
+    tout(cct) << size << std::endl;
+    tout(cct) << offset << std::endl;
 
-  Fh *f = get_filehandle(fd);
-  if (!f)
-    return -EBADF;
+    Fh *f = get_filehandle(fd);
+    if (!f)
+      return -EBADF;
 #if defined(__linux__) && defined(O_PATH)
-  if (f->flags & O_PATH)
-    return -EBADF;
+    if (f->flags & O_PATH)
+      return -EBADF;
 #endif
-  bufferlist bl;
-  int r = _read(f, offset, size, &bl);
-  ldout(cct, 3) << "read(" << fd << ", " << (void*)buf << ", " << size << ", " << offset << ") = " << r << dendl;
+    r = _read(f, offset, size, &bl);
+    ldout(cct, 3) << "read(" << fd << ", " << (void*)buf << ", " << size << ", " << offset << ") = " << r << dendl;
+  }
+
+  // bl holds its own references to the data; copy out to the caller
+  // without client_lock so other threads' I/O isn't serialized behind it
   if (r >= 0) {
     bl.copy(0, bl.length(), buf);
     r = bl.length();
@@ -7270,12 +7819,14 @@ done:
 }
 
 Client::C_Readahead::C_Readahead(Client *c, Fh *f) :
-  client(c), f(f) {
+  client(c), f(f), start(ceph_clock_now(c->cct)) {
     f->get();
 }
 
 void Client::C_Readahead::finish(int r) {
   lgeneric_subdout(client->cct, client, 20) << "client." << client->get_nodeid() << " " << "C_Readahead on " << f->inode << dendl;
+  if (r >= 0)
+    f->readahead.record_latency(ceph_clock_now(client->cct) - start);
   client->put_cap_ref(f->inode, CEPH_CAP_FILE_RD | CEPH_CAP_FILE_CACHE);
   f->readahead.dec_pending();
   client->_put_fh(f);
@@ -7306,8 +7857,14 @@ int Client::_read_async(Fh *f, uint64_t off, uint64_t len, bufferlist *bl)
   Cond cond;
   bool done = false;
   Context *onfinish = new C_SafeCond(&flock, &cond, &done, &rvalue);
+  // our FILE_RD|FILE_CACHE refs keep the cache and layout in place while
+  // we look in the cacher without client_lock
+  objectcacher_lock.Lock();
+  client_lock.Unlock();
   r = objectcacher->file_read(&in->oset, &in->layout, in->snapid,
 			      off, len, bl, 0, onfinish);
+  objectcacher_lock.Unlock();
+  client_lock.Lock();
   if (r == 0) {
     get_cap_ref(in, CEPH_CAP_FILE_CACHE);
     client_lock.Unlock();
@@ -7324,18 +7881,27 @@ int Client::_read_async(Fh *f, uint64_t off, uint64_t len, bufferlist *bl)
   }
 
   if(conf->client_readahead_max_bytes > 0) {
-    pair<uint64_t, uint64_t> readahead_extent = f->readahead.update(off, len, in->size);
-    if (readahead_extent.second > 0) {
-      ldout(cct, 20) << "readahead " << readahead_extent.first << "~" << readahead_extent.second
+    vector<pair<uint64_t, uint64_t> > reads(1, make_pair(off, len));
+    vector<pair<uint64_t, uint64_t> > readahead;
+    f->readahead.update(reads, in->size, &readahead);
+    for (vector<pair<uint64_t, uint64_t> >::iterator p = readahead.begin();
+	 p != readahead.end();
+	 ++p) {
+      ldout(cct, 20) << "readahead " << p->first << "~" << p->second
 		     << " (caller wants " << off << "~" << len << ")" << dendl;
-      Context *onfinish2 = new C_Readahead(this, f);
+      // C_Readahead runs once we drop client_lock: after the refs below
+      Context *onfinish2 = _oc_callback(new C_Readahead(this, f));
       f->readahead.inc_pending();
+      objectcacher_lock.Lock();
       int r2 = objectcacher->file_read(&in->oset, &in->layout, in->snapid,
-				       readahead_extent.first, readahead_extent.second,
+				       p->first, p->second,
 				       NULL, 0, onfinish2);
+      objectcacher_lock.Unlock();
       if (r2 == 0) {
 	ldout(cct, 20) << "readahead initiated, c " << onfinish2 << dendl;
 	get_cap_ref(in, CEPH_CAP_FILE_RD | CEPH_CAP_FILE_CACHE);
+	logger->inc(l_c_readahead);
+	logger->inc(l_c_readahead_bytes, p->second);
       } else {
 	f->readahead.dec_pending();
 	ldout(cct, 20) << "readahead was no-op, already cached" << dendl;
@@ -7451,8 +8017,29 @@ void Client::sync_write_commit(Inode *in)
   put_inode(in);
 }
 
+/*
+ * Copy the caller's data into a fresh buffer (our write may be resubmitted
+ * or completed asynchronously).  This is done before taking client_lock.
+ */
+static void build_write_buffer(const char *buf, const struct iovec *iov,
+			       int iovcnt, int64_t size, bufferlist &bl)
+{
+  if (buf) {
+    if (size > 0)
+      bl.append(buffer::copy(buf, size));
+  } else if (iov) {
+    for (int i = 0; i < iovcnt; i++) {
+      if (iov[i].iov_len > 0)
+	bl.append(buffer::copy((char*)iov[i].iov_base, iov[i].iov_len));
+    }
+  }
+}
+
 int Client::write(int fd, const char *buf, loff_t size, loff_t offset) 
 {
+  bufferlist bl;
+  build_write_buffer(buf, NULL, 0, size, bl);
+
   Mutex::Locker lock(client_lock);
   tout(cct) << "write" << std::endl;
   tout(cct) << fd << std::endl;
@@ -7466,7 +8053,7 @@ int Client::write(int fd, const char *buf, loff_t size, loff_t offset)
   if (fh->flags & O_PATH)
     return -EBADF;
 #endif
-  int r = _write(fh, offset, size, buf, NULL, 0);
+  int r = _write(fh, offset, size, bl);
   ldout(cct, 3) << "write(" << fd << ", \"...\", " << size << ", " << offset << ") = " << r << dendl;
   return r;
 }
@@ -7480,50 +8067,59 @@ int Client::pwritev(int fd, const struct iovec *iov, int iovcnt, int64_t offset)
 
 int Client::_preadv_pwritev(int fd, const struct iovec *iov, unsigned iovcnt, int64_t offset, bool write)
 {
-    Mutex::Locker lock(client_lock);
-    tout(cct) << fd << std::endl;
-    tout(cct) << offset << std::endl;
-
-    Fh *fh = get_filehandle(fd);
-    if (!fh)
-        return -EBADF;
-#if defined(__linux__) && defined(O_PATH)
-    if (fh->flags & O_PATH)
-        return -EBADF;
-#endif
     loff_t totallen = 0;
     for (unsigned i = 0; i < iovcnt; i++) {
         totallen += iov[i].iov_len;
     }
-    if (write) {
-        int w = _write(fh, offset, totallen, NULL, iov, iovcnt);
-        ldout(cct, 3) << "pwritev(" << fd << ", \"...\", " << totallen << ", " << offset << ") = " << w << dendl;
-        return w;
-    } else {
-        bufferlist bl;
-        int r = _read(fh, offset, totallen, &bl);
-        ldout(cct, 3) << "preadv(" << fd << ", " <<  offset << ") = " << r << dendl;
-        int bufoff = 0;
-        for (unsigned j = 0, resid = r; j < iovcnt && resid > 0; j++) {
-               /*
-                * This piece of code aims to handle the case that bufferlist does not have enough data 
-                * to fill in the iov 
-                */
-               if (resid < iov[j].iov_len) {
-                    bl.copy(bufoff, resid, (char *)iov[j].iov_base);
-                    break;
-               } else {
-                    bl.copy(bufoff, iov[j].iov_len, (char *)iov[j].iov_base);
-               }
-               resid -= iov[j].iov_len;
-               bufoff += iov[j].iov_len;
+    bufferlist bl;
+    if (write)
+        build_write_buffer(NULL, iov, iovcnt, totallen, bl);
+
+    int r;
+    {
+        Mutex::Locker lock(client_lock);
+        tout(cct) << fd << std::endl;
+        tout(cct) << offset << std::endl;
+
+        Fh *fh = get_filehandle(fd);
+        if (!fh)
+            return -EBADF;
+#if defined(__linux__) && defined(O_PATH)
+        if (fh->flags & O_PATH)
+            return -EBADF;
+#endif
+        if (write) {
+            int w = _write(fh, offset, totallen, bl);
+            ldout(cct, 3) << "pwritev(" << fd << ", \"...\", " << totallen << ", " << offset << ") = " << w << dendl;
+            return w;
         }
-        return r;  
+        r = _read(fh, offset, totallen, &bl);
+        ldout(cct, 3) << "preadv(" << fd << ", " <<  offset << ") = " << r << dendl;
+    }
+
+    if (r < 0)
+        return r;
+
+    // scatter into the caller's iovecs without client_lock
+    int bufoff = 0;
+    for (unsigned j = 0, resid = r; j < iovcnt && resid > 0; j++) {
+           /*
+            * This piece of code aims to handle the case that bufferlist does not have enough data 
+            * to fill in the iov 
+            */
+           if (resid < iov[j].iov_len) {
+                bl.copy(bufoff, resid, (char *)iov[j].iov_base);
+                break;
+           } else {
+                bl.copy(bufoff, iov[j].iov_len, (char *)iov[j].iov_base);
+           }
+           resid -= iov[j].iov_len;
+           bufoff += iov[j].iov_len;
     }
+    return r;  
 }
 
-int Client::_write(Fh *f, int64_t offset, uint64_t size, const char *buf,
-                  const struct iovec *iov, int iovcnt)
+int Client::_write(Fh *f, int64_t offset, uint64_t size, bufferlist& bl)
 {
   if ((uint64_t)(offset+size) > mdsmap->get_max_filesize()) //too large!
     return -EFBIG;
@@ -7574,24 +8170,6 @@ int Client::_write(Fh *f, int64_t offset, uint64_t size, const char *buf,
     assert(in->inline_version > 0);
   }
 
-  // copy into fresh buffer (since our write may be resub, async)
-  bufferlist bl;
-  bufferptr *bparr = NULL;
-  if (buf) {
-      bufferptr bp;
-      if (size > 0) bp = buffer::copy(buf, size);
-      bl.push_back( bp );
-  } else if (iov){
-      //iov case 
-      bparr = new bufferptr[iovcnt];
-      for (int i = 0; i < iovcnt; i++) {
-        if (iov[i].iov_len > 0) {
-            bparr[i] = buffer::copy((char*)iov[i].iov_base, iov[i].iov_len);
-        }
-        bl.push_back( bparr[i] );
-      }
-  }
-
   utime_t lat;
   uint64_t totalwritten;
   int have;
@@ -7639,15 +8217,23 @@ int Client::_write(Fh *f, int64_t offset, uint64_t size, const char *buf,
   }
 
   if (cct->_conf->client_oc && (have & CEPH_CAP_FILE_BUFFER)) {
-    // do buffered write
+    // do buffered write.  the ref taken when the set goes dirty is
+    // dropped by flush_set_callback when it is clean again, so test
+    // and dirty it under one hold of objectcacher_lock.
+    objectcacher_lock.Lock();
     if (!in->oset.dirty_or_tx)
       get_cap_ref(in, CEPH_CAP_FILE_CACHE | CEPH_CAP_FILE_BUFFER);
 
     get_cap_ref(in, CEPH_CAP_FILE_BUFFER);
+    SnapContext snapc = in->snaprealm->get_snap_context();
 
-    // async, caching, non-blocking.
-    r = objectcacher->file_write(&in->oset, &in->layout, in->snaprealm->get_snap_context(),
+    // async, caching; blocks only when there is too much dirty data,
+    // which we wait out without client_lock.
+    client_lock.Unlock();
+    r = objectcacher->file_write(&in->oset, &in->layout, snapc,
 			         offset, size, bl, ceph_clock_now(cct), 0);
+    objectcacher_lock.Unlock();
+    client_lock.Lock();
     put_cap_ref(in, CEPH_CAP_FILE_BUFFER);
 
     if (r < 0)
@@ -7738,7 +8324,6 @@ done:
   }
 
   put_cap_ref(in, CEPH_CAP_FILE_WR);
-  delete[] bparr; 
   return r;
 }
 
@@ -7849,6 +8434,14 @@ int Client::_fsync(Fh *f, bool syncdataonly)
     }
   }
 
+  while (in->async_create_req) {
+    MetaRequest *req = in->async_create_req;
+    ldout(cct, 15) << "waiting on async create, tid " << req->get_tid() << dendl;
+    req->get();
+    wait_on_list(req->waitfor_safe);
+    put_request(req);
+  }
+
   if (!in->unsafe_dir_ops.empty()) {
     MetaRequest *req = in->unsafe_dir_ops.back();
     uint64_t last_tid = req->get_tid();
@@ -8362,7 +8955,26 @@ int Client::_sync_fs()
 
   // wait for unsafe mds requests
   // FIXME
-  
+  // ...though at least for async creates, which have no waiting caller
+  ceph_tid_t last_async = 0;
+  for (map<ceph_tid_t, MetaRequest*>::iterator p = mds_requests.begin();
+       p != mds_requests.end();
+       ++p)
+    if (p->second->async)
+      last_async = p->first;
+  while (last_async) {
+    map<ceph_tid_t, MetaRequest*>::iterator p = mds_requests.begin();
+    while (p != mds_requests.end() && p->first <= last_async &&
+	   !p->second->async)
+      ++p;
+    if (p == mds_requests.end() || p->first > last_async)
+      break;
+    MetaRequest *req = p->second->get();
+    ldout(cct, 10) << "_sync_fs waiting on async create tid " << req->get_tid() << dendl;
+    wait_on_list(req->waitfor_safe);
+    put_request(req);
+  }
+
   // flush caps
   flush_caps();
   wait_sync_caps(last_flush_seq);
@@ -8382,6 +8994,7 @@ int Client::sync_fs()
 int64_t Client::drop_caches()
 {
   Mutex::Locker l(client_lock);
+  Mutex::Locker ocl(objectcacher_lock);
   return objectcacher->release_all();
 }
 
@@ -9387,6 +10000,15 @@ int Client::_create(Inode *dir, const char *name, int flags, mode_t mode,
       return -ERANGE;  // bummer!
   }
 
+  bool default_layout = !stripe_unit && !stripe_count && !object_size &&
+    pool_id < 0;
+  if (default_layout) {
+    MetaSession *session = _can_async_create(dir, name);
+    if (session)
+      return _async_create(dir, name, flags, mode, cmode, session, inp, fhp,
+			   created, uid, gid);
+  }
+
   MetaRequest *req = new MetaRequest(CEPH_MDS_OP_CREATE);
 
   filepath path;
@@ -9403,9 +10025,12 @@ int Client::_create(Inode *dir, const char *name, int flags, mode_t mode,
   req->head.args.open.pool = pool_id;
   req->dentry_drop = CEPH_CAP_FILE_SHARED;
   req->dentry_unless = CEPH_CAP_FILE_EXCL;
+  if (cct->_conf->client_async_create)
+    req->head.flags = req->head.flags | CEPH_MDS_FLAG_WANT_DELEG_INOS;
 
   bufferlist extra_bl;
   inodeno_t created_ino;
+  bool did_create = false;
 
   Dentry *de;
   int res = get_or_create(dir, name, &de);
@@ -9413,11 +10038,19 @@ int Client::_create(Inode *dir, const char *name, int flags, mode_t mode,
     goto fail;
   req->set_dentry(de);
 
-  res = make_request(req, uid, gid, inp, created);
+  res = make_request(req, uid, gid, inp, &did_create);
+  if (created)
+    *created = did_create;
   if (res < 0) {
     goto reply_error;
   }
 
+  // later creates here can assume the same layout
+  if (default_layout && did_create) {
+    dir->last_create_layout = (*inp)->layout;
+    dir->last_create_layout_gen = layout_policy_gen;
+  }
+
   /* If the caller passed a value in fhp, do the open */
   if(fhp) {
     (*inp)->get_open_ref(cmode);
@@ -9439,6 +10072,223 @@ int Client::_create(Inode *dir, const char *name, int flags, mode_t mode,
   return res;
 }
 
+/*
+ * We may create a file without waiting for the mds when
+ *  - we hold Fx on the dir, so no other client can add entries to it
+ *    without first revoking that, and its ack would queue behind our
+ *    create on the session;
+ *  - the dir is complete, so we know the name is free;
+ *  - the mds has delegated us inos to use; and
+ *  - a previous create here told us what layout the mds would pick,
+ *    and we haven't seen the policy it came from change since.
+ */
+MetaSession *Client::_can_async_create(Inode *dir, const char *name)
+{
+  if (!cct->_conf->client_async_create)
+    return NULL;
+  if (dir->snapid != CEPH_NOSNAP ||
+      !dir->auth_cap ||
+      !dir->caps_issued_mask(CEPH_CAP_FILE_EXCL))
+    return NULL;
+  MetaSession *session = dir->auth_cap->session;
+  if (session->state != MetaSession::STATE_OPEN ||
+      session->delegated_inos.empty())
+    return NULL;
+  if (!(dir->flags & I_COMPLETE))
+    return NULL;
+  if (dir->dir && dir->dir->dentries.count(name) &&
+      dir->dir->dentries[name]->inode)
+    return NULL;
+  if (!ceph_file_layout_is_valid(&dir->last_create_layout) ||
+      dir->last_create_layout_gen != layout_policy_gen ||
+      mdsmap->get_inline_data_enabled())
+    return NULL;
+  return session;
+}
+
+/*
+ * The layout policy of dir in, or its xattrs, changed.  The policy may
+ * be inherited by any dir below, so every last_create_layout is stale;
+ * the next create in each dir goes to the mds to learn it again.
+ */
+void Client::_layout_policy_changed(Inode *in)
+{
+  ldout(cct, 10) << "_layout_policy_changed " << *in << dendl;
+  memset(&in->last_create_layout, 0, sizeof(in->last_create_layout));
+  ++layout_policy_gen;
+}
+
+/*
+ * Create the inode and dentry locally, as Server::handle_client_openc
+ * would, with an ino the mds delegated to us and the caps it will
+ * issue for a new file, and send the create without waiting for it.
+ * Cap messages for the inode are held back, and requests naming it
+ * wait, until the mds replies (see wait_on_async_creates); fsync
+ * waits until the create is safe.  If the create fails the error is
+ * reported by fsync/close.
+ */
+int Client::_async_create(Inode *dir, const char *name, int flags,
+			  mode_t mode, int cmode, MetaSession *session,
+			  Inode **inp, Fh **fhp, bool *created, int uid, int gid)
+{
+  inodeno_t ino = session->delegated_inos.range_start();
+  session->delegated_inos.erase(ino);
+
+  if (uid < 0) {
+    uid = geteuid();
+    gid = getegid();
+  }
+  utime_t now = ceph_clock_now(cct);
+
+  vinodeno_t vino(ino, CEPH_NOSNAP);
+  Inode *in = new Inode(cct, vino, &dir->last_create_layout);
+  inode_map[vino] = in;
+  in->mode = S_IFREG | (mode & ~S_IFMT);
+  in->uid = uid;
+  in->gid = (dir->mode & S_ISGID) ? dir->gid : gid;
+  in->nlink = 1;
+  in->ctime = in->mtime = in->atime = now;
+  in->layout = dir->last_create_layout;
+  in->max_size = (uint64_t)in->layout.fl_object_size * in->layout.fl_stripe_count;
+  in->inline_version = CEPH_INLINE_NONE;
+  in->rstat.rfiles = 1;
+  add_update_cap(in, session, 0,
+		 CEPH_CAP_PIN | CEPH_CAP_AUTH_SHARED | CEPH_CAP_LINK_SHARED |
+		 CEPH_CAP_XATTR_SHARED | ceph_caps_for_mode(cmode),
+		 0, 0, dir->snaprealm->ino, CEPH_CAP_FLAG_AUTH);
+
+  Dir *d = dir->open_dir();
+  Dentry *dn = d->dentries.count(name) ? d->dentries[name] : NULL;
+  dn = link(d, name, in, dn);
+  d->ordered_count++;
+  dir->flags &= ~I_DIR_ORDERED;
+  dir->dirstat.nfiles++;
+  dir->mtime = dir->ctime = now;
+
+  MetaRequest *req = new MetaRequest(CEPH_MDS_OP_CREATE);
+  filepath path;
+  dir->make_nosnap_relative_path(path);
+  path.push_dentry(name);
+  req->set_filepath(path);
+  req->set_inode(dir);
+  req->set_dentry(dn);
+  req->head.ino = ino;
+  req->head.flags = req->head.flags | CEPH_MDS_FLAG_WANT_DELEG_INOS;
+  req->head.args.open.flags = flags | O_CREAT | O_EXCL;
+  req->head.args.open.mode = mode;
+  req->head.args.open.stripe_unit = in->layout.fl_stripe_unit;
+  req->head.args.open.stripe_count = in->layout.fl_stripe_count;
+  req->head.args.open.object_size = in->layout.fl_object_size;
+  req->head.args.open.pool = in->layout.fl_pg_pool;
+  req->dentry_drop = CEPH_CAP_FILE_SHARED;
+  req->dentry_unless = CEPH_CAP_FILE_EXCL;
+  req->async = true;
+  req->target = in;
+  in->get();  // until the create is safe
+  in->async_create_req = req->get();
+  in->async_creates_unacked++;
+  dir->async_creates_unacked++;
+
+  ceph_tid_t tid = ++last_tid;
+  req->set_tid(tid);
+  req->op_stamp = now;
+  mds_requests[tid] = req->get();
+  if (oldest_tid == 0)
+    oldest_tid = tid;
+  req->set_caller_uid(uid);
+  req->set_caller_gid(gid);
+  req->set_oldest_client_tid(oldest_tid);
+  send_request(req, session);
+  put_request(req);
+  logger->inc(l_c_async_create);
+
+  if (fhp) {
+    in->get_open_ref(cmode);
+    *fhp = _create_fh(in, flags, cmode);
+  }
+  if (inp)
+    *inp = in;
+  if (created)
+    *created = true;
+
+  ldout(cct, 3) << "_async_create(" << path << ", 0" << oct << mode << dec
+		<< ") = " << ino << " tid " << tid << dendl;
+  return 0;
+}
+
+/*
+ * completion for requests sent with req->async set; nobody is waiting
+ * on them in make_request().
+ */
+void Client::_async_reply(MetaRequest *req, int r, bool first, bool safe,
+			  Inode *traced)
+{
+  if (req->get_op() == CEPH_MDS_OP_READDIR)
+    _readdir_prefetch_reply(req, r);
+  else
+    _async_create_reply(req, r, first, safe, traced);
+}
+
+/*
+ * first is set for the first reply to an async create (or when it is
+ * abandoned), safe once it is committed (or abandoned).  traced is the
+ * inode the reply's trace named, if any.
+ */
+void Client::_async_create_reply(MetaRequest *req, int r, bool first, bool safe,
+				 Inode *traced)
+{
+  Inode *in = req->target;
+  Inode *dir = req->inode();
+  ldout(cct, 10) << "_async_create_reply tid " << req->get_tid() << " " << *in
+		 << " r=" << r << (first ? " first" : "") << (safe ? " safe" : "")
+		 << dendl;
+
+  if (first && r >= 0 && traced && traced->ino != in->ino) {
+    // the mds created the file, but not under the ino we gave it; what
+    // we set up and wrote under ours is not that file.
+    lderr(cct) << "async create of " << in->ino << " got ino " << traced->ino
+	       << " from the mds, failing it" << dendl;
+    r = -ESTALE;
+  }
+
+  if (safe && in->async_create_req == req) {
+    in->async_create_req = NULL;
+    signal_cond_list(req->waitfor_safe);
+    put_request(req);
+  }
+
+  if (first) {
+    in->async_creates_unacked--;
+    dir->async_creates_unacked--;
+    if (r < 0) {
+      ldout(cct, 1) << "async create of " << in->ino << " failed: "
+		    << cpp_strerror(r) << dendl;
+      in->async_err = r;
+      Dentry *dn = req->dentry();
+      if (dn && dn->inode == in)
+	unlink(dn, true, true);  // keep dir, dentry
+      if (dir->dir)
+	dir->dir->release_count++;
+      dir->flags &= ~(I_COMPLETE | I_DIR_ORDERED);
+      if (cct->_conf->client_oc) {
+	Mutex::Locker l(objectcacher_lock);
+	objectcacher->purge_set(&in->oset);
+      }
+      remove_all_caps(in);
+    } else {
+      // send whatever check_caps held back
+      check_caps(in, false);
+    }
+    signal_cond_list(in->waitfor_caps);
+    signal_cond_list(dir->waitfor_caps);
+  }
+
+  if (safe) {
+    req->target = NULL;
+    put_inode(in);
+  }
+}
+
 
 int Client::_mkdir(Inode *dir, const char *name, mode_t mode, int uid, int gid,
 		   Inode **inp)
@@ -10277,6 +11127,9 @@ int Client::ll_commit_blocks(Inode *in,
 
 int Client::ll_write(Fh *fh, loff_t off, loff_t len, const char *data)
 {
+  bufferlist bl;
+  build_write_buffer(data, NULL, 0, len, bl);
+
   Mutex::Locker lock(client_lock);
   ldout(cct, 3) << "ll_write " << fh << " " << fh->inode->ino << " " << off <<
     "~" << len << dendl;
@@ -10285,7 +11138,7 @@ int Client::ll_write(Fh *fh, loff_t off, loff_t len, const char *data)
   tout(cct) << off << std::endl;
   tout(cct) << len << std::endl;
 
-  int r = _write(fh, off, len, data, NULL, 0);
+  int r = _write(fh, off, len, bl);
   ldout(cct, 3) << "ll_write " << fh << " " << off << "~" << len << " = " << r
 		<< dendl;
   return r;
@@ -81,6 +81,10 @@ enum {
   l_c_reply,
   l_c_lat,
   l_c_wrlat,
+  l_c_async_create,
+  l_c_readdir_prefetch,
+  l_c_readahead,
+  l_c_readahead_bytes,
   l_c_last,
 };
 
@@ -174,6 +178,7 @@ struct dir_result_t {
   uint64_t this_offset;  // offset of last chunk, adjusted for . and ..
   uint64_t next_offset;  // offset of next chunk (last_name's + 1)
   string last_name;      // last entry in previous chunk
+  bool key_order;        // this frag is being listed in dentry key order
 
   uint64_t release_count;
   uint64_t ordered_count;
@@ -184,6 +189,8 @@ struct dir_result_t {
 
   string at_cache_name;  // last entry we successfully returned
 
+  list<MetaRequest*> prefetch;  // chunks requested ahead of the reader
+
   dir_result_t(Inode *in);
 
   frag_t frag() { return frag_t(offset >> SHIFT); }
@@ -205,6 +212,7 @@ struct dir_result_t {
 
   void reset() {
     last_name.clear();
+    key_order = false;
     at_cache_name.clear();
     next_offset = 2;
     this_offset = 0;
@@ -248,6 +256,7 @@ class Client : public Dispatcher, public md_config_obs_t {
   Finisher interrupt_finisher;
   Finisher remount_finisher;
   Finisher objecter_finisher;
+  Finisher objectcacher_finisher;  // runs objectcacher callbacks that need client_lock
 
   Context *tick_event;
   utime_t last_cap_renew;
@@ -295,6 +304,10 @@ public:
   ceph_tid_t last_flush_seq;
   map<ceph_tid_t, MetaRequest*> mds_requests;
 
+  // bumped when a layout policy (or the default data pool) that a
+  // dir's last_create_layout might have come from changes
+  uint64_t layout_policy_gen;
+
   void dump_mds_requests(Formatter *f);
   void dump_mds_sessions(Formatter *f);
 
@@ -304,6 +317,7 @@ public:
 		   int use_mds=-1, bufferlist *pdirbl=0);
   void put_request(MetaRequest *request);
   void unregister_request(MetaRequest *request);
+  void wait_on_async_creates(MetaRequest *request);
 
   int verify_reply_trace(int r, MetaRequest *request, MClientReply *reply,
 			 Inode **ptarget, bool *pcreated, int uid, int gid);
@@ -399,8 +413,13 @@ protected:
   }
 
   // global client lock
-  //  - protects Client and buffer cache both!
+  //  - protects Client
   Mutex                  client_lock;
+  // protects objectcacher and the Inode::oset it keeps.  taken after
+  // client_lock, never before: the cacher's callbacks that need
+  // client_lock are run from objectcacher_finisher (see _oc_callback).
+  // reads and writes drop client_lock while they are in the cacher.
+  Mutex                  objectcacher_lock;
 
   // helpers
   void wake_inode_waiters(MetaSession *s);
@@ -417,6 +436,8 @@ protected:
   void close_dir(Dir *dir);
 
   friend class C_Client_FlushComplete; // calls put_inode()
+  friend class C_Client_Flushed; // calls _flushed()
+  friend class C_Client_OCCallback; // queues on objectcacher_finisher
   friend class C_Client_CacheInvalidate;  // calls ino_invalidate_cb
   friend class C_Client_DentryInvalidate;  // calls dentry_invalidate_cb
   friend class C_Block_Sync; // Calls block map and protected helpers
@@ -588,6 +609,7 @@ protected:
   void _flush_range(Inode *in, int64_t off, uint64_t size);
   void _flushed(Inode *in);
   void flush_set_callback(ObjectCacher::ObjectSet *oset);
+  Context *_oc_callback(Context *c);
 
   void close_release(Inode *in);
   void close_safe(Inode *in);
@@ -627,6 +649,18 @@ private:
   void _readdir_next_frag(dir_result_t *dirp);
   void _readdir_rechoose_frag(dir_result_t *dirp);
   int _readdir_get_frag(dir_result_t *dirp);
+  bool _readdir_send_prefetch(dir_result_t *dirp, frag_t fg, const string& start,
+			      uint64_t offset, bool key_order);
+  MetaRequest *_readdir_find_prefetch(dir_result_t *dirp, frag_t fg,
+				      const string& start, uint64_t offset,
+				      bool key_order);
+  MetaRequest *_readdir_take_prefetch(dir_result_t *dirp, frag_t fg,
+				      const string& start, uint64_t offset,
+				      bool key_order);
+  void _readdir_put_prefetch(MetaRequest *req);
+  void _readdir_drop_prefetch(dir_result_t *dirp);
+  void _readdir_prefetch(dir_result_t *dirp);
+  void _readdir_prefetch_reply(MetaRequest *req, int r);
   int _readdir_cache_cb(dir_result_t *dirp, add_dirent_cb_t cb, void *p);
   void _closedir(dir_result_t *dirp);
 
@@ -645,6 +679,7 @@ private:
   struct C_Readahead : public Context {
     Client *client;
     Fh *f;
+    utime_t start;
     C_Readahead(Client *c, Fh *f);
     void finish(int r);
   };
@@ -675,10 +710,18 @@ private:
   int _create(Inode *in, const char *name, int flags, mode_t mode, Inode **inp, Fh **fhp,
               int stripe_unit, int stripe_count, int object_size, const char *data_pool,
 	      bool *created = NULL, int uid=-1, int gid=-1);
+  MetaSession *_can_async_create(Inode *dir, const char *name);
+  void _layout_policy_changed(Inode *in);
+  int _async_create(Inode *dir, const char *name, int flags, mode_t mode,
+		    int cmode, MetaSession *session, Inode **inp, Fh **fhp,
+		    bool *created, int uid, int gid);
+  void _async_create_reply(MetaRequest *req, int r, bool first, bool safe,
+			   Inode *traced);
+  void _async_reply(MetaRequest *req, int r, bool first, bool safe,
+		    Inode *traced=NULL);
   loff_t _lseek(Fh *fh, loff_t offset, int whence);
   int _read(Fh *fh, int64_t offset, uint64_t size, bufferlist *bl);
-  int _write(Fh *fh, int64_t offset, uint64_t size, const char *buf,
-          const struct iovec *iov, int iovcnt);
+  int _write(Fh *fh, int64_t offset, uint64_t size, bufferlist& bl);
   int _preadv_pwritev(int fd, const struct iovec *iov, unsigned iovcnt, int64_t offset, bool write);
   int _flush(Fh *fh);
   int _fsync(Fh *fh, bool syncdataonly);
@@ -10,6 +10,7 @@ class Dir {
   xlist<Dentry*> dentry_list;
   uint64_t release_count;
   uint64_t ordered_count;
+  set<frag_t> key_order_frags;  // frags last listed in dentry key order
 
   Dir(Inode* in) : release_count(0), ordered_count(0) { parent_inode = in; }
 
@@ -35,8 +35,11 @@ ostream& operator<<(ostream &out, Inode &in)
   if (in.flags & I_COMPLETE)
     out << " COMPLETE";
 
+  // the oset's objects and dirty counts are under objectcacher_lock,
+  // which callers here may or may not hold; stick to what client_lock
+  // covers
   if (in.is_file())
-    out << " " << in.oset;
+    out << " ts " << in.truncate_seq << "/" << in.truncate_size;
 
   if (!in.dn_set.empty())
     out << " parents=" << in.dn_set;
@@ -303,6 +303,13 @@ struct Inode {
 
   xlist<MetaRequest*> unsafe_dir_ops;
 
+  // async creates (see Client::_async_create)
+  MetaRequest *async_create_req;   // our create of this inode, until it is safe
+  int async_creates_unacked;       // creates of (or in, for a dir) this inode
+                                   // the mds hasn't replied to yet
+  ceph_file_layout last_create_layout;  // dir: layout the mds gave our last create here
+  uint64_t last_create_layout_gen;      // Client::layout_policy_gen as it was set
+
   Inode(CephContext *cct_, vinodeno_t vino, ceph_file_layout *newlayout)
     : cct(cct_), ino(vino.ino), snapid(vino.snapid),
       rdev(0), mode(0), uid(0), gid(0), nlink(0),
@@ -320,10 +327,13 @@ struct Inode {
       reported_size(0), wanted_max_size(0), requested_max_size(0),
       _ref(0), ll_ref(0), dir(0), dn_set(),
       fcntl_locks(NULL), flock_locks(NULL),
+      async_create_req(NULL), async_creates_unacked(0),
+      last_create_layout_gen(0),
       async_err(0)
   {
     memset(&dir_layout, 0, sizeof(dir_layout));
     memset(&layout, 0, sizeof(layout));
+    memset(&last_create_layout, 0, sizeof(last_create_layout));
     memset(&flushing_cap_tid, 0, sizeof(__u16)*CEPH_CAP_BITS);
     memset(&quota, 0, sizeof(quota));
   }
@@ -19,6 +19,7 @@
 class MClientReply;
 struct Inode;
 class Dentry;
+struct dir_result_t;
 
 struct MetaRequest {
 private:
@@ -66,9 +67,14 @@ public:
   bool readdir_end;
   int readdir_num;
   string readdir_last_name;
+  bool readdir_key_order;      // the reply lists in dentry key order, not name order
+  dir_result_t *readdir_dirp;  // reader a prefetched chunk is for; see Client::_readdir_prefetch
+  bool readdir_done;
+  int readdir_r;
 
   //possible responses
   bool got_unsafe;
+  bool async;                  // nobody waits in make_request(); see Client::_async_create
 
   xlist<MetaRequest*>::item item;
   xlist<MetaRequest*>::item unsafe_item;
@@ -95,8 +101,9 @@ public:
     num_fwd(0), retry_attempt(0),
     ref(1), reply(0), 
     kick(false), aborted(false), success(false),
-    readdir_offset(0), readdir_end(false), readdir_num(0),
-    got_unsafe(false), item(this), unsafe_item(this), unsafe_dir_item(this),
+    readdir_offset(0), readdir_end(false), readdir_num(0), readdir_key_order(false),
+    readdir_dirp(0), readdir_done(false), readdir_r(0),
+    got_unsafe(false), async(false), item(this), unsafe_item(this), unsafe_dir_item(this),
     lock("MetaRequest lock"),
     caller_cond(0), dispatch_cond(0),
     target(0) {
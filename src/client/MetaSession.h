@@ -8,6 +8,7 @@
 #include "include/utime.h"
 #include "msg/msg_types.h"
 #include "include/xlist.h"
+#include "include/interval_set.h"
 
 #include "messages/MClientCapRelease.h"
 #include "mds/MDSMap.h"
@@ -47,6 +48,8 @@ struct MetaSession {
   xlist<MetaRequest*> requests;
   xlist<MetaRequest*> unsafe_requests;
 
+  interval_set<inodeno_t> delegated_inos;  // ours to create with (client_async_create)
+
   Cap *s_cap_iterator;
 
   MClientCapRelease *release;
@@ -25,6 +25,7 @@ using namespace std;
 
 #include "include/filepath.h"
 #include "common/perf_counters.h"
+#include "common/Thread.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -138,6 +139,29 @@ void parse_syn_options(vector<const char*>& args)
         syn_iargs.push_back( atoi(args[++i]) );
         syn_iargs.push_back( atoi(args[++i]) );
         syn_iargs.push_back( atoi(args[++i]) );
+      } else if (strcmp(args[i],"mdsbench") == 0) {
+        syn_modes.push_back( SYNCLIENT_MODE_MDSBENCH );
+        syn_iargs.push_back( atoi(args[++i]) );
+        syn_iargs.push_back( atoi(args[++i]) );
+      } else if (strcmp(args[i],"lsbench") == 0) {
+        syn_modes.push_back( SYNCLIENT_MODE_LSBENCH );
+        syn_iargs.push_back( atoi(args[++i]) );
+        syn_iargs.push_back( atoi(args[++i]) );
+      } else if (strcmp(args[i],"lslbench") == 0) {
+        syn_modes.push_back( SYNCLIENT_MODE_LSLBENCH );
+        syn_iargs.push_back( atoi(args[++i]) );
+        syn_iargs.push_back( atoi(args[++i]) );
+        syn_iargs.push_back( atoi(args[++i]) );
+      } else if (strcmp(args[i],"untarbench") == 0) {
+        syn_modes.push_back( SYNCLIENT_MODE_UNTARBENCH );
+        syn_iargs.push_back( atoi(args[++i]) );
+        syn_iargs.push_back( atoi(args[++i]) );
+        syn_iargs.push_back( atoi(args[++i]) );
+      } else if (strcmp(args[i],"rwbench") == 0) {
+        syn_modes.push_back( SYNCLIENT_MODE_RWBENCH );
+        syn_iargs.push_back( atoi(args[++i]) );
+        syn_iargs.push_back( atoi(args[++i]) );
+        syn_iargs.push_back( atoi(args[++i]) );
       } else if (strcmp(args[i],"makefiles") == 0) {
         syn_modes.push_back( SYNCLIENT_MODE_MAKEFILES );
         syn_iargs.push_back( atoi(args[++i]) );
@@ -521,6 +545,69 @@ int SyntheticClient::run()
       }
       break;
 
+    case SYNCLIENT_MODE_MDSBENCH:
+      {
+        int iarg1 = iargs.front();  iargs.pop_front();
+        int iarg2 = iargs.front();  iargs.pop_front();
+        if (run_me()) {
+          dout(2) << "mdsbench " << iarg1 << " " << iarg2 << dendl;
+          mds_bench(iarg1, iarg2);
+        }
+	did_run_me();
+      }
+      break;
+
+    case SYNCLIENT_MODE_LSBENCH:
+      {
+        int iarg1 = iargs.front();  iargs.pop_front();
+        int iarg2 = iargs.front();  iargs.pop_front();
+        if (run_me()) {
+          dout(2) << "lsbench " << iarg1 << " " << iarg2 << dendl;
+          ls_bench(iarg1, iarg2);
+        }
+	did_run_me();
+      }
+      break;
+
+    case SYNCLIENT_MODE_LSLBENCH:
+      {
+        int iarg1 = iargs.front();  iargs.pop_front();
+        int iarg2 = iargs.front();  iargs.pop_front();
+        int iarg3 = iargs.front();  iargs.pop_front();
+        if (run_me()) {
+          dout(2) << "lslbench " << iarg1 << " " << iarg2 << " " << iarg3 << dendl;
+          ls_l_bench(iarg1, iarg2, iarg3);
+        }
+	did_run_me();
+      }
+      break;
+
+    case SYNCLIENT_MODE_UNTARBENCH:
+      {
+        int iarg1 = iargs.front();  iargs.pop_front();
+        int iarg2 = iargs.front();  iargs.pop_front();
+        int iarg3 = iargs.front();  iargs.pop_front();
+        if (run_me()) {
+          dout(2) << "untarbench " << iarg1 << " " << iarg2 << " " << iarg3 << dendl;
+          untar_bench(iarg1, iarg2, iarg3);
+        }
+	did_run_me();
+      }
+      break;
+
+    case SYNCLIENT_MODE_RWBENCH:
+      {
+        int iarg1 = iargs.front();  iargs.pop_front();
+        int iarg2 = iargs.front();  iargs.pop_front();
+        int iarg3 = iargs.front();  iargs.pop_front();
+        if (run_me()) {
+          dout(2) << "rwbench " << iarg1 << " " << iarg2 << " " << iarg3 << dendl;
+          rw_bench(iarg1, iarg2, iarg3);
+        }
+	did_run_me();
+      }
+      break;
+
 
     case SYNCLIENT_MODE_THRASHLINKS:
       {
@@ -1829,6 +1916,319 @@ int SyntheticClient::read_dirs(const char *basedir, int dirs, int files, int dep
 }
 
 
+/*
+ * Metadata read benchmark: each client fills a private directory, then
+ * alternates readdirs and lookups of every entry for the given number of
+ * seconds.  Run with a small client_cache_size (e.g. 1) so lookups miss
+ * the client cache and are served from the MDS cache; compare the
+ * aggregate rate across --num-client values to see how the MDS scales
+ * with concurrent clients.
+ */
+int SyntheticClient::mds_bench(int files, int seconds)
+{
+  int whoami = client->get_nodeid().v;
+  char base[64];
+  char d[255];
+  snprintf(base, sizeof(base), "mdsbench.client%d", whoami);
+  client->mkdir(base, 0755);
+  for (int i = 0; i < files; i++) {
+    snprintf(d, sizeof(d), "%s/file.%d", base, i);
+    client->mknod(d, 0644);
+    if (time_to_stop()) return 0;
+  }
+
+  struct stat st;
+  uint64_t lookups = 0, readdirs = 0;
+  utime_t start = ceph_clock_now(client->cct);
+  utime_t until = start;
+  until += (double)seconds;
+  while (!time_to_stop() && ceph_clock_now(client->cct) < until) {
+    list<string> contents;
+    int r = client->getdir(base, contents);
+    if (r < 0) {
+      dout(0) << "mdsbench couldn't readdir " << base << ": "
+	      << cpp_strerror(r) << dendl;
+      return r;
+    }
+    ++readdirs;
+    for (int i = 0; i < files; i++) {
+      snprintf(d, sizeof(d), "%s/file.%d", base, i);
+      r = client->lstat(d, &st);
+      if (r < 0) {
+	dout(0) << "mdsbench failed stat on " << d << ": "
+		<< cpp_strerror(r) << dendl;
+	return r;
+      }
+      ++lookups;
+    }
+  }
+  utime_t elapsed = ceph_clock_now(client->cct);
+  elapsed -= start;
+  dout(0) << "mdsbench " << lookups << " lookups, " << readdirs
+	  << " readdirs in " << elapsed << " = "
+	  << ((double)(lookups + readdirs) / (double)elapsed) << " ops/sec"
+	  << dendl;
+  return 0;
+}
+
+/*
+ * Large directory listing benchmark: fill lsbench.client<N> with the
+ * given number of files (skipped if it is already that full, so a
+ * multi-million entry directory only has to be built once), then list it
+ * the given number of times and report entries/sec.  Restart the MDS
+ * between runs to list a directory that is not in its cache; compare
+ * with mds_readdir_stream_min_entries on and off.
+ */
+/// make sure the lsbench dir holds at least <files> files
+void SyntheticClient::ls_bench_fill(const char *base, int files)
+{
+  char d[255];
+  struct stat st;
+  client->mkdir(base, 0755);
+  if (client->lstat(base, &st) == 0 && st.st_size < files) {
+    for (int i = st.st_size; i < files; i++) {
+      snprintf(d, sizeof(d), "%s/file.%d", base, i);
+      client->mknod(d, 0644);
+      if (time_to_stop()) return;
+    }
+  }
+}
+
+int SyntheticClient::ls_bench(int files, int iterations)
+{
+  int whoami = client->get_nodeid().v;
+  char base[64];
+  snprintf(base, sizeof(base), "lsbench.client%d", whoami);
+  ls_bench_fill(base, files);
+
+  for (int n = 0; n < iterations && !time_to_stop(); n++) {
+    utime_t start = ceph_clock_now(client->cct);
+    list<string> contents;
+    int r = client->getdir(base, contents);
+    if (r < 0) {
+      dout(0) << "lsbench couldn't readdir " << base << ": "
+	      << cpp_strerror(r) << dendl;
+      return r;
+    }
+    utime_t elapsed = ceph_clock_now(client->cct);
+    elapsed -= start;
+    dout(0) << "lsbench listed " << contents.size() << " entries in "
+	    << elapsed << " = "
+	    << ((double)contents.size() / (double)elapsed) << " entries/sec"
+	    << dendl;
+  }
+  return 0;
+}
+
+/*
+ * "ls -l" of the lsbench directory: readdirplus, then stat each entry
+ * by name, with lstat or (lite) with lstatlite asking for no optional
+ * fields.
+ */
+int SyntheticClient::ls_l_bench(int files, int iterations, bool lite)
+{
+  int whoami = client->get_nodeid().v;
+  char base[64];
+  char d[512];
+  snprintf(base, sizeof(base), "lsbench.client%d", whoami);
+  ls_bench_fill(base, files);
+
+  for (int n = 0; n < iterations && !time_to_stop(); n++) {
+    utime_t start = ceph_clock_now(client->cct);
+    dir_result_t *dirp;
+    int r = client->opendir(base, &dirp);
+    if (r < 0) {
+      dout(0) << "lslbench couldn't opendir " << base << ": "
+	      << cpp_strerror(r) << dendl;
+      return r;
+    }
+    uint64_t entries = 0;
+    struct dirent de;
+    struct stat st;
+    int stmask;
+    while ((r = client->readdirplus_r(dirp, &de, &st, &stmask)) > 0) {
+      if (strcmp(de.d_name, ".") == 0 || strcmp(de.d_name, "..") == 0)
+	continue;
+      snprintf(d, sizeof(d), "%s/%s", base, de.d_name);
+      if (lite) {
+	struct statlite stl;
+	stl.st_litemask = 0;
+	r = client->lstatlite(d, &stl);
+      } else {
+	r = client->lstat(d, &st);
+      }
+      if (r < 0)
+	break;
+      ++entries;
+    }
+    client->closedir(dirp);
+    if (r < 0) {
+      dout(0) << "lslbench failed in " << base << ": "
+	      << cpp_strerror(r) << dendl;
+      return r;
+    }
+    utime_t elapsed = ceph_clock_now(client->cct);
+    elapsed -= start;
+    dout(0) << "lslbench " << (lite ? "lstatlite" : "lstat") << " listed "
+	    << entries << " entries in " << elapsed << " = "
+	    << ((double)entries / (double)elapsed) << " entries/sec" << dendl;
+  }
+  return 0;
+}
+
+/*
+ * Unpack a synthetic tarball into untarbench.client<N>.<run>: mkdir each
+ * dir, then create, write and close its files in order, the way tar
+ * does.  Reports files/sec for the unpack and, separately, how long the
+ * final sync takes (where async creates catch up).
+ */
+int SyntheticClient::untar_bench(int dirs, int files, int size)
+{
+  int whoami = client->get_nodeid().v;
+  char base[64];
+  char d[255];
+  utime_t now = ceph_clock_now(client->cct);
+  snprintf(base, sizeof(base), "untarbench.client%d.%d", whoami,
+	   (int)now.sec());
+  int r = client->mkdir(base, 0755);
+  if (r < 0) {
+    dout(0) << "untarbench couldn't mkdir " << base << ": "
+	    << cpp_strerror(r) << dendl;
+    return r;
+  }
+
+  char *buf = new char[size > 0 ? size : 1];
+  memset(buf, 0xa5, size > 0 ? size : 1);
+  uint64_t created = 0;
+  utime_t start = ceph_clock_now(client->cct);
+  for (int i = 0; i < dirs && !time_to_stop(); i++) {
+    snprintf(d, sizeof(d), "%s/dir.%d", base, i);
+    client->mkdir(d, 0755);
+    for (int j = 0; j < files && !time_to_stop(); j++) {
+      snprintf(d, sizeof(d), "%s/dir.%d/file.%d", base, i, j);
+      int fd = client->open(d, O_CREAT|O_EXCL|O_WRONLY, 0644);
+      if (fd < 0) {
+	dout(0) << "untarbench couldn't create " << d << ": "
+		<< cpp_strerror(fd) << dendl;
+	delete[] buf;
+	return fd;
+      }
+      if (size > 0)
+	client->write(fd, buf, size, 0);
+      r = client->close(fd);
+      if (r < 0) {
+	dout(0) << "untarbench close of " << d << " failed: "
+		<< cpp_strerror(r) << dendl;
+	delete[] buf;
+	return r;
+      }
+      ++created;
+    }
+  }
+  delete[] buf;
+  utime_t unpacked = ceph_clock_now(client->cct);
+  client->sync_fs();
+  utime_t synced = ceph_clock_now(client->cct);
+
+  utime_t elapsed = unpacked - start;
+  dout(0) << "untarbench created " << created << " files of " << size
+	  << " bytes in " << elapsed << " = "
+	  << ((double)created / (double)elapsed) << " files/sec, sync took "
+	  << (synced - unpacked) << dendl;
+  return 0;
+}
+
+/*
+ * One rwbench worker: overwrite and read back a window of its own file
+ * through the shared Client until the deadline passes.
+ */
+class RWBenchThread : public Thread {
+public:
+  Client *client;
+  int fd;
+  int size;
+  utime_t deadline;
+  uint64_t ops;
+  uint64_t bytes;
+  RWBenchThread(Client *c, int f, int s, utime_t d)
+    : client(c), fd(f), size(s), deadline(d), ops(0), bytes(0) {}
+  void *entry() {
+    const int window = 16;
+    char *buf = new char[size];
+    memset(buf, 0x5a, size);
+    for (int i = 0; ceph_clock_now(client->cct) < deadline; i++) {
+      loff_t off = (loff_t)(i % window) * size;
+      int r = client->write(fd, buf, size, off);
+      if (r < 0)
+	break;
+      r = client->read(fd, buf, size, off);
+      if (r < 0)
+	break;
+      ops += 2;
+      bytes += 2 * (uint64_t)size;
+    }
+    delete[] buf;
+    return NULL;
+  }
+};
+
+/*
+ * Drive a single Client from several threads at once, each doing
+ * write+read of <size> bytes against a private file.  Reports aggregate
+ * ops/sec and MB/sec; compare runs at different thread counts to see how
+ * well the client's data path scales.
+ */
+int SyntheticClient::rw_bench(int threads, int size, int seconds)
+{
+  if (threads <= 0 || size <= 0)
+    return -EINVAL;
+  int whoami = client->get_nodeid().v;
+  char d[255];
+  vector<int> fds;
+  for (int t = 0; t < threads; t++) {
+    snprintf(d, sizeof(d), "rwbench.client%d.%d", whoami, t);
+    int fd = client->open(d, O_CREAT|O_RDWR, 0644);
+    if (fd < 0) {
+      dout(0) << "rwbench couldn't open " << d << ": "
+	      << cpp_strerror(fd) << dendl;
+      for (vector<int>::iterator p = fds.begin(); p != fds.end(); ++p)
+	client->close(*p);
+      return fd;
+    }
+    fds.push_back(fd);
+  }
+
+  utime_t start = ceph_clock_now(client->cct);
+  utime_t deadline = start;
+  deadline += seconds;
+  vector<RWBenchThread*> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.push_back(new RWBenchThread(client, fds[t], size, deadline));
+    workers.back()->create();
+  }
+  uint64_t ops = 0, bytes = 0;
+  for (int t = 0; t < threads; t++) {
+    workers[t]->join();
+    ops += workers[t]->ops;
+    bytes += workers[t]->bytes;
+    delete workers[t];
+  }
+  utime_t elapsed = ceph_clock_now(client->cct) - start;
+
+  for (int t = 0; t < threads; t++) {
+    client->close(fds[t]);
+    snprintf(d, sizeof(d), "rwbench.client%d.%d", whoami, t);
+    client->unlink(d);
+  }
+
+  dout(0) << "rwbench " << threads << " threads, " << size << " byte ops: "
+	  << ops << " ops in " << elapsed << " = "
+	  << ((double)ops / (double)elapsed) << " ops/sec, "
+	  << ((double)bytes / (double)elapsed / (1024.0*1024.0)) << " MB/sec"
+	  << dendl;
+  return 0;
+}
+
 int SyntheticClient::make_files(int num, int count, int priv, bool more)
 {
   int whoami = client->get_nodeid().v;
@@ -33,6 +33,11 @@
 #define SYNCLIENT_MODE_MAKEDIRS     8      // dirs files depth
 #define SYNCLIENT_MODE_STATDIRS     9     // dirs files depth
 #define SYNCLIENT_MODE_READDIRS     10     // dirs files depth
+#define SYNCLIENT_MODE_MDSBENCH     15     // files seconds
+#define SYNCLIENT_MODE_LSBENCH      16     // files iterations
+#define SYNCLIENT_MODE_LSLBENCH     4      // files iterations lite
+#define SYNCLIENT_MODE_UNTARBENCH   17     // dirs files size
+#define SYNCLIENT_MODE_RWBENCH      18     // threads size seconds
 
 #define SYNCLIENT_MODE_MAKEFILES    11     // num count private
 #define SYNCLIENT_MODE_MAKEFILES2   12     // num count private
@@ -231,6 +236,12 @@ class SyntheticClient {
   int make_dirs(const char *basedir, int dirs, int files, int depth);
   int stat_dirs(const char *basedir, int dirs, int files, int depth);
   int read_dirs(const char *basedir, int dirs, int files, int depth);
+  int mds_bench(int files, int seconds);
+  void ls_bench_fill(const char *base, int files);
+  int ls_bench(int files, int iterations);
+  int ls_l_bench(int files, int iterations, bool lite);
+  int untar_bench(int dirs, int files, int size);
+  int rw_bench(int threads, int size, int seconds);
   int make_files(int num, int count, int priv, bool more);
   int link_test();
 
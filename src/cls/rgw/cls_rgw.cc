@@ -24,6 +24,7 @@ CLS_NAME(rgw)
 cls_handle_t h_class;
 cls_method_handle_t h_rgw_bucket_init_index;
 cls_method_handle_t h_rgw_bucket_set_tag_timeout;
+cls_method_handle_t h_rgw_bucket_set_reshard_state;
 cls_method_handle_t h_rgw_bucket_list;
 cls_method_handle_t h_rgw_bucket_check_index;
 cls_method_handle_t h_rgw_bucket_rebuild_index;
@@ -38,6 +39,7 @@ cls_method_handle_t h_rgw_obj_remove;
 cls_method_handle_t h_rgw_obj_check_attrs_prefix;
 cls_method_handle_t h_rgw_bi_get_op;
 cls_method_handle_t h_rgw_bi_put_op;
+cls_method_handle_t h_rgw_bi_remove_op;
 cls_method_handle_t h_rgw_bi_list_op;
 cls_method_handle_t h_rgw_bi_log_list_op;
 cls_method_handle_t h_rgw_dir_suggest_changes;
@@ -422,39 +424,63 @@ int rgw_bucket_list(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
 
   bufferlist bl;
 
-  map<string, bufferlist> keys;
   string start_key;
   encode_list_index_key(hctx, op.start_obj, &start_key);
-  rc = get_obj_vals(hctx, start_key, op.filter_prefix, op.num_entries + 1, &keys);
-  if (rc < 0)
-    return rc;
 
   std::map<string, struct rgw_bucket_dir_entry>& m = new_dir.m;
-  std::map<string, bufferlist>::iterator kiter = keys.begin();
-  uint32_t i;
+  uint32_t i = 0;
 
+  map<string, bufferlist> keys;
+  std::map<string, bufferlist>::iterator kiter = keys.end();
   bool done = false;
+  bool more = true;   /* the last read may have stopped short of the end */
 
-  for (i = 0; i < op.num_entries && kiter != keys.end(); ++i, ++kiter) {
-    struct rgw_bucket_dir_entry entry;
+  /*
+   * Entries are read a batch at a time from start_key on.  With a
+   * delimiter, the first entry of a group that has it stands for the
+   * group: the walk goes on in the same batch from past the group, and
+   * reads again only once the batch runs out, so the keys under it are
+   * never sent back.
+   */
+  while (!done && i < op.num_entries) {
+    if (kiter == keys.end()) {
+      if (!more)
+        break;
+      if (!keys.empty() && keys.rbegin()->first > start_key)
+        start_key = keys.rbegin()->first;
+      keys.clear();
+      uint32_t want = op.num_entries - i;
+      rc = get_obj_vals(hctx, start_key, op.filter_prefix, want + 1, &keys);
+      if (rc < 0)
+        return rc;
+      more = (keys.size() > want);
+      kiter = keys.begin();
+      if (kiter == keys.end())
+        break;
+    }
 
     if (!bi_is_objs_index(kiter->first)) {
       done = true;
       break;
     }
 
-    bufferlist& entrybl = kiter->second;
+    std::map<string, bufferlist>::iterator cur = kiter++;
+    ++i;
+
+    struct rgw_bucket_dir_entry entry;
+    bufferlist& entrybl = cur->second;
     bufferlist::iterator eiter = entrybl.begin();
     try {
       ::decode(entry, eiter);
     } catch (buffer::error& err) {
-      CLS_LOG(1, "ERROR: rgw_bucket_list(): failed to decode entry, key=%s\n", kiter->first.c_str());
+      CLS_LOG(1, "ERROR: rgw_bucket_list(): failed to decode entry, key=%s\n", cur->first.c_str());
       return -EINVAL;
     }
 
     cls_rgw_obj_key key;
     uint64_t ver;
-    decode_list_index_key(kiter->first, &key, &ver);
+    decode_list_index_key(cur->first, &key, &ver);
+    ret.marker = cur->first;
 
     if (!entry.is_valid()) {
       CLS_LOG(20, "entry %s[%s] is not valid\n", key.name.c_str(), key.instance.c_str());
@@ -465,12 +491,26 @@ int rgw_bucket_list(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
       CLS_LOG(20, "entry %s[%s] is not visible\n", key.name.c_str(), key.instance.c_str());
       continue;
     }
-    m[kiter->first] = entry;
+    m[cur->first] = entry;
 
     CLS_LOG(20, "got entry %s[%s] m.size()=%d\n", key.name.c_str(), key.instance.c_str(), (int)m.size());
+
+    /* an entry with ops pending may yet be dropped, and can't stand for the rest */
+    if (!op.delimiter.empty() && entry.pending_map.empty() &&
+        (entry.exists || entry.is_delete_marker())) {
+      size_t delim_pos = key.name.find(op.delimiter, op.filter_prefix.size());
+      if (delim_pos != string::npos) {
+        /* no list index key under the prefix has a 0xff byte after it */
+        start_key = key.name.substr(0, delim_pos + op.delimiter.size());
+        start_key.append(1, (char)0xff);
+        ret.marker = start_key;
+        CLS_LOG(20, "skipping past common prefix %s\n", key.name.substr(0, delim_pos + op.delimiter.size()).c_str());
+        kiter = keys.lower_bound(start_key);
+      }
+    }
   }
 
-  ret.is_truncated = (kiter != keys.end() && !done);
+  ret.is_truncated = (!done && (kiter != keys.end() || more));
 
   ::encode(ret, *out);
   return 0;
@@ -614,6 +654,56 @@ int rgw_bucket_set_tag_timeout(cls_method_context_t hctx, bufferlist *in, buffer
   return write_bucket_header(hctx, &header);
 }
 
+int rgw_bucket_set_reshard_state(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
+  // decode request
+  rgw_cls_set_reshard_state_op op;
+  bufferlist::iterator iter = in->begin();
+  try {
+    ::decode(op, iter);
+  } catch (buffer::error& err) {
+    CLS_LOG(1, "ERROR: rgw_bucket_set_reshard_state(): failed to decode request\n");
+    return -EINVAL;
+  }
+
+  if (op.state > CLS_RGW_RESHARD_DONE) {
+    CLS_LOG(1, "ERROR: rgw_bucket_set_reshard_state(): invalid state %d\n", (int)op.state);
+    return -EINVAL;
+  }
+
+  struct rgw_bucket_dir_header header;
+  int rc = read_bucket_header(hctx, &header);
+  if (rc < 0) {
+    CLS_LOG(1, "ERROR: rgw_bucket_set_reshard_state(): failed to read header\n");
+    return rc;
+  }
+
+  header.reshard_state = op.state;
+
+  return write_bucket_header(hctx, &header);
+}
+
+/*
+ * The reshard rebuilds the new index from the log of the old one, so
+ * while a shard is being copied every update to it is logged, whatever
+ * the gateway that sent it thought.  Once the new index took over, the
+ * shard refuses updates with -ESTALE, and the gateway looks the bucket
+ * up again.  Updates are applied under the object's lock on the OSD, so
+ * nothing gets past a change of state.
+ */
+static int check_reshard_state(struct rgw_bucket_dir_header& header, bool *log_op)
+{
+  switch (header.reshard_state) {
+  case CLS_RGW_RESHARD_IN_PROGRESS:
+    *log_op = true;
+    break;
+  case CLS_RGW_RESHARD_DONE:
+    *log_op = true;
+    return -ESTALE;
+  }
+  return 0;
+}
+
 static int read_key_entry(cls_method_context_t hctx, cls_rgw_obj_key& key, string *idx, struct rgw_bucket_dir_entry *entry,
                           bool special_delete_marker_name = false);
 
@@ -670,6 +760,12 @@ int rgw_bucket_prepare_op(cls_method_context_t hctx, bufferlist *in, bufferlist
     return rc;
   }
 
+  rc = check_reshard_state(header, &op.log_op);
+  if (rc < 0) {
+    CLS_LOG(1, "rgw_bucket_prepare_op(): index shard was resharded\n");
+    return rc;
+  }
+
   if (op.log_op) {
     rc = log_index_operation(hctx, op.key, op.op, op.tag, entry.meta.mtime,
                              entry.ver, info.state, header.ver, header.max_marker, op.bilog_flags);
@@ -785,6 +881,14 @@ int rgw_bucket_complete_op(cls_method_context_t hctx, bufferlist *in, bufferlist
     return -EINVAL;
   }
 
+  /* an op prepared here before the reshard fenced the shard still lands
+   * here; the reshard waits for it, and replays it from the log */
+  bool resharded = (check_reshard_state(header, &op.log_op) == -ESTALE);
+  if (resharded && op.tag.empty()) {
+    CLS_LOG(1, "rgw_bucket_complete_op(): index shard was resharded\n");
+    return -ESTALE;
+  }
+
   struct rgw_bucket_dir_entry entry;
   bool ondisk = true;
 
@@ -806,6 +910,10 @@ int rgw_bucket_complete_op(cls_method_context_t hctx, bufferlist *in, bufferlist
   if (op.tag.size()) {
     map<string, struct rgw_bucket_pending_info>::iterator pinter = entry.pending_map.find(op.tag);
     if (pinter == entry.pending_map.end()) {
+      if (resharded) {
+        CLS_LOG(1, "rgw_bucket_complete_op(): index shard was resharded\n");
+        return -ESTALE;
+      }
       CLS_LOG(1, "ERROR: couldn't find tag for pending operation\n");
       return -EINVAL;
     }
@@ -1480,6 +1588,13 @@ static int rgw_bucket_link_olh(cls_method_context_t hctx, bufferlist *in, buffer
     return ret;
   }
 
+  /* failing drops the updates above along with the op */
+  ret = check_reshard_state(header, &op.log_op);
+  if (ret < 0) {
+    CLS_LOG(1, "%s(): index shard was resharded\n", __func__);
+    return ret;
+  }
+
   if (op.log_op) {
     rgw_bucket_dir_entry& entry = obj.get_dir_entry();
 
@@ -1612,6 +1727,13 @@ static int rgw_bucket_unlink_instance(cls_method_context_t hctx, bufferlist *in,
     return ret;
   }
 
+  /* failing drops the updates above along with the op */
+  ret = check_reshard_state(header, &op.log_op);
+  if (ret < 0) {
+    CLS_LOG(1, "%s(): index shard was resharded\n", __func__);
+    return ret;
+  }
+
   if (op.log_op) {
     rgw_bucket_entry_ver ver;
     ver.epoch = (op.olh_epoch ? op.olh_epoch : olh.get_epoch());
@@ -2086,6 +2208,27 @@ static int rgw_bi_put_op(cls_method_context_t hctx, bufferlist *in, bufferlist *
   return 0;
 }
 
+static int rgw_bi_remove_op(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
+{
+  // decode request
+  rgw_cls_bi_remove_op op;
+  bufferlist::iterator iter = in->begin();
+  try {
+    ::decode(op, iter);
+  } catch (buffer::error& err) {
+    CLS_LOG(0, "ERROR: %s(): failed to decode request", __func__);
+    return -EINVAL;
+  }
+
+  int r = cls_cxx_map_remove_key(hctx, op.idx);
+  if (r < 0 && r != -ENOENT) {
+    CLS_LOG(0, "ERROR: %s(): cls_cxx_map_remove_key() returned r=%d", __func__, r);
+    return r;
+  }
+
+  return 0;
+}
+
 static int list_plain_entries(cls_method_context_t hctx, const string& name, const string& marker, uint32_t max,
                               list<rgw_cls_bi_entry> *entries)
 {
@@ -2203,6 +2346,68 @@ static int list_instance_entries(cls_method_context_t hctx, const string& name,
   return count;
 }
 
+/*
+ * list all the index entries of the shard (plain, instance and olh
+ * entries, but not the bucket log) in key order, starting after marker
+ */
+static int list_all_entries(cls_method_context_t hctx, const string& marker, uint32_t max,
+                            list<rgw_cls_bi_entry> *entries, bool *truncated)
+{
+  string start_key = marker;
+  string log_end_key;
+  log_end_key = BI_PREFIX_CHAR;
+  log_end_key.append(bucket_index_prefixes[BI_BUCKET_LOG_INDEX + 1]);
+
+  int count = 0;
+  map<string, bufferlist> keys;
+  *truncated = false;
+  do {
+    keys.clear();
+    int ret = cls_cxx_map_get_vals(hctx, start_key, string(), BI_GET_NUM_KEYS, &keys);
+    if (ret < 0) {
+      return ret;
+    }
+
+    map<string, bufferlist>::iterator iter;
+    for (iter = keys.begin(); iter != keys.end(); ++iter) {
+      if (count >= (int)max) {
+        *truncated = true;
+        return count;
+      }
+      start_key = iter->first;
+
+      rgw_cls_bi_entry entry;
+      switch (bi_entry_type(iter->first)) {
+        case BI_BUCKET_OBJS_INDEX:
+          entry.type = PlainIdx;
+          break;
+        case BI_BUCKET_OBJ_INSTANCE_INDEX:
+          entry.type = InstanceIdx;
+          break;
+        case BI_BUCKET_OLH_DATA_INDEX:
+          entry.type = OLHIdx;
+          break;
+        case BI_BUCKET_LOG_INDEX:
+          /* skip over the rest of the log */
+          start_key = log_end_key;
+          break;
+        default:
+          continue;
+      }
+      if (entry.type == InvalidIdx) {
+        break;
+      }
+
+      entry.idx = iter->first;
+      entry.data = iter->second;
+      entries->push_back(entry);
+      count++;
+    }
+  } while (!keys.empty());
+
+  return count;
+}
+
 static int rgw_bi_list_op(cls_method_context_t hctx, bufferlist *in, bufferlist *out)
 {
   // decode request
@@ -2221,6 +2426,16 @@ static int rgw_bi_list_op(cls_method_context_t hctx, bufferlist *in, bufferlist
 #define MAX_BI_LIST_ENTRIES 1000
   int32_t max = (op.max < MAX_BI_LIST_ENTRIES ? op.max : MAX_BI_LIST_ENTRIES);
   string start_key = op.marker;
+  if (filter.empty()) {
+    int ret = list_all_entries(hctx, op.marker, max, &op_ret.entries, &op_ret.is_truncated);
+    if (ret < 0) {
+      CLS_LOG(0, "ERROR: %s(): list_all_entries retured ret=%d", __func__, ret);
+      return ret;
+    }
+    ::encode(op_ret, *out);
+    return 0;
+  }
+
   int ret = list_plain_entries(hctx, op.name, op.marker, max, &op_ret.entries);
   if (ret < 0) {
     CLS_LOG(0, "ERROR: %s(): list_plain_entries retured ret=%d", __func__, ret);
@@ -3051,6 +3266,7 @@ void __cls_init()
   /* bucket index */
   cls_register_cxx_method(h_class, "bucket_init_index", CLS_METHOD_RD | CLS_METHOD_WR, rgw_bucket_init_index, &h_rgw_bucket_init_index);
   cls_register_cxx_method(h_class, "bucket_set_tag_timeout", CLS_METHOD_RD | CLS_METHOD_WR, rgw_bucket_set_tag_timeout, &h_rgw_bucket_set_tag_timeout);
+  cls_register_cxx_method(h_class, "bucket_set_reshard_state", CLS_METHOD_RD | CLS_METHOD_WR, rgw_bucket_set_reshard_state, &h_rgw_bucket_set_reshard_state);
   cls_register_cxx_method(h_class, "bucket_list", CLS_METHOD_RD, rgw_bucket_list, &h_rgw_bucket_list);
   cls_register_cxx_method(h_class, "bucket_check_index", CLS_METHOD_RD, rgw_bucket_check_index, &h_rgw_bucket_check_index);
   cls_register_cxx_method(h_class, "bucket_rebuild_index", CLS_METHOD_RD | CLS_METHOD_WR, rgw_bucket_rebuild_index, &h_rgw_bucket_rebuild_index);
@@ -3067,6 +3283,7 @@ void __cls_init()
 
   cls_register_cxx_method(h_class, "bi_get", CLS_METHOD_RD, rgw_bi_get_op, &h_rgw_bi_get_op);
   cls_register_cxx_method(h_class, "bi_put", CLS_METHOD_RD | CLS_METHOD_WR, rgw_bi_put_op, &h_rgw_bi_put_op);
+  cls_register_cxx_method(h_class, "bi_remove", CLS_METHOD_RD | CLS_METHOD_WR, rgw_bi_remove_op, &h_rgw_bi_remove_op);
   cls_register_cxx_method(h_class, "bi_list", CLS_METHOD_RD, rgw_bi_list_op, &h_rgw_bi_list_op);
 
   cls_register_cxx_method(h_class, "bi_log_list", CLS_METHOD_RD, rgw_bi_log_list, &h_rgw_bi_log_list_op);
@@ -138,6 +138,22 @@ int CLSRGWIssueSetTagTimeout::issue_op(int shard_id, const string& oid)
   return issue_bucket_set_tag_timeout_op(io_ctx, oid, tag_timeout, &manager);
 }
 
+void cls_rgw_bucket_set_reshard_state(ObjectWriteOperation& o, uint8_t state)
+{
+  bufferlist in;
+  struct rgw_cls_set_reshard_state_op call;
+  call.state = state;
+  ::encode(call, in);
+  o.exec("rgw", "bucket_set_reshard_state", in);
+}
+
+int CLSRGWIssueSetReshardState::issue_op(int shard_id, const string& oid)
+{
+  ObjectWriteOperation op;
+  cls_rgw_bucket_set_reshard_state(op, state);
+  return manager.aio_operate(io_ctx, oid, &op);
+}
+
 void cls_rgw_bucket_prepare_op(ObjectWriteOperation& o, RGWModifyOp op, string& tag,
                                const cls_rgw_obj_key& key, const string& locator, bool log_op,
                                uint16_t bilog_flags)
@@ -177,20 +193,33 @@ void cls_rgw_bucket_complete_op(ObjectWriteOperation& o, RGWModifyOp op, string&
   o.exec("rgw", "bucket_complete_op", in);
 }
 
-static bool issue_bucket_list_op(librados::IoCtx& io_ctx,
-    const string& oid, const cls_rgw_obj_key& start_obj, const string& filter_prefix,
-    uint32_t num_entries, bool list_versions, BucketIndexAioManager *manager,
-    struct rgw_cls_list_ret *pdata) {
+void cls_rgw_bucket_list_op(librados::ObjectReadOperation& op,
+                            const cls_rgw_obj_key& start_obj,
+                            const string& filter_prefix,
+                            const string& delimiter,
+                            uint32_t num_entries,
+                            bool list_versions,
+                            rgw_cls_list_ret *result,
+                            int *pret)
+{
   bufferlist in;
   struct rgw_cls_list_op call;
   call.start_obj = start_obj;
   call.filter_prefix = filter_prefix;
+  call.delimiter = delimiter;
   call.num_entries = num_entries;
   call.list_versions = list_versions;
   ::encode(call, in);
 
+  op.exec("rgw", "bucket_list", in, new ClsBucketIndexOpCtx<struct rgw_cls_list_ret>(result, pret));
+}
+
+static bool issue_bucket_list_op(librados::IoCtx& io_ctx,
+    const string& oid, const cls_rgw_obj_key& start_obj, const string& filter_prefix,
+    uint32_t num_entries, bool list_versions, BucketIndexAioManager *manager,
+    struct rgw_cls_list_ret *pdata) {
   librados::ObjectReadOperation op;
-  op.exec("rgw", "bucket_list", in, new ClsBucketIndexOpCtx<struct rgw_cls_list_ret>(pdata, NULL));
+  cls_rgw_bucket_list_op(op, start_obj, filter_prefix, "", num_entries, list_versions, pdata, NULL);
   return manager->aio_operate(io_ctx, oid, &op);
 }
 
@@ -257,6 +286,24 @@ int cls_rgw_bi_put(librados::IoCtx& io_ctx, const string oid, rgw_cls_bi_entry&
   return 0;
 }
 
+void cls_rgw_bi_put(librados::ObjectWriteOperation& op, rgw_cls_bi_entry& entry)
+{
+  bufferlist in;
+  struct rgw_cls_bi_put_op call;
+  call.entry = entry;
+  ::encode(call, in);
+  op.exec("rgw", "bi_put", in);
+}
+
+void cls_rgw_bi_remove(librados::ObjectWriteOperation& op, const string& idx)
+{
+  bufferlist in;
+  struct rgw_cls_bi_remove_op call;
+  call.idx = idx;
+  ::encode(call, in);
+  op.exec("rgw", "bi_remove", in);
+}
+
 int cls_rgw_bi_list(librados::IoCtx& io_ctx, const string oid,
                    const string& name, const string& marker, uint32_t max,
                    list<rgw_cls_bi_entry> *entries, bool *is_truncated)
@@ -302,6 +302,18 @@ public:
     CLSRGWConcurrentIO(ioc, _bucket_objs, _max_aio), tag_timeout(_tag_timeout) {}
 };
 
+void cls_rgw_bucket_set_reshard_state(librados::ObjectWriteOperation& o, uint8_t state);
+
+class CLSRGWIssueSetReshardState : public CLSRGWConcurrentIO {
+  uint8_t state;
+protected:
+  int issue_op(int shard_id, const string& oid);
+public:
+  CLSRGWIssueSetReshardState(librados::IoCtx& ioc, map<int, string>& _bucket_objs,
+                     uint32_t _max_aio, uint8_t _state) :
+    CLSRGWConcurrentIO(ioc, _bucket_objs, _max_aio), state(_state) {}
+};
+
 void cls_rgw_bucket_prepare_op(librados::ObjectWriteOperation& o, RGWModifyOp op, string& tag,
                                const cls_rgw_obj_key& key, const string& locator, bool log_op,
                                uint16_t bilog_op);
@@ -320,6 +332,8 @@ int cls_rgw_bi_get(librados::IoCtx& io_ctx, const string oid,
                    BIIndexType index_type, cls_rgw_obj_key& key,
                    rgw_cls_bi_entry *entry);
 int cls_rgw_bi_put(librados::IoCtx& io_ctx, const string oid, rgw_cls_bi_entry& entry);
+void cls_rgw_bi_put(librados::ObjectWriteOperation& op, rgw_cls_bi_entry& entry);
+void cls_rgw_bi_remove(librados::ObjectWriteOperation& op, const string& idx);
 int cls_rgw_bi_list(librados::IoCtx& io_ctx, const string oid,
                    const string& name, const string& marker, uint32_t max,
                    list<rgw_cls_bi_entry> *entries, bool *is_truncated);
@@ -336,6 +350,21 @@ int cls_rgw_get_olh_log(librados::IoCtx& io_ctx, string& oid, librados::ObjectRe
 void cls_rgw_trim_olh_log(librados::ObjectWriteOperation& op, const cls_rgw_obj_key& olh, uint64_t ver, const string& olh_tag);
 int cls_rgw_clear_olh(librados::IoCtx& io_ctx, string& oid, const cls_rgw_obj_key& olh, const string& olh_tag);
 
+/**
+ * Add a listing of one bucket index object to a read op.  The result is
+ * decoded into *result and the return code put in *pret when the op
+ * completes.  With a delimiter, only the first entry of every common
+ * prefix is listed; the marker in the result is then past the prefix.
+ */
+void cls_rgw_bucket_list_op(librados::ObjectReadOperation& op,
+                            const cls_rgw_obj_key& start_obj,
+                            const string& filter_prefix,
+                            const string& delimiter,
+                            uint32_t num_entries,
+                            bool list_versions,
+                            rgw_cls_list_ret *result,
+                            int *pret);
+
 /**
  * List the bucket with the starting object and filter prefix.
  * NOTE: this method do listing requests for each bucket index shards identified by
@@ -16,6 +16,18 @@ void rgw_cls_tag_timeout_op::generate_test_instances(list<rgw_cls_tag_timeout_op
   ls.back()->tag_timeout = 23323;
 }
 
+void rgw_cls_set_reshard_state_op::dump(Formatter *f) const
+{
+  f->dump_int("state", (int)state);
+}
+
+void rgw_cls_set_reshard_state_op::generate_test_instances(list<rgw_cls_set_reshard_state_op*>& ls)
+{
+  ls.push_back(new rgw_cls_set_reshard_state_op);
+  ls.push_back(new rgw_cls_set_reshard_state_op);
+  ls.back()->state = CLS_RGW_RESHARD_IN_PROGRESS;
+}
+
 void cls_rgw_gc_set_entry_op::dump(Formatter *f) const
 {
   f->dump_unsigned("expiration_secs", expiration_secs);
@@ -280,6 +292,7 @@ void rgw_cls_list_op::generate_test_instances(list<rgw_cls_list_op*>& o)
   op->start_obj.name = "start_obj";
   op->num_entries = 100;
   op->filter_prefix = "filter_prefix";
+  op->delimiter = "/";
   o.push_back(op);
   o.push_back(new rgw_cls_list_op);
 }
@@ -288,6 +301,7 @@ void rgw_cls_list_op::dump(Formatter *f) const
 {
   f->dump_string("start_obj", start_obj.name);
   f->dump_unsigned("num_entries", num_entries);
+  f->dump_string("delimiter", delimiter);
 }
 
 void rgw_cls_list_ret::generate_test_instances(list<rgw_cls_list_ret*>& o)
@@ -316,6 +330,7 @@ void rgw_cls_list_ret::dump(Formatter *f) const
   dir.dump(f);
   f->close_section();
   f->dump_int("is_truncated", (int)is_truncated);
+  f->dump_string("marker", marker);
 }
 
 void rgw_cls_check_index_ret::generate_test_instances(list<rgw_cls_check_index_ret*>& o)
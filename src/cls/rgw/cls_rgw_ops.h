@@ -27,6 +27,27 @@ struct rgw_cls_tag_timeout_op
 };
 WRITE_CLASS_ENCODER(rgw_cls_tag_timeout_op)
 
+struct rgw_cls_set_reshard_state_op
+{
+  uint8_t state;
+
+  rgw_cls_set_reshard_state_op() : state(CLS_RGW_RESHARD_NONE) {}
+
+  void encode(bufferlist &bl) const {
+    ENCODE_START(1, 1, bl);
+    ::encode(state, bl);
+    ENCODE_FINISH(bl);
+  }
+  void decode(bufferlist::iterator &bl) {
+    DECODE_START(1, bl);
+    ::decode(state, bl);
+    DECODE_FINISH(bl);
+  }
+  void dump(Formatter *f) const;
+  static void generate_test_instances(list<rgw_cls_set_reshard_state_op*>& ls);
+};
+WRITE_CLASS_ENCODER(rgw_cls_set_reshard_state_op)
+
 struct rgw_cls_obj_prepare_op
 {
   RGWModifyOp op;
@@ -342,19 +363,26 @@ struct rgw_cls_list_op
   uint32_t num_entries;
   string filter_prefix;
   bool list_versions;
+  /*
+   * if set, only the first entry listed of every group of entries whose
+   * names are the same up to the delimiter (searched for after
+   * filter_prefix) is returned, and the rest of the group is skipped
+   */
+  string delimiter;
 
   rgw_cls_list_op() : num_entries(0), list_versions(false) {}
 
   void encode(bufferlist &bl) const {
-    ENCODE_START(5, 4, bl);
+    ENCODE_START(6, 4, bl);
     ::encode(num_entries, bl);
     ::encode(filter_prefix, bl);
     ::encode(start_obj, bl);
     ::encode(list_versions, bl);
+    ::encode(delimiter, bl);
     ENCODE_FINISH(bl);
   }
   void decode(bufferlist::iterator &bl) {
-    DECODE_START_LEGACY_COMPAT_LEN(5, 2, 2, bl);
+    DECODE_START_LEGACY_COMPAT_LEN(6, 2, 2, bl);
     if (struct_v < 4) {
       ::decode(start_obj.name, bl);
     }
@@ -365,6 +393,8 @@ struct rgw_cls_list_op
       ::decode(start_obj, bl);
     if (struct_v >= 5)
       ::decode(list_versions, bl);
+    if (struct_v >= 6)
+      ::decode(delimiter, bl);
     DECODE_FINISH(bl);
   }
   void dump(Formatter *f) const;
@@ -376,19 +406,27 @@ struct rgw_cls_list_ret
 {
   rgw_bucket_dir dir;
   bool is_truncated;
+  /*
+   * the list index key of the last entry looked at, listed or not; as
+   * the name of start_obj, the next listing starts right after it
+   */
+  string marker;
 
   rgw_cls_list_ret() : is_truncated(false) {}
 
   void encode(bufferlist &bl) const {
-    ENCODE_START(2, 2, bl);
+    ENCODE_START(3, 2, bl);
     ::encode(dir, bl);
     ::encode(is_truncated, bl);
+    ::encode(marker, bl);
     ENCODE_FINISH(bl);
   }
   void decode(bufferlist::iterator &bl) {
-    DECODE_START_LEGACY_COMPAT_LEN(2, 2, 2, bl);
+    DECODE_START_LEGACY_COMPAT_LEN(3, 2, 2, bl);
     ::decode(dir, bl);
     ::decode(is_truncated, bl);
+    if (struct_v >= 3)
+      ::decode(marker, bl);
     DECODE_FINISH(bl);
   }
   void dump(Formatter *f) const;
@@ -538,6 +576,25 @@ struct rgw_cls_bi_put_op {
 };
 WRITE_CLASS_ENCODER(rgw_cls_bi_put_op)
 
+struct rgw_cls_bi_remove_op {
+  string idx; /* raw index key, as returned by bi_list */
+
+  rgw_cls_bi_remove_op() {}
+
+  void encode(bufferlist& bl) const {
+    ENCODE_START(1, 1, bl);
+    ::encode(idx, bl);
+    ENCODE_FINISH(bl);
+  }
+
+  void decode(bufferlist::iterator& bl) {
+    DECODE_START(1, bl);
+    ::decode(idx, bl);
+    DECODE_FINISH(bl);
+  }
+};
+WRITE_CLASS_ENCODER(rgw_cls_bi_remove_op)
+
 struct rgw_cls_bi_list_op {
   uint32_t max;
   string name;
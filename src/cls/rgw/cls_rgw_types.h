@@ -32,6 +32,13 @@ enum RGWModifyOp {
   CLS_RGW_OP_UNLINK_INSTANCE = 6,
 };
 
+/* reshard state of a bucket index shard, kept in its header */
+enum RGWIndexReshardState {
+  CLS_RGW_RESHARD_NONE        = 0,
+  CLS_RGW_RESHARD_IN_PROGRESS = 1, /* being copied; every update is logged */
+  CLS_RGW_RESHARD_DONE        = 2, /* superseded; only ops prepared here may complete */
+};
+
 enum RGWBILogFlags {
   RGW_BILOG_FLAG_VERSIONED_OP = 0x1,
 };
@@ -545,16 +552,18 @@ struct rgw_bucket_dir_header {
   uint64_t ver;
   uint64_t master_ver;
   string max_marker;
+  uint8_t reshard_state;
 
-  rgw_bucket_dir_header() : tag_timeout(0), ver(0), master_ver(0) {}
+  rgw_bucket_dir_header() : tag_timeout(0), ver(0), master_ver(0), reshard_state(CLS_RGW_RESHARD_NONE) {}
 
   void encode(bufferlist &bl) const {
-    ENCODE_START(5, 2, bl);
+    ENCODE_START(6, 2, bl);
     ::encode(stats, bl);
     ::encode(tag_timeout, bl);
     ::encode(ver, bl);
     ::encode(master_ver, bl);
     ::encode(max_marker, bl);
+    ::encode(reshard_state, bl);
     ENCODE_FINISH(bl);
   }
   void decode(bufferlist::iterator &bl) {
@@ -574,6 +583,11 @@ struct rgw_bucket_dir_header {
     if (struct_v >= 5) {
       ::decode(max_marker, bl);
     }
+    if (struct_v >= 6) {
+      ::decode(reshard_state, bl);
+    } else {
+      reshard_state = CLS_RGW_RESHARD_NONE;
+    }
     DECODE_FINISH(bl);
   }
   void dump(Formatter *f) const;
@@ -0,0 +1,203 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_CONFIGSNAPSHOT_H
+#define CEPH_CONFIGSNAPSHOT_H
+
+#include <list>
+#include <utility>
+#include <pthread.h>
+
+#include "include/atomic.h"
+#include "include/assert.h"
+#include "common/Mutex.h"
+
+/// a word whose every load and store is a full memory barrier
+class ConfigSnapshotWord {
+#ifndef NO_ATOMIC_OPS
+  AO_t v;
+public:
+  ConfigSnapshotWord(uintptr_t i = 0) : v(i) {}
+  uintptr_t read() const {
+    return AO_load_full((AO_t *)&v);
+  }
+  void set(uintptr_t n) {
+    AO_store_full(&v, n);
+  }
+#else
+  ceph::atomic_spinlock_t<uintptr_t> v;
+public:
+  ConfigSnapshotWord(uintptr_t i = 0) : v(i) {}
+  uintptr_t read() const {
+    return v.read();
+  }
+  void set(uintptr_t n) {
+    v.set(n);
+  }
+#endif
+};
+
+/**
+ * ConfigSnapshot - immutable copy of derived config state
+ *
+ * Observers that parse config strings into richer structures (maps,
+ * vectors, ...) in handle_conf_change() cannot update them in place
+ * while other threads read them.  ConfigSnapshot keeps the parsed value
+ * behind a single pointer: readers get a consistent, immutable copy
+ * without taking a lock, while writers build a new copy and publish it.
+ *
+ * Superseded copies are reclaimed by epoch: a reader notes the epoch it
+ * started in in a slot of its own thread, and a writer bumps the epoch
+ * with every update and frees the copies retired before the oldest epoch
+ * a reader is still in.  So a copy lives until the readers that could
+ * have seen it are done, and no longer than the next update after that.
+ */
+template <class T>
+class ConfigSnapshot {
+  struct Slot {
+    ConfigSnapshotWord epoch;   ///< the one its thread reads in; 0 if none
+    ConfigSnapshotWord in_use;  ///< claimed by a thread
+    int depth;                  ///< nested readers, for the owning thread
+    Slot() : in_use(1), depth(0) {}
+  };
+
+  ConfigSnapshotWord cur;
+  ConfigSnapshotWord epoch;
+  mutable Mutex lock;  ///< serializes writers, and the slot list
+  pthread_key_t slot_key;
+  mutable std::list<Slot*> slots;
+  std::list<std::pair<T*, uintptr_t> > retired;  ///< with the epoch it was retired in
+
+  static void release_slot(void *p) {
+    static_cast<Slot*>(p)->in_use.set(0);
+  }
+
+  Slot *get_slot() const {
+    Slot *s = static_cast<Slot*>(pthread_getspecific(slot_key));
+    if (s)
+      return s;
+    Mutex::Locker l(lock);
+    for (typename std::list<Slot*>::iterator p = slots.begin();
+	 p != slots.end();
+	 ++p) {
+      if (!(*p)->in_use.read()) {
+	s = *p;
+	s->in_use.set(1);
+	break;
+      }
+    }
+    if (!s) {
+      s = new Slot;
+      slots.push_back(s);
+    }
+    pthread_setspecific(slot_key, s);
+    return s;
+  }
+
+  const T *enter(Slot *s) const {
+    if (s->depth++ == 0)
+      s->epoch.set(epoch.read());
+    return reinterpret_cast<const T*>(cur.read());
+  }
+  void exit(Slot *s) const {
+    if (--s->depth == 0)
+      s->epoch.set(0);
+  }
+
+  /// free what no reader can still see; with the lock held
+  void reclaim() {
+    uintptr_t oldest = epoch.read();
+    for (typename std::list<Slot*>::iterator p = slots.begin();
+	 p != slots.end();
+	 ++p) {
+      uintptr_t e = (*p)->epoch.read();
+      if (e && e < oldest)
+	oldest = e;
+    }
+    while (!retired.empty() && retired.front().second <= oldest) {
+      delete retired.front().first;
+      retired.pop_front();
+    }
+  }
+
+public:
+  explicit ConfigSnapshot(const T &init = T())
+    : cur(0), epoch(1), lock("ConfigSnapshot::lock") {
+    int r = pthread_key_create(&slot_key, release_slot);
+    assert(r == 0);
+    cur.set(reinterpret_cast<uintptr_t>(new T(init)));
+  }
+  ~ConfigSnapshot() {
+    pthread_key_delete(slot_key);
+    delete reinterpret_cast<T*>(cur.read());
+    for (typename std::list<std::pair<T*, uintptr_t> >::iterator p = retired.begin();
+	 p != retired.end();
+	 ++p)
+      delete p->first;
+    for (typename std::list<Slot*>::iterator p = slots.begin();
+	 p != slots.end();
+	 ++p)
+      delete *p;
+  }
+
+  /**
+   * Reader - the current value, for as long as the Reader lives
+   *
+   * Keep it for the duration of a call, not across blocking: while it
+   * lives, no copy published since can be freed.
+   */
+  class Reader {
+    const ConfigSnapshot<T> &snap;
+    Slot *slot;
+    const T *val;
+  public:
+    explicit Reader(const ConfigSnapshot<T> &s)
+      : snap(s), slot(s.get_slot()), val(s.enter(slot)) {}
+    ~Reader() {
+      snap.exit(slot);
+    }
+    const T &operator*() const {
+      return *val;
+    }
+    const T *operator->() const {
+      return val;
+    }
+  private:
+    Reader(const Reader &other);
+    Reader &operator=(const Reader &rhs);
+  };
+
+  /// publish a new value; readers see either the old or the new copy
+  void update(const T &v) {
+    T *n = new T(v);
+    Mutex::Locker l(lock);
+    T *old = reinterpret_cast<T*>(cur.read());
+    cur.set(reinterpret_cast<uintptr_t>(n));
+    uintptr_t e = epoch.read() + 1;
+    epoch.set(e);
+    retired.push_back(std::make_pair(old, e));
+    reclaim();
+  }
+
+  /// number of superseded copies still held
+  size_t get_num_retired() const {
+    Mutex::Locker l(lock);
+    return retired.size();
+  }
+
+private:
+  // forbid copying
+  ConfigSnapshot(const ConfigSnapshot<T> &other);
+  ConfigSnapshot &operator=(const ConfigSnapshot<T> &rhs);
+};
+
+#endif
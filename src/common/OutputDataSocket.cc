@@ -405,16 +405,18 @@ void OutputDataSocket::shutdown()
   m_path.clear();
 }
 
-void OutputDataSocket::append_output(bufferlist& bl)
+bool OutputDataSocket::append_output(bufferlist& bl)
 {
   Mutex::Locker l(m_lock);
 
-  if (data_size + bl.length() > data_max_backlog) {
+  if (data_size && data_size + bl.length() > data_max_backlog) {
     ldout(m_cct, 20) << "dropping data output, max backlog reached" << dendl;
+    return false;
   }
   data.push_back(bl);
 
   data_size += bl.length();
 
   cond.Signal();
+  return true;
 }
@@ -34,7 +34,8 @@ public:
 
   bool init(const std::string &path);
   
-  void append_output(bufferlist& bl);
+  /* false if the backlog has no room for it */
+  bool append_output(bufferlist& bl);
 
 protected:
   virtual void init_connection(bufferlist& bl) {}
@@ -2,6 +2,7 @@
 // vim: ts=8 sw=2 smarttab
 
 #include "Readahead.h"
+#include "common/Clock.h"
 
 using namespace std;
 
@@ -11,12 +12,11 @@ Readahead::Readahead()
     m_readahead_max_bytes(NO_LIMIT),
     m_alignments(),
     m_lock("Readahead::m_lock"),
-    m_nr_consec_read(0),
-    m_consec_read_bytes(0),
-    m_last_pos(0),
-    m_readahead_pos(0),
-    m_readahead_trigger_pos(0),
-    m_readahead_size(0),
+    m_streams(1),
+    m_max_streams(1),
+    m_stride_detection(false),
+    m_seq(0),
+    m_latency(0),
     m_pending(0),
     m_pending_lock("Readahead::m_pending_lock"),
     m_pending_cond() {
@@ -26,67 +26,156 @@ Readahead::~Readahead() {
 }
 
 Readahead::extent_t Readahead::update(const vector<extent_t>& extents, uint64_t limit) {
-  m_lock.Lock();
-  for (vector<extent_t>::const_iterator p = extents.begin(); p != extents.end(); ++p) {
-    _observe_read(p->first, p->second);
-  }
-  if (m_readahead_pos >= limit) {
-    m_lock.Unlock();
+  vector<extent_t> out;
+  update(extents, limit, &out);
+  if (out.empty()) {
     return extent_t(0, 0);
   }
-  pair<uint64_t, uint64_t> extent = _compute_readahead(limit);
-  m_lock.Unlock();
-  return extent;
+  return extent_t(out.front().first,
+		  out.back().first + out.back().second - out.front().first);
 }
 
 Readahead::extent_t Readahead::update(uint64_t offset, uint64_t length, uint64_t limit) {
+  vector<extent_t> extents(1, extent_t(offset, length));
+  return update(extents, limit);
+}
+
+void Readahead::update(const vector<extent_t>& extents, uint64_t limit,
+		       vector<extent_t> *readahead) {
   m_lock.Lock();
-  _observe_read(offset, length);
-  if (m_readahead_pos >= limit) {
-    m_lock.Unlock();
-    return extent_t(0, 0);
+  stream_t *s = NULL;
+  for (vector<extent_t>::const_iterator p = extents.begin(); p != extents.end(); ++p) {
+    s = _observe_read(p->first, p->second);
+  }
+  if (!s) {
+    // no new reads; carry on with the most recent stream
+    s = &m_streams[0];
+    for (vector<stream_t>::iterator p = m_streams.begin(); p != m_streams.end(); ++p) {
+      if (p->last_used > s->last_used) {
+	s = &*p;
+      }
+    }
+  }
+  if (s->readahead_pos < limit) {
+    if (s->stride) {
+      _compute_stride_readahead(s, limit, readahead);
+    } else {
+      _compute_readahead(s, limit, readahead);
+    }
   }
-  extent_t extent = _compute_readahead(limit);
   m_lock.Unlock();
-  return extent;
 }
 
-void Readahead::_observe_read(uint64_t offset, uint64_t length) {
-  if (offset == m_last_pos) {
-    m_nr_consec_read++;
-    m_consec_read_bytes += length;
-  } else {
-    m_nr_consec_read = 0;
-    m_consec_read_bytes = 0;
-    m_readahead_trigger_pos = 0;
-    m_readahead_size = 0;
-    m_readahead_pos = 0;
+Readahead::stream_t *Readahead::_observe_read(uint64_t offset, uint64_t length) {
+  ++m_seq;
+
+  // continues a stream sequentially?
+  stream_t *s = NULL;
+  for (vector<stream_t>::iterator p = m_streams.begin(); p != m_streams.end(); ++p) {
+    if (offset == p->last_pos) {
+      s = &*p;
+      break;
+    }
+  }
+  if (s) {
+    if (s->stride) {
+      // no longer strided; start over as a sequential stream
+      s->stride = 0;
+      s->nr_consec_read = 0;
+      s->consec_read_bytes = 0;
+      s->readahead_trigger_pos = 0;
+      s->readahead_size = 0;
+      s->readahead_pos = 0;
+    }
+    s->nr_consec_read++;
+    s->consec_read_bytes += length;
+  }
+
+  // continues a strided stream, or is the second read of a new one?
+  if (!s && m_stride_detection) {
+    for (vector<stream_t>::iterator p = m_streams.begin(); p != m_streams.end(); ++p) {
+      uint64_t last_length = p->last_pos - p->last_offset;
+      if (length != last_length || offset <= p->last_pos) {
+	continue;
+      }
+      if (p->stride && offset == p->last_offset + p->stride) {
+	s = &*p;
+	break;
+      }
+      if (!p->stride && p->reads == 1) {
+	s = &*p;
+	s->stride = offset - s->last_offset;
+	break;
+      }
+    }
+    if (s) {
+      s->nr_consec_read++;
+      s->consec_read_bytes += length;
+    }
+  }
+
+  if (!s) {
+    // a new stream, in place of the least recently used one
+    if (m_streams.size() < m_max_streams) {
+      m_streams.push_back(stream_t());
+      s = &m_streams.back();
+    } else {
+      s = &m_streams[0];
+      for (vector<stream_t>::iterator p = m_streams.begin(); p != m_streams.end(); ++p) {
+	if (p->last_used < s->last_used) {
+	  s = &*p;
+	}
+      }
+    }
+    s->reset(offset, length);
+    s->start = ceph_clock_now(NULL);
+  }
+
+  s->last_offset = offset;
+  s->last_pos = offset + length;
+  s->last_used = m_seq;
+  s->reads++;
+  return s;
+}
+
+uint64_t Readahead::_latency_window(stream_t *s) {
+  if (m_latency <= 0) {
+    return 0;
+  }
+  double secs = (double)(ceph_clock_now(NULL) - s->start);
+  if (secs <= 0) {
+    return m_readahead_max_bytes;
   }
-  m_last_pos = offset + length;
+  double window = (double)s->consec_read_bytes / secs * m_latency;
+  if (window >= (double)m_readahead_max_bytes) {
+    return m_readahead_max_bytes;
+  }
+  return (uint64_t)window;
 }
 
-Readahead::extent_t Readahead::_compute_readahead(uint64_t limit) {
+void Readahead::_compute_readahead(stream_t *s, uint64_t limit, vector<extent_t> *out) {
   uint64_t readahead_offset = 0;
   uint64_t readahead_length = 0;
-  if (m_nr_consec_read >= m_trigger_requests) {
+  if (s->nr_consec_read >= m_trigger_requests) {
     // currently reading sequentially
-    if (m_last_pos >= m_readahead_trigger_pos) {
+    if (s->last_pos >= s->readahead_trigger_pos) {
       // need to read ahead
-      if (m_readahead_size == 0) {
+      if (s->readahead_size == 0) {
 	// initial readahead trigger
-	m_readahead_size = m_consec_read_bytes;
-	m_readahead_pos = m_last_pos;
+	s->readahead_size = s->consec_read_bytes;
+	s->readahead_pos = s->last_pos;
       } else {
 	// continuing readahead trigger
-	m_readahead_size *= 2;
-	if (m_last_pos > m_readahead_pos) {
-	  m_readahead_pos = m_last_pos;
+	s->readahead_size *= 2;
+	if (s->last_pos > s->readahead_pos) {
+	  s->readahead_pos = s->last_pos;
 	}
       }
-      m_readahead_size = MAX(m_readahead_size, m_readahead_min_bytes);
-      m_readahead_size = MIN(m_readahead_size, m_readahead_max_bytes);
-      readahead_offset = m_readahead_pos;
-      readahead_length = m_readahead_size;
+      s->readahead_size = MAX(s->readahead_size, _latency_window(s));
+      s->readahead_size = MAX(s->readahead_size, m_readahead_min_bytes);
+      s->readahead_size = MIN(s->readahead_size, m_readahead_max_bytes);
+      readahead_offset = s->readahead_pos;
+      readahead_length = s->readahead_size;
 
       // Snap to the first alignment possible
       uint64_t readahead_end = readahead_offset + readahead_length;
@@ -108,18 +197,72 @@ Readahead::extent_t Readahead::_compute_readahead(uint64_t limit) {
 	  readahead_length = align_next - readahead_offset;
 	  break;
 	}
-	// Note that m_readahead_size should remain unadjusted.
+	// Note that readahead_size should remain unadjusted.
       }
 
-      if (m_readahead_pos + readahead_length > limit) {
-	readahead_length = limit - m_readahead_pos;
+      if (s->readahead_pos + readahead_length > limit) {
+	readahead_length = limit - s->readahead_pos;
       }
 
-      m_readahead_trigger_pos = m_readahead_pos + readahead_length / 2;
-      m_readahead_pos += readahead_length;
+      s->readahead_trigger_pos = s->readahead_pos + readahead_length / 2;
+      s->readahead_pos += readahead_length;
+    }
+  }
+  if (readahead_length > 0) {
+    out->push_back(extent_t(readahead_offset, readahead_length));
+    s->readahead_requests++;
+    s->readahead_bytes += readahead_length;
+  }
+}
+
+void Readahead::_compute_stride_readahead(stream_t *s, uint64_t limit,
+					  vector<extent_t> *out) {
+  if (s->nr_consec_read < m_trigger_requests ||
+      s->last_pos < s->readahead_trigger_pos) {
+    return;
+  }
+  uint64_t record = s->last_pos - s->last_offset;
+  uint64_t next = s->last_offset + s->stride;
+  if (s->readahead_size == 0) {
+    // initial readahead trigger
+    s->readahead_size = s->consec_read_bytes;
+    s->readahead_pos = next;
+  } else {
+    // continuing readahead trigger
+    s->readahead_size *= 2;
+    if (next > s->readahead_pos) {
+      s->readahead_pos = next;
+    }
+  }
+  // sizes count the records, not the gaps between them
+  s->readahead_size = MAX(s->readahead_size, _latency_window(s));
+  s->readahead_size = MAX(s->readahead_size, m_readahead_min_bytes);
+  s->readahead_size = MIN(s->readahead_size, m_readahead_max_bytes);
+
+  uint64_t nrec = MAX(1, s->readahead_size / record);
+  uint64_t bytes = 0;
+  if (s->stride - record <= record) {
+    // gaps are small; one request for the span is cheaper than many
+    uint64_t end = s->readahead_pos + (nrec - 1) * s->stride + record;
+    if (end > limit) {
+      end = limit;
+    }
+    out->push_back(extent_t(s->readahead_pos, end - s->readahead_pos));
+    bytes = end - s->readahead_pos;
+  } else {
+    nrec = MIN(nrec, MAX_STRIDE_EXTENTS);
+    uint64_t pos = s->readahead_pos;
+    for (uint64_t i = 0; i < nrec && pos < limit; i++, pos += s->stride) {
+      uint64_t length = MIN(record, limit - pos);
+      out->push_back(extent_t(pos, length));
+      bytes += length;
     }
   }
-  return extent_t(readahead_offset, readahead_length);
+
+  s->readahead_trigger_pos = s->readahead_pos + (nrec / 2) * s->stride;
+  s->readahead_pos += nrec * s->stride;
+  s->readahead_requests++;
+  s->readahead_bytes += bytes;
 }
 
 void Readahead::inc_pending(int count) {
@@ -148,6 +291,17 @@ void Readahead::wait_for_pending() {
   m_pending_lock.Unlock();
 }
 
+void Readahead::record_latency(utime_t latency) {
+  m_lock.Lock();
+  double l = (double)latency;
+  if (m_latency <= 0) {
+    m_latency = l;
+  } else {
+    m_latency = (m_latency * 7 + l) / 8;
+  }
+  m_lock.Unlock();
+}
+
 void Readahead::set_trigger_requests(int trigger_requests) {
   m_lock.Lock();
   m_trigger_requests = trigger_requests;
@@ -171,3 +325,35 @@ void Readahead::set_alignments(const vector<uint64_t> &alignments) {
   m_alignments = alignments;
   m_lock.Unlock();
 }
+
+void Readahead::set_max_streams(unsigned max_streams) {
+  m_lock.Lock();
+  m_max_streams = MAX(max_streams, 1u);
+  if (m_streams.size() > m_max_streams) {
+    m_streams.resize(m_max_streams);
+  }
+  m_lock.Unlock();
+}
+
+void Readahead::set_stride_detection(bool enabled) {
+  m_lock.Lock();
+  m_stride_detection = enabled;
+  m_lock.Unlock();
+}
+
+void Readahead::get_stream_stats(vector<stream_stat_t> *stats) {
+  m_lock.Lock();
+  for (vector<stream_t>::iterator p = m_streams.begin(); p != m_streams.end(); ++p) {
+    if (p->reads == 0) {
+      continue;
+    }
+    stream_stat_t st;
+    st.pos = p->last_pos;
+    st.stride = p->stride;
+    st.reads = p->reads;
+    st.readahead_requests = p->readahead_requests;
+    st.readahead_bytes = p->readahead_bytes;
+    stats->push_back(st);
+  }
+  m_lock.Unlock();
+}
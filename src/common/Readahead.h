@@ -6,12 +6,18 @@
 
 #include "Mutex.h"
 #include "Cond.h"
+#include "include/utime.h"
 
 /**
    This class provides common state and logic for code that needs to perform readahead
    on linear things such as RBD images or files.
    Unless otherwise specified, all methods are thread-safe.
 
+   Up to set_max_streams() independent read streams are tracked, so that
+   interleaved sequential readers (several threads or processes sharing
+   a file handle) each get readahead.  With set_stride_detection(), a
+   stream may also be strided: fixed-size reads separated by a fixed gap.
+
    Minimum and maximum readahead sizes may be violated by up to 50\% if alignment is enabled.
    Minimum readahead size may be violated if the end of the readahead target is reached.
  */
@@ -22,6 +28,18 @@ public:
   // equal to UINT64_MAX
   static const uint64_t NO_LIMIT = 18446744073709551615ULL;
 
+  /// at most this many extents are returned for one strided readahead
+  static const unsigned MAX_STRIDE_EXTENTS = 64;
+
+  /// per-stream statistics, see get_stream_stats()
+  struct stream_stat_t {
+    uint64_t pos;                 ///< end of the last read
+    uint64_t stride;              ///< distance between reads, 0 if sequential
+    uint64_t reads;               ///< reads attributed to the stream
+    uint64_t readahead_requests;  ///< times readahead was triggered
+    uint64_t readahead_bytes;     ///< bytes requested by readahead
+  };
+
   Readahead();
 
   ~Readahead();
@@ -35,6 +53,9 @@ public:
      is not the same as passing in the correct limit, because the internal state
      will differ in the two cases.
 
+     A strided stream's readahead is several extents; this returns the
+     span covering them.  Use the vector form to read only the records.
+
      @param extents read operations since last call to update
      @param limit size of the thing readahead is being applied to
    */
@@ -55,6 +76,18 @@ public:
    */
   extent_t update(uint64_t offset, uint64_t length, uint64_t limit);
 
+  /**
+     Update state with new reads and append the readahead to be performed
+     to \c readahead (nothing, if none should be).  Extents are in
+     ascending order and do not pass \c limit.
+
+     @param extents read operations since last call to update
+     @param limit size of the thing readahead is being applied to
+     @param readahead where to put the readahead extents
+   */
+  void update(const vector<extent_t>& extents, uint64_t limit,
+	      vector<extent_t> *readahead);
+
   /**
      Increment the pending counter.
    */
@@ -71,6 +104,14 @@ public:
    */
   void wait_for_pending();
 
+  /**
+     Records how long a readahead request took to complete.
+     Once latency is known, a stream's readahead is at least as large as
+     the data it consumes in that time, so that the next readahead lands
+     before the reader catches up with it.
+   */
+  void record_latency(utime_t latency);
+
   /**
      Sets the number of sequential requests necessary to trigger readahead.
    */
@@ -94,18 +135,104 @@ public:
    */
   void set_alignments(const std::vector<uint64_t> &alignments);
 
+  /**
+     Sets the number of read streams tracked (default 1).  A read that
+     continues none of them starts a new stream in place of the least
+     recently used one.
+   */
+  void set_max_streams(unsigned max_streams);
+
+  /**
+     Enables detection of strided streams (default off).
+   */
+  void set_stride_detection(bool enabled);
+
+  /**
+     Appends the state of each tracked stream to \c stats.
+   */
+  void get_stream_stats(std::vector<stream_stat_t> *stats);
+
 private:
+  struct stream_t {
+    /// Number of consecutive read requests in the stream
+    int nr_consec_read;
+
+    /// Number of bytes read in the stream
+    uint64_t consec_read_bytes;
+
+    /// Start and end of the last read
+    uint64_t last_offset;
+    uint64_t last_pos;
+
+    /// Distance between the starts of consecutive reads; 0 if sequential
+    uint64_t stride;
+
+    /// Position of the readahead stream
+    uint64_t readahead_pos;
+
+    /// When readahead is already triggered and the read stream crosses this point, readahead is continued
+    uint64_t readahead_trigger_pos;
+
+    /// Size of the next readahead request (barring changes due to alignment, etc.)
+    uint64_t readahead_size;
+
+    /// When the stream started; used to estimate its bandwidth
+    utime_t start;
+
+    /// For LRU replacement
+    uint64_t last_used;
+
+    /// Counters, see stream_stat_t
+    uint64_t reads;
+    uint64_t readahead_requests;
+    uint64_t readahead_bytes;
+
+    stream_t()
+      : nr_consec_read(0), consec_read_bytes(0), last_offset(0), last_pos(0),
+	stride(0), readahead_pos(0), readahead_trigger_pos(0),
+	readahead_size(0), last_used(0), reads(0), readahead_requests(0),
+	readahead_bytes(0) {}
+
+    void reset(uint64_t offset, uint64_t length) {
+      nr_consec_read = 0;
+      consec_read_bytes = 0;
+      stride = 0;
+      readahead_trigger_pos = 0;
+      readahead_size = 0;
+      readahead_pos = 0;
+      last_offset = offset;
+      last_pos = offset + length;
+      reads = 0;
+      readahead_requests = 0;
+      readahead_bytes = 0;
+    }
+  };
+
   /**
      Records that a read request has been received.
      m_lock must be held while calling.
+     @returns the stream the read belongs to
    */
-  void _observe_read(uint64_t offset, uint64_t length);
+  stream_t *_observe_read(uint64_t offset, uint64_t length);
+
+  /**
+     Computes the next readahead request for a stream.
+     m_lock must be held while calling.
+  */
+  void _compute_readahead(stream_t *s, uint64_t limit, vector<extent_t> *out);
 
   /**
-     Computes the next readahead request.
+     Computes the next readahead request for a strided stream.
      m_lock must be held while calling.
   */
-  extent_t _compute_readahead(uint64_t limit);
+  void _compute_stride_readahead(stream_t *s, uint64_t limit,
+				 vector<extent_t> *out);
+
+  /**
+     The readahead size the stream needs to hide readahead latency.
+     m_lock must be held while calling.
+   */
+  uint64_t _latency_window(stream_t *s);
 
   /// Number of sequential requests necessary to trigger readahead
   int m_trigger_requests;
@@ -122,23 +249,20 @@ private:
   /// Held while reading/modifying any state except m_pending
   Mutex m_lock;
 
-  /// Number of consecutive read requests in the current sequential stream
-  int m_nr_consec_read;
-
-  /// Number of bytes read in the current sequenial stream
-  uint64_t m_consec_read_bytes;
+  /// Tracked read streams
+  std::vector<stream_t> m_streams;
 
-  /// Position of the read stream
-  uint64_t m_last_pos;
+  /// Maximum number of tracked read streams
+  unsigned m_max_streams;
 
-  /// Position of the readahead stream
-  uint64_t m_readahead_pos;
+  /// Whether strided streams are detected
+  bool m_stride_detection;
 
-  /// When readahead is already triggered and the read stream crosses this point, readahead is continued
-  uint64_t m_readahead_trigger_pos;
+  /// Incremented for each read; for LRU replacement of streams
+  uint64_t m_seq;
 
-  /// Size of the next readahead request (barring changes due to alignment, etc.)
-  uint64_t m_readahead_size;
+  /// Moving average of readahead latency, in seconds (0 if unknown)
+  double m_latency;
 
   /// Number of pending readahead requests, as determined by inc_pending() and dec_pending()
   int m_pending;
@@ -33,6 +33,7 @@
 #include <sstream>
 #include <sys/uio.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include <ostream>
 namespace ceph {
@@ -122,6 +123,298 @@ static simple_spinlock_t buffer_debug_lock = SIMPLE_SPINLOCK_INITIALIZER;
   buffer::error_code::error_code(int error) :
     buffer::malformed_input(cpp_strerror(error).c_str()), code(error) {}
 
+  /*
+   * raw data pools
+   *
+   * Size classes are powers of two from 64 bytes to 64 KB, with a second
+   * set of page-aligned classes.  Each thread keeps a small free list per
+   * class, so the common alloc/free pair never takes a lock.  Buffers are
+   * often freed by a different thread than the one that allocated them
+   * (messenger reader vs. op worker); the freeing thread simply caches
+   * the block, and when its list is full half of it is handed to a shared
+   * per-class list from which other threads refill in batches.
+   *
+   * What all the threads hold together is bounded as well, so that threads
+   * that went idle with full lists don't pin memory the busy ones need:
+   * each thread charges what it holds to a global count, a chunk at a
+   * time, and over the bound a free goes to the shared list (or back to
+   * the system) instead of the freeing thread's.
+   */
+  static bool buffer_pool_enabled = get_env_bool("CEPH_BUFFER_POOL");
+
+  enum {
+    POOL_MALLOC = 0,
+    POOL_PAGE_ALIGNED = 1,
+    POOL_NUM_KINDS = 2
+  };
+
+  static const unsigned POOL_MIN_SHIFT = 6;	 // 64 bytes
+  static const unsigned POOL_MAX_SHIFT = 16;	 // 64 KB
+  static const unsigned POOL_NUM_CLASSES = POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1;
+  static const unsigned POOL_THREAD_CLASS_BYTES = 256 * 1024;
+  static const unsigned POOL_CENTRAL_CLASS_BYTES = 4 * 1024 * 1024;
+  static const unsigned POOL_CHARGE_BYTES = 64 * 1024;
+
+  struct pool_freelist_t {
+    void *head;
+    unsigned count;
+
+    void push(void *p) {
+      *(void **)p = head;
+      head = p;
+      ++count;
+    }
+    void *pop() {
+      void *p = head;
+      head = *(void **)p;
+      --count;
+      return p;
+    }
+  };
+
+  struct pool_thread_cache_t {
+    pool_freelist_t lists[POOL_NUM_KINDS][POOL_NUM_CLASSES];
+    // written by the owning thread only, read by get_pool_stats()
+    atomic64_t alloc_cached, alloc_system, free_cached, free_system;
+    atomic64_t bytes;   // held in lists
+    uint64_t charged;   // of bytes, to pool_thread_bytes
+    pool_thread_cache_t *prev, *next;
+
+    pool_thread_cache_t() : charged(0), prev(NULL), next(NULL) {
+      memset(lists, 0, sizeof(lists));
+    }
+  };
+
+  // all POD, so usable by buffers created during static initialization
+  static simple_spinlock_t pool_central_lock[POOL_NUM_KINDS][POOL_NUM_CLASSES];
+  static pool_freelist_t pool_central[POOL_NUM_KINDS][POOL_NUM_CLASSES];
+  static simple_spinlock_t pool_threads_lock = SIMPLE_SPINLOCK_INITIALIZER;
+  static pool_thread_cache_t *pool_threads;
+  static buffer::pool_stats_t pool_exited;  // counters of exited threads
+  static uint64_t pool_thread_max_bytes = 64 * 1024 * 1024;
+  static pthread_once_t pool_key_once = PTHREAD_ONCE_INIT;
+  static pthread_key_t pool_key;
+
+  // not POD, but nothing is pooled before buffer_pool_enabled, defined
+  // above, is initialized
+  static atomic64_t pool_thread_bytes;  // charged by all thread caches
+
+  static unsigned pool_thread_max(unsigned shift) {
+    unsigned n = POOL_THREAD_CLASS_BYTES >> shift;
+    return n < 4 ? 4 : n;
+  }
+
+  static unsigned pool_central_max(unsigned shift) {
+    return POOL_CENTRAL_CLASS_BYTES >> shift;
+  }
+
+  /*
+   * account for bytes coming into or leaving tc's lists; the global
+   * count moves in POOL_CHARGE_BYTES steps, with a step of slack on the
+   * way down so a thread going back and forth over one doesn't bounce it
+   */
+  static void pool_thread_charge(pool_thread_cache_t *tc, int64_t delta) {
+    uint64_t bytes = tc->bytes.read() + delta;
+    tc->bytes.set(bytes);
+    uint64_t want = ROUND_UP_TO(bytes, POOL_CHARGE_BYTES);
+    if (want > tc->charged) {
+      pool_thread_bytes.add(want - tc->charged);
+      tc->charged = want;
+    } else if (want + POOL_CHARGE_BYTES < tc->charged) {
+      want += POOL_CHARGE_BYTES;
+      pool_thread_bytes.sub(tc->charged - want);
+      tc->charged = want;
+    }
+  }
+
+  /// size class for len, or 0 if len is not pooled
+  static unsigned pool_shift(unsigned len, int kind) {
+    unsigned min = kind == POOL_PAGE_ALIGNED ? CEPH_PAGE_SHIFT : POOL_MIN_SHIFT;
+    if (len == 0 || len > (1u << POOL_MAX_SHIFT) || min > POOL_MAX_SHIFT)
+      return 0;
+    unsigned shift = len > 1 ? 32 - __builtin_clz(len - 1) : 0;
+    return shift < min ? min : shift;
+  }
+
+  static void *pool_sys_alloc(unsigned shift, int kind) {
+    void *p;
+    if (kind == POOL_PAGE_ALIGNED) {
+      if (::posix_memalign(&p, CEPH_PAGE_SIZE, 1u << shift))
+	p = NULL;
+    } else {
+      p = ::malloc(1u << shift);
+    }
+    if (!p)
+      throw buffer::bad_alloc();
+    return p;
+  }
+
+  /// move up to n entries from a thread list to the shared list; free the rest
+  static void pool_release(pool_thread_cache_t *tc, pool_freelist_t *fl,
+			   unsigned n, unsigned shift, int kind) {
+    unsigned idx = shift - POOL_MIN_SHIFT;
+    unsigned cmax = pool_central_max(shift);
+    pool_freelist_t *c = &pool_central[kind][idx];
+    unsigned moved = 0, freed = 0;
+    simple_spin_lock(&pool_central_lock[kind][idx]);
+    while (n > 0 && fl->head && c->count < cmax) {
+      c->push(fl->pop());
+      ++moved;
+      --n;
+    }
+    simple_spin_unlock(&pool_central_lock[kind][idx]);
+    while (n > 0 && fl->head) {
+      ::free(fl->pop());
+      ++freed;
+      --n;
+    }
+    if (freed)
+      tc->free_system.add(freed);
+    pool_thread_charge(tc, -((int64_t)(moved + freed) << shift));
+  }
+
+  static void pool_thread_exit(void *arg) {
+    pool_thread_cache_t *tc = static_cast<pool_thread_cache_t*>(arg);
+    for (int kind = 0; kind < POOL_NUM_KINDS; ++kind) {
+      for (unsigned idx = 0; idx < POOL_NUM_CLASSES; ++idx) {
+	pool_freelist_t *fl = &tc->lists[kind][idx];
+	pool_release(tc, fl, fl->count, idx + POOL_MIN_SHIFT, kind);
+      }
+    }
+    simple_spin_lock(&pool_threads_lock);
+    if (tc->prev)
+      tc->prev->next = tc->next;
+    else
+      pool_threads = tc->next;
+    if (tc->next)
+      tc->next->prev = tc->prev;
+    pool_exited.alloc_cached += tc->alloc_cached.read();
+    pool_exited.alloc_system += tc->alloc_system.read();
+    pool_exited.free_cached += tc->free_cached.read();
+    pool_exited.free_system += tc->free_system.read();
+    simple_spin_unlock(&pool_threads_lock);
+    pool_thread_bytes.sub(tc->charged);
+    delete tc;
+  }
+
+  static void pool_key_init() {
+    int r = pthread_key_create(&pool_key, pool_thread_exit);
+    assert(r == 0);
+  }
+
+  static pool_thread_cache_t *pool_get_thread_cache() {
+    pthread_once(&pool_key_once, pool_key_init);
+    pool_thread_cache_t *tc =
+      static_cast<pool_thread_cache_t*>(pthread_getspecific(pool_key));
+    if (likely(tc != NULL))
+      return tc;
+    tc = new pool_thread_cache_t;
+    simple_spin_lock(&pool_threads_lock);
+    tc->next = pool_threads;
+    if (pool_threads)
+      pool_threads->prev = tc;
+    pool_threads = tc;
+    simple_spin_unlock(&pool_threads_lock);
+    pthread_setspecific(pool_key, tc);
+    return tc;
+  }
+
+  static void *pool_alloc(unsigned shift, int kind) {
+    pool_thread_cache_t *tc = pool_get_thread_cache();
+    unsigned idx = shift - POOL_MIN_SHIFT;
+    pool_freelist_t *fl = &tc->lists[kind][idx];
+    if (!fl->head) {
+      // refill half a thread list from the shared list
+      unsigned n = pool_thread_max(shift) / 2;
+      unsigned got = 0;
+      pool_freelist_t *c = &pool_central[kind][idx];
+      simple_spin_lock(&pool_central_lock[kind][idx]);
+      while (got < n && c->head) {
+	fl->push(c->pop());
+	++got;
+      }
+      simple_spin_unlock(&pool_central_lock[kind][idx]);
+      pool_thread_charge(tc, (int64_t)got << shift);
+    }
+    if (fl->head) {
+      tc->alloc_cached.inc();
+      pool_thread_charge(tc, -(1ll << shift));
+      return fl->pop();
+    }
+    tc->alloc_system.inc();
+    return pool_sys_alloc(shift, kind);
+  }
+
+  static void pool_free(void *p, unsigned shift, int kind) {
+    pool_thread_cache_t *tc = pool_get_thread_cache();
+    if (!buffer_pool_enabled) {
+      tc->free_system.inc();
+      ::free(p);
+      return;
+    }
+    pool_freelist_t *fl = &tc->lists[kind][shift - POOL_MIN_SHIFT];
+    unsigned max = pool_thread_max(shift);
+    if (fl->count >= max)
+      pool_release(tc, fl, max / 2, shift, kind);
+    fl->push(p);
+    tc->free_cached.inc();
+    pool_thread_charge(tc, 1ll << shift);
+    if (pool_thread_bytes.read() > pool_thread_max_bytes)
+      pool_release(tc, fl, fl->count, shift, kind);
+  }
+
+  void buffer::enable_pool(bool b) {
+    buffer_pool_enabled = b;
+  }
+  void buffer::set_pool_thread_max_bytes(uint64_t max) {
+    pool_thread_max_bytes = max;
+  }
+  bool buffer::get_pool_enabled() {
+    return buffer_pool_enabled;
+  }
+
+  void buffer::get_pool_stats(pool_stats_t *s) {
+    simple_spin_lock(&pool_threads_lock);
+    *s = pool_exited;
+    for (pool_thread_cache_t *tc = pool_threads; tc; tc = tc->next) {
+      s->alloc_cached += tc->alloc_cached.read();
+      s->alloc_system += tc->alloc_system.read();
+      s->free_cached += tc->free_cached.read();
+      s->free_system += tc->free_system.read();
+      s->thread_bytes += tc->bytes.read();
+      ++s->threads;
+    }
+    simple_spin_unlock(&pool_threads_lock);
+    for (int kind = 0; kind < POOL_NUM_KINDS; ++kind) {
+      for (unsigned idx = 0; idx < POOL_NUM_CLASSES; ++idx) {
+	simple_spin_lock(&pool_central_lock[kind][idx]);
+	s->central_bytes +=
+	  (uint64_t)pool_central[kind][idx].count << (idx + POOL_MIN_SHIFT);
+	simple_spin_unlock(&pool_central_lock[kind][idx]);
+      }
+    }
+  }
+
+  void buffer::trim_pool() {
+    pool_thread_cache_t *tc = pool_get_thread_cache();
+    for (int kind = 0; kind < POOL_NUM_KINDS; ++kind) {
+      for (unsigned idx = 0; idx < POOL_NUM_CLASSES; ++idx) {
+	pool_freelist_t *fl = &tc->lists[kind][idx];
+	int64_t freed = 0;
+	while (fl->head) {
+	  ::free(fl->pop());
+	  freed += 1ll << (idx + POOL_MIN_SHIFT);
+	}
+	pool_thread_charge(tc, -freed);
+	pool_freelist_t *c = &pool_central[kind][idx];
+	simple_spin_lock(&pool_central_lock[kind][idx]);
+	while (c->head)
+	  ::free(c->pop());
+	simple_spin_unlock(&pool_central_lock[kind][idx]);
+      }
+    }
+  }
+
   class buffer::raw {
   public:
     char *data;
@@ -503,6 +796,26 @@ static simple_spinlock_t buffer_debug_lock = SIMPLE_SPINLOCK_INITIALIZER;
     }
   };
 
+  class buffer::raw_pooled : public buffer::raw {
+    unsigned shift;
+    int kind;
+  public:
+    raw_pooled(unsigned l, unsigned _shift, int _kind)
+      : raw(l), shift(_shift), kind(_kind) {
+      data = (char *)pool_alloc(shift, kind);
+      inc_total_alloc(len);
+      bdout << "raw_pooled " << this << " alloc " << (void *)data << " " << l << " " << buffer::get_total_alloc() << bendl;
+    }
+    ~raw_pooled() {
+      pool_free(data, shift, kind);
+      dec_total_alloc(len);
+      bdout << "raw_pooled " << this << " free " << (void *)data << " " << buffer::get_total_alloc() << bendl;
+    }
+    raw* clone_empty() {
+      return new raw_pooled(len, shift, kind);
+    }
+  };
+
   class buffer::raw_unshareable : public buffer::raw {
   public:
     raw_unshareable(unsigned l) : raw(l) {
@@ -587,11 +900,16 @@ static simple_spinlock_t buffer_debug_lock = SIMPLE_SPINLOCK_INITIALIZER;
 #endif /* HAVE_XIO */
 
   buffer::raw* buffer::copy(const char *c, unsigned len) {
-    raw* r = new raw_char(len);
+    raw* r = create(len);
     memcpy(r->data, c, len);
     return r;
   }
   buffer::raw* buffer::create(unsigned len) {
+    if (buffer_pool_enabled) {
+      unsigned shift = pool_shift(len, POOL_MALLOC);
+      if (shift)
+	return new raw_pooled(len, shift, POOL_MALLOC);
+    }
     return new raw_char(len);
   }
   buffer::raw* buffer::claim_char(unsigned len, char *buf) {
@@ -607,6 +925,11 @@ static simple_spinlock_t buffer_debug_lock = SIMPLE_SPINLOCK_INITIALIZER;
     return new raw_static(buf, len);
   }
   buffer::raw* buffer::create_aligned(unsigned len, unsigned align) {
+    if (buffer_pool_enabled && align == CEPH_PAGE_SIZE) {
+      unsigned shift = pool_shift(len, POOL_PAGE_ALIGNED);
+      if (shift)
+	return new raw_pooled(len, shift, POOL_PAGE_ALIGNED);
+    }
 #ifndef __CYGWIN__
     //return new raw_mmap_pages(len);
     return new raw_posix_aligned(len, align);
@@ -1441,6 +1764,24 @@ void buffer::list::rebuild_page_aligned()
     append(bp);
   }
 
+  void buffer::list::reserve(unsigned prealloc)
+  {
+    if (append_buffer.unused_tail_length() >= prealloc)
+      return;
+    unsigned alen = CEPH_PAGE_SIZE * (((prealloc-1) / CEPH_PAGE_SIZE) + 1);
+    append_buffer = create_page_aligned(alen);
+    append_buffer.set_length(0);   // unused, so far.
+  }
+
+  char *buffer::list::append_hole(unsigned len)
+  {
+    reserve(len);
+    char *hole = append_buffer.c_str() + append_buffer.length();
+    append_buffer.set_length(append_buffer.length() + len);
+    append(append_buffer, append_buffer.end() - len, len);	// add segment to the list
+    return hole;
+  }
+
   
   /*
    * get a char
@@ -39,6 +39,18 @@
 
 using ceph::HeartbeatMap;
 
+enum {
+  l_buffer_pool_first = 998082,
+  l_buffer_pool_alloc_cached,
+  l_buffer_pool_alloc_system,
+  l_buffer_pool_free_cached,
+  l_buffer_pool_free_system,
+  l_buffer_pool_thread_bytes,
+  l_buffer_pool_central_bytes,
+  l_buffer_pool_threads,
+  l_buffer_pool_last,
+};
+
 class CephContextServiceThread : public Thread
 {
 public:
@@ -165,6 +177,7 @@ public:
   const char** get_tracked_conf_keys() const {
     static const char *KEYS[] = {
       "enable_experimental_unrecoverable_data_corrupting_features",
+      "buffer_pool",
       NULL
     };
     return KEYS;
@@ -172,6 +185,11 @@ public:
 
   void handle_conf_change(const md_config_t *conf,
                           const std::set <std::string> &changed) {
+    if (changed.count("buffer_pool")) {
+      buffer::enable_pool(conf->buffer_pool);
+    }
+    if (!changed.count("enable_experimental_unrecoverable_data_corrupting_features"))
+      return;
     ceph_spin_lock(&cct->_feature_lock);
     get_str_set(conf->enable_experimental_unrecoverable_data_corrupting_features,
 		cct->_experimental_features);
@@ -249,6 +267,7 @@ void CephContext::do_command(std::string command, cmdmap_t& cmdmap,
     std::string counter;
     cmd_getval(this, cmdmap, "logger", logger);
     cmd_getval(this, cmdmap, "counter", counter);
+    refresh_buffer_pool_perf();
     _perf_counters_collection->dump_formatted(f, false, logger, counter);
   }
   else if (command == "perfcounters_schema" || command == "2" ||
@@ -368,6 +387,7 @@ CephContext::CephContext(uint32_t module_type_)
     _admin_socket(NULL),
     _perf_counters_collection(NULL),
     _perf_counters_conf_obs(NULL),
+    _buffer_pool_perf(NULL),
     _heartbeat_map(NULL),
     _crypto_none(NULL),
     _crypto_aes(NULL)
@@ -386,6 +406,19 @@ CephContext::CephContext(uint32_t module_type_)
   _conf->add_observer(_cct_obs);
 
   _perf_counters_collection = new PerfCountersCollection(this);
+
+  PerfCountersBuilder b(this, "buffer_pool",
+			l_buffer_pool_first, l_buffer_pool_last);
+  b.add_u64_counter(l_buffer_pool_alloc_cached, "alloc_cached");
+  b.add_u64_counter(l_buffer_pool_alloc_system, "alloc_system");
+  b.add_u64_counter(l_buffer_pool_free_cached, "free_cached");
+  b.add_u64_counter(l_buffer_pool_free_system, "free_system");
+  b.add_u64(l_buffer_pool_thread_bytes, "thread_bytes");
+  b.add_u64(l_buffer_pool_central_bytes, "central_bytes");
+  b.add_u64(l_buffer_pool_threads, "threads");
+  _buffer_pool_perf = b.create_perf_counters();
+  _perf_counters_collection->add(_buffer_pool_perf);
+
   _admin_socket = new AdminSocket(this);
   _heartbeat_map = new HeartbeatMap(this);
 
@@ -442,6 +475,10 @@ CephContext::~CephContext()
 
   delete _heartbeat_map;
 
+  _perf_counters_collection->remove(_buffer_pool_perf);
+  delete _buffer_pool_perf;
+  _buffer_pool_perf = NULL;
+
   delete _perf_counters_collection;
   _perf_counters_collection = NULL;
 
@@ -523,6 +560,19 @@ uint32_t CephContext::get_module_type() const
   return _module_type;
 }
 
+void CephContext::refresh_buffer_pool_perf()
+{
+  buffer::pool_stats_t s;
+  buffer::get_pool_stats(&s);
+  _buffer_pool_perf->set(l_buffer_pool_alloc_cached, s.alloc_cached);
+  _buffer_pool_perf->set(l_buffer_pool_alloc_system, s.alloc_system);
+  _buffer_pool_perf->set(l_buffer_pool_free_cached, s.free_cached);
+  _buffer_pool_perf->set(l_buffer_pool_free_system, s.free_system);
+  _buffer_pool_perf->set(l_buffer_pool_thread_bytes, s.thread_bytes);
+  _buffer_pool_perf->set(l_buffer_pool_central_bytes, s.central_bytes);
+  _buffer_pool_perf->set(l_buffer_pool_threads, s.threads);
+}
+
 PerfCountersCollection *CephContext::get_perfcounters_collection()
 {
   return _perf_counters_collection;
@@ -27,6 +27,7 @@
 
 class AdminSocket;
 class CephContextServiceThread;
+class PerfCounters;
 class PerfCountersCollection;
 class md_config_obs_t;
 struct md_config_t;
@@ -155,6 +156,10 @@ private:
 
   md_config_obs_t *_perf_counters_conf_obs;
 
+  /* buffer pool counters, refreshed when perf counters are dumped */
+  PerfCounters *_buffer_pool_perf;
+  void refresh_buffer_pool_perf();
+
   CephContextHook *_admin_hook;
 
   ceph::HeartbeatMap *_heartbeat_map;
@@ -65,6 +65,8 @@ OPTION(mon_cluster_log_file_level, OPT_STR, "info")
 
 OPTION(enable_experimental_unrecoverable_data_corrupting_features, OPT_STR, "")
 
+OPTION(buffer_pool, OPT_BOOL, false) // cache buffer data in per-thread size-class pools
+
 OPTION(xio_trace_mempool, OPT_BOOL, false) // mempool allocation counters
 OPTION(xio_trace_msgcnt, OPT_BOOL, false) // incoming/outgoing msg counters
 OPTION(xio_trace_xcon, OPT_BOOL, false) // Xio message encode/decode trace
@@ -307,12 +309,16 @@ OPTION(client_trace, OPT_STR, "")
 OPTION(client_readahead_min, OPT_LONGLONG, 128*1024)  // readahead at _least_ this much.
 OPTION(client_readahead_max_bytes, OPT_LONGLONG, 0)  //8 * 1024*1024
 OPTION(client_readahead_max_periods, OPT_LONGLONG, 4)  // as multiple of file layout period (object size * num stripes)
+OPTION(client_readahead_streams, OPT_INT, 4)  // independent read streams tracked per open file
+OPTION(client_readahead_stride, OPT_BOOL, true)  // detect strided reads and read ahead records only
 OPTION(client_snapdir, OPT_STR, ".snap")
 OPTION(client_mountpoint, OPT_STR, "/")
 OPTION(client_notify_timeout, OPT_INT, 10) // in seconds
 OPTION(osd_client_watch_timeout, OPT_INT, 30) // in seconds
 OPTION(client_caps_release_delay, OPT_INT, 5) // in seconds
 OPTION(client_quota, OPT_BOOL, false)
+OPTION(client_async_create, OPT_BOOL, false)  // create files in Fx dirs without waiting for the mds
+OPTION(client_readdir_prefetch, OPT_INT, 2)  // readdir chunks to keep requested ahead of the reader
 OPTION(client_oc, OPT_BOOL, true)
 OPTION(client_oc_size, OPT_INT, 1024*1024* 200)    // MB * n
 OPTION(client_oc_max_dirty, OPT_INT, 1024*1024* 100)    // MB * n  (dirty OR tx.. bigish)
@@ -357,9 +363,16 @@ OPTION(journaler_batch_max, OPT_U64, 0)  // max bytes we'll delay flushing; disa
 OPTION(mds_data, OPT_STR, "/var/lib/ceph/mds/$cluster-$id")
 OPTION(mds_max_file_size, OPT_U64, 1ULL << 40) // Used when creating new CephFS. Change with 'ceph mds set max_file_size <size>' afterwards
 OPTION(mds_cache_size, OPT_INT, 100000)
+OPTION(mds_cache_memory_limit, OPT_U64, 0) // bytes; trim the cache to this estimated size as well (0 = dentry count only)
+OPTION(mds_cache_memory_trim_batch, OPT_U32, 10000) // dentries trim() looks at per call to get under mds_cache_memory_limit
 OPTION(mds_cache_mid, OPT_FLOAT, .7)
+OPTION(mds_stat_cache_size, OPT_U32, 0) // inodes whose getattr/lookup is answered outside mds_lock; such replies carry no caps (0 = off)
 OPTION(mds_max_file_recover, OPT_U32, 32)
 OPTION(mds_dir_max_commit_size, OPT_INT, 10) // MB
+OPTION(mds_dir_commit_max_ops, OPT_U32, 64) // dirfrag commit writes in flight; 0 = unlimited
+OPTION(mds_dir_commit_max_bytes, OPT_U64, 64 << 20) // bytes of dirfrag commit writes in flight; 0 = unlimited
+OPTION(mds_readdir_stream_min_entries, OPT_INT, 0) // serve readdir of dirfrags at least this big from omap pages, without loading them (0 = off)
+OPTION(mds_readdir_stream_page, OPT_INT, 1024) // omap entries read per page when streaming readdir
 OPTION(mds_decay_halflife, OPT_FLOAT, 5)
 OPTION(mds_beacon_interval, OPT_FLOAT, 4)
 OPTION(mds_beacon_grace, OPT_FLOAT, 15)
@@ -378,10 +391,13 @@ OPTION(mds_tick_interval, OPT_FLOAT, 5)
 OPTION(mds_dirstat_min_interval, OPT_FLOAT, 1)    // try to avoid propagating more often than this
 OPTION(mds_scatter_nudge_interval, OPT_FLOAT, 5)  // how quickly dirstat changes propagate up the hierarchy
 OPTION(mds_client_prealloc_inos, OPT_INT, 1000)
+OPTION(mds_client_delegate_inos, OPT_INT, 100)  // prealloc inos a client may hold for async creates
 OPTION(mds_early_reply, OPT_BOOL, true)
 OPTION(mds_default_dir_hash, OPT_INT, CEPH_STR_HASH_RJENKINS)
 OPTION(mds_log, OPT_BOOL, true)
 OPTION(mds_log_skip_corrupt_events, OPT_BOOL, false)
+OPTION(mds_log_replay_prefetch_periods, OPT_INT, 32) // journal objects to read ahead during replay (0 = journaler_prefetch_periods)
+OPTION(mds_log_replay_queue_max, OPT_INT, 4096) // decoded events waiting for replay
 OPTION(mds_log_max_events, OPT_INT, -1)
 OPTION(mds_log_events_per_segment, OPT_INT, 1024)
 OPTION(mds_log_segment_size, OPT_INT, 0)  // segment size for mds log,
@@ -413,6 +429,11 @@ OPTION(mds_bal_midchunk, OPT_FLOAT, .3)       // any sub bigger than this taken
 OPTION(mds_bal_minchunk, OPT_FLOAT, .001)     // never take anything smaller than this
 OPTION(mds_bal_target_removal_min, OPT_INT, 5) // min balance iterations before old target is removed
 OPTION(mds_bal_target_removal_max, OPT_INT, 10) // max balance iterations before old target is removed
+OPTION(mds_bal_cost_weight, OPT_FLOAT, 1.0)   // mode 3: load per ms/s of request handling time
+OPTION(mds_bal_revoke_weight, OPT_FLOAT, 2.0) // mode 3: load per cap revocation/s
+OPTION(mds_bal_hysteresis, OPT_FLOAT, .1)     // mode 3: extra overload a recent importer needs before it exports
+OPTION(mds_bal_reexport_interval, OPT_INT, 60) // mode 3: seconds before an imported subtree may be exported again
+OPTION(mds_bal_max_export_items, OPT_INT, 100000) // mode 3: don't export subtrees with more cached dentries + caps than this
 OPTION(mds_replay_interval, OPT_FLOAT, 1.0) // time to wait before starting replay again
 OPTION(mds_shutdown_check, OPT_INT, 0)
 OPTION(mds_thrash_exports, OPT_INT, 0)
@@ -858,6 +879,9 @@ OPTION(keyvaluestore_max_expected_write_size, OPT_U64, 1ULL << 24) // bytes
 OPTION(keyvaluestore_header_cache_size, OPT_INT, 4096)    // Header cache size
 OPTION(keyvaluestore_backend, OPT_STR, "leveldb")
 OPTION(keyvaluestore_dump_file, OPT_STR, "")         // file onto which store transaction dumps
+OPTION(keyvaluestore_compression, OPT_BOOL, false)   // compress object data strips
+OPTION(keyvaluestore_compression_pools, OPT_STR, "") // comma separated pool ids to compress; empty means all pools
+OPTION(keyvaluestore_compression_max_ratio, OPT_DOUBLE, .875) // store a strip raw unless it compresses below this ratio
 
 // max bytes to search ahead in journal searching for corruption
 OPTION(journal_max_corrupt_search, OPT_U64, 10<<20)
@@ -895,6 +919,8 @@ OPTION(rbd_localize_parent_reads, OPT_BOOL, true)
 OPTION(rbd_readahead_trigger_requests, OPT_INT, 10) // number of sequential requests necessary to trigger readahead
 OPTION(rbd_readahead_max_bytes, OPT_LONGLONG, 512 * 1024) // set to 0 to disable readahead
 OPTION(rbd_readahead_disable_after_bytes, OPT_LONGLONG, 50 * 1024 * 1024) // how many bytes are read in total before readahead is disabled
+OPTION(rbd_readahead_streams, OPT_INT, 1) // number of independent sequential read streams tracked
+OPTION(rbd_readahead_stride, OPT_BOOL, false) // detect strided reads and read ahead records only
 OPTION(rbd_clone_copy_on_read, OPT_BOOL, false)
 OPTION(rbd_blacklist_on_break_lock, OPT_BOOL, true) // whether to blacklist clients whose lock was broken
 OPTION(rbd_blacklist_expire_seconds, OPT_INT, 0) // number of seconds to blacklist - set to 0 for OSD default
@@ -949,6 +975,21 @@ OPTION(rgw_override_bucket_index_max_shards, OPT_U32, 0)
  */
 OPTION(rgw_bucket_index_max_aio, OPT_U32, 8)
 
+/**
+ * Whether or not to reshard the index of buckets that have grown past
+ * rgw_max_objs_per_shard entries in a shard, in the background.
+ */
+OPTION(rgw_dynamic_resharding, OPT_BOOL, false)
+OPTION(rgw_max_objs_per_shard, OPT_U32, 100000)
+OPTION(rgw_reshard_thread_interval, OPT_U32, 600) // seconds between scans for buckets to reshard
+/**
+ * Most seconds a reshard waits, once it fenced the old index, for the
+ * updates started on it to complete; updates started longer ago than
+ * this are taken as abandoned.
+ */
+OPTION(rgw_reshard_grace, OPT_U32, 10)
+OPTION(rgw_reshard_max_passes, OPT_U32, 10) // catch-up passes over the index log before switching
+
 /**
  * whether or not the quota/gc threads should be started
  */
@@ -959,6 +1000,12 @@ OPTION(rgw_data, OPT_STR, "/var/lib/ceph/radosgw/$cluster-$id")
 OPTION(rgw_enable_apis, OPT_STR, "s3, swift, swift_auth, admin")
 OPTION(rgw_cache_enabled, OPT_BOOL, true)   // rgw cache enabled
 OPTION(rgw_cache_lru_size, OPT_INT, 10000)   // num of entries in rgw cache
+OPTION(rgw_cache_shards, OPT_INT, 16)   // rgw cache is split in this many shards, by name
+OPTION(rgw_data_cache_enabled, OPT_BOOL, false)   // cache the data of objects read
+OPTION(rgw_data_cache_size, OPT_U64, 512ul << 20)   // bytes of object data cached in RAM
+OPTION(rgw_data_cache_max_obj_size, OPT_U64, 16ul << 20)   // larger objects are not cached
+OPTION(rgw_data_cache_path, OPT_STR, "")   // directory (e.g., on a local SSD) for data pushed out of RAM
+OPTION(rgw_data_cache_path_size, OPT_U64, 10ULL << 30)   // bytes of object data cached in rgw_data_cache_path
 OPTION(rgw_socket_path, OPT_STR, "")   // path to unix domain socket, if not specified, rgw will not run as external fcgi
 OPTION(rgw_host, OPT_STR, "")  // host for radosgw, can be an IP, default is 0.0.0.0
 OPTION(rgw_port, OPT_STR, "")  // port to listen, format as "8080" "5000", if not specified, rgw will not run external fcgi
@@ -1008,6 +1055,10 @@ OPTION(rgw_enable_usage_log, OPT_BOOL, false) // enable logging bandwidth usage
 OPTION(rgw_ops_log_rados, OPT_BOOL, true) // whether ops log should go to rados
 OPTION(rgw_ops_log_socket_path, OPT_STR, "") // path to unix domain socket where ops log can go
 OPTION(rgw_ops_log_data_backlog, OPT_INT, 5 << 20) // max data backlog for ops log
+OPTION(rgw_ops_log_socket_binary, OPT_BOOL, false) // ops log socket gets the encoded entries rather than json
+OPTION(rgw_ops_log_batch_size, OPT_INT, 1 << 20) // bytes of ops log entries that are written out together
+OPTION(rgw_ops_log_flush_interval, OPT_INT, 1) // write ops log entries out at least every X seconds
+OPTION(rgw_ops_log_max_pending, OPT_INT, 64 << 20) // max bytes of ops log entries waiting to be written out
 OPTION(rgw_usage_log_flush_threshold, OPT_INT, 1024) // threshold to flush pending log data
 OPTION(rgw_usage_log_tick_interval, OPT_INT, 30) // flush pending log data every X seconds
 OPTION(rgw_intent_log_object_name, OPT_STR, "%Y-%m-%d-%i-%n")  // man date to see codes (a subset are supported)
@@ -1018,6 +1069,9 @@ OPTION(rgw_gc_max_objs, OPT_INT, 32)
 OPTION(rgw_gc_obj_min_wait, OPT_INT, 2 * 3600)    // wait time before object may be handled by gc
 OPTION(rgw_gc_processor_max_time, OPT_INT, 3600)  // total run time for a single gc processor work
 OPTION(rgw_gc_processor_period, OPT_INT, 3600)  // gc processor cycle time
+OPTION(rgw_gc_processor_threads, OPT_INT, 4)  // gc shards processed at once
+OPTION(rgw_gc_max_concurrent_io, OPT_INT, 32)  // max tail object removals in flight
+OPTION(rgw_gc_slow_io_ms, OPT_INT, 500)  // removals slower than this shrink the gc window
 OPTION(rgw_s3_success_create_obj_status, OPT_INT, 0) // alternative success status response for create-obj (0 - default)
 OPTION(rgw_resolve_cname, OPT_BOOL, false)  // should rgw try to resolve hostname as a dns cname record
 OPTION(rgw_obj_stripe_size, OPT_INT, 4 << 20)
@@ -1044,6 +1098,7 @@ OPTION(rgw_replica_log_obj_prefix, OPT_STR, "replica_log") //
 OPTION(rgw_bucket_quota_ttl, OPT_INT, 600) // time for cached bucket stats to be cached within rgw instance
 OPTION(rgw_bucket_quota_soft_threshold, OPT_DOUBLE, 0.95) // threshold from which we don't rely on cached info for quota decisions
 OPTION(rgw_bucket_quota_cache_size, OPT_INT, 10000) // number of entries in bucket quota cache
+OPTION(rgw_bucket_quota_max_age, OPT_INT, 3600) // cached stats this old (as refreshes failed) are read again before use; 0 to go on with them
 
 OPTION(rgw_expose_bucket, OPT_BOOL, false) // Return the bucket name in the 'Bucket' response header
 
@@ -1056,6 +1111,7 @@ OPTION(rgw_user_quota_sync_wait_time, OPT_INT, 3600 * 24) // min time between tw
 
 OPTION(rgw_multipart_min_part_size, OPT_INT, 5 * 1024 * 1024) // min size for each part (except for last one) in multipart upload
 OPTION(rgw_multipart_part_upload_limit, OPT_INT, 10000) // parts limit in multipart upload
+OPTION(rgw_multipart_complete_max_aio, OPT_INT, 8) // part info reads in flight when completing a multipart upload
 
 OPTION(rgw_olh_pending_timeout_sec, OPT_INT, 3600) // time until we retire a pending olh change
 
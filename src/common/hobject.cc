@@ -135,6 +135,47 @@ void hobject_t::decode(bufferlist::iterator& bl)
   build_filestore_key_cache();
 }
 
+size_t hobject_t::encoded_size() const
+{
+  return UNCHECKED_STRUCT_HEADER_SIZE +
+    unchecked_string_size(key) + unchecked_string_size(oid.name) +
+    sizeof(snap.val) + sizeof(hash) + 1 +
+    unchecked_string_size(nspace) + sizeof(pool);
+}
+
+void hobject_t::encode_unchecked(unchecked_encoder& e) const
+{
+  char *len = e.start_struct(4, 3);
+  e.put_string(key);
+  e.put_string(oid.name);
+  e.put_le64(snap.val);
+  e.put_le32(hash);
+  e.put_bool(max);
+  e.put_string(nspace);
+  e.put_le64(pool);
+  e.finish_struct(len);
+}
+
+bool hobject_t::decode_unchecked(unchecked_decoder& d)
+{
+  const char *end;
+  if (!d.start_struct(4, &end))
+    return false;
+  d.get_string(key);
+  d.get_string(oid.name);
+  d.need(sizeof(snap.val) + sizeof(hash) + 1);
+  snap.val = d.get_le64();
+  hash = d.get_le32();
+  max = d.get_bool();
+  d.get_string(nspace);
+  d.need(sizeof(pool));
+  pool = d.get_le64();
+  if (!d.finish_struct(end))
+    return false;
+  build_filestore_key_cache();
+  return true;
+}
+
 void hobject_t::decode(json_spirit::Value& v)
 {
   using namespace json_spirit;
@@ -223,6 +223,9 @@ public:
   void encode(bufferlist& bl) const;
   void decode(bufferlist::iterator& bl);
   void decode(json_spirit::Value& v);
+  size_t encoded_size() const;
+  void encode_unchecked(unchecked_encoder& e) const;
+  bool decode_unchecked(unchecked_decoder& d);
   void dump(Formatter *f) const;
   static void generate_test_instances(list<hobject_t*>& o);
   friend bool operator<(const hobject_t&, const hobject_t&);
@@ -45,6 +45,13 @@ public:
    * - if ctx is set will return true if object is found and updated
    */
   bool find_and_update(const K& key, V *value, UpdateContext *ctx);
+  /*
+   * find_or_add()
+   *
+   * - will return true and set value if object is found
+   * - will add value otherwise
+   */
+  bool find_or_add(const K& key, V& value);
   void add(const K& key, V& value);
   void erase(const K& key);
 };
@@ -88,6 +95,16 @@ bool lru_map<K, V>::find_and_update(const K& key, V *value, UpdateContext *ctx)
   return _find(key, value, ctx);
 }
 
+template <class K, class V>
+bool lru_map<K, V>::find_or_add(const K& key, V& value)
+{
+  Mutex::Locker l(lock);
+  if (_find(key, &value, NULL))
+    return true;
+  _add(key, value);
+  return false;
+}
+
 template <class K, class V>
 void lru_map<K, V>::_add(const K& key, V& value)
 {
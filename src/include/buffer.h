@@ -119,6 +119,26 @@ public:
   /// enable/disable tracking of buffer::ptr::c_str() calls
   static void track_c_str(bool b);
 
+  /// buffer pool activity, see get_pool_stats()
+  struct pool_stats_t {
+    uint64_t alloc_cached;  ///< allocations served from a pool
+    uint64_t alloc_system;  ///< allocations passed to the system allocator
+    uint64_t free_cached;   ///< frees kept in a pool
+    uint64_t free_system;   ///< frees passed to the system allocator
+    uint64_t thread_bytes;  ///< bytes held in per-thread caches
+    uint64_t central_bytes; ///< bytes held in the shared cache
+    uint64_t threads;       ///< threads with a cache
+  };
+  /// enable/disable size-class pools for raw data
+  static void enable_pool(bool b);
+  static bool get_pool_enabled();
+  /// bound what all the per-thread caches hold together
+  static void set_pool_thread_max_bytes(uint64_t max);
+  /// collect pool counters from all threads
+  static void get_pool_stats(pool_stats_t *s);
+  /// release the shared and the calling thread's cached buffers
+  static void trim_pool();
+
 private:
  
   /* hack for memory utilization debugging. */
@@ -137,6 +157,7 @@ private:
   class raw_char;
   class raw_pipe;
   class raw_unshareable; // diagnostic, unshareable char buffer
+  class raw_pooled;
 
   friend std::ostream& operator<<(std::ostream& out, const raw &r);
 
@@ -460,6 +481,16 @@ public:
     void append(const list& bl);
     void append(std::istream& in);
     void append_zero(unsigned len);
+    /*
+     * make sure the next prealloc bytes of small appends land in a
+     * single contiguous buffer.
+     */
+    void reserve(unsigned prealloc);
+    /*
+     * append len bytes for the caller to fill in through the pointer
+     * returned: they are contiguous, and already counted in length().
+     */
+    char *append_hole(unsigned len);
     
     /*
      * get a char
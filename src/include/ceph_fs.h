@@ -424,6 +424,10 @@ union ceph_mds_request_args {
 
 #define CEPH_MDS_FLAG_REPLAY        1  /* this is a replayed op */
 #define CEPH_MDS_FLAG_WANT_DENTRY   2  /* want dentry in reply */
+#define CEPH_MDS_FLAG_WANT_DELEG_INOS 4  /* delegate prealloc inos in reply */
+#define CEPH_MDS_FLAG_READDIR_KEY_ORDER 8  /* readdir: may list in dentry key
+					      order; with an offset, resume
+					      a listing that is in it */
 
 struct ceph_mds_request_head {
 	__le64 oldest_client_tid;
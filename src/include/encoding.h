@@ -922,4 +922,153 @@ inline void decode(std::deque<T>& ls, bufferlist::iterator& p)
       bl.advance(struct_end - bl.get_off());				\
   }
 
+
+/*
+ * Unchecked encoding, for the few types hot enough to be worth it.
+ *
+ * The type computes its exact encoded_size() up front, the caller makes
+ * room for that many contiguous bytes, and the fields are stored through
+ * a pointer without any per-field bounds or append bookkeeping.  The
+ * decoder reads from one contiguous buffer::ptr and only checks lengths
+ * that come off the wire (strings, bufferlists, vectors) and each fixed
+ * size run once with need().  The layouts are the same as those of
+ * ENCODE_START/::encode() above, so either side can be mixed with the
+ * checked one.
+ */
+struct unchecked_encoder {
+  char *p;
+
+  explicit unchecked_encoder(char *_p) : p(_p) {}
+
+  void put_u8(__u8 v) {
+    *p++ = v;
+  }
+  void put_le16(__u16 v) {
+    *(ceph_le16 *)p = v;
+    p += sizeof(ceph_le16);
+  }
+  void put_le32(__u32 v) {
+    *(ceph_le32 *)p = v;
+    p += sizeof(ceph_le32);
+  }
+  void put_le64(__u64 v) {
+    *(ceph_le64 *)p = v;
+    p += sizeof(ceph_le64);
+  }
+  void put_bool(bool v) {
+    put_u8(v ? 1 : 0);
+  }
+  void put_string(const std::string& s) {
+    put_le32(s.length());
+    memcpy(p, s.data(), s.length());
+    p += s.length();
+  }
+  void put_bufferlist(const bufferlist& bl) {
+    put_le32(bl.length());
+    for (std::list<bufferptr>::const_iterator it = bl.buffers().begin();
+	 it != bl.buffers().end();
+	 ++it) {
+      memcpy(p, it->c_str(), it->length());
+      p += it->length();
+    }
+  }
+
+  /* ENCODE_START/ENCODE_FINISH */
+  char *start_struct(__u8 v, __u8 compat) {
+    put_u8(v);
+    put_u8(compat);
+    char *len = p;
+    p += sizeof(ceph_le32);
+    return len;
+  }
+  void finish_struct(char *len) {
+    *(ceph_le32 *)len = (__u32)(p - len - sizeof(ceph_le32));
+  }
+};
+
+/* the encoded size of the pieces, to add up an exact encoded_size() */
+#define UNCHECKED_STRUCT_HEADER_SIZE (2 + sizeof(ceph_le32))
+static inline size_t unchecked_string_size(const std::string& s) {
+  return sizeof(ceph_le32) + s.length();
+}
+static inline size_t unchecked_bufferlist_size(const bufferlist& bl) {
+  return sizeof(ceph_le32) + bl.length();
+}
+
+struct unchecked_decoder {
+  bufferptr bp;       /* so that bufferlists can share it */
+  const char *start, *p, *end;
+
+  explicit unchecked_decoder(const bufferptr& _bp)
+    : bp(_bp), start(bp.c_str()), p(start), end(start + bp.length()) {}
+
+  unsigned get_off() const {
+    return p - start;
+  }
+  void need(size_t n) const {
+    if (n > (size_t)(end - p))
+      throw buffer::end_of_buffer();
+  }
+
+  __u8 get_u8() {
+    return *p++;
+  }
+  __u16 get_le16() {
+    __u16 v = *(const ceph_le16 *)p;
+    p += sizeof(ceph_le16);
+    return v;
+  }
+  __u32 get_le32() {
+    __u32 v = *(const ceph_le32 *)p;
+    p += sizeof(ceph_le32);
+    return v;
+  }
+  __u64 get_le64() {
+    __u64 v = *(const ceph_le64 *)p;
+    p += sizeof(ceph_le64);
+    return v;
+  }
+  bool get_bool() {
+    return get_u8() != 0;
+  }
+  /* these check their length, and leave the next need() to the caller */
+  void get_string(std::string& s) {
+    need(sizeof(ceph_le32));
+    __u32 len = get_le32();
+    need(len);
+    s.assign(p, len);
+    p += len;
+  }
+  void get_bufferlist(bufferlist& bl) {
+    need(sizeof(ceph_le32));
+    __u32 len = get_le32();
+    need(len);
+    bl.clear();
+    if (len)
+      bl.append(bufferptr(bp, get_off(), len));
+    p += len;
+  }
+
+  /*
+   * DECODE_START, for exactly version v only: false if the encoding is
+   * any other, or does not fit in what is left, for the caller to go the
+   * checked way instead.
+   */
+  bool start_struct(__u8 v, const char **struct_end) {
+    if ((size_t)(end - p) < UNCHECKED_STRUCT_HEADER_SIZE)
+      return false;
+    __u8 struct_v = get_u8();
+    get_u8();
+    __u32 len = get_le32();
+    if (struct_v != v || (size_t)(end - p) < len)
+      return false;
+    *struct_end = p + len;
+    return true;
+  }
+  /* DECODE_FINISH: false if the struct was not what we made of it */
+  bool finish_struct(const char *struct_end) const {
+    return p == struct_end;
+  }
+};
+
 #endif
@@ -272,6 +272,10 @@ class LRU {
   }
 
 
+  // walk the bottom list, coldest first
+  LRUObject *lru_get_bot_tail() { return lru_bot.get_tail(); }
+  static LRUObject *lru_get_prev(LRUObject *o) { return o->lru_prev; }
+
   // expire -- expire a single item
   LRUObject *lru_get_next_expire() {
     LRUObject *p;
@@ -230,6 +230,8 @@ public:
 
     readahead.set_trigger_requests(readahead_trigger_requests);
     readahead.set_max_readahead_size(readahead_max_bytes);
+    readahead.set_max_streams(readahead_streams);
+    readahead.set_stride_detection(readahead_stride);
 
     return 0;
   }
@@ -852,6 +854,8 @@ public:
         "rbd_readahead_trigger_requests", false)(
         "rbd_readahead_max_bytes", false)(
         "rbd_readahead_disable_after_bytes", false)(
+        "rbd_readahead_streams", false)(
+        "rbd_readahead_stride", false)(
         "rbd_clone_copy_on_read", false)(
         "rbd_blacklist_on_break_lock", false)(
         "rbd_blacklist_expire_seconds", false)(
@@ -918,6 +922,8 @@ public:
     ASSIGN_OPTION(readahead_trigger_requests);
     ASSIGN_OPTION(readahead_max_bytes);
     ASSIGN_OPTION(readahead_disable_after_bytes);
+    ASSIGN_OPTION(readahead_streams);
+    ASSIGN_OPTION(readahead_stride);
     ASSIGN_OPTION(clone_copy_on_read);
     ASSIGN_OPTION(blacklist_on_break_lock);
     ASSIGN_OPTION(blacklist_expire_seconds);
@@ -4017,10 +4017,14 @@ reprotect_and_return_err:
     object_t oid;
     uint64_t offset;
     uint64_t length;
+    utime_t start;
     C_RBD_Readahead(ImageCtx *ictx, object_t oid, uint64_t offset, uint64_t length)
-      : ictx(ictx), oid(oid), offset(offset), length(length) { }
+      : ictx(ictx), oid(oid), offset(offset), length(length),
+	start(ceph_clock_now(ictx->cct)) { }
     void finish(int r) {
       ldout(ictx->cct, 20) << "C_RBD_Readahead on " << oid << ": " << offset << "+" << length << dendl;
+      if (r >= 0)
+	ictx->readahead.record_latency(ceph_clock_now(ictx->cct) - start);
       ictx->readahead.dec_pending();
     }
   };
@@ -4045,11 +4049,14 @@ reprotect_and_return_err:
     if (abort) {
       return;
     }
-    pair<uint64_t, uint64_t> readahead_extent = ictx->readahead.update(image_extents, image_size);
-    uint64_t readahead_offset = readahead_extent.first;
-    uint64_t readahead_length = readahead_extent.second;
+    vector<pair<uint64_t, uint64_t> > readahead_extents;
+    ictx->readahead.update(image_extents, image_size, &readahead_extents);
 
-    if (readahead_length > 0) {
+    for (vector<pair<uint64_t, uint64_t> >::iterator r = readahead_extents.begin();
+	 r != readahead_extents.end();
+	 ++r) {
+      uint64_t readahead_offset = r->first;
+      uint64_t readahead_length = r->second;
       ldout(ictx->cct, 20) << "(readahead logical) " << readahead_offset << "~" << readahead_length << dendl;
       map<object_t,vector<ObjectExtent> > readahead_object_extents;
       Striper::file_to_extents(ictx->cct, ictx->format_string, &ictx->layout,
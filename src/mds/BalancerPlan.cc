@@ -0,0 +1,129 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "BalancerPlan.h"
+
+using std::map;
+using std::multimap;
+using std::pair;
+
+double BalancerPlan::get_export_threshold(mds_rank_t r) const
+{
+  double f = 1.0 + min_rebalance;
+  if (prev_importers.count(r))
+    f += hysteresis;
+  return target_load * f;
+}
+
+bool BalancerPlan::is_exporter(mds_rank_t r) const
+{
+  return get_load(r) >= get_export_threshold(r);
+}
+
+double BalancerPlan::try_match(mds_rank_t ex, double& maxex,
+			       mds_rank_t im, double& maxim)
+{
+  if (maxex <= 0 || maxim <= 0) return 0.0;
+
+  double howmuch = MIN(maxex, maxim);
+  if (howmuch <= 0) return 0.0;
+
+  targets[ex][im] += howmuch;
+
+  exported[ex] += howmuch;
+  imported[im] += howmuch;
+
+  maxex -= howmuch;
+  maxim -= howmuch;
+
+  return howmuch;
+}
+
+void BalancerPlan::plan(int beat)
+{
+  targets.clear();
+  imported.clear();
+  exported.clear();
+  prev_importers.swap(cur_importers);
+  cur_importers.clear();
+
+  double total_load = 0;
+  for (map<mds_rank_t, double>::iterator p = loads.begin(); p != loads.end(); ++p)
+    total_load += p->second;
+  target_load = loads.empty() ? 0 : total_load / (double)loads.size();
+
+  // first separate exporters and importers.  a recent importer that is
+  // over the target but held back by hysteresis is neither.
+  multimap<double,mds_rank_t> importers;
+  multimap<double,mds_rank_t> exporters;
+  for (map<mds_rank_t, double>::iterator p = loads.begin(); p != loads.end(); ++p) {
+    if (p->second < target_load)
+      importers.insert(pair<double,mds_rank_t>(p->second, p->first));
+    else if (hysteresis <= 0 || !prev_importers.count(p->first) ||
+	     is_exporter(p->first))
+      exporters.insert(pair<double,mds_rank_t>(p->second, p->first));
+  }
+
+  // analyze import_map; do any matches i can
+  for (multimap<double,mds_rank_t>::reverse_iterator ex = exporters.rbegin();
+       ex != exporters.rend();
+       ++ex) {
+    double maxex = get_maxex(ex->second);
+    if (maxex <= .001) continue;
+
+    // check importers. for now, just in arbitrary order (no intelligent matching).
+    map<mds_rank_t, float>& from = import_map[ex->second];
+    for (map<mds_rank_t, float>::iterator im = from.begin();
+	 im != from.end();
+	 ++im) {
+      double maxim = get_maxim(im->first);
+      if (maxim <= .001) continue;
+      try_match(ex->second, maxex,
+		im->first, maxim);
+      if (maxex <= .001) break;
+    }
+  }
+
+  if (beat % 2 == 1) {
+    // old way: big exporters to big importers
+    multimap<double,mds_rank_t>::reverse_iterator ex = exporters.rbegin();
+    multimap<double,mds_rank_t>::iterator im = importers.begin();
+    while (ex != exporters.rend() &&
+	   im != importers.end()) {
+      double maxex = get_maxex(ex->second);
+      double maxim = get_maxim(im->second);
+      if (maxex < .001 || maxim < .001) break;
+      try_match(ex->second, maxex,
+		im->second, maxim);
+      if (maxex <= .001) ++ex;
+      if (maxim <= .001) ++im;
+    }
+  } else {
+    // new way: small exporters to big importers
+    multimap<double,mds_rank_t>::iterator ex = exporters.begin();
+    multimap<double,mds_rank_t>::iterator im = importers.begin();
+    while (ex != exporters.end() &&
+	   im != importers.end()) {
+      double maxex = get_maxex(ex->second);
+      double maxim = get_maxim(im->second);
+      if (maxex < .001 || maxim < .001) break;
+      try_match(ex->second, maxex,
+		im->second, maxim);
+      if (maxex <= .001) ++ex;
+      if (maxim <= .001) ++im;
+    }
+  }
+
+  for (map<mds_rank_t, double>::iterator p = imported.begin(); p != imported.end(); ++p)
+    if (p->second > 0)
+      cur_importers.insert(p->first);
+}
@@ -0,0 +1,92 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MDS_BALANCERPLAN_H
+#define CEPH_MDS_BALANCERPLAN_H
+
+#include <map>
+#include <set>
+
+#include "mdstypes.h"
+
+/**
+ * BalancerPlan - decide how much load each rank should move where
+ *
+ * Given the load of every rank and what each rank has imported from
+ * whom (as gathered from MHeartbeats), match overloaded ranks to
+ * underloaded ones.  Every rank computes the same plan from the same
+ * inputs and acts on its own row of targets.
+ *
+ * This has no MDS dependencies so that heartbeat traces can be
+ * replayed offline (see test/mds/TestBalancerPlan.cc).
+ */
+class BalancerPlan {
+public:
+  /// rank -> load, in the units subtree loads are measured in
+  std::map<mds_rank_t, double> loads;
+  /// rank -> (rank it imported from -> load of those imports)
+  std::map<mds_rank_t, std::map<mds_rank_t, float> > import_map;
+  /// a rank must be this fraction above the target to export
+  double min_rebalance;
+  /**
+   * a rank that imported in the previous plan must additionally be this
+   * fraction above the target before it exports, so that load does not
+   * bounce back and forth between ranks near the target; 0 disables
+   */
+  double hysteresis;
+
+  /// output: the average load
+  double target_load;
+  /// output: exporter -> importer -> load to move
+  std::map<mds_rank_t, std::map<mds_rank_t, double> > targets;
+
+  BalancerPlan()
+    : min_rebalance(.1), hysteresis(0), target_load(0) {}
+
+  /**
+   * Compute targets from loads and import_map.  beat alternates between
+   * matching the biggest and the smallest exporters to the biggest
+   * importers first.
+   */
+  void plan(int beat);
+
+  /// whether r is loaded enough to export, per the last plan()
+  bool is_exporter(mds_rank_t r) const;
+  /// the load above which r exports, per the last plan()
+  double get_export_threshold(mds_rank_t r) const;
+
+  /// forget which ranks imported recently
+  void reset_history() {
+    prev_importers.clear();
+    cur_importers.clear();
+  }
+
+private:
+  std::map<mds_rank_t, double> imported, exported;
+  std::set<mds_rank_t> prev_importers;  ///< importers in the previous plan
+  std::set<mds_rank_t> cur_importers;   ///< importers in the last plan
+
+  double get_load(mds_rank_t r) const {
+    std::map<mds_rank_t, double>::const_iterator p = loads.find(r);
+    return p == loads.end() ? 0 : p->second;
+  }
+  double get_maxim(mds_rank_t im) {
+    return target_load - get_load(im) - imported[im];
+  }
+  double get_maxex(mds_rank_t ex) {
+    return get_load(ex) - target_load - exported[ex];
+  }
+  double try_match(mds_rank_t ex, double& maxex,
+		   mds_rank_t im, double& maxim);
+};
+
+#endif
@@ -145,6 +145,13 @@ void CDentry::add_waiter(uint64_t tag, MDSInternalContextBase *c)
 }
 
 
+void CDentry::drop_cached_stat()
+{
+  if (state_test(STATE_STATCACHED))
+    dir->cache->stat_cache.remove_dentry(this);
+}
+
+
 version_t CDentry::pre_dirty(version_t min)
 {
   projected_version = dir->pre_dirty(min);
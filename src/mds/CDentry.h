@@ -28,6 +28,7 @@
 #include "mdstypes.h"
 
 #include "SimpleLock.h"
+#include "CacheMemory.h"
 #include "LocalLock.h"
 
 class CInode;
@@ -60,9 +61,11 @@ public:
     void *n = pool.malloc();
     if (!n)
       throw std::bad_alloc();
+    CacheMemory::alloc(CacheMemory::POOL_DENTRY, sizeof(CDentry));
     return n;
   }
   void operator delete(void *p) {
+    CacheMemory::free(CacheMemory::POOL_DENTRY, sizeof(CDentry));
     pool.free(p);
   }
 
@@ -73,6 +76,7 @@ public:
   static const int STATE_PURGING =      (1<<2);
   static const int STATE_BADREMOTEINO = (1<<3);
   static const int STATE_EVALUATINGSTRAY = (1<<4);
+  static const int STATE_STATCACHED =   (1<<5);  // may be in the StatCache
   // stray dentry needs notification of releasing reference
   static const int STATE_STRAY =	STATE_NOTIFYREF;
 
@@ -93,6 +97,7 @@ public:
   //static const int WAIT_LOCK_OFFSET = 8;
 
   void add_waiter(uint64_t tag, MDSInternalContextBase *c);
+  void drop_cached_stat();
 
   static const unsigned EXPORT_NONCE = 1;
 
@@ -179,6 +184,7 @@ public:
     versionlock(this, &versionlock_type) {
     g_num_dn++;
     g_num_dna++;
+    CacheMemory::recharge(CacheMemory::POOL_DENTRY_DATA, 0, get_data_bytes());
   }
   CDentry(const std::string& n, __u32 h, inodeno_t ino, unsigned char dt,
 	  snapid_t f, snapid_t l) :
@@ -191,12 +197,20 @@ public:
     versionlock(this, &versionlock_type) {
     g_num_dn++;
     g_num_dna++;
+    CacheMemory::recharge(CacheMemory::POOL_DENTRY_DATA, 0, get_data_bytes());
     linkage.remote_ino = ino;
     linkage.remote_d_type = dt;
   }
   ~CDentry() {
     g_num_dn--;
     g_num_dns++;
+    CacheMemory::recharge(CacheMemory::POOL_DENTRY_DATA, get_data_bytes(), 0);
+  }
+
+  /// name plus its node in CDir::items, charged to the cache memory pool
+  size_t get_data_bytes() const {
+    return name.length() + sizeof(dentry_key_t) + sizeof(CDentry*) +
+      CacheMemory::MAP_NODE_BYTES;
   }
 
 
@@ -361,7 +375,7 @@ public:
   // ---------------------------------------------
   // replicas (on clients)
  public:
-  map<client_t,ClientLease*> client_lease_map;
+  compact_map<client_t,ClientLease*> client_lease_map;
 
   bool is_any_leases() const {
     return !client_lease_map.empty();
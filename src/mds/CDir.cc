@@ -454,6 +454,8 @@ void CDir::remove_dentry(CDentry *dn)
   // there should be no client leases at this point!
   assert(dn->client_lease_map.empty());
 
+  dn->drop_cached_stat();
+
   if (state_test(CDir::STATE_DNPINNEDFRAG)) {
     dn->put(CDentry::PIN_FRAGMENTING);
     dn->state_clear(CDentry::STATE_FRAGMENTING);
@@ -603,6 +605,8 @@ void CDir::unlink_inode_work( CDentry *dn )
 {
   CInode *in = dn->get_linkage()->get_inode();
 
+  dn->drop_cached_stat();
+
   if (dn->get_linkage()->is_remote()) {
     // remote
     if (in) 
@@ -784,6 +788,8 @@ void CDir::steal_dentry(CDentry *dn)
 {
   dout(15) << "steal_dentry " << *dn << dendl;
 
+  dn->drop_cached_stat();  // its dirstat names the old dirfrag
+
   items[dn->key()] = dn;
 
   dn->dir->items.erase(dn->key());
@@ -1540,6 +1546,113 @@ void CDir::_omap_fetch(const string& want_dn)
 			     new C_OnFinisher(fin, &cache->mds->finisher));
 }
 
+class C_IO_Dir_OMAP_FetchedPage : public CDirIOContext {
+  MDSInternalContextBase *fin;
+ public:
+  int *rval;
+  int ret;
+  C_IO_Dir_OMAP_FetchedPage(CDir *d, int *r, MDSInternalContextBase *c) :
+    CDirIOContext(d), fin(c), rval(r), ret(0) { }
+  void finish(int r) {
+    if (r >= 0)
+      r = ret;
+    *rval = r;
+    dir->auth_unpin(dir);
+    fin->complete(r);
+  }
+};
+
+void CDir::fetch_page(const string& after_key, unsigned max,
+		      map<string, bufferlist> *out, int *rval,
+		      MDSInternalContextBase *c)
+{
+  dout(10) << "fetch_page after '" << after_key << "' max " << max
+	   << " on " << *this << dendl;
+  assert(is_auth());
+
+  if (cache->mds->logger) cache->mds->logger->inc(l_mds_dir_fetch_page);
+
+  auth_pin(this);
+  out->clear();
+  C_IO_Dir_OMAP_FetchedPage *fin = new C_IO_Dir_OMAP_FetchedPage(this, rval, c);
+  object_t oid = get_ondisk_object();
+  object_locator_t oloc(cache->mds->mdsmap->get_metadata_pool());
+  ObjectOperation rd;
+  rd.omap_get_vals(after_key, "", max, out, &fin->ret);
+  cache->mds->objecter->read(oid, oloc, rd, CEPH_NOSNAP, NULL, 0,
+			     new C_OnFinisher(fin, &cache->mds->finisher));
+}
+
+int CDir::decode_listed_dentry(bufferlist& bl, listed_dentry_t *ld)
+{
+  try {
+    bufferlist::iterator q = bl.begin();
+    ::decode(ld->first, q);
+    ::decode(ld->type, q);
+    if (ld->type == 'L') {
+      ::decode(ld->remote_ino, q);
+      ::decode(ld->remote_d_type, q);
+    } else if (ld->type == 'I') {
+      ld->inode.decode_bare(q);
+    } else {
+      return -EINVAL;
+    }
+  } catch (buffer::error& e) {
+    return -EINVAL;
+  }
+  return 0;
+}
+
+void CDir::get_head_dentries_in_key_range(const string& after_key,
+					  const string *last_key,
+					  map<string, CDentry*>& out)
+{
+  string after_name;
+  if (!after_key.empty()) {
+    snapid_t snap;
+    dentry_key_t::decode_helper(after_key, after_name, snap);
+  }
+
+  // a proper prefix of after_name sorts after it by key if the next
+  // character of after_name is below '_'
+  list<CDentry*> candidates;
+  for (size_t i = 1; i < after_name.length(); ++i) {
+    CDentry *dn = lookup(after_name.substr(0, i));
+    if (dn)
+      candidates.push_back(dn);
+  }
+
+  // any name at or beyond <last name> + ('_' + 1) sorts after last_key
+  string stop_name;
+  if (last_key) {
+    snapid_t snap;
+    dentry_key_t::decode_helper(*last_key, stop_name, snap);
+    stop_name += (char)('_' + 1);
+  }
+  map_t::iterator p = after_name.empty() ? items.begin() :
+    items.lower_bound(dentry_key_t(0, after_name.c_str()));
+  for (; p != items.end(); ++p) {
+    if (last_key && stop_name.compare(p->first.name) <= 0)
+      break;
+    candidates.push_back(p->second);
+  }
+
+  for (list<CDentry*>::iterator q = candidates.begin();
+       q != candidates.end();
+       ++q) {
+    CDentry *dn = *q;
+    if (dn->last != CEPH_NOSNAP)
+      continue;
+    string key;
+    dn->key().encode(key);
+    if (key.compare(after_key) <= 0)
+      continue;
+    if (last_key && key.compare(*last_key) > 0)
+      continue;
+    out[key] = dn;
+  }
+}
+
 CDentry *CDir::_load_dentry(
     const std::string &key,
     const std::string &dname,
@@ -1662,6 +1775,7 @@ CDentry *CDir::_load_dentry(
           in->symlink = inode_data.symlink;
         
         in->dirfragtree.swap(inode_data.dirfragtree);
+        in->clear_packed_xattrs();
         in->xattrs.swap(inode_data.xattrs);
         in->old_inodes.swap(inode_data.old_inodes);
         in->oldest_snap = inode_data.oldest_snap;
@@ -1672,6 +1786,8 @@ CDentry *CDir::_load_dentry(
         if (!undef_inode) {
           cache->add_inode(in); // add
           dn = add_primary_dentry(dname, in, first, last); // link
+        } else {
+          in->update_mem_charge();
         }
         dout(12) << "_fetched  got " << *dn << " " << *in << dendl;
 
@@ -1898,7 +2014,8 @@ void CDir::go_bad()
  * @param want - min version i want committed
  * @param c - callback for completion
  */
-void CDir::commit(version_t want, MDSInternalContextBase *c, bool ignore_authpinnability, int op_prio)
+void CDir::commit(version_t want, MDSInternalContextBase *c, bool ignore_authpinnability, int op_prio,
+		  LogSegment *ls)
 {
   dout(10) << "commit want " << want << " on " << *this << dendl;
   if (want == 0) want = get_version();
@@ -1928,7 +2045,7 @@ void CDir::commit(version_t want, MDSInternalContextBase *c, bool ignore_authpin
   waiting_for_commit[want].push_back(c);
   
   // ok.
-  _commit(want, op_prio);
+  _commit(want, op_prio, ls);
 }
 
 class C_IO_Dir_Committed : public CDirIOContext {
@@ -1943,8 +2060,12 @@ public:
 /**
  * Flush out the modified dentries in this dir. Keep the bufferlist
  * below max_write_size;
+ *
+ * The writes go through the MDCache's DirCommitScheduler, which sends
+ * those for the oldest LogSegment (\p ls, if the commit is for one)
+ * first.
  */
-void CDir::_omap_commit(int op_prio)
+void CDir::_omap_commit(int op_prio, LogSegment *ls)
 {
   dout(10) << "_omap_commit" << dendl;
 
@@ -1975,9 +2096,10 @@ void CDir::_omap_commit(int op_prio)
 								 get_version()),
 					  &cache->mds->finisher));
 
-  SnapContext snapc;
   object_t oid = get_ondisk_object();
   object_locator_t oloc(cache->mds->mdsmap->get_metadata_pool());
+  uint64_t seq = ls ? ls->seq : 0;
+  bool first = true;
 
   if (!stale_items.empty()) {
     for (compact_set<string>::iterator p = stale_items.begin();
@@ -2022,22 +2144,29 @@ void CDir::_omap_commit(int op_prio)
     }
 
     if (write_size >= max_write_size) {
-      ObjectOperation op;
-      op.priority = op_prio;
+      ObjectOperation *op = new ObjectOperation;
+      op->priority = op_prio;
 
       // don't create new dirfrag blindly
       if (!is_new() && !state_test(CDir::STATE_FRAGMENTING))
-	op.stat(NULL, (utime_t*)NULL, NULL);
+	op->stat(NULL, (utime_t*)NULL, NULL);
 
-      op.tmap_to_omap(true); // convert tmap to omap
+      // convert tmap to omap; writes to the object are applied in order,
+      // so only the first needs to
+      if (first)
+	op->tmap_to_omap(true);
+      first = false;
 
       if (!to_set.empty())
-	op.omap_set(to_set);
+	op->omap_set(to_set);
       if (!to_remove.empty())
-	op.omap_rm_keys(to_remove);
+	op->omap_rm_keys(to_remove);
 
-      cache->mds->objecter->mutate(oid, oloc, op, snapc, ceph_clock_now(g_ceph_context),
-				   0, NULL, gather.new_sub());
+      if (ls) {
+	ls->dir_commit_ops++;
+	ls->dir_commit_bytes += write_size;
+      }
+      cache->dir_commit_sched.queue(seq, oid, oloc, op, write_size, gather.new_sub());
 
       write_size = 0;
       to_set.clear();
@@ -2045,14 +2174,15 @@ void CDir::_omap_commit(int op_prio)
     }
   }
 
-  ObjectOperation op;
-  op.priority = op_prio;
+  ObjectOperation *op = new ObjectOperation;
+  op->priority = op_prio;
 
   // don't create new dirfrag blindly
   if (!is_new() && !state_test(CDir::STATE_FRAGMENTING))
-    op.stat(NULL, (utime_t*)NULL, NULL);
+    op->stat(NULL, (utime_t*)NULL, NULL);
 
-  op.tmap_to_omap(true); // convert tmap to omap
+  if (first)
+    op->tmap_to_omap(true); // convert tmap to omap
 
   /*
    * save the header at the last moment.. If we were to send it off before other
@@ -2064,15 +2194,19 @@ void CDir::_omap_commit(int op_prio)
    */
   bufferlist header;
   ::encode(fnode, header);
-  op.omap_set_header(header);
+  op->omap_set_header(header);
+  write_size += header.length();
 
   if (!to_set.empty())
-    op.omap_set(to_set);
+    op->omap_set(to_set);
   if (!to_remove.empty())
-    op.omap_rm_keys(to_remove);
+    op->omap_rm_keys(to_remove);
 
-  cache->mds->objecter->mutate(oid, oloc, op, snapc, ceph_clock_now(g_ceph_context),
-			       0, NULL, gather.new_sub());
+  if (ls) {
+    ls->dir_commit_ops++;
+    ls->dir_commit_bytes += write_size;
+  }
+  cache->dir_commit_sched.queue(seq, oid, oloc, op, write_size, gather.new_sub());
 
   gather.activate();
 }
@@ -2120,7 +2254,7 @@ void CDir::_encode_dentry(CDentry *dn, bufferlist& bl,
   }
 }
 
-void CDir::_commit(version_t want, int op_prio)
+void CDir::_commit(version_t want, int op_prio, LogSegment *ls)
 {
   dout(10) << "_commit want " << want << " on " << *this << dendl;
 
@@ -2160,7 +2294,7 @@ void CDir::_commit(version_t want, int op_prio)
   
   if (cache->mds->logger) cache->mds->logger->inc(l_mds_dir_commit);
 
-  _omap_commit(op_prio);
+  _omap_commit(op_prio, ls);
 }
 
 
@@ -32,6 +32,7 @@
 
 
 #include "CInode.h"
+#include "CacheMemory.h"
 
 class CDentry;
 class MDCache;
@@ -55,9 +56,11 @@ public:
     void *n = pool.malloc();
     if (!n)
       throw std::bad_alloc();
+    CacheMemory::alloc(CacheMemory::POOL_DIR, sizeof(CDir));
     return n;
   }
   void operator delete(void *p) {
+    CacheMemory::free(CacheMemory::POOL_DIR, sizeof(CDir));
     pool.free(p);
   }
 
@@ -495,6 +498,39 @@ private:
   }
   void fetch(MDSInternalContextBase *c, bool ignore_authpinnability=false);
   void fetch(MDSInternalContextBase *c, const std::string& want_dn, bool ignore_authpinnability=false);
+
+  // -- paged listing --
+  /**
+   * A dentry as stored in the dirfrag object, decoded for a paged
+   * readdir without instantiating a CDentry or CInode.
+   */
+  struct listed_dentry_t {
+    snapid_t first;
+    char type;                   // 'I' primary, 'L' remote
+    InodeStore inode;            // if primary
+    inodeno_t remote_ino;        // if remote
+    unsigned char remote_d_type;
+    listed_dentry_t() : type(0), remote_ino(0), remote_d_type(0) {}
+  };
+  static int decode_listed_dentry(bufferlist& bl, listed_dentry_t *ld);
+
+  /**
+   * Read up to max omap entries that sort after after_key from the
+   * dirfrag object, leaving the cached contents alone.
+   */
+  void fetch_page(const std::string& after_key, unsigned max,
+		  std::map<std::string, bufferlist> *out, int *rval,
+		  MDSInternalContextBase *c);
+  /**
+   * Cached head dentries whose omap key is in (after_key, last_key], or
+   * after after_key if last_key is NULL.  Omap keys are "<name>_head", so
+   * their order differs from dentry name order where one name is a
+   * prefix of another.
+   */
+  void get_head_dentries_in_key_range(const std::string& after_key,
+				      const std::string *last_key,
+				      std::map<std::string, CDentry*>& out);
+
 protected:
   void _omap_fetch(const std::string& want_dn);
   CDentry *_load_dentry(
@@ -519,8 +555,8 @@ protected:
 
   // -- commit --
   compact_map<version_t, std::list<MDSInternalContextBase*> > waiting_for_commit;
-  void _commit(version_t want, int op_prio);
-  void _omap_commit(int op_prio);
+  void _commit(version_t want, int op_prio, LogSegment *ls=NULL);
+  void _omap_commit(int op_prio, LogSegment *ls);
   void _encode_dentry(CDentry *dn, bufferlist& bl, const std::set<snapid_t> *snaps);
   void _committed(int r, version_t v);
 public:
@@ -529,7 +565,8 @@ public:
 #endif
   void commit_to(version_t want);
   void commit(version_t want, MDSInternalContextBase *c,
-	      bool ignore_authpinnability=false, int op_prio=-1);
+	      bool ignore_authpinnability=false, int op_prio=-1,
+	      LogSegment *ls=NULL);
 
   // -- dirtyness --
   version_t get_committing_version() const { return committing_version; }
@@ -67,6 +67,21 @@ public:
 boost::pool<> CInode::pool(sizeof(CInode));
 boost::pool<> Capability::pool(sizeof(Capability));
 
+// memory estimates, see CInode::update_mem_charge()
+static const size_t CAP_MAP_NODE_BYTES =
+  sizeof(client_t) + sizeof(Capability*) + CacheMemory::MAP_NODE_BYTES;
+
+static size_t xattr_bytes(const map<string,bufferptr>& xattrs)
+{
+  size_t n = 0;
+  for (map<string,bufferptr>::const_iterator p = xattrs.begin();
+       p != xattrs.end();
+       ++p)
+    n += sizeof(*p) + CacheMemory::MAP_NODE_BYTES +
+      p->first.length() + p->second.length();
+  return n;
+}
+
 LockType CInode::versionlock_type(CEPH_LOCK_IVERSION);
 LockType CInode::authlock_type(CEPH_LOCK_IAUTH);
 LockType CInode::linklock_type(CEPH_LOCK_ILINK);
@@ -342,10 +357,11 @@ void CInode::clear_dirty_rstat()
 
 inode_t *CInode::project_inode(map<string,bufferptr> *px) 
 {
+  drop_cached_stat();
   if (projected_nodes.empty()) {
     projected_nodes.push_back(new projected_inode_t(new inode_t(inode)));
     if (px)
-      *px = xattrs;
+      *px = *get_projected_xattrs();
   } else {
     projected_nodes.push_back(new projected_inode_t(
         new inode_t(*projected_nodes.back()->inode)));
@@ -368,7 +384,9 @@ void CInode::pop_and_dirty_projected_inode(LogSegment *ls)
   int64_t old_pool = inode.layout.fl_pg_pool;
 
   mark_dirty(projected_nodes.front()->inode->version, ls);
+  size_t old_bytes = inode.inline_data.length();
   inode = *projected_nodes.front()->inode;
+  size_t new_bytes = inode.inline_data.length();
 
   if (inode.is_backtrace_updated())
     _mark_dirty_parent(ls, old_pool != inode.layout.fl_pg_pool);
@@ -376,7 +394,10 @@ void CInode::pop_and_dirty_projected_inode(LogSegment *ls)
   map<string,bufferptr> *px = projected_nodes.front()->xattrs;
   if (px) {
     --num_projected_xattrs;
+    old_bytes += xattrs_packed.length() ? xattrs_packed.length() : xattr_bytes(xattrs);
+    clear_packed_xattrs();
     xattrs = *px;
+    new_bytes += xattr_bytes(xattrs);
     delete px;
   }
 
@@ -389,6 +410,8 @@ void CInode::pop_and_dirty_projected_inode(LogSegment *ls)
   delete projected_nodes.front();
 
   projected_nodes.pop_front();
+
+  recharge_mem(old_bytes, new_bytes);
 }
 
 sr_t *CInode::project_snaprealm(snapid_t snapid)
@@ -451,6 +474,7 @@ void CInode::pop_projected_snaprealm(sr_t *next_snaprealm)
   }
   snaprealm->srnode = *next_snaprealm;
   delete next_snaprealm;
+  mdcache->stat_cache.clear();  // cached stats carry snap traces
 
   // we should be able to open these up (or have them already be open).
   bool ok = snaprealm->_open_parents(NULL);
@@ -1277,7 +1301,7 @@ void InodeStoreBase::encode_bare(bufferlist &bl, const bufferlist *snap_blob) co
   if (is_symlink())
     ::encode(symlink, bl);
   ::encode(dirfragtree, bl);
-  ::encode(xattrs, bl);
+  encode_xattrs(bl);
   if (snap_blob)
     ::encode(*snap_blob, bl);
   else
@@ -1307,6 +1331,7 @@ void InodeStoreBase::decode_bare(bufferlist::iterator &bl,
   if (is_symlink())
     ::decode(symlink, bl);
   ::decode(dirfragtree, bl);
+  clear_packed_xattrs();
   ::decode(xattrs, bl);
   ::decode(snap_blob, bl);
 
@@ -1336,6 +1361,7 @@ void CInode::decode_store(bufferlist::iterator& bl)
   bufferlist snap_blob;
   InodeStoreBase::decode(bl, snap_blob);
   decode_snap_blob(snap_blob);
+  update_mem_charge();
 }
 
 // ------------------
@@ -1477,7 +1503,7 @@ void CInode::encode_lock_state(int type, bufferlist& bl)
     
   case CEPH_LOCK_IXATTR:
     ::encode(inode.version, bl);
-    ::encode(xattrs, bl);
+    encode_xattrs(bl);
     break;
 
   case CEPH_LOCK_ISNAP:
@@ -1723,8 +1749,13 @@ void CInode::decode_lock_state(int type, bufferlist& bl)
     break;
 
   case CEPH_LOCK_IXATTR:
-    ::decode(inode.version, p);
-    ::decode(xattrs, p);
+    {
+      ::decode(inode.version, p);
+      size_t old_bytes = xattrs_packed.length() ? xattrs_packed.length() : xattr_bytes(xattrs);
+      clear_packed_xattrs();
+      ::decode(xattrs, p);
+      recharge_mem(old_bytes, xattr_bytes(xattrs));
+    }
     break;
 
   case CEPH_LOCK_ISNAP:
@@ -1773,6 +1804,12 @@ void CInode::clear_scatter_dirty()
   dirfragtreelock.remove_dirty();
 }
 
+void CInode::drop_cached_stat()
+{
+  if (state_test(STATE_STATCACHED))
+    mdcache->stat_cache.remove_inode(this);
+}
+
 void CInode::clear_dirty_scattered(int type)
 {
   dout(10) << "clear_dirty_scattered " << type << " on " << *this << dendl;
@@ -2430,6 +2467,8 @@ old_inode_t& CInode::cow_old_inode(snapid_t follows, bool cow_head)
   inode_t *pi = cow_head ? get_projected_inode() : get_previous_projected_inode();
   map<string,bufferptr> *px = cow_head ? get_projected_xattrs() : get_previous_projected_xattrs();
 
+  compact_map<snapid_t, old_inode_t>::iterator q = old_inodes.find(follows);
+  size_t old_bytes = q != old_inodes.end() ? old_inode_mem_bytes(q->second) : 0;
   old_inode_t &old = old_inodes[follows];
   old.first = first;
   old.inode = *pi;
@@ -2452,9 +2491,81 @@ old_inode_t& CInode::cow_old_inode(snapid_t follows, bool cow_head)
 	   << " to [" << old.first << "," << follows << "] on "
 	   << *this << dendl;
 
+  recharge_mem(old_bytes, old_inode_mem_bytes(old));
   return old;
 }
 
+size_t CInode::old_inode_mem_bytes(const old_inode_t& old)
+{
+  return sizeof(snapid_t) + sizeof(old_inode_t) + CacheMemory::MAP_NODE_BYTES +
+    xattr_bytes(old.xattrs);
+}
+
+/*
+ * Charge the variable-length parts of this inode to the cache memory
+ * pool.  This is an estimate: map nodes are costed at a fixed size and
+ * xattr values by their length, even when they share a buffer.
+ *
+ * This walks everything, for when an inode is loaded in bulk; the paths
+ * that change one part (projection, cow, caps) charge the difference.
+ */
+void CInode::update_mem_charge()
+{
+  size_t n = symlink.length();
+  n += xattrs_packed.length() ? xattrs_packed.length() : xattr_bytes(xattrs);
+  n += dirfragtree._splits.size() *
+    (sizeof(frag_t) + sizeof(int32_t) + CacheMemory::MAP_NODE_BYTES);
+  n += inode.inline_data.length();
+  for (compact_map<snapid_t, old_inode_t>::iterator p = old_inodes.begin();
+       p != old_inodes.end();
+       ++p)
+    n += old_inode_mem_bytes(p->second);
+  n += client_caps.size() * CAP_MAP_NODE_BYTES;
+  recharge_mem(mem_charged, n);
+}
+
+/*
+ * Nothing but lookups is likely to touch a clean inode nobody has caps
+ * on or a pin in; keep its xattrs in a single buffer until then.  The
+ * buffer is exactly what encoding the map gives, so encoding the inode
+ * (commit, replicate, reply) never needs to unpack it.
+ */
+bool CInode::can_pack_xattrs() const
+{
+  return !xattrs.empty() &&
+    !is_projected() &&
+    !is_dirty() &&
+    client_caps.empty() &&
+    get_num_ref() == 0;
+}
+
+void CInode::pack_xattrs()
+{
+  assert(!xattrs_packed.length());
+  size_t old_bytes = xattr_bytes(xattrs);
+  bufferlist bl;
+  ::encode(xattrs, bl);
+  bl.rebuild();  // our own copy, not shared with the values
+  xattrs_packed = bl.buffers().front();
+  xattrs.clear();
+  recharge_mem(old_bytes, xattrs_packed.length());
+  dout(20) << "pack_xattrs " << old_bytes << " -> " << xattrs_packed.length()
+	   << " bytes on " << *this << dendl;
+}
+
+void CInode::unpack_xattrs()
+{
+  assert(xattrs_packed.length());
+  bufferlist bl;
+  bl.append(xattrs_packed);
+  bufferlist::iterator p = bl.begin();
+  ::decode(xattrs, p);
+  size_t old_bytes = xattrs_packed.length();
+  clear_packed_xattrs();
+  recharge_mem(old_bytes, xattr_bytes(xattrs));
+  dout(20) << "unpack_xattrs on " << *this << dendl;
+}
+
 void CInode::split_old_inode(snapid_t snap)
 {
   compact_map<snapid_t, old_inode_t>::iterator p = old_inodes.lower_bound(snap);
@@ -2462,6 +2573,7 @@ void CInode::split_old_inode(snapid_t snap)
 
   old_inode_t &old = old_inodes[snap - 1];
   old = p->second;
+  recharge_mem(0, old_inode_mem_bytes(old));
 
   p->second.first = snap;
   dout(10) << "split_old_inode " << "[" << old.first << "," << p->first
@@ -2487,6 +2599,7 @@ void CInode::purge_stale_snap_data(const set<snapid_t>& snaps)
     set<snapid_t>::const_iterator q = snaps.lower_bound(p->second.first);
     if (q == snaps.end() || *q > p->first) {
       dout(10) << " purging old_inode [" << p->second.first << "," << p->first << "]" << dendl;
+      recharge_mem(old_inode_mem_bytes(p->second), 0);
       old_inodes.erase(p++);
     } else
       ++p;
@@ -2510,6 +2623,7 @@ old_inode_t * CInode::pick_old_inode(snapid_t snap)
 void CInode::open_snaprealm(bool nosplit)
 {
   if (!snaprealm) {
+    mdcache->stat_cache.clear();  // inodes below may move to the new realm
     SnapRealm *parent = find_snaprealm();
     snaprealm = new SnapRealm(mdcache, this);
     if (parent) {
@@ -2528,6 +2642,7 @@ void CInode::close_snaprealm(bool nojoin)
 {
   if (snaprealm) {
     dout(15) << "close_snaprealm " << *snaprealm << dendl;
+    mdcache->stat_cache.clear();
     snaprealm->close_parents();
     if (snaprealm->parent) {
       snaprealm->parent->open_children.erase(snaprealm);
@@ -2720,7 +2835,8 @@ Capability *CInode::add_client_cap(client_t client, Session *session, SnapRealm
   cap->client_follows = first-1;
   
   containing_realm->add_cap(client, cap);
-  
+
+  recharge_mem(0, CAP_MAP_NODE_BYTES);
   return cap;
 }
 
@@ -2748,6 +2864,7 @@ void CInode::remove_client_cap(client_t client)
     mdcache->num_inodes_with_caps--;
   }
   mdcache->num_caps--;
+  recharge_mem(CAP_MAP_NODE_BYTES, 0);
 
   //clean up advisory locks
   bool fcntl_removed = fcntl_locks ? fcntl_locks->remove_all_from(client) : false;
@@ -3134,9 +3251,12 @@ int CInode::encode_inodestat(bufferlist& bl, Session *session,
   if ((!cap && !no_caps) ||
       (cap && cap->client_xattr_version < i->xattr_version) ||
       (getattr_caps & CEPH_CAP_XATTR_SHARED)) { // client requests xattrs
-    if (!pxattrs)
-      pxattrs = pxattr ? get_projected_xattrs() : &xattrs;
-    ::encode(*pxattrs, xbl);
+    if (!pxattrs && pxattr)
+      pxattrs = get_projected_xattrs();
+    if (pxattrs)
+      ::encode(*pxattrs, xbl);
+    else
+      encode_xattrs(xbl);
     e.xattr_version = i->xattr_version;
   } else {
     e.xattr_version = 0;
@@ -3269,6 +3389,61 @@ int CInode::encode_inodestat(bufferlist& bl, Session *session,
   return valid;
 }
 
+void InodeStoreBase::encode_inodestat_nocaps(bufferlist& bl, uint64_t features,
+					     bool auth) const
+{
+  const inode_t *i = &inode;
+
+  /*
+   * same layout as CInode::encode_inodestat, minus caps and xattrs
+   */
+  struct ceph_mds_reply_inode e;
+  memset(&e, 0, sizeof(e));
+  e.ino = i->ino;
+  e.snapid = CEPH_NOSNAP;
+  e.rdev = i->rdev;
+  e.version = i->version * 2;
+  i->ctime.encode_timeval(&e.ctime);
+  e.layout = i->layout;
+  e.size = i->size;
+  e.truncate_seq = i->truncate_seq;
+  e.truncate_size = i->truncate_size;
+  i->mtime.encode_timeval(&e.mtime);
+  i->atime.encode_timeval(&e.atime);
+  e.time_warp_seq = i->time_warp_seq;
+  e.files = i->dirstat.nfiles;
+  e.subdirs = i->dirstat.nsubdirs;
+  i->rstat.rctime.encode_timeval(&e.rctime);
+  e.rbytes = i->rstat.rbytes;
+  e.rfiles = i->rstat.rfiles;
+  e.rsubdirs = i->rstat.rsubdirs;
+  e.mode = i->mode;
+  e.uid = i->uid;
+  e.gid = i->gid;
+  e.nlink = i->nlink;
+  e.xattr_version = 0;
+  e.cap.flags = auth ? CEPH_CAP_FLAG_AUTH : 0;
+  e.fragtree.nsplits = dirfragtree._splits.size();
+  ::encode(e, bl);
+
+  dirfragtree.encode_nohead(bl);
+
+  ::encode(symlink, bl);
+  if ((features & CEPH_FEATURE_DIRLAYOUTHASH))
+    ::encode(i->dir_layout, bl);
+  bufferlist xbl;
+  ::encode(xbl, bl);
+  if ((features & CEPH_FEATURE_MDS_INLINE_DATA)) {
+    version_t inline_version = 0;
+    if (i->inline_data.version == CEPH_INLINE_NONE)
+      inline_version = CEPH_INLINE_NONE;
+    ::encode(inline_version, bl);
+    ::encode(bufferlist(), bl);
+  }
+  if ((features & CEPH_FEATURE_MDS_QUOTA))
+    ::encode(i->quota, bl);
+}
+
 void CInode::encode_cap_message(MClientCaps *m, Capability *cap)
 {
   assert(cap);
@@ -3320,11 +3495,13 @@ void CInode::encode_cap_message(MClientCaps *m, Capability *cap)
   m->head.nlink = i->nlink;
 
   i = pxattr ? pi:oi;
-  map<string,bufferptr> *ix = pxattr ? get_projected_xattrs() : &xattrs;
   if ((cap->pending() & CEPH_CAP_XATTR_SHARED) &&
       i->xattr_version > cap->client_xattr_version) {
     dout(10) << "    including xattrs v " << i->xattr_version << dendl;
-    ::encode(*ix, m->xattrbl);
+    if (pxattr)
+      ::encode(*get_projected_xattrs(), m->xattrbl);
+    else
+      encode_xattrs(m->xattrbl);
     m->head.xattr_version = i->xattr_version;
     cap->client_xattr_version = i->xattr_version;
   }
@@ -3338,7 +3515,7 @@ void CInode::_encode_base(bufferlist& bl)
   ::encode(inode, bl);
   ::encode(symlink, bl);
   ::encode(dirfragtree, bl);
-  ::encode(xattrs, bl);
+  encode_xattrs(bl);
   ::encode(old_inodes, bl);
   encode_snap(bl);
 }
@@ -3348,9 +3525,11 @@ void CInode::_decode_base(bufferlist::iterator& p)
   ::decode(inode, p);
   ::decode(symlink, p);
   ::decode(dirfragtree, p);
+  clear_packed_xattrs();
   ::decode(xattrs, p);
   ::decode(old_inodes, p);
   decode_snap(p);
+  update_mem_charge();
 }
 
 void CInode::_encode_locks_full(bufferlist& bl)
@@ -32,6 +32,7 @@
 #include "LocalLock.h"
 #include "Capability.h"
 #include "SnapRealm.h"
+#include "CacheMemory.h"
 
 #include <list>
 #include <set>
@@ -75,6 +76,7 @@ public:
   inode_t                    inode;        // the inode itself
   std::string                symlink;      // symlink dest, if symlink
   std::map<std::string, bufferptr> xattrs;
+  bufferptr                  xattrs_packed;  // xattrs, encoded, while the map is empty (see CInode::pack_xattrs)
   fragtree_t                 dirfragtree;  // dir frag tree, if any.  always consistent with our dirfrag map.
   compact_map<snapid_t, old_inode_t> old_inodes;   // key = last, value.first = first
   snapid_t                  oldest_snap;
@@ -87,6 +89,16 @@ public:
   bool is_dir() const     { return inode.is_dir(); }
   static object_t get_object_name(inodeno_t ino, frag_t fg, const char *suffix);
 
+  /* Encoded xattrs, packed or not */
+  void encode_xattrs(bufferlist &bl) const {
+    if (xattrs_packed.length())
+      bl.append(xattrs_packed);
+    else
+      ::encode(xattrs, bl);
+  }
+  /* Forget the packed copy, for callers replacing xattrs wholesale */
+  void clear_packed_xattrs() { xattrs_packed = bufferptr(); }
+
   /* Full serialization for use in ".inode" root inode objects */
   void encode(bufferlist &bl, const bufferlist *snap_blob=NULL) const;
   void decode(bufferlist::iterator &bl, bufferlist& snap_blob);
@@ -95,6 +107,12 @@ public:
   void encode_bare(bufferlist &bl, const bufferlist *snap_blob=NULL) const;
   void decode_bare(bufferlist::iterator &bl, bufferlist &snap_blob, __u8 struct_v=5);
 
+  /* Reply InodeStat carrying no caps, for inodes listed straight from
+   * a dirfrag object without being loaded into cache, and for the
+   * StatCache */
+  void encode_inodestat_nocaps(bufferlist& bl, uint64_t features,
+			       bool auth) const;
+
   /* For test/debug output */
   void dump(Formatter *f) const;
 };
@@ -135,9 +153,11 @@ public:
     void *n = pool.malloc();
     if (!n)
       throw std::bad_alloc();
+    CacheMemory::alloc(CacheMemory::POOL_INODE, sizeof(CInode));
     return n;
   }
   void operator delete(void *p) {
+    CacheMemory::free(CacheMemory::POOL_INODE, sizeof(CInode));
     pool.free(p);
   }
 
@@ -208,6 +228,7 @@ public:
   static const int STATE_STRAYPINNED = (1<<16);
   static const int STATE_FROZENAUTHPIN = (1<<17);
   static const int STATE_DIRTYPOOL =   (1<<18);
+  static const int STATE_STATCACHED =  (1<<19);  // may be in the StatCache
   // orphan inode needs notification of releasing reference
   static const int STATE_ORPHAN =	STATE_NOTIFYREF;
 
@@ -341,6 +362,8 @@ public:
 	if ((*p)->xattrs)
 	  return (*p)->xattrs;
     }
+    if (xattrs_packed.length())
+      unpack_xattrs();
     return &xattrs;
   }
   std::map<std::string,bufferptr> *get_previous_projected_xattrs() {
@@ -350,6 +373,8 @@ public:
 	 ++p)
       if ((*p)->xattrs)
 	return (*p)->xattrs;
+    if (xattrs_packed.length())
+      unpack_xattrs();
     return &xattrs;
   }
 
@@ -556,7 +581,8 @@ public:
     nestlock(this, &nestlock_type),
     flocklock(this, &flocklock_type),
     policylock(this, &policylock_type),
-    loner_cap(-1), want_loner_cap(-1)
+    loner_cap(-1), want_loner_cap(-1),
+    mem_charged(0)
   {
     g_num_ino++;
     g_num_inoa++;
@@ -571,6 +597,7 @@ public:
     clear_file_locks();
     assert(num_projected_xattrs == 0);
     assert(num_projected_srnodes == 0);
+    CacheMemory::recharge(CacheMemory::POOL_INODE_DATA, mem_charged, 0);
   }
   
 
@@ -771,6 +798,7 @@ public:
 
   void clear_dirty_scattered(int type);
   bool is_dirty_scattered();
+  void drop_cached_stat();
   void clear_scatter_dirty();  // on rejoin ack
 
   void start_scatter(ScatterLock *lock);
@@ -790,6 +818,20 @@ public:
   // client caps
   client_t loner_cap, want_loner_cap;
 
+  // -- memory accounting --
+  size_t mem_charged;  // bytes charged to CacheMemory::POOL_INODE_DATA
+  void update_mem_charge();
+  void recharge_mem(size_t old_bytes, size_t new_bytes) {
+    CacheMemory::recharge(CacheMemory::POOL_INODE_DATA, old_bytes, new_bytes);
+    mem_charged = mem_charged - old_bytes + new_bytes;
+  }
+  static size_t old_inode_mem_bytes(const old_inode_t& old);
+
+  // cold inodes keep their xattrs as one encoded buffer until next used
+  bool can_pack_xattrs() const;
+  void pack_xattrs();
+  void unpack_xattrs();
+
   client_t get_loner() const { return loner_cap; }
   client_t get_wanted_loner() const { return want_loner_cap; }
 
@@ -0,0 +1,51 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "CacheMemory.h"
+#include "common/Formatter.h"
+
+ceph::atomic64_t CacheMemory::items[CacheMemory::NUM_POOLS];
+ceph::atomic64_t CacheMemory::bytes_used[CacheMemory::NUM_POOLS];
+
+uint64_t CacheMemory::get_total_bytes()
+{
+  uint64_t total = 0;
+  for (int p = 0; p < NUM_POOLS; ++p)
+    total += bytes_used[p].read();
+  return total;
+}
+
+const char *CacheMemory::get_pool_name(pool_t p)
+{
+  switch (p) {
+  case POOL_INODE: return "inode";
+  case POOL_INODE_DATA: return "inode_data";
+  case POOL_DENTRY: return "dentry";
+  case POOL_DENTRY_DATA: return "dentry_data";
+  case POOL_DIR: return "dir";
+  case POOL_CAP: return "cap";
+  default: return "???";
+  }
+}
+
+void CacheMemory::dump(ceph::Formatter *f)
+{
+  f->open_object_section("mds_cache");
+  for (int p = 0; p < NUM_POOLS; ++p) {
+    f->open_object_section(get_pool_name((pool_t)p));
+    f->dump_unsigned("items", items[p].read());
+    f->dump_unsigned("bytes", bytes_used[p].read());
+    f->close_section();
+  }
+  f->dump_unsigned("total_bytes", get_total_bytes());
+  f->close_section();
+}
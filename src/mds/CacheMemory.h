@@ -0,0 +1,76 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MDS_CACHEMEMORY_H
+#define CEPH_MDS_CACHEMEMORY_H
+
+#include "include/atomic.h"
+#include "include/int_types.h"
+
+namespace ceph {
+  class Formatter;
+}
+
+/**
+ * CacheMemory - byte accounting for the MDS cache
+ *
+ * Cache objects charge their fixed size to a pool when they are
+ * allocated.  Inodes and dentries also charge the variable-length data
+ * hanging off them (names, xattrs, old inodes, fragtrees, ...), which is
+ * what makes a dentry count a poor proxy for memory use.  MDCache::trim()
+ * keeps the total under mds_cache_memory_limit, and "dump_mempools" on
+ * the admin socket shows the breakdown.
+ */
+class CacheMemory {
+public:
+  enum pool_t {
+    POOL_INODE,        ///< CInode
+    POOL_INODE_DATA,   ///< xattrs, old inodes, symlinks, fragtrees, cap map
+    POOL_DENTRY,       ///< CDentry
+    POOL_DENTRY_DATA,  ///< names and their CDir::items nodes
+    POOL_DIR,          ///< CDir
+    POOL_CAP,          ///< Capability
+    NUM_POOLS
+  };
+
+  /// rough cost of one std::map/std::set node beyond its value
+  static const size_t MAP_NODE_BYTES = 32;
+
+  static void alloc(pool_t p, size_t bytes) {
+    items[p].inc();
+    bytes_used[p].add(bytes);
+  }
+  static void free(pool_t p, size_t bytes) {
+    items[p].dec();
+    bytes_used[p].sub(bytes);
+  }
+  /// update a variable-length charge from old_bytes to new_bytes
+  static void recharge(pool_t p, size_t old_bytes, size_t new_bytes) {
+    if (new_bytes > old_bytes)
+      bytes_used[p].add(new_bytes - old_bytes);
+    else if (new_bytes < old_bytes)
+      bytes_used[p].sub(old_bytes - new_bytes);
+  }
+
+  static uint64_t get_items(pool_t p) { return items[p].read(); }
+  static uint64_t get_bytes(pool_t p) { return bytes_used[p].read(); }
+  static uint64_t get_total_bytes();
+  static const char *get_pool_name(pool_t p);
+
+  static void dump(ceph::Formatter *f);
+
+private:
+  static ceph::atomic64_t items[NUM_POOLS];
+  static ceph::atomic64_t bytes_used[NUM_POOLS];
+};
+
+#endif
@@ -22,6 +22,7 @@
 #include "common/config.h"
 
 #include "mdstypes.h"
+#include "CacheMemory.h"
 
 /*
 
@@ -71,9 +72,11 @@ public:
     void *n = pool.malloc();
     if (!n)
       throw std::bad_alloc();
+    CacheMemory::alloc(CacheMemory::POOL_CAP, sizeof(Capability));
     return n;
   }
   void operator delete(void *p) {
+    CacheMemory::free(CacheMemory::POOL_CAP, sizeof(Capability));
     pool.free(p);
   }
 public:
@@ -0,0 +1,129 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include "common/perf_counters.h"
+#include "common/Finisher.h"
+
+#include "MDS.h"
+#include "MDCache.h"
+#include "DirCommitScheduler.h"
+
+
+#define dout_subsys ceph_subsys_mds
+#undef dout_prefix
+#define dout_prefix *_dout << "mds." << mds->get_nodeid() << " DirCommitScheduler::" << __func__ << " "
+
+class C_IO_DirCommitWritten : public MDSIOContextBase {
+protected:
+  DirCommitScheduler *sched;
+  uint64_t bytes;
+  Context *onfinish;
+  MDS *get_mds() {
+    return sched->mds;
+  }
+public:
+  C_IO_DirCommitWritten(DirCommitScheduler *s, uint64_t b, Context *c)
+    : sched(s), bytes(b), onfinish(c) {}
+  void finish(int r) {
+    onfinish->complete(r);
+    sched->_written(bytes);
+  }
+};
+
+
+DirCommitScheduler::DirCommitScheduler(MDS *mds_)
+  : num_queued(0), in_flight_ops(0), in_flight_bytes(0),
+    mds(mds_), logger(NULL)
+{}
+
+DirCommitScheduler::~DirCommitScheduler()
+{
+  for (std::map<uint64_t, std::list<write_t> >::iterator p = queued.begin();
+       p != queued.end();
+       ++p) {
+    for (std::list<write_t>::iterator q = p->second.begin();
+	 q != p->second.end();
+	 ++q) {
+      delete q->op;
+      delete q->onfinish;
+    }
+  }
+}
+
+void DirCommitScheduler::queue(uint64_t seq, const object_t& oid,
+			       const object_locator_t& oloc,
+			       ObjectOperation *op, uint64_t bytes,
+			       Context *onfinish)
+{
+  dout(15) << oid << " " << bytes << " bytes for segment " << seq << dendl;
+  queued[seq].push_back(write_t(oid, oloc, op, bytes, onfinish));
+  ++num_queued;
+  advance();
+}
+
+/**
+ * Send queued writes, oldest segment first, until the op or byte limit
+ * is reached.  At least one write is always in flight, however large.
+ */
+void DirCommitScheduler::advance()
+{
+  uint64_t max_ops = g_conf->mds_dir_commit_max_ops;
+  uint64_t max_bytes = g_conf->mds_dir_commit_max_bytes;
+
+  while (!queued.empty()) {
+    if (in_flight_ops > 0 &&
+	((max_ops && in_flight_ops >= max_ops) ||
+	 (max_bytes && in_flight_bytes + queued.begin()->second.front().bytes > max_bytes)))
+      break;
+    std::map<uint64_t, std::list<write_t> >::iterator p = queued.begin();
+    write_t w = p->second.front();
+    p->second.pop_front();
+    if (p->second.empty())
+      queued.erase(p);
+    --num_queued;
+    _send(w);
+  }
+
+  dout(10) << num_queued << " queued, " << in_flight_ops << " ops "
+	   << in_flight_bytes << " bytes in flight" << dendl;
+  if (logger) {
+    logger->set(l_mdc_dir_commit_queued, num_queued);
+    logger->set(l_mdc_dir_commit_in_flight, in_flight_ops);
+  }
+}
+
+void DirCommitScheduler::_send(write_t &w)
+{
+  dout(20) << w.oid << " " << w.bytes << " bytes" << dendl;
+  ++in_flight_ops;
+  in_flight_bytes += w.bytes;
+  SnapContext snapc;
+  mds->objecter->mutate(w.oid, w.oloc, *w.op, snapc,
+			ceph_clock_now(g_ceph_context), 0, NULL,
+			new C_OnFinisher(new C_IO_DirCommitWritten(this, w.bytes,
+								   w.onfinish),
+					 &mds->finisher));
+  delete w.op;
+  if (logger) {
+    logger->inc(l_mdc_dir_commit_ops);
+    logger->inc(l_mdc_dir_commit_bytes, w.bytes);
+  }
+}
+
+void DirCommitScheduler::_written(uint64_t bytes)
+{
+  assert(in_flight_ops > 0);
+  assert(in_flight_bytes >= bytes);
+  --in_flight_ops;
+  in_flight_bytes -= bytes;
+  advance();
+}
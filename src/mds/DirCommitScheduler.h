@@ -0,0 +1,85 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef DIR_COMMIT_SCHEDULER_H
+#define DIR_COMMIT_SCHEDULER_H
+
+#include <list>
+#include <map>
+
+#include "osdc/Objecter.h"
+
+class MDS;
+class PerfCounters;
+
+/**
+ * Orders and throttles the omap writes of dirfrag commits.
+ *
+ * Expiring a LogSegment commits every dirfrag dirtied in it, which for
+ * many small directories means thousands of small writes at once.
+ * CDir::_omap_commit() queues its writes here instead of sending them.
+ * They go out oldest LogSegment first (commits not driven by expiry
+ * first of all), with at most mds_dir_commit_max_ops writes and
+ * mds_dir_commit_max_bytes bytes in flight.  Writes queued for the same
+ * segment are sent in the order they were queued, so a dirfrag's header
+ * still goes out after the rest of its update.
+ */
+class DirCommitScheduler {
+public:
+  DirCommitScheduler(MDS *mds_);
+  ~DirCommitScheduler();
+
+  void set_logger(PerfCounters *p) {logger=p;}
+
+  /**
+   * Queue a write to a dirfrag object, and send it if there is room.
+   *
+   * @param seq LogSegment being expired, or 0 if none
+   * @param op the write; the scheduler takes ownership
+   * @param bytes size of the keys and values written
+   * @param onfinish completed once the write commits
+   */
+  void queue(uint64_t seq, const object_t& oid, const object_locator_t& oloc,
+	     ObjectOperation *op, uint64_t bytes, Context *onfinish);
+
+  /// send queued writes while under the limits
+  void advance();
+
+  uint64_t get_num_queued() const { return num_queued; }
+  uint64_t get_num_in_flight() const { return in_flight_ops; }
+
+private:
+  struct write_t {
+    object_t oid;
+    object_locator_t oloc;
+    ObjectOperation *op;
+    uint64_t bytes;
+    Context *onfinish;
+    write_t(const object_t& o, const object_locator_t& l, ObjectOperation *p,
+	    uint64_t b, Context *c)
+      : oid(o), oloc(l), op(p), bytes(b), onfinish(c) {}
+  };
+
+  void _send(write_t &w);
+  void _written(uint64_t bytes);
+
+  std::map<uint64_t, std::list<write_t> > queued;  ///< by LogSegment seq
+  uint64_t num_queued;
+  uint64_t in_flight_ops;
+  uint64_t in_flight_bytes;
+  MDS *mds;
+  PerfCounters *logger;
+
+  friend class C_IO_DirCommitWritten;
+};
+
+#endif // DIR_COMMIT_SCHEDULER_H
@@ -23,6 +23,7 @@
 #include "MDSContext.h"
 
 #include "MDLog.h"
+#include "MDBalancer.h"
 #include "MDSMap.h"
 
 #include "events/EUpdate.h"
@@ -1934,6 +1935,10 @@ bool Locker::issue_caps(CInode *in, Capability *only_cap)
 		revoking_caps_by_client[cap->get_client()].push_back(&cap->item_client_revoking_caps);
 		cap->set_last_revoke_stamp(ceph_clock_now(g_ceph_context));
 		cap->reset_num_revoke_warnings();
+		if (g_conf->mds_bal_mode == 3 && in->get_parent_dn())
+		  mds->balancer->hit_dir(cap->get_last_revoke_stamp(),
+					 in->get_parent_dn()->get_dir(),
+					 META_POP_REVOKE);
 	}
 
 	MClientCaps *m = new MClientCaps(op, in->ino(),
@@ -3447,7 +3452,7 @@ void Locker::revoke_client_leases(SimpleLock *lock)
 {
   int n = 0;
   CDentry *dn = static_cast<CDentry*>(lock->get_parent());
-  for (map<client_t, ClientLease*>::iterator p = dn->client_lease_map.begin();
+  for (compact_map<client_t, ClientLease*>::iterator p = dn->client_lease_map.begin();
        p != dn->client_lease_map.end();
        ++p) {
     ClientLease *l = p->second;
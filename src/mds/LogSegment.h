@@ -71,6 +71,9 @@ class LogSegment {
   version_t sessionmapv;
   map<int,version_t> tablev;
 
+  // dirfrag commits sent to expire this segment
+  uint64_t dir_commit_ops, dir_commit_bytes;
+
   // try to expire
   void try_to_expire(MDS *mds, MDSGatherBuilder &gather_bld, int op_prio);
 
@@ -95,7 +98,8 @@ class LogSegment {
     dirty_dirfrag_nest(member_offset(CInode, item_dirty_dirfrag_nest)),
     dirty_dirfrag_dirfragtree(member_offset(CInode, item_dirty_dirfrag_dirfragtree)),
     slave_updates(0), // passed to begin() manually
-    inotablev(0), sessionmapv(0)
+    inotablev(0), sessionmapv(0),
+    dir_commit_ops(0), dir_commit_bytes(0)
   { }
 };
 
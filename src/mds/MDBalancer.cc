@@ -136,6 +136,16 @@ double mds_load_t::mds_load()
   case 2:
     return cpu_load_avg;
 
+  case 3:
+    // mode 0, plus what the work costs us: time spent handling requests
+    // and cap revocations
+    return
+      .8 * auth.meta_load() +
+      .2 * all.meta_load() +
+      g_conf->mds_bal_cost_weight * auth.get(META_POP_COST).get_last() +
+      g_conf->mds_bal_revoke_weight * auth.get(META_POP_REVOKE).get_last() +
+      req_rate +
+      10.0 * queue_len;
   }
   assert(0);
   return 0;
@@ -169,6 +179,18 @@ mds_load_t MDBalancer::get_load(utime_t now)
   return load;
 }
 
+double MDBalancer::get_dir_load(dirfrag_load_vec_t& pop, utime_t now)
+{
+  double l = pop.meta_load(now, mds->mdcache->decayrate);
+  if (g_conf->mds_bal_mode == 3) {
+    l += g_conf->mds_bal_cost_weight *
+      pop.get(META_POP_COST).get(now, mds->mdcache->decayrate);
+    l += g_conf->mds_bal_revoke_weight *
+      pop.get(META_POP_REVOKE).get(now, mds->mdcache->decayrate);
+  }
+  return l;
+}
+
 void MDBalancer::send_heartbeat()
 {
   utime_t now = ceph_clock_now(g_ceph_context);
@@ -204,7 +226,7 @@ void MDBalancer::send_heartbeat()
     mds_rank_t from = im->inode->authority().first;
     if (from == mds->get_nodeid()) continue;
     if (im->get_inode()->is_stray()) continue;
-    import_map[from] += im->pop_auth_subtree.meta_load(now, mds->mdcache->decayrate);
+    import_map[from] += get_dir_load(im->pop_auth_subtree, now);
   }
   mds_import_map[ mds->get_nodeid() ] = import_map;
 
@@ -309,28 +331,6 @@ void MDBalancer::export_empties()
 
 
 
-double MDBalancer::try_match(mds_rank_t ex, double& maxex,
-                             mds_rank_t im, double& maxim)
-{
-  if (maxex <= 0 || maxim <= 0) return 0.0;
-
-  double howmuch = MIN(maxex, maxim);
-  if (howmuch <= 0) return 0.0;
-
-  dout(5) << "   - mds." << ex << " exports " << howmuch << " to mds." << im << dendl;
-
-  if (ex == mds->get_nodeid())
-    my_targets[im] += howmuch;
-
-  exported[ex] += howmuch;
-  imported[im] += howmuch;
-
-  maxex -= howmuch;
-  maxim -= howmuch;
-
-  return howmuch;
-}
-
 void MDBalancer::queue_split(CDir *dir)
 {
   split_queue.insert(dir->dirfrag());
@@ -437,8 +437,15 @@ void MDBalancer::prep_rebalance(int beat)
 
     // reset
     my_targets.clear();
-    imported.clear();
-    exported.clear();
+
+    // forget imports that may be exported again
+    map<dirfrag_t, utime_t>::iterator st = import_stamps.begin();
+    while (st != import_stamps.end()) {
+      if ((double)rebalance_time - (double)st->second >= g_conf->mds_bal_reexport_interval)
+	import_stamps.erase(st++);
+      else
+	++st;
+    }
 
     dout(5) << " prep_rebalance: cluster loads are" << dendl;
 
@@ -448,7 +455,7 @@ void MDBalancer::prep_rebalance(int beat)
     double load_fac = 1.0;
     map<mds_rank_t, mds_load_t>::iterator m = mds_load.find(whoami);
     if ((m != mds_load.end()) && (m->second.mds_load() > 0)) {
-      double metald = m->second.auth.meta_load(rebalance_time, mds->mdcache->decayrate);
+      double metald = get_dir_load(m->second.auth, rebalance_time);
       double mdsld = m->second.mds_load();
       load_fac = metald / mdsld;
       dout(7) << " load_fac is " << load_fac
@@ -457,15 +464,14 @@ void MDBalancer::prep_rebalance(int beat)
 	      << dendl;
     }
 
-    double total_load = 0;
-    multimap<double,mds_rank_t> load_map;
+    plan.loads.clear();
     for (mds_rank_t i=mds_rank_t(0); i < mds_rank_t(cluster_size); i++) {
       map<mds_rank_t, mds_load_t>::value_type val(i, mds_load_t(ceph_clock_now(g_ceph_context)));
       std::pair < map<mds_rank_t, mds_load_t>::iterator, bool > r(mds_load.insert(val));
       mds_load_t &load(r.first->second);
 
       double l = load.mds_load() * load_fac;
-      mds_meta_load[i] = l;
+      plan.loads[i] = l;
 
       if (whoami == 0)
 	dout(0) << "  mds." << i
@@ -474,20 +480,29 @@ void MDBalancer::prep_rebalance(int beat)
 		<< " ~ " << l << dendl;
 
       if (whoami == i) my_load = l;
-      total_load += l;
-
-      load_map.insert(pair<double,mds_rank_t>( l, i ));
     }
 
-    // target load
-    target_load = total_load / (double)cluster_size;
+    // determine load transfer mapping
+    plan.import_map = mds_import_map;
+    plan.min_rebalance = g_conf->mds_bal_min_rebalance;
+    plan.hysteresis = g_conf->mds_bal_mode == 3 ? g_conf->mds_bal_hysteresis : 0;
+    plan.plan(beat);
+    target_load = plan.target_load;
     dout(5) << "prep_rebalance:  my load " << my_load
 	    << "   target " << target_load
-	    << "   total " << total_load
+	    << "   threshold " << plan.get_export_threshold(whoami)
 	    << dendl;
+    for (map<mds_rank_t, map<mds_rank_t, double> >::iterator p = plan.targets.begin();
+	 p != plan.targets.end();
+	 ++p)
+      for (map<mds_rank_t, double>::iterator q = p->second.begin();
+	   q != p->second.end();
+	   ++q)
+	dout(5) << "   - mds." << p->first << " exports " << q->second
+		<< " to mds." << q->first << dendl;
 
     // under or over?
-    if (my_load < target_load * (1.0 + g_conf->mds_bal_min_rebalance)) {
+    if (!plan.is_exporter(whoami)) {
       dout(5) << "  i am underloaded or barely overloaded, doing nothing." << dendl;
       last_epoch_under = beat_epoch;
       show_imports();
@@ -503,92 +518,7 @@ void MDBalancer::prep_rebalance(int beat)
     }
 
     dout(5) << "  i am sufficiently overloaded" << dendl;
-
-
-    // first separate exporters and importers
-    multimap<double,mds_rank_t> importers;
-    multimap<double,mds_rank_t> exporters;
-    set<mds_rank_t>             importer_set;
-    set<mds_rank_t>             exporter_set;
-
-    for (multimap<double,mds_rank_t>::iterator it = load_map.begin();
-	 it != load_map.end();
-	 ++it) {
-      if (it->first < target_load) {
-	dout(15) << "   mds." << it->second << " is importer" << dendl;
-	importers.insert(pair<double,mds_rank_t>(it->first,it->second));
-	importer_set.insert(it->second);
-      } else {
-	dout(15) << "   mds." << it->second << " is exporter" << dendl;
-	exporters.insert(pair<double,mds_rank_t>(it->first,it->second));
-	exporter_set.insert(it->second);
-      }
-    }
-
-
-    // determine load transfer mapping
-
-    if (true) {
-      // analyze import_map; do any matches i can
-
-      dout(15) << "  matching exporters to import sources" << dendl;
-
-      // big -> small exporters
-      for (multimap<double,mds_rank_t>::reverse_iterator ex = exporters.rbegin();
-	   ex != exporters.rend();
-	   ++ex) {
-	double maxex = get_maxex(ex->second);
-	if (maxex <= .001) continue;
-
-	// check importers. for now, just in arbitrary order (no intelligent matching).
-	for (map<mds_rank_t, float>::iterator im = mds_import_map[ex->second].begin();
-	     im != mds_import_map[ex->second].end();
-	     ++im) {
-	  double maxim = get_maxim(im->first);
-	  if (maxim <= .001) continue;
-	  try_match(ex->second, maxex,
-		    im->first, maxim);
-	  if (maxex <= .001) break;
-	}
-      }
-    }
-
-
-    if (1) {
-      if (beat % 2 == 1) {
-	// old way
-	dout(15) << "  matching big exporters to big importers" << dendl;
-	// big exporters to big importers
-	multimap<double,mds_rank_t>::reverse_iterator ex = exporters.rbegin();
-	multimap<double,mds_rank_t>::iterator im = importers.begin();
-	while (ex != exporters.rend() &&
-	       im != importers.end()) {
-	  double maxex = get_maxex(ex->second);
-	  double maxim = get_maxim(im->second);
-	  if (maxex < .001 || maxim < .001) break;
-	  try_match(ex->second, maxex,
-		    im->second, maxim);
-	  if (maxex <= .001) ++ex;
-	  if (maxim <= .001) ++im;
-	}
-      } else {
-	// new way
-	dout(15) << "  matching small exporters to big importers" << dendl;
-	// small exporters to big importers
-	multimap<double,mds_rank_t>::iterator ex = exporters.begin();
-	multimap<double,mds_rank_t>::iterator im = importers.begin();
-	while (ex != exporters.end() &&
-	       im != importers.end()) {
-	  double maxex = get_maxex(ex->second);
-	  double maxim = get_maxim(im->second);
-	  if (maxex < .001 || maxim < .001) break;
-	  try_match(ex->second, maxex,
-		    im->second, maxim);
-	  if (maxex <= .001) ++ex;
-	  if (maxim <= .001) ++im;
-	}
-      }
-    }
+    my_targets = plan.targets[whoami];
   }
   try_rebalance();
 }
@@ -618,7 +548,7 @@ void MDBalancer::try_rebalance()
     CDir *im = *it;
     if (im->get_inode()->is_stray()) continue;
 
-    double pop = im->pop_auth_subtree.meta_load(rebalance_time, mds->mdcache->decayrate);
+    double pop = get_dir_load(im->pop_auth_subtree, rebalance_time);
     if (g_conf->mds_bal_idle_threshold > 0 &&
 	pop < g_conf->mds_bal_idle_threshold &&
 	im->inode != mds->mdcache->get_root() &&
@@ -673,7 +603,8 @@ void MDBalancer::try_rebalance()
 	    dir->inode->is_stray())
 	  continue;
 	if (dir->is_freezing() || dir->is_frozen()) continue;  // export pbly already in progress
-	double pop = dir->pop_auth_subtree.meta_load(rebalance_time, mds->mdcache->decayrate);
+	if (is_recent_import(dir)) continue;
+	double pop = get_dir_load(dir->pop_auth_subtree, rebalance_time);
 	assert(dir->inode->authority().first == target);  // cuz that's how i put it in the map, dummy
 
 	if (pop <= amount-have) {
@@ -740,7 +671,7 @@ void MDBalancer::try_rebalance()
       dout(0) << "   - exporting "
 	       << (*it)->pop_auth_subtree
 	       << " "
-	       << (*it)->pop_auth_subtree.meta_load(rebalance_time, mds->mdcache->decayrate)
+	       << get_dir_load((*it)->pop_auth_subtree, rebalance_time)
 	       << " to mds." << target
 	       << " " << **it
 	       << dendl;
@@ -828,7 +759,7 @@ void MDBalancer::find_exports(CDir *dir,
   list<CDir*> bigger_rep, bigger_unrep;
   multimap<double, CDir*> smaller;
 
-  double dir_pop = dir->pop_auth_subtree.meta_load(rebalance_time, mds->mdcache->decayrate);
+  double dir_pop = get_dir_load(dir->pop_auth_subtree, rebalance_time);
   dout(7) << " find_exports in " << dir_pop << " " << *dir << " need " << need << " (" << needmin << " - " << needmax << ")" << dendl;
 
   double subdir_sum = 0;
@@ -849,16 +780,17 @@ void MDBalancer::find_exports(CDir *dir,
       if (already_exporting.count(subdir)) continue;
 
       if (subdir->is_frozen()) continue;  // can't export this right now!
+      if (is_recent_import(subdir)) continue;
 
       // how popular?
-      double pop = subdir->pop_auth_subtree.meta_load(rebalance_time, mds->mdcache->decayrate);
+      double pop = get_dir_load(subdir->pop_auth_subtree, rebalance_time);
       subdir_sum += pop;
       dout(15) << "   subdir pop " << pop << " " << *subdir << dendl;
 
       if (pop < minchunk) continue;
 
       // lucky find?
-      if (pop > needmin && pop < needmax) {
+      if (pop > needmin && pop < needmax && !is_export_too_costly(subdir)) {
 	exports.push_back(subdir);
 	already_exporting.insert(subdir);
 	have += pop;
@@ -884,6 +816,8 @@ void MDBalancer::find_exports(CDir *dir,
 
     if ((*it).first < midchunk)
       break;  // try later
+    if (is_export_too_costly((*it).second))
+      continue;
 
     dout(7) << "   taking smaller " << *(*it).second << dendl;
 
@@ -908,6 +842,8 @@ void MDBalancer::find_exports(CDir *dir,
   for (;
        it != smaller.rend();
        ++it) {
+    if (is_export_too_costly((*it).second))
+      continue;
     dout(7) << "   taking (much) smaller " << it->first << " " << *(*it).second << dendl;
 
     exports.push_back((*it).second);
@@ -1094,6 +1030,7 @@ void MDBalancer::hit_dir(utime_t now, CDir *dir, int type, int who, double amoun
 void MDBalancer::subtract_export(CDir *dir, utime_t now)
 {
   dirfrag_load_vec_t subload = dir->pop_auth_subtree;
+  import_stamps.erase(dir->dirfrag());
 
   while (true) {
     dir = dir->inode->get_parent_dir();
@@ -1108,6 +1045,8 @@ void MDBalancer::subtract_export(CDir *dir, utime_t now)
 void MDBalancer::add_import(CDir *dir, utime_t now)
 {
   dirfrag_load_vec_t subload = dir->pop_auth_subtree;
+  if (g_conf->mds_bal_mode == 3)
+    import_stamps[dir->dirfrag()] = now;
 
   while (true) {
     dir = dir->inode->get_parent_dir();
@@ -1118,10 +1057,62 @@ void MDBalancer::add_import(CDir *dir, utime_t now)
   }
 }
 
+bool MDBalancer::is_recent_import(CDir *dir)
+{
+  if (g_conf->mds_bal_mode != 3)
+    return false;
+  map<dirfrag_t, utime_t>::iterator p = import_stamps.find(dir->dirfrag());
+  if (p == import_stamps.end())
+    return false;
+  if ((double)rebalance_time - (double)p->second >= g_conf->mds_bal_reexport_interval) {
+    import_stamps.erase(p);
+    return false;
+  }
+  dout(10) << " not exporting recent import " << *dir
+	   << " (imported " << p->second << ")" << dendl;
+  return true;
+}
 
+uint64_t MDBalancer::estimate_export_cost(CDir *dir, uint64_t max)
+{
+  uint64_t cost = 0;
+  list<CDir*> q;
+  q.push_back(dir);
+  while (!q.empty() && cost < max) {
+    CDir *d = q.front();
+    q.pop_front();
+    for (CDir::map_t::iterator p = d->begin(); p != d->end() && cost < max; ++p) {
+      cost++;
+      CInode *in = p->second->get_linkage()->get_inode();
+      if (!in)
+	continue;
+      cost += in->get_client_caps().size();
+      if (!in->is_dir())
+	continue;
+      list<CDir*> dfls;
+      in->get_dirfrags(dfls);
+      for (list<CDir*>::iterator f = dfls.begin(); f != dfls.end(); ++f) {
+	// nested subtrees stay where they are
+	if ((*f)->is_auth() && !(*f)->is_subtree_root())
+	  q.push_back(*f);
+      }
+    }
+  }
+  return cost;
+}
 
-
-
+bool MDBalancer::is_export_too_costly(CDir *dir)
+{
+  if (g_conf->mds_bal_mode != 3 || g_conf->mds_bal_max_export_items <= 0)
+    return false;
+  uint64_t max = g_conf->mds_bal_max_export_items;
+  uint64_t cost = estimate_export_cost(dir, max + 1);
+  if (cost <= max)
+    return false;
+  dout(7) << "   not exporting " << *dir << ", would migrate over " << max
+	  << " dentries+caps" << dendl;
+  return true;
+}
 
 void MDBalancer::show_imports(bool external)
 {
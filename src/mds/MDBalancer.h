@@ -25,6 +25,7 @@ using std::map;
 #include "include/types.h"
 #include "common/Clock.h"
 #include "CInode.h"
+#include "BalancerPlan.h"
 
 
 class MDS;
@@ -51,26 +52,23 @@ class MDBalancer {
 
   // per-epoch scatter/gathered info
   map<mds_rank_t, mds_load_t>  mds_load;
-  map<mds_rank_t, float>       mds_meta_load;
   map<mds_rank_t, map<mds_rank_t, float> > mds_import_map;
 
   // per-epoch state
   double          my_load, target_load;
   map<mds_rank_t,double> my_targets;
-  map<mds_rank_t,double> imported;
-  map<mds_rank_t,double> exported;
+  BalancerPlan    plan;
+
+  // mode 3: when we last imported each subtree
+  map<dirfrag_t, utime_t> import_stamps;
 
   map<mds_rank_t, int> old_prev_targets;  // # iterations they _haven't_ been targets
   bool check_targets();
 
-  double try_match(mds_rank_t ex, double& maxex,
-                   mds_rank_t im, double& maxim);
-  double get_maxim(mds_rank_t im) {
-    return target_load - mds_meta_load[im] - imported[im];
-  }
-  double get_maxex(mds_rank_t ex) {
-    return mds_meta_load[ex] - target_load - exported[ex];    
-  }
+  /// whether dir was imported too recently to be exported again
+  bool is_recent_import(CDir *dir);
+  /// whether migrating dir would touch more than mds_bal_max_export_items
+  bool is_export_too_costly(CDir *dir);
 
 public:
   MDBalancer(MDS *m) : 
@@ -79,6 +77,14 @@ public:
     last_epoch_under(0), last_epoch_over(0), my_load(0.0), target_load(0.0) { }
   
   mds_load_t get_load(utime_t);
+  /// load of a subtree in mds_load_t::mds_load() terms
+  double get_dir_load(dirfrag_load_vec_t& pop, utime_t now);
+  /**
+   * Number of cached dentries and client caps under dir (in its auth
+   * subtree) that migrating it would have to encode, counting no
+   * further than max.
+   */
+  uint64_t estimate_export_cost(CDir *dir, uint64_t max);
 
   int proc_message(Message *m);
   
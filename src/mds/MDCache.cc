@@ -172,6 +172,7 @@ MDCache::MDCache(MDS *m) :
   rejoin_done(NULL),
   resolve_done(NULL),
   recovery_queue(m),
+  dir_commit_sched(m),
   stray_manager(m)
 {
   mds = m;
@@ -242,6 +243,7 @@ void MDCache::log_stat()
   mds->logger->set(l_mds_inodes_pin_tail, lru.lru_get_pintail());
   mds->logger->set(l_mds_inodes_with_caps, num_inodes_with_caps);
   mds->logger->set(l_mds_caps, num_caps);
+  mds->logger->set(l_mds_cache_bytes, CacheMemory::get_total_bytes());
 }
 
 
@@ -267,6 +269,7 @@ void MDCache::add_inode(CInode *in)
   // add to lru, inode map
   assert(inode_map.count(in->vino()) == 0);  // should be no dup inos!
   inode_map[ in->vino() ] = in;
+  in->update_mem_charge();
 
   if (in->ino() < MDS_INO_SYSTEM_BASE) {
     if (in->ino() == MDS_INO_ROOT)
@@ -287,6 +290,8 @@ void MDCache::remove_inode(CInode *o)
 { 
   dout(14) << "remove_inode " << *o << dendl;
 
+  o->drop_cached_stat();
+
   if (o->get_parent_dn()) {
     // FIXME: multiple parents?
     CDentry *dn = o->get_parent_dn();
@@ -1943,6 +1948,7 @@ void MDCache::project_rstat_frag_to_inode(nest_info_t& rstat, nest_info_t& accou
 	  dout(10) << " splitting right old_inode [" << first << "," << p->first << "] to ["
 		   << (last+1) << "," << p->first << "]" << dendl;
 	  pin->old_inodes[last] = p->second;
+	  pin->recharge_mem(0, CInode::old_inode_mem_bytes(p->second));
 	  p->second.first = last+1;
 	  pin->dirty_old_rstats.insert(p->first);
 	}
@@ -1951,6 +1957,7 @@ void MDCache::project_rstat_frag_to_inode(nest_info_t& rstat, nest_info_t& accou
 	dout(10) << " splitting left old_inode [" << first << "," << last << "] to ["
 		 << first << "," << ofirst-1 << "]" << dendl;
 	pin->old_inodes[ofirst-1] = pin->old_inodes[last];
+	pin->recharge_mem(0, CInode::old_inode_mem_bytes(pin->old_inodes[last]));
 	pin->dirty_old_rstats.insert(ofirst-1);
 	pin->old_inodes[last].first = first = ofirst;
       }
@@ -6208,6 +6215,29 @@ void MDCache::start_recovered_truncates()
 // cache trimming
 
 
+/*
+ * pack the xattrs of cold inodes among the max coldest dentries, so
+ * they cost less while they wait to be trimmed or used again.
+ */
+void MDCache::pack_cold_inodes(unsigned max)
+{
+  if (!mds->is_active() && !mds->is_stopping())
+    return;
+  unsigned packed = 0;
+  LRUObject *o = lru.lru_get_bot_tail();
+  for (unsigned n = 0; o && n < max; o = LRU::lru_get_prev(o), ++n) {
+    CDentry::linkage_t *dnl = static_cast<CDentry*>(o)->get_linkage();
+    if (!dnl->is_primary())
+      continue;
+    CInode *in = dnl->get_inode();
+    if (in->can_pack_xattrs()) {
+      in->pack_xattrs();
+      ++packed;
+    }
+  }
+  dout(10) << "pack_cold_inodes packed " << packed << dendl;
+}
+
 /*
  * note: only called while MDS is active or stopping... NOT during recovery.
  * however, we may expire a replica whose authority is recovering.
@@ -6222,10 +6252,16 @@ bool MDCache::trim(int max, int count)
       max = 1;
   } else if (max < 0) {
     max = g_conf->mds_cache_size;
-    if (max <= 0)
-      return false;
+    if (max <= 0) {
+      if (!g_conf->mds_cache_memory_limit)
+	return false;
+      max = INT_MAX;  // bounded by memory only
+    }
   }
-  dout(7) << "trim max=" << max << "  cur=" << lru.lru_get_size() << dendl;
+  uint64_t mem_limit = count > 0 ? 0 : g_conf->mds_cache_memory_limit;
+  dout(7) << "trim max=" << max << "  cur=" << lru.lru_get_size()
+	  << " mem_limit=" << mem_limit
+	  << " mem=" << CacheMemory::get_total_bytes() << dendl;
 
   // process delayed eval_stray()
   stray_manager.advance_delayed();
@@ -6234,8 +6270,19 @@ bool MDCache::trim(int max, int count)
   bool is_standby_replay = mds->is_standby_replay();
   int unexpirable = 0;
   list<CDentry*> unexpirables;
+  // the byte estimate alone may drive us through the whole LRU (e.g. when
+  // most of the memory is pinned); only look at so many dentries for it
+  // per call, and let the next tick carry on.
+  uint32_t mem_batch = g_conf->mds_cache_memory_trim_batch;
+  uint32_t mem_tried = 0;
+  if (mem_limit && CacheMemory::get_total_bytes() > mem_limit)
+    pack_cold_inodes(mem_batch);
   // trim dentries from the LRU
-  while (lru.lru_get_size() + unexpirable > (unsigned)max) {
+  while (lru.lru_get_size() + unexpirable > (unsigned)max ||
+	 (mem_limit && mem_tried < mem_batch &&
+	  CacheMemory::get_total_bytes() > mem_limit)) {
+    if (lru.lru_get_size() + unexpirable <= (unsigned)max)
+      ++mem_tried;
     CDentry *dn = static_cast<CDentry*>(lru.lru_expire());
     if (!dn) break;
     if ((is_standby_replay && dn->get_linkage()->inode &&
@@ -6249,6 +6296,11 @@ bool MDCache::trim(int max, int count)
       i != unexpirables.end();
       ++i)
     lru.lru_insert_mid(*i);
+  if (mem_limit && CacheMemory::get_total_bytes() > mem_limit)
+    dout(5) << "trim still over mem_limit " << mem_limit
+	    << " after " << mem_tried << " dentries: mem="
+	    << CacheMemory::get_total_bytes() << " unexpirable="
+	    << unexpirable << dendl;
 
   // trim non-auth, non-bound subtrees
   for (map<CDir*, set<CDir*> >::iterator p = subtrees.begin();
@@ -10358,6 +10410,8 @@ void MDCache::adjust_dir_fragments(CInode *diri,
 	   << " srcfrags " << srcfrags
 	   << " on " << *diri << dendl;
 
+  diri->drop_cached_stat();  // its stat carries the fragtree
+
   // adjust fragtree
   // yuck.  we may have discovered the inode while it was being fragmented.
   if (!diri->dirfragtree.is_leaf(basefrag))
@@ -11763,9 +11817,16 @@ void MDCache::register_perfcounters()
     pcb.add_u64_counter(l_mdc_recovery_completed, "recovery_completed",
         "File recoveries completed", "recd");
 
+    /* Dirfrag commit statistics */
+    pcb.add_u64(l_mdc_dir_commit_queued, "dir_commit_queued", "Dirfrag commit writes waiting to be sent");
+    pcb.add_u64(l_mdc_dir_commit_in_flight, "dir_commit_in_flight", "Dirfrag commit writes in flight");
+    pcb.add_u64_counter(l_mdc_dir_commit_ops, "dir_commit_ops", "Dirfrag commit writes sent");
+    pcb.add_u64_counter(l_mdc_dir_commit_bytes, "dir_commit_bytes", "Dentry bytes written by dirfrag commits");
+
     logger = pcb.create_perf_counters();
     g_ceph_context->get_perfcounters_collection()->add(logger);
     recovery_queue.set_logger(logger);
+    dir_commit_sched.set_logger(logger);
     stray_manager.set_logger(logger);
 }
 
@@ -29,6 +29,8 @@
 #include "events/EMetaBlob.h"
 #include "RecoveryQueue.h"
 #include "StrayManager.h"
+#include "DirCommitScheduler.h"
+#include "StatCache.h"
 #include "MDSContext.h"
 #include "MDSMap.h"
 
@@ -105,6 +107,15 @@ enum {
   // How many inodes ever completed size recovery
   l_mdc_recovery_completed,
 
+  // How many dirfrag commit writes are waiting to be sent
+  l_mdc_dir_commit_queued,
+  // How many dirfrag commit writes are in flight
+  l_mdc_dir_commit_in_flight,
+  // How many dirfrag commit writes have been sent
+  l_mdc_dir_commit_ops,
+  // How many bytes of dentries dirfrag commit writes have carried
+  l_mdc_dir_commit_bytes,
+
   l_mdc_last,
 };
 
@@ -613,6 +624,13 @@ private:
   void start_files_to_recover(vector<CInode*>& recover_q, vector<CInode*>& check_q);
 public:
   void do_file_recover();
+
+  // dirfrag commit writes
+  DirCommitScheduler dir_commit_sched;
+
+  // getattr/lookup replies served outside mds_lock
+  StatCache stat_cache;
+
   void queue_file_recover(CInode *in);
   void _queued_file_recover_cow(CInode *in, MutationRef& mut);
 
@@ -636,6 +654,7 @@ public:
 
   // trimming
   bool trim(int max=-1, int count=-1);   // trim cache
+  void pack_cold_inodes(unsigned max);
   bool trim_dentry(CDentry *dn, map<mds_rank_t, MCacheExpire*>& expiremap);
   void trim_dirfrag(CDir *dir, CDir *con,
 		    map<mds_rank_t, MCacheExpire*>& expiremap);
@@ -69,11 +69,23 @@ void MDLog::create_logger()
       "Segments", "segs");
   plb.add_u64(l_mdl_segexg, "segexg", "Expiring segments");
   plb.add_u64(l_mdl_segexd, "segexd", "Current expired segments");
+  plb.add_u64_avg(l_mdl_segdirops, "segdirops",
+      "Dirfrag commit writes per expired segment");
+  plb.add_u64_avg(l_mdl_segdirbytes, "segdirbytes",
+      "Dirfrag commit bytes per expired segment");
 
   plb.add_u64(l_mdl_expos, "expos", "Journaler xpire position");
   plb.add_u64(l_mdl_wrpos, "wrpos", "Journaler  write position");
   plb.add_u64(l_mdl_rdpos, "rdpos", "Journaler  read position");
   plb.add_u64(l_mdl_jlat, "jlat", "Journaler flush latency");
+  plb.add_u64_counter(l_mdl_replayev, "replayev", "Events replayed");
+  plb.add_u64_counter(l_mdl_replaybytes, "replaybytes",
+      "Journal bytes replayed");
+  plb.add_u64(l_mdl_replayq, "replayq", "Decoded events waiting for replay");
+  plb.add_time_avg(l_mdl_replaydecode, "replaydecode",
+      "Journal event read and decode latency");
+  plb.add_time_avg(l_mdl_replayapply, "replayapply",
+      "Journal event replay latency");
 
   // logger
   logger = plb.create_perf_counters();
@@ -796,8 +808,12 @@ void MDLog::_expired(LogSegment *ls)
     }
     ls->expiry_waiters.clear();
     
+    dout(10) << "_expired segment " << ls->seq << " took " << ls->dir_commit_ops
+	     << " dirfrag commit writes, " << ls->dir_commit_bytes << " bytes" << dendl;
     logger->inc(l_mdl_evex, ls->num_events);
     logger->inc(l_mdl_segex);
+    logger->inc(l_mdl_segdirops, ls->dir_commit_ops);
+    logger->inc(l_mdl_segdirbytes, ls->dir_commit_bytes);
   }
 
   logger->set(l_mdl_ev, num_events);
@@ -833,6 +849,9 @@ void MDLog::replay(MDSInternalContextBase *c)
   assert(num_events == 0 || already_replayed);
   already_replayed = true;
 
+  if (g_conf->mds_log_replay_prefetch_periods > 0)
+    journaler->set_prefetch_periods(g_conf->mds_log_replay_prefetch_periods);
+
   replay_thread.create();
 }
 
@@ -1185,6 +1204,14 @@ void MDLog::_replay_thread()
 {
   dout(10) << "_replay_thread start" << dendl;
 
+  replay_queue.clear();
+  replay_applying = false;
+  replay_read_done = false;
+  replay_apply_stopped = false;
+  replay_bytes = 0;
+  replay_apply_thread.create();
+  utime_t replay_start = ceph_clock_now(g_ceph_context);
+
   // loop
   int r = 0;
   while (1) {
@@ -1244,6 +1271,8 @@ void MDLog::_replay_thread()
                             // respawn()
             }
           }
+	  if (!_replay_drain())
+	    break;
 	  standby_trim_segments();
           if (journaler->get_read_pos() < journaler->get_expire_pos()) {
             dout(0) << "expire_pos is higher than read_pos, returning EAGAIN" << dendl;
@@ -1261,6 +1290,7 @@ void MDLog::_replay_thread()
     assert(journaler->is_readable() || mds->stopping);
     
     // read it
+    utime_t read_start = ceph_clock_now(g_ceph_context);
     uint64_t pos = journaler->get_read_pos();
     bufferlist bl;
     bool r = journaler->try_read_entry(bl);
@@ -1291,44 +1321,32 @@ void MDLog::_replay_thread()
     }
     le->set_start_off(pos);
 
-    // new segment?
-    if (le->get_type() == EVENT_SUBTREEMAP ||
-	le->get_type() == EVENT_RESETJOURNAL) {
-      ESubtreeMap *sle = dynamic_cast<ESubtreeMap*>(le);
-      if (sle && sle->event_seq > 0)
-	event_seq = sle->event_seq;
-      else
-	event_seq = pos;
-      segments[event_seq] = new LogSegment(event_seq, pos);
-      logger->set(l_mdl_seg, segments.size());
-    } else {
-      event_seq++;
-    }
+    logger->tinc(l_mdl_replaydecode, ceph_clock_now(g_ceph_context) - read_start);
 
-    // have we seen an import map yet?
-    if (segments.empty()) {
-      dout(10) << "_replay " << pos << "~" << bl.length() << " / " << journaler->get_write_pos() 
-	       << " " << le->get_stamp() << " -- waiting for subtree_map.  (skipping " << *le << ")" << dendl;
-    } else {
-      dout(10) << "_replay " << pos << "~" << bl.length() << " / " << journaler->get_write_pos() 
-	       << " " << le->get_stamp() << ": " << *le << dendl;
-      le->_segment = get_current_segment();    // replay may need this
-      le->_segment->num_events++;
-      le->_segment->end = journaler->get_read_pos();
-      num_events++;
-
-      {
-        Mutex::Locker l(mds->mds_lock);
-        if (mds->stopping) {
-          return;
-        }
-        le->replay(mds);
-      }
-    }
-    delete le;
+    if (!_replay_queue_event(le, journaler->get_read_pos(), bl.length()))
+      break;
+  }
 
-    logger->set(l_mdl_rdpos, pos);
+  // let the apply thread finish what we decoded
+  {
+    Mutex::Locker l(replay_lock);
+    replay_read_done = true;
+    replay_cond.Signal();
   }
+  replay_apply_thread.join();
+
+  // back to the normal readahead, whether we got to the end or not
+  if (g_conf->mds_log_replay_prefetch_periods > 0)
+    journaler->set_prefetch_periods(0);
+  if (replay_apply_stopped)
+    return;
+
+  double elapsed = ceph_clock_now(g_ceph_context) - replay_start;
+  dout(1) << "_replay_thread replayed " << replay_bytes << " bytes in "
+	  << elapsed << "s";
+  if (elapsed > 0)
+    *_dout << " (" << ((double)replay_bytes / elapsed / 1048576.0) << " MB/s)";
+  *_dout << dendl;
 
   // done!
   if (r == 0) {
@@ -1353,6 +1371,120 @@ void MDLog::_replay_thread()
   dout(10) << "_replay_thread finish" << dendl;
 }
 
+bool MDLog::_replay_queue_event(LogEvent *le, uint64_t end, size_t len)
+{
+  unsigned max = MAX(1, g_conf->mds_log_replay_queue_max);
+  Mutex::Locker l(replay_lock);
+  while (replay_queue.size() >= max && !replay_apply_stopped)
+    replay_cond.Wait(replay_lock);
+  if (replay_apply_stopped) {
+    delete le;
+    return false;
+  }
+  replay_queue.push_back(replay_item_t(le, end, len));
+  logger->set(l_mdl_replayq, replay_queue.size());
+  replay_cond.Signal();
+  return true;
+}
+
+bool MDLog::_replay_drain()
+{
+  Mutex::Locker l(replay_lock);
+  while ((!replay_queue.empty() || replay_applying) && !replay_apply_stopped)
+    replay_cond.Wait(replay_lock);
+  return !replay_apply_stopped;
+}
+
+/*
+ * Apply side of replay: segment bookkeeping and LogEvent::replay() for
+ * whatever the replay thread has decoded, a batch per mds_lock hold.
+ */
+void MDLog::_replay_apply_thread()
+{
+  dout(10) << "_replay_apply_thread start" << dendl;
+  replay_lock.Lock();
+  while (true) {
+    while (replay_queue.empty() && !replay_read_done)
+      replay_cond.Wait(replay_lock);
+    if (replay_queue.empty())
+      break;
+
+    list<replay_item_t> batch;
+    batch.swap(replay_queue);
+    replay_applying = true;
+    logger->set(l_mdl_replayq, 0);
+    replay_cond.Signal();   // room for the reader
+    replay_lock.Unlock();
+
+    bool stopping = false;
+    {
+      Mutex::Locker l(mds->mds_lock);
+      for (list<replay_item_t>::iterator p = batch.begin(); p != batch.end(); ++p) {
+	LogEvent *le = p->le;
+	if (mds->stopping) {
+	  stopping = true;
+	  delete le;
+	  continue;
+	}
+	uint64_t pos = le->get_start_off();
+
+	// new segment?
+	if (le->get_type() == EVENT_SUBTREEMAP ||
+	    le->get_type() == EVENT_RESETJOURNAL) {
+	  ESubtreeMap *sle = dynamic_cast<ESubtreeMap*>(le);
+	  if (sle && sle->event_seq > 0)
+	    event_seq = sle->event_seq;
+	  else
+	    event_seq = pos;
+	  segments[event_seq] = new LogSegment(event_seq, pos);
+	  logger->set(l_mdl_seg, segments.size());
+	} else {
+	  event_seq++;
+	}
+
+	// have we seen an import map yet?
+	if (segments.empty()) {
+	  dout(10) << "_replay " << pos << "~" << p->len << " / " << p->end
+		   << " " << le->get_stamp() << " -- waiting for subtree_map.  (skipping " << *le << ")" << dendl;
+	} else {
+	  dout(10) << "_replay " << pos << "~" << p->len << " / " << p->end
+		   << " " << le->get_stamp() << ": " << *le << dendl;
+	  le->_segment = get_current_segment();    // replay may need this
+	  le->_segment->num_events++;
+	  le->_segment->end = p->end;
+	  num_events++;
+
+	  utime_t start = ceph_clock_now(g_ceph_context);
+	  le->replay(mds);
+	  logger->tinc(l_mdl_replayapply, ceph_clock_now(g_ceph_context) - start);
+	}
+	delete le;
+
+	logger->set(l_mdl_rdpos, pos);
+	logger->inc(l_mdl_replayev);
+	logger->inc(l_mdl_replaybytes, p->len);
+	replay_bytes += p->len;
+      }
+    }
+
+    replay_lock.Lock();
+    replay_applying = false;
+    if (stopping) {
+      replay_apply_stopped = true;
+      for (list<replay_item_t>::iterator p = replay_queue.begin();
+	   p != replay_queue.end();
+	   ++p)
+	delete p->le;
+      replay_queue.clear();
+    }
+    replay_cond.Signal();
+    if (stopping)
+      break;
+  }
+  replay_lock.Unlock();
+  dout(10) << "_replay_apply_thread finish" << dendl;
+}
+
 void MDLog::standby_trim_segments()
 {
   dout(10) << "standby_trim_segments" << dendl;
@@ -30,10 +30,17 @@ enum {
   l_mdl_seg,
   l_mdl_segexg,
   l_mdl_segexd,
+  l_mdl_segdirops,
+  l_mdl_segdirbytes,
   l_mdl_expos,
   l_mdl_wrpos,
   l_mdl_rdpos,
   l_mdl_jlat,
+  l_mdl_replayev,
+  l_mdl_replaybytes,
+  l_mdl_replayq,
+  l_mdl_replaydecode,
+  l_mdl_replayapply,
   l_mdl_last,
 };
 
@@ -103,6 +110,39 @@ protected:
   void _replay();         // old way
   void _replay_thread();  // new way
 
+  // Replay is pipelined: the replay thread reads and decodes events
+  // while the apply thread replays earlier ones under mds_lock.
+  struct replay_item_t {
+    LogEvent *le;
+    uint64_t end;     // journal read position after this event
+    size_t len;
+    replay_item_t(LogEvent *e, uint64_t en, size_t l) : le(e), end(en), len(l) {}
+  };
+  class ReplayApplyThread : public Thread {
+    MDLog *log;
+  public:
+    ReplayApplyThread(MDLog *l) : log(l) {}
+    void* entry() {
+      log->_replay_apply_thread();
+      return 0;
+    }
+  } replay_apply_thread;
+  friend class ReplayApplyThread;
+
+  Mutex replay_lock;
+  Cond replay_cond;
+  list<replay_item_t> replay_queue;
+  bool replay_applying;       // apply thread holds a batch
+  bool replay_read_done;      // no more events will be queued
+  bool replay_apply_stopped;  // apply thread saw mds->stopping
+  uint64_t replay_bytes;
+
+  void _replay_apply_thread();
+  /// queue an event for apply; false if replay is being torn down
+  bool _replay_queue_event(LogEvent *le, uint64_t end, size_t len);
+  /// wait until everything queued so far has been applied
+  bool _replay_drain();
+
   // Journal recovery/rewrite logic
   class RecoveryThread : public Thread {
     MDLog *log;
@@ -191,6 +231,10 @@ public:
 		  logger(0),
 		  replay_thread(this),
 		  already_replayed(false),
+		  replay_apply_thread(this),
+		  replay_lock("MDLog::replay_lock"),
+		  replay_applying(false), replay_read_done(false),
+		  replay_apply_stopped(false), replay_bytes(0),
 		  recovery_thread(this),
 		  event_seq(0), expiring_events(0), expired_events(0),
 		  submit_mutex("MDLog::submit_mutex"),
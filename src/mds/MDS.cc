@@ -61,6 +61,7 @@
 #include "messages/MGenericMessage.h"
 
 #include "messages/MClientRequest.h"
+#include "messages/MClientReply.h"
 #include "messages/MClientRequestForward.h"
 
 #include "messages/MMDSTableRequest.h"
@@ -86,7 +87,7 @@
 // cons/des
 MDS::MDS(const std::string &n, Messenger *m, MonClient *mc) : 
   Dispatcher(m->cct),
-  mds_lock("MDS::mds_lock"),
+  mds_lock("MDS::mds_lock", false, true, false, m->cct),
   stopping(false),
   timer(m->cct, mds_lock),
   hb(NULL),
@@ -340,6 +341,8 @@ bool MDS::asok_command(string command, cmdmap_t& cmdmap, string format,
       command_flush_journal(f);
     } else if (command == "get subtrees") {
       command_get_subtrees(f);
+    } else if (command == "dump_mempools") {
+      command_dump_mempools(f);
     } else if (command == "export dir") {
       string path;
       if(!cmd_getval(g_ceph_context, cmdmap, "path", path)) {
@@ -544,6 +547,15 @@ int MDS::_command_flush_journal(std::stringstream *ss)
 }
 
 
+void MDS::command_dump_mempools(Formatter *f)
+{
+  f->open_object_section("mempools");
+  CacheMemory::dump(f);
+  f->dump_unsigned("mds_cache_memory_limit", g_conf->mds_cache_memory_limit);
+  f->dump_int("mds_cache_size", g_conf->mds_cache_size);
+  f->close_section();
+}
+
 void MDS::command_get_subtrees(Formatter *f)
 {
   assert(f != NULL);
@@ -824,6 +836,11 @@ void MDS::set_up_admin_socket()
 				     asok_hook,
 				     "Return the subtree map");
   assert(r == 0);
+  r = admin_socket->register_command("dump_mempools",
+				     "dump_mempools",
+				     asok_hook,
+				     "Show estimated cache memory use by type");
+  assert(r == 0);
   r = admin_socket->register_command("dirfrag split",
 				     "dirfrag split "
                                      "name=path,type=CephString,req=true "
@@ -860,6 +877,7 @@ void MDS::clean_up_admin_socket()
   admin_socket->unregister_command("session ls");
   admin_socket->unregister_command("flush journal");
   admin_socket->unregister_command("force_readonly");
+  admin_socket->unregister_command("dump_mempools");
   delete asok_hook;
   asok_hook = NULL;
 }
@@ -920,12 +938,16 @@ void MDS::create_logger()
     PerfCountersBuilder mds_plb(g_ceph_context, "mds", l_mds_first, l_mds_last);
 
     mds_plb.add_u64_counter(l_mds_request, "request", "Requests");
+    mds_plb.add_u64_counter(l_mds_request_fast, "request_fast",
+        "Requests answered outside mds_lock");
     mds_plb.add_u64_counter(l_mds_reply, "reply", "Replies");
     mds_plb.add_time_avg(l_mds_reply_latency, "reply_latency",
         "Reply latency", "rlat");
     mds_plb.add_u64_counter(l_mds_forward, "forward", "Forwarding request");
     
     mds_plb.add_u64_counter(l_mds_dir_fetch, "dir_fetch", "Directory fetch");
+    mds_plb.add_u64_counter(l_mds_dir_fetch_page, "dir_fetch_page",
+        "Directory page fetch for streaming readdir");
     mds_plb.add_u64_counter(l_mds_dir_commit, "dir_commit", "Directory commit");
     mds_plb.add_u64_counter(l_mds_dir_split, "dir_split", "Directory split");
 
@@ -938,6 +960,8 @@ void MDS::create_logger()
     mds_plb.add_u64(l_mds_inodes_expired, "inodes_expired", "Inodes expired");
     mds_plb.add_u64(l_mds_inodes_with_caps, "inodes_with_caps", "Inodes with capabilities");
     mds_plb.add_u64(l_mds_caps, "caps", "Capabilities", "caps");
+    mds_plb.add_u64(l_mds_cache_bytes, "cache_bytes",
+        "Estimated cache memory");
     mds_plb.add_u64(l_mds_subtrees, "subtrees", "Subtrees");
     
     mds_plb.add_u64_counter(l_mds_traverse, "traverse", "Traverses"); 
@@ -2048,6 +2072,7 @@ void MDS::handle_mds_map(MMDSMap *m)
   mdcache->notify_mdsmap_changed();
 
  out:
+  mdcache->stat_cache.set_active(is_active(), mdsmap->get_epoch());
   m->put();
   delete oldmap;
 }
@@ -2653,6 +2678,7 @@ void MDS::suicide(bool fast)
   // out if it is.
   assert(stopping == false);
   stopping = true;
+  mdcache->stat_cache.set_active(false, mdsmap->get_epoch());
 
   set_want_state(MDSMap::STATE_DNE); // whatever.
 
@@ -2793,6 +2819,47 @@ bool MDS::ms_dispatch(Message *m)
   return ret;
 }
 
+/*
+ * getattr and lookup replies the StatCache has are sent from the
+ * messenger thread, without taking mds_lock.
+ *
+ * The messenger asks again just before ms_fast_dispatch(), and must get
+ * the same answer, so a request is marked the first time the StatCache
+ * takes it.
+ */
+bool MDS::ms_can_fast_dispatch(Message *m) const
+{
+  if (m->get_type() != CEPH_MSG_CLIENT_REQUEST)
+    return false;
+  MClientRequest *req = static_cast<MClientRequest*>(m);
+  if (!req->fast_dispatch)
+    req->fast_dispatch = mdcache->stat_cache.can_reply(req);
+  return req->fast_dispatch;
+}
+
+void MDS::ms_fast_dispatch(Message *m)
+{
+  MClientRequest *req = static_cast<MClientRequest*>(m);
+  MClientReply *reply = mdcache->stat_cache.build_reply(req);
+  if (!reply) {
+    // dropped since ms_can_fast_dispatch(); this thread mustn't wait
+    // for mds_lock, so queue it for the finisher to dispatch
+    dout(10) << "ms_fast_dispatch lost the stat for " << *req
+	     << ", requeueing" << dendl;
+    finisher.queue(new C_MDS_RetryDispatch(this, m));
+    return;
+  }
+  if (logger) {
+    logger->inc(l_mds_request);
+    logger->inc(l_mds_request_fast);
+    logger->inc(l_mds_reply);
+    logger->tinc(l_mds_reply_latency,
+		 ceph_clock_now(g_ceph_context) - req->get_recv_stamp());
+  }
+  req->get_connection()->send_message(reply);
+  req->put();
+}
+
 bool MDS::ms_get_authorizer(int dest_type, AuthAuthorizer **authorizer, bool force_new)
 {
   dout(10) << "MDS::ms_get_authorizer type=" << ceph_entity_type_name(dest_type) << dendl;
@@ -44,10 +44,12 @@
 enum {
   l_mds_first = 2000,
   l_mds_request,
+  l_mds_request_fast,
   l_mds_reply,
   l_mds_reply_latency,
   l_mds_forward,
   l_mds_dir_fetch,
+  l_mds_dir_fetch_page,
   l_mds_dir_commit,
   l_mds_dir_split,
   l_mds_inode_max,
@@ -59,6 +61,7 @@ enum {
   l_mds_inodes_expired,
   l_mds_inodes_with_caps,
   l_mds_caps,
+  l_mds_cache_bytes,
   l_mds_subtrees,
   l_mds_traverse,
   l_mds_traverse_hit,
@@ -322,6 +325,22 @@ public:
  private:
   int dispatch_depth;
   bool ms_dispatch(Message *m);
+  bool ms_can_fast_dispatch_any() const { return true; }
+  bool ms_can_fast_dispatch(Message *m) const;
+  void ms_fast_dispatch(Message *m);
+
+  // a fast dispatched request we can't answer after all, handled as
+  // ms_dispatch() would from the finisher thread
+  class C_MDS_RetryDispatch : public Context {
+    MDS *mds;
+    Message *m;
+  public:
+    C_MDS_RetryDispatch(MDS *mds_, Message *m_) : mds(mds_), m(m_) {}
+    void finish(int r) {
+      if (!mds->ms_dispatch(m))
+	m->put();
+    }
+  };
   bool ms_get_authorizer(int dest_type, AuthAuthorizer **authorizer, bool force_new);
   bool ms_verify_authorizer(Connection *con, int peer_type,
 			       int protocol, bufferlist& authorizer_data, bufferlist& authorizer_reply,
@@ -385,6 +404,7 @@ private:
   void command_flush_path(Formatter *f, const string& path);
   void command_flush_journal(Formatter *f);
   void command_get_subtrees(Formatter *f);
+  void command_dump_mempools(Formatter *f);
   void command_export_dir(Formatter *f,
       const std::string &path, mds_rank_t dest);
   bool command_dirfrag_split(
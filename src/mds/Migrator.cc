@@ -1346,6 +1346,7 @@ void Migrator::finish_export_inode(CInode *in, utime_t now, mds_rank_t peer,
   
   // clear/unpin cached_by (we're no longer the authority)
   in->clear_replica_map();
+  in->drop_cached_stat();
   
   // twiddle lock states for auth -> replica transition
   in->authlock.export_twiddle();
@@ -1513,6 +1514,7 @@ void Migrator::finish_export_dir(CDir *dir, utime_t now, mds_rank_t peer,
     CInode *in = dn->get_linkage()->get_inode();
 
     // dentry
+    dn->drop_cached_stat();
     dn->finish_export();
 
     // inode?
@@ -224,6 +224,9 @@ struct MDRequestImpl : public MutationImpl, public TrackedOp {
   // indicator for vxattr osdmap update
   bool waited_for_osdmap;
 
+  // time spent in dispatch_client_request, charged to the balancer (mode 3)
+  utime_t dispatch_start, dispatch_time;
+
   // break rarely-used fields into a separately allocated structure 
   // to save memory for most ops
   struct More {
@@ -274,13 +277,21 @@ struct MDRequestImpl : public MutationImpl, public TrackedOp {
     filepath filepath1;
     filepath filepath2;
 
+    // for streaming readdir
+    map<string, bufferlist> readdir_page;
+    dirfrag_t readdir_page_frag;
+    string readdir_page_after;
+    int readdir_page_r;
+    bool readdir_page_loaded;
+
     More() : 
       slave_error(0),
       has_journaled_slaves(false), slave_update_journaled(false),
       srcdn_auth_mds(-1), inode_import_v(0), rename_inode(0),
       is_freeze_authpin(false), is_ambiguous_auth(false),
       is_remote_frozen_authpin(false), is_inode_exporter(false),
-      flock_was_waiting(false), stid(0), slave_commit(0), export_dir(NULL)  { }
+      flock_was_waiting(false), stid(0), slave_commit(0), export_dir(NULL),
+      readdir_page_r(0), readdir_page_loaded(false) { }
   } *_more;
 
 
@@ -1052,6 +1052,7 @@ void Server::early_reply(MDRequestRef& mdr, CInode *tracei, CDentry *tracedn)
   }
 
   reply->set_extra_bl(mdr->reply_extra_bl);
+  delegate_inos(mdr, reply);
   req->get_connection()->send_message(reply);
 
   mdr->did_early_reply = true;
@@ -1064,6 +1065,38 @@ void Server::early_reply(MDRequestRef& mdr, CInode *tracei, CDentry *tracedn)
   mdr->mark_event("early_replied");
 }
 
+/*
+ * hand the client some of its session's preallocated inos, so that it
+ * can create files in directories it holds Fx on without waiting for
+ * us (see Client::_async_create).  the inos stay in prealloc_inos, so
+ * they are journaled and survive a restart like any other prealloc;
+ * we only stop using them for our own allocations.  the client's
+ * create carries the ino in head.ino and O_EXCL, so a create that
+ * races with a revoke of its Fx simply fails.
+ */
+void Server::delegate_inos(MDRequestRef& mdr, MClientReply *reply)
+{
+  MClientRequest *req = mdr->client_request;
+  if (!(req->head.flags & CEPH_MDS_FLAG_WANT_DELEG_INOS) ||
+      req->get_op() != CEPH_MDS_OP_CREATE ||
+      reply->get_result() < 0 ||
+      !mdr->session)
+    return;
+
+  Session *session = mdr->session;
+  int want = g_conf->mds_client_delegate_inos - session->delegated_inos.size();
+  if (want <= 0)
+    return;
+
+  interval_set<inodeno_t> inos;
+  session->delegate_inos(want, inos);
+  if (inos.empty())
+    return;
+  dout(10) << "delegate_inos " << inos << " to " << session->info.inst.name
+	   << " (" << session->delegated_inos.size() << " delegated)" << dendl;
+  reply->set_deleg_inos(inos);
+}
+
 /*
  * send given reply
  * include a trace to tracei
@@ -1122,6 +1155,9 @@ void Server::reply_client_request(MDRequestRef& mdr, MClientReply *reply)
       mdr->cap_releases.erase(tracedn->get_dir()->get_inode()->vino());
   }
 
+  if (!is_replay && g_conf->mds_bal_mode == 3)
+    charge_request_cost(mdr, tracei, tracedn);
+
   // note client connection to direct my reply
   ConnectionRef client_con = req->get_connection();
 
@@ -1150,6 +1186,8 @@ void Server::reply_client_request(MDRequestRef& mdr, MClientReply *reply)
     // We can set the extra bl unconditionally: if it's already been sent in the
     // early_reply, set_extra_bl will have claimed it and reply_extra_bl is empty
     reply->set_extra_bl(mdr->reply_extra_bl);
+    if (!did_early_reply && !is_replay)
+      delegate_inos(mdr, reply);
 
     reply->set_mdsmap_epoch(mds->mdsmap->get_epoch());
     client_con->send_message(reply);
@@ -1422,9 +1460,56 @@ void Server::handle_osd_map()
   mds->objecter->put_osdmap_read();
 }
 
+/*
+ * charge the time spent handling a request to the directory it touched,
+ * so that the balancer sees which subtrees are expensive rather than
+ * merely popular.
+ */
+void Server::charge_request_cost(MDRequestRef& mdr, CInode *tracei, CDentry *tracedn)
+{
+  utime_t now = ceph_clock_now(g_ceph_context);
+  utime_t t = mdr->dispatch_time;
+  if (mdr->dispatch_start != utime_t())
+    t += now - mdr->dispatch_start;  // still in dispatch_client_request
+
+  CDir *dir = NULL;
+  if (tracedn)
+    dir = tracedn->get_dir();
+  else if (tracei && tracei->get_parent_dn())
+    dir = tracei->get_parent_dn()->get_dir();
+  if (!dir)
+    return;
+  mds->balancer->hit_dir(now, dir, META_POP_COST, -1, (double)t * 1000.0);
+}
+
+/*
+ * accumulates the time a request spends being dispatched (under
+ * mds_lock) in mdr->dispatch_time, for balancer mode 3.  only the
+ * outermost dispatch is timed; the request may finish (and be dropped
+ * by everyone else) before we go out of scope, so hold a ref.
+ */
+class DispatchTimer {
+  MDRequestRef mdr;
+  bool outer;
+public:
+  DispatchTimer(MDRequestRef& m)
+    : mdr(m),
+      outer(g_conf->mds_bal_mode == 3 && m->dispatch_start == utime_t()) {
+    if (outer)
+      mdr->dispatch_start = ceph_clock_now(g_ceph_context);
+  }
+  ~DispatchTimer() {
+    if (outer) {
+      mdr->dispatch_time += ceph_clock_now(g_ceph_context) - mdr->dispatch_start;
+      mdr->dispatch_start = utime_t();
+    }
+  }
+};
+
 void Server::dispatch_client_request(MDRequestRef& mdr)
 {
   MClientRequest *req = mdr->client_request;
+  DispatchTimer timer(mdr);
 
   if (logger) logger->inc(l_mdss_dispatch_client_request);
 
@@ -2197,7 +2282,7 @@ CInode* Server::prepare_new_inode(MDRequestRef& mdr, CDir *dir, inodeno_t useino
   CInode *in = new CInode(mdcache);
   
   // assign ino
-  if (mdr->session->info.prealloc_inos.size()) {
+  if (mdr->session->can_take_ino(useino)) {
     mdr->used_prealloc_ino = 
       in->inode.ino = mdr->session->take_ino(useino);  // prealloc -> used
     mds->sessionmap.mark_projected(mdr->session);
@@ -2660,6 +2745,16 @@ void Server::handle_client_getattr(MDRequestRef& mdr, bool is_lookup)
   mds->balancer->hit_inode(ceph_clock_now(g_ceph_context), ref, META_POP_IRD,
 			   mdr->client_request->get_source().num());
 
+  // let later stats of the same inode skip mds_lock while it stays put
+  if (mdr->snapid == CEPH_NOSNAP && mdcache->stat_cache.is_active()) {
+    mdcache->stat_cache.add_inode(ref);
+    if (is_lookup) {
+      CDentry *dn = mdr->dn[0].back();
+      mdcache->stat_cache.add_inode(dn->get_dir()->get_inode());
+      mdcache->stat_cache.add_dentry(dn, mds->get_nodeid());
+    }
+  }
+
   // reply
   dout(10) << "reply to stat on " << *req << dendl;
   mdr->tracei = ref;
@@ -3058,6 +3153,19 @@ void Server::handle_client_openc(MDRequestRef& mdr)
   }
 
   // created null dn.
+
+  // an async create has already set up its inode under the ino we
+  // delegated (see delegate_inos); if that isn't ours to give any more,
+  // any other ino would leave the client with the wrong inode.
+  if ((req->head.flags & CEPH_MDS_FLAG_WANT_DELEG_INOS) &&
+      req->head.ino && !req->is_replay() &&
+      !mdr->session->info.prealloc_inos.contains(inodeno_t(req->head.ino))) {
+    dout(10) << "create with ino " << inodeno_t(req->head.ino)
+	     << " not preallocated to " << mdr->session->info.inst.name
+	     << ", failing with -ESTALE" << dendl;
+    respond_to_request(mdr, -ESTALE);
+    return;
+  }
     
   // create inode.
   SnapRealm *realm = diri->find_snaprealm();   // use directory's realm; inode isn't attached yet.
@@ -3158,6 +3266,18 @@ void Server::handle_client_readdir(MDRequestRef& mdr)
   dout(10) << "handle_client_readdir on " << *dir << dendl;
   assert(dir->is_auth());
 
+  if (_readdir_should_stream(mdr, dir, offset_str)) {
+    if (!mdr->more()->readdir_page_loaded && !dir->can_auth_pin()) {
+      dout(7) << "dir is frozen, waiting to stream " << *dir << dendl;
+      mds->locker->drop_locks(mdr.get());
+      mdr->drop_local_auth_pins();
+      dir->add_waiter(CDir::WAIT_UNFREEZE, new C_MDS_RetryRequest(mdcache, mdr));
+      return;
+    }
+    _readdir_stream(mdr, diri, dir, offset_str);
+    return;
+  }
+
   if (!dir->is_complete()) {
     if (dir->is_frozen()) {
       dout(7) << "dir is frozen " << *dir << dendl;
@@ -3301,6 +3421,10 @@ void Server::handle_client_readdir(MDRequestRef& mdr)
   ::encode(end, dirbl);
   ::encode(complete, dirbl);
   dirbl.claim_append(dnbl);
+  if (req->get_flags() & CEPH_MDS_FLAG_READDIR_KEY_ORDER) {
+    __u8 key_order = 0;  // no, name order
+    ::encode(key_order, dirbl);
+  }
   
   // yay, reply
   dout(10) << "reply to " << *req << " readdir num=" << numfiles
@@ -3320,6 +3444,241 @@ void Server::handle_client_readdir(MDRequestRef& mdr)
   respond_to_request(mdr, 0);
 }
 
+/*
+ * Huge dirfrags can be listed without loading them: the dirfrag object is
+ * read one omap page at a time and merged with whatever is already cached.
+ * Entries come back in omap key order ("<name>_head"), which only differs
+ * from name order where one name is a prefix of another, so only clients
+ * that ask with CEPH_MDS_FLAG_READDIR_KEY_ORDER get them.  The reply says
+ * which order it is in, and the client flags the continuations of a
+ * key-ordered listing, which are always resumed here by key, whatever
+ * has become of the frag in between.
+ */
+bool Server::_readdir_should_stream(MDRequestRef& mdr, CDir *dir,
+				    const string& offset_str)
+{
+  if (!(mdr->client_request->get_flags() & CEPH_MDS_FLAG_READDIR_KEY_ORDER) ||
+      mdr->snapid != CEPH_NOSNAP)
+    return false;
+
+  if (mdr->more()->readdir_page_loaded || !offset_str.empty())
+    return true;
+
+  int min_entries = g_conf->mds_readdir_stream_min_entries;
+  if (min_entries <= 0 ||
+      dir->is_complete() || !dir->can_auth_pin())
+    return false;
+  int64_t size = MAX(dir->get_inode()->get_projected_inode()->dirstat.size(),
+		     dir->get_frag_size());
+  return size >= min_entries;
+}
+
+void Server::_readdir_stream(MDRequestRef& mdr, CInode *diri, CDir *dir,
+			     const string& offset_str)
+{
+  MClientRequest *req = mdr->client_request;
+  client_t client = req->get_source().num();
+  MDRequestImpl::More *more = mdr->more();
+  unsigned page_max = MAX(1, g_conf->mds_readdir_stream_page);
+
+  string after_key;
+  if (!offset_str.empty())
+    dentry_key_t(CEPH_NOSNAP, offset_str.c_str()).encode(after_key);
+
+  if (!more->readdir_page_loaded || !(more->readdir_page_frag == dir->dirfrag())) {
+    more->readdir_page_loaded = true;
+    more->readdir_page_frag = dir->dirfrag();
+    more->readdir_page_after = after_key;
+    dout(10) << " streaming readdir on " << *dir << ", fetching page after '"
+	     << after_key << "'" << dendl;
+    dir->fetch_page(after_key, page_max, &more->readdir_page,
+		    &more->readdir_page_r, new C_MDS_RetryRequest(mdcache, mdr));
+    return;
+  }
+  if (more->readdir_page_r == -ENOENT) {
+    more->readdir_page.clear();   // object not created yet; nothing stored
+  } else if (more->readdir_page_r < 0) {
+    dout(0) << "readdir page fetch on " << *dir << " got "
+	    << cpp_strerror(more->readdir_page_r) << dendl;
+    respond_to_request(mdr, more->readdir_page_r);
+    return;
+  }
+
+  utime_t now = ceph_clock_now(NULL);
+  mdr->set_mds_stamp(now);
+
+  SnapRealm *realm = diri->find_snaprealm();
+
+  unsigned max = req->head.args.readdir.max_entries;
+  if (!max)
+    max = page_max;
+  unsigned max_bytes = req->head.args.readdir.max_bytes;
+  if (!max_bytes)
+    max_bytes = 512 << 10;
+
+  bufferlist dirbl;
+  dir->encode_dirstat(dirbl, mds->get_nodeid());
+
+  int front_bytes = dirbl.length() + sizeof(__u32) + sizeof(__u8)*2;
+  int bytes_left = max_bytes - front_bytes;
+  bytes_left -= realm->get_snap_trace().length();
+
+  // merge the stored head dentries with the cached ones; cached wins,
+  // including null dentries for unlinks not yet committed.
+  map<string, bufferlist>& page = more->readdir_page;
+  bool page_full = page.size() >= page_max;
+  typedef map<string, pair<CDentry*, bufferlist*> > merged_t;
+  merged_t merged;
+  for (map<string, bufferlist>::iterator p = page.begin(); p != page.end(); ++p) {
+    string dname;
+    snapid_t last;
+    dentry_key_t::decode_helper(p->first, dname, last);
+    if (last == CEPH_NOSNAP)
+      merged[p->first] = make_pair((CDentry*)NULL, &p->second);
+  }
+  map<string, CDentry*> cached;
+  dir->get_head_dentries_in_key_range(after_key,
+				      page_full ? &page.rbegin()->first : NULL,
+				      cached);
+  for (map<string, CDentry*>::iterator p = cached.begin(); p != cached.end(); ++p)
+    merged[p->first] = make_pair(p->second, (bufferlist*)NULL);
+
+  bufferlist dnbl;
+  __u32 numfiles = 0;
+  merged_t::iterator it = merged.begin();
+  for (; it != merged.end() && numfiles < max; ++it) {
+    CDentry *dn = it->second.first;
+    string dname;
+    snapid_t last;
+    dentry_key_t::decode_helper(it->first, dname, last);
+
+    if ((int)(dnbl.length() + dname.length() + sizeof(__u32) + sizeof(LeaseStat)) > bytes_left) {
+      dout(10) << " ran out of room, stopping at " << dnbl.length() << " < " << bytes_left << dendl;
+      break;
+    }
+
+    if (!dn) {
+      CDir::listed_dentry_t ld;
+      if (CDir::decode_listed_dentry(*it->second.second, &ld) < 0) {
+	dout(0) << "readdir: corrupt dentry '" << dname << "' in " << *dir << dendl;
+	continue;
+      }
+      if (ld.type == 'L') {
+	// a remote link needs its target anyway; give it a dentry
+	dn = dir->add_remote_dentry(dname, ld.remote_ino, ld.remote_d_type, ld.first);
+      } else {
+	if (ld.inode.inode.ino == CEPH_INO_CEPH)
+	  continue;
+	// listed only: no cache entry, no lease, no caps
+	unsigned start_len = dnbl.length();
+	::encode(dname, dnbl);
+	LeaseStat e;
+	e.mask = 0;
+	e.seq = 0;
+	e.duration_ms = 0;
+	::encode(e, dnbl);
+	ld.inode.encode_inodestat_nocaps(dnbl,
+				       mdr->session->connection->get_features(),
+				       true);
+	if ((int)dnbl.length() > bytes_left) {
+	  dout(10) << " ran out of room, stopping at " << start_len << " < " << bytes_left << dendl;
+	  bufferlist keep;
+	  keep.substr_of(dnbl, 0, start_len);
+	  dnbl.swap(keep);
+	  break;
+	}
+	dout(12) << "including listed dn " << dname << dendl;
+	numfiles++;
+	continue;
+      }
+    }
+
+    if (dn->state_test(CDentry::STATE_PURGING))
+      continue;
+
+    bool dnp = dn->use_projected(client, mdr);
+    CDentry::linkage_t *dnl = dnp ? dn->get_projected_linkage() : dn->get_linkage();
+    if (dnl->is_null())
+      continue;
+
+    CInode *in = dnl->get_inode();
+    if (in && in->ino() == CEPH_INO_CEPH)
+      continue;
+
+    if (dnl->is_remote() && !in) {
+      in = mdcache->get_inode(dnl->get_remote_ino());
+      if (in) {
+	dn->link_remote(dnl, in);
+      } else if (dn->state_test(CDentry::STATE_BADREMOTEINO)) {
+	dout(10) << "skipping bad remote ino on " << *dn << dendl;
+	continue;
+      } else {
+	if (dnbl.length() > 0) {
+	  mdcache->open_remote_dentry(dn, dnp, new C_MDSInternalNoop);
+	  dout(10) << " open remote dentry after caps were issued, stopping at "
+		   << dnbl.length() << " < " << bytes_left << dendl;
+	  break;
+	}
+	mds->locker->drop_locks(mdr.get());
+	mdr->drop_local_auth_pins();
+	mdcache->open_remote_dentry(dn, dnp, new C_MDS_RetryRequest(mdcache, mdr));
+	return;
+      }
+    }
+    assert(in);
+
+    unsigned start_len = dnbl.length();
+    dout(12) << "including    dn " << *dn << dendl;
+    ::encode(dn->name, dnbl);
+    mds->locker->issue_client_lease(dn, client, dnbl, now, mdr->session);
+
+    dout(12) << "including inode " << *in << dendl;
+    int r = in->encode_inodestat(dnbl, mdr->session, realm, CEPH_NOSNAP,
+				 bytes_left - (int)dnbl.length());
+    if (r < 0) {
+      dout(10) << " ran out of room, stopping at " << start_len << " < " << bytes_left << dendl;
+      bufferlist keep;
+      keep.substr_of(dnbl, 0, start_len);
+      dnbl.swap(keep);
+      break;
+    }
+    numfiles++;
+    mdcache->lru.lru_touch(dn);
+  }
+
+  if (numfiles == 0 && it == merged.end() && page_full) {
+    // everything on this page was skipped; move on to the next one
+    more->readdir_page_after = page.rbegin()->first;
+    dout(10) << " nothing to list in page, fetching after '"
+	     << more->readdir_page_after << "'" << dendl;
+    dir->fetch_page(more->readdir_page_after, page_max, &more->readdir_page,
+		    &more->readdir_page_r, new C_MDS_RetryRequest(mdcache, mdr));
+    return;
+  }
+
+  __u8 end = (it == merged.end() && !page_full);
+  __u8 complete = (end && offset_str.empty());
+
+  __u8 key_order = 1;
+  ::encode(numfiles, dirbl);
+  ::encode(end, dirbl);
+  ::encode(complete, dirbl);
+  dirbl.claim_append(dnbl);
+  ::encode(key_order, dirbl);
+
+  dout(10) << "reply to " << *req << " streamed readdir num=" << numfiles
+	   << " bytes=" << dirbl.length()
+	   << " end=" << (int)end
+	   << " complete=" << (int)complete
+	   << dendl;
+  mdr->reply_extra_bl = dirbl;
+
+  mds->balancer->hit_dir(ceph_clock_now(g_ceph_context), dir, META_POP_IRD, -1, numfiles);
+
+  mdr->tracei = diri;
+  respond_to_request(mdr, 0);
+}
+
 
 
 // ===============================================================================
@@ -168,6 +168,10 @@ public:
 				bool want_parent, bool want_dentry);
   void _lookup_ino_2(MDRequestRef& mdr, int r);
   void handle_client_readdir(MDRequestRef& mdr);
+  bool _readdir_should_stream(MDRequestRef& mdr, CDir *dir,
+			      const string& offset_str);
+  void _readdir_stream(MDRequestRef& mdr, CInode *diri, CDir *dir,
+		       const string& offset_str);
   void handle_client_file_setlock(MDRequestRef& mdr);
   void handle_client_file_readlock(MDRequestRef& mdr);
 
@@ -277,6 +281,8 @@ public:
 
 private:
   void reply_client_request(MDRequestRef& mdr, MClientReply *reply);
+  void charge_request_cost(MDRequestRef& mdr, CInode *tracei, CDentry *tracedn);
+  void delegate_inos(MDRequestRef& mdr, MClientReply *reply);
 };
 
 #endif
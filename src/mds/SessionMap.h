@@ -137,6 +137,7 @@ public:
   size_t get_request_count();
 
   interval_set<inodeno_t> pending_prealloc_inos; // journaling prealloc, will be added to prealloc_inos
+  interval_set<inodeno_t> delegated_inos; // subset of prealloc_inos the client may create with
 
   void notify_cap_release(size_t n_caps);
   void notify_recall_sent(int const new_limit);
@@ -146,24 +147,52 @@ public:
       return 0;
     return info.prealloc_inos.range_start();
   }
+  /// true if take_ino(ino) will succeed
+  bool can_take_ino(inodeno_t ino = 0) const {
+    if (ino && info.prealloc_inos.contains(ino))
+      return true;
+    return info.prealloc_inos.size() > delegated_inos.size();
+  }
   inodeno_t take_ino(inodeno_t ino = 0) {
-    assert(!info.prealloc_inos.empty());
+    assert(can_take_ino(ino));
 
     if (ino) {
-      if (info.prealloc_inos.contains(ino))
+      if (info.prealloc_inos.contains(ino)) {
 	info.prealloc_inos.erase(ino);
-      else
+	if (delegated_inos.contains(ino))
+	  delegated_inos.erase(ino);
+      } else
 	ino = 0;
     }
     if (!ino) {
-      ino = info.prealloc_inos.range_start();
+      // the mds may not hand out inos it has delegated to the client
+      interval_set<inodeno_t> avail;
+      avail.insert(info.prealloc_inos);
+      avail.subtract(delegated_inos);
+      ino = avail.range_start();
       info.prealloc_inos.erase(ino);
     }
     info.used_inos.insert(ino, 1);
     return ino;
   }
+  /// pick up to max prealloc inos the client may use for its own creates
+  void delegate_inos(int max, interval_set<inodeno_t>& out) {
+    interval_set<inodeno_t> avail;
+    avail.insert(info.prealloc_inos);
+    avail.subtract(delegated_inos);
+    for (interval_set<inodeno_t>::iterator p = avail.begin();
+	 p != avail.end() && max > 0;
+	 ++p) {
+      inodeno_t len = MIN(p.get_len(), (inodeno_t)max);
+      out.insert(p.get_start(), len);
+      max -= len;
+    }
+    delegated_inos.insert(out);
+  }
   int get_num_projected_prealloc_inos() {
-    return info.prealloc_inos.size() + pending_prealloc_inos.size();
+    // delegated inos belong to the client; don't count them as stock
+    return info.prealloc_inos.size() + pending_prealloc_inos.size() -
+      delegated_inos.size();
   }
 
   client_t get_client() {
@@ -296,6 +325,7 @@ public:
 
   void clear() {
     pending_prealloc_inos.clear();
+    delegated_inos.clear();
     info.clear_meta();
 
     cap_push_seq = 0;
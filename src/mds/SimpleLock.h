@@ -317,6 +317,8 @@ public:
   // state
   int get_state() const { return state; }
   int set_state(int s) { 
+    if (state == LOCK_SYNC && s != LOCK_SYNC)
+      parent->drop_cached_stat();
     state = s; 
     //assert(!is_stable() || gather_set.size() == 0);  // gather should be empty in stable states.
     return s;
@@ -474,6 +474,13 @@ void SnapRealm::split_at(SnapRealm *child)
 
 }
 
+void SnapRealm::invalidate_cached_snaps()
+{
+  cached_seq = 0;
+  // cached stats carry snap traces
+  mdcache->stat_cache.clear();
+}
+
 const bufferlist& SnapRealm::get_snap_trace()
 {
   check_cache();
@@ -98,9 +98,7 @@ struct SnapRealm {
   void check_cache();
   const set<snapid_t>& get_snaps();
   const SnapContext& get_snap_context();
-  void invalidate_cached_snaps() {
-    cached_seq = 0;
-  }
+  void invalidate_cached_snaps();
   snapid_t get_last_created() {
     check_cache();
     return cached_last_created;
@@ -0,0 +1,315 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <sstream>
+
+#include "common/config.h"
+#include "common/debug.h"
+#include "messages/MClientRequest.h"
+#include "messages/MClientReply.h"
+
+#include "CInode.h"
+#include "CDentry.h"
+#include "CDir.h"
+#include "SessionMap.h"
+#include "SnapRealm.h"
+#include "StatCache.h"
+
+
+#define dout_subsys ceph_subsys_mds
+#undef dout_prefix
+#define dout_prefix *_dout << "mds.statcache " << __func__ << " "
+
+StatCache::StatCache()
+  : active(0), epoch(0), num_inodes(0), num_dentries(0)
+{
+  for (unsigned i = 0; i < NUM_SHARDS; ++i) {
+    std::ostringstream n;
+    n << "StatCache::shard." << i;
+    shards.push_back(new Shard(n.str()));
+  }
+}
+
+StatCache::~StatCache()
+{
+  for (unsigned i = 0; i < NUM_SHARDS; ++i)
+    delete shards[i];
+}
+
+void StatCache::set_active(bool a, epoch_t e)
+{
+  epoch.set(e);
+  if (a && g_conf->mds_stat_cache_size > 0) {
+    active.set(1);
+  } else {
+    active.set(0);
+    clear();
+  }
+}
+
+bool StatCache::is_full() const
+{
+  return num_inodes.read() >= g_conf->mds_stat_cache_size ||
+    num_dentries.read() >= g_conf->mds_stat_cache_size;
+}
+
+void StatCache::add_inode(CInode *in)
+{
+  if (!is_active())
+    return;
+  if (is_full() && !in->state_test(CInode::STATE_STATCACHED))
+    return;
+
+  if (!in->is_auth() ||
+      in->last != CEPH_NOSNAP ||
+      in->is_projected() ||
+      in->is_frozen() ||
+      in->is_freezing() ||
+      in->state_test(CInode::STATE_AMBIGUOUSAUTH |
+		     CInode::STATE_EXPORTINGCAPS |
+		     CInode::STATE_PURGING))
+    return;
+  // inline data is only sent to clients that ask for it
+  if (in->inode.inline_data.version != CEPH_INLINE_NONE)
+    return;
+  if (in->authlock.get_state() != LOCK_SYNC ||
+      in->linklock.get_state() != LOCK_SYNC ||
+      in->filelock.get_state() != LOCK_SYNC ||
+      in->xattrlock.get_state() != LOCK_SYNC ||
+      in->dirfragtreelock.get_state() != LOCK_SYNC ||
+      in->policylock.get_state() != LOCK_SYNC)
+    return;
+  SnapRealm *realm = in->find_snaprealm();
+  if (!realm || !realm->is_open())
+    return;
+
+  inode_entry_t e;
+  in->encode_inodestat_nocaps(e.stat, FEATURES, true);
+  e.snapbl = realm->get_snap_trace();
+
+  Shard *s = shard_of(in->ino());
+  RWLock::WLocker l(s->lock);
+  std::pair<std::map<inodeno_t, inode_entry_t>::iterator, bool> r =
+    s->inodes.insert(std::make_pair(in->ino(), e));
+  if (r.second)
+    num_inodes.inc();
+  else
+    r.first->second = e;
+  in->state_set(CInode::STATE_STATCACHED);
+  dout(20) << *in << dendl;
+}
+
+void StatCache::add_dentry(CDentry *dn, mds_rank_t whoami)
+{
+  if (!is_active())
+    return;
+  if (is_full() && !dn->state_test(CDentry::STATE_STATCACHED))
+    return;
+
+  if (!dn->is_auth() ||
+      dn->last != CEPH_NOSNAP ||
+      dn->is_projected() ||
+      dn->lock.get_state() != LOCK_SYNC ||
+      dn->state_test(CDentry::STATE_FRAGMENTING | CDentry::STATE_PURGING))
+    return;
+  CDentry::linkage_t *dnl = dn->get_linkage();
+  if (!dnl->is_primary())
+    return;
+  CDir *dir = dn->get_dir();
+  if (dir->is_frozen() || dir->is_freezing())
+    return;
+
+  dentry_entry_t e;
+  e.ino = dnl->get_inode()->ino();
+  dir->encode_dirstat(e.dirstat, whoami);
+
+  Shard *s = shard_of(dir->ino());
+  RWLock::WLocker l(s->lock);
+  std::pair<std::map<dentry_key_t, dentry_entry_t>::iterator, bool> r =
+    s->dentries.insert(std::make_pair(dentry_key_t(dir->ino(), dn->get_name()), e));
+  if (r.second)
+    num_dentries.inc();
+  else
+    r.first->second = e;
+  dn->state_set(CDentry::STATE_STATCACHED);
+  dout(20) << *dn << dendl;
+}
+
+void StatCache::remove_inode(CInode *in)
+{
+  Shard *s = shard_of(in->ino());
+  {
+    RWLock::WLocker l(s->lock);
+    if (s->inodes.erase(in->ino()))
+      num_inodes.dec();
+  }
+  in->state_clear(CInode::STATE_STATCACHED);
+}
+
+void StatCache::remove_dentry(CDentry *dn)
+{
+  inodeno_t dirino = dn->get_dir()->ino();
+  Shard *s = shard_of(dirino);
+  {
+    RWLock::WLocker l(s->lock);
+    if (s->dentries.erase(dentry_key_t(dirino, dn->get_name())))
+      num_dentries.dec();
+  }
+  dn->state_clear(CDentry::STATE_STATCACHED);
+}
+
+/*
+ * objects keep STATE_STATCACHED after this; it only means "may have an
+ * entry", and dropping an entry that is not there is harmless.
+ */
+void StatCache::clear()
+{
+  for (unsigned i = 0; i < NUM_SHARDS; ++i) {
+    Shard *s = shards[i];
+    RWLock::WLocker l(s->lock);
+    num_inodes.sub(s->inodes.size());
+    num_dentries.sub(s->dentries.size());
+    s->inodes.clear();
+    s->dentries.clear();
+  }
+}
+
+bool StatCache::is_eligible(MClientRequest *req)
+{
+  if (!is_active())
+    return false;
+  if (!req->get_source().is_client() ||
+      req->is_replay() ||
+      req->get_retry_attempt() ||
+      !req->releases.empty())
+    return false;
+
+  const filepath &path = req->get_filepath();
+  switch (req->get_op()) {
+  case CEPH_MDS_OP_GETATTR:
+    if (path.depth() != 0)
+      return false;
+    break;
+  case CEPH_MDS_OP_LOOKUP:
+    // an empty name is the snapdir
+    if (path.depth() != 1 || path[0].empty())
+      return false;
+    break;
+  default:
+    return false;
+  }
+  if (req->head.args.getattr.mask & CEPH_CAP_XATTR_SHARED)
+    return false;
+  if (g_conf->mds_inject_traceless_reply_probability)
+    return false;
+
+  const ConnectionRef& con = req->get_connection();
+  if (!con || (con->get_features() & FEATURES) != FEATURES)
+    return false;
+  // the session state is read without mds_lock: a request racing with
+  // the close of its session is answered as if it came just before it.
+  Session *session = static_cast<Session *>(con->get_priv());
+  if (!session)
+    return false;
+  bool open = session->is_open();
+  session->put();
+  return open;
+}
+
+/*
+ * look up what req needs, and assemble the trace if asked to.  a lookup
+ * reads the dir's shard and the target's shard together, taking them in
+ * index order: writers only ever hold one shard lock, so this cannot
+ * deadlock.
+ */
+bool StatCache::find(MClientRequest *req, bufferlist *trace, bufferlist *snapbl)
+{
+  const filepath &path = req->get_filepath();
+  inodeno_t ino = path.get_ino();
+
+  if (req->get_op() == CEPH_MDS_OP_GETATTR) {
+    Shard *s = shard_of(ino);
+    RWLock::RLocker l(s->lock);
+    std::map<inodeno_t, inode_entry_t>::iterator p = s->inodes.find(ino);
+    if (p == s->inodes.end())
+      return false;
+    if (trace) {
+      trace->append(p->second.stat);
+      *snapbl = p->second.snapbl;
+    }
+    return true;
+  }
+
+  dentry_key_t key(ino, path[0]);
+  Shard *ds = shard_of(ino);
+  inodeno_t target;
+  {
+    RWLock::RLocker l(ds->lock);
+    std::map<dentry_key_t, dentry_entry_t>::iterator p = ds->dentries.find(key);
+    if (p == ds->dentries.end())
+      return false;
+    target = p->second.ino;
+  }
+
+  Shard *ts = shard_of(target);
+  Shard *first = ds, *second = ts;
+  if (shard_index(target) < shard_index(ino))
+    std::swap(first, second);
+  first->lock.get_read();
+  if (second != first)
+    second->lock.get_read();
+
+  bool found = false;
+  std::map<dentry_key_t, dentry_entry_t>::iterator d = ds->dentries.find(key);
+  if (d != ds->dentries.end() && d->second.ino == target) {
+    std::map<inodeno_t, inode_entry_t>::iterator di = ds->inodes.find(ino);
+    std::map<inodeno_t, inode_entry_t>::iterator ti = ts->inodes.find(target);
+    if (di != ds->inodes.end() && ti != ts->inodes.end()) {
+      found = true;
+      if (trace) {
+	trace->append(di->second.stat);
+	trace->append(d->second.dirstat);
+	::encode(key.second, *trace);
+	LeaseStat lease;  // null lease
+	::encode(lease, *trace);
+	trace->append(ti->second.stat);
+	*snapbl = ti->second.snapbl;
+      }
+    }
+  }
+
+  if (second != first)
+    second->lock.put_read();
+  first->lock.put_read();
+  return found;
+}
+
+bool StatCache::can_reply(MClientRequest *req)
+{
+  return is_eligible(req) && find(req, NULL, NULL);
+}
+
+MClientReply *StatCache::build_reply(MClientRequest *req)
+{
+  bufferlist trace, snapbl;
+  if (!is_eligible(req) || !find(req, &trace, &snapbl))
+    return NULL;
+
+  MClientReply *reply = new MClientReply(req, 0);
+  reply->head.is_dentry = req->get_op() == CEPH_MDS_OP_LOOKUP;
+  reply->head.is_target = 1;
+  reply->snapbl.claim(snapbl);
+  reply->set_trace(trace);
+  reply->set_mdsmap_epoch(epoch.read());
+  dout(20) << *req << dendl;
+  return reply;
+}
@@ -0,0 +1,118 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_MDS_STATCACHE_H
+#define CEPH_MDS_STATCACHE_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "include/atomic.h"
+#include "include/buffer.h"
+#include "include/ceph_features.h"
+#include "common/RWLock.h"
+#include "mdstypes.h"
+
+class CInode;
+class CDentry;
+class MClientRequest;
+class MClientReply;
+
+/**
+ * StatCache - getattr and lookup replies served without mds_lock
+ *
+ * Keeps encoded copies of what a getattr or lookup reply carries: the
+ * InodeStat (without caps) and snap trace of an inode, and the dirstat
+ * and target of a primary dentry.  An inode is only cached while it is
+ * auth, unprojected and unfrozen, with all of its attribute locks in
+ * LOCK_SYNC, so no client holds caps that let it change what we copied.
+ *
+ * The messenger's fast dispatch threads read entries under a per-shard
+ * read lock and answer the request straight away; everything else still
+ * goes through mds_lock.  Whatever could change a cached copy happens
+ * under mds_lock and drops the entry first: a lock leaving LOCK_SYNC, a
+ * projected inode, a dentry's linkage or dirfrag changing, removal from
+ * the cache, export, or a snaprealm change.  Entries pin nothing, so
+ * trimming the cache drops them too.
+ *
+ * Replies from here issue no caps or leases, which keeps clients coming
+ * back for the same inodes; mds_stat_cache_size is 0 (off) by default.
+ */
+class StatCache {
+public:
+  /// reply features every cached InodeStat is encoded for
+  static const uint64_t FEATURES =
+    CEPH_FEATURE_DIRLAYOUTHASH |
+    CEPH_FEATURE_MDS_INLINE_DATA |
+    CEPH_FEATURE_MDS_QUOTA;
+
+  StatCache();
+  ~StatCache();
+
+  /// allow or stop fast replies; the mdsmap epoch goes into each reply
+  void set_active(bool a, epoch_t e);
+  bool is_active() const { return active.read(); }
+
+  /// cache the stat of in, if it is stable enough; with mds_lock held
+  void add_inode(CInode *in);
+  /// cache the binding of a primary dentry; with mds_lock held
+  void add_dentry(CDentry *dn, mds_rank_t whoami);
+  void remove_inode(CInode *in);
+  void remove_dentry(CDentry *dn);
+  void clear();
+
+  /// whether req is one we answer here, and we have what it needs
+  bool can_reply(MClientRequest *req);
+  /// build the reply to req, or NULL if we can't (any more)
+  MClientReply *build_reply(MClientRequest *req);
+
+  uint64_t get_num_inodes() const { return num_inodes.read(); }
+  uint64_t get_num_dentries() const { return num_dentries.read(); }
+
+private:
+  static const unsigned NUM_SHARDS = 16;
+
+  struct inode_entry_t {
+    bufferlist stat;    ///< InodeStat, no caps, for FEATURES
+    bufferlist snapbl;  ///< snap trace of its realm
+  };
+  struct dentry_entry_t {
+    inodeno_t ino;
+    bufferlist dirstat;
+  };
+  typedef std::pair<inodeno_t, std::string> dentry_key_t;
+
+  struct Shard {
+    RWLock lock;
+    std::map<inodeno_t, inode_entry_t> inodes;
+    std::map<dentry_key_t, dentry_entry_t> dentries;  ///< in the dir's shard
+    Shard(const std::string &n) : lock(n) {}
+  };
+
+  static unsigned shard_index(inodeno_t ino) {
+    return ino.val % NUM_SHARDS;
+  }
+  Shard *shard_of(inodeno_t ino) {
+    return shards[shard_index(ino)];
+  }
+  bool is_eligible(MClientRequest *req);
+  bool find(MClientRequest *req, bufferlist *trace, bufferlist *snapbl);
+  bool is_full() const;
+
+  std::vector<Shard*> shards;
+  ceph::atomic_t active;
+  ceph::atomic_t epoch;
+  ceph::atomic_t num_inodes, num_dentries;
+};
+
+#endif
@@ -104,7 +104,7 @@ void LogSegment::try_to_expire(MDS *mds, MDSGatherBuilder &gather_bld, int op_pr
       assert(dir->is_auth());
       if (dir->can_auth_pin()) {
 	dout(15) << "try_to_expire committing " << *dir << dendl;
-	dir->commit(0, gather_bld.new_sub(), false, op_prio);
+	dir->commit(0, gather_bld.new_sub(), false, op_prio, this);
       } else {
 	dout(15) << "try_to_expire waiting for unfreeze on " << *dir << dendl;
 	dir->add_waiter(CDir::WAIT_UNFREEZE, gather_bld.new_sub());
@@ -535,6 +535,7 @@ void EMetaBlob::fullbit::generate_test_instances(list<EMetaBlob::fullbit*>& ls)
 void EMetaBlob::fullbit::update_inode(MDS *mds, CInode *in)
 {
   in->inode = inode;
+  in->clear_packed_xattrs();
   in->xattrs = xattrs;
   if (in->inode.is_dir()) {
     if (!(in->dirfragtree == dirfragtree)) {
@@ -566,6 +567,7 @@ void EMetaBlob::fullbit::update_inode(MDS *mds, CInode *in)
    */
   in->oldest_snap = oldest_snap;
   in->decode_snap_blob(snapbl);
+  in->update_mem_charge();
 }
 
 // EMetaBlob::remotebit
@@ -947,7 +947,9 @@ CEPH_HASH_NAMESPACE_END
 #define META_POP_READDIR 2
 #define META_POP_FETCH   3
 #define META_POP_STORE   4
-#define META_NPOP        5
+#define META_POP_COST    5  // ms spent handling requests (balancer mode 3)
+#define META_POP_REVOKE  6  // client cap revocations (balancer mode 3)
+#define META_NPOP        7
 
 class inode_load_vec_t {
   static const int NUM = 2;
@@ -982,7 +984,7 @@ inline void decode(inode_load_vec_t & c, const utime_t &t, bufferlist::iterator
 
 class dirfrag_load_vec_t {
 public:
-  static const int NUM = 5;
+  static const int NUM = 7;
   std::vector < DecayCounter > vec;
   dirfrag_load_vec_t(const utime_t &now)
      : vec(NUM, DecayCounter(now))
@@ -992,15 +994,19 @@ public:
     : vec(NUM, DecayCounter())
   {}
   void encode(bufferlist &bl) const {
-    ENCODE_START(2, 2, bl);
+    ENCODE_START(3, 2, bl);
     for (int i=0; i<NUM; i++)
       ::encode(vec[i], bl);
     ENCODE_FINISH(bl);
   }
   void decode(const utime_t &t, bufferlist::iterator &p) {
-    DECODE_START_LEGACY_COMPAT_LEN(2, 2, 2, p);
-    for (int i=0; i<NUM; i++)
+    DECODE_START_LEGACY_COMPAT_LEN(3, 2, 2, p);
+    for (int i=0; i<=META_POP_STORE; i++)
       ::decode(vec[i], t, p);
+    if (struct_v >= 3) {
+      ::decode(vec[META_POP_COST], t, p);
+      ::decode(vec[META_POP_REVOKE], t, p);
+    }
     DECODE_FINISH(p);
   }
   // for dencoder infrastructure
@@ -1321,7 +1327,7 @@ class MDSCacheObject {
 protected:
   __s32      ref;       // reference count
 #ifdef MDS_REF_SET
-  std::map<int,int> ref_map;
+  compact_map<int,int> ref_map;  // pins held, by type; zero counts are dropped
 #endif
 
  public:
@@ -1359,7 +1365,8 @@ protected:
     } else {
       ref--;
 #ifdef MDS_REF_SET
-      ref_map[by]--;
+      if (--ref_map[by] == 0)
+	ref_map.erase(by);
 #endif
       if (ref == 0)
 	last_put();
@@ -1380,15 +1387,13 @@ protected:
       first_get();
     ref++;
 #ifdef MDS_REF_SET
-    if (ref_map.find(by) == ref_map.end())
-      ref_map[by] = 0;
     ref_map[by]++;
 #endif
   }
 
   void print_pin_set(std::ostream& out) const {
 #ifdef MDS_REF_SET
-    std::map<int, int>::const_iterator it = ref_map.begin();
+    compact_map<int, int>::const_iterator it = ref_map.begin();
     while (it != ref_map.end()) {
       out << " " << pin_name(it->first) << "=" << it->second;
       ++it;
@@ -1548,6 +1553,8 @@ protected:
   virtual bool is_lock_waiting(int type, uint64_t mask) { assert(0); return false; }
 
   virtual void clear_dirty_scattered(int type) { assert(0); }
+  /// drop whatever copy of our state the StatCache holds
+  virtual void drop_cached_stat() {}
 
   // ---------------------------------------------
   // ordering
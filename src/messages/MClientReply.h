@@ -17,6 +17,7 @@
 #define CEPH_MCLIENTREPLY_H
 
 #include "include/types.h"
+#include "include/interval_set.h"
 #include "MClientRequest.h"
 
 #include "msg/Message.h"
@@ -189,12 +190,17 @@ struct InodeStat {
 
 
 class MClientReply : public Message {
+  // v2 carries deleg_inos.  it is only sent to clients that asked for
+  // delegation, so older clients never see the extra field.
+  static const int DELEG_VERSION = 2;
+
   // reply data
 public:
   struct ceph_mds_reply_head head;
   bufferlist trace_bl;
   bufferlist extra_bl;
   bufferlist snapbl;
+  interval_set<inodeno_t> deleg_inos;  ///< prealloc inos the client may create with
 
  public:
   int get_op() const { return head.op; }
@@ -246,6 +252,8 @@ public:
     ::decode(trace_bl, p);
     ::decode(extra_bl, p);
     ::decode(snapbl, p);
+    if (header.version >= DELEG_VERSION)
+      ::decode(deleg_inos, p);
     assert(p.end());
   }
   virtual void encode_payload(uint64_t features) {
@@ -253,6 +261,13 @@ public:
     ::encode(trace_bl, payload);
     ::encode(extra_bl, payload);
     ::encode(snapbl, payload);
+    if (header.version >= DELEG_VERSION)
+      ::encode(deleg_inos, payload);
+  }
+
+  void set_deleg_inos(const interval_set<inodeno_t>& inos) {
+    deleg_inos = inos;
+    header.version = DELEG_VERSION;
   }
 
 
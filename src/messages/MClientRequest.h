@@ -76,14 +76,17 @@ public:
   // path arguments
   filepath path, path2;
 
-
+  // taken by the mds' fast dispatch (see MDS::ms_can_fast_dispatch); not encoded
+  bool fast_dispatch;
 
  public:
   // cons
   MClientRequest()
-    : Message(CEPH_MSG_CLIENT_REQUEST, HEAD_VERSION, COMPAT_VERSION) {}
+    : Message(CEPH_MSG_CLIENT_REQUEST, HEAD_VERSION, COMPAT_VERSION),
+      fast_dispatch(false) {}
   MClientRequest(int op)
-    : Message(CEPH_MSG_CLIENT_REQUEST, HEAD_VERSION, COMPAT_VERSION) {
+    : Message(CEPH_MSG_CLIENT_REQUEST, HEAD_VERSION, COMPAT_VERSION),
+      fast_dispatch(false) {
     memset(&head, 0, sizeof(head));
     head.op = op;
   }
@@ -266,7 +266,60 @@ struct ceph_osd_request_head {
     }
   }
 
+  /*
+   * The current encoding, straight from a contiguous payload, with the
+   * ops as they are laid out; false to go the checked way instead.
+   */
+  bool decode_payload_unchecked() {
+    if (header.version != HEAD_VERSION || !payload.is_contiguous() ||
+	payload.length() == 0)
+      return false;
+    unchecked_decoder d(payload.buffers().front());
+    d.need(sizeof(client_inc) + sizeof(osdmap_epoch) + sizeof(flags) +
+	   2 * sizeof(__u32) + sizeof(version_t) + sizeof(epoch_t));
+    client_inc = d.get_le32();
+    osdmap_epoch = d.get_le32();
+    flags = d.get_le32();
+    mtime.sec_ref() = d.get_le32();
+    mtime.nsec_ref() = d.get_le32();
+    reassert_version.version = d.get_le64();
+    reassert_version.epoch = d.get_le32();
+    if (!oloc.decode_unchecked(d))
+      return false;
+    d.need(pgid.encoded_size());
+    pgid.decode_unchecked(d);
+    d.get_string(oid.name);
+
+    d.need(sizeof(__u16));
+    __u16 num_ops = d.get_le16();
+    d.need((size_t)num_ops * sizeof(ceph_osd_op));
+    ops.resize(num_ops);
+    for (unsigned i = 0; i < num_ops; i++) {
+      memcpy(&ops[i].op, d.p, sizeof(ceph_osd_op));
+      d.p += sizeof(ceph_osd_op);
+    }
+
+    d.need(2 * sizeof(snapid_t) + sizeof(__u32));
+    snapid = d.get_le64();
+    snap_seq = d.get_le64();
+    __u32 num_snaps = d.get_le32();
+    d.need((size_t)num_snaps * sizeof(snapid_t));
+    snaps.resize(num_snaps);
+    for (unsigned i = 0; i < num_snaps; i++)
+      snaps[i] = d.get_le64();
+
+    d.need(sizeof(retry_attempt) + sizeof(features));
+    retry_attempt = d.get_le32();
+    features = d.get_le64();
+    return true;
+  }
+
   virtual void decode_payload() {
+    if (decode_payload_unchecked()) {
+      OSDOp::split_osd_op_vector_in_data(ops, data);
+      return;
+    }
+
     bufferlist::iterator p = payload.begin();
 
     if (header.version < 2) {
@@ -47,6 +47,11 @@ public:
     paxos_encode();
     ::encode(fsid, payload);
     ::encode(osd_stat, payload);
+    // the rest, exactly, in one contiguous buffer
+    size_t len = sizeof(__u32) + sizeof(epoch) + sizeof(had_map_for);
+    for (map<pg_t,pg_stat_t>::iterator p = pg_stat.begin(); p != pg_stat.end(); ++p)
+      len += p->first.encoded_size() + p->second.encoded_size();
+    payload.reserve(len);
     ::encode(pg_stat, payload);
     ::encode(epoch, payload);
     ::encode(had_map_for, payload);
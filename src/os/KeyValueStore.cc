@@ -48,6 +48,10 @@
 #include "common/safe_io.h"
 #include "common/perf_counters.h"
 #include "common/sync_filesystem.h"
+#include "common/strtol.h"
+#include "include/str_list.h"
+
+#include <snappy.h>
 
 #ifdef HAVE_KINETIC
 #include "KineticStore.h"
@@ -84,6 +88,7 @@ static CompatSet get_kv_initial_compat_set() {
 static CompatSet get_kv_supported_compat_set() {
   CompatSet compat =  get_kv_initial_compat_set();
   //Any features here can be set in code, but not in initial superblock
+  compat.incompat.insert(CEPH_KV_FEATURE_INCOMPAT_COMPRESSED_STRIP);
   return compat;
 }
 
@@ -359,6 +364,8 @@ int KeyValueStore::BufferTransaction::get_buffer_keys(
   if (!need_lookup.empty()) {
     int r = store->backend->get_values_with_header(strip_header, prefix,
                                                    need_lookup, out);
+    if (r >= 0 && prefix == OBJECT_STRIP_PREFIX)
+      r = store->_decompress_strips(strip_header, need_lookup, out);
     if (r < 0) {
       dout(10) << __func__  << " " << strip_header->cid << "/"
                << strip_header->oid << " " << " r = " << r << dendl;
@@ -373,7 +380,13 @@ void KeyValueStore::BufferTransaction::set_buffer_keys(
      StripObjectMap::StripObjectHeaderRef strip_header,
      const string &prefix, map<string, bufferlist> &values)
 {
-  store->backend->set_keys(strip_header->header, prefix, values, t);
+  if (prefix == OBJECT_STRIP_PREFIX) {
+    map<string, bufferlist> encoded;
+    store->_compress_strips(strip_header, values, &encoded);
+    store->backend->set_keys(strip_header->header, prefix, encoded, t);
+  } else {
+    store->backend->set_keys(strip_header->header, prefix, values, t);
+  }
 
   uniq_id uid = make_pair(strip_header->cid, strip_header->oid);
   map<pair<string, string>, bufferlist> &uid_buffers = buffers[uid];
@@ -542,14 +555,17 @@ KeyValueStore::KeyValueStore(const std::string &base,
   m_keyvaluestore_max_expected_write_size(g_conf->keyvaluestore_max_expected_write_size),
   do_update(do_update),
   m_keyvaluestore_do_dump(false),
-  m_keyvaluestore_dump_fmt(true)
+  m_keyvaluestore_dump_fmt(true),
+  compression_lock("KeyValueStore::compression_lock"),
+  m_keyvaluestore_compression(false),
+  m_keyvaluestore_compression_max_ratio(1.0)
 {
   ostringstream oss;
   oss << basedir << "/current";
   current_fn = oss.str();
 
   // initialize perf_logger
-  PerfCountersBuilder plb(g_ceph_context, internal_name, l_os_commit_len, l_os_last);
+  PerfCountersBuilder plb(g_ceph_context, internal_name, l_os_commit_len, l_kvs_last);
 
   plb.add_u64(l_os_oq_max_ops, "op_queue_max_ops", "Max operations count in queue");
   plb.add_u64(l_os_oq_ops, "op_queue_ops", "Operations count in queue");
@@ -560,6 +576,10 @@ KeyValueStore::KeyValueStore(const std::string &base,
   plb.add_time_avg(l_os_commit_lat, "commit_latency", "Commit latency");
   plb.add_time_avg(l_os_apply_lat, "apply_latency", "Apply latency");
   plb.add_time_avg(l_os_queue_lat, "queue_transaction_latency_avg", "Store operation queue latency");
+  plb.add_u64_counter(l_kvs_compress_in_bytes, "compress_in_bytes", "Strip data passed to the compressor");
+  plb.add_u64_counter(l_kvs_compress_out_bytes, "compress_out_bytes", "Strip data stored after compression");
+  plb.add_time_avg(l_kvs_compress_lat, "compress_latency", "Strip compression latency");
+  plb.add_time_avg(l_kvs_decompress_lat, "decompress_latency", "Strip decompression latency");
 
   perf_logger = plb.create_perf_counters();
 
@@ -987,6 +1007,8 @@ int KeyValueStore::mount()
     backend.reset(dbomap);
   }
 
+  _update_compression_conf(g_conf);
+
   op_tp.start();
   op_finisher.start();
   ondisk_finisher.start();
@@ -1697,6 +1719,9 @@ int KeyValueStore::_generic_read(StripObjectMap::StripObjectHeaderRef header,
 
   int r = backend->get_values_with_header(header, OBJECT_STRIP_PREFIX, keys, &out);
   r = check_get_rc(header->cid, header->oid, r, out.size() == keys.size());
+  if (r < 0)
+    return r;
+  r = _decompress_strips(header, keys, &out);
   if (r < 0)
     return r;
 
@@ -2935,6 +2960,9 @@ const char** KeyValueStore::get_tracked_conf_keys() const
     "keyvaluestore_queue_max_bytes",
     "keyvaluestore_strip_size",
     "keyvaluestore_dump_file",
+    "keyvaluestore_compression",
+    "keyvaluestore_compression_pools",
+    "keyvaluestore_compression_max_ratio",
     NULL
   };
   return KEYS;
@@ -2962,6 +2990,160 @@ void KeyValueStore::handle_conf_change(const struct md_config_t *conf,
       dump_stop();
     }
   }
+  if (changed.count("keyvaluestore_compression") ||
+      changed.count("keyvaluestore_compression_pools") ||
+      changed.count("keyvaluestore_compression_max_ratio")) {
+    _update_compression_conf(conf);
+  }
+}
+
+void KeyValueStore::_update_compression_conf(const struct md_config_t *conf)
+{
+  set<int64_t> pools;
+  list<string> ls;
+  get_str_list(conf->keyvaluestore_compression_pools, ls);
+  for (list<string>::iterator i = ls.begin(); i != ls.end(); ++i) {
+    string err;
+    int64_t pool = strict_strtoll(i->c_str(), 10, &err);
+    if (!err.empty()) {
+      derr << __func__ << " ignoring bad pool id '" << *i << "' in "
+           << "keyvaluestore_compression_pools: " << err << dendl;
+      continue;
+    }
+    pools.insert(pool);
+  }
+
+  if (conf->keyvaluestore_compression)
+    _set_compression_feature();
+
+  RWLock::WLocker l(compression_lock);
+  m_keyvaluestore_compression = conf->keyvaluestore_compression;
+  m_keyvaluestore_compression_pools.swap(pools);
+  m_keyvaluestore_compression_max_ratio = conf->keyvaluestore_compression_max_ratio;
+}
+
+void KeyValueStore::_set_compression_feature()
+{
+  Mutex::Locker l(lock);
+  if (superblock.compat_features.incompat.contains(
+        CEPH_KV_FEATURE_INCOMPAT_COMPRESSED_STRIP))
+    return;
+
+  // once a compressed strip may hit the disk older code must not mount us
+  superblock.compat_features.incompat.insert(
+    CEPH_KV_FEATURE_INCOMPAT_COMPRESSED_STRIP);
+  int r = write_superblock();
+  assert(r == 0);
+}
+
+bool KeyValueStore::_compression_enabled(const coll_t &cid)
+{
+  RWLock::RLocker l(compression_lock);
+  if (!m_keyvaluestore_compression)
+    return false;
+  if (m_keyvaluestore_compression_pools.empty())
+    return true;
+
+  spg_t pgid;
+  if (!cid.is_pg_prefix(&pgid))
+    return false;
+  return m_keyvaluestore_compression_pools.count(pgid.pool());
+}
+
+void KeyValueStore::_compress_strips(StripObjectMap::StripObjectHeaderRef header,
+                                     const map<string, bufferlist> &values,
+                                     map<string, bufferlist> *out)
+{
+  bool enabled = _compression_enabled(header->cid);
+  double max_ratio;
+  {
+    RWLock::RLocker l(compression_lock);
+    max_ratio = m_keyvaluestore_compression_max_ratio;
+  }
+
+  utime_t start = ceph_clock_now(g_ceph_context);
+  uint64_t in_bytes = 0, out_bytes = 0;
+  for (map<string, bufferlist>::const_iterator iter = values.begin();
+       iter != values.end(); ++iter) {
+    uint64_t no = strtoull(iter->first.c_str(), NULL, 10);
+    assert(no < header->bits.size());
+
+    // removed strips are written as empty values; leave them alone
+    if (!enabled || iter->second.length() == 0) {
+      if (header->bits[no] == StripObjectMap::STRIP_COMPRESSED) {
+        header->bits[no] = StripObjectMap::STRIP_RAW;
+        header->updated = true;
+      }
+      (*out)[iter->first] = iter->second;
+      continue;
+    }
+
+    bufferlist raw = iter->second;
+    string compressed;
+    snappy::Compress(raw.c_str(), raw.length(), &compressed);
+    in_bytes += raw.length();
+
+    if (compressed.length() < raw.length() * max_ratio) {
+      (*out)[iter->first].append(compressed.data(), compressed.length());
+      out_bytes += compressed.length();
+      if (header->bits[no] != StripObjectMap::STRIP_COMPRESSED) {
+        header->bits[no] = StripObjectMap::STRIP_COMPRESSED;
+        header->updated = true;
+      }
+    } else {
+      (*out)[iter->first] = iter->second;
+      out_bytes += raw.length();
+      if (header->bits[no] == StripObjectMap::STRIP_COMPRESSED) {
+        header->bits[no] = StripObjectMap::STRIP_RAW;
+        header->updated = true;
+      }
+    }
+  }
+
+  if (in_bytes) {
+    perf_logger->inc(l_kvs_compress_in_bytes, in_bytes);
+    perf_logger->inc(l_kvs_compress_out_bytes, out_bytes);
+    perf_logger->tinc(l_kvs_compress_lat,
+                      ceph_clock_now(g_ceph_context) - start);
+    dout(20) << __func__ << " " << header->cid << "/" << header->oid << " "
+             << in_bytes << " -> " << out_bytes << " bytes" << dendl;
+  }
+}
+
+int KeyValueStore::_decompress_strips(StripObjectMap::StripObjectHeaderRef header,
+                                      const set<string> &keys,
+                                      map<string, bufferlist> *out)
+{
+  utime_t start = ceph_clock_now(g_ceph_context);
+  bool decompressed = false;
+  for (set<string>::const_iterator iter = keys.begin();
+       iter != keys.end(); ++iter) {
+    uint64_t no = strtoull(iter->c_str(), NULL, 10);
+    if (no >= header->bits.size() ||
+        header->bits[no] != StripObjectMap::STRIP_COMPRESSED)
+      continue;
+
+    map<string, bufferlist>::iterator p = out->find(*iter);
+    if (p == out->end())
+      continue;
+
+    bufferlist &compressed = p->second;
+    string raw;
+    if (!snappy::Uncompress(compressed.c_str(), compressed.length(), &raw)) {
+      derr << __func__ << " " << header->cid << "/" << header->oid
+           << " strip " << no << " is corrupt" << dendl;
+      return -EIO;
+    }
+    bufferlist bl;
+    bl.append(raw.data(), raw.length());
+    compressed.swap(bl);
+    decompressed = true;
+  }
+
+  if (decompressed)
+    perf_logger->tinc(l_kvs_decompress_lat,
+                      ceph_clock_now(g_ceph_context) - start);
+  return 0;
 }
 
 int KeyValueStore::check_get_rc(const coll_t cid, const ghobject_t& oid, int r, bool is_equal_size)
@@ -43,9 +43,26 @@ using namespace std;
 
 static uint64_t default_strip_size = 1024;
 
+#define CEPH_KV_FEATURE_INCOMPAT_COMPRESSED_STRIP CompatSet::Feature(1, "compressed strips")
+
+enum {
+  l_kvs_compress_in_bytes = l_os_last,
+  l_kvs_compress_out_bytes,
+  l_kvs_compress_lat,
+  l_kvs_decompress_lat,
+  l_kvs_last,
+};
+
 class StripObjectMap: public GenericObjectMap {
  public:
 
+  // values of StripObjectHeader::bits
+  enum {
+    STRIP_NONE = 0,
+    STRIP_RAW = 1,
+    STRIP_COMPRESSED = 2, // strip value is snappy compressed
+  };
+
   struct StripExtent {
     uint64_t no;
     uint64_t offset;    // in key
@@ -641,6 +658,16 @@ class KeyValueStore : public ObjectStore,
                                                  const ghobject_t &oid);
 
   int check_get_rc(const coll_t cid, const ghobject_t& oid, int r, bool is_equal_size);
+
+  // -- strip compression --
+  bool _compression_enabled(const coll_t &cid);
+  void _set_compression_feature();
+  void _compress_strips(StripObjectMap::StripObjectHeaderRef header,
+                        const map<string, bufferlist> &values,
+                        map<string, bufferlist> *out);
+  int _decompress_strips(StripObjectMap::StripObjectHeaderRef header,
+                         const set<string> &keys,
+                         map<string, bufferlist> *out);
   void dump_start(const std::string file);
   void dump_stop();
   void dump_transactions(list<ObjectStore::Transaction*>& ls, uint64_t seq,
@@ -683,6 +710,12 @@ class KeyValueStore : public ObjectStore,
   std::ofstream m_keyvaluestore_dump;
   JSONFormatter m_keyvaluestore_dump_fmt;
 
+  RWLock compression_lock; // protects the compression settings below
+  bool m_keyvaluestore_compression;
+  set<int64_t> m_keyvaluestore_compression_pools;
+  double m_keyvaluestore_compression_max_ratio;
+  void _update_compression_conf(const struct md_config_t *conf);
+
   static const string OBJECT_STRIP_PREFIX;
   static const string OBJECT_XATTR;
   static const string OBJECT_OMAP;
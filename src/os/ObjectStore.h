@@ -777,8 +777,10 @@ public:
 
       bufferlist::iterator data_bl_p;
 
-      vector<coll_t> colls;
-      vector<ghobject_t> objects;
+      // point into t->coll_index and t->object_index, which must not
+      // change while we are iterating
+      vector<const coll_t*> colls;
+      vector<const ghobject_t*> objects;
 
       iterator(Transaction *t)
         : t(t),
@@ -793,14 +795,14 @@ public:
         for (coll_index_p = t->coll_index.begin();
              coll_index_p != t->coll_index.end();
              ++coll_index_p) {
-          colls[coll_index_p->second] = coll_index_p->first;
+          colls[coll_index_p->second] = &coll_index_p->first;
         }
 
         map<ghobject_t, __le32>::iterator object_index_p;
         for (object_index_p = t->object_index.begin();
              object_index_p != t->object_index.end();
              ++object_index_p) {
-          objects[object_index_p->second] = object_index_p->first;
+          objects[object_index_p->second] = &object_index_p->first;
         }
       }
 
@@ -840,11 +842,11 @@ public:
 
       ghobject_t get_oid(__le32 oid_id) {
         assert(oid_id < objects.size());
-        return objects[oid_id];
+        return *objects[oid_id];
       }
       coll_t get_cid(__le32 cid_id) {
         assert(cid_id < colls.size());
-        return colls[cid_id];
+        return *colls[cid_id];
       }
       uint32_t get_fadvise_flags() const {
 	return t->get_fadvise_flags();
@@ -874,12 +876,14 @@ private:
         op_ptr = bufferptr(sizeof(Op) * OPS_PER_PTR);
 	op_ptr.zero();
       }
-      bufferptr ptr(op_ptr, 0, sizeof(Op));
-      op_bl.append(ptr);
+      char* p = op_ptr.c_str();
+
+      // ops are carved sequentially out of op_ptr, so this extends the
+      // tail segment of op_bl instead of adding a new bufferptr per op
+      op_bl.append(op_ptr, 0, sizeof(Op));
 
       op_ptr.set_offset(op_ptr.offset() + sizeof(Op));
 
-      char* p = ptr.c_str();
       return reinterpret_cast<Op*>(p);
     }
     __le32 _get_coll_id(const coll_t& coll) {
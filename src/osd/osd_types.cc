@@ -17,6 +17,7 @@
 
 #include "osd_types.h"
 #include "include/ceph_features.h"
+#include "include/crc32c.h"
 extern "C" {
 #include "crush/hash.h"
 }
@@ -173,6 +174,92 @@ void osd_reqid_t::generate_test_instances(list<osd_reqid_t*>& o)
   o.push_back(new osd_reqid_t(entity_name_t::CLIENT(123), 1, 45678));
 }
 
+// -- unchecked encoding of the small types pg_log_entry_t and pg_stat_t
+//    are made of; these must follow their ::encode()/::decode() above
+
+static const size_t EVERSION_ENCODED_SIZE = sizeof(version_t) + sizeof(epoch_t);
+static const size_t UTIME_ENCODED_SIZE = 2 * sizeof(__u32);
+static const size_t REQID_ENCODED_SIZE = UNCHECKED_STRUCT_HEADER_SIZE +
+  sizeof(__u8) + sizeof(int64_t) + sizeof(ceph_tid_t) + sizeof(int32_t);
+
+static inline void encode_unchecked(const eversion_t& v, unchecked_encoder& e)
+{
+  e.put_le64(v.version);
+  e.put_le32(v.epoch);
+}
+
+static inline void decode_unchecked(eversion_t& v, unchecked_decoder& d)
+{
+  v.version = d.get_le64();
+  v.epoch = d.get_le32();
+}
+
+static inline void encode_unchecked(const utime_t& t, unchecked_encoder& e)
+{
+  e.put_le32(t.sec());
+  e.put_le32(t.nsec());
+}
+
+static inline void decode_unchecked(utime_t& t, unchecked_decoder& d)
+{
+  t.sec_ref() = d.get_le32();
+  t.nsec_ref() = d.get_le32();
+}
+
+static void encode_unchecked(const osd_reqid_t& r, unchecked_encoder& e)
+{
+  char *len = e.start_struct(2, 2);
+  e.put_u8(r.name.type());
+  e.put_le64(r.name.num());
+  e.put_le64(r.tid);
+  e.put_le32(r.inc);
+  e.finish_struct(len);
+}
+
+static bool decode_unchecked(osd_reqid_t& r, unchecked_decoder& d)
+{
+  const char *end;
+  if (!d.start_struct(2, &end))
+    return false;
+  d.need(REQID_ENCODED_SIZE - UNCHECKED_STRUCT_HEADER_SIZE);
+  int type = d.get_u8();
+  int64_t num = d.get_le64();
+  r.name = entity_name_t(type, num);
+  r.tid = d.get_le64();
+  r.inc = d.get_le32();
+  return d.finish_struct(end);
+}
+
+static void encode_unchecked(const pg_t& pgid, unchecked_encoder& e)
+{
+  e.put_u8(1);
+  e.put_le64(pgid.m_pool);
+  e.put_le32(pgid.m_seed);
+  e.put_le32(pgid.m_preferred);
+}
+
+static inline size_t vector_encoded_size(const vector<int32_t>& v)
+{
+  return sizeof(__u32) + v.size() * sizeof(int32_t);
+}
+
+static void encode_unchecked(const vector<int32_t>& v, unchecked_encoder& e)
+{
+  e.put_le32(v.size());
+  for (vector<int32_t>::const_iterator p = v.begin(); p != v.end(); ++p)
+    e.put_le32(*p);
+}
+
+static void decode_unchecked(vector<int32_t>& v, unchecked_decoder& d)
+{
+  d.need(sizeof(__u32));
+  __u32 n = d.get_le32();
+  d.need((size_t)n * sizeof(int32_t));
+  v.resize(n);
+  for (__u32 i = 0; i < n; ++i)
+    v[i] = d.get_le32();
+}
+
 // -- object_locator_t --
 
 void object_locator_t::encode(bufferlist& bl) const
@@ -218,6 +305,22 @@ void object_locator_t::decode(bufferlist::iterator& p)
   assert(hash == -1 || key.empty());
 }
 
+bool object_locator_t::decode_unchecked(unchecked_decoder& d)
+{
+  const char *end;
+  if (!d.start_struct(6, &end))
+    return false;
+  d.need(sizeof(pool) + sizeof(int32_t));
+  pool = d.get_le64();
+  d.get_le32();  // preferred
+  d.get_string(key);
+  d.get_string(nspace);
+  d.need(sizeof(hash));
+  hash = d.get_le64();
+  // a corrupt locator is for the checked decode to assert on
+  return d.finish_struct(end) && (hash == -1 || key.empty());
+}
+
 void object_locator_t::dump(Formatter *f) const
 {
   f->dump_int("pool", pool);
@@ -1876,53 +1979,239 @@ void pg_stat_t::dump_brief(Formatter *f) const
   f->dump_int("acting_primary", acting_primary);
 }
 
+// object_stat_sum_t v11, in object_stat_collection_t v2 with an empty
+// cat_sum, as object_stat_collection_t::encode() does
+static const int OBJECT_STAT_SUM_FIELDS = 23;
+static const size_t OBJECT_STAT_COLLECTION_ENCODED_SIZE =
+  UNCHECKED_STRUCT_HEADER_SIZE +
+  UNCHECKED_STRUCT_HEADER_SIZE + OBJECT_STAT_SUM_FIELDS * sizeof(int64_t) +
+  sizeof(__u32);
+
+static void encode_unchecked(const object_stat_collection_t& c, unchecked_encoder& e)
+{
+  const object_stat_sum_t& s = c.sum;
+  char *clen = e.start_struct(2, 2);
+  char *len = e.start_struct(11, 3);
+  e.put_le64(s.num_bytes);
+  e.put_le64(s.num_objects);
+  e.put_le64(s.num_object_clones);
+  e.put_le64(s.num_object_copies);
+  e.put_le64(s.num_objects_missing_on_primary);
+  e.put_le64(s.num_objects_degraded);
+  e.put_le64(s.num_objects_unfound);
+  e.put_le64(s.num_rd);
+  e.put_le64(s.num_rd_kb);
+  e.put_le64(s.num_wr);
+  e.put_le64(s.num_wr_kb);
+  e.put_le64(s.num_scrub_errors);
+  e.put_le64(s.num_objects_recovered);
+  e.put_le64(s.num_bytes_recovered);
+  e.put_le64(s.num_keys_recovered);
+  e.put_le64(s.num_shallow_scrub_errors);
+  e.put_le64(s.num_deep_scrub_errors);
+  e.put_le64(s.num_objects_dirty);
+  e.put_le64(s.num_whiteouts);
+  e.put_le64(s.num_objects_omap);
+  e.put_le64(s.num_objects_hit_set_archive);
+  e.put_le64(s.num_objects_misplaced);
+  e.put_le64(s.num_bytes_hit_set_archive);
+  e.finish_struct(len);
+  e.put_le32(0);
+  e.finish_struct(clen);
+}
+
+static bool decode_unchecked(object_stat_collection_t& c, unchecked_decoder& d)
+{
+  object_stat_sum_t& s = c.sum;
+  const char *cend, *end;
+  if (!d.start_struct(2, &cend) ||
+      !d.start_struct(11, &end))
+    return false;
+  d.need(OBJECT_STAT_SUM_FIELDS * sizeof(int64_t));
+  s.num_bytes = d.get_le64();
+  s.num_objects = d.get_le64();
+  s.num_object_clones = d.get_le64();
+  s.num_object_copies = d.get_le64();
+  s.num_objects_missing_on_primary = d.get_le64();
+  s.num_objects_degraded = d.get_le64();
+  s.num_objects_unfound = d.get_le64();
+  s.num_rd = d.get_le64();
+  s.num_rd_kb = d.get_le64();
+  s.num_wr = d.get_le64();
+  s.num_wr_kb = d.get_le64();
+  s.num_scrub_errors = d.get_le64();
+  s.num_objects_recovered = d.get_le64();
+  s.num_bytes_recovered = d.get_le64();
+  s.num_keys_recovered = d.get_le64();
+  s.num_shallow_scrub_errors = d.get_le64();
+  s.num_deep_scrub_errors = d.get_le64();
+  s.num_objects_dirty = d.get_le64();
+  s.num_whiteouts = d.get_le64();
+  s.num_objects_omap = d.get_le64();
+  s.num_objects_hit_set_archive = d.get_le64();
+  s.num_objects_misplaced = d.get_le64();
+  s.num_bytes_hit_set_archive = d.get_le64();
+  if (!d.finish_struct(end))
+    return false;
+  // a non-empty cat_sum is left to the checked decode
+  d.need(sizeof(__u32));
+  if (d.get_le32() != 0)
+    return false;
+  return d.finish_struct(cend);
+}
+
+size_t pg_stat_t::encoded_size() const
+{
+  return UNCHECKED_STRUCT_HEADER_SIZE +
+    EVERSION_ENCODED_SIZE +			// version
+    sizeof(reported_seq) + sizeof(reported_epoch) + sizeof(state) +
+    2 * EVERSION_ENCODED_SIZE +			// log_start, ondisk_log_start
+    sizeof(created) + sizeof(last_epoch_clean) +
+    parent.encoded_size() + sizeof(parent_split_bits) +
+    EVERSION_ENCODED_SIZE + UTIME_ENCODED_SIZE +	// last_scrub
+    OBJECT_STAT_COLLECTION_ENCODED_SIZE +
+    sizeof(log_size) + sizeof(ondisk_log_size) +
+    vector_encoded_size(up) + vector_encoded_size(acting) +
+    5 * UTIME_ENCODED_SIZE +			// last_fresh .. last_unstale
+    sizeof(mapping_epoch) +
+    EVERSION_ENCODED_SIZE + UTIME_ENCODED_SIZE +	// last_deep_scrub
+    1 +						// stats_invalid
+    2 * UTIME_ENCODED_SIZE +			// last_clean_scrub_stamp, last_became_active
+    1 +						// dirty_stats_invalid
+    sizeof(up_primary) + sizeof(acting_primary) +
+    2 +						// omap_, hitset_stats_invalid
+    vector_encoded_size(blocked_by) +
+    2 * UTIME_ENCODED_SIZE +			// last_undegraded, last_fullsized
+    1 +						// hitset_bytes_stats_invalid
+    2 * UTIME_ENCODED_SIZE;			// last_peered, last_became_peered
+}
+
+void pg_stat_t::encode_unchecked(unchecked_encoder& e) const
+{
+  char *len = e.start_struct(21, 8);
+  ::encode_unchecked(version, e);
+  e.put_le64(reported_seq);
+  e.put_le32(reported_epoch);
+  e.put_le32(state);
+  ::encode_unchecked(log_start, e);
+  ::encode_unchecked(ondisk_log_start, e);
+  e.put_le32(created);
+  e.put_le32(last_epoch_clean);
+  ::encode_unchecked(parent, e);
+  e.put_le32(parent_split_bits);
+  ::encode_unchecked(last_scrub, e);
+  ::encode_unchecked(last_scrub_stamp, e);
+  ::encode_unchecked(stats, e);
+  e.put_le64(log_size);
+  e.put_le64(ondisk_log_size);
+  ::encode_unchecked(up, e);
+  ::encode_unchecked(acting, e);
+  ::encode_unchecked(last_fresh, e);
+  ::encode_unchecked(last_change, e);
+  ::encode_unchecked(last_active, e);
+  ::encode_unchecked(last_clean, e);
+  ::encode_unchecked(last_unstale, e);
+  e.put_le32(mapping_epoch);
+  ::encode_unchecked(last_deep_scrub, e);
+  ::encode_unchecked(last_deep_scrub_stamp, e);
+  e.put_bool(stats_invalid);
+  ::encode_unchecked(last_clean_scrub_stamp, e);
+  ::encode_unchecked(last_became_active, e);
+  e.put_bool(dirty_stats_invalid);
+  e.put_le32(up_primary);
+  e.put_le32(acting_primary);
+  e.put_bool(omap_stats_invalid);
+  e.put_bool(hitset_stats_invalid);
+  ::encode_unchecked(blocked_by, e);
+  ::encode_unchecked(last_undegraded, e);
+  ::encode_unchecked(last_fullsized, e);
+  e.put_bool(hitset_bytes_stats_invalid);
+  ::encode_unchecked(last_peered, e);
+  ::encode_unchecked(last_became_peered, e);
+  e.finish_struct(len);
+}
+
+bool pg_stat_t::decode_unchecked(bufferlist::iterator &bl)
+{
+  if (bl.end())
+    return false;
+  unchecked_decoder d(bl.get_current_ptr());
+  const char *end;
+  if (!d.start_struct(21, &end))
+    return false;
+  d.end = end;
+
+  d.need(EVERSION_ENCODED_SIZE + sizeof(reported_seq) + sizeof(reported_epoch) +
+	 sizeof(state) + 2 * EVERSION_ENCODED_SIZE + sizeof(created) +
+	 sizeof(last_epoch_clean) + parent.encoded_size() + sizeof(parent_split_bits) +
+	 EVERSION_ENCODED_SIZE + UTIME_ENCODED_SIZE);
+  ::decode_unchecked(version, d);
+  reported_seq = d.get_le64();
+  reported_epoch = d.get_le32();
+  state = d.get_le32();
+  ::decode_unchecked(log_start, d);
+  ::decode_unchecked(ondisk_log_start, d);
+  created = d.get_le32();
+  last_epoch_clean = d.get_le32();
+  parent.decode_unchecked(d);
+  parent_split_bits = d.get_le32();
+  ::decode_unchecked(last_scrub, d);
+  ::decode_unchecked(last_scrub_stamp, d);
+  if (!::decode_unchecked(stats, d))
+    return false;
+  d.need(sizeof(log_size) + sizeof(ondisk_log_size));
+  log_size = d.get_le64();
+  ondisk_log_size = d.get_le64();
+  ::decode_unchecked(up, d);
+  ::decode_unchecked(acting, d);
+  d.need(5 * UTIME_ENCODED_SIZE + sizeof(mapping_epoch) +
+	 EVERSION_ENCODED_SIZE + UTIME_ENCODED_SIZE + 1 +
+	 2 * UTIME_ENCODED_SIZE + 1 +
+	 sizeof(up_primary) + sizeof(acting_primary) + 2);
+  ::decode_unchecked(last_fresh, d);
+  ::decode_unchecked(last_change, d);
+  ::decode_unchecked(last_active, d);
+  ::decode_unchecked(last_clean, d);
+  ::decode_unchecked(last_unstale, d);
+  mapping_epoch = d.get_le32();
+  ::decode_unchecked(last_deep_scrub, d);
+  ::decode_unchecked(last_deep_scrub_stamp, d);
+  stats_invalid = d.get_bool();
+  ::decode_unchecked(last_clean_scrub_stamp, d);
+  ::decode_unchecked(last_became_active, d);
+  dirty_stats_invalid = d.get_bool();
+  up_primary = d.get_le32();
+  acting_primary = d.get_le32();
+  omap_stats_invalid = d.get_bool();
+  hitset_stats_invalid = d.get_bool();
+  ::decode_unchecked(blocked_by, d);
+  d.need(2 * UTIME_ENCODED_SIZE + 1 + 2 * UTIME_ENCODED_SIZE);
+  ::decode_unchecked(last_undegraded, d);
+  ::decode_unchecked(last_fullsized, d);
+  hitset_bytes_stats_invalid = d.get_bool();
+  ::decode_unchecked(last_peered, d);
+  ::decode_unchecked(last_became_peered, d);
+  if (!d.finish_struct(end))
+    return false;
+
+  bl.advance(d.get_off());
+  return true;
+}
+
 void pg_stat_t::encode(bufferlist &bl) const
 {
-  ENCODE_START(21, 8, bl);
-  ::encode(version, bl);
-  ::encode(reported_seq, bl);
-  ::encode(reported_epoch, bl);
-  ::encode(state, bl);
-  ::encode(log_start, bl);
-  ::encode(ondisk_log_start, bl);
-  ::encode(created, bl);
-  ::encode(last_epoch_clean, bl);
-  ::encode(parent, bl);
-  ::encode(parent_split_bits, bl);
-  ::encode(last_scrub, bl);
-  ::encode(last_scrub_stamp, bl);
-  ::encode(stats, bl);
-  ::encode(log_size, bl);
-  ::encode(ondisk_log_size, bl);
-  ::encode(up, bl);
-  ::encode(acting, bl);
-  ::encode(last_fresh, bl);
-  ::encode(last_change, bl);
-  ::encode(last_active, bl);
-  ::encode(last_clean, bl);
-  ::encode(last_unstale, bl);
-  ::encode(mapping_epoch, bl);
-  ::encode(last_deep_scrub, bl);
-  ::encode(last_deep_scrub_stamp, bl);
-  ::encode(stats_invalid, bl);
-  ::encode(last_clean_scrub_stamp, bl);
-  ::encode(last_became_active, bl);
-  ::encode(dirty_stats_invalid, bl);
-  ::encode(up_primary, bl);
-  ::encode(acting_primary, bl);
-  ::encode(omap_stats_invalid, bl);
-  ::encode(hitset_stats_invalid, bl);
-  ::encode(blocked_by, bl);
-  ::encode(last_undegraded, bl);
-  ::encode(last_fullsized, bl);
-  ::encode(hitset_bytes_stats_invalid, bl);
-  ::encode(last_peered, bl);
-  ::encode(last_became_peered, bl);
-  ENCODE_FINISH(bl);
+  size_t len = encoded_size();
+  unchecked_encoder e(bl.append_hole(len));
+  char *start = e.p;
+  encode_unchecked(e);
+  assert(e.p == start + len);
 }
 
 void pg_stat_t::decode(bufferlist::iterator &bl)
 {
+  if (decode_unchecked(bl))
+    return;
+
   DECODE_START_LEGACY_COMPAT_LEN(20, 8, 8, bl);
   ::decode(version, bl);
   ::decode(reported_seq, bl);
@@ -2938,6 +3227,32 @@ void ObjectModDesc::decode(bufferlist::iterator &_bl)
   DECODE_FINISH(_bl);
 }
 
+size_t ObjectModDesc::encoded_size() const
+{
+  return UNCHECKED_STRUCT_HEADER_SIZE + 2 + unchecked_bufferlist_size(bl);
+}
+
+void ObjectModDesc::encode_unchecked(unchecked_encoder& e) const
+{
+  char *len = e.start_struct(1, 1);
+  e.put_bool(can_local_rollback);
+  e.put_bool(rollback_info_completed);
+  e.put_bufferlist(bl);
+  e.finish_struct(len);
+}
+
+bool ObjectModDesc::decode_unchecked(unchecked_decoder& d)
+{
+  const char *end;
+  if (!d.start_struct(1, &end))
+    return false;
+  d.need(2);
+  can_local_rollback = d.get_bool();
+  rollback_info_completed = d.get_bool();
+  d.get_bufferlist(bl);
+  return d.finish_struct(end);
+}
+
 // -- pg_log_entry_t --
 
 string pg_log_entry_t::get_key_name() const
@@ -2947,11 +3262,15 @@ string pg_log_entry_t::get_key_name() const
 
 void pg_log_entry_t::encode_with_checksum(bufferlist& bl) const
 {
-  bufferlist ebl(sizeof(*this)*2);
-  encode(ebl);
-  __u32 crc = ebl.crc32c(0);
-  ::encode(ebl, bl);
-  ::encode(crc, bl);
+  // same layout as ::encode(bufferlist) of the encoded entry followed by
+  // its crc, but encoded in place so the entry shares bl's buffer.
+  size_t len = encoded_size();
+  unchecked_encoder e(bl.append_hole(sizeof(__u32) + len + sizeof(__u32)));
+  e.put_le32(len);
+  char *start = e.p;
+  encode_unchecked(e);
+  assert(e.p == start + len);
+  e.put_le32(ceph_crc32c(0, (unsigned char *)start, len));
 }
 
 void pg_log_entry_t::decode_with_checksum(bufferlist::iterator& p)
@@ -2966,12 +3285,25 @@ void pg_log_entry_t::decode_with_checksum(bufferlist::iterator& p)
   decode(q);
 }
 
-void pg_log_entry_t::encode(bufferlist &bl) const
+size_t pg_log_entry_t::encoded_size() const
 {
-  ENCODE_START(10, 4, bl);
-  ::encode(op, bl);
-  ::encode(soid, bl);
-  ::encode(version, bl);
+  return UNCHECKED_STRUCT_HEADER_SIZE +
+    sizeof(op) + soid.encoded_size() +
+    2 * EVERSION_ENCODED_SIZE +
+    REQID_ENCODED_SIZE + UTIME_ENCODED_SIZE +
+    (op == LOST_REVERT ? EVERSION_ENCODED_SIZE : 0) +
+    unchecked_bufferlist_size(snaps) +
+    sizeof(user_version) +
+    mod_desc.encoded_size() +
+    sizeof(__u32) + extra_reqids.size() * (REQID_ENCODED_SIZE + sizeof(version_t));
+}
+
+void pg_log_entry_t::encode_unchecked(unchecked_encoder& e) const
+{
+  char *len = e.start_struct(10, 4);
+  e.put_le32(op);
+  soid.encode_unchecked(e);
+  ::encode_unchecked(version, e);
 
   /**
    * Added with reverting_to:
@@ -2981,23 +3313,91 @@ void pg_log_entry_t::encode(bufferlist &bl) const
    * into prior_version as expected.
    */
   if (op == LOST_REVERT)
-    ::encode(reverting_to, bl);
+    ::encode_unchecked(reverting_to, e);
   else
-    ::encode(prior_version, bl);
+    ::encode_unchecked(prior_version, e);
 
-  ::encode(reqid, bl);
-  ::encode(mtime, bl);
+  ::encode_unchecked(reqid, e);
+  ::encode_unchecked(mtime, e);
   if (op == LOST_REVERT)
-    ::encode(prior_version, bl);
-  ::encode(snaps, bl);
-  ::encode(user_version, bl);
-  ::encode(mod_desc, bl);
-  ::encode(extra_reqids, bl);
-  ENCODE_FINISH(bl);
+    ::encode_unchecked(prior_version, e);
+  e.put_bufferlist(snaps);
+  e.put_le64(user_version);
+  mod_desc.encode_unchecked(e);
+  e.put_le32(extra_reqids.size());
+  for (vector<pair<osd_reqid_t, version_t> >::const_iterator p =
+	 extra_reqids.begin();
+       p != extra_reqids.end();
+       ++p) {
+    ::encode_unchecked(p->first, e);
+    e.put_le64(p->second);
+  }
+  e.finish_struct(len);
+}
+
+bool pg_log_entry_t::decode_unchecked(bufferlist::iterator &bl)
+{
+  if (bl.end())
+    return false;
+  unchecked_decoder d(bl.get_current_ptr());
+  const char *end;
+  if (!d.start_struct(10, &end))
+    return false;
+  d.end = end;
+
+  d.need(sizeof(op));
+  op = d.get_le32();
+  if (!soid.decode_unchecked(d))
+    return false;
+  d.need(2 * EVERSION_ENCODED_SIZE);
+  ::decode_unchecked(version, d);
+  if (op == LOST_REVERT)
+    ::decode_unchecked(reverting_to, d);
+  else
+    ::decode_unchecked(prior_version, d);
+  if (!::decode_unchecked(reqid, d))
+    return false;
+  d.need(UTIME_ENCODED_SIZE);
+  ::decode_unchecked(mtime, d);
+  if (op == LOST_REVERT) {
+    d.need(EVERSION_ENCODED_SIZE);
+    ::decode_unchecked(prior_version, d);
+  }
+  d.get_bufferlist(snaps);
+  d.need(sizeof(user_version));
+  user_version = d.get_le64();
+  if (!mod_desc.decode_unchecked(d))
+    return false;
+  d.need(sizeof(__u32));
+  __u32 n = d.get_le32();
+  d.need((size_t)n * (REQID_ENCODED_SIZE + sizeof(version_t)));
+  extra_reqids.resize(n);
+  for (__u32 i = 0; i < n; ++i) {
+    if (!::decode_unchecked(extra_reqids[i].first, d))
+      return false;
+    extra_reqids[i].second = d.get_le64();
+  }
+  if (!d.finish_struct(end))
+    return false;
+
+  bl.advance(d.get_off());
+  return true;
+}
+
+void pg_log_entry_t::encode(bufferlist &bl) const
+{
+  size_t len = encoded_size();
+  unchecked_encoder e(bl.append_hole(len));
+  char *start = e.p;
+  encode_unchecked(e);
+  assert(e.p == start + len);
 }
 
 void pg_log_entry_t::decode(bufferlist::iterator &bl)
 {
+  if (decode_unchecked(bl))
+    return;
+
   DECODE_START_LEGACY_COMPAT_LEN(10, 4, 4, bl);
   ::decode(op, bl);
   if (struct_v < 2) {
@@ -3098,6 +3498,15 @@ void pg_log_entry_t::generate_test_instances(list<pg_log_entry_t*>& o)
   o.push_back(new pg_log_entry_t(MODIFY, oid, eversion_t(1,2), eversion_t(3,4),
 				 1, osd_reqid_t(entity_name_t::CLIENT(777), 8, 999),
 				 utime_t(8,9)));
+  pg_log_entry_t *e = new pg_log_entry_t(LOST_REVERT, oid, eversion_t(5,6),
+					 eversion_t(3,4), 2,
+					 osd_reqid_t(entity_name_t::CLIENT(777), 8, 1000),
+					 utime_t(10,11));
+  e->reverting_to = eversion_t(1,2);
+  e->snaps.append("snaps", 5);
+  e->mod_desc.append(4096);
+  e->extra_reqids.push_back(make_pair(osd_reqid_t(entity_name_t::CLIENT(778), 9, 1), 7));
+  o.push_back(e);
 }
 
 ostream& operator<<(ostream& out, const pg_log_entry_t& e)
@@ -4261,8 +4670,76 @@ void object_info_t::encode(bufferlist& bl) const
   ENCODE_FINISH(bl);
 }
 
+bool object_info_t::decode_unchecked(bufferlist::iterator& bl)
+{
+  if (bl.end())
+    return false;
+  unchecked_decoder d(bl.get_current_ptr());
+  const char *end;
+  if (!d.start_struct(15, &end))
+    return false;
+  d.end = end;
+
+  if (!soid.decode_unchecked(d))
+    return false;
+  const char *oloc_end;  // retained for compatibility, and not used
+  if (!d.start_struct(6, &oloc_end))
+    return false;
+  d.p = oloc_end;
+  {
+    string category;
+    d.get_string(category);  // no longer used
+  }
+  d.need(2 * EVERSION_ENCODED_SIZE);
+  ::decode_unchecked(version, d);
+  ::decode_unchecked(prior_version, d);
+  if (!::decode_unchecked(last_reqid, d))
+    return false;
+  d.need(sizeof(size) + UTIME_ENCODED_SIZE);
+  size = d.get_le64();
+  ::decode_unchecked(mtime, d);
+  if (soid.snap == CEPH_NOSNAP) {
+    if (!::decode_unchecked(wrlock_by, d))
+      return false;
+  } else {
+    d.need(sizeof(__u32));
+    __u32 n = d.get_le32();
+    d.need((size_t)n * sizeof(snapid_t));
+    snaps.resize(n);
+    for (__u32 i = 0; i < n; ++i)
+      snaps[i] = d.get_le64();
+  }
+  d.need(sizeof(truncate_seq) + sizeof(truncate_size) + 1 + sizeof(__u32));
+  truncate_seq = d.get_le64();
+  truncate_size = d.get_le64();
+  d.get_u8();  // lost, in flags below
+  if (d.get_le32())
+    return false;  // old_watchers
+  d.need(EVERSION_ENCODED_SIZE + 1 + sizeof(__u32));
+  eversion_t user_eversion;
+  ::decode_unchecked(user_eversion, d);
+  user_version = user_eversion.version;
+  d.get_bool();  // uses_tmap, in flags below
+  if (d.get_le32())
+    return false;  // watchers
+  watchers.clear();
+  d.need(sizeof(__u32) + UTIME_ENCODED_SIZE + sizeof(data_digest) + sizeof(omap_digest));
+  flags = (flag_t)d.get_le32();
+  ::decode_unchecked(local_mtime, d);
+  data_digest = d.get_le32();
+  omap_digest = d.get_le32();
+  if (!d.finish_struct(end))
+    return false;
+
+  bl.advance(d.get_off());
+  return true;
+}
+
 void object_info_t::decode(bufferlist::iterator& bl)
 {
+  if (decode_unchecked(bl))
+    return;
+
   object_locator_t myoloc;
   DECODE_START_LEGACY_COMPAT_LEN(14, 8, 8, bl);
   map<entity_name_t, watch_info_t> old_watchers;
@@ -4376,8 +4853,30 @@ void object_info_t::dump(Formatter *f) const
 void object_info_t::generate_test_instances(list<object_info_t*>& o)
 {
   o.push_back(new object_info_t());
-  
-  // fixme
+
+  o.push_back(new object_info_t(hobject_t(object_t("head"), "", CEPH_NOSNAP,
+					  0x42, 3, "ns")));
+  o.back()->version = eversion_t(10, 20);
+  o.back()->prior_version = eversion_t(10, 19);
+  o.back()->user_version = 19;
+  o.back()->last_reqid = osd_reqid_t(entity_name_t::CLIENT(777), 8, 999);
+  o.back()->size = 4096;
+  o.back()->mtime = utime_t(8, 9);
+  o.back()->local_mtime = utime_t(8, 10);
+  o.back()->truncate_seq = 2;
+  o.back()->truncate_size = 1024;
+  o.back()->set_data_digest(0x1234);
+
+  o.push_back(new object_info_t(hobject_t(object_t("clone"), "key", 5,
+					  0x43, 3, "")));
+  o.back()->snaps.push_back(5);
+  o.back()->snaps.push_back(4);
+  o.back()->set_flag(object_info_t::FLAG_LOST);
+
+  o.push_back(new object_info_t(hobject_t(object_t("watched"), "", CEPH_NOSNAP,
+					  0x44, 3, "")));
+  o.back()->watchers[make_pair(1, entity_name_t::CLIENT(4))] =
+    watch_info_t(1, 30, entity_addr_t());
 }
 
 
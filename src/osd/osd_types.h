@@ -169,6 +169,8 @@ struct object_locator_t {
 
   void encode(bufferlist& bl) const;
   void decode(bufferlist::iterator& p);
+  /// the current version only; false to go the checked way instead
+  bool decode_unchecked(unchecked_decoder& d);
   void dump(Formatter *f) const;
   static void generate_test_instances(list<object_locator_t*>& o);
 };
@@ -324,6 +326,9 @@ struct pg_t {
    */
   unsigned get_split_bits(unsigned pg_num) const;
 
+  size_t encoded_size() const {
+    return sizeof(__u8) + sizeof(m_pool) + sizeof(m_seed) + sizeof(m_preferred);
+  }
   void encode(bufferlist& bl) const {
     __u8 v = 1;
     ::encode(v, bl);
@@ -338,6 +343,13 @@ struct pg_t {
     ::decode(m_seed, bl);
     ::decode(m_preferred, bl);
   }
+  /// the caller has checked that encoded_size() bytes are there
+  void decode_unchecked(unchecked_decoder& d) {
+    d.get_u8();
+    m_pool = d.get_le64();
+    m_seed = d.get_le32();
+    m_preferred = d.get_le32();
+  }
   void decode_old(bufferlist::iterator& bl) {
     old_pg_t opg;
     ::decode(opg, bl);
@@ -1575,6 +1587,9 @@ struct pg_stat_t {
   bool is_acting_osd(int32_t osd, bool primary) const;
   void dump(Formatter *f) const;
   void dump_brief(Formatter *f) const;
+  size_t encoded_size() const;
+  void encode_unchecked(unchecked_encoder& e) const;
+  bool decode_unchecked(bufferlist::iterator& bl);
   void encode(bufferlist &bl) const;
   void decode(bufferlist::iterator &bl);
   static void generate_test_instances(list<pg_stat_t*>& o);
@@ -2161,6 +2176,9 @@ public:
     if (bl.length() > 0)
       bl.rebuild();
   }
+  size_t encoded_size() const;
+  void encode_unchecked(unchecked_encoder& e) const;
+  bool decode_unchecked(unchecked_decoder& d);
   void encode(bufferlist &bl) const;
   void decode(bufferlist::iterator &bl);
   void dump(Formatter *f) const;
@@ -2268,6 +2286,12 @@ struct pg_log_entry_t {
   void encode_with_checksum(bufferlist& bl) const;
   void decode_with_checksum(bufferlist::iterator& p);
 
+  /// exactly what encode() appends
+  size_t encoded_size() const;
+  void encode_unchecked(unchecked_encoder& e) const;
+  /// decode straight from the current contiguous buffer, if it is all there
+  bool decode_unchecked(bufferlist::iterator& bl);
+
   void encode(bufferlist &bl) const;
   void decode(bufferlist::iterator &bl);
   void dump(Formatter *f) const;
@@ -3003,6 +3027,9 @@ struct object_info_t {
   }
 
   void encode(bufferlist& bl) const;
+  /// decode straight from the current contiguous buffer, if it is all
+  /// there and there are no watchers
+  bool decode_unchecked(bufferlist::iterator& bl);
   void decode(bufferlist::iterator& bl);
   void decode(bufferlist& bl) {
     bufferlist::iterator p = bl.begin();
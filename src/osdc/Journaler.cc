@@ -75,14 +75,28 @@ void Journaler::_set_layout(ceph_file_layout const *l)
   last_written.layout = layout;
   last_committed.layout = layout;
 
+  _set_fetch_len();
+}
+
+void Journaler::_set_fetch_len()
+{
   // prefetch intelligently.
   // (watch out, this is big if you use big objects or weird striping)
-  uint64_t periods = cct->_conf->journaler_prefetch_periods;
+  uint64_t periods = prefetch_periods ? prefetch_periods :
+    cct->_conf->journaler_prefetch_periods;
   if (periods < 2)
     periods = 2;  // we need at least 2 periods to make progress.
   fetch_len = layout.fl_stripe_count * layout.fl_object_size * periods;
 }
 
+void Journaler::set_prefetch_periods(uint64_t periods)
+{
+  Mutex::Locker l(lock);
+  ldout(cct, 10) << "set_prefetch_periods " << periods << dendl;
+  prefetch_periods = periods;
+  _set_fetch_len();
+}
+
 
 /***************** HEADER *******************/
 
@@ -266,6 +266,7 @@ private:
 
   void _reread_head(Context *onfinish);
   void _set_layout(ceph_file_layout const *l);
+  void _set_fetch_len();
   list<Context*> waitfor_recover;
   void _read_head(Context *on_finish, bufferlist *bl);
   void _finish_read_head(int r, bufferlist& bl);
@@ -315,6 +316,7 @@ private:
 
   uint64_t fetch_len;     // how much to read at a time
   uint64_t temp_fetch_len;
+  uint64_t prefetch_periods;  // layout periods to read ahead; 0 = journaler_prefetch_periods
 
   // for wait_for_readable()
   C_OnFinisher    *on_readable;
@@ -385,7 +387,7 @@ public:
     prezeroing_pos(0), prezero_pos(0), write_pos(0), flush_pos(0), safe_pos(0),
     waiting_for_zero(false),
     read_pos(0), requested_pos(0), received_pos(0),
-    fetch_len(0), temp_fetch_len(0),
+    fetch_len(0), temp_fetch_len(0), prefetch_periods(0),
     on_readable(0), on_write_error(NULL), called_write_error(false),
     expire_pos(0), trimming_pos(0), trimmed_pos(0), readable(false),
     stopping(false)
@@ -469,6 +471,12 @@ public:
 
   void set_write_error_handler(Context *c);
 
+  /**
+   * Read this many layout periods (objects) ahead instead of
+   * journaler_prefetch_periods, keeping that many reads in flight.
+   */
+  void set_prefetch_periods(uint64_t periods);
+
   /**
    * Cause any ongoing waits to error out with -EAGAIN, set error
    * to -EAGAIN.
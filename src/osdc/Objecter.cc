@@ -163,14 +163,15 @@ void Objecter::handle_conf_change(const struct md_config_t *conf,
 				  const std::set <std::string> &changed)
 {
   if (changed.count("crush_location")) {
-    crush_location.clear();
+    std::multimap<string,string> loc;
     vector<string> lvec;
     get_str_vec(cct->_conf->crush_location, ";, \t", lvec);
-    int r = CrushWrapper::parse_loc_multimap(lvec, &crush_location);
+    int r = CrushWrapper::parse_loc_multimap(lvec, &loc);
     if (r < 0) {
       lderr(cct) << "warning: crush_location '" << cct->_conf->crush_location
 		 << "' does not parse" << dendl;
     }
+    crush_location.update(loc);
   }
 }
 
@@ -2541,9 +2542,10 @@ int Objecter::_calc_target(op_target_t *t, epoch_t *last_force_resend,  bool any
 	// distance is the same.
 	int best = -1;
 	int best_locality = 0;
+	ConfigSnapshot<std::multimap<string,string> >::Reader loc(crush_location);
 	for (unsigned i = 0; i < acting.size(); ++i) {
 	  int locality = osdmap->crush->get_common_ancestor_distance(
-		 cct, acting[i], crush_location);
+		 cct, acting[i], *loc);
 	  ldout(cct, 20) << __func__ << " localize: rank " << i
 			 << " osd." << acting[i]
 			 << " locality " << locality << dendl;
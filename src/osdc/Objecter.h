@@ -24,6 +24,7 @@
 #include "common/admin_socket.h"
 #include "common/Timer.h"
 #include "common/RWLock.h"
+#include "common/ConfigSnapshot.h"
 #include "include/rados/rados_types.hpp"
 
 #include <list>
@@ -1053,7 +1054,8 @@ private:
   OSDMap    *osdmap;
 public:
   using Dispatcher::cct;
-  std::multimap<string,string> crush_location;
+  // parsed crush_location; read lock-free from _calc_target
+  ConfigSnapshot<std::multimap<string,string> > crush_location;
 
   atomic_t initialized;
 
@@ -32,6 +32,8 @@ using namespace std;
 #include "rgw_usage.h"
 #include "rgw_replica_log.h"
 #include "rgw_orphan.h"
+#include "rgw_reshard.h"
+#include "rgw_gc.h"
 
 #define dout_subsys ceph_subsys_rgw
 
@@ -65,6 +67,7 @@ void _usage()
   cerr << "  bucket stats               returns bucket statistics\n";
   cerr << "  bucket rm                  remove bucket\n";
   cerr << "  bucket check               check bucket index\n";
+  cerr << "  bucket reshard             reshard bucket index (use --num-shards)\n";
   cerr << "  object rm                  remove object\n";
   cerr << "  object unlink              unlink object from bucket index\n";
   cerr << "  quota set                  set quota params\n";
@@ -94,6 +97,9 @@ void _usage()
   cerr << "  gc list                    dump expired garbage collection objects (specify\n";
   cerr << "                             --include-all to list all entries, including unexpired)\n";
   cerr << "  gc process                 manually process garbage\n";
+  cerr << "  gc stats                   show the gc backlog of each gc shard\n";
+  cerr << "  reshard status             show the progress of the last reshard of a bucket\n";
+  cerr << "  reshard cancel             cancel an unfinished reshard of a bucket\n";
   cerr << "  metadata get               get metadata info\n";
   cerr << "  metadata put               put metadata info\n";
   cerr << "  metadata rm                remove metadata info\n";
@@ -210,6 +216,7 @@ enum {
   OPT_BUCKET_CHECK,
   OPT_BUCKET_RM,
   OPT_BUCKET_REWRITE,
+  OPT_BUCKET_RESHARD,
   OPT_POLICY,
   OPT_POOL_ADD,
   OPT_POOL_RM,
@@ -233,6 +240,9 @@ enum {
   OPT_QUOTA_DISABLE,
   OPT_GC_LIST,
   OPT_GC_PROCESS,
+  OPT_GC_STATS,
+  OPT_RESHARD_STATUS,
+  OPT_RESHARD_CANCEL,
   OPT_ORPHANS_FIND,
   OPT_ORPHANS_FINISH,
   OPT_REGION_GET,
@@ -293,6 +303,7 @@ static int get_cmd(const char *cmd, const char *prev_cmd, bool *need_more)
       strcmp(cmd, "region-map") == 0 ||
       strcmp(cmd, "regionmap") == 0 ||
       strcmp(cmd, "replicalog") == 0 ||
+      strcmp(cmd, "reshard") == 0 ||
       strcmp(cmd, "subuser") == 0 ||
       strcmp(cmd, "temp") == 0 ||
       strcmp(cmd, "usage") == 0 ||
@@ -355,6 +366,8 @@ static int get_cmd(const char *cmd, const char *prev_cmd, bool *need_more)
       return OPT_BUCKET_REWRITE;
     if (strcmp(cmd, "check") == 0)
       return OPT_BUCKET_CHECK;
+    if (strcmp(cmd, "reshard") == 0)
+      return OPT_BUCKET_RESHARD;
   } else if (strcmp(prev_cmd, "log") == 0) {
     if (strcmp(cmd, "list") == 0)
       return OPT_LOG_LIST;
@@ -445,6 +458,13 @@ static int get_cmd(const char *cmd, const char *prev_cmd, bool *need_more)
       return OPT_GC_LIST;
     if (strcmp(cmd, "process") == 0)
       return OPT_GC_PROCESS;
+    if (strcmp(cmd, "stats") == 0)
+      return OPT_GC_STATS;
+  } else if (strcmp(prev_cmd, "reshard") == 0) {
+    if (strcmp(cmd, "status") == 0)
+      return OPT_RESHARD_STATUS;
+    if (strcmp(cmd, "cancel") == 0)
+      return OPT_RESHARD_CANCEL;
   } else if (strcmp(prev_cmd, "orphans") == 0) {
     if (strcmp(cmd, "find") == 0)
       return OPT_ORPHANS_FIND;
@@ -2388,15 +2408,16 @@ next:
 
     rgw_obj_key marker;
     string prefix;
+    RGWBucketListCursor cursor;
 
     formatter->open_object_section("result");
     formatter->dump_string("bucket", bucket_name);
     formatter->open_array_section("objects");
     while (is_truncated) {
       map<string, RGWObjEnt> result;
-      int r = store->cls_bucket_list(bucket, marker, prefix, 1000, true,
+      int r = store->cls_bucket_list(bucket, marker, prefix, string(), 1000, true,
                                      result, &is_truncated, &marker,
-                                     bucket_object_check_filter);
+                                     bucket_object_check_filter, &cursor);
 
       if (r < 0 && r != -ENOENT) {
         cerr << "ERROR: failed operation r=" << r << std::endl;
@@ -2544,6 +2565,52 @@ next:
     RGWBucketAdminOp::remove_bucket(store, bucket_op);
   }
 
+  if (opt_cmd == OPT_BUCKET_RESHARD ||
+      opt_cmd == OPT_RESHARD_STATUS ||
+      opt_cmd == OPT_RESHARD_CANCEL) {
+    if (bucket_name.empty()) {
+      cerr << "ERROR: bucket not specified" << std::endl;
+      return EINVAL;
+    }
+
+    RGWBucketInfo bucket_info;
+    int ret = init_bucket(bucket_name, bucket_id, bucket_info, bucket);
+    if (ret < 0) {
+      cerr << "ERROR: could not init bucket: " << cpp_strerror(-ret) << std::endl;
+      return -ret;
+    }
+
+    map<string, bufferlist> attrs;
+    RGWBucketReshard br(store, bucket_info, attrs);
+
+    if (opt_cmd == OPT_BUCKET_RESHARD) {
+      if (num_shards <= 0) {
+        cerr << "ERROR: --num-shards not specified" << std::endl;
+        return EINVAL;
+      }
+      ret = br.execute(num_shards);
+      if (ret < 0) {
+        cerr << "ERROR: failed to reshard bucket: " << cpp_strerror(-ret) << std::endl;
+        return -ret;
+      }
+    } else if (opt_cmd == OPT_RESHARD_CANCEL) {
+      ret = br.cancel();
+      if (ret < 0) {
+        cerr << "ERROR: failed to cancel reshard: " << cpp_strerror(-ret) << std::endl;
+        return -ret;
+      }
+    }
+
+    RGWReshardStatus status;
+    ret = br.get_status(&status);
+    if (ret < 0) {
+      cerr << "ERROR: failed to read reshard status: " << cpp_strerror(-ret) << std::endl;
+      return -ret;
+    }
+    encode_json("reshard_status", status, formatter);
+    formatter->flush(cout);
+  }
+
   if (opt_cmd == OPT_GC_LIST) {
     int index = 0;
     bool truncated;
@@ -2588,6 +2655,36 @@ next:
     }
   }
 
+  if (opt_cmd == OPT_GC_STATS) {
+    list<RGWGCShardStats> stats;
+    int ret = store->get_gc_stats(stats);
+    if (ret < 0) {
+      cerr << "ERROR: failed to read gc stats: " << cpp_strerror(-ret) << std::endl;
+      return 1;
+    }
+
+    RGWGCShardStats total;
+    formatter->open_object_section("gc_stats");
+    formatter->open_array_section("shards");
+    for (list<RGWGCShardStats>::iterator iter = stats.begin(); iter != stats.end(); ++iter) {
+      RGWGCShardStats& shard = *iter;
+      encode_json("shard", shard, formatter);
+      total.entries += shard.entries;
+      total.expired += shard.expired;
+      total.objs += shard.objs;
+      if (!shard.oldest_expired.is_zero() &&
+          (total.oldest_expired.is_zero() || shard.oldest_expired < total.oldest_expired))
+        total.oldest_expired = shard.oldest_expired;
+    }
+    formatter->close_section();
+    formatter->dump_unsigned("entries", total.entries);
+    formatter->dump_unsigned("expired", total.expired);
+    formatter->dump_unsigned("objs", total.objs);
+    formatter->dump_stream("oldest_expired") << total.oldest_expired;
+    formatter->close_section();
+    formatter->flush(cout);
+  }
+
   if (opt_cmd == OPT_ORPHANS_FIND) {
     RGWOrphanSearch search(store, max_concurrent_ios, orphan_stale_secs);
 
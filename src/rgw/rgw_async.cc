@@ -0,0 +1,858 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "common/errno.h"
+#include "common/pipe.h"
+#include "common/strtol.h"
+#include "rgw_async.h"
+
+#define dout_subsys ceph_subsys_rgw
+
+#define MAX_HEADER_SIZE (64 * 1024)
+#define READ_SIZE (64 * 1024)
+#define MAX_EVENTS 256
+#define SOCKET_BACKLOG 1024
+#define WAITING_RETRY_MS 10
+
+using namespace std;
+
+static const char continue_response[] = "HTTP/1.1 100 Continue\r\n\r\n";
+
+RGWAsyncConn::RGWAsyncConn(CephContext *_cct, int _fd, RGWAsyncLoop *_loop, uint64_t _buffer_size)
+  : cct(_cct), fd(_fd), loop(_loop), buffer_size(_buffer_size), lock("RGWAsyncConn"),
+    state(READ_HEADER), keepalive(false), chunked(false), chunk_state(CHUNK_SIZE),
+    body_left(0), body_done(false), response_done(false), closed(false), waiting(false),
+    events(0)
+{
+}
+
+RGWAsyncConn::~RGWAsyncConn()
+{
+  ::close(fd);
+}
+
+int RGWAsyncConn::read_body(char *buf, int len)
+{
+  Mutex::Locker l(lock);
+  while (!body.length() && !body_done && !closed) {
+    cond.Wait(lock);
+  }
+  if (!body.length()) {
+    return (body_done ? 0 : -EIO);
+  }
+
+  int n = MIN((unsigned)len, body.length());
+  body.copy(0, n, buf);
+  body.splice(0, n);
+
+  /* the loop stopped reading for lack of room */
+  if (!body_done && !(events & EPOLLIN)) {
+    loop->conn_updated(this);
+  }
+  return n;
+}
+
+int RGWAsyncConn::write(const char *buf, int len)
+{
+  Mutex::Locker l(lock);
+  if (closed)
+    return -EIO;
+
+  bool was_empty = !out.length();
+  out.append(buf, len);
+  if (was_empty) {
+    /* most of the time it all goes out right away */
+    int r = flush_out();
+    if (r < 0) {
+      ldout(cct, 10) << "async: write to fd " << fd << " failed: " << cpp_strerror(r) << dendl;
+      closed = true;
+      loop->conn_updated(this);
+      return r;
+    }
+  }
+  if (out.length() && !(events & EPOLLOUT)) {
+    loop->conn_updated(this);
+  }
+  while (out.length() > buffer_size && !closed) {
+    cond.Wait(lock);
+  }
+  if (closed)
+    return -EIO;
+  return len;
+}
+
+void RGWAsyncConn::finish()
+{
+  Mutex::Locker l(lock);
+  response_done = true;
+  loop->conn_updated(this);
+}
+
+int RGWAsyncConn::parse_header(const string& header)
+{
+  size_t pos = header.find("\r\n");
+  string line = header.substr(0, pos);
+  size_t sp1 = line.find(' ');
+  size_t sp2 = line.rfind(' ');
+  if (sp1 == string::npos || sp1 == sp2)
+    return -EINVAL;
+
+  method = line.substr(0, sp1);
+  string target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+  string version = line.substr(sp2 + 1);
+  if (version.compare(0, 5, "HTTP/") != 0)
+    return -EINVAL;
+  bool http11 = (version != "HTTP/1.0");
+
+  size_t q = target.find('?');
+  uri = target.substr(0, q);
+  query_string = (q == string::npos ? "" : target.substr(q + 1));
+
+  keepalive = http11;
+  chunked = false;
+  body_left = 0;
+  bool expect_continue = false;
+  headers.clear();
+
+  while (pos != string::npos) {
+    size_t start = pos + 2;
+    pos = header.find("\r\n", start);
+    string h = header.substr(start, (pos == string::npos ? string::npos : pos - start));
+    if (h.empty())
+      continue;
+
+    size_t colon = h.find(':');
+    if (colon == string::npos || colon == 0)
+      return -EINVAL;
+    string name = h.substr(0, colon);
+    string val;
+    size_t vstart = h.find_first_not_of(" \t", colon + 1);
+    if (vstart != string::npos) {
+      size_t vend = h.find_last_not_of(" \t");
+      val = h.substr(vstart, vend - vstart + 1);
+    }
+
+    if (strcasecmp(name.c_str(), "content-length") == 0) {
+      string err;
+      long long len = strict_strtoll(val.c_str(), 10, &err);
+      if (!err.empty() || len < 0)
+        return -EINVAL;
+      body_left = len;
+    } else if (strcasecmp(name.c_str(), "transfer-encoding") == 0) {
+      if (strcasecmp(val.c_str(), "chunked") == 0) {
+        chunked = true;
+      } else if (strcasecmp(val.c_str(), "identity") != 0) {
+        return -EINVAL;
+      }
+    } else if (strcasecmp(name.c_str(), "connection") == 0) {
+      if (strcasecmp(val.c_str(), "close") == 0) {
+        keepalive = false;
+      } else if (strcasecmp(val.c_str(), "keep-alive") == 0) {
+        keepalive = true;
+      }
+    } else if (strcasecmp(name.c_str(), "expect") == 0) {
+      expect_continue = (strcasecmp(val.c_str(), "100-continue") == 0);
+    }
+    headers.push_back(make_pair(name, val));
+  }
+
+  if (chunked) {
+    chunk_state = CHUNK_SIZE;
+    body_left = 0;
+  }
+  body_done = (!chunked && !body_left);
+
+  /*
+   * The body is read before the request gets to a worker, so the client
+   * is not kept waiting for the handler to ask for it.
+   */
+  if (expect_continue && http11 && !body_done) {
+    out.append(continue_response, sizeof(continue_response) - 1);
+  }
+  return 0;
+}
+
+/*
+ * Parse what was read: the header of a request, then its body, for the
+ * worker.  What comes after the body is left for the next request.
+ */
+int RGWAsyncConn::process_input()
+{
+  if (state == READ_HEADER) {
+    size_t pos = in.find("\r\n\r\n");
+    if (pos == string::npos) {
+      return (in.size() > MAX_HEADER_SIZE ? -E2BIG : 0);
+    }
+    int r = parse_header(in.substr(0, pos));
+    in.erase(0, pos + 4);
+    if (r < 0)
+      return r;
+    state = READ_BODY;
+    ldout(cct, 20) << "async: fd " << fd << ": " << method << " " << uri << dendl;
+  }
+
+  while (!body_done && !in.empty()) {
+    if (!chunked) {
+      size_t n = MIN((uint64_t)in.size(), body_left);
+      body.append(in.data(), n);
+      in.erase(0, n);
+      body_left -= n;
+      body_done = !body_left;
+      continue;
+    }
+
+    switch (chunk_state) {
+    case CHUNK_SIZE:
+      {
+        size_t eol = in.find("\r\n");
+        if (eol == string::npos) {
+          return (in.size() > MAX_HEADER_SIZE ? -E2BIG : 0);
+        }
+        string line = in.substr(0, eol);
+        in.erase(0, eol + 2);
+        size_t ext = line.find(';');
+        if (ext != string::npos)
+          line.resize(ext);
+        char *end;
+        errno = 0;
+        body_left = strtoull(line.c_str(), &end, 16);
+        if (line.empty() || end == line.c_str() || errno)
+          return -EINVAL;
+        chunk_state = (body_left ? CHUNK_DATA : CHUNK_TRAILER);
+      }
+      break;
+    case CHUNK_DATA:
+      {
+        size_t n = MIN((uint64_t)in.size(), body_left);
+        body.append(in.data(), n);
+        in.erase(0, n);
+        body_left -= n;
+        if (!body_left)
+          chunk_state = CHUNK_DATA_END;
+      }
+      break;
+    case CHUNK_DATA_END:
+      if (in.size() < 2)
+        return 0;
+      if (in.compare(0, 2, "\r\n") != 0)
+        return -EINVAL;
+      in.erase(0, 2);
+      chunk_state = CHUNK_SIZE;
+      break;
+    case CHUNK_TRAILER:
+      {
+        size_t eol = in.find("\r\n");
+        if (eol == string::npos) {
+          return (in.size() > MAX_HEADER_SIZE ? -E2BIG : 0);
+        }
+        in.erase(0, eol + 2);
+        body_done = (eol == 0);
+      }
+      break;
+    }
+  }
+  return 0;
+}
+
+int RGWAsyncConn::flush_out()
+{
+  while (out.length()) {
+    const bufferptr& bp = out.buffers().front();
+    ssize_t r = ::send(fd, bp.c_str(), bp.length(), MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (r < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        break;
+      return -errno;
+    }
+    out.splice(0, r);
+  }
+  if (out.length() <= buffer_size) {
+    cond.Signal();
+  }
+  return 0;
+}
+
+void RGWAsyncConn::reset()
+{
+  state = READ_HEADER;
+  method.clear();
+  uri.clear();
+  query_string.clear();
+  headers.clear();
+  keepalive = false;
+  chunked = false;
+  chunk_state = CHUNK_SIZE;
+  body_left = 0;
+  body.clear();
+  body_done = false;
+  response_done = false;
+}
+
+uint32_t RGWAsyncConn::wanted_events()
+{
+  if (closed)
+    return 0;
+
+  uint32_t ev = 0;
+  if (state == READ_HEADER ||
+      (!body_done && body.length() + in.size() < buffer_size)) {
+    ev |= EPOLLIN;
+  }
+  if (out.length()) {
+    ev |= EPOLLOUT;
+  }
+  return ev;
+}
+
+RGWAsyncLoop::RGWAsyncLoop(CephContext *_cct, RGWAsyncDispatcher *_dispatcher, uint64_t _buffer_size)
+  : cct(_cct), dispatcher(_dispatcher), epoll_fd(-1), listen_fd(-1), peers(NULL),
+    next_peer(0), buffer_size(_buffer_size), lock("RGWAsyncLoop"), going_down(false),
+    woken(false)
+{
+  wake_fd[0] = wake_fd[1] = -1;
+}
+
+RGWAsyncLoop::~RGWAsyncLoop()
+{
+  list<RGWAsyncConn *>::iterator iter;
+  for (iter = new_conns.begin(); iter != new_conns.end(); ++iter) {
+    (*iter)->put();
+  }
+  for (iter = updated_conns.begin(); iter != updated_conns.end(); ++iter) {
+    (*iter)->put();
+  }
+  if (epoll_fd >= 0)
+    ::close(epoll_fd);
+  if (wake_fd[0] >= 0) {
+    ::close(wake_fd[0]);
+    ::close(wake_fd[1]);
+  }
+}
+
+int RGWAsyncLoop::init()
+{
+  epoll_fd = epoll_create(MAX_EVENTS);
+  if (epoll_fd < 0)
+    return -errno;
+  fcntl(epoll_fd, F_SETFD, FD_CLOEXEC);
+
+  int r = pipe_cloexec(wake_fd);
+  if (r < 0)
+    return r;
+  fcntl(wake_fd[0], F_SETFL, O_NONBLOCK);
+
+  struct epoll_event ev;
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.ptr = NULL;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd[0], &ev) < 0)
+    return -errno;
+
+  if (listen_fd >= 0) {
+    ev.data.ptr = this;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) < 0)
+      return -errno;
+  }
+  return 0;
+}
+
+void RGWAsyncLoop::wake()
+{
+  assert(lock.is_locked());
+  if (!woken) {
+    woken = true;
+    char c = 0;
+    int r = ::write(wake_fd[1], &c, 1);
+    (void)r;
+  }
+}
+
+void RGWAsyncLoop::add_conn(RGWAsyncConn *conn)
+{
+  Mutex::Locker l(lock);
+  new_conns.push_back(conn);
+  wake();
+}
+
+void RGWAsyncLoop::conn_updated(RGWAsyncConn *conn)
+{
+  conn->get();
+  Mutex::Locker l(lock);
+  updated_conns.push_back(conn);
+  wake();
+}
+
+void RGWAsyncLoop::stop()
+{
+  Mutex::Locker l(lock);
+  going_down = true;
+  wake();
+}
+
+void RGWAsyncLoop::accept_conns()
+{
+  for (;;) {
+    int fd = ::accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR)
+        continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        ldout(cct, 1) << "async: accept failed: " << cpp_strerror(errno) << dendl;
+      }
+      return;
+    }
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    RGWAsyncLoop *loop = (*peers)[next_peer++ % peers->size()];
+    RGWAsyncConn *conn = new RGWAsyncConn(cct, fd, loop, buffer_size);
+    ldout(cct, 20) << "async: accepted fd " << fd << dendl;
+    loop->add_conn(conn);
+  }
+}
+
+void RGWAsyncLoop::handle_io(RGWAsyncConn *conn, uint32_t ev)
+{
+  conn->lock.Lock();
+  if (ev & EPOLLIN) {
+    char buf[READ_SIZE];
+    ssize_t r = ::recv(conn->fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (r > 0) {
+      conn->in.append(buf, r);
+      int ret = conn->process_input();
+      if (ret < 0) {
+        ldout(cct, 1) << "async: bad request on fd " << conn->fd << ": " << cpp_strerror(ret) << dendl;
+        conn->closed = true;
+      }
+      conn->cond.Signal();
+    } else if (r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+      conn->closed = true;
+    }
+  }
+  if ((ev & EPOLLOUT) && !conn->closed) {
+    if (conn->flush_out() < 0)
+      conn->closed = true;
+  }
+  if (ev & (EPOLLERR | EPOLLHUP)) {
+    conn->closed = true;
+  }
+  conn->lock.Unlock();
+
+  update(conn);
+}
+
+bool RGWAsyncLoop::try_dispatch(RGWAsyncConn *conn)
+{
+  if (!dispatcher->dispatch(conn)) {
+    if (!conn->waiting) {
+      conn->waiting = true;
+      waiting.push_back(conn);
+    }
+    return false;
+  }
+  conn->state = RGWAsyncConn::HANDLING;
+  return true;
+}
+
+/*
+ * Move the connection along after something happened to it: send what
+ * there is to send, hand its request to a worker once it is ready, go on
+ * to the next request once the response is out, and ask epoll for what
+ * it needs next.
+ */
+bool RGWAsyncLoop::update(RGWAsyncConn *conn)
+{
+  conn->lock.Lock();
+  if (!conn->closed && conn->out.length() && conn->flush_out() < 0) {
+    conn->closed = true;
+  }
+
+  if (!conn->closed && conn->state == RGWAsyncConn::HANDLING &&
+      conn->response_done && !conn->out.length()) {
+    /* a body not read to the end leaves the connection in its midst */
+    if (conn->keepalive && conn->body_done && !conn->body.length()) {
+      conn->reset();
+      if (conn->process_input() < 0)
+        conn->closed = true;
+    } else {
+      conn->closed = true;
+    }
+  }
+
+  if (!conn->closed && conn->state == RGWAsyncConn::READ_BODY && !conn->waiting &&
+      (conn->body_done || conn->body.length() >= buffer_size)) {
+    try_dispatch(conn);
+  }
+
+  if (conn->closed) {
+    conn->lock.Unlock();
+    close_conn(conn);
+    return false;
+  }
+
+  uint32_t ev = conn->wanted_events();
+  if (ev != conn->events) {
+    struct epoll_event e;
+    memset(&e, 0, sizeof(e));
+    e.events = ev;
+    e.data.ptr = conn;
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &e);
+    conn->events = ev;
+  }
+  conn->lock.Unlock();
+  return true;
+}
+
+void RGWAsyncLoop::close_conn(RGWAsyncConn *conn)
+{
+  if (!conns.erase(conn))
+    return;
+
+  ldout(cct, 20) << "async: closing fd " << conn->fd << dendl;
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+  /* the fd goes with the last reference, a worker may still have one */
+  ::shutdown(conn->fd, SHUT_RDWR);
+
+  conn->lock.Lock();
+  conn->closed = true;
+  if (conn->waiting) {
+    waiting.remove(conn);
+    conn->waiting = false;
+  }
+  conn->cond.Signal();
+  conn->lock.Unlock();
+
+  conn->put();
+}
+
+void *RGWAsyncLoop::entry()
+{
+  struct epoll_event events[MAX_EVENTS];
+
+  for (;;) {
+    list<RGWAsyncConn *> added;
+    list<RGWAsyncConn *> updated;
+
+    lock.Lock();
+    if (going_down) {
+      lock.Unlock();
+      break;
+    }
+    added.swap(new_conns);
+    updated.swap(updated_conns);
+    woken = false;
+    lock.Unlock();
+
+    list<RGWAsyncConn *>::iterator iter;
+    for (iter = added.begin(); iter != added.end(); ++iter) {
+      RGWAsyncConn *conn = *iter;
+      struct epoll_event e;
+      memset(&e, 0, sizeof(e));
+      e.events = EPOLLIN;
+      e.data.ptr = conn;
+      conn->events = EPOLLIN;
+      if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn->fd, &e) < 0) {
+        ldout(cct, 0) << "ERROR: async: epoll_ctl failed: " << cpp_strerror(errno) << dendl;
+        conn->put();
+        continue;
+      }
+      conns.insert(conn);
+    }
+
+    for (iter = updated.begin(); iter != updated.end(); ++iter) {
+      RGWAsyncConn *conn = *iter;
+      if (conns.count(conn))
+        update(conn);
+      conn->put();
+    }
+
+    list<RGWAsyncConn *> retry;
+    retry.swap(waiting);
+    for (iter = retry.begin(); iter != retry.end(); ++iter) {
+      RGWAsyncConn *conn = *iter;
+      conn->lock.Lock();
+      conn->waiting = false;
+      conn->lock.Unlock();
+      update(conn);
+    }
+
+    int timeout = (waiting.empty() ? -1 : WAITING_RETRY_MS);
+    int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      lderr(cct) << "ERROR: async: epoll_wait failed: " << cpp_strerror(errno) << dendl;
+      break;
+    }
+
+    for (int i = 0; i < n; i++) {
+      void *ptr = events[i].data.ptr;
+      if (!ptr) {
+        char buf[64];
+        while (::read(wake_fd[0], buf, sizeof(buf)) > 0);
+      } else if (ptr == this) {
+        accept_conns();
+      } else {
+        RGWAsyncConn *conn = static_cast<RGWAsyncConn *>(ptr);
+        if (conns.count(conn))
+          handle_io(conn, events[i].events);
+      }
+    }
+  }
+
+  /* a worker still on a request finds its connection closed */
+  while (!conns.empty()) {
+    close_conn(*conns.begin());
+  }
+  return NULL;
+}
+
+RGWAsyncServer::RGWAsyncServer(CephContext *_cct, RGWAsyncDispatcher *_dispatcher,
+                               int _num_loops, uint64_t _buffer_size)
+  : cct(_cct), dispatcher(_dispatcher), num_loops(_num_loops), buffer_size(_buffer_size),
+    listen_fd(-1), port(0)
+{
+}
+
+RGWAsyncServer::~RGWAsyncServer()
+{
+  stop();
+  for (vector<RGWAsyncLoop *>::iterator iter = loops.begin(); iter != loops.end(); ++iter) {
+    delete *iter;
+  }
+  if (listen_fd >= 0)
+    ::close(listen_fd);
+}
+
+int RGWAsyncServer::bind(const string& host, int _port)
+{
+  listen_fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0)
+    return -errno;
+
+  int one = 1;
+  ::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(_port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (!host.empty() && inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1)
+    return -EINVAL;
+
+  if (::bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    return -errno;
+  if (::listen(listen_fd, SOCKET_BACKLOG) < 0)
+    return -errno;
+
+  socklen_t len = sizeof(addr);
+  if (::getsockname(listen_fd, (struct sockaddr *)&addr, &len) < 0)
+    return -errno;
+  port = ntohs(addr.sin_port);
+  return 0;
+}
+
+int RGWAsyncServer::start()
+{
+  for (int i = 0; i < num_loops; i++) {
+    loops.push_back(new RGWAsyncLoop(cct, dispatcher, buffer_size));
+  }
+  loops[0]->set_listener(listen_fd, &loops);
+
+  for (vector<RGWAsyncLoop *>::iterator iter = loops.begin(); iter != loops.end(); ++iter) {
+    int r = (*iter)->init();
+    if (r < 0) {
+      lderr(cct) << "ERROR: async: failed to set up event loop: " << cpp_strerror(r) << dendl;
+      return r;
+    }
+  }
+  for (vector<RGWAsyncLoop *>::iterator iter = loops.begin(); iter != loops.end(); ++iter) {
+    (*iter)->create();
+  }
+  ldout(cct, 1) << "async: listening on port " << port << " with " << num_loops
+                << " event loops" << dendl;
+  return 0;
+}
+
+void RGWAsyncServer::stop()
+{
+  vector<RGWAsyncLoop *>::iterator iter;
+  for (iter = loops.begin(); iter != loops.end(); ++iter) {
+    if ((*iter)->is_started())
+      (*iter)->stop();
+  }
+  for (iter = loops.begin(); iter != loops.end(); ++iter) {
+    if ((*iter)->is_started())
+      (*iter)->join();
+  }
+}
+
+RGWAsyncIO::RGWAsyncIO(RGWAsyncConn *_conn, int _port)
+  : conn(_conn), port(_port), header_done(false), sent_header(false),
+    has_content_length(false)
+{
+}
+
+int RGWAsyncIO::write_data(const char *buf, int len)
+{
+  if (!header_done) {
+    header_data.append(buf, len);
+    return len;
+  }
+  if (!sent_header) {
+    data.append(buf, len);
+    return len;
+  }
+  return conn->write(buf, len);
+}
+
+int RGWAsyncIO::read_data(char *buf, int len)
+{
+  return conn->read_body(buf, len);
+}
+
+void RGWAsyncIO::flush()
+{
+}
+
+int RGWAsyncIO::complete_request()
+{
+  if (!sent_header) {
+    if (!has_content_length) {
+      header_done = false; /* let's go back to writing the header */
+
+      int r = send_content_length(data.length());
+      if (r < 0)
+        return r;
+    }
+
+    complete_header();
+  }
+
+  if (data.length()) {
+    int r = write_data(data.c_str(), data.length());
+    if (r < 0)
+      return r;
+    data.clear();
+  }
+
+  return 0;
+}
+
+void RGWAsyncIO::init_env(CephContext *cct)
+{
+  env.init(cct);
+
+  /* the loop leaves the request alone while a worker has it */
+  vector<pair<string, string> >::iterator iter;
+  for (iter = conn->headers.begin(); iter != conn->headers.end(); ++iter) {
+    const string& name = iter->first;
+    const string& val = iter->second;
+
+    if (strcasecmp(name.c_str(), "content-length") == 0) {
+      env.set("CONTENT_LENGTH", val.c_str());
+      continue;
+    }
+
+    if (strcasecmp(name.c_str(), "content-type") == 0) {
+      env.set("CONTENT_TYPE", val.c_str());
+      continue;
+    }
+
+    string env_name = "HTTP_";
+    for (string::const_iterator c = name.begin(); c != name.end(); ++c) {
+      env_name.push_back(*c == '-' ? '_' : toupper(*c));
+    }
+    env.set(env_name.c_str(), val.c_str());
+  }
+
+  env.set("REQUEST_METHOD", conn->method.c_str());
+  env.set("REQUEST_URI", conn->uri.c_str());
+  env.set("QUERY_STRING", conn->query_string.c_str());
+  env.set("SCRIPT_URI", conn->uri.c_str());
+
+  char port_buf[16];
+  snprintf(port_buf, sizeof(port_buf), "%d", port);
+  env.set("SERVER_PORT", port_buf);
+}
+
+int RGWAsyncIO::send_status(const char *status, const char *status_name)
+{
+  char buf[128];
+
+  if (!status_name)
+    status_name = "";
+
+  snprintf(buf, sizeof(buf), "HTTP/1.1 %s %s\r\n", status, status_name);
+
+  bufferlist bl;
+  bl.append(buf);
+  bl.append(header_data);
+  header_data = bl;
+
+  return 0;
+}
+
+int RGWAsyncIO::send_100_continue()
+{
+  /* sent by the loop already, if the client asked for it */
+  return 0;
+}
+
+static void dump_date_header(bufferlist &out)
+{
+  char timestr[128];
+  const time_t gtime = time(NULL);
+  struct tm result;
+  struct tm const * const tmp = gmtime_r(&gtime, &result);
+
+  if (tmp == NULL)
+    return;
+
+  if (strftime(timestr, sizeof(timestr), "Date: %a, %d %b %Y %H:%M:%S %Z\r\n", tmp))
+    out.append(timestr);
+}
+
+int RGWAsyncIO::complete_header()
+{
+  header_done = true;
+
+  if (!has_content_length) {
+    return 0;
+  }
+
+  dump_date_header(header_data);
+
+  if (conn->keepalive)
+    header_data.append("Connection: Keep-Alive\r\n");
+  else
+    header_data.append("Connection: close\r\n");
+
+  header_data.append("\r\n");
+
+  sent_header = true;
+
+  return write_data(header_data.c_str(), header_data.length());
+}
+
+int RGWAsyncIO::send_content_length(uint64_t len)
+{
+  has_content_length = true;
+  char buf[21];
+  snprintf(buf, sizeof(buf), "%" PRIu64, len);
+  return print("Content-Length: %s\r\n", buf);
+}
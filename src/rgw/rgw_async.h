@@ -0,0 +1,198 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_RGW_ASYNC_H
+#define CEPH_RGW_ASYNC_H
+
+#include <list>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "include/types.h"
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "common/RefCountedObj.h"
+#include "common/Thread.h"
+#include "rgw_client_io.h"
+
+class RGWAsyncLoop;
+
+/*
+ * A client connection of the async frontend.
+ *
+ * The event loop the connection belongs to reads the requests and writes
+ * the responses without ever blocking on the client.  Once a request has
+ * its header and either all of its body or buffer_size bytes of it, it
+ * is handed to a worker thread, which reads the rest of the body from
+ * here and writes the response here as the loop moves it along.  A worker
+ * only waits on a client that is slower than the buffers: one that sends
+ * or takes more than buffer_size bytes of body.
+ */
+struct RGWAsyncConn : public RefCountedObject {
+  enum State {
+    READ_HEADER,   /* waiting for a request */
+    READ_BODY,     /* has a request, not handed to a worker yet */
+    HANDLING       /* a worker has the request */
+  };
+  enum ChunkState {
+    CHUNK_SIZE,
+    CHUNK_DATA,
+    CHUNK_DATA_END,
+    CHUNK_TRAILER
+  };
+
+  CephContext *cct;
+  int fd;
+  RGWAsyncLoop *loop;
+  uint64_t buffer_size;
+
+  Mutex lock;
+  Cond cond;
+
+  /* the request, as parsed by the loop */
+  State state;
+  string method;
+  string uri;
+  string query_string;
+  vector<pair<string, string> > headers;
+  bool keepalive;
+
+  string in;                /* read but not parsed yet */
+  bool chunked;
+  ChunkState chunk_state;
+  uint64_t body_left;       /* of the body, or of the chunk */
+  bufferlist body;          /* for the worker to read */
+  bool body_done;
+
+  bufferlist out;           /* for the loop to write */
+  bool response_done;
+  bool closed;
+  bool waiting;             /* for room in the dispatcher */
+  uint32_t events;          /* asked of epoll */
+
+  RGWAsyncConn(CephContext *_cct, int _fd, RGWAsyncLoop *_loop, uint64_t _buffer_size);
+  ~RGWAsyncConn();
+
+  /* for the worker */
+  int read_body(char *buf, int len);
+  int write(const char *buf, int len);
+  void finish();
+
+  /* for the loop, with the lock held */
+  int parse_header(const string& header);
+  int process_input();
+  int flush_out();
+  void reset();
+  uint32_t wanted_events();
+};
+
+/*
+ * Takes the requests off the loops; false to be asked again later, when
+ * there is no room for the request yet.
+ */
+class RGWAsyncDispatcher {
+public:
+  virtual ~RGWAsyncDispatcher() {}
+  virtual bool dispatch(RGWAsyncConn *conn) = 0;
+};
+
+class RGWAsyncLoop : public Thread {
+  CephContext *cct;
+  RGWAsyncDispatcher *dispatcher;
+  int epoll_fd;
+  int wake_fd[2];
+  int listen_fd;
+  vector<RGWAsyncLoop *> *peers;  /* for the loop that accepts */
+  unsigned next_peer;
+  uint64_t buffer_size;
+
+  Mutex lock;
+  bool going_down;
+  bool woken;
+  list<RGWAsyncConn *> new_conns;
+  list<RGWAsyncConn *> updated_conns;
+
+  /* only touched by the loop thread */
+  set<RGWAsyncConn *> conns;
+  list<RGWAsyncConn *> waiting;   /* for room in the dispatcher */
+
+  void wake();
+  void accept_conns();
+  void handle_io(RGWAsyncConn *conn, uint32_t ev);
+  bool update(RGWAsyncConn *conn);
+  bool try_dispatch(RGWAsyncConn *conn);
+  void close_conn(RGWAsyncConn *conn);
+
+protected:
+  void *entry();
+
+public:
+  RGWAsyncLoop(CephContext *_cct, RGWAsyncDispatcher *_dispatcher, uint64_t _buffer_size);
+  ~RGWAsyncLoop();
+
+  int init();
+  void set_listener(int fd, vector<RGWAsyncLoop *> *_peers) {
+    listen_fd = fd;
+    peers = _peers;
+  }
+  void add_conn(RGWAsyncConn *conn);
+  void conn_updated(RGWAsyncConn *conn);
+  void stop();
+};
+
+/*
+ * An HTTP server with one event loop per core (num_loops), that hands the
+ * requests to a dispatcher.
+ */
+class RGWAsyncServer {
+  CephContext *cct;
+  RGWAsyncDispatcher *dispatcher;
+  int num_loops;
+  uint64_t buffer_size;
+  int listen_fd;
+  int port;
+  vector<RGWAsyncLoop *> loops;
+
+public:
+  RGWAsyncServer(CephContext *_cct, RGWAsyncDispatcher *_dispatcher, int _num_loops,
+                 uint64_t _buffer_size);
+  ~RGWAsyncServer();
+
+  /* port 0 for any */
+  int bind(const string& host, int _port);
+  int get_port() { return port; }
+  int start();
+  void stop();
+};
+
+class RGWAsyncIO : public RGWClientIO
+{
+  RGWAsyncConn *conn;
+
+  bufferlist header_data;
+  bufferlist data;
+
+  int port;
+
+  bool header_done;
+  bool sent_header;
+  bool has_content_length;
+
+public:
+  void init_env(CephContext *cct);
+
+  int write_data(const char *buf, int len);
+  int read_data(char *buf, int len);
+
+  int send_status(const char *status, const char *status_name);
+  int send_100_continue();
+  int complete_header();
+  int complete_request();
+  int send_content_length(uint64_t len);
+
+  RGWAsyncIO(RGWAsyncConn *_conn, int _port);
+  void flush();
+};
+
+#endif
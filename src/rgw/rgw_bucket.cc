@@ -776,13 +776,14 @@ int RGWBucket::check_object_index(RGWBucketAdminOpState& op_state,
   string prefix;
   rgw_obj_key marker;
   bool is_truncated = true;
+  RGWBucketListCursor cursor;
 
   while (is_truncated) {
     map<string, RGWObjEnt> result;
 
-    int r = store->cls_bucket_list(bucket, marker, prefix, 1000, true,
+    int r = store->cls_bucket_list(bucket, marker, prefix, string(), 1000, true,
                                    result, &is_truncated, &marker,
-                                   bucket_object_check_filter);
+                                   bucket_object_check_filter, &cursor);
     if (r == -ENOENT) {
       break;
     } else if (r < 0 && r != -ENOENT) {
@@ -0,0 +1,210 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <errno.h>
+
+#include "rgw_bucket_list.h"
+
+using namespace std;
+
+/*
+ * The entries of a bucket are spread evenly over its shards by hash, so
+ * a shard is asked for twice its share of what is wanted, plus a few for
+ * small listings, which rarely runs out before the listing is done.
+ */
+#define SHARD_BATCH_EXTRA 8
+#define MAX_SHARD_BATCH (64 * 1024)
+
+RGWBucketListMerger::RGWBucketListMerger(RGWBucketListSource *_source, const set<int>& shard_ids)
+  : source(_source), started(false), need_refill(false), refill_id(0),
+    entries_fetched(0), fetches(0)
+{
+  for (set<int>::const_iterator iter = shard_ids.begin(); iter != shard_ids.end(); ++iter) {
+    shards[*iter] = Shard();
+  }
+}
+
+RGWBucketListMerger::~RGWBucketListMerger()
+{
+  drain();
+}
+
+int RGWBucketListMerger::start_fetch(int shard_id, Shard& shard)
+{
+  int r = source->aio_list(shard_id, shard.marker, shard.batch);
+  if (r < 0)
+    return r;
+  shard.pending = true;
+  fetches++;
+  return 0;
+}
+
+int RGWBucketListMerger::finish_fetch(int shard_id, Shard& shard, bool discard)
+{
+  rgw_cls_list_ret result;
+  int r = source->wait_list(shard_id, &result);
+  shard.pending = false;
+  if (r < 0 || discard)
+    return r;
+
+  map<string, rgw_bucket_dir_entry>& m = result.dir.m;
+  entries_fetched += m.size();
+  /* all of them come after what the shard still has */
+  shard.entries.insert(m.begin(), m.end());
+  shard.truncated = result.is_truncated;
+
+  if (!result.marker.empty()) {
+    shard.marker = cls_rgw_obj_key(result.marker);
+  } else if (!m.empty()) {
+    shard.marker = cls_rgw_obj_key(m.rbegin()->first);
+  } else if (shard.truncated && shard.batch < MAX_SHARD_BATCH) {
+    /* everything looked at was skipped, and the index did not say how
+     * far it got; look at more of it next time */
+    shard.batch *= 2;
+  }
+  return 0;
+}
+
+/*
+ * Make sure the shard has entries, unless it has no more, and put the
+ * first of them in the running.
+ */
+int RGWBucketListMerger::fill(int shard_id, Shard& shard)
+{
+  while (shard.entries.empty() && shard.truncated) {
+    if (!shard.pending) {
+      int r = start_fetch(shard_id, shard);
+      if (r < 0)
+        return r;
+    }
+    int r = finish_fetch(shard_id, shard, false);
+    if (r < 0)
+      return r;
+  }
+  if (!shard.entries.empty()) {
+    heads[shard.entries.begin()->first] = shard_id;
+  }
+  return 0;
+}
+
+void RGWBucketListMerger::prefetch(int shard_id, Shard& shard)
+{
+  if (shard.pending || !shard.truncated || shard.entries.size() > shard.batch / 2)
+    return;
+
+  /* on error, the fetch is tried again when the entries are needed */
+  start_fetch(shard_id, shard);
+}
+
+void RGWBucketListMerger::drain()
+{
+  for (map<int, Shard>::iterator iter = shards.begin(); iter != shards.end(); ++iter) {
+    if (iter->second.pending) {
+      finish_fetch(iter->first, iter->second, true);
+    }
+  }
+}
+
+void RGWBucketListMerger::reset(const cls_rgw_obj_key& marker)
+{
+  drain();
+  heads.clear();
+  need_refill = false;
+  for (map<int, Shard>::iterator iter = shards.begin(); iter != shards.end(); ++iter) {
+    Shard& shard = iter->second;
+    shard.entries.clear();
+    shard.marker = marker;
+    shard.truncated = true;
+  }
+}
+
+/*
+ * Drop what comes before marker.  A shard that is left with nothing was
+ * fetched up to marker at most, and goes on from marker.
+ */
+void RGWBucketListMerger::skip(const cls_rgw_obj_key& marker)
+{
+  heads.clear();
+  need_refill = false;
+  for (map<int, Shard>::iterator iter = shards.begin(); iter != shards.end(); ++iter) {
+    Shard& shard = iter->second;
+    shard.entries.erase(shard.entries.begin(), shard.entries.upper_bound(marker.name));
+    if (shard.entries.empty() && shard.truncated) {
+      if (shard.pending) {
+        finish_fetch(iter->first, shard, true);
+      }
+      shard.marker = marker;
+    }
+  }
+}
+
+int RGWBucketListMerger::seek(const cls_rgw_obj_key& marker, uint32_t max)
+{
+  if (!started) {
+    reset(marker);
+    started = true;
+  } else if (!marker.instance.empty() || marker.name < last_key) {
+    reset(marker);
+  } else if (marker.name != last_key) {
+    skip(marker);
+  }
+  last_key = marker.name;
+
+  uint32_t batch = max * 2 / shards.size() + SHARD_BATCH_EXTRA;
+  if (batch > max)
+    batch = max;
+  if (!batch)
+    batch = 1;
+
+  /* fetch from all the shards that need it at once, then wait */
+  map<int, Shard>::iterator iter;
+  for (iter = shards.begin(); iter != shards.end(); ++iter) {
+    Shard& shard = iter->second;
+    shard.batch = batch;
+    if (shard.entries.empty() && shard.truncated && !shard.pending) {
+      int r = start_fetch(iter->first, shard);
+      if (r < 0)
+        return r;
+    }
+  }
+  heads.clear();
+  need_refill = false;
+  for (iter = shards.begin(); iter != shards.end(); ++iter) {
+    int r = fill(iter->first, iter->second);
+    if (r < 0)
+      return r;
+  }
+  return 0;
+}
+
+int RGWBucketListMerger::next(string *key, rgw_bucket_dir_entry *entry, int *shard_id)
+{
+  if (need_refill) {
+    int r = fill(refill_id, shards[refill_id]);
+    if (r < 0)
+      return r;
+    need_refill = false;
+  }
+  if (heads.empty())
+    return -ENOENT;
+
+  int id = heads.begin()->second;
+  heads.erase(heads.begin());
+  Shard& shard = shards[id];
+  map<string, rgw_bucket_dir_entry>::iterator iter = shard.entries.begin();
+  *key = iter->first;
+  *entry = iter->second;
+  *shard_id = id;
+  last_key = iter->first;
+  shard.entries.erase(iter);
+
+  if (!shard.entries.empty()) {
+    heads[shard.entries.begin()->first] = id;
+  } else if (shard.truncated) {
+    /* not until the next entry is asked for, which may never be */
+    need_refill = true;
+    refill_id = id;
+  }
+  prefetch(id, shard);
+  return 0;
+}
@@ -0,0 +1,103 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_RGW_BUCKET_LIST_H
+#define CEPH_RGW_BUCKET_LIST_H
+
+#include <map>
+#include <set>
+#include <string>
+
+#include "include/types.h"
+#include "cls/rgw/cls_rgw_ops.h"
+
+/*
+ * Where the entries of the shards of a bucket index come from.  At most
+ * one listing is in flight per shard.
+ */
+class RGWBucketListSource {
+public:
+  virtual ~RGWBucketListSource() {}
+
+  /* start listing up to max entries of a shard, after marker */
+  virtual int aio_list(int shard_id, const cls_rgw_obj_key& marker, uint32_t max) = 0;
+  /* wait for the listing started on a shard */
+  virtual int wait_list(int shard_id, rgw_cls_list_ret *result) = 0;
+};
+
+/*
+ * Merge the entries of the shards of a bucket index into one listing,
+ * in order.
+ *
+ * Every shard has a cursor: the entries fetched from it that were not
+ * returned yet, and the key its next fetch starts after.  A shard is
+ * asked for about its share of the entries wanted rather than for all
+ * of them, and for more only when the merge gets to the end of what it
+ * has.  The next batch of a shard is fetched in the background while the
+ * current one is consumed.  A listing made of several seek()s, each to
+ * the last entry returned (or further on), keeps the cursors and does
+ * not fetch entries twice.
+ */
+class RGWBucketListMerger {
+  struct Shard {
+    map<string, rgw_bucket_dir_entry> entries; /* fetched, not returned yet */
+    cls_rgw_obj_key marker;  /* the next fetch starts after this */
+    uint32_t batch;          /* entries asked for per fetch */
+    bool truncated;          /* more entries after marker */
+    bool pending;            /* a fetch is in flight */
+
+    Shard() : batch(1), truncated(true), pending(false) {}
+  };
+
+  RGWBucketListSource *source;
+  map<int, Shard> shards;
+  map<string, int> heads;  /* the first entry of every shard -> shard id */
+  string last_key;         /* list index key of the last entry returned */
+  bool started;
+  bool need_refill;        /* the shard of the last entry ran out */
+  int refill_id;
+
+  uint64_t entries_fetched;
+  uint64_t fetches;
+
+  int start_fetch(int shard_id, Shard& shard);
+  int finish_fetch(int shard_id, Shard& shard, bool discard);
+  int fill(int shard_id, Shard& shard);
+  void prefetch(int shard_id, Shard& shard);
+  void reset(const cls_rgw_obj_key& marker);
+  void skip(const cls_rgw_obj_key& marker);
+  void drain();
+
+public:
+  RGWBucketListMerger(RGWBucketListSource *_source, const set<int>& shard_ids);
+  ~RGWBucketListMerger();
+
+  /*
+   * Continue the listing right after marker, with about max entries
+   * wanted from there on.  The marker may be a list index key (as the
+   * name, with no instance), which is how the listing hands them out.
+   */
+  int seek(const cls_rgw_obj_key& marker, uint32_t max);
+
+  /*
+   * Return the next entry and the list index key and shard it has; or
+   * -ENOENT at the end of the listing.
+   */
+  int next(string *key, rgw_bucket_dir_entry *entry, int *shard_id);
+
+  bool is_truncated() const {
+    return !heads.empty() || need_refill;
+  }
+  const string& get_last_key() const {
+    return last_key;
+  }
+
+  uint64_t get_entries_fetched() const {
+    return entries_fetched;
+  }
+  uint64_t get_fetches() const {
+    return fetches;
+  }
+};
+
+#endif
@@ -5,48 +5,74 @@
 
 #include <errno.h>
 
+#include "include/ceph_hash.h"
+
 #define dout_subsys ceph_subsys_rgw
 
 using namespace std;
 
+ObjectCache::~ObjectCache()
+{
+  for (vector<ObjectCacheShard *>::iterator iter = shards.begin(); iter != shards.end(); ++iter) {
+    delete *iter;
+  }
+}
+
+void ObjectCache::set_ctx(CephContext *_cct)
+{
+  cct = _cct;
+  if (!shards.empty())
+    return;
+
+  int num_shards = cct->_conf->rgw_cache_shards;
+  if (num_shards < 1)
+    num_shards = 1;
+  unsigned long max_entries = cct->_conf->rgw_cache_lru_size / num_shards;
+  if (!max_entries)
+    max_entries = 1;
+
+  for (int i = 0; i < num_shards; i++) {
+    ObjectCacheShard *shard = new ObjectCacheShard;
+    shard->max_entries = max_entries;
+    shards.push_back(shard);
+  }
+}
+
+unsigned ObjectCache::get_shard_id(const string& name)
+{
+  return ceph_str_hash_linux(name.c_str(), name.size()) % shards.size();
+}
+
+ObjectCacheShard *ObjectCache::get_shard(const string& name)
+{
+  if (shards.empty())
+    return NULL;
+  return shards[get_shard_id(name)];
+}
+
 int ObjectCache::get(string& name, ObjectCacheInfo& info, uint32_t mask, rgw_cache_entry_info *cache_info)
 {
-  RWLock::RLocker l(lock);
+  ObjectCacheShard *shard = get_shard(name);
+  if (!shard)
+    return -ENOENT;
 
-  if (!enabled) {
+  RWLock::RLocker l(shard->lock);
+
+  if (!shard->enabled) {
     return -ENOENT;
   }
 
-  map<string, ObjectCacheEntry>::iterator iter = cache_map.find(name);
-  if (iter == cache_map.end()) {
+  map<string, ObjectCacheEntry>::iterator iter = shard->cache_map.find(name);
+  if (iter == shard->cache_map.end()) {
     ldout(cct, 10) << "cache get: name=" << name << " : miss" << dendl;
     if(perfcounter) perfcounter->inc(l_rgw_cache_miss);
     return -ENOENT;
   }
 
   ObjectCacheEntry *entry = &iter->second;
+  entry->referenced.set(1);
 
-  if (lru_counter - entry->lru_promotion_ts > lru_window) {
-    ldout(cct, 20) << "cache get: touching lru, lru_counter=" << lru_counter << " promotion_ts=" << entry->lru_promotion_ts << dendl;
-    lock.unlock();
-    lock.get_write(); /* promote lock to writer */
-
-    /* need to redo this because entry might have dropped off the cache */
-    iter = cache_map.find(name);
-    if (iter == cache_map.end()) {
-      ldout(cct, 10) << "lost race! cache get: name=" << name << " : miss" << dendl;
-      if(perfcounter) perfcounter->inc(l_rgw_cache_miss);
-      return -ENOENT;
-    }
-
-    entry = &iter->second;
-    /* check again, we might have lost a race here */
-    if (lru_counter - entry->lru_promotion_ts > lru_window) {
-      touch_lru(name, *entry, iter->second.lru_iter);
-    }
-  }
-
-  ObjectCacheInfo& src = iter->second.info;
+  ObjectCacheInfo& src = entry->info;
   if ((src.flags & mask) != mask) {
     ldout(cct, 10) << "cache get: name=" << name << " : type miss (requested=" << mask << ", cached=" << src.flags << ")" << dendl;
     if(perfcounter) perfcounter->inc(l_rgw_cache_miss);
@@ -66,66 +92,89 @@ int ObjectCache::get(string& name, ObjectCacheInfo& info, uint32_t mask, rgw_cac
 
 bool ObjectCache::chain_cache_entry(list<rgw_cache_entry_info *>& cache_info_entries, RGWChainedCache::Entry *chained_entry)
 {
-  RWLock::WLocker l(lock);
-
-  if (!enabled) {
+  if (shards.empty())
     return false;
-  }
 
   list<rgw_cache_entry_info *>::iterator citer;
 
+  /* the entries may be in different shards, locked in order */
+  set<unsigned> shard_ids;
+  for (citer = cache_info_entries.begin(); citer != cache_info_entries.end(); ++citer) {
+    shard_ids.insert(get_shard_id((*citer)->cache_locator));
+  }
+  set<unsigned>::iterator siter;
+  for (siter = shard_ids.begin(); siter != shard_ids.end(); ++siter) {
+    shards[*siter]->lock.get_write();
+  }
+
   list<ObjectCacheEntry *> cache_entry_list;
+  bool valid = true;
 
   /* first verify that all entries are still valid */
   for (citer = cache_info_entries.begin(); citer != cache_info_entries.end(); ++citer) {
     rgw_cache_entry_info *cache_info = *citer;
+    ObjectCacheShard *shard = get_shard(cache_info->cache_locator);
 
     ldout(cct, 10) << "chain_cache_entry: cache_locator=" << cache_info->cache_locator << dendl;
-    map<string, ObjectCacheEntry>::iterator iter = cache_map.find(cache_info->cache_locator);
-    if (iter == cache_map.end()) {
+    if (!shard->enabled) {
+      valid = false;
+      break;
+    }
+    map<string, ObjectCacheEntry>::iterator iter = shard->cache_map.find(cache_info->cache_locator);
+    if (iter == shard->cache_map.end()) {
       ldout(cct, 20) << "chain_cache_entry: couldn't find cachce locator" << dendl;
-      return false;
+      valid = false;
+      break;
     }
 
     ObjectCacheEntry *entry = &iter->second;
 
     if (entry->gen != cache_info->gen) {
       ldout(cct, 20) << "chain_cache_entry: entry.gen (" << entry->gen << ") != cache_info.gen (" << cache_info->gen << ")" << dendl;
-      return false;
+      valid = false;
+      break;
     }
 
     cache_entry_list.push_back(entry);
   }
 
+  if (valid) {
+    chained_entry->cache->chain_cb(chained_entry->key, chained_entry->data);
 
-  chained_entry->cache->chain_cb(chained_entry->key, chained_entry->data);
+    list<ObjectCacheEntry *>::iterator liter;
 
-  list<ObjectCacheEntry *>::iterator liter;
+    for (liter = cache_entry_list.begin(); liter != cache_entry_list.end(); ++liter) {
+      ObjectCacheEntry *entry = *liter;
 
-  for (liter = cache_entry_list.begin(); liter != cache_entry_list.end(); ++liter) {
-    ObjectCacheEntry *entry = *liter;
+      entry->chained_entries.push_back(make_pair<RGWChainedCache *, string>(chained_entry->cache, chained_entry->key));
+    }
+  }
 
-    entry->chained_entries.push_back(make_pair<RGWChainedCache *, string>(chained_entry->cache, chained_entry->key));
+  for (siter = shard_ids.begin(); siter != shard_ids.end(); ++siter) {
+    shards[*siter]->lock.unlock();
   }
 
-  return true;
+  return valid;
 }
 
 void ObjectCache::put(string& name, ObjectCacheInfo& info, rgw_cache_entry_info *cache_info)
 {
-  RWLock::WLocker l(lock);
+  ObjectCacheShard *shard = get_shard(name);
+  if (!shard)
+    return;
+
+  RWLock::WLocker l(shard->lock);
 
-  if (!enabled) {
+  if (!shard->enabled) {
     return;
   }
 
   ldout(cct, 10) << "cache put: name=" << name << dendl;
-  map<string, ObjectCacheEntry>::iterator iter = cache_map.find(name);
-  if (iter == cache_map.end()) {
-    ObjectCacheEntry entry;
-    entry.lru_iter = lru.end();
-    cache_map.insert(pair<string, ObjectCacheEntry>(name, entry));
-    iter = cache_map.find(name);
+  map<string, ObjectCacheEntry>::iterator iter = shard->cache_map.find(name);
+  if (iter == shard->cache_map.end()) {
+    iter = add_entry(shard, name);
+  } else {
+    iter->second.referenced.set(1);
   }
   ObjectCacheEntry& entry = iter->second;
   ObjectCacheInfo& target = entry.info;
@@ -139,8 +188,6 @@ void ObjectCache::put(string& name, ObjectCacheInfo& info, rgw_cache_entry_info
   entry.chained_entries.clear();
   entry.gen++;
 
-  touch_lru(name, entry, entry.lru_iter);
-
   target.status = info.status;
 
   if (info.status < 0) {
@@ -189,102 +236,113 @@ void ObjectCache::put(string& name, ObjectCacheInfo& info, rgw_cache_entry_info
 
 void ObjectCache::remove(string& name)
 {
-  RWLock::WLocker l(lock);
+  ObjectCacheShard *shard = get_shard(name);
+  if (!shard)
+    return;
+
+  RWLock::WLocker l(shard->lock);
 
-  if (!enabled) {
+  if (!shard->enabled) {
     return;
   }
 
-  map<string, ObjectCacheEntry>::iterator iter = cache_map.find(name);
-  if (iter == cache_map.end())
+  map<string, ObjectCacheEntry>::iterator iter = shard->cache_map.find(name);
+  if (iter == shard->cache_map.end())
     return;
 
   ldout(cct, 10) << "removing " << name << " from cache" << dendl;
-  ObjectCacheEntry& entry = iter->second;
+  remove_entry(shard, iter);
+}
 
-  for (list<pair<RGWChainedCache *, string> >::iterator iiter = entry.chained_entries.begin();
-       iiter != entry.chained_entries.end(); ++iiter) {
-    RGWChainedCache *chained_cache = iiter->first;
-    chained_cache->invalidate(iiter->second);
-  }
+/*
+ * A new entry goes just behind the hand, so that it is the last one the
+ * hand gets to, and unreferenced: unless it is read by then, it goes on
+ * the next round.  A scan through many objects, each read once, does not
+ * push out the entries that are read over and over.
+ */
+map<string, ObjectCacheEntry>::iterator ObjectCache::add_entry(ObjectCacheShard *shard, const string& name)
+{
+  make_room(shard);
 
-  remove_lru(name, iter->second.lru_iter);
-  cache_map.erase(iter);
+  map<string, ObjectCacheEntry>::iterator iter =
+    shard->cache_map.insert(pair<string, ObjectCacheEntry>(name, ObjectCacheEntry())).first;
+  iter->second.clock_iter = shard->clock.insert(shard->hand, name);
+  ldout(cct, 10) << "adding " << name << " to cache" << dendl;
+  return iter;
 }
 
-void ObjectCache::touch_lru(string& name, ObjectCacheEntry& entry, std::list<string>::iterator& lru_iter)
+void ObjectCache::make_room(ObjectCacheShard *shard)
 {
-  while (lru_size > (size_t)cct->_conf->rgw_cache_lru_size) {
-    list<string>::iterator iter = lru.begin();
-    if ((*iter).compare(name) == 0) {
-      /*
-       * if the entry we're touching happens to be at the lru end, don't remove it,
-       * lru shrinking can wait for next time
-       */
-      break;
+  while (shard->cache_map.size() >= shard->max_entries && !shard->clock.empty()) {
+    if (shard->hand == shard->clock.end())
+      shard->hand = shard->clock.begin();
+
+    map<string, ObjectCacheEntry>::iterator iter = shard->cache_map.find(*shard->hand);
+    assert(iter != shard->cache_map.end());
+    ObjectCacheEntry& entry = iter->second;
+    if (entry.referenced.read()) {
+      /* used since the hand last came by, give it another round */
+      entry.referenced.set(0);
+      ++shard->hand;
+      continue;
     }
-    map<string, ObjectCacheEntry>::iterator map_iter = cache_map.find(*iter);
-    ldout(cct, 10) << "removing entry: name=" << *iter << " from cache LRU" << dendl;
-    if (map_iter != cache_map.end())
-      cache_map.erase(map_iter);
-    lru.pop_front();
-    lru_size--;
+    ldout(cct, 10) << "removing entry: name=" << iter->first << " from cache" << dendl;
+    remove_entry(shard, iter);
   }
+}
 
-  if (lru_iter == lru.end()) {
-    lru.push_back(name);
-    lru_size++;
-    lru_iter--;
-    ldout(cct, 10) << "adding " << name << " to cache LRU end" << dendl;
-  } else {
-    ldout(cct, 10) << "moving " << name << " to cache LRU end" << dendl;
-    lru.erase(lru_iter);
-    lru.push_back(name);
-    lru_iter = lru.end();
-    --lru_iter;
+void ObjectCache::remove_entry(ObjectCacheShard *shard, map<string, ObjectCacheEntry>::iterator iter)
+{
+  ObjectCacheEntry& entry = iter->second;
+
+  for (list<pair<RGWChainedCache *, string> >::iterator iiter = entry.chained_entries.begin();
+       iiter != entry.chained_entries.end(); ++iiter) {
+    RGWChainedCache *chained_cache = iiter->first;
+    chained_cache->invalidate(iiter->second);
   }
 
-  lru_counter++;
-  entry.lru_promotion_ts = lru_counter;
+  if (shard->hand == entry.clock_iter)
+    ++shard->hand;
+  shard->clock.erase(entry.clock_iter);
+  shard->cache_map.erase(iter);
 }
 
-void ObjectCache::remove_lru(string& name, std::list<string>::iterator& lru_iter)
+void ObjectCache::clear_shard(ObjectCacheShard *shard)
 {
-  if (lru_iter == lru.end())
-    return;
-
-  lru.erase(lru_iter);
-  lru_size--;
-  lru_iter = lru.end();
+  shard->cache_map.clear();
+  shard->clock.clear();
+  shard->hand = shard->clock.end();
 }
 
 void ObjectCache::set_enabled(bool status)
 {
-  RWLock::WLocker l(lock);
-
-  enabled = status;
+  for (vector<ObjectCacheShard *>::iterator iter = shards.begin(); iter != shards.end(); ++iter) {
+    ObjectCacheShard *shard = *iter;
+    RWLock::WLocker l(shard->lock);
+    shard->enabled = status;
+    if (!status) {
+      clear_shard(shard);
+    }
+  }
 
-  if (!enabled) {
-    do_invalidate_all();
+  if (!status) {
+    invalidate_chained();
   }
 }
 
 void ObjectCache::invalidate_all()
 {
-  RWLock::WLocker l(lock);
+  for (vector<ObjectCacheShard *>::iterator iter = shards.begin(); iter != shards.end(); ++iter) {
+    RWLock::WLocker l((*iter)->lock);
+    clear_shard(*iter);
+  }
 
-  do_invalidate_all();
+  invalidate_chained();
 }
 
-void ObjectCache::do_invalidate_all()
+void ObjectCache::invalidate_chained()
 {
-  cache_map.clear();
-  lru.clear();
-
-  lru_size = 0;
-  lru_counter = 0;
-  lru_window = 0;
-
+  RWLock::RLocker l(lock);
   for (list<RGWChainedCache *>::iterator iter = chained_cache.begin(); iter != chained_cache.end(); ++iter) {
     (*iter)->invalidate_all();
   }
@@ -294,4 +352,3 @@ void ObjectCache::chain_cache(RGWChainedCache *cache) {
   RWLock::WLocker l(lock);
   chained_cache.push_back(cache);
 }
-
@@ -5,16 +5,19 @@
 #define CEPH_RGWCACHE_H
 
 #include "rgw_rados.h"
+#include "rgw_data_cache.h"
 #include <string>
 #include <map>
 #include "include/types.h"
 #include "include/utime.h"
 #include "include/assert.h"
+#include "include/atomic.h"
 #include "common/RWLock.h"
 
 enum {
   UPDATE_OBJ,
   REMOVE_OBJ,
+  REMOVE_OBJ_DATA,  /* drop what the data cache has of a user object */
 };
 
 #define CACHE_FLAG_DATA           0x01
@@ -129,40 +132,57 @@ WRITE_CLASS_ENCODER(RGWCacheNotifyInfo)
 
 struct ObjectCacheEntry {
   ObjectCacheInfo info;
-  std::list<string>::iterator lru_iter;
-  uint64_t lru_promotion_ts;
+  std::list<string>::iterator clock_iter;
+  atomic_t referenced;  /* set on a hit, under the read lock of the shard */
   uint64_t gen;
   std::list<pair<RGWChainedCache *, string> > chained_entries;
 
-  ObjectCacheEntry() : lru_promotion_ts(0), gen(0) {}
+  ObjectCacheEntry() : referenced(0), gen(0) {}
+  ObjectCacheEntry(const ObjectCacheEntry& rhs)
+    : info(rhs.info), clock_iter(rhs.clock_iter), referenced(rhs.referenced.read()),
+      gen(rhs.gen), chained_entries(rhs.chained_entries) {}
 };
 
-class ObjectCache {
+/*
+ * The entries whose names hash to one shard of the cache.  Recency is
+ * kept CLOCK style: a hit only sets the referenced bit of the entry, so
+ * that lookups share the lock.  To make room, the hand goes around the
+ * entries, clearing the bits that are set and evicting the first entry
+ * that has it clear.
+ */
+struct ObjectCacheShard {
   std::map<string, ObjectCacheEntry> cache_map;
-  std::list<string> lru;
-  unsigned long lru_size;
-  unsigned long lru_counter;
-  unsigned long lru_window;
+  std::list<string> clock;
+  std::list<string>::iterator hand;
+  unsigned long max_entries;
+  bool enabled;
   RWLock lock;
-  CephContext *cct;
 
-  list<RGWChainedCache *> chained_cache;
+  ObjectCacheShard() : hand(clock.end()), max_entries(0), enabled(false),
+                       lock("ObjectCacheShard") {}
+};
 
-  bool enabled;
+class ObjectCache {
+  vector<ObjectCacheShard *> shards;
+  RWLock lock;  /* protects chained_cache */
+  CephContext *cct;
 
-  void touch_lru(string& name, ObjectCacheEntry& entry, std::list<string>::iterator& lru_iter);
-  void remove_lru(string& name, std::list<string>::iterator& lru_iter);
+  list<RGWChainedCache *> chained_cache;
 
-  void do_invalidate_all();
+  unsigned get_shard_id(const string& name);
+  ObjectCacheShard *get_shard(const string& name);
+  map<string, ObjectCacheEntry>::iterator add_entry(ObjectCacheShard *shard, const string& name);
+  void make_room(ObjectCacheShard *shard);
+  void remove_entry(ObjectCacheShard *shard, map<string, ObjectCacheEntry>::iterator iter);
+  void clear_shard(ObjectCacheShard *shard);
+  void invalidate_chained();
 public:
-  ObjectCache() : lru_size(0), lru_counter(0), lru_window(0), lock("ObjectCache"), cct(NULL), enabled(false) { }
+  ObjectCache() : lock("ObjectCache"), cct(NULL) { }
+  ~ObjectCache();
   int get(std::string& name, ObjectCacheInfo& bl, uint32_t mask, rgw_cache_entry_info *cache_info);
   void put(std::string& name, ObjectCacheInfo& bl, rgw_cache_entry_info *cache_info);
   void remove(std::string& name);
-  void set_ctx(CephContext *_cct) {
-    cct = _cct;
-    lru_window = cct->_conf->rgw_cache_lru_size / 2;
-  }
+  void set_ctx(CephContext *_cct);
   bool chain_cache_entry(list<rgw_cache_entry_info *>& cache_info_entries, RGWChainedCache::Entry *chained_entry);
 
   void set_enabled(bool status);
@@ -253,6 +273,8 @@ public:
   bool chain_cache_entry(list<rgw_cache_entry_info *>& cache_info_entries, RGWChainedCache::Entry *chained_entry) {
     return cache.chain_cache_entry(cache_info_entries, chained_entry);
   }
+
+  void invalidate_obj_data(rgw_obj& obj);
 };
 
 template <class T>
@@ -560,6 +582,25 @@ done:
   return 0;
 }
 
+/*
+ * The data cache is keyed by the tag the object was written with, so
+ * that it can't be read stale; the notification only frees what the
+ * other gateways hold of it sooner.  An object that this gateway did not
+ * have cached is not likely to be elsewhere, and every write would cost
+ * a notification otherwise.
+ */
+template <class T>
+void RGWCache<T>::invalidate_obj_data(rgw_obj& obj)
+{
+  if (!T::data_cache || !T::data_cache->invalidate(RGWDataCache::obj_key(obj)))
+    return;
+
+  ObjectCacheInfo info;
+  int r = distribute_cache(RGWDataCache::obj_key(obj), obj, info, REMOVE_OBJ_DATA);
+  if (r < 0)
+    mydout(0) << "ERROR: failed to distribute data cache invalidation for " << obj << dendl;
+}
+
 template <class T>
 int RGWCache<T>::distribute_cache(const string& normal_name, rgw_obj& obj, ObjectCacheInfo& obj_info, int op)
 {
@@ -594,6 +635,12 @@ int RGWCache<T>::watch_cb(uint64_t notify_id,
     return -EIO;
   }
 
+  if (info.op == REMOVE_OBJ_DATA) {
+    if (T::data_cache)
+      T::data_cache->invalidate(RGWDataCache::obj_key(info.obj));
+    return 0;
+  }
+
   rgw_bucket bucket;
   string oid;
   normalize_bucket_and_obj(info.obj.bucket, info.obj.get_object(), bucket, oid);
@@ -48,6 +48,23 @@ int rgw_perf_start(CephContext *cct)
   plb.add_u64_counter(l_rgw_cache_hit, "cache_hit", "Cache hits");
   plb.add_u64_counter(l_rgw_cache_miss, "cache_miss", "Cache miss");
 
+  plb.add_u64_counter(l_rgw_data_cache_hit, "data_cache_hit", "Data cache hits");
+  plb.add_u64_counter(l_rgw_data_cache_miss, "data_cache_miss", "Data cache miss");
+  plb.add_u64_counter(l_rgw_data_cache_file_hit, "data_cache_file_hit", "Data cache hits on file");
+  plb.add_u64_counter(l_rgw_data_cache_evict, "data_cache_evict", "Data cache evictions from RAM");
+  plb.add_u64_counter(l_rgw_data_cache_file_evict, "data_cache_file_evict", "Data cache evictions from file");
+  plb.add_u64(l_rgw_data_cache_size, "data_cache_size", "Data cache bytes in RAM");
+  plb.add_u64(l_rgw_data_cache_file_size, "data_cache_file_size", "Data cache bytes on file");
+
+  plb.add_u64_counter(l_rgw_gc_removed_objs, "gc_removed_objs", "Tail objects removed by gc");
+  plb.add_u64_counter(l_rgw_gc_removed_chains, "gc_removed_chains", "Gc entries done with");
+  plb.add_u64_counter(l_rgw_gc_failed, "gc_failed", "Gc removals failed");
+  plb.add_time_avg(l_rgw_gc_lat, "gc_lat", "Gc removal latency");
+  plb.add_u64(l_rgw_gc_window, "gc_window", "Gc removals allowed in flight");
+  plb.add_u64(l_rgw_gc_backlog_age, "gc_backlog_age", "Seconds the oldest expired gc entry waited, as of the last gc pass");
+
+  plb.add_u64_counter(l_rgw_ops_log_dropped, "ops_log_dropped", "Ops log entries dropped");
+
   plb.add_u64_counter(l_rgw_keystone_token_cache_hit, "keystone_token_cache_hit", "Keystone token cache hits");
   plb.add_u64_counter(l_rgw_keystone_token_cache_miss, "keystone_token_cache_miss", "Keystone token cache miss");
 
@@ -185,6 +185,23 @@ enum {
   l_rgw_cache_hit,
   l_rgw_cache_miss,
 
+  l_rgw_data_cache_hit,
+  l_rgw_data_cache_miss,
+  l_rgw_data_cache_file_hit,
+  l_rgw_data_cache_evict,
+  l_rgw_data_cache_file_evict,
+  l_rgw_data_cache_size,
+  l_rgw_data_cache_file_size,
+
+  l_rgw_gc_removed_objs,
+  l_rgw_gc_removed_chains,
+  l_rgw_gc_failed,
+  l_rgw_gc_lat,
+  l_rgw_gc_window,
+  l_rgw_gc_backlog_age,
+
+  l_rgw_ops_log_dropped,
+
   l_rgw_keystone_token_cache_hit,
   l_rgw_keystone_token_cache_miss,
 
@@ -768,6 +785,11 @@ struct RGWBucketInfo
     MOD = 0
   };
 
+  enum BIReshardStatus {
+    RESHARD_NONE = 0,
+    RESHARD_IN_PROGRESS = 1,
+  };
+
   rgw_bucket bucket;
   string owner;
   uint32_t flags;
@@ -791,8 +813,18 @@ struct RGWBucketInfo
   // Represents the shard number for blind bucket.
   const static uint32_t NUM_SHARDS_BLIND_BUCKET;
 
+  // Generation of the bucket index shard set; each reshard writes a new
+  // set of shard objects under the next generation.
+  uint32_t index_gen;
+
+  // While resharding, index updates are logged and mirrored into the
+  // shard set of generation index_gen + 1, which has new_num_shards
+  // shards.  See rgw_reshard.h.
+  uint8_t reshard_status;
+  uint32_t new_num_shards;
+
   void encode(bufferlist& bl) const {
-     ENCODE_START(11, 4, bl);
+     ENCODE_START(12, 4, bl);
      ::encode(bucket, bl);
      ::encode(owner, bl);
      ::encode(flags, bl);
@@ -804,6 +836,9 @@ struct RGWBucketInfo
      ::encode(quota, bl);
      ::encode(num_shards, bl);
      ::encode(bucket_index_shard_hash_type, bl);
+     ::encode(index_gen, bl);
+     ::encode(reshard_status, bl);
+     ::encode(new_num_shards, bl);
      ENCODE_FINISH(bl);
   }
   void decode(bufferlist::iterator& bl) {
@@ -830,6 +865,11 @@ struct RGWBucketInfo
        ::decode(num_shards, bl);
      if (struct_v >= 11)
        ::decode(bucket_index_shard_hash_type, bl);
+     if (struct_v >= 12) {
+       ::decode(index_gen, bl);
+       ::decode(reshard_status, bl);
+       ::decode(new_num_shards, bl);
+     }
      DECODE_FINISH(bl);
   }
   void dump(Formatter *f) const;
@@ -840,8 +880,10 @@ struct RGWBucketInfo
   bool versioned() { return (flags & BUCKET_VERSIONED) != 0; }
   int versioning_status() { return flags & (BUCKET_VERSIONED | BUCKET_VERSIONS_SUSPENDED); }
   bool versioning_enabled() { return versioning_status() == BUCKET_VERSIONED; }
+  bool resharding() const { return reshard_status == RESHARD_IN_PROGRESS; }
 
-  RGWBucketInfo() : flags(0), creation_time(0), has_instance_obj(false), num_shards(0), bucket_index_shard_hash_type(MOD) {}
+  RGWBucketInfo() : flags(0), creation_time(0), has_instance_obj(false), num_shards(0), bucket_index_shard_hash_type(MOD),
+                    index_gen(0), reshard_status(RESHARD_NONE), new_num_shards(0) {}
 };
 WRITE_CLASS_ENCODER(RGWBucketInfo)
 
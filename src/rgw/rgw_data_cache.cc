@@ -0,0 +1,345 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <errno.h>
+#include <dirent.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common/errno.h"
+#include "rgw_data_cache.h"
+
+#define dout_subsys ceph_subsys_rgw
+
+#define DATA_CACHE_FILE_PREFIX "chunk."
+
+using namespace std;
+
+RGWDataCache::RGWDataCache(CephContext *_cct)
+  : cct(_cct), lock("RGWDataCache"), size(0), file_size(0),
+    max_size(cct->_conf->rgw_data_cache_size),
+    max_file_size(cct->_conf->rgw_data_cache_path_size),
+    path(cct->_conf->rgw_data_cache_path), file_seq(0)
+{
+}
+
+RGWDataCache::~RGWDataCache()
+{
+  invalidate_all();
+}
+
+int RGWDataCache::init()
+{
+  if (path.empty())
+    return 0;
+
+  DIR *dir = opendir(path.c_str());
+  if (!dir) {
+    int r = -errno;
+    lderr(cct) << "ERROR: can't open data cache path " << path << ": " << cpp_strerror(r) << dendl;
+    return r;
+  }
+  struct dirent *de;
+  while ((de = readdir(dir)) != NULL) {
+    if (strncmp(de->d_name, DATA_CACHE_FILE_PREFIX, sizeof(DATA_CACHE_FILE_PREFIX) - 1) == 0) {
+      string name = path + "/" + de->d_name;
+      ::unlink(name.c_str());
+    }
+  }
+  closedir(dir);
+
+  ldout(cct, 1) << "data cache: " << max_size << " bytes in RAM, " << max_file_size
+                << " bytes in " << path << dendl;
+  return 0;
+}
+
+string RGWDataCache::obj_key(rgw_obj& obj)
+{
+  return obj.bucket.bucket_id + "+" + obj.get_object();
+}
+
+string RGWDataCache::file_name(uint64_t seq)
+{
+  char buf[64];
+  snprintf(buf, sizeof(buf), "/" DATA_CACHE_FILE_PREFIX "%llu", (unsigned long long)seq);
+  return path + buf;
+}
+
+void RGWDataCache::drop_chunk(Obj& obj, map<off_t, Chunk>::iterator iter, list<string> *unlinks)
+{
+  Chunk& c = iter->second;
+  if (c.in_ram) {
+    lru.erase(c.lru_iter);
+    size -= c.len;
+  }
+  if (c.on_file) {
+    file_lru.erase(c.file_lru_iter);
+    file_size -= c.len;
+    unlinks->push_back(file_name(c.file_seq));
+  }
+  /* a file still being written is removed by its writer */
+  obj.chunks.erase(iter);
+}
+
+void RGWDataCache::drop_obj(map<string, Obj>::iterator iter, list<string> *unlinks)
+{
+  Obj& obj = iter->second;
+  while (!obj.chunks.empty()) {
+    drop_chunk(obj, obj.chunks.begin(), unlinks);
+  }
+  objs.erase(iter);
+}
+
+/*
+ * Push the least recently used chunks out of RAM; to a file if there is
+ * a file tier and the chunk is not there already.
+ */
+void RGWDataCache::evict(list<FileWrite> *writes, list<string> *unlinks)
+{
+  while (size > max_size && !lru.empty()) {
+    ChunkRef ref = lru.front();
+    lru.pop_front();
+    map<string, Obj>::iterator oiter = objs.find(ref.first);
+    assert(oiter != objs.end());
+    map<off_t, Chunk>::iterator citer = oiter->second.chunks.find(ref.second);
+    assert(citer != oiter->second.chunks.end());
+    Chunk& c = citer->second;
+
+    c.in_ram = false;
+    size -= c.len;
+    if (perfcounter) perfcounter->inc(l_rgw_data_cache_evict);
+    ldout(cct, 20) << "data cache: evicting " << ref.first << " ofs=" << ref.second << " len=" << c.len << dendl;
+
+    if (!path.empty() && !c.on_file && c.len <= max_file_size) {
+      FileWrite w;
+      w.ref = ref;
+      w.seq = c.file_seq = ++file_seq;
+      w.data.claim(c.data);
+      writes->push_back(w);
+      continue;
+    }
+
+    c.data.clear();
+    if (!c.on_file) {
+      oiter->second.chunks.erase(citer);
+      if (oiter->second.chunks.empty())
+        objs.erase(oiter);
+    }
+  }
+}
+
+void RGWDataCache::evict_files(list<string> *unlinks)
+{
+  while (file_size > max_file_size && !file_lru.empty()) {
+    ChunkRef ref = file_lru.front();
+    file_lru.pop_front();
+    map<string, Obj>::iterator oiter = objs.find(ref.first);
+    assert(oiter != objs.end());
+    map<off_t, Chunk>::iterator citer = oiter->second.chunks.find(ref.second);
+    assert(citer != oiter->second.chunks.end());
+    Chunk& c = citer->second;
+
+    c.on_file = false;
+    file_size -= c.len;
+    unlinks->push_back(file_name(c.file_seq));
+    if (perfcounter) perfcounter->inc(l_rgw_data_cache_file_evict);
+
+    if (!c.in_ram) {
+      oiter->second.chunks.erase(citer);
+      if (oiter->second.chunks.empty())
+        objs.erase(oiter);
+    }
+  }
+}
+
+void RGWDataCache::write_files(list<FileWrite>& writes, list<string> *unlinks)
+{
+  for (list<FileWrite>::iterator iter = writes.begin(); iter != writes.end(); ++iter) {
+    FileWrite& w = *iter;
+    string name = file_name(w.seq);
+    int r = w.data.write_file(name.c_str(), 0600);
+    if (r < 0) {
+      ldout(cct, 0) << "ERROR: data cache: failed to write " << name << ": " << cpp_strerror(r) << dendl;
+    }
+
+    Mutex::Locker l(lock);
+    map<string, Obj>::iterator oiter = objs.find(w.ref.first);
+    map<off_t, Chunk>::iterator citer;
+    bool found = false;
+    if (oiter != objs.end()) {
+      citer = oiter->second.chunks.find(w.ref.second);
+      found = (citer != oiter->second.chunks.end() && citer->second.file_seq == w.seq);
+    }
+
+    if (found && r >= 0 && !citer->second.on_file && citer->second.len == w.data.length()) {
+      Chunk& c = citer->second;
+      c.on_file = true;
+      c.file_lru_iter = file_lru.insert(file_lru.end(), w.ref);
+      file_size += c.len;
+      evict_files(unlinks);
+    } else {
+      /* dropped or cached again while it was being written */
+      if (r >= 0)
+        unlinks->push_back(name);
+      if (found && !citer->second.in_ram && !citer->second.on_file) {
+        oiter->second.chunks.erase(citer);
+        if (oiter->second.chunks.empty())
+          objs.erase(oiter);
+      }
+    }
+    update_counters();
+  }
+}
+
+void RGWDataCache::unlink_files(list<string>& unlinks)
+{
+  for (list<string>::iterator iter = unlinks.begin(); iter != unlinks.end(); ++iter) {
+    ::unlink(iter->c_str());
+  }
+}
+
+void RGWDataCache::update_counters()
+{
+  if (perfcounter) {
+    perfcounter->set(l_rgw_data_cache_size, size);
+    perfcounter->set(l_rgw_data_cache_file_size, file_size);
+  }
+}
+
+bool RGWDataCache::get(const string& key, const string& tag, off_t ofs, uint64_t len, bufferlist *bl)
+{
+  list<string> unlinks;
+
+  lock.Lock();
+  map<string, Obj>::iterator oiter = objs.find(key);
+  if (oiter == objs.end() || oiter->second.tag != tag) {
+    if (oiter != objs.end()) {
+      ldout(cct, 10) << "data cache: " << key << " was rewritten, dropping it" << dendl;
+      drop_obj(oiter, &unlinks);
+      update_counters();
+    }
+    lock.Unlock();
+    unlink_files(unlinks);
+    if (perfcounter) perfcounter->inc(l_rgw_data_cache_miss);
+    return false;
+  }
+
+  map<off_t, Chunk>::iterator citer = oiter->second.chunks.find(ofs);
+  if (citer == oiter->second.chunks.end() || citer->second.len < len ||
+      (!citer->second.in_ram && !citer->second.on_file)) {
+    lock.Unlock();
+    if (perfcounter) perfcounter->inc(l_rgw_data_cache_miss);
+    return false;
+  }
+
+  Chunk& c = citer->second;
+  if (c.in_ram) {
+    lru.splice(lru.end(), lru, c.lru_iter);
+    bl->substr_of(c.data, 0, len);
+    lock.Unlock();
+    ldout(cct, 20) << "data cache: hit " << key << " ofs=" << ofs << " len=" << len << dendl;
+    if (perfcounter) perfcounter->inc(l_rgw_data_cache_hit);
+    return true;
+  }
+
+  file_lru.splice(file_lru.end(), file_lru, c.file_lru_iter);
+  string name = file_name(c.file_seq);
+  lock.Unlock();
+
+  bufferlist fbl;
+  string err;
+  int r = fbl.read_file(name.c_str(), &err);
+  if (r < 0 || fbl.length() < len) {
+    /* dropped in the meantime */
+    if (perfcounter) perfcounter->inc(l_rgw_data_cache_miss);
+    return false;
+  }
+  bl->substr_of(fbl, 0, len);
+  ldout(cct, 20) << "data cache: file hit " << key << " ofs=" << ofs << " len=" << len << dendl;
+  if (perfcounter) {
+    perfcounter->inc(l_rgw_data_cache_hit);
+    perfcounter->inc(l_rgw_data_cache_file_hit);
+  }
+
+  /* it is read again, back to RAM with it */
+  put(key, tag, ofs, fbl);
+  return true;
+}
+
+void RGWDataCache::put(const string& key, const string& tag, off_t ofs, bufferlist& bl)
+{
+  if (!bl.length() || bl.length() > max_size)
+    return;
+
+  list<FileWrite> writes;
+  list<string> unlinks;
+
+  lock.Lock();
+  map<string, Obj>::iterator oiter = objs.find(key);
+  if (oiter != objs.end() && oiter->second.tag != tag) {
+    drop_obj(oiter, &unlinks);
+    oiter = objs.end();
+  }
+  if (oiter == objs.end()) {
+    oiter = objs.insert(make_pair(key, Obj())).first;
+    oiter->second.tag = tag;
+  }
+
+  Chunk& c = oiter->second.chunks[ofs];
+  if (c.on_file && c.len != bl.length()) {
+    file_lru.erase(c.file_lru_iter);
+    file_size -= c.len;
+    unlinks.push_back(file_name(c.file_seq));
+    c.on_file = false;
+  }
+  if (c.in_ram) {
+    lru.erase(c.lru_iter);
+    size -= c.len;
+  }
+  c.data = bl;
+  c.len = bl.length();
+  c.in_ram = true;
+  c.lru_iter = lru.insert(lru.end(), ChunkRef(key, ofs));
+  size += c.len;
+  ldout(cct, 20) << "data cache: put " << key << " ofs=" << ofs << " len=" << c.len << dendl;
+
+  evict(&writes, &unlinks);
+  update_counters();
+  lock.Unlock();
+
+  write_files(writes, &unlinks);
+  unlink_files(unlinks);
+}
+
+bool RGWDataCache::invalidate(const string& key)
+{
+  list<string> unlinks;
+
+  lock.Lock();
+  map<string, Obj>::iterator iter = objs.find(key);
+  if (iter == objs.end()) {
+    lock.Unlock();
+    return false;
+  }
+  ldout(cct, 10) << "data cache: invalidating " << key << dendl;
+  drop_obj(iter, &unlinks);
+  update_counters();
+  lock.Unlock();
+
+  unlink_files(unlinks);
+  return true;
+}
+
+void RGWDataCache::invalidate_all()
+{
+  list<string> unlinks;
+
+  lock.Lock();
+  while (!objs.empty()) {
+    drop_obj(objs.begin(), &unlinks);
+  }
+  update_counters();
+  lock.Unlock();
+
+  unlink_files(unlinks);
+}
@@ -0,0 +1,100 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_RGW_DATA_CACHE_H
+#define CEPH_RGW_DATA_CACHE_H
+
+#include <list>
+#include <map>
+#include <string>
+
+#include "include/types.h"
+#include "common/Mutex.h"
+#include "rgw_common.h"
+
+/*
+ * A cache of the data of objects, by chunk, as read by get_obj_iterate().
+ *
+ * An object is cached under its name and the tag it was written with.
+ * Whatever is cached for another tag is dropped when a newer one is seen,
+ * so that a rewritten object never reads back as the old data, whether
+ * or not the invalidation from the gateway that rewrote it got here.
+ *
+ * Chunks are kept in RAM up to rgw_data_cache_size bytes, the least
+ * recently used going first.  With rgw_data_cache_path set, chunks pushed
+ * out of RAM are written to files there, up to rgw_data_cache_path_size
+ * bytes, and read back on a hit.  Files are written and read without the
+ * lock held.
+ */
+class RGWDataCache {
+  typedef pair<string, off_t> ChunkRef;
+
+  struct Chunk {
+    bufferlist data;        /* in RAM, if in_ram */
+    uint64_t len;
+    bool in_ram;
+    bool on_file;
+    uint64_t file_seq;      /* name of the file, if on_file or being written */
+    std::list<ChunkRef>::iterator lru_iter;
+    std::list<ChunkRef>::iterator file_lru_iter;
+
+    Chunk() : len(0), in_ram(false), on_file(false), file_seq(0) {}
+  };
+
+  struct Obj {
+    string tag;
+    map<off_t, Chunk> chunks;
+  };
+
+  struct FileWrite {
+    ChunkRef ref;
+    uint64_t seq;
+    bufferlist data;
+  };
+
+  CephContext *cct;
+  Mutex lock;
+  map<string, Obj> objs;
+  std::list<ChunkRef> lru;       /* chunks in RAM, least recently used first */
+  std::list<ChunkRef> file_lru;  /* chunks on file */
+  uint64_t size;
+  uint64_t file_size;
+  uint64_t max_size;
+  uint64_t max_file_size;
+  string path;
+  uint64_t file_seq;
+
+  string file_name(uint64_t seq);
+  void drop_chunk(Obj& obj, map<off_t, Chunk>::iterator iter, list<string> *unlinks);
+  void drop_obj(map<string, Obj>::iterator iter, list<string> *unlinks);
+  void evict(list<FileWrite> *writes, list<string> *unlinks);
+  void evict_files(list<string> *unlinks);
+  void write_files(list<FileWrite>& writes, list<string> *unlinks);
+  void unlink_files(list<string>& unlinks);
+  void update_counters();
+
+public:
+  RGWDataCache(CephContext *_cct);
+  ~RGWDataCache();
+
+  /* set up the file tier, clearing what an earlier run left there */
+  int init();
+
+  /* the name an object is cached under */
+  static string obj_key(rgw_obj& obj);
+
+  /*
+   * Get len bytes of the object at ofs, if a chunk that starts there and
+   * has that many is cached for tag.
+   */
+  bool get(const string& key, const string& tag, off_t ofs, uint64_t len, bufferlist *bl);
+
+  /* cache bl as the chunk of the object at ofs */
+  void put(const string& key, const string& tag, off_t ofs, bufferlist& bl);
+
+  /* drop what is cached for the object; true if there was anything */
+  bool invalidate(const string& key);
+  void invalidate_all();
+};
+
+#endif
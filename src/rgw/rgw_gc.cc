@@ -8,6 +8,7 @@
 #include "cls/lock/cls_lock_client.h"
 #include "auth/Crypto.h"
 
+#include <algorithm>
 #include <list>
 
 #define dout_subsys ceph_subsys_rgw
@@ -91,6 +92,14 @@ int RGWGC::remove(int index, const std::list<string>& tags)
   return store->gc_operate(obj_names[index], &op);
 }
 
+/* the marker gc_list takes: the time key of the last entry listed */
+static void get_marker(const cls_rgw_gc_obj_info& info, string *marker)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%011llu.%09u", (unsigned long long)info.time.sec(), info.time.nsec());
+  *marker = buf;
+}
+
 int RGWGC::list(int *index, string& marker, uint32_t max, bool expired_only, std::list<cls_rgw_gc_obj_info>& result, bool *truncated)
 {
   result.clear();
@@ -110,6 +119,8 @@ int RGWGC::list(int *index, string& marker, uint32_t max, bool expired_only, std
 
     if (*index == cct->_conf->rgw_gc_max_objs - 1) {
       /* we cut short here, truncated will hold the correct value */
+      if (!entries.empty())
+        get_marker(entries.back(), &marker);
       return 0;
     }
 
@@ -118,6 +129,12 @@ int RGWGC::list(int *index, string& marker, uint32_t max, bool expired_only, std
        * anything, in this case truncated should have been false, but we can find
        * that out on the next iteration
        */
+      if (*truncated)
+        get_marker(entries.back(), &marker);
+      else {
+        (*index)++;
+        marker.clear();
+      }
       *truncated = true;
       return 0;
     }
@@ -128,11 +145,332 @@ int RGWGC::list(int *index, string& marker, uint32_t max, bool expired_only, std
   return 0;
 }
 
-int RGWGC::process(int index, int max_secs)
+void RGWGCShardStats::dump(Formatter *f) const
+{
+  f->dump_int("index", index);
+  f->dump_unsigned("entries", entries);
+  f->dump_unsigned("expired", expired);
+  f->dump_unsigned("objs", objs);
+  f->dump_stream("oldest_expired") << oldest_expired;
+}
+
+int RGWGC::get_stats(int index, RGWGCShardStats *stats)
+{
+  utime_t now = ceph_clock_now(cct);
+  string marker;
+  bool truncated;
+
+  stats->index = index;
+  do {
+    std::list<cls_rgw_gc_obj_info> entries;
+    int ret = cls_rgw_gc_list(store->gc_pool_ctx, obj_names[index], marker, 1000, false, entries, &truncated);
+    if (ret == -ENOENT)
+      return 0;
+    if (ret < 0)
+      return ret;
+    if (entries.empty())
+      break;
+
+    std::list<cls_rgw_gc_obj_info>::iterator iter;
+    for (iter = entries.begin(); iter != entries.end(); ++iter) {
+      cls_rgw_gc_obj_info& info = *iter;
+      stats->entries++;
+      stats->objs += info.chain.objs.size();
+      if (info.time <= now) {
+        stats->expired++;
+        if (stats->oldest_expired.is_zero() || info.time < stats->oldest_expired)
+          stats->oldest_expired = info.time;
+      }
+    }
+    get_marker(entries.back(), &marker);
+  } while (truncated);
+
+  return 0;
+}
+
+RGWGCThrottle::RGWGCThrottle(CephContext *_cct, int _max_window, const utime_t& _slow)
+  : cct(_cct), lock("RGWGCThrottle"),
+    max_window(_max_window < 1 ? 1 : _max_window), window(max_window),
+    in_flight(0), done_in_window(0), skip_cuts(0), slow(_slow)
+{
+  if (perfcounter)
+    perfcounter->set(l_rgw_gc_window, window);
+}
+
+void RGWGCThrottle::get()
+{
+  Mutex::Locker l(lock);
+  while (in_flight >= window)
+    cond.Wait(lock);
+  in_flight++;
+}
+
+void RGWGCThrottle::put(int r, const utime_t& lat)
+{
+  Mutex::Locker l(lock);
+  assert(in_flight > 0);
+  in_flight--;
+
+  bool loaded = (r < 0 || (!slow.is_zero() && lat > slow));
+  if (skip_cuts > 0) {
+    /* issued at the old window, it tells nothing about the new one */
+    skip_cuts--;
+  } else if (loaded) {
+    if (window > 1) {
+      window /= 2;
+      ldout(cct, 5) << "gc: removal took " << lat << " r=" << r << ", window down to " << window << dendl;
+    }
+    done_in_window = 0;
+    skip_cuts = in_flight;
+  } else if (++done_in_window >= window) {
+    done_in_window = 0;
+    if (window < max_window)
+      window++;
+  }
+
+  if (perfcounter)
+    perfcounter->set(l_rgw_gc_window, window);
+  cond.SignalAll();
+}
+
+int RGWGCThrottle::get_window()
+{
+  Mutex::Locker l(lock);
+  return window;
+}
+
+static void gc_aio_completion_cb(completion_t c, void *arg);
+
+/*
+ * Removes the tail objects of the expired entries of a gc shard, with as
+ * many removals in flight as the throttle allows.  The removals of a page
+ * of entries are issued in pool and placement group order, so that those
+ * that go to the same PG go out together; an entry is done with once all
+ * of its objects are gone.
+ */
+class RGWGCShardProcessor {
+  struct Chain {
+    string tag;
+    int pending;
+    bool failed;
+
+    Chain(const string& _tag, int _pending) : tag(_tag), pending(_pending), failed(false) {}
+  };
+
+  struct Removal {
+    string pool;
+    uint32_t pg;
+    string loc;
+    string oid;
+    std::list<Chain>::iterator chain;
+
+    bool operator<(const Removal& r) const {
+      if (pool != r.pool)
+        return pool < r.pool;
+      return pg < r.pg;
+    }
+  };
+
+public:
+  struct IO {
+    CephContext *cct;
+    RGWGCThrottle *throttle;
+    librados::AioCompletion *c;
+    utime_t start;
+    std::list<Chain>::iterator chain;
+    string pool;
+    string oid;
+  };
+
+private:
+  CephContext *cct;
+  RGWGC *gc;
+  RGWRados *store;
+  int index;
+  RGWGCThrottle *throttle;
+  utime_t end;
+
+  map<string, librados::IoCtx> ctxs;
+  std::list<Chain> chains;
+  std::list<IO *> ios;
+  std::list<string> remove_tags;
+
+  librados::IoCtx *get_ctx(const string& pool) {
+    map<string, librados::IoCtx>::iterator iter = ctxs.find(pool);
+    if (iter != ctxs.end())
+      return &iter->second;
+    librados::IoCtx& ctx = ctxs[pool];
+    int ret = store->get_rados_handle()->ioctx_create(pool.c_str(), ctx);
+    if (ret < 0) {
+      ldout(cct, 0) << "ERROR: failed to create ioctx pool=" << pool << dendl;
+      ctxs.erase(pool);
+      return NULL;
+    }
+    return &ctx;
+  }
+
+  void flush_tags(bool all) {
+#define MAX_REMOVE_CHUNK 16
+    if (remove_tags.empty() || (!all && remove_tags.size() <= MAX_REMOVE_CHUNK))
+      return;
+    int ret = gc->remove(index, remove_tags);
+    if (ret < 0) {
+      ldout(cct, 0) << "ERROR: failed to remove gc entries: ret=" << ret << dendl;
+    } else if (perfcounter) {
+      perfcounter->inc(l_rgw_gc_removed_chains, remove_tags.size());
+    }
+    remove_tags.clear();
+  }
+
+  void chain_done(std::list<Chain>::iterator chain) {
+    if (!chain->failed)
+      remove_tags.push_back(chain->tag);
+    chains.erase(chain);
+    flush_tags(false);
+  }
+
+  void complete(IO *io) {
+    io->c->wait_for_complete_and_cb();
+    int ret = io->c->get_return_value();
+    io->c->release();
+    if (ret == -ENOENT)
+      ret = 0;
+    if (ret < 0) {
+      ldout(cct, 0) << "failed to remove " << io->pool << ":" << io->oid << " ret=" << ret << dendl;
+      io->chain->failed = true;
+    }
+    if (perfcounter)
+      perfcounter->inc(ret < 0 ? l_rgw_gc_failed : l_rgw_gc_removed_objs);
+    if (--io->chain->pending == 0)
+      chain_done(io->chain);
+    delete io;
+  }
+
+  /* all of them if wait, the ones that are done otherwise */
+  void reap(bool wait) {
+    std::list<IO *>::iterator iter = ios.begin();
+    while (iter != ios.end()) {
+      IO *io = *iter;
+      if (!wait && !io->c->is_complete_and_cb()) {
+        ++iter;
+        continue;
+      }
+      ios.erase(iter++);
+      complete(io);
+    }
+  }
+
+  bool stopping() {
+    return gc->going_down() || ceph_clock_now(cct) >= end;
+  }
+
+  int issue(Removal& r) {
+    librados::IoCtx *ctx = get_ctx(r.pool);
+    if (!ctx)
+      return -ENOENT;
+
+    ldout(cct, 10) << "gc::process: removing " << r.pool << ":" << r.oid << dendl;
+
+    IO *io = new IO;
+    io->cct = cct;
+    io->throttle = throttle;
+    io->chain = r.chain;
+    io->pool = r.pool;
+    io->oid = r.oid;
+
+    throttle->get();
+    io->start = ceph_clock_now(cct);
+    io->c = librados::Rados::aio_create_completion(io, gc_aio_completion_cb, NULL);
+
+    librados::ObjectWriteOperation op;
+    cls_refcount_put(op, r.chain->tag, true);
+    ctx->locator_set_key(r.loc);
+    int ret = ctx->aio_operate(r.oid, io->c, &op);
+    if (ret < 0) {
+      throttle->put(ret, utime_t());
+      io->c->release();
+      delete io;
+      return ret;
+    }
+    ios.push_back(io);
+    return 0;
+  }
+
+public:
+  RGWGCShardProcessor(CephContext *_cct, RGWGC *_gc, RGWRados *_store, int _index,
+                      RGWGCThrottle *_throttle, const utime_t& _end)
+    : cct(_cct), gc(_gc), store(_store), index(_index), throttle(_throttle), end(_end) {}
+
+  ~RGWGCShardProcessor() {
+    /* chains left had removals that were never issued, their tags stay */
+    reap(true);
+    flush_tags(true);
+  }
+
+  /* false once it should stop */
+  bool process(std::list<cls_rgw_gc_obj_info>& entries) {
+    vector<Removal> removals;
+    std::list<cls_rgw_gc_obj_info>::iterator iter;
+    for (iter = entries.begin(); iter != entries.end(); ++iter) {
+      cls_rgw_gc_obj_info& info = *iter;
+      std::list<Chain>::iterator chain = chains.insert(chains.end(), Chain(info.tag, info.chain.objs.size()));
+      if (info.chain.objs.empty()) {
+        chain_done(chain);
+        continue;
+      }
+
+      std::list<cls_rgw_obj>::iterator liter;
+      for (liter = info.chain.objs.begin(); liter != info.chain.objs.end(); ++liter) {
+        cls_rgw_obj& obj = *liter;
+        rgw_obj key_obj;
+        key_obj.set_obj(obj.key.name);
+        key_obj.set_instance(obj.key.instance);
+
+        Removal r;
+        r.pool = obj.pool;
+        r.loc = obj.loc;
+        r.oid = key_obj.get_object();
+        r.chain = chain;
+        librados::IoCtx *ctx = get_ctx(obj.pool);
+        r.pg = (ctx ? ctx->get_object_pg_hash_position(r.loc.empty() ? r.oid : r.loc) : 0);
+        removals.push_back(r);
+      }
+    }
+
+    std::stable_sort(removals.begin(), removals.end());
+
+    for (vector<Removal>::iterator riter = removals.begin(); riter != removals.end(); ++riter) {
+      if (stopping()) // leave early, even if tags aren't removed, it's ok
+        return false;
+      int ret = issue(*riter);
+      if (ret < 0) {
+        riter->chain->failed = true;
+        if (--riter->chain->pending == 0)
+          chain_done(riter->chain);
+      }
+      reap(false);
+    }
+    return !stopping();
+  }
+};
+
+static void gc_aio_completion_cb(completion_t c, void *arg)
+{
+  RGWGCShardProcessor::IO *io = (RGWGCShardProcessor::IO *)arg;
+  int r = rados_aio_get_return_value(c);
+  if (r == -ENOENT)
+    r = 0;
+  utime_t lat = ceph_clock_now(io->cct);
+  lat -= io->start;
+  if (perfcounter)
+    perfcounter->tinc(l_rgw_gc_lat, lat);
+  io->throttle->put(r, lat);
+}
+
+int RGWGC::process(int index, int max_secs, RGWGCThrottle *throttle, utime_t *oldest_expired)
 {
   rados::cls::lock::Lock l(gc_index_lock_name);
   utime_t end = ceph_clock_now(g_ceph_context);
-  std::list<string> remove_tags;
 
   /* max_secs should be greater than zero. We don't want a zero max_secs
    * to be translated as no timeout, since we'd then need to break the
@@ -153,103 +491,119 @@ int RGWGC::process(int index, int max_secs)
   if (ret < 0)
     return ret;
 
-  string marker;
-  bool truncated;
-  IoCtx *ctx = new IoCtx;
-  do {
-    int max = 100;
-    std::list<cls_rgw_gc_obj_info> entries;
-    ret = cls_rgw_gc_list(store->gc_pool_ctx, obj_names[index], marker, max, true, entries, &truncated);
-    if (ret == -ENOENT) {
-      ret = 0;
-      goto done;
-    }
-    if (ret < 0)
-      goto done;
-
-    string last_pool;
-    std::list<cls_rgw_gc_obj_info>::iterator iter;
-    for (iter = entries.begin(); iter != entries.end(); ++iter) {
-      bool remove_tag;
-      cls_rgw_gc_obj_info& info = *iter;
-      std::list<cls_rgw_obj>::iterator liter;
-      cls_rgw_obj_chain& chain = info.chain;
-
-      utime_t now = ceph_clock_now(g_ceph_context);
-      if (now >= end)
-        goto done;
-
-      remove_tag = true;
-      for (liter = chain.objs.begin(); liter != chain.objs.end(); ++liter) {
-        cls_rgw_obj& obj = *liter;
-
-        if (obj.pool != last_pool) {
-          delete ctx;
-          ctx = new IoCtx;
-	  ret = store->get_rados_handle()->ioctx_create(obj.pool.c_str(), *ctx);
-	  if (ret < 0) {
-	    dout(0) << "ERROR: failed to create ioctx pool=" << obj.pool << dendl;
-	    continue;
-	  }
-          last_pool = obj.pool;
-        }
-
-        ctx->locator_set_key(obj.loc);
-        rgw_obj key_obj;
-        key_obj.set_obj(obj.key.name);
-        key_obj.set_instance(obj.key.instance);
-
-	dout(0) << "gc::process: removing " << obj.pool << ":" << key_obj.get_object() << dendl;
-	ObjectWriteOperation op;
-	cls_refcount_put(op, info.tag, true);
-        ret = ctx->operate(key_obj.get_object(), &op);
-	if (ret == -ENOENT)
-	  ret = 0;
-        if (ret < 0) {
-          remove_tag = false;
-          dout(0) << "failed to remove " << obj.pool << ":" << key_obj.get_object() << "@" << obj.loc << dendl;
-        }
-
-        if (going_down()) // leave early, even if tag isn't removed, it's ok
-          goto done;
-      }
-      if (remove_tag) {
-        remove_tags.push_back(info.tag);
-#define MAX_REMOVE_CHUNK 16
-        if (remove_tags.size() > MAX_REMOVE_CHUNK) {
-          RGWGC::remove(index, remove_tags);
-          remove_tags.clear();
-        }
-      }
-    }
-  } while (truncated);
+  {
+    RGWGCShardProcessor processor(cct, this, store, index, throttle, end);
+    string marker;
+    bool truncated;
+    do {
+      int max = 100;
+      std::list<cls_rgw_gc_obj_info> entries;
+      ret = cls_rgw_gc_list(store->gc_pool_ctx, obj_names[index], marker, max, true, entries, &truncated);
+      if (ret == -ENOENT || entries.empty())
+        break;
+      if (ret < 0)
+        break;
+
+      if (marker.empty())
+        *oldest_expired = entries.front().time;
+      get_marker(entries.back(), &marker);
+
+      if (!processor.process(entries))
+        break;
+    } while (truncated);
+  }
 
-done:
-  if (!remove_tags.empty())
-    RGWGC::remove(index, remove_tags);
   l.unlock(&store->gc_pool_ctx, obj_names[index]);
-  delete ctx;
   return 0;
 }
 
+/*
+ * A gc pass: each thread takes the next shard there is, until there are no
+ * more.  They share the throttle, and so the window of removals.
+ */
+struct RGWGCPass {
+  RGWGC *gc;
+  RGWGCThrottle throttle;
+  int max_objs;
+  int max_secs;
+  unsigned start;
+  atomic_t next;
+
+  Mutex lock;
+  int ret;
+  utime_t oldest_expired;
+
+  RGWGCPass(CephContext *cct, RGWGC *_gc, int _max_objs, unsigned _start)
+    : gc(_gc),
+      throttle(cct, cct->_conf->rgw_gc_max_concurrent_io,
+               utime_t(cct->_conf->rgw_gc_slow_io_ms / 1000,
+                       (cct->_conf->rgw_gc_slow_io_ms % 1000) * 1000000)),
+      max_objs(_max_objs), max_secs(cct->_conf->rgw_gc_processor_max_time),
+      start(_start), lock("RGWGCPass"), ret(0) {}
+};
+
+class RGWGCPassThread : public Thread {
+  RGWGCPass *pass;
+
+public:
+  RGWGCPassThread(RGWGCPass *_pass) : pass(_pass) {}
+
+  void *entry() {
+    while (!pass->gc->going_down()) {
+      int i = pass->next.inc() - 1;
+      if (i >= pass->max_objs)
+        break;
+      int index = (i + pass->start) % pass->max_objs;
+      utime_t oldest;
+      int r = pass->gc->process(index, pass->max_secs, &pass->throttle, &oldest);
+
+      Mutex::Locker l(pass->lock);
+      if (r < 0 && pass->ret == 0)
+        pass->ret = r;
+      if (!oldest.is_zero() &&
+          (pass->oldest_expired.is_zero() || oldest < pass->oldest_expired))
+        pass->oldest_expired = oldest;
+    }
+    return NULL;
+  }
+};
+
 int RGWGC::process()
 {
-  int max_objs = cct->_conf->rgw_gc_max_objs;
-  int max_secs = cct->_conf->rgw_gc_processor_max_time;
-
   unsigned start;
   int ret = get_random_bytes((char *)&start, sizeof(start));
   if (ret < 0)
     return ret;
 
-  for (int i = 0; i < max_objs; i++) {
-    int index = (i + start) % max_objs;
-    ret = process(index, max_secs);
-    if (ret < 0)
-      return ret;
+  RGWGCPass pass(cct, this, max_objs, start);
+
+  int num_threads = cct->_conf->rgw_gc_processor_threads;
+  if (num_threads > max_objs)
+    num_threads = max_objs;
+  if (num_threads < 1)
+    num_threads = 1;
+
+  vector<RGWGCPassThread *> threads;
+  for (int i = 0; i < num_threads; i++) {
+    RGWGCPassThread *thread = new RGWGCPassThread(&pass);
+    thread->create();
+    threads.push_back(thread);
+  }
+  for (vector<RGWGCPassThread *>::iterator iter = threads.begin(); iter != threads.end(); ++iter) {
+    (*iter)->join();
+    delete *iter;
   }
 
-  return 0;
+  if (perfcounter) {
+    utime_t age;
+    if (!pass.oldest_expired.is_zero()) {
+      age = ceph_clock_now(cct);
+      age -= pass.oldest_expired;
+    }
+    perfcounter->set(l_rgw_gc_backlog_age, age.sec());
+  }
+
+  return pass.ret;
 }
 
 bool RGWGC::going_down()
@@ -15,6 +15,45 @@
 #include "rgw_rados.h"
 #include "cls/rgw/cls_rgw_types.h"
 
+/*
+ * Bounds the tail object removals the gc has in flight, over all the
+ * shards it is processing.  The window starts at its maximum, halves when
+ * a removal fails or takes longer than the slow threshold, and grows back
+ * by one for every window's worth of removals that complete quickly, so
+ * the gc backs off while the cluster is loaded.
+ */
+class RGWGCThrottle {
+  CephContext *cct;
+  Mutex lock;
+  Cond cond;
+  int max_window;
+  int window;
+  int in_flight;
+  int done_in_window;   /* fast completions since the window last changed */
+  int skip_cuts;        /* issued before the last cut, can't cut again */
+  utime_t slow;
+
+public:
+  RGWGCThrottle(CephContext *_cct, int _max_window, const utime_t& _slow);
+
+  /* waits for room in the window */
+  void get();
+  void put(int r, const utime_t& lat);
+  int get_window();
+};
+
+struct RGWGCShardStats {
+  int index;
+  uint64_t entries;
+  uint64_t expired;
+  uint64_t objs;
+  utime_t oldest_expired;   /* zero if none expired */
+
+  RGWGCShardStats() : index(0), entries(0), expired(0), objs(0) {}
+
+  void dump(Formatter *f) const;
+};
+
 class RGWGC {
   CephContext *cct;
   RGWRados *store;
@@ -54,7 +93,9 @@ public:
 
   int list(int *index, string& marker, uint32_t max, bool expired_only, std::list<cls_rgw_gc_obj_info>& result, bool *truncated);
   void list_init(int *index) { *index = 0; }
-  int process(int index, int process_max_secs);
+  int get_stats(int index, RGWGCShardStats *stats);
+  int get_max_objs() { return max_objs; }
+  int process(int index, int process_max_secs, RGWGCThrottle *throttle, utime_t *oldest_expired);
   int process();
 
   bool going_down();
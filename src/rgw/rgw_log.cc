@@ -2,7 +2,9 @@
 // vim: ts=8 sw=2 smarttab
 
 #include "common/Clock.h"
-#include "common/Timer.h"
+#include "common/Cond.h"
+#include "common/Mutex.h"
+#include "common/Thread.h"
 #include "common/utf8.h"
 #include "common/OutputDataSocket.h"
 #include "common/Formatter.h"
@@ -81,76 +83,137 @@ string render_log_object_name(const string& format,
 }
 
 /* usage logger */
-class UsageLogger {
+class UsageLogger : public Thread {
   CephContext *cct;
   RGWRados *store;
-  map<rgw_user_bucket, RGWUsageBatch> usage_map;
-  Mutex lock;
-  int32_t num_entries;
-  Mutex timer_lock;
-  SafeTimer timer;
-  utime_t round_timestamp;
-
-  class C_UsageLogTimeout : public Context {
-    UsageLogger *logger;
-  public:
-    C_UsageLogTimeout(UsageLogger *_l) : logger(_l) {}
-    void finish(int r) {
-      logger->flush();
-      logger->set_timer();
-    }
+
+  /*
+   * The request threads aggregate into shards of their own, one thread
+   * to a shard as long as there are no more threads than shards, so a
+   * thread only ever contends for its shard's lock with the flush, and
+   * that only holds it for as long as it takes to swap the map out.
+   */
+  struct Shard {
+    Mutex lock;
+    map<rgw_user_bucket, RGWUsageBatch> usage_map;
+    utime_t round_timestamp;
+
+    Shard() : lock("UsageLogger::Shard") {}
   };
+  vector<Shard *> shards;
+  pthread_key_t shard_key;
+  atomic_t next_shard;
+  atomic_t num_entries;
 
-  void set_timer() {
-    timer.add_event_after(cct->_conf->rgw_usage_log_tick_interval, new C_UsageLogTimeout(this));
+  Mutex lock;
+  Cond cond;
+  bool going_down;
+  bool need_flush;
+
+  Shard *get_shard() {
+    void *p = pthread_getspecific(shard_key);
+    if (p)
+      return (Shard *)p;
+    Shard *shard = shards[(next_shard.inc() - 1) % shards.size()];
+    pthread_setspecific(shard_key, shard);
+    return shard;
   }
+
+protected:
+  void *entry() {
+    lock.Lock();
+    while (!going_down) {
+      if (!need_flush)
+        cond.WaitInterval(cct, lock, utime_t(cct->_conf->rgw_usage_log_tick_interval, 0));
+      need_flush = false;
+      lock.Unlock();
+      flush();
+      lock.Lock();
+    }
+    lock.Unlock();
+    return NULL;
+  }
+
 public:
 
-  UsageLogger(CephContext *_cct, RGWRados *_store) : cct(_cct), store(_store), lock("UsageLogger"), num_entries(0), timer_lock("UsageLogger::timer_lock"), timer(cct, timer_lock) {
-    timer.init();
-    Mutex::Locker l(timer_lock);
-    set_timer();
+  UsageLogger(CephContext *_cct, RGWRados *_store) : cct(_cct), store(_store), lock("UsageLogger"), going_down(false), need_flush(false) {
+    int num_shards = cct->_conf->rgw_thread_pool_size;
+    if (num_shards < 1)
+      num_shards = 1;
     utime_t ts = ceph_clock_now(cct);
-    recalc_round_timestamp(ts);
+    for (int i = 0; i < num_shards; i++) {
+      Shard *shard = new Shard;
+      recalc_round_timestamp(shard, ts);
+      shards.push_back(shard);
+    }
+    pthread_key_create(&shard_key, NULL);
+    create();
   }
 
   ~UsageLogger() {
-    Mutex::Locker l(timer_lock);
+    lock.Lock();
+    going_down = true;
+    cond.Signal();
+    lock.Unlock();
+    join();
+
     flush();
-    timer.cancel_all_events();
-    timer.shutdown();
+    pthread_key_delete(shard_key);
+    for (vector<Shard *>::iterator iter = shards.begin(); iter != shards.end(); ++iter)
+      delete *iter;
   }
 
-  void recalc_round_timestamp(utime_t& ts) {
-    round_timestamp = ts.round_to_hour();
+  void recalc_round_timestamp(Shard *shard, utime_t& ts) {
+    shard->round_timestamp = ts.round_to_hour();
   }
 
   void insert(utime_t& timestamp, rgw_usage_log_entry& entry) {
-    lock.Lock();
-    if (timestamp.sec() > round_timestamp + 3600)
-      recalc_round_timestamp(timestamp);
-    entry.epoch = round_timestamp.sec();
+    Shard *shard = get_shard();
     bool account;
+    shard->lock.Lock();
+    if (timestamp.sec() > shard->round_timestamp + 3600)
+      recalc_round_timestamp(shard, timestamp);
+    entry.epoch = shard->round_timestamp.sec();
     rgw_user_bucket ub(entry.owner, entry.bucket);
-    usage_map[ub].insert(round_timestamp, entry, &account);
-    if (account)
-      num_entries++;
-    bool need_flush = (num_entries > cct->_conf->rgw_usage_log_flush_threshold);
-    lock.Unlock();
-    if (need_flush) {
-      Mutex::Locker l(timer_lock);
-      flush();
+    shard->usage_map[ub].insert(shard->round_timestamp, entry, &account);
+    shard->lock.Unlock();
+
+    /* only the one that crosses the threshold asks for the flush */
+    if (account && (int)num_entries.inc() == cct->_conf->rgw_usage_log_flush_threshold + 1) {
+      Mutex::Locker l(lock);
+      need_flush = true;
+      cond.Signal();
     }
   }
 
   void flush() {
     map<rgw_user_bucket, RGWUsageBatch> old_map;
-    lock.Lock();
-    old_map.swap(usage_map);
-    num_entries = 0;
-    lock.Unlock();
+    num_entries.set(0);
+    for (vector<Shard *>::iterator iter = shards.begin(); iter != shards.end(); ++iter) {
+      Shard *shard = *iter;
+      map<rgw_user_bucket, RGWUsageBatch> shard_map;
+      shard->lock.Lock();
+      shard_map.swap(shard->usage_map);
+      shard->lock.Unlock();
+
+      if (old_map.empty()) {
+        old_map.swap(shard_map);
+        continue;
+      }
+      map<rgw_user_bucket, RGWUsageBatch>::iterator miter;
+      for (miter = shard_map.begin(); miter != shard_map.end(); ++miter) {
+        RGWUsageBatch& batch = old_map[miter->first];
+        map<utime_t, rgw_usage_log_entry>::iterator eiter;
+        for (eiter = miter->second.m.begin(); eiter != miter->second.m.end(); ++eiter) {
+          bool account;
+          utime_t t = eiter->first;
+          batch.insert(t, eiter->second, &account);
+        }
+      }
+    }
 
-    store->log_usage(old_map);
+    if (!old_map.empty())
+      store->log_usage(old_map);
   }
 };
 
@@ -236,13 +299,16 @@ void OpsLogSocket::formatter_to_bl(bufferlist& bl)
 
 void OpsLogSocket::init_connection(bufferlist& bl)
 {
-  bl.append("[");
+  if (!binary)
+    bl.append("[");
 }
 
 OpsLogSocket::OpsLogSocket(CephContext *cct, uint64_t _backlog) : OutputDataSocket(cct, _backlog), lock("OpsLogSocket")
 {
   formatter = new JSONFormatter;
-  delim.append(",\n");
+  binary = cct->_conf->rgw_ops_log_socket_binary;
+  if (!binary)
+    delim.append(",\n");
 }
 
 OpsLogSocket::~OpsLogSocket()
@@ -250,18 +316,179 @@ OpsLogSocket::~OpsLogSocket()
   delete formatter;
 }
 
+void OpsLogSocket::format(struct rgw_log_entry& entry, bufferlist& bl)
+{
+  if (binary) {
+    ::encode(entry, bl);
+    return;
+  }
+  rgw_format_ops_log_entry(entry, formatter);
+  formatter_to_bl(bl);
+}
+
 void OpsLogSocket::log(struct rgw_log_entry& entry)
 {
   bufferlist bl;
 
   lock.Lock();
-  rgw_format_ops_log_entry(entry, formatter);
-  formatter_to_bl(bl);
+  format(entry, bl);
   lock.Unlock();
 
   append_output(bl);
 }
 
+bool OpsLogSocket::log(list<rgw_log_entry>& entries)
+{
+  bufferlist bl;
+
+  lock.Lock();
+  for (list<rgw_log_entry>::iterator iter = entries.begin(); iter != entries.end(); ++iter) {
+    if (iter != entries.begin())
+      bl.append(delim);
+    format(*iter, bl);
+  }
+  lock.Unlock();
+
+  return append_output(bl);
+}
+
+/*
+ * Takes the ops log entries off the request threads.  A thread of its own
+ * appends them to their log objects, one append per object, and hands
+ * them to the ops log socket, one write for all of them, when there is a
+ * batch of them or every rgw_ops_log_flush_interval seconds.  When the
+ * socket's backlog is full the entries wait here for it; past
+ * rgw_ops_log_max_pending bytes waiting, the newer ones are dropped, so a
+ * request never waits on the log.
+ */
+class OpsLogBatcher : public Thread {
+  CephContext *cct;
+  RGWRados *store;
+  OpsLogSocket *olog;
+
+  Mutex lock;
+  Cond cond;
+  bool going_down;
+  map<string, bufferlist> objs;   /* entries, by log object */
+  uint64_t objs_size;
+  list<rgw_log_entry> socket_entries;
+  uint64_t socket_size;
+  bool socket_full;               /* wait for the next tick to try again */
+
+  bool ready() {
+    uint64_t batch_size = cct->_conf->rgw_ops_log_batch_size;
+    return (objs_size >= batch_size || (!socket_full && socket_size >= batch_size));
+  }
+
+  void write_objs(map<string, bufferlist>& m) {
+    for (map<string, bufferlist>::iterator iter = m.begin(); iter != m.end(); ++iter) {
+      rgw_obj obj(store->zone.log_pool, iter->first);
+      bufferlist& bl = iter->second;
+      int ret = store->append_async(obj, bl.length(), bl);
+      if (ret == -ENOENT) {
+        ret = store->create_pool(store->zone.log_pool);
+        if (ret >= 0) // retry
+          ret = store->append_async(obj, bl.length(), bl);
+      }
+      if (ret < 0)
+        ldout(cct, 0) << "ERROR: failed to log entries to " << iter->first << " ret=" << ret << dendl;
+    }
+  }
+
+protected:
+  void *entry() {
+    lock.Lock();
+    while (true) {
+      if (!going_down && !ready())
+        cond.WaitInterval(cct, lock, utime_t(cct->_conf->rgw_ops_log_flush_interval, 0));
+      bool stop = going_down;
+
+      map<string, bufferlist> m;
+      m.swap(objs);
+      objs_size = 0;
+      list<rgw_log_entry> entries;
+      entries.swap(socket_entries);
+      uint64_t size = socket_size;
+      socket_size = 0;
+      lock.Unlock();
+
+      write_objs(m);
+      bool sent = (entries.empty() || olog->log(entries));
+
+      lock.Lock();
+      socket_full = !sent;
+      if (!sent && !stop) {
+        socket_entries.splice(socket_entries.begin(), entries);
+        socket_size += size;
+      }
+      if (stop)
+        break;
+    }
+    lock.Unlock();
+    return NULL;
+  }
+
+public:
+  OpsLogBatcher(CephContext *_cct, RGWRados *_store, OpsLogSocket *_olog)
+    : cct(_cct), store(_store), olog(_olog), lock("OpsLogBatcher"), going_down(false),
+      objs_size(0), socket_size(0), socket_full(false) {}
+
+  void stop() {
+    lock.Lock();
+    going_down = true;
+    cond.Signal();
+    lock.Unlock();
+    join();
+  }
+
+  /* oid empty if it doesn't go to rados */
+  void log(const string& oid, bufferlist& bl, rgw_log_entry& entry) {
+    Mutex::Locker l(lock);
+    uint64_t max_pending = cct->_conf->rgw_ops_log_max_pending;
+    int dropped = 0;
+    if (!oid.empty()) {
+      if (objs_size + bl.length() > max_pending) {
+        dropped++;
+      } else {
+        objs[oid].append(bl);
+        objs_size += bl.length();
+      }
+    }
+    if (olog) {
+      if (socket_size + bl.length() > max_pending) {
+        dropped++;
+      } else {
+        socket_entries.push_back(entry);
+        socket_size += bl.length();
+      }
+    }
+    if (dropped) {
+      ldout(cct, 20) << "ops log behind by more than " << max_pending << " bytes, dropping entry" << dendl;
+      if (perfcounter)
+        perfcounter->inc(l_rgw_ops_log_dropped, dropped);
+    }
+    if (ready())
+      cond.Signal();
+  }
+};
+
+static OpsLogBatcher *ops_log_batcher = NULL;
+
+void rgw_log_ops_init(CephContext *cct, RGWRados *store, OpsLogSocket *olog)
+{
+  ops_log_batcher = new OpsLogBatcher(cct, store, olog);
+  ops_log_batcher->create();
+}
+
+void rgw_log_ops_finalize()
+{
+  if (!ops_log_batcher)
+    return;
+  ops_log_batcher->stop();
+  delete ops_log_batcher;
+  ops_log_batcher = NULL;
+}
+
 int rgw_log_op(RGWRados *store, struct req_state *s, const string& op_name, OpsLogSocket *olog)
 {
   struct rgw_log_entry entry;
@@ -344,11 +571,18 @@ int rgw_log_op(RGWRados *store, struct req_state *s, const string& op_name, OpsL
     localtime_r(&t, &bdt);
 
   int ret = 0;
+  string oid;
+
+  if (s->cct->_conf->rgw_ops_log_rados)
+    oid = render_log_object_name(s->cct->_conf->rgw_log_object_name, &bdt,
+				 s->bucket.bucket_id, entry.bucket);
 
-  if (s->cct->_conf->rgw_ops_log_rados) {
-    string oid = render_log_object_name(s->cct->_conf->rgw_log_object_name, &bdt,
-				        s->bucket.bucket_id, entry.bucket);
+  if (ops_log_batcher) {
+    ops_log_batcher->log(oid, bl, entry);
+    return 0;
+  }
 
+  if (!oid.empty()) {
     rgw_obj obj(store->zone.log_pool, oid);
 
     ret = store->append_async(obj, bl.length(), bl);
@@ -104,8 +104,10 @@ WRITE_CLASS_ENCODER(rgw_log_entry)
 class OpsLogSocket : public OutputDataSocket {
   Formatter *formatter;
   Mutex lock;
+  bool binary;  /* the entries encoded, back to back, rather than a json array */
 
   void formatter_to_bl(bufferlist& bl);
+  void format(struct rgw_log_entry& entry, bufferlist& bl);
 
 protected:
   void init_connection(bufferlist& bl);
@@ -115,11 +117,15 @@ public:
   ~OpsLogSocket();
 
   void log(struct rgw_log_entry& entry);
+  /* in one write; false if the backlog has no room for them */
+  bool log(list<rgw_log_entry>& entries);
 };
 
 int rgw_log_op(RGWRados *store, struct req_state *s, const string& op_name, OpsLogSocket *olog);
 void rgw_log_usage_init(CephContext *cct, RGWRados *store);
 void rgw_log_usage_finalize();
+void rgw_log_ops_init(CephContext *cct, RGWRados *store, OpsLogSocket *olog);
+void rgw_log_ops_finalize();
 void rgw_format_ops_log_entry(struct rgw_log_entry& entry, Formatter *formatter);
 
 #endif
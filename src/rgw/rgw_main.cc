@@ -57,11 +57,13 @@
 #include "rgw_tools.h"
 #include "rgw_resolve.h"
 #include "rgw_loadgen.h"
+#include "rgw_async.h"
 #include "rgw_civetweb.h"
 #include "rgw_civetweb_log.h"
 
 #include "civetweb/civetweb.h"
 
+#include <algorithm>
 #include <map>
 #include <string>
 #include <vector>
@@ -374,9 +376,19 @@ struct RGWLoadGenRequest : public RGWRequest {
 
 class RGWLoadGenProcess : public RGWProcess {
   RGWAccessKey access_key;
+
+  /* of the requests of the current phase of the run */
+  Mutex stats_lock;
+  vector<double> latencies;
+  int failures;
+  utime_t phase_start;
+
+  void start_phase();
+  void end_phase(const char *name);
 public:
   RGWLoadGenProcess(CephContext *cct, RGWProcessEnv *pe, int num_threads, RGWFrontendConfig *_conf) :
-    RGWProcess(cct, pe, num_threads, _conf) {}
+    RGWProcess(cct, pe, num_threads, _conf), stats_lock("RGWLoadGenProcess::stats_lock"),
+    failures(0) {}
   void run();
   void checkpoint();
   void handle_request(RGWRequest *req);
@@ -390,6 +402,40 @@ void RGWLoadGenProcess::checkpoint()
   m_tp.drain(&req_wq);
 }
 
+void RGWLoadGenProcess::start_phase()
+{
+  Mutex::Locker l(stats_lock);
+  latencies.clear();
+  failures = 0;
+  phase_start = ceph_clock_now(g_ceph_context);
+}
+
+/*
+ * Report the throughput and latencies of the requests since
+ * start_phase(), once they are all done.
+ */
+void RGWLoadGenProcess::end_phase(const char *name)
+{
+  checkpoint();
+
+  Mutex::Locker l(stats_lock);
+  utime_t elapsed = ceph_clock_now(g_ceph_context);
+  elapsed -= phase_start;
+  if (latencies.empty())
+    return;
+
+  sort(latencies.begin(), latencies.end());
+  double total = 0;
+  for (vector<double>::iterator iter = latencies.begin(); iter != latencies.end(); ++iter) {
+    total += *iter;
+  }
+  size_t n = latencies.size();
+  dout(0) << "loadgen: " << name << ": " << n << " requests in " << elapsed << "s, "
+          << (double)n / (double)elapsed << " req/s, latency avg " << total / n
+          << "s p50 " << latencies[n / 2] << "s p99 " << latencies[n * 99 / 100]
+          << "s max " << latencies[n - 1] << "s, " << failures << " failed" << dendl;
+}
+
 void RGWLoadGenProcess::run()
 {
   m_tp.start(); /* start thread pool */
@@ -403,10 +449,14 @@ void RGWLoadGenProcess::run()
   int num_buckets;
   conf->get_val("num_buckets", 1, &num_buckets);
 
+  int obj_size;
+  conf->get_val("obj_size", 4096, &obj_size);
+
   vector<string> buckets(num_buckets);
 
   atomic_t failed;
 
+  start_phase();
   for (i = 0; i < num_buckets; i++) {
     buckets[i] = "/loadgen";
     string& bucket = buckets[i];
@@ -416,6 +466,7 @@ void RGWLoadGenProcess::run()
     gen_request("PUT", bucket, 0, &failed);
     checkpoint();
   }
+  end_phase("create buckets");
 
   string *objs = new string[num_objs];
 
@@ -431,32 +482,34 @@ void RGWLoadGenProcess::run()
     objs[i] = buckets[i % num_buckets] + "/" + buf;
   }
 
+  start_phase();
   for (i = 0; i < num_objs; i++) {
-    gen_request("PUT", objs[i], 4096, &failed);
+    gen_request("PUT", objs[i], obj_size, &failed);
   }
-
-  checkpoint();
+  end_phase("put objects");
 
   if (failed.read()) {
     derr << "ERROR: bucket creation failed" << dendl;
     goto done;
   }
 
+  start_phase();
   for (i = 0; i < num_objs; i++) {
-    gen_request("GET", objs[i], 4096, NULL);
+    gen_request("GET", objs[i], 0, NULL);
   }
+  end_phase("get objects");
 
-  checkpoint();
-
+  start_phase();
   for (i = 0; i < num_objs; i++) {
     gen_request("DELETE", objs[i], 0, NULL);
   }
+  end_phase("delete objects");
 
-  checkpoint();
-
+  start_phase();
   for (i = 0; i < num_buckets; i++) {
     gen_request("DELETE", buckets[i], 0, NULL);
   }
+  end_phase("delete buckets");
 
 done:
   checkpoint();
@@ -477,6 +530,88 @@ void RGWLoadGenProcess::gen_request(const string& method, const string& resource
   req_wq.queue(req);
 }
 
+struct RGWAsyncRequest : public RGWRequest {
+  RGWAsyncConn *conn;
+
+  RGWAsyncRequest(uint64_t req_id, RGWAsyncConn *_conn) : RGWRequest(req_id), conn(_conn) {
+    conn->get();
+  }
+
+  ~RGWAsyncRequest() {
+    conn->put();
+  }
+};
+
+/*
+ * Serves HTTP from a few event loops, one per core by default, that read
+ * the requests and write the responses; the worker threads only run the
+ * ops, so a slow client takes up a buffer rather than a thread.
+ */
+class RGWAsyncProcess : public RGWProcess, public RGWAsyncDispatcher {
+  RGWAsyncServer server;
+  int port;
+  Mutex lock;
+  Cond cond;
+  bool going_down;
+public:
+  RGWAsyncProcess(CephContext *cct, RGWProcessEnv *pe, int num_threads, int num_loops,
+                  uint64_t buffer_size, RGWFrontendConfig *_conf) :
+    RGWProcess(cct, pe, num_threads, _conf),
+    server(cct, this, num_loops, buffer_size), port(pe->port),
+    lock("RGWAsyncProcess"), going_down(false) {}
+  void run();
+  void stop();
+  bool dispatch(RGWAsyncConn *conn);
+  void handle_request(RGWRequest *req);
+};
+
+void RGWAsyncProcess::run()
+{
+  string host;
+  conf->get_val("host", "", &host);
+
+  int r = server.bind(host, port);
+  if (r < 0) {
+    dout(0) << "ERROR: async frontend can't bind to port " << port << ": " << cpp_strerror(r) << dendl;
+    return;
+  }
+
+  m_tp.start();
+
+  r = server.start();
+  if (r >= 0) {
+    Mutex::Locker l(lock);
+    while (!going_down) {
+      cond.Wait(lock);
+    }
+  }
+
+  /* the requests still being handled find their connections closed */
+  server.stop();
+
+  m_tp.drain(&req_wq);
+  m_tp.stop();
+}
+
+void RGWAsyncProcess::stop()
+{
+  Mutex::Locker l(lock);
+  going_down = true;
+  cond.Signal();
+}
+
+bool RGWAsyncProcess::dispatch(RGWAsyncConn *conn)
+{
+  /* the loops don't wait for room, they ask again in a while */
+  if (!req_throttle.get_or_fail(1))
+    return false;
+
+  RGWAsyncRequest *req = new RGWAsyncRequest(store->get_new_req_id(), conn);
+  dout(10) << "allocated request req=" << hex << req << dec << dendl;
+  req_wq.queue(req);
+  return true;
+}
+
 static void signal_shutdown()
 {
   if (!disable_signal_fd.read()) {
@@ -704,6 +839,30 @@ void RGWLoadGenProcess::handle_request(RGWRequest *r)
     }
   }
 
+  utime_t latency = ceph_clock_now(g_ceph_context);
+  latency -= req->ts;
+  stats_lock.Lock();
+  latencies.push_back((double)latency);
+  if (ret < 0)
+    failures++;
+  stats_lock.Unlock();
+
+  delete req;
+}
+
+void RGWAsyncProcess::handle_request(RGWRequest *r)
+{
+  RGWAsyncRequest *req = static_cast<RGWAsyncRequest *>(r);
+  RGWAsyncIO client_io(req->conn, port);
+
+  int ret = process_request(store, rest, req, &client_io, olog);
+  if (ret < 0) {
+    /* we don't really care about return code */
+    dout(20) << "process_request() returned " << ret << dendl;
+  }
+
+  req->conn->finish();
+
   delete req;
 }
 
@@ -944,6 +1103,31 @@ public:
   }
 };
 
+class RGWAsyncFrontend : public RGWProcessFrontend {
+public:
+  RGWAsyncFrontend(RGWProcessEnv& pe, RGWFrontendConfig *_conf) : RGWProcessFrontend(pe, _conf) {}
+
+  int init() {
+    int num_loops;
+    conf->get_val("num_loops", (int)sysconf(_SC_NPROCESSORS_ONLN), &num_loops);
+    if (num_loops < 1)
+      num_loops = 1;
+
+    int buffer_size;
+    conf->get_val("buffer_size", g_conf->rgw_max_chunk_size, &buffer_size);
+    if (buffer_size < 4096)
+      buffer_size = 4096;
+
+    pprocess = new RGWAsyncProcess(g_ceph_context, &env, g_conf->rgw_thread_pool_size,
+                                   num_loops, buffer_size, conf);
+    return 0;
+  }
+
+  void stop() {
+    static_cast<RGWAsyncProcess *>(pprocess)->stop();
+  }
+};
+
 class RGWMongooseFrontend : public RGWFrontend {
   RGWFrontendConfig *conf;
   struct mg_context *ctx;
@@ -1138,6 +1322,7 @@ int main(int argc, const char **argv)
     olog = new OpsLogSocket(g_ceph_context, g_conf->rgw_ops_log_data_backlog);
     olog->init(g_conf->rgw_ops_log_socket_path);
   }
+  rgw_log_ops_init(g_ceph_context, store, olog);
 
   r = signal_fd_init();
   if (r < 0) {
@@ -1200,6 +1385,13 @@ int main(int argc, const char **argv)
       RGWProcessEnv env = { store, &rest, olog, port };
 
       fe = new RGWLoadGenFrontend(env, config);
+    } else if (framework == "async") {
+      int port;
+      config->get_val("port", 80, &port);
+
+      RGWProcessEnv env = { store, &rest, olog, port };
+
+      fe = new RGWAsyncFrontend(env, config);
     } else {
       dout(0) << "WARNING: skipping unknown framework: " << framework << dendl;
       continue;
@@ -1246,6 +1438,7 @@ int main(int argc, const char **argv)
   }
 
   rgw_log_usage_finalize();
+  rgw_log_ops_finalize();
 
   delete olog;
 
@@ -1237,9 +1237,10 @@ void RGWListBucket::execute()
   list_op.params.marker = marker;
   list_op.params.end_marker = end_marker;
   list_op.params.list_versions = list_versions;
+  list_op.params.allow_unordered = allow_unordered;
 
   ret = list_op.list_objects(max, &objs, &common_prefixes, &is_truncated);
-  if (ret >= 0 && !delimiter.empty()) {
+  if (ret >= 0 && (!delimiter.empty() || allow_unordered)) {
     next_marker = list_op.get_next_marker();
   }
 }
@@ -3066,6 +3067,76 @@ static int list_multipart_parts(RGWRados *store, struct req_state *s,
   return 0;
 }
 
+/*
+ * Reads the part info of a v2 upload all at once, with the omap reads of
+ * runs of max_parts parts in flight together, each starting after the
+ * last part of the run before it.  *all_read is set only when the parts
+ * uploaded are exactly those in nums; otherwise the caller lists them the
+ * slow way, which also tells what is wrong with them.
+ */
+static int read_multipart_parts(RGWRados *store, struct req_state *s,
+                                string& meta_oid, map<int, string>& nums, int max_parts,
+                                map<uint32_t, RGWUploadPartInfo>& parts, bool *all_read)
+{
+  *all_read = false;
+  parts.clear();
+
+  if (nums.empty() || nums.begin()->first <= 0)
+    return 0;
+
+  rgw_obj obj;
+  obj.init_ns(s->bucket, meta_oid, mp_ns);
+  obj.set_in_extra_data(true);
+
+  vector<pair<string, uint64_t> > ranges;
+  int prev = 0;
+  int run = 0;
+  map<int, string>::iterator iter;
+  for (iter = nums.begin(); iter != nums.end(); ++iter) {
+    if (run == 0) {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "part.%08d", prev);
+      ranges.push_back(make_pair(string(buf), 0));
+    }
+    ranges.back().second++;
+    prev = iter->first;
+    if (++run == max_parts)
+      run = 0;
+  }
+  /* one more, to see there's no part after the last one */
+  ranges.back().second++;
+
+  vector<map<string, bufferlist> > results;
+  int ret = store->omap_get_vals_ranges(obj, ranges, results, s->cct->_conf->rgw_multipart_complete_max_aio);
+  if (ret < 0)
+    return ret;
+
+  iter = nums.begin();
+  for (size_t i = 0; i < results.size(); i++) {
+    uint64_t expected = ranges[i].second - (i == results.size() - 1 ? 1 : 0);
+    if (results[i].size() != expected)
+      return 0;
+
+    map<string, bufferlist>::iterator riter;
+    for (riter = results[i].begin(); riter != results[i].end(); ++riter, ++iter) {
+      bufferlist::iterator bli = riter->second.begin();
+      RGWUploadPartInfo info;
+      try {
+        ::decode(info, bli);
+      } catch (buffer::error& err) {
+        ldout(s->cct, 0) << "ERROR: could not part info, caught buffer::error" << dendl;
+        return -EIO;
+      }
+      if ((int)info.num != iter->first)
+        return 0;
+      parts[info.num] = info;
+    }
+  }
+
+  *all_read = true;
+  return 0;
+}
+
 int RGWCompleteMultipart::verify_permission()
 {
   if (!verify_bucket_permission(s, RGW_PERM_WRITE))
@@ -3162,13 +3233,24 @@ void RGWCompleteMultipart::execute()
     return;
   }
 
+  bool all_read = false;
+  if (is_v2_upload_id(upload_id)) {
+    ret = read_multipart_parts(store, s, meta_oid, parts->parts, max_parts, obj_parts, &all_read);
+    if (ret < 0 && ret != -ENOENT)
+      return;
+  }
+
   do {
-    ret = list_multipart_parts(store, s, upload_id, meta_oid, max_parts, marker, obj_parts, &marker, &truncated);
-    if (ret == -ENOENT) {
-      ret = -ERR_NO_SUCH_UPLOAD;
+    if (all_read) {
+      truncated = false;
+    } else {
+      ret = list_multipart_parts(store, s, upload_id, meta_oid, max_parts, marker, obj_parts, &marker, &truncated);
+      if (ret == -ENOENT) {
+        ret = -ERR_NO_SUCH_UPLOAD;
+      }
+      if (ret < 0)
+        return;
     }
-    if (ret < 0)
-      return;
 
     total_parts += obj_parts.size();
     if (!truncated && total_parts != (int)parts->parts.size()) {
@@ -257,6 +257,7 @@ protected:
   string max_keys;
   string delimiter;
   bool list_versions;
+  bool allow_unordered;
   int max;
   int ret;
   vector<RGWObjEnt> objs;
@@ -268,7 +269,7 @@ protected:
   int parse_max_keys();
 
 public:
-  RGWListBucket() : list_versions(false), max(0), ret(0),
+  RGWListBucket() : list_versions(false), allow_unordered(false), max(0), ret(0),
                     default_max(0), is_truncated(false) {}
   int verify_permission();
   void pre_exec();
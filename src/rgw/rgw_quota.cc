@@ -14,58 +14,39 @@
 
 
 #include "include/utime.h"
+#include "include/memory.h"
 #include "common/lru_map.h"
 #include "common/RefCountedObj.h"
 #include "common/Thread.h"
 #include "common/Mutex.h"
+#include "common/Cond.h"
 #include "common/RWLock.h"
 
 #include "rgw_common.h"
 #include "rgw_rados.h"
 #include "rgw_quota.h"
+#include "rgw_quota_cache.h"
 #include "rgw_bucket.h"
 #include "rgw_user.h"
 
 #define dout_subsys ceph_subsys_rgw
 
 
-struct RGWQuotaCacheStats {
-  RGWStorageStats stats;
-  utime_t expiration;
-  utime_t async_refresh_time;
-};
-
 template<class T>
 class RGWQuotaCache {
 protected:
   RGWRados *store;
-  lru_map<T, RGWQuotaCacheStats> stats_map;
+  lru_map<T, RGWQuotaCacheStatsRef> stats_map;
   RefCountedWaitObject *async_refcount;
 
-  class StatsAsyncTestSet : public lru_map<T, RGWQuotaCacheStats>::UpdateContext {
-    int objs_delta;
-    uint64_t added_bytes;
-    uint64_t removed_bytes;
-  public:
-    StatsAsyncTestSet() : objs_delta(0), added_bytes(0), removed_bytes(0) {}
-    bool update(RGWQuotaCacheStats *entry) {
-      if (entry->async_refresh_time.sec() == 0)
-        return false;
-
-      entry->async_refresh_time = utime_t(0, 0);
-
-      return true;
-    }
-  };
-
   virtual int fetch_stats_from_storage(const string& user, rgw_bucket& bucket, RGWStorageStats& stats) = 0;
 
-  virtual bool map_find(const string& user, rgw_bucket& bucket, RGWQuotaCacheStats& qs) = 0;
-
-  virtual bool map_find_and_update(const string& user, rgw_bucket& bucket, typename lru_map<T, RGWQuotaCacheStats>::UpdateContext *ctx) = 0;
-  virtual void map_add(const string& user, rgw_bucket& bucket, RGWQuotaCacheStats& qs) = 0;
+  virtual bool map_find(const string& user, rgw_bucket& bucket, RGWQuotaCacheStatsRef& qs) = 0;
+  virtual bool map_find_or_add(const string& user, rgw_bucket& bucket, RGWQuotaCacheStatsRef& qs) = 0;
 
   virtual void data_modified(const string& user, rgw_bucket& bucket) {}
+
+  int read_stats(const string& user, rgw_bucket& bucket, RGWQuotaCacheStatsRef& qs);
 public:
   RGWQuotaCache(RGWRados *_store, int size) : store(_store), stats_map(size) {
     async_refcount = new RefCountedWaitObject;
@@ -79,23 +60,25 @@ public:
 
   virtual bool can_use_cached_stats(RGWQuotaInfo& quota, RGWStorageStats& stats);
 
-  void set_stats(const string& user, rgw_bucket& bucket, RGWQuotaCacheStats& qs, RGWStorageStats& stats);
-  int async_refresh(const string& user, rgw_bucket& bucket, RGWQuotaCacheStats& qs);
-  void async_refresh_response(const string& user, rgw_bucket& bucket, RGWStorageStats& stats);
+  int async_refresh(const string& user, rgw_bucket& bucket, RGWQuotaCacheStatsRef& qs);
+  void async_refresh_response(RGWQuotaCacheStatsRef& qs, RGWStorageStats& stats);
+  void async_refresh_fail(RGWQuotaCacheStatsRef& qs, int r);
 
   class AsyncRefreshHandler {
   protected:
     RGWRados *store;
     RGWQuotaCache<T> *cache;
+    RGWQuotaCacheStatsRef qs;
   public:
-    AsyncRefreshHandler(RGWRados *_store, RGWQuotaCache<T> *_cache) : store(_store), cache(_cache) {}
+    AsyncRefreshHandler(RGWRados *_store, RGWQuotaCache<T> *_cache, RGWQuotaCacheStatsRef& _qs)
+      : store(_store), cache(_cache), qs(_qs) {}
     virtual ~AsyncRefreshHandler() {}
 
     virtual int init_fetch() = 0;
     virtual void drop_reference() = 0;
   };
 
-  virtual AsyncRefreshHandler *allocate_refresh_handler(const string& user, rgw_bucket& bucket) = 0;
+  virtual AsyncRefreshHandler *allocate_refresh_handler(const string& user, rgw_bucket& bucket, RGWQuotaCacheStatsRef& qs) = 0;
 };
 
 template<class T>
@@ -128,23 +111,17 @@ bool RGWQuotaCache<T>::can_use_cached_stats(RGWQuotaInfo& quota, RGWStorageStats
   return true;
 }
 
+/* with qs->lock held, and qs->refreshing set */
 template<class T>
-int RGWQuotaCache<T>::async_refresh(const string& user, rgw_bucket& bucket, RGWQuotaCacheStats& qs)
+int RGWQuotaCache<T>::async_refresh(const string& user, rgw_bucket& bucket, RGWQuotaCacheStatsRef& qs)
 {
-  /* protect against multiple updates */
-  StatsAsyncTestSet test_update;
-  if (!map_find_and_update(user, bucket, &test_update)) {
-    /* most likely we just raced with another update */
-    return 0;
-  }
-
   async_refcount->get();
 
-
-  AsyncRefreshHandler *handler = allocate_refresh_handler(user, bucket);
+  AsyncRefreshHandler *handler = allocate_refresh_handler(user, bucket, qs);
 
   int ret = handler->init_fetch();
   if (ret < 0) {
+    qs->fail(ret);
     async_refcount->put();
     handler->drop_reference();
     return ret;
@@ -154,88 +131,130 @@ int RGWQuotaCache<T>::async_refresh(const string& user, rgw_bucket& bucket, RGWQ
 }
 
 template<class T>
-void RGWQuotaCache<T>::async_refresh_response(const string& user, rgw_bucket& bucket, RGWStorageStats& stats)
+void RGWQuotaCache<T>::async_refresh_response(RGWQuotaCacheStatsRef& qs, RGWStorageStats& stats)
 {
-  ldout(store->ctx(), 20) << "async stats refresh response for bucket=" << bucket << dendl;
-
-  RGWQuotaCacheStats qs;
+  ldout(store->ctx(), 20) << "async stats refresh response" << dendl;
 
-  map_find(user, bucket, qs);
-
-  set_stats(user, bucket, qs, stats);
+  qs->lock.Lock();
+  qs->set(store->ctx(), stats);
+  qs->lock.Unlock();
 
   async_refcount->put();
 }
 
 template<class T>
-void RGWQuotaCache<T>::set_stats(const string& user, rgw_bucket& bucket, RGWQuotaCacheStats& qs, RGWStorageStats& stats)
+void RGWQuotaCache<T>::async_refresh_fail(RGWQuotaCacheStatsRef& qs, int r)
 {
-  qs.stats = stats;
-  qs.expiration = ceph_clock_now(store->ctx());
-  qs.async_refresh_time = qs.expiration;
-  qs.expiration += store->ctx()->_conf->rgw_bucket_quota_ttl;
-  qs.async_refresh_time += store->ctx()->_conf->rgw_bucket_quota_ttl / 2;
+  CephContext *cct = store->ctx();
+
+  qs->lock.Lock();
+  qs->fail(r);
+  utime_t age = ceph_clock_now(cct) - qs->fetch_time;
+  if (qs->refresh_failures == 1) {
+    /* say so once, as it starts failing */
+    ldout(cct, 0) << "WARNING: quota stats refresh failed ret=" << r
+      << ", going on with stats " << age << "s old" << dendl;
+  } else {
+    ldout(cct, 10) << "quota stats refresh failed ret=" << r << " (" << qs->refresh_failures
+      << " in a row), the stats are " << age << "s old" << dendl;
+  }
+  qs->lock.Unlock();
 
-  map_add(user, bucket, qs);
+  async_refcount->put();
 }
 
+/*
+ * Read the stats while the request waits, with qs->lock held: for the
+ * first request, and once the stats are older than
+ * rgw_bucket_quota_max_age because the refreshes kept failing.  The
+ * requests that come meanwhile wait for that one read, or for the
+ * refresh that is in flight already.
+ */
 template<class T>
-int RGWQuotaCache<T>::get_stats(const string& user, rgw_bucket& bucket, RGWStorageStats& stats, RGWQuotaInfo& quota) {
-  RGWQuotaCacheStats qs;
-  utime_t now = ceph_clock_now(store->ctx());
-  if (map_find(user, bucket, qs)) {
-    if (qs.async_refresh_time.sec() > 0 && now >= qs.async_refresh_time) {
-      int r = async_refresh(user, bucket, qs);
-      if (r < 0) {
-        ldout(store->ctx(), 0) << "ERROR: quota async refresh returned ret=" << r << dendl;
-
-        /* continue processing, might be a transient error, async refresh is just optimization */
-      }
-    }
+int RGWQuotaCache<T>::read_stats(const string& user, rgw_bucket& bucket, RGWQuotaCacheStatsRef& qs)
+{
+  CephContext *cct = store->ctx();
+  int max_age = cct->_conf->rgw_bucket_quota_max_age;
 
-    if (can_use_cached_stats(quota, qs.stats) && qs.expiration > ceph_clock_now(store->ctx())) {
-      stats = qs.stats;
+  if (qs->refreshing) {
+    while (qs->refreshing)
+      qs->cond.Wait(qs->lock);
+    if (qs->fetched && !qs->expired(ceph_clock_now(cct), max_age))
       return 0;
-    }
+    return qs->fetch_ret;
   }
 
-  int ret = fetch_stats_from_storage(user, bucket, stats);
-  if (ret < 0 && ret != -ENOENT)
-    return ret;
-
-  set_stats(user, bucket, qs, stats);
+  if (qs->fetched) {
+    utime_t age = ceph_clock_now(cct) - qs->fetch_time;
+    ldout(cct, 0) << "WARNING: quota stats are " << age << "s old, past rgw_bucket_quota_max_age"
+      << ", reading them again" << dendl;
+  }
 
+  qs->start_refresh();
+  qs->lock.Unlock();
+  RGWStorageStats fetched;
+  int ret = fetch_stats_from_storage(user, bucket, fetched);
+  qs->lock.Lock();
+  if (ret == -ENOENT)
+    ret = 0;
+  if (ret < 0) {
+    qs->fail(ret);
+    return ret;
+  }
+  qs->set(cct, fetched);
   return 0;
 }
 
-
+/*
+ * Only the first request for a bucket or user reads its stats, and the
+ * others that come meanwhile wait for that one read.  After that they
+ * are refreshed in the background, as they get old or, for as long as
+ * they are past the soft threshold, as often as one read after another
+ * allows, and the requests go on with what there is.  If the refreshes
+ * keep failing, that is until the stats are rgw_bucket_quota_max_age
+ * old; then they are read again before they are used.
+ */
 template<class T>
-class RGWQuotaStatsUpdate : public lru_map<T, RGWQuotaCacheStats>::UpdateContext {
-  int objs_delta;
-  uint64_t added_bytes;
-  uint64_t removed_bytes;
-public:
-  RGWQuotaStatsUpdate(int _objs_delta, uint64_t _added_bytes, uint64_t _removed_bytes) : 
-                    objs_delta(_objs_delta), added_bytes(_added_bytes), removed_bytes(_removed_bytes) {}
-  bool update(RGWQuotaCacheStats *entry) {
-    uint64_t rounded_kb_added = rgw_rounded_objsize_kb(added_bytes);
-    uint64_t rounded_kb_removed = rgw_rounded_objsize_kb(removed_bytes);
+int RGWQuotaCache<T>::get_stats(const string& user, rgw_bucket& bucket, RGWStorageStats& stats, RGWQuotaInfo& quota) {
+  RGWQuotaCacheStatsRef qs(new RGWQuotaCacheStats);
+  map_find_or_add(user, bucket, qs);
 
-    entry->stats.num_kb_rounded += (rounded_kb_added - rounded_kb_removed);
-    entry->stats.num_kb += (added_bytes - removed_bytes) / 1024;
-    entry->stats.num_objects += objs_delta;
+  Mutex::Locker l(qs->lock);
 
-    return true;
+  utime_t now = ceph_clock_now(store->ctx());
+  if (!qs->fetched || qs->expired(now, store->ctx()->_conf->rgw_bucket_quota_max_age)) {
+    int ret = read_stats(user, bucket, qs);
+    if (ret < 0)
+      return ret;
+    now = ceph_clock_now(store->ctx());
   }
-};
 
+  qs->get(stats);
+
+  if (!qs->refreshing &&
+      (now >= qs->refresh_time || !can_use_cached_stats(quota, stats))) {
+    qs->start_refresh();
+    int r = async_refresh(user, bucket, qs);
+    if (r < 0) {
+      ldout(store->ctx(), 0) << "ERROR: quota async refresh returned ret=" << r << dendl;
+
+      /* continue processing, might be a transient error, async refresh is just optimization */
+    }
+  }
+
+  return 0;
+}
 
 template<class T>
 void RGWQuotaCache<T>::adjust_stats(const string& user, rgw_bucket& bucket, int objs_delta,
                                  uint64_t added_bytes, uint64_t removed_bytes)
 {
-  RGWQuotaStatsUpdate<T> update(objs_delta, added_bytes, removed_bytes);
-  map_find_and_update(user, bucket, &update);
+  RGWQuotaCacheStatsRef qs;
+  if (map_find(user, bucket, qs)) {
+    int64_t kb_rounded = (int64_t)rgw_rounded_objsize_kb(added_bytes) - (int64_t)rgw_rounded_objsize_kb(removed_bytes);
+    int64_t kb = ((int64_t)added_bytes - (int64_t)removed_bytes) / 1024;
+    qs->adjust(objs_delta, kb, kb_rounded);
+  }
 
   data_modified(user, bucket);
 }
@@ -245,8 +264,8 @@ class BucketAsyncRefreshHandler : public RGWQuotaCache<rgw_bucket>::AsyncRefresh
   string user;
 public:
   BucketAsyncRefreshHandler(RGWRados *_store, RGWQuotaCache<rgw_bucket> *_cache,
-                            const string& _user, rgw_bucket& _bucket) :
-                                      RGWQuotaCache<rgw_bucket>::AsyncRefreshHandler(_store, _cache),
+                            const string& _user, rgw_bucket& _bucket, RGWQuotaCacheStatsRef& _qs) :
+                                      RGWQuotaCache<rgw_bucket>::AsyncRefreshHandler(_store, _cache, _qs),
                                       RGWGetBucketStats_CB(_bucket), user(_user) {}
 
   void drop_reference() { put(); }
@@ -273,7 +292,8 @@ void BucketAsyncRefreshHandler::handle_response(int r)
 {
   if (r < 0) {
     ldout(store->ctx(), 20) << "AsyncRefreshHandler::handle_response() r=" << r << dendl;
-    return; /* nothing to do here */
+    cache->async_refresh_fail(qs, r);
+    return;
   }
 
   RGWStorageStats bs;
@@ -286,21 +306,17 @@ void BucketAsyncRefreshHandler::handle_response(int r)
     bs.num_objects += s.num_objects;
   }
 
-  cache->async_refresh_response(user, bucket, bs);
+  cache->async_refresh_response(qs, bs);
 }
 
 class RGWBucketStatsCache : public RGWQuotaCache<rgw_bucket> {
 protected:
-  bool map_find(const string& user, rgw_bucket& bucket, RGWQuotaCacheStats& qs) {
+  bool map_find(const string& user, rgw_bucket& bucket, RGWQuotaCacheStatsRef& qs) {
     return stats_map.find(bucket, qs);
   }
 
-  bool map_find_and_update(const string& user, rgw_bucket& bucket, lru_map<rgw_bucket, RGWQuotaCacheStats>::UpdateContext *ctx) {
-    return stats_map.find_and_update(bucket, NULL, ctx);
-  }
-
-  void map_add(const string& user, rgw_bucket& bucket, RGWQuotaCacheStats& qs) {
-    stats_map.add(bucket, qs);
+  bool map_find_or_add(const string& user, rgw_bucket& bucket, RGWQuotaCacheStatsRef& qs) {
+    return stats_map.find_or_add(bucket, qs);
   }
 
   int fetch_stats_from_storage(const string& user, rgw_bucket& bucket, RGWStorageStats& stats);
@@ -309,8 +325,8 @@ public:
   RGWBucketStatsCache(RGWRados *_store) : RGWQuotaCache<rgw_bucket>(_store, _store->ctx()->_conf->rgw_bucket_quota_cache_size) {
   }
 
-  AsyncRefreshHandler *allocate_refresh_handler(const string& user, rgw_bucket& bucket) {
-    return new BucketAsyncRefreshHandler(store, this, user, bucket);
+  AsyncRefreshHandler *allocate_refresh_handler(const string& user, rgw_bucket& bucket, RGWQuotaCacheStatsRef& qs) {
+    return new BucketAsyncRefreshHandler(store, this, user, bucket, qs);
   }
 };
 
@@ -346,8 +362,8 @@ class UserAsyncRefreshHandler : public RGWQuotaCache<string>::AsyncRefreshHandle
   rgw_bucket bucket;
 public:
   UserAsyncRefreshHandler(RGWRados *_store, RGWQuotaCache<string> *_cache,
-                          const string& _user, rgw_bucket& _bucket) :
-                          RGWQuotaCache<string>::AsyncRefreshHandler(_store, _cache),
+                          const string& _user, rgw_bucket& _bucket, RGWQuotaCacheStatsRef& _qs) :
+                          RGWQuotaCache<string>::AsyncRefreshHandler(_store, _cache, _qs),
                           RGWGetUserStats_CB(_user),
                           bucket(_bucket) {}
 
@@ -374,10 +390,11 @@ void UserAsyncRefreshHandler::handle_response(int r)
 {
   if (r < 0) {
     ldout(store->ctx(), 20) << "AsyncRefreshHandler::handle_response() r=" << r << dendl;
-    return; /* nothing to do here */
+    cache->async_refresh_fail(qs, r);
+    return;
   }
 
-  cache->async_refresh_response(user, bucket, stats);
+  cache->async_refresh_response(qs, stats);
 }
 
 class RGWUserStatsCache : public RGWQuotaCache<string> {
@@ -474,16 +491,12 @@ class RGWUserStatsCache : public RGWQuotaCache<string> {
   BucketsSyncThread *buckets_sync_thread;
   UserSyncThread *user_sync_thread;
 protected:
-  bool map_find(const string& user, rgw_bucket& bucket, RGWQuotaCacheStats& qs) {
+  bool map_find(const string& user, rgw_bucket& bucket, RGWQuotaCacheStatsRef& qs) {
     return stats_map.find(user, qs);
   }
 
-  bool map_find_and_update(const string& user, rgw_bucket& bucket, lru_map<string, RGWQuotaCacheStats>::UpdateContext *ctx) {
-    return stats_map.find_and_update(user, NULL, ctx);
-  }
-
-  void map_add(const string& user, rgw_bucket& bucket, RGWQuotaCacheStats& qs) {
-    stats_map.add(user, qs);
+  bool map_find_or_add(const string& user, rgw_bucket& bucket, RGWQuotaCacheStatsRef& qs) {
+    return stats_map.find_or_add(user, qs);
   }
 
   int fetch_stats_from_storage(const string& user, rgw_bucket& bucket, RGWStorageStats& stats);
@@ -528,8 +541,8 @@ public:
     stop();
   }
 
-  AsyncRefreshHandler *allocate_refresh_handler(const string& user, rgw_bucket& bucket) {
-    return new UserAsyncRefreshHandler(store, this, user, bucket);
+  AsyncRefreshHandler *allocate_refresh_handler(const string& user, rgw_bucket& bucket, RGWQuotaCacheStatsRef& qs) {
+    return new UserAsyncRefreshHandler(store, this, user, bucket, qs);
   }
 
   bool can_use_cached_stats(RGWQuotaInfo& quota, RGWStorageStats& stats) {
@@ -0,0 +1,117 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#ifndef CEPH_RGW_QUOTA_CACHE_H
+#define CEPH_RGW_QUOTA_CACHE_H
+
+#include "include/utime.h"
+#include "include/atomic.h"
+#include "include/memory.h"
+#include "common/Mutex.h"
+#include "common/Cond.h"
+#include "common/Clock.h"
+
+#include "rgw_common.h"
+
+/*
+ * The stats of a bucket or a user as last read from storage, and what
+ * this gateway changed since: the request threads add to the deltas
+ * without taking a lock, and a refresh folds in those that were there
+ * when it started.  Only one read of the stats is ever in flight.
+ *
+ * A change that reaches storage before the read, but is added here only
+ * after the refresh started, is counted twice until the next refresh,
+ * which folds it in.
+ */
+struct RGWQuotaCacheStats {
+  Mutex lock;
+  Cond cond;                /* signalled as a read completes */
+  RGWStorageStats stats;
+  bool fetched;
+  int fetch_ret;            /* of the last read that failed, for those that waited on it */
+  int refresh_failures;     /* reads that failed in a row */
+  bool refreshing;
+  utime_t fetch_time;       /* of the stats we have */
+  utime_t refresh_time;
+
+  atomic64_t objs_delta;    /* two's complement */
+  atomic64_t kb_delta;
+  atomic64_t kb_rounded_delta;
+
+  /* the deltas the refresh in flight will fold in */
+  int64_t refresh_objs_delta;
+  int64_t refresh_kb_delta;
+  int64_t refresh_kb_rounded_delta;
+
+  RGWQuotaCacheStats() : lock("RGWQuotaCacheStats"), fetched(false), fetch_ret(0), refresh_failures(0),
+                         refreshing(false),
+                         refresh_objs_delta(0), refresh_kb_delta(0), refresh_kb_rounded_delta(0) {}
+
+  void adjust(int64_t objs, int64_t kb, int64_t kb_rounded) {
+    objs_delta.add((uint64_t)objs);
+    kb_delta.add((uint64_t)kb);
+    kb_rounded_delta.add((uint64_t)kb_rounded);
+  }
+
+  /* with the lock held */
+  void get(RGWStorageStats& out) {
+    out = stats;
+    out.num_objects += (int64_t)objs_delta.read();
+    out.num_kb += (int64_t)kb_delta.read();
+    out.num_kb_rounded += (int64_t)kb_rounded_delta.read();
+  }
+
+  /* with the lock held; whether the stats are too old to go on with */
+  bool expired(utime_t now, int max_age) {
+    if (max_age <= 0)
+      return false;
+    utime_t t = fetch_time;
+    t += max_age;
+    return t <= now;
+  }
+
+  /* with the lock held, as the read is sent */
+  void start_refresh() {
+    refreshing = true;
+    refresh_objs_delta = (int64_t)objs_delta.read();
+    refresh_kb_delta = (int64_t)kb_delta.read();
+    refresh_kb_rounded_delta = (int64_t)kb_rounded_delta.read();
+  }
+
+  /* with the lock held; the stats read include the deltas there were when it was sent */
+  void set(CephContext *cct, RGWStorageStats& _stats) {
+    stats = _stats;
+    objs_delta.sub((uint64_t)refresh_objs_delta);
+    kb_delta.sub((uint64_t)refresh_kb_delta);
+    kb_rounded_delta.sub((uint64_t)refresh_kb_rounded_delta);
+    refresh_objs_delta = refresh_kb_delta = refresh_kb_rounded_delta = 0;
+    fetched = true;
+    refreshing = false;
+    refresh_failures = 0;
+    fetch_time = ceph_clock_now(cct);
+    refresh_time = fetch_time;
+    refresh_time += cct->_conf->rgw_bucket_quota_ttl / 2;
+    cond.SignalAll();
+  }
+
+  /* with the lock held; the deltas stay for the next read to fold in */
+  void fail(int ret) {
+    refresh_objs_delta = refresh_kb_delta = refresh_kb_rounded_delta = 0;
+    refreshing = false;
+    fetch_ret = ret;
+    refresh_failures++;
+    cond.SignalAll();
+  }
+};
+typedef ceph::shared_ptr<RGWQuotaCacheStats> RGWQuotaCacheStatsRef;
+
+#endif
@@ -47,11 +47,12 @@ using namespace librados;
 #include "rgw_log.h"
 
 #include "rgw_gc.h"
+#include "rgw_reshard.h"
+#include "rgw_data_cache.h"
+#include "rgw_bucket_list.h"
 
 #define dout_subsys ceph_subsys_rgw
 
-#define MAX_BUCKET_INDEX_SHARDS_PRIME 7877
-
 using namespace std;
 
 static RGWCache<RGWRados> cached_rados_provider;
@@ -1428,6 +1429,13 @@ int RGWRados::get_max_chunk_size(rgw_bucket& bucket, uint64_t *max_chunk_size)
   return 0;
 }
 
+void RGWRados::invalidate_obj_data(rgw_obj& obj)
+{
+  if (data_cache) {
+    data_cache->invalidate(RGWDataCache::obj_key(obj));
+  }
+}
+
 void RGWRados::finalize()
 {
   if (finisher) {
@@ -1437,6 +1445,13 @@ void RGWRados::finalize()
   if (need_watch_notify()) {
     finalize_watch();
   }
+  delete data_cache;
+  data_cache = NULL;
+  if (reshard) {
+    reshard->stop_processor();
+    delete reshard;
+    reshard = NULL;
+  }
   delete meta_mgr;
   delete data_log;
   if (use_gc_thread) {
@@ -1615,6 +1630,23 @@ int RGWRados::init_complete()
   if (use_gc_thread)
     gc->start_processor();
 
+  if (use_gc_thread && cct->_conf->rgw_dynamic_resharding) {
+    reshard = new RGWReshard();
+    reshard->initialize(cct, this);
+    reshard->start_processor();
+  }
+
+  /* other gateways drop what they cached through the cache notifications */
+  if (use_gc_thread && need_watch_notify() && cct->_conf->rgw_data_cache_enabled) {
+    data_cache = new RGWDataCache(cct);
+    ret = data_cache->init();
+    if (ret < 0) {
+      delete data_cache;
+      data_cache = NULL;
+      return ret;
+    }
+  }
+
   quota_handler = RGWQuotaHandler::generate_handler(this, quota_threads);
 
   bucket_index_max_shards = (cct->_conf->rgw_override_bucket_index_max_shards ? cct->_conf->rgw_override_bucket_index_max_shards :
@@ -2409,6 +2441,11 @@ int RGWRados::Bucket::List::list_objects(int max, vector<RGWObjEnt> *result,
   if (store->bucket_is_system(bucket)) {
     return -EINVAL;
   }
+  if (params.allow_unordered) {
+    if (!params.delim.empty())
+      return -EINVAL;
+    return list_objects_unordered(max, result, is_truncated);
+  }
   result->clear();
 
   rgw_obj marker_obj, end_marker_obj, prefix_obj;
@@ -2446,6 +2483,18 @@ int RGWRados::Bucket::List::list_objects(int max, vector<RGWObjEnt> *result,
     bigger_than_delim = buf;
   }
 
+  /*
+   * The index skips over the common prefixes itself, when its keys group
+   * the same way the object names do: not so for the delimiters that can
+   * match the '_' namespaced and escaped keys start with, nor when filters
+   * could drop the one entry a prefix is listed by.
+   */
+  string index_delim;
+  if (!params.delim.empty() && params.delim[0] != '_' && !params.filter &&
+      (params.enforce_ns || !params.ns.empty())) {
+    index_delim = params.delim;
+  }
+
   string skip_after_delim;
 
   /* if marker points at a common prefix, fast forward it into its upperbound string */
@@ -2464,8 +2513,8 @@ int RGWRados::Bucket::List::list_objects(int max, vector<RGWObjEnt> *result,
       ldout(cct, 20) << "setting cur_marker=" << cur_marker.name << "[" << cur_marker.instance << "]" << dendl;
     }
     std::map<string, RGWObjEnt> ent_map;
-    int r = store->cls_bucket_list(bucket, cur_marker, cur_prefix, max + 1 - count, params.list_versions, ent_map,
-                            &truncated, &cur_marker);
+    int r = store->cls_bucket_list(bucket, cur_marker, cur_prefix, index_delim, max + 1 - count, params.list_versions, ent_map,
+                            &truncated, &cur_marker, NULL, &cursor);
     if (r < 0)
       return r;
 
@@ -2565,6 +2614,93 @@ done:
   return 0;
 }
 
+/*
+ * Like list_objects(), but a shard after the other.  The listing goes on
+ * from the shard the marker is in; end_marker only filters, as listing
+ * does not get past it at any point.
+ */
+int RGWRados::Bucket::List::list_objects_unordered(int max, vector<RGWObjEnt> *result,
+                                                   bool *is_truncated)
+{
+  RGWRados *store = target->get_store();
+  CephContext *cct = store->ctx();
+  rgw_bucket& bucket = target->get_bucket();
+
+  int count = 0;
+  bool truncated = true;
+
+  result->clear();
+
+  rgw_obj marker_obj, end_marker_obj, prefix_obj;
+  marker_obj.set_instance(params.marker.instance);
+  marker_obj.set_ns(params.ns);
+  marker_obj.set_obj(params.marker.name);
+  rgw_obj_key cur_marker;
+  marker_obj.get_index_key(&cur_marker);
+
+  end_marker_obj.set_instance(params.end_marker.instance);
+  end_marker_obj.set_ns(params.ns);
+  end_marker_obj.set_obj(params.end_marker.name);
+  rgw_obj_key cur_end_marker;
+  if (params.ns.empty()) { /* no support for end marker for namespaced objects */
+    end_marker_obj.get_index_key(&cur_end_marker);
+  }
+  const bool cur_end_marker_valid = !cur_end_marker.empty();
+
+  prefix_obj.set_ns(params.ns);
+  prefix_obj.set_obj(params.prefix);
+  string cur_prefix = prefix_obj.get_index_key_name();
+
+  while (truncated && count < max) {
+    vector<RGWObjEnt> ent_list;
+    int r = store->cls_bucket_list_unordered(bucket, cur_marker, cur_prefix, max - count, params.list_versions,
+                                             ent_list, &truncated, &cur_marker);
+    if (r < 0)
+      return r;
+
+    for (vector<RGWObjEnt>::iterator eiter = ent_list.begin(); eiter != ent_list.end(); ++eiter) {
+      RGWObjEnt& entry = *eiter;
+      rgw_obj_key obj = entry.key;
+      rgw_obj_key key = obj;
+      string instance;
+      string ns;
+
+      bool valid = rgw_obj::parse_raw_oid(obj.name, &obj.name, &instance, &ns);
+      if (!valid) {
+        ldout(cct, 0) << "ERROR: could not parse object name: " << obj.name << dendl;
+        continue;
+      }
+      if (!params.list_versions && !entry.is_visible()) {
+        continue;
+      }
+      if (params.enforce_ns && ns != params.ns) {
+        continue;
+      }
+      if (cur_end_marker_valid && cur_end_marker <= obj) {
+        continue;
+      }
+      if (params.filter && !params.filter->filter(obj.name, key.name))
+        continue;
+      if (params.prefix.size() && (obj.name.compare(0, params.prefix.size(), params.prefix) != 0))
+        continue;
+
+      params.marker = obj;
+      next_marker = obj;
+
+      RGWObjEnt ent = entry;
+      ent.key = obj;
+      ent.ns = ns;
+      result->push_back(ent);
+      count++;
+    }
+  }
+
+  if (is_truncated)
+    *is_truncated = truncated;
+
+  return 0;
+}
+
 /**
  * create a rados pool, associated meta info
  * returns 0 on success, -ERR# otherwise.
@@ -2593,7 +2729,7 @@ int RGWRados::create_pool(rgw_bucket& bucket)
   return 0;
 }
 
-int RGWRados::init_bucket_index(rgw_bucket& bucket, int num_shards)
+int RGWRados::init_bucket_index(rgw_bucket& bucket, int num_shards, uint32_t index_gen)
 {
   librados::IoCtx index_ctx; // context for new bucket
 
@@ -2601,8 +2737,7 @@ int RGWRados::init_bucket_index(rgw_bucket& bucket, int num_shards)
   if (r < 0)
     return r;
 
-  string dir_oid =  dir_oid_prefix;
-  dir_oid.append(bucket.marker);
+  string dir_oid = get_bucket_index_oid_base(bucket, index_gen);
 
   map<int, string> bucket_objs;
   get_bucket_index_objects(dir_oid, num_shards, bucket_objs);
@@ -3281,21 +3416,57 @@ int RGWRados::fix_tail_obj_locator(rgw_bucket& bucket, rgw_obj_key& key, bool fi
 int RGWRados::BucketShard::init(rgw_bucket& _bucket, rgw_obj& obj)
 {
   bucket = _bucket;
+  reshard_obj.clear();
 
   if (store->bucket_is_system(bucket)) {
     return 0;
   }
 
-  int ret = store->open_bucket_index_shard(bucket, index_ctx, obj.get_hash_object(), &bucket_obj, &shard_id);
+  RGWBucketInfo binfo;
+  int ret = store->open_bucket_index_shard(bucket, index_ctx, obj.get_hash_object(), &bucket_obj, &shard_id, &binfo);
   if (ret < 0) {
     ldout(store->ctx(), 0) << "ERROR: open_bucket_index_shard() returned ret=" << ret << dendl;
     return ret;
   }
   ldout(store->ctx(), 20) << " bucket index object: " << bucket_obj << dendl;
 
+  log_op = store->need_to_log_data();
+  if (binfo.resharding()) {
+    /* the reshard replays the log of the old index (which the index
+     * shard makes sure of, whatever we think), and the new index gets
+     * the same updates so that it is current when it takes over */
+    log_op = true;
+    string base = store->get_bucket_index_oid_base(bucket, binfo.index_gen + 1);
+    ret = store->get_bucket_index_object(base, obj.get_hash_object(), binfo.new_num_shards,
+        (RGWBucketInfo::BIShardsHashType)binfo.bucket_index_shard_hash_type, &reshard_obj, NULL);
+    if (ret < 0) {
+      ldout(store->ctx(), 0) << "ERROR: get_bucket_index_object() returned ret=" << ret << dendl;
+      return ret;
+    }
+    ldout(store->ctx(), 20) << " resharding, new bucket index object: " << reshard_obj << dendl;
+  }
+
   return 0;
 }
 
+#define RESHARD_RETRIES 10
+#define RESHARD_RETRY_USEC (100 * 1000)
+
+/*
+ * An index shard returns -ESTALE once a reshard moved the bucket to a
+ * new index.  The bucket info changed before that, so a fresh lookup
+ * finds the new index once the change reached our cache.
+ */
+static bool retry_resharded(CephContext *cct, int r, int *tries)
+{
+  if (r != -ESTALE || *tries >= RESHARD_RETRIES)
+    return false;
+  ++(*tries);
+  ldout(cct, 10) << "bucket index shard was resharded, retrying (" << *tries << ")" << dendl;
+  usleep(RESHARD_RETRY_USEC * *tries);
+  return true;
+}
+
 
 /**
  * Write/overwrite an object to the bucket storage.
@@ -3450,6 +3621,8 @@ int RGWRados::Object::Write::write_meta(uint64_t size,
   target->invalidate_state();
   state = NULL;
 
+  store->invalidate_obj_data(obj);
+
   if (versioned_op) {
     r = store->set_olh(target->get_ctx(), target->get_bucket_info(), obj, false, NULL, meta.olh_epoch);
     if (r < 0) {
@@ -4307,11 +4480,12 @@ int RGWRados::delete_bucket(rgw_bucket& bucket, RGWObjVersionTracker& objv_track
   rgw_obj_key marker;
   string prefix;
   bool is_truncated;
+  RGWBucketListCursor cursor;
 
   do {
 #define NUM_ENTRIES 1000
-    r = cls_bucket_list(bucket, marker, prefix, NUM_ENTRIES, true, ent_map,
-                        &is_truncated, &marker);
+    r = cls_bucket_list(bucket, marker, prefix, string(), NUM_ENTRIES, true, ent_map,
+                        &is_truncated, &marker, NULL, &cursor);
     if (r < 0)
       return r;
 
@@ -4474,7 +4648,7 @@ int RGWRados::open_bucket_index(rgw_bucket& bucket, librados::IoCtx& index_ctx,
 }
 
 int RGWRados::open_bucket_index_base(rgw_bucket& bucket, librados::IoCtx& index_ctx,
-    string& bucket_oid_base) {
+    string& bucket_oid_base, uint32_t index_gen) {
   if (bucket_is_system(bucket))
     return -EINVAL;
 
@@ -4487,8 +4661,7 @@ int RGWRados::open_bucket_index_base(rgw_bucket& bucket, librados::IoCtx& index_
     return -EIO;
   }
 
-  bucket_oid_base = dir_oid_prefix;
-  bucket_oid_base.append(bucket.marker);
+  bucket_oid_base = get_bucket_index_oid_base(bucket, index_gen);
 
   return 0;
 
@@ -4496,16 +4669,19 @@ int RGWRados::open_bucket_index_base(rgw_bucket& bucket, librados::IoCtx& index_
 
 int RGWRados::open_bucket_index(rgw_bucket& bucket, librados::IoCtx& index_ctx,
     map<int, string>& bucket_objs, int shard_id, map<int, string> *bucket_instance_ids) {
-  string bucket_oid_base;
-  int ret = open_bucket_index_base(bucket, index_ctx, bucket_oid_base);
-  if (ret < 0)
-    return ret;
+  if (bucket_is_system(bucket))
+    return -EINVAL;
 
   RGWObjectCtx obj_ctx(this);
 
   // Get the bucket info
   RGWBucketInfo binfo;
-  ret = get_bucket_instance_info(obj_ctx, bucket, binfo, NULL, NULL);
+  int ret = get_bucket_instance_info(obj_ctx, bucket, binfo, NULL, NULL);
+  if (ret < 0)
+    return ret;
+
+  string bucket_oid_base;
+  ret = open_bucket_index_base(bucket, index_ctx, bucket_oid_base, binfo.index_gen);
   if (ret < 0)
     return ret;
 
@@ -4533,18 +4709,22 @@ int RGWRados::open_bucket_index(rgw_bucket& bucket, librados::IoCtx& index_ctx,
 }
 
 int RGWRados::open_bucket_index_shard(rgw_bucket& bucket, librados::IoCtx& index_ctx,
-    const string& obj_key, string *bucket_obj, int *shard_id)
+    const string& obj_key, string *bucket_obj, int *shard_id, RGWBucketInfo *pinfo)
 {
-  string bucket_oid_base;
-  int ret = open_bucket_index_base(bucket, index_ctx, bucket_oid_base);
-  if (ret < 0)
-    return ret;
+  if (bucket_is_system(bucket))
+    return -EINVAL;
 
   RGWObjectCtx obj_ctx(this);
 
   // Get the bucket info
-  RGWBucketInfo binfo;
-  ret = get_bucket_instance_info(obj_ctx, bucket, binfo, NULL, NULL);
+  RGWBucketInfo info;
+  RGWBucketInfo& binfo = (pinfo ? *pinfo : info);
+  int ret = get_bucket_instance_info(obj_ctx, bucket, binfo, NULL, NULL);
+  if (ret < 0)
+    return ret;
+
+  string bucket_oid_base;
+  ret = open_bucket_index_base(bucket, index_ctx, bucket_oid_base, binfo.index_gen);
   if (ret < 0)
     return ret;
 
@@ -4772,6 +4952,8 @@ int RGWRados::Object::Delete::delete_obj()
       ldout(store->ctx(), 0) << "ERROR: complete_atomic_modification returned ret=" << ret << dendl;
     }
     /* other than that, no need to propagate error */
+
+    store->invalidate_obj_data(obj);
   }
 
   if (need_invalidate) {
@@ -5843,6 +6025,8 @@ struct get_obj_aio_data {
 struct get_obj_io {
   off_t len;
   bufferlist bl;
+
+  get_obj_io() : len(0) {}
 };
 
 static void _get_obj_aio_completion_cb(completion_t cb, void *arg);
@@ -5863,6 +6047,9 @@ struct get_obj_data : public RefCountedObject {
   atomic_t err_code;
   Throttle throttle;
   list<bufferlist> read_list;
+  string cache_key;   /* the data cache name of the object, if its data is cached */
+  string cache_tag;
+  list<pair<off_t, bufferlist> > cache_fill;  /* read, not cached yet; under data_lock */
 
   get_obj_data(CephContext *_cct)
     : cct(_cct),
@@ -5916,6 +6103,7 @@ struct get_obj_data : public RefCountedObject {
     Mutex::Locker l(lock);
 
     get_obj_io& io = io_map[ofs];
+    io.len = len;
     *pbl = &io.bl;
 
     struct get_obj_aio_data aio;
@@ -6004,6 +6192,9 @@ struct get_obj_data : public RefCountedObject {
 
       map<off_t, get_obj_io>::iterator old_liter = liter++;
       bl_list.push_back(old_liter->second.bl);
+      if (!cache_key.empty() && r == old_liter->second.len) {
+        cache_fill.push_back(make_pair(old_liter->first, old_liter->second.bl));
+      }
       io_map.erase(old_liter);
     }
 
@@ -6073,6 +6264,8 @@ int RGWRados::flush_read_list(struct get_obj_data *d)
   d->data_lock.Lock();
   list<bufferlist> l;
   l.swap(d->read_list);
+  list<pair<off_t, bufferlist> > fill;
+  fill.swap(d->cache_fill);
   d->get();
   d->read_list.clear();
 
@@ -6090,6 +6283,12 @@ int RGWRados::flush_read_list(struct get_obj_data *d)
     }
   }
 
+  if (data_cache) {
+    for (list<pair<off_t, bufferlist> >::iterator fiter = fill.begin(); fiter != fill.end(); ++fiter) {
+      data_cache->put(d->cache_key, d->cache_tag, fiter->first, fiter->second);
+    }
+  }
+
   d->data_lock.Lock();
   d->put();
   if (r < 0) {
@@ -6143,6 +6342,43 @@ int RGWRados::get_obj_iterate_cb(RGWObjectCtx *ctx, RGWObjState *astate,
     }
   }
 
+  if (!d->cache_key.empty() && d->cache_tag.empty()) {
+    /* only what can be told apart from what the object is rewritten with */
+    if (astate && astate->obj_tag.length() && !astate->fake_tag &&
+        astate->size <= cct->_conf->rgw_data_cache_max_obj_size) {
+      d->cache_tag = string(astate->obj_tag.c_str(), astate->obj_tag.length());
+    } else {
+      d->cache_key.clear();
+    }
+  }
+
+  if (!d->cache_key.empty()) {
+    bufferlist cached_bl;
+    if (data_cache->get(d->cache_key, d->cache_tag, obj_ofs, len, &cached_bl)) {
+      /* the reads in flight come before it */
+      bool done = false;
+      while (!done) {
+        r = d->wait_next_io(&done);
+        if (r < 0)
+          return r;
+        r = flush_read_list(d);
+        if (r < 0)
+          return r;
+      }
+
+      d->data_lock.Lock();
+      r = d->client_cb->handle_data(cached_bl, 0, len);
+      d->data_lock.Unlock();
+      if (r < 0)
+        return r;
+
+      d->lock.Lock();
+      d->total_read += len;
+      d->lock.Unlock();
+      return 0;
+    }
+  }
+
   get_obj_bucket_and_oid_loc(obj, bucket, oid, key);
 
   d->throttle.get(len);
@@ -6194,6 +6430,9 @@ int RGWRados::Object::Read::iterate(int64_t ofs, int64_t end, RGWGetDataCB *cb)
   data->rados = store;
   data->io_ctx.dup(state.io_ctx);
   data->client_cb = cb;
+  if (store->data_cache) {
+    data->cache_key = RGWDataCache::obj_key(state.obj);
+  }
 
   int r = store->iterate_obj(obj_ctx, state.obj, ofs, end, cct->_conf->rgw_get_obj_max_req_size, _get_obj_iterate_cb, (void *)data);
   if (r < 0) {
@@ -6446,8 +6685,11 @@ int RGWRados::bucket_index_link_olh(RGWObjState& olh_state, rgw_obj& obj_instanc
   }
 
   cls_rgw_obj_key key(obj_instance.get_index_key_name(), obj_instance.get_instance());
-  ret = cls_rgw_bucket_link_olh(bs.index_ctx, bs.bucket_obj, key, olh_state.olh_tag, delete_marker, op_tag, meta, olh_epoch,
-                                zone_public_config.log_data);
+  int tries = 0;
+  do {
+    ret = cls_rgw_bucket_link_olh(bs.index_ctx, bs.bucket_obj, key, olh_state.olh_tag, delete_marker, op_tag, meta, olh_epoch,
+                                  bs.log_op);
+  } while (retry_resharded(cct, ret, &tries) && (ret = bs.init(bucket, obj_instance)) == 0);
   if (ret < 0) {
     return ret;
   }
@@ -6478,7 +6720,10 @@ int RGWRados::bucket_index_unlink_instance(rgw_obj& obj_instance, const string&
   }
 
   cls_rgw_obj_key key(obj_instance.get_index_key_name(), obj_instance.get_instance());
-  ret = cls_rgw_bucket_unlink_instance(bs.index_ctx, bs.bucket_obj, key, op_tag, olh_epoch, zone_public_config.log_data);
+  int tries = 0;
+  do {
+    ret = cls_rgw_bucket_unlink_instance(bs.index_ctx, bs.bucket_obj, key, op_tag, olh_epoch, bs.log_op);
+  } while (retry_resharded(cct, ret, &tries) && (ret = bs.init(bucket, obj_instance)) == 0);
   if (ret < 0) {
     return ret;
   }
@@ -7504,6 +7749,59 @@ int RGWRados::omap_get_all(rgw_obj& obj, bufferlist& header, std::map<string, bu
   return omap_get_vals(obj, header, start_after, (uint64_t)-1, m);
 }
 
+int RGWRados::omap_get_vals_ranges(rgw_obj& obj, const vector<pair<string, uint64_t> >& ranges,
+                                   vector<std::map<string, bufferlist> >& results, int max_aio)
+{
+  rgw_rados_ref ref;
+  rgw_bucket bucket;
+  int r = get_obj_ref(obj, &ref, &bucket);
+  if (r < 0) {
+    return r;
+  }
+
+  if (max_aio < 1)
+    max_aio = 1;
+
+  results.clear();
+  results.resize(ranges.size());
+  vector<int> rvals(ranges.size());
+  list<pair<size_t, AioCompletion *> > pending;
+  size_t next = 0;
+  int ret = 0;
+
+  while (next < ranges.size() || !pending.empty()) {
+    if (next < ranges.size() && ret == 0 && (int)pending.size() < max_aio) {
+      librados::ObjectReadOperation op;
+      op.omap_get_vals(ranges[next].first, ranges[next].second, &results[next], &rvals[next]);
+      AioCompletion *c = librados::Rados::aio_create_completion(NULL, NULL, NULL);
+      r = ref.ioctx.aio_operate(ref.oid, c, &op, NULL);
+      if (r < 0) {
+        c->release();
+        ret = r;
+        continue;
+      }
+      pending.push_back(make_pair(next, c));
+      next++;
+      continue;
+    }
+    if (pending.empty())
+      break;
+
+    size_t i = pending.front().first;
+    AioCompletion *c = pending.front().second;
+    pending.pop_front();
+    c->wait_for_complete();
+    r = c->get_return_value();
+    c->release();
+    if (r >= 0)
+      r = rvals[i];
+    if (r < 0 && ret == 0)
+      ret = r;
+  }
+
+  return ret;
+}
+
 int RGWRados::omap_set(rgw_obj& obj, std::string& key, bufferlist& bl)
 {
   rgw_rados_ref ref;
@@ -7920,6 +8218,18 @@ int RGWRados::list_gc_objs(int *index, string& marker, uint32_t max, bool expire
   return gc->list(index, marker, max, expired_only, result, truncated);
 }
 
+int RGWRados::get_gc_stats(std::list<RGWGCShardStats>& stats)
+{
+  for (int i = 0; i < gc->get_max_objs(); i++) {
+    RGWGCShardStats shard_stats;
+    int ret = gc->get_stats(i, &shard_stats);
+    if (ret < 0)
+      return ret;
+    stats.push_back(shard_stats);
+  }
+  return 0;
+}
+
 int RGWRados::process_gc()
 {
   return gc->process();
@@ -7936,10 +8246,27 @@ int RGWRados::cls_rgw_init_index(librados::IoCtx& index_ctx, librados::ObjectWri
 int RGWRados::cls_obj_prepare_op(BucketShard& bs, RGWModifyOp op, string& tag,
                                  rgw_obj& obj, uint16_t bilog_flags)
 {
-  ObjectWriteOperation o;
   cls_rgw_obj_key key(obj.get_index_key_name(), obj.get_instance());
-  cls_rgw_bucket_prepare_op(o, op, tag, key, obj.get_loc(), zone_public_config.log_data, bilog_flags);
-  int r = bs.index_ctx.operate(bs.bucket_obj, &o);
+  int r;
+  int tries = 0;
+  do {
+    ObjectWriteOperation o;
+    cls_rgw_bucket_prepare_op(o, op, tag, key, obj.get_loc(), bs.log_op, bilog_flags);
+    r = bs.index_ctx.operate(bs.bucket_obj, &o);
+  } while (retry_resharded(cct, r, &tries) && (r = bs.init(bs.bucket, obj)) == 0);
+  if (r < 0 || bs.reshard_obj.empty())
+    return r;
+
+  /* the reshard reconciles the new index from the log anyway; this only
+   * keeps it close, so a failure here is not fatal.  The new index may
+   * be gone with a cancelled reshard, and must not come back. */
+  ObjectWriteOperation ro;
+  ro.assert_exists();
+  cls_rgw_bucket_prepare_op(ro, op, tag, key, obj.get_loc(), zone_public_config.log_data, bilog_flags);
+  int ret = bs.index_ctx.operate(bs.reshard_obj, &ro);
+  if (ret < 0) {
+    ldout(cct, 5) << "prepare on " << bs.reshard_obj << " returned ret=" << ret << dendl;
+  }
   return r;
 }
 
@@ -7976,11 +8303,26 @@ int RGWRados::cls_obj_complete_op(BucketShard& bs, RGWModifyOp op, string& tag,
   ver.epoch = epoch;
   cls_rgw_obj_key key(ent.key.name, ent.key.instance);
   cls_rgw_bucket_complete_op(o, op, tag, ver, key, dir_meta, pro,
-                             zone_public_config.log_data, bilog_flags);
+                             bs.log_op, bilog_flags);
 
+  /* nobody waits for this: the shard the op was prepared on takes it
+   * even if it was resharded since, and the reshard waits for it */
   AioCompletion *c = librados::Rados::aio_create_completion(NULL, NULL, NULL);
   int ret = bs.index_ctx.aio_operate(bs.bucket_obj, c, &o);
   c->release();
+  if (ret < 0 || bs.reshard_obj.empty())
+    return ret;
+
+  ObjectWriteOperation reshard_o;
+  reshard_o.assert_exists();
+  cls_rgw_bucket_complete_op(reshard_o, op, tag, ver, key, dir_meta, pro,
+                             zone_public_config.log_data, bilog_flags);
+  c = librados::Rados::aio_create_completion(NULL, NULL, NULL);
+  int r = bs.index_ctx.aio_operate(bs.reshard_obj, c, &reshard_o);
+  c->release();
+  if (r < 0) {
+    ldout(cct, 5) << "complete on " << bs.reshard_obj << " returned ret=" << r << dendl;
+  }
   return ret;
 }
 
@@ -8021,79 +8363,162 @@ int RGWRados::cls_obj_set_bucket_tag_timeout(rgw_bucket& bucket, uint64_t timeou
   return CLSRGWIssueSetTagTimeout(index_ctx, bucket_objs, cct->_conf->rgw_bucket_index_max_aio, timeout)();
 }
 
+/*
+ * Lists the index objects of a bucket for RGWBucketListMerger.
+ */
+class RGWRadosBucketListSource : public RGWBucketListSource {
+  librados::IoCtx& index_ctx;
+  map<int, string>& oids;
+  string prefix;
+  string delimiter;
+  bool list_versions;
+
+  struct Pending {
+    librados::AioCompletion *c;
+    rgw_cls_list_ret result;
+    int ret;
+
+    Pending() : c(NULL), ret(0) {}
+  };
+  map<int, Pending> pending;
+
+public:
+  RGWRadosBucketListSource(librados::IoCtx& _index_ctx, map<int, string>& _oids,
+                           const string& _prefix, const string& _delimiter, bool _list_versions)
+    : index_ctx(_index_ctx), oids(_oids), prefix(_prefix), delimiter(_delimiter),
+      list_versions(_list_versions) {}
+
+  ~RGWRadosBucketListSource() {
+    for (map<int, Pending>::iterator iter = pending.begin(); iter != pending.end(); ++iter) {
+      librados::AioCompletion *c = iter->second.c;
+      if (c) {
+        c->wait_for_complete();
+        c->release();
+      }
+    }
+  }
+
+  int aio_list(int shard_id, const cls_rgw_obj_key& marker, uint32_t max) {
+    Pending& p = pending[shard_id];
+    assert(!p.c);
+    p.result = rgw_cls_list_ret();
+    p.ret = 0;
+
+    librados::ObjectReadOperation op;
+    cls_rgw_bucket_list_op(op, marker, prefix, delimiter, max, list_versions, &p.result, &p.ret);
+    p.c = librados::Rados::aio_create_completion(NULL, NULL, NULL);
+    int r = index_ctx.aio_operate(oids[shard_id], p.c, &op, NULL);
+    if (r < 0) {
+      p.c->release();
+      p.c = NULL;
+    }
+    return r;
+  }
+
+  int wait_list(int shard_id, rgw_cls_list_ret *result) {
+    Pending& p = pending[shard_id];
+    assert(p.c);
+    p.c->wait_for_complete();
+    int r = p.c->get_return_value();
+    p.c->release();
+    p.c = NULL;
+    if (r >= 0)
+      r = p.ret;
+    if (r < 0)
+      return r;
+    *result = p.result;
+    return 0;
+  }
+};
+
+void RGWBucketListCursor::clear()
+{
+  delete merger;
+  merger = NULL;
+  delete source;
+  source = NULL;
+  oids.clear();
+}
+
+static void dir_entry_to_obj_ent(rgw_bucket_dir_entry& dirent, RGWObjEnt *e)
+{
+  e->key.set(dirent.key.name, dirent.key.instance);
+  e->size = dirent.meta.size;
+  e->mtime = dirent.meta.mtime;
+  e->etag = dirent.meta.etag;
+  e->owner = dirent.meta.owner;
+  e->owner_display_name = dirent.meta.owner_display_name;
+  e->content_type = dirent.meta.content_type;
+  e->tag = dirent.tag;
+  e->flags = dirent.flags;
+  e->versioned_epoch = dirent.versioned_epoch;
+}
+
 int RGWRados::cls_bucket_list(rgw_bucket& bucket, rgw_obj_key& start, const string& prefix,
-		              uint32_t num_entries, bool list_versions, map<string, RGWObjEnt>& m,
+			      const string& delimiter, uint32_t num_entries, bool list_versions, map<string, RGWObjEnt>& m,
 			      bool *is_truncated, rgw_obj_key *last_entry,
-			      bool (*force_check_filter)(const string&  name))
+			      bool (*force_check_filter)(const string&  name),
+			      RGWBucketListCursor *cursor)
 {
   ldout(cct, 10) << "cls_bucket_list " << bucket << " start " << start.name << "[" << start.instance << "] num_entries " << num_entries << dendl;
 
-  librados::IoCtx index_ctx;
-  // key   - oid (for different shards if there is any)
-  // value - list result for the corresponding oid (shard), it is filled by the AIO callback
-  map<int, string> oids;
-  map<int, struct rgw_cls_list_ret> list_results;
-  int r = open_bucket_index(bucket, index_ctx, oids);
-  if (r < 0)
-    return r;
-
-  cls_rgw_obj_key start_key(start.name, start.instance);
-  r = CLSRGWIssueBucketList(index_ctx, start_key, prefix, num_entries, list_versions,
-                            oids, list_results, cct->_conf->rgw_bucket_index_max_aio)();
-  if (r < 0)
-    return r;
-
-  // Create a list of iterators that are used to iterate each shard
-  vector<map<string, struct rgw_bucket_dir_entry>::iterator> vcurrents(list_results.size());
-  vector<map<string, struct rgw_bucket_dir_entry>::iterator> vends(list_results.size());
-  vector<string> vnames(list_results.size());
-  map<int, struct rgw_cls_list_ret>::iterator iter = list_results.begin();
-  *is_truncated = false;
-  for (; iter != list_results.end(); ++iter) {
-    vcurrents.push_back(iter->second.dir.m.begin());
-    vends.push_back(iter->second.dir.m.end());
-    vnames.push_back(oids[iter->first]);
-    *is_truncated = (*is_truncated || iter->second.is_truncated);
+  RGWBucketListCursor local_cursor;
+  if (!cursor) {
+    cursor = &local_cursor;
   }
 
-  // Create a map to track the next candidate entry from each shard, if the entry
-  // from a specified shard is selected/erased, the next entry from that shard will
-  // be inserted for next round selection
-  map<string, size_t> candidates;
-  for (size_t i = 0; i < vcurrents.size(); ++i) {
-    if (vcurrents[i] != vends[i]) {
-      candidates[vcurrents[i]->first] = i;
+  if (!cursor->merger || cursor->prefix != prefix || cursor->delimiter != delimiter ||
+      cursor->list_versions != list_versions) {
+    cursor->clear();
+    int r = open_bucket_index(bucket, cursor->index_ctx, cursor->oids);
+    if (r < 0)
+      return r;
+
+    cursor->prefix = prefix;
+    cursor->delimiter = delimiter;
+    cursor->list_versions = list_versions;
+    cursor->source = new RGWRadosBucketListSource(cursor->index_ctx, cursor->oids, prefix, delimiter,
+                                                  list_versions);
+    set<int> shard_ids;
+    for (map<int, string>::iterator iter = cursor->oids.begin(); iter != cursor->oids.end(); ++iter) {
+      shard_ids.insert(iter->first);
     }
+    cursor->merger = new RGWBucketListMerger(cursor->source, shard_ids);
   }
+  RGWBucketListMerger *merger = cursor->merger;
+
+  cls_rgw_obj_key start_key(start.name, start.instance);
+  int r = merger->seek(start_key, num_entries);
+  if (r < 0)
+    return r;
 
   map<string, bufferlist> updates;
   uint32_t count = 0;
-  while (count < num_entries && !candidates.empty()) {
-    // Select the next one
-    int pos = candidates.begin()->second;
-    const string& name = vcurrents[pos]->first;
-    struct rgw_bucket_dir_entry& dirent = vcurrents[pos]->second;
+  bool consumed = false;
+  while (count < num_entries) {
+    string name;
+    struct rgw_bucket_dir_entry dirent;
+    int shard_id;
+    r = merger->next(&name, &dirent, &shard_id);
+    if (r == -ENOENT) {
+      r = 0;
+      break;
+    }
+    if (r < 0)
+      return r;
+    consumed = true;
 
     // fill it in with initial values; we may correct later
     RGWObjEnt e;
-    e.key.set(dirent.key.name, dirent.key.instance);
-    e.size = dirent.meta.size;
-    e.mtime = dirent.meta.mtime;
-    e.etag = dirent.meta.etag;
-    e.owner = dirent.meta.owner;
-    e.owner_display_name = dirent.meta.owner_display_name;
-    e.content_type = dirent.meta.content_type;
-    e.tag = dirent.tag;
-    e.flags = dirent.flags;
-    e.versioned_epoch = dirent.versioned_epoch;
+    dir_entry_to_obj_ent(dirent, &e);
 
     bool force_check = force_check_filter && force_check_filter(dirent.key.name);
     if ((!dirent.exists && !dirent.is_delete_marker()) || !dirent.pending_map.empty() || force_check) {
       /* there are uncommitted ops. We need to check the current state,
        * and if the tags are old we need to do cleanup as well. */
       librados::IoCtx sub_ctx;
-      sub_ctx.dup(index_ctx);
-      r = check_disk_state(sub_ctx, bucket, dirent, e, updates[vnames[pos]]);
+      sub_ctx.dup(cursor->index_ctx);
+      r = check_disk_state(sub_ctx, bucket, dirent, e, updates[cursor->oids[shard_id]]);
       if (r < 0 && r != -ENOENT) {
           return r;
       }
@@ -8103,13 +8528,6 @@ int RGWRados::cls_bucket_list(rgw_bucket& bucket, rgw_obj_key& start, const stri
       ldout(cct, 10) << "RGWRados::cls_bucket_list: got " << e.key.name << "[" << e.key.instance << "]" << dendl;
       ++count;
     }
-
-    // Refresh the candidates map
-    candidates.erase(candidates.begin());
-    ++vcurrents[pos];
-    if (vcurrents[pos] != vends[pos]) {
-      candidates[vcurrents[pos]->first] = pos;
-    }
   }
 
   // Suggest updates if there is any
@@ -8120,19 +8538,118 @@ int RGWRados::cls_bucket_list(rgw_bucket& bucket, rgw_obj_key& start, const stri
       cls_rgw_suggest_changes(o, miter->second);
       // we don't care if we lose suggested updates, send them off blindly
       AioCompletion *c = librados::Rados::aio_create_completion(NULL, NULL, NULL);
-      index_ctx.aio_operate(miter->first, c, &o);
+      cursor->index_ctx.aio_operate(miter->first, c, &o);
         c->release();
     }
   }
 
-  // Check if all the returned entries are consumed or not
-  for (size_t i = 0; i < vcurrents.size(); ++i) {
-    if (vcurrents[i] != vends[i])
-      *is_truncated = true;
+  *is_truncated = merger->is_truncated();
+  /* past the entries that were dropped, too */
+  if (consumed)
+    *last_entry = merger->get_last_key();
+
+  ldout(cct, 20) << "cls_bucket_list: fetched " << merger->get_entries_fetched() << " entries in "
+                 << merger->get_fetches() << " requests so far" << dendl;
+  return 0;
+}
+
+int RGWRados::cls_bucket_list_unordered(rgw_bucket& bucket, rgw_obj_key& start, const string& prefix,
+                                        uint32_t num_entries, bool list_versions, vector<RGWObjEnt>& ent_list,
+                                        bool *is_truncated, rgw_obj_key *last_entry,
+                                        bool (*force_check_filter)(const string&  name))
+{
+  ldout(cct, 10) << "cls_bucket_list_unordered " << bucket << " start " << start.name << "[" << start.instance << "] num_entries " << num_entries << dendl;
+
+  librados::IoCtx index_ctx;
+  map<int, string> oids;
+  int r = open_bucket_index(bucket, index_ctx, oids);
+  if (r < 0)
+    return r;
+
+  map<int, string>::iterator shard = oids.begin();
+  cls_rgw_obj_key marker(start.name, start.instance);
+  if (!start.empty()) {
+    /* a list index key has the object name up to the first nul */
+    string hash_src = RGWBucketReshard::get_index_hash_source(string(start.name.c_str()));
+    string oid;
+    int shard_id;
+    r = open_bucket_index_shard(bucket, index_ctx, hash_src, &oid, &shard_id);
+    if (r < 0)
+      return r;
+    shard = oids.find(shard_id < 0 ? 0 : shard_id);
+    if (shard == oids.end()) {
+      /* the index was resharded since; start over */
+      shard = oids.begin();
+      marker = cls_rgw_obj_key();
+    }
+  }
+
+  map<string, bufferlist> updates;
+  uint32_t count = 0;
+  uint32_t want = num_entries;
+  while (shard != oids.end() && count < num_entries) {
+    rgw_cls_list_ret result;
+    int ret = 0;
+    librados::ObjectReadOperation op;
+    cls_rgw_bucket_list_op(op, marker, prefix, "", want, list_versions, &result, &ret);
+    r = index_ctx.operate(shard->second, &op, NULL);
+    if (r >= 0)
+      r = ret;
+    if (r < 0)
+      return r;
+
+    map<string, struct rgw_bucket_dir_entry>& m = result.dir.m;
+    for (map<string, struct rgw_bucket_dir_entry>::iterator iter = m.begin(); iter != m.end(); ++iter) {
+      rgw_bucket_dir_entry& dirent = iter->second;
+      RGWObjEnt e;
+      dir_entry_to_obj_ent(dirent, &e);
+
+      bool force_check = force_check_filter && force_check_filter(dirent.key.name);
+      if ((!dirent.exists && !dirent.is_delete_marker()) || !dirent.pending_map.empty() || force_check) {
+        librados::IoCtx sub_ctx;
+        sub_ctx.dup(index_ctx);
+        r = check_disk_state(sub_ctx, bucket, dirent, e, updates[shard->second]);
+        if (r < 0 && r != -ENOENT) {
+          return r;
+        }
+      }
+      if (r >= 0) {
+        ent_list.push_back(e);
+        ++count;
+      }
+      r = 0;
+    }
+
+    if (!result.marker.empty()) {
+      marker = cls_rgw_obj_key(result.marker);
+    } else if (!m.empty()) {
+      marker = cls_rgw_obj_key(m.rbegin()->first);
+    } else if (result.is_truncated) {
+      /* nothing listed, and no telling how far it got */
+      want *= 2;
+      continue;
+    }
+    *last_entry = marker.name;
+    want = num_entries - count;
+
+    if (!result.is_truncated) {
+      ++shard;
+      marker = cls_rgw_obj_key();
+    }
   }
-  if (!m.empty())
-    *last_entry = m.rbegin()->first;
 
+  map<string, bufferlist>::iterator miter = updates.begin();
+  for (; miter != updates.end(); ++miter) {
+    if (miter->second.length()) {
+      ObjectWriteOperation o;
+      cls_rgw_suggest_changes(o, miter->second);
+      AioCompletion *c = librados::Rados::aio_create_completion(NULL, NULL, NULL);
+      index_ctx.aio_operate(miter->first, c, &o);
+      c->release();
+    }
+  }
+
+  *is_truncated = (shard != oids.end());
   return 0;
 }
 
@@ -8605,6 +9122,19 @@ void RGWRados::get_bucket_index_objects(const string& bucket_oid_base,
   }
 }
 
+string RGWRados::get_bucket_index_oid_base(const rgw_bucket& bucket, uint32_t index_gen)
+{
+  string oid = dir_oid_prefix;
+  oid.append(bucket.marker);
+  if (index_gen) {
+    /* not a plain number, so that it can't be taken for a shard id */
+    char buf[16];
+    snprintf(buf, sizeof(buf), ".g%u", index_gen);
+    oid.append(buf);
+  }
+  return oid;
+}
+
 void RGWRados::get_bucket_instance_ids(RGWBucketInfo& bucket_info, int shard_id, map<int, string> *result)
 {
   rgw_bucket& bucket = bucket_info.bucket;
@@ -21,6 +21,11 @@ class RGWWatcher;
 class SafeTimer;
 class ACLOwner;
 class RGWGC;
+struct RGWGCShardStats;
+class RGWReshard;
+class RGWDataCache;
+class RGWBucketListSource;
+class RGWBucketListMerger;
 
 /* flags for put_obj_meta() */
 #define PUT_OBJ_CREATE      0x01
@@ -30,6 +35,8 @@ class RGWGC;
 #define RGW_OBJ_NS_MULTIPART "multipart"
 #define RGW_OBJ_NS_SHADOW    "shadow"
 
+#define MAX_BUCKET_INDEX_SHARDS_PRIME 7877
+
 #define RGW_BUCKET_INSTANCE_MD_PREFIX ".bucket.meta."
 
 static inline void prepend_bucket_marker(rgw_bucket& bucket, const string& orig_oid, string& oid)
@@ -1156,11 +1163,37 @@ struct RGWObjectCtx {
   void invalidate(rgw_obj& obj);
 };
 
+/*
+ * The shards of a bucket index being listed, and how far the listing of
+ * each has got; kept across the cls_bucket_list() calls of one listing.
+ */
+struct RGWBucketListCursor {
+  librados::IoCtx index_ctx;
+  map<int, string> oids;
+  string prefix;
+  string delimiter;
+  bool list_versions;
+  RGWBucketListSource *source;
+  RGWBucketListMerger *merger;
+
+  RGWBucketListCursor() : list_versions(false), source(NULL), merger(NULL) {}
+  ~RGWBucketListCursor() {
+    clear();
+  }
+
+  void clear();
+
+private:
+  RGWBucketListCursor(const RGWBucketListCursor&);
+  RGWBucketListCursor& operator=(const RGWBucketListCursor&);
+};
+
 class Finisher;
 
 class RGWRados
 {
   friend class RGWGC;
+  friend class RGWBucketReshard;
   friend class RGWStateLog;
   friend class RGWReplicaLogger;
 
@@ -1174,9 +1207,9 @@ class RGWRados
   int open_bucket_data_extra_ctx(rgw_bucket& bucket, librados::IoCtx&  io_ctx);
   int open_bucket_index(rgw_bucket& bucket, librados::IoCtx&  index_ctx, string& bucket_oid);
   int open_bucket_index_base(rgw_bucket& bucket, librados::IoCtx&  index_ctx,
-      string& bucket_oid_base);
+      string& bucket_oid_base, uint32_t index_gen = 0);
   int open_bucket_index_shard(rgw_bucket& bucket, librados::IoCtx& index_ctx,
-      const string& obj_key, string *bucket_obj, int *shard_id);
+      const string& obj_key, string *bucket_obj, int *shard_id, RGWBucketInfo *pinfo = NULL);
   int open_bucket_index(rgw_bucket& bucket, librados::IoCtx& index_ctx,
       map<int, string>& bucket_objs, int shard_id = -1, map<int, string> *bucket_instance_ids = NULL);
   template<typename T>
@@ -1203,6 +1236,7 @@ class RGWRados
   };
 
   RGWGC *gc;
+  RGWReshard *reshard;
   bool use_gc_thread;
   bool quota_threads;
 
@@ -1255,9 +1289,11 @@ protected:
 
   Finisher *finisher;
 
+  RGWDataCache *data_cache;
+
 public:
   RGWRados() : max_req_id(0), lock("rados_timer_lock"), watchers_lock("watchers_lock"), timer(NULL),
-               gc(NULL), use_gc_thread(false), quota_threads(false),
+               gc(NULL), reshard(NULL), use_gc_thread(false), quota_threads(false),
                num_watchers(0), watchers(NULL),
                watch_initialized(false),
                bucket_id_lock("rados_bucket_id"),
@@ -1268,6 +1304,7 @@ public:
                pools_initialized(false),
                quota_handler(NULL),
                finisher(NULL),
+               data_cache(NULL),
                rest_master_conn(NULL),
                meta_mgr(NULL), data_log(NULL) {}
 
@@ -1373,7 +1410,7 @@ public:
    * create a bucket with name bucket and the given list of attrs
    * returns 0 on success, -ERR# otherwise.
    */
-  virtual int init_bucket_index(rgw_bucket& bucket, int num_shards);
+  virtual int init_bucket_index(rgw_bucket& bucket, int num_shards, uint32_t index_gen = 0);
   int select_bucket_placement(RGWUserInfo& user_info, const string& region_name, const std::string& rule,
                               const std::string& bucket_name, rgw_bucket& bucket, string *pselected_rule);
   int select_legacy_bucket_placement(const string& bucket_name, rgw_bucket& bucket);
@@ -1452,8 +1489,10 @@ public:
     int shard_id;
     librados::IoCtx index_ctx;
     string bucket_obj;
+    bool log_op;          // log the index updates in the bucket index log
+    string reshard_obj;   // matching shard of the new index, while resharding
 
-    BucketShard(RGWRados *_store) : store(_store), shard_id(-1) {}
+    BucketShard(RGWRados *_store) : store(_store), shard_id(-1), log_op(false) {}
     int init(rgw_bucket& _bucket, rgw_obj& obj);
   };
 
@@ -1697,10 +1736,16 @@ public:
         bool enforce_ns;
         RGWAccessListFilter *filter;
         bool list_versions;
+        bool allow_unordered; /* shard by shard, not in order; no delimiter */
 
-        Params() : enforce_ns(true), filter(NULL), list_versions(false) {}
+        Params() : enforce_ns(true), filter(NULL), list_versions(false), allow_unordered(false) {}
       } params;
 
+    private:
+      RGWBucketListCursor cursor;
+
+      int list_objects_unordered(int max, vector<RGWObjEnt> *result, bool *is_truncated);
+
     public:
       List(RGWRados::Bucket *_target) : target(_target) {}
 
@@ -1962,6 +2007,9 @@ public:
 
   int omap_get_vals(rgw_obj& obj, bufferlist& header, const std::string& marker, uint64_t count, std::map<string, bufferlist>& m);
   virtual int omap_get_all(rgw_obj& obj, bufferlist& header, std::map<string, bufferlist>& m);
+  /* for each range, up to count values after marker; max_aio reads in flight */
+  int omap_get_vals_ranges(rgw_obj& obj, const vector<pair<string, uint64_t> >& ranges,
+                           vector<std::map<string, bufferlist> >& results, int max_aio);
   virtual int omap_set(rgw_obj& obj, std::string& key, bufferlist& bl);
   virtual int omap_set(rgw_obj& obj, map<std::string, bufferlist>& m);
   virtual int omap_del(rgw_obj& obj, const std::string& key);
@@ -1984,6 +2032,9 @@ public:
 
   virtual void set_cache_enabled(bool state) {}
 
+  /* the data of the object changed; drop what is cached of it */
+  virtual void invalidate_obj_data(rgw_obj& obj);
+
   void set_atomic(void *ctx, rgw_obj& obj) {
     RGWObjectCtx *rctx = static_cast<RGWObjectCtx *>(ctx);
     rctx->set_atomic(obj);
@@ -2029,10 +2080,26 @@ public:
                            list<rgw_obj_key> *remove_objs, uint16_t bilog_flags);
   int cls_obj_complete_cancel(BucketShard& bs, string& tag, rgw_obj& obj, uint16_t bilog_flags);
   int cls_obj_set_bucket_tag_timeout(rgw_bucket& bucket, uint64_t timeout);
+  /*
+   * List the bucket index in order, merging its shards.  A listing made of
+   * several calls, each one starting at the last_entry of the one before,
+   * can keep its cursor between calls so that the shards go on from where
+   * they were.
+   */
   int cls_bucket_list(rgw_bucket& bucket, rgw_obj_key& start, const string& prefix,
-                      uint32_t num_entries, bool list_versions, map<string, RGWObjEnt>& m,
+                      const string& delimiter, uint32_t num_entries, bool list_versions, map<string, RGWObjEnt>& m,
                       bool *is_truncated, rgw_obj_key *last_entry,
-                      bool (*force_check_filter)(const string&  name) = NULL);
+                      bool (*force_check_filter)(const string&  name) = NULL,
+                      RGWBucketListCursor *cursor = NULL);
+  /*
+   * List the bucket index a shard after the other, starting with the
+   * shard start is in.  The entries of a shard are in order, but not the
+   * listing.
+   */
+  int cls_bucket_list_unordered(rgw_bucket& bucket, rgw_obj_key& start, const string& prefix,
+                                uint32_t num_entries, bool list_versions, vector<RGWObjEnt>& ent_list,
+                                bool *is_truncated, rgw_obj_key *last_entry,
+                                bool (*force_check_filter)(const string&  name) = NULL);
   int cls_bucket_head(rgw_bucket& bucket, map<string, struct rgw_bucket_dir_header>& headers, map<int, string> *bucket_instance_ids = NULL);
   int cls_bucket_head_async(rgw_bucket& bucket, RGWGetDirHeader_CB *ctx, int *num_aio);
   int list_bi_log_entries(rgw_bucket& bucket, int shard_id, string& marker, uint32_t max, std::list<rgw_bi_log_entry>& result, bool *truncated);
@@ -2070,6 +2137,7 @@ public:
   int gc_operate(string& oid, librados::ObjectReadOperation *op, bufferlist *pbl);
 
   int list_gc_objs(int *index, string& marker, uint32_t max, bool expired_only, std::list<cls_rgw_gc_obj_info>& result, bool *truncated);
+  int get_gc_stats(std::list<RGWGCShardStats>& stats);
   int process_gc();
   int defer_gc(void *ctx, rgw_obj& obj);
 
@@ -2137,6 +2205,12 @@ public:
   void get_bucket_index_objects(const string& bucket_oid_base, uint32_t num_shards,
       map<int, string>& bucket_objs, int shard_id = -1);
 
+  /**
+   * Get the base name of the bucket index objects of the given index
+   * generation (see RGWBucketInfo::index_gen).
+   */
+  string get_bucket_index_oid_base(const rgw_bucket& bucket, uint32_t index_gen);
+
   /**
    * Get the bucket index object with the given base bucket index object and object key,
    * and the number of bucket index shards.
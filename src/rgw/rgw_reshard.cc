@@ -0,0 +1,911 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#include <unistd.h>
+
+#include "rgw_reshard.h"
+#include "include/rados/librados.hpp"
+#include "cls/rgw/cls_rgw_client.h"
+#include "cls/lock/cls_lock_client.h"
+#include "common/errno.h"
+
+#include <list>
+
+#define dout_subsys ceph_subsys_rgw
+
+using namespace std;
+using namespace librados;
+
+static string reshard_oid_prefix = "reshard.";
+static string reshard_lock_name = "reshard_process";
+static string reshard_scan_oid = "reshard";
+static string reshard_scan_lock_name = "reshard_scan";
+
+/* the lock is renewed as the reshard goes, well before it expires */
+#define RESHARD_LOCK_DURATION 60
+
+#define RESHARD_LIST_MAX 1000
+#define RESHARD_MAX_RETRIES 10
+#define RESHARD_DRAIN_USEC (100 * 1000)
+
+static const char *reshard_stage_name(RGWReshardStage stage)
+{
+  switch (stage) {
+    case RESHARD_STAGE_NONE:
+      return "none";
+    case RESHARD_STAGE_INIT:
+      return "init";
+    case RESHARD_STAGE_COPY:
+      return "copy";
+    case RESHARD_STAGE_CATCHUP:
+      return "catchup";
+    case RESHARD_STAGE_SWITCH:
+      return "switch";
+    case RESHARD_STAGE_DONE:
+      return "done";
+    case RESHARD_STAGE_FAILED:
+      return "failed";
+    case RESHARD_STAGE_CANCELLED:
+      return "cancelled";
+  }
+  return "unknown";
+}
+
+void RGWReshardStatus::dump(Formatter *f) const
+{
+  f->dump_string("stage", reshard_stage_name(stage));
+  f->dump_unsigned("old_num_shards", old_num_shards);
+  f->dump_unsigned("new_num_shards", new_num_shards);
+  f->dump_unsigned("index_gen", index_gen);
+  f->dump_unsigned("entries_copied", entries_copied);
+  f->dump_unsigned("entries_replayed", entries_replayed);
+  f->dump_unsigned("passes", passes);
+  f->dump_int("error", error);
+  f->dump_stream("start_time") << start_time;
+  f->dump_stream("update_time") << update_time;
+}
+
+static int open_log_pool_ctx(RGWRados *store, IoCtx& io_ctx)
+{
+  const char *log_pool = store->zone.log_pool.name.c_str();
+  librados::Rados *rad = store->get_rados_handle();
+  int r = rad->ioctx_create(log_pool, io_ctx);
+  if (r == -ENOENT) {
+    rgw_bucket pool(log_pool);
+    r = store->create_pool(pool);
+    if (r < 0)
+      return r;
+
+    // retry
+    r = rad->ioctx_create(log_pool, io_ctx);
+  }
+  return r;
+}
+
+/* the key of an index entry, and the tags of the updates pending on it */
+static int get_entry_key(rgw_cls_bi_entry& entry, cls_rgw_obj_key *key,
+                         map<string, utime_t> *pending)
+{
+  bufferlist::iterator iter = entry.data.begin();
+  try {
+    switch (entry.type) {
+      case PlainIdx:
+      case InstanceIdx:
+        {
+          rgw_bucket_dir_entry e;
+          ::decode(e, iter);
+          *key = e.key;
+          map<string, rgw_bucket_pending_info>::iterator piter;
+          for (piter = e.pending_map.begin(); piter != e.pending_map.end(); ++piter) {
+            (*pending)[piter->first] = piter->second.timestamp;
+          }
+        }
+        break;
+      case OLHIdx:
+        {
+          rgw_bucket_olh_entry e;
+          ::decode(e, iter);
+          *key = e.key;
+        }
+        break;
+      default:
+        return -EINVAL;
+    }
+  } catch (buffer::error& err) {
+    return -EIO;
+  }
+  return 0;
+}
+
+string RGWBucketReshard::get_index_hash_source(const string& key_name)
+{
+  string name, instance, ns;
+  if (key_name.empty() || !rgw_obj::parse_raw_oid(key_name, &name, &instance, &ns)) {
+    return key_name;
+  }
+  if (ns == RGW_OBJ_NS_MULTIPART) {
+    /* <object>.<upload id>.meta, or <object>.<upload id>.<part> */
+    size_t end_pos = name.rfind('.');
+    if (end_pos != string::npos && end_pos > 0) {
+      size_t mid_pos = name.rfind('.', end_pos - 1);
+      if (mid_pos != string::npos) {
+        return name.substr(0, mid_pos);
+      }
+    }
+  }
+  return name;
+}
+
+RGWBucketReshard::RGWBucketReshard(RGWRados *_store, const RGWBucketInfo& _bucket_info,
+                                   const map<string, bufferlist>& _bucket_attrs)
+  : store(_store), cct(_store->ctx()), bucket_info(_bucket_info), bucket_attrs(_bucket_attrs),
+    lock(reshard_lock_name)
+{
+  const rgw_bucket& b = bucket_info.bucket;
+  status_oid = reshard_oid_prefix + b.name + ":" + b.bucket_id;
+}
+
+int RGWBucketReshard::open_log_ctx()
+{
+  int r = open_log_pool_ctx(store, log_ctx);
+  if (r < 0) {
+    ldout(cct, 0) << "ERROR: failed to open log pool: " << cpp_strerror(-r) << dendl;
+  }
+  return r;
+}
+
+int RGWBucketReshard::renew_lock()
+{
+  utime_t now = ceph_clock_now(cct);
+  lock.set_renew(true);
+  int r = lock.lock_exclusive(&log_ctx, status_oid);
+  lock.set_renew(false);
+  if (r < 0) {
+    ldout(cct, 0) << "ERROR: failed to renew reshard lock on " << status_oid
+                  << ": " << cpp_strerror(-r) << dendl;
+    return r;
+  }
+  lock_renewed = now;
+  return 0;
+}
+
+/*
+ * Renew the lock once half of it ran out.  Anything that can take a
+ * while calls this as it goes; if we lost the lock, someone else may be
+ * resharding the bucket, and we must stop.
+ */
+int RGWBucketReshard::keep_lock()
+{
+  utime_t due = lock_renewed;
+  due += utime_t(RESHARD_LOCK_DURATION / 2, 0);
+  if (ceph_clock_now(cct) < due)
+    return 0;
+  return renew_lock();
+}
+
+int RGWBucketReshard::store_status()
+{
+  status.update_time = ceph_clock_now(cct);
+  bufferlist bl;
+  ::encode(status, bl);
+  int r = log_ctx.write_full(status_oid, bl);
+  if (r < 0) {
+    ldout(cct, 0) << "ERROR: failed to store reshard status " << status_oid
+                  << ": " << cpp_strerror(-r) << dendl;
+    return r;
+  }
+  return keep_lock();
+}
+
+int RGWBucketReshard::get_status(RGWReshardStatus *s)
+{
+  int r = open_log_ctx();
+  if (r < 0)
+    return r;
+
+  bufferlist bl;
+  r = log_ctx.read(status_oid, bl, 0, 0);
+  if (r == -ENOENT) {
+    *s = RGWReshardStatus();
+    return 0;
+  }
+  if (r < 0)
+    return r;
+
+  bufferlist::iterator iter = bl.begin();
+  try {
+    ::decode(*s, iter);
+  } catch (buffer::error& err) {
+    ldout(cct, 0) << "ERROR: failed to decode reshard status " << status_oid << dendl;
+    return -EIO;
+  }
+  return 0;
+}
+
+/*
+ * Update the index layout in the bucket info.  Anything else in the
+ * bucket info may be changed under us, so this starts from the stored
+ * bucket info and retries if it changed before we wrote it back.
+ */
+int RGWBucketReshard::set_bucket_info(uint32_t index_gen, uint32_t num_shards,
+                                      uint8_t reshard_status, uint32_t new_num_shards)
+{
+  rgw_bucket bucket = bucket_info.bucket;
+  RGWBucketInfo info;
+  map<string, bufferlist> attrs;
+  int r = 0;
+  for (int i = 0; i < RESHARD_MAX_RETRIES; i++) {
+    RGWObjectCtx obj_ctx(store);
+    attrs.clear();
+    r = store->get_bucket_instance_info(obj_ctx, bucket, info, NULL, &attrs);
+    if (r < 0) {
+      ldout(cct, 0) << "ERROR: failed to read bucket info for " << bucket
+                    << ": " << cpp_strerror(-r) << dendl;
+      return r;
+    }
+    info.index_gen = index_gen;
+    info.num_shards = num_shards;
+    info.reshard_status = reshard_status;
+    info.new_num_shards = new_num_shards;
+    r = store->put_bucket_instance_info(info, false, 0, &attrs);
+    if (r != -ECANCELED)
+      break;
+    ldout(cct, 10) << "bucket info for " << bucket << " changed, retrying" << dendl;
+  }
+  if (r < 0) {
+    ldout(cct, 0) << "ERROR: failed to store bucket info for " << bucket
+                  << ": " << cpp_strerror(-r) << dendl;
+    return r;
+  }
+  /* only once it is stored, so that a cancel undoes what is */
+  bucket_info = info;
+  bucket_attrs.swap(attrs);
+  return 0;
+}
+
+int RGWBucketReshard::remove_index(const map<int, string>& oids)
+{
+  int ret = 0;
+  for (map<int, string>::const_iterator iter = oids.begin(); iter != oids.end(); ++iter) {
+    int r = index_ctx.remove(iter->second);
+    if (r < 0 && r != -ENOENT) {
+      ldout(cct, 0) << "ERROR: failed to remove bucket index object " << iter->second
+                    << ": " << cpp_strerror(-r) << dendl;
+      ret = r;
+    }
+  }
+  return ret;
+}
+
+/*
+ * Requests look up the index layout once, when they start, so they may
+ * go to an index that is not current any more.  The shards themselves
+ * know: while one is being copied it logs every update, and once it was
+ * superseded it turns new updates away.
+ */
+int RGWBucketReshard::set_index_state(map<int, string>& oids, uint8_t state)
+{
+  int r = CLSRGWIssueSetReshardState(index_ctx, oids, cct->_conf->rgw_bucket_index_max_aio, state)();
+  if (r < 0) {
+    ldout(cct, 0) << "ERROR: failed to set reshard state " << (int)state << " on the index of "
+                  << bucket_info.bucket << ": " << cpp_strerror(-r) << dendl;
+  }
+  return r;
+}
+
+int RGWBucketReshard::get_target_shard(const string& key_name, string *oid)
+{
+  return store->get_bucket_index_object(new_oid_base, get_index_hash_source(key_name),
+                                        status.new_num_shards,
+                                        (RGWBucketInfo::BIShardsHashType)bucket_info.bucket_index_shard_hash_type,
+                                        oid, NULL);
+}
+
+int RGWBucketReshard::init_log_markers()
+{
+  map<int, rgw_cls_list_ret> headers;
+  for (map<int, string>::iterator iter = old_oids.begin(); iter != old_oids.end(); ++iter) {
+    headers[iter->first] = rgw_cls_list_ret();
+  }
+  int r = CLSRGWIssueGetDirHeader(index_ctx, old_oids, headers, cct->_conf->rgw_bucket_index_max_aio)();
+  if (r < 0)
+    return r;
+
+  for (map<int, rgw_cls_list_ret>::iterator iter = headers.begin(); iter != headers.end(); ++iter) {
+    log_markers.add(iter->first, iter->second.dir.header.max_marker);
+  }
+  return 0;
+}
+
+int RGWBucketReshard::copy_shard(const string& oid)
+{
+  string marker;
+  bool truncated;
+  do {
+    list<rgw_cls_bi_entry> entries;
+    int r = cls_rgw_bi_list(index_ctx, oid, string(), marker, RESHARD_LIST_MAX, &entries, &truncated);
+    if (r < 0) {
+      ldout(cct, 0) << "ERROR: bi_list on " << oid << " returned " << cpp_strerror(-r) << dendl;
+      return r;
+    }
+
+    map<string, list<rgw_cls_bi_entry *> > targets;
+    for (list<rgw_cls_bi_entry>::iterator iter = entries.begin(); iter != entries.end(); ++iter) {
+      rgw_cls_bi_entry& entry = *iter;
+      marker = entry.idx;
+
+      cls_rgw_obj_key key;
+      r = get_entry_key(entry, &key, &in_flight);
+      if (r < 0) {
+        ldout(cct, 0) << "ERROR: failed to decode index entry " << entry.idx
+                      << " in " << oid << dendl;
+        return r;
+      }
+      string target;
+      r = get_target_shard(key.name, &target);
+      if (r < 0)
+        return r;
+      targets[target].push_back(&entry);
+    }
+
+    list<AioCompletion *> completions;
+    for (map<string, list<rgw_cls_bi_entry *> >::iterator titer = targets.begin();
+         titer != targets.end(); ++titer) {
+      ObjectWriteOperation op;
+      list<rgw_cls_bi_entry *>& l = titer->second;
+      for (list<rgw_cls_bi_entry *>::iterator eiter = l.begin(); eiter != l.end(); ++eiter) {
+        cls_rgw_bi_put(op, **eiter);
+      }
+      AioCompletion *c = librados::Rados::aio_create_completion(NULL, NULL, NULL);
+      r = index_ctx.aio_operate(titer->first, c, &op);
+      if (r < 0) {
+        c->release();
+        break;
+      }
+      completions.push_back(c);
+    }
+    for (list<AioCompletion *>::iterator citer = completions.begin(); citer != completions.end(); ++citer) {
+      AioCompletion *c = *citer;
+      c->wait_for_complete();
+      int ret = c->get_return_value();
+      c->release();
+      if (ret < 0 && r >= 0) {
+        r = ret;
+      }
+    }
+    if (r < 0) {
+      ldout(cct, 0) << "ERROR: failed to copy index entries from " << oid << ": "
+                    << cpp_strerror(-r) << dendl;
+      return r;
+    }
+
+    status.entries_copied += entries.size();
+    r = store_status();
+    if (r < 0)
+      return r;
+    r = keep_lock();
+    if (r < 0)
+      return r;
+  } while (truncated);
+
+  return 0;
+}
+
+/*
+ * Make the entries of the new index for the named object the same as
+ * those of the old one.  Returns the number of entries written.
+ */
+int RGWBucketReshard::reconcile(const string& old_oid, const string& name)
+{
+  string new_oid;
+  int r = get_target_shard(name, &new_oid);
+  if (r < 0)
+    return r;
+
+  bool truncated;
+  list<rgw_cls_bi_entry> old_entries;
+  r = cls_rgw_bi_list(index_ctx, old_oid, name, string(), RESHARD_LIST_MAX, &old_entries, &truncated);
+  if (r < 0)
+    return r;
+
+  list<rgw_cls_bi_entry> new_entries;
+  r = cls_rgw_bi_list(index_ctx, new_oid, name, string(), RESHARD_LIST_MAX, &new_entries, &truncated);
+  if (r < 0)
+    return r;
+
+  ObjectWriteOperation op;
+  int count = 0;
+  set<string> old_keys;
+  for (list<rgw_cls_bi_entry>::iterator iter = old_entries.begin(); iter != old_entries.end(); ++iter) {
+    cls_rgw_bi_put(op, *iter);
+    old_keys.insert(iter->idx);
+    count++;
+  }
+  for (list<rgw_cls_bi_entry>::iterator iter = new_entries.begin(); iter != new_entries.end(); ++iter) {
+    if (!old_keys.count(iter->idx)) {
+      cls_rgw_bi_remove(op, iter->idx);
+      count++;
+    }
+  }
+  if (!count)
+    return 0;
+
+  r = index_ctx.operate(new_oid, &op);
+  if (r < 0)
+    return r;
+  return count;
+}
+
+/*
+ * Reconcile every object named in the log of the old index since the
+ * last pass.
+ */
+int RGWBucketReshard::catch_up(uint64_t *replayed)
+{
+  *replayed = 0;
+  map<int, string> oids = old_oids;
+  while (!oids.empty()) {
+    map<int, cls_rgw_bi_log_list_ret> logs;
+    int r = CLSRGWIssueBILogList(index_ctx, log_markers, RESHARD_LIST_MAX, oids, logs,
+                                 cct->_conf->rgw_bucket_index_max_aio)();
+    if (r < 0) {
+      ldout(cct, 0) << "ERROR: failed to list bucket index log: " << cpp_strerror(-r) << dendl;
+      return r;
+    }
+
+    map<int, string> next;
+    for (map<int, cls_rgw_bi_log_list_ret>::iterator iter = logs.begin(); iter != logs.end(); ++iter) {
+      int shard_id = iter->first;
+      list<rgw_bi_log_entry>& entries = iter->second.entries;
+
+      /* an object usually shows up twice, for prepare and complete */
+      set<string> names;
+      for (list<rgw_bi_log_entry>::iterator eiter = entries.begin(); eiter != entries.end(); ++eiter) {
+        names.insert(eiter->object);
+        log_markers.add(shard_id, eiter->id);
+        if (eiter->state == CLS_RGW_STATE_PENDING_MODIFY) {
+          in_flight[eiter->tag] = eiter->timestamp;
+        } else {
+          in_flight.erase(eiter->tag);
+        }
+      }
+      for (set<string>::iterator niter = names.begin(); niter != names.end(); ++niter) {
+        r = keep_lock();
+        if (r < 0)
+          return r;
+        r = reconcile(old_oids[shard_id], *niter);
+        if (r < 0) {
+          ldout(cct, 0) << "ERROR: failed to reconcile index entries of " << *niter
+                        << ": " << cpp_strerror(-r) << dendl;
+          return r;
+        }
+        *replayed += r;
+      }
+      if (iter->second.truncated) {
+        next[shard_id] = old_oids[shard_id];
+      }
+    }
+    oids.swap(next);
+
+    status.entries_replayed += *replayed;
+    r = store_status();
+    if (r < 0)
+      return r;
+  }
+  return 0;
+}
+
+/*
+ * Wait for the updates that were started on the old index before it
+ * was fenced off, and replay them as they complete.  Updates older than
+ * rgw_reshard_grace are taken as abandoned, and so is whatever has not
+ * completed rgw_reshard_grace after we started waiting.
+ */
+int RGWBucketReshard::drain()
+{
+  utime_t grace(cct->_conf->rgw_reshard_grace, 0);
+  utime_t deadline = ceph_clock_now(cct);
+  deadline += grace;
+  for (;;) {
+    uint64_t replayed;
+    int r = catch_up(&replayed);
+    if (r < 0)
+      return r;
+    status.passes++;
+
+    utime_t now = ceph_clock_now(cct);
+    utime_t oldest = now;
+    oldest -= grace;
+    map<string, utime_t>::iterator iter = in_flight.begin();
+    while (iter != in_flight.end()) {
+      if (iter->second < oldest) {
+        in_flight.erase(iter++);
+      } else {
+        ++iter;
+      }
+    }
+    if (in_flight.empty())
+      return 0;
+    if (deadline <= now) {
+      ldout(cct, 0) << "WARNING: " << in_flight.size() << " updates to the old index of "
+                    << bucket_info.bucket << " did not complete, giving up on them" << dendl;
+      in_flight.clear();
+      return 0;
+    }
+    ldout(cct, 10) << "waiting for " << in_flight.size() << " updates in flight" << dendl;
+
+    r = keep_lock();
+    if (r < 0)
+      return r;
+    usleep(RESHARD_DRAIN_USEC);
+  }
+}
+
+int RGWBucketReshard::execute(uint32_t num_shards)
+{
+  if (num_shards == 0 || num_shards > MAX_BUCKET_INDEX_SHARDS_PRIME) {
+    ldout(cct, 0) << "ERROR: invalid number of shards: " << num_shards << dendl;
+    return -EINVAL;
+  }
+
+  int r = open_log_ctx();
+  if (r < 0)
+    return r;
+
+  lock.set_duration(utime_t(RESHARD_LOCK_DURATION, 0));
+  r = lock.lock_exclusive(&log_ctx, status_oid);
+  if (r == -EBUSY) {
+    ldout(cct, 0) << "bucket " << bucket_info.bucket << " is being resharded elsewhere" << dendl;
+    return r;
+  }
+  if (r < 0)
+    return r;
+  lock_renewed = ceph_clock_now(cct);
+
+  if (bucket_info.resharding()) {
+    ldout(cct, 0) << "cancelling unfinished reshard of " << bucket_info.bucket << dendl;
+    r = do_cancel();
+    if (r < 0)
+      goto done;
+  }
+
+  if (num_shards == bucket_info.num_shards) {
+    ldout(cct, 0) << "bucket " << bucket_info.bucket << " already has " << num_shards << " shards" << dendl;
+    r = -EEXIST;
+    goto done;
+  }
+
+  r = store->open_bucket_index(bucket_info.bucket, index_ctx, old_oids);
+  if (r < 0)
+    goto done;
+
+  status = RGWReshardStatus();
+  status.stage = RESHARD_STAGE_INIT;
+  status.old_num_shards = bucket_info.num_shards;
+  status.new_num_shards = num_shards;
+  status.index_gen = bucket_info.index_gen + 1;
+  status.start_time = ceph_clock_now(cct);
+  r = store_status();
+  if (r < 0)
+    goto done;
+
+  ldout(cct, 0) << "resharding " << bucket_info.bucket << " from " << status.old_num_shards
+                << " to " << num_shards << " shards" << dendl;
+
+  new_oid_base = store->get_bucket_index_oid_base(bucket_info.bucket, status.index_gen);
+  store->get_bucket_index_objects(new_oid_base, num_shards, new_oids);
+  r = remove_index(new_oids); /* left over by an earlier attempt */
+  if (r < 0)
+    goto fail;
+  r = store->init_bucket_index(bucket_info.bucket, num_shards, status.index_gen);
+  if (r < 0)
+    goto fail;
+  r = keep_lock();
+  if (r < 0)
+    goto fail;
+
+  r = set_bucket_info(bucket_info.index_gen, bucket_info.num_shards,
+                      RGWBucketInfo::RESHARD_IN_PROGRESS, num_shards);
+  if (r < 0)
+    goto fail;
+
+  /* anything logged from here on is replayed after the copy */
+  r = init_log_markers();
+  if (r < 0)
+    goto cancel;
+  /* and from here on, everything is logged */
+  r = set_index_state(old_oids, CLS_RGW_RESHARD_IN_PROGRESS);
+  if (r < 0)
+    goto cancel;
+
+  status.stage = RESHARD_STAGE_COPY;
+  for (map<int, string>::iterator iter = old_oids.begin(); iter != old_oids.end(); ++iter) {
+    r = copy_shard(iter->second);
+    if (r < 0)
+      goto cancel;
+  }
+
+  status.stage = RESHARD_STAGE_CATCHUP;
+  while (status.passes < cct->_conf->rgw_reshard_max_passes) {
+    uint64_t replayed;
+    r = catch_up(&replayed);
+    if (r < 0)
+      goto cancel;
+    status.passes++;
+    ldout(cct, 10) << "catch-up pass " << status.passes << " replayed " << replayed << " entries" << dendl;
+    if (!replayed)
+      break;
+  }
+
+  r = CLSRGWIssueBucketRebuild(index_ctx, new_oids, cct->_conf->rgw_bucket_index_max_aio)();
+  if (r < 0)
+    goto cancel;
+
+  status.stage = RESHARD_STAGE_SWITCH;
+  r = store_status();
+  if (r < 0)
+    goto cancel;
+  /* requests that go to the old index from here on are turned away, and
+   * look the bucket up again until they find the new index */
+  r = set_index_state(old_oids, CLS_RGW_RESHARD_DONE);
+  if (r < 0)
+    goto cancel;
+  r = set_bucket_info(status.index_gen, num_shards, RGWBucketInfo::RESHARD_NONE, 0);
+  if (r < 0)
+    goto cancel;
+
+  /* only what was started on the old index before still lands there */
+  r = drain();
+  if (r < 0)
+    goto fail;
+  r = CLSRGWIssueBucketRebuild(index_ctx, new_oids, cct->_conf->rgw_bucket_index_max_aio)();
+  if (r < 0)
+    goto fail;
+
+  r = remove_index(old_oids);
+  if (r < 0)
+    goto fail;
+
+  status.stage = RESHARD_STAGE_DONE;
+  store_status();
+  ldout(cct, 0) << "resharded " << bucket_info.bucket << " to " << num_shards << " shards: "
+                << status.entries_copied << " entries copied, " << status.entries_replayed
+                << " replayed in " << status.passes << " passes" << dendl;
+  goto done;
+
+cancel:
+  do_cancel();
+fail:
+  status.stage = RESHARD_STAGE_FAILED;
+  status.error = r;
+  store_status();
+done:
+  lock.unlock(&log_ctx, status_oid);
+  return r;
+}
+
+int RGWBucketReshard::do_cancel()
+{
+  if (!bucket_info.resharding())
+    return 0;
+
+  int r = store->open_bucket_index_ctx(bucket_info.bucket, index_ctx);
+  if (r < 0)
+    return r;
+
+  map<int, string> oids;
+  string base = store->get_bucket_index_oid_base(bucket_info.bucket, bucket_info.index_gen + 1);
+  store->get_bucket_index_objects(base, bucket_info.new_num_shards, oids);
+
+  r = set_bucket_info(bucket_info.index_gen, bucket_info.num_shards, RGWBucketInfo::RESHARD_NONE, 0);
+  if (r < 0)
+    return r;
+
+  /* the old index goes on as if nothing happened; requests still
+   * updating the new one fail there once it is gone */
+  map<int, string> cur_oids;
+  base = store->get_bucket_index_oid_base(bucket_info.bucket, bucket_info.index_gen);
+  store->get_bucket_index_objects(base, bucket_info.num_shards, cur_oids);
+  r = set_index_state(cur_oids, CLS_RGW_RESHARD_NONE);
+  if (r < 0)
+    return r;
+
+  return remove_index(oids);
+}
+
+int RGWBucketReshard::cancel()
+{
+  int r = get_status(&status);
+  if (r < 0)
+    return r;
+
+  lock.set_duration(utime_t(RESHARD_LOCK_DURATION, 0));
+  r = lock.lock_exclusive(&log_ctx, status_oid);
+  if (r < 0)
+    return r;
+  lock_renewed = ceph_clock_now(cct);
+
+  if (bucket_info.resharding()) {
+    r = do_cancel();
+    if (r == 0) {
+      status.stage = RESHARD_STAGE_CANCELLED;
+      r = store_status();
+    }
+  }
+
+  lock.unlock(&log_ctx, status_oid);
+  return r;
+}
+
+void RGWReshard::initialize(CephContext *_cct, RGWRados *_store)
+{
+  cct = _cct;
+  store = _store;
+}
+
+int RGWReshard::check_bucket(const string& bucket_name, uint32_t *num_shards)
+{
+  *num_shards = 0;
+
+  RGWObjectCtx obj_ctx(store);
+  RGWBucketInfo info;
+  int r = store->get_bucket_info(obj_ctx, bucket_name, info, NULL);
+  if (r < 0)
+    return r;
+
+  if (info.resharding()) {
+    /* the gateway that was resharding it went away */
+    *num_shards = info.new_num_shards;
+    return 0;
+  }
+
+  map<string, rgw_bucket_dir_header> headers;
+  r = store->cls_bucket_head(info.bucket, headers);
+  if (r < 0)
+    return r;
+
+  uint64_t total = 0;
+  uint64_t max_shard = 0;
+  for (map<string, rgw_bucket_dir_header>::iterator iter = headers.begin(); iter != headers.end(); ++iter) {
+    uint64_t entries = 0;
+    map<uint8_t, rgw_bucket_category_stats>& stats = iter->second.stats;
+    for (map<uint8_t, rgw_bucket_category_stats>::iterator siter = stats.begin(); siter != stats.end(); ++siter) {
+      entries += siter->second.num_entries;
+    }
+    total += entries;
+    max_shard = MAX(max_shard, entries);
+  }
+
+  uint64_t limit = cct->_conf->rgw_max_objs_per_shard;
+  if (!limit || max_shard <= limit)
+    return 0;
+
+  /* leave the shards half full, so that the bucket can grow a while */
+  uint64_t want = total * 2 / limit + 1;
+  if (want > MAX_BUCKET_INDEX_SHARDS_PRIME)
+    want = MAX_BUCKET_INDEX_SHARDS_PRIME;
+  if (want <= info.num_shards) {
+    ldout(cct, 5) << "bucket " << bucket_name << " has an oversized shard, but enough shards" << dendl;
+    return 0;
+  }
+  *num_shards = (uint32_t)want;
+  return 0;
+}
+
+int RGWReshard::process()
+{
+  IoCtx log_ctx;
+  int r = open_log_pool_ctx(store, log_ctx);
+  if (r < 0)
+    return r;
+
+  /* one gateway looks at the buckets each period */
+  rados::cls::lock::Lock l(reshard_scan_lock_name);
+  l.set_duration(utime_t(cct->_conf->rgw_reshard_thread_interval, 0));
+  r = l.lock_exclusive(&log_ctx, reshard_scan_oid);
+  if (r == -EBUSY) {
+    ldout(cct, 10) << "another gateway is looking for buckets to reshard" << dendl;
+    return 0;
+  }
+  if (r < 0)
+    return r;
+
+  void *handle;
+  string section = "bucket";
+  r = store->meta_mgr->list_keys_init(section, &handle);
+  if (r < 0)
+    return r;
+
+  bool truncated;
+  do {
+    list<string> keys;
+    r = store->meta_mgr->list_keys_next(handle, RESHARD_LIST_MAX, keys, &truncated);
+    if (r < 0)
+      break;
+
+    for (list<string>::iterator iter = keys.begin(); iter != keys.end() && !going_down(); ++iter) {
+      uint32_t num_shards;
+      r = check_bucket(*iter, &num_shards);
+      if (r < 0) {
+        ldout(cct, 5) << "failed to check bucket " << *iter << ": " << cpp_strerror(-r) << dendl;
+        continue;
+      }
+      if (!num_shards)
+        continue;
+
+      RGWObjectCtx obj_ctx(store);
+      RGWBucketInfo info;
+      map<string, bufferlist> attrs;
+      r = store->get_bucket_info(obj_ctx, *iter, info, NULL, &attrs);
+      if (r < 0)
+        continue;
+      RGWBucketReshard br(store, info, attrs);
+      r = br.execute(num_shards);
+      if (r < 0) {
+        ldout(cct, 0) << "ERROR: failed to reshard bucket " << *iter << ": " << cpp_strerror(-r) << dendl;
+      }
+    }
+  } while (truncated && !going_down());
+
+  store->meta_mgr->list_keys_complete(handle);
+  l.unlock(&log_ctx, reshard_scan_oid);
+  return 0;
+}
+
+bool RGWReshard::going_down()
+{
+  return (down_flag.read() != 0);
+}
+
+void RGWReshard::start_processor()
+{
+  worker = new ReshardWorker(cct, this);
+  worker->create();
+}
+
+void RGWReshard::stop_processor()
+{
+  down_flag.set(1);
+  if (worker) {
+    worker->stop();
+    worker->join();
+  }
+  delete worker;
+  worker = NULL;
+}
+
+void *RGWReshard::ReshardWorker::entry() {
+  do {
+    utime_t start = ceph_clock_now(cct);
+    dout(2) << "reshard: start" << dendl;
+    int r = reshard->process();
+    if (r < 0) {
+      dout(0) << "ERROR: reshard process() returned error r=" << r << dendl;
+    }
+    dout(2) << "reshard: stop" << dendl;
+
+    if (reshard->going_down())
+      break;
+
+    utime_t end = ceph_clock_now(cct);
+    end -= start;
+    int secs = cct->_conf->rgw_reshard_thread_interval;
+
+    if (secs <= end.sec())
+      continue; // next round
+
+    secs -= end.sec();
+
+    lock.Lock();
+    cond.WaitInterval(cct, lock, utime_t(secs, 0));
+    lock.Unlock();
+  } while (!reshard->going_down());
+
+  return NULL;
+}
+
+void RGWReshard::ReshardWorker::stop()
+{
+  Mutex::Locker l(lock);
+  cond.Signal();
+}
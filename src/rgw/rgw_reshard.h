@@ -0,0 +1,205 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+
+#ifndef CEPH_RGW_RESHARD_H
+#define CEPH_RGW_RESHARD_H
+
+#include "include/types.h"
+#include "include/atomic.h"
+#include "include/rados/librados.hpp"
+#include "common/Mutex.h"
+#include "common/Cond.h"
+#include "common/Thread.h"
+#include "common/Formatter.h"
+#include "cls/lock/cls_lock_client.h"
+#include "cls/rgw/cls_rgw_client.h"
+#include "rgw_common.h"
+#include "rgw_rados.h"
+
+enum RGWReshardStage {
+  RESHARD_STAGE_NONE = 0,
+  RESHARD_STAGE_INIT = 1,     /* new index created, writes go to both */
+  RESHARD_STAGE_COPY = 2,     /* copying the entries of the old index */
+  RESHARD_STAGE_CATCHUP = 3,  /* replaying the log of the old index */
+  RESHARD_STAGE_SWITCH = 4,   /* new index in use, final catch-up */
+  RESHARD_STAGE_DONE = 5,
+  RESHARD_STAGE_FAILED = 6,
+  RESHARD_STAGE_CANCELLED = 7,
+};
+
+/*
+ * Progress of the last reshard of a bucket, kept in the log pool
+ * so that it can be looked at with radosgw-admin.
+ */
+struct RGWReshardStatus {
+  RGWReshardStage stage;
+  uint32_t old_num_shards;
+  uint32_t new_num_shards;
+  uint32_t index_gen;         /* generation of the new index */
+  uint64_t entries_copied;
+  uint64_t entries_replayed;  /* entries reconciled from the log */
+  uint32_t passes;            /* catch-up passes over the log */
+  int32_t error;
+  utime_t start_time;
+  utime_t update_time;
+
+  RGWReshardStatus() : stage(RESHARD_STAGE_NONE), old_num_shards(0), new_num_shards(0),
+                       index_gen(0), entries_copied(0), entries_replayed(0), passes(0),
+                       error(0) {}
+
+  void encode(bufferlist& bl) const {
+    ENCODE_START(1, 1, bl);
+    ::encode((int)stage, bl);
+    ::encode(old_num_shards, bl);
+    ::encode(new_num_shards, bl);
+    ::encode(index_gen, bl);
+    ::encode(entries_copied, bl);
+    ::encode(entries_replayed, bl);
+    ::encode(passes, bl);
+    ::encode(error, bl);
+    ::encode(start_time, bl);
+    ::encode(update_time, bl);
+    ENCODE_FINISH(bl);
+  }
+
+  void decode(bufferlist::iterator& bl) {
+    DECODE_START(1, bl);
+    int s;
+    ::decode(s, bl);
+    stage = (RGWReshardStage)s;
+    ::decode(old_num_shards, bl);
+    ::decode(new_num_shards, bl);
+    ::decode(index_gen, bl);
+    ::decode(entries_copied, bl);
+    ::decode(entries_replayed, bl);
+    ::decode(passes, bl);
+    ::decode(error, bl);
+    ::decode(start_time, bl);
+    ::decode(update_time, bl);
+    DECODE_FINISH(bl);
+  }
+
+  void dump(Formatter *f) const;
+};
+WRITE_CLASS_ENCODER(RGWReshardStatus)
+
+/*
+ * Reshard the index of a bucket while the bucket stays in use.
+ *
+ * The bucket is first marked as resharding in its bucket info, so that
+ * index updates are also applied to the matching shard of the new
+ * index, and the shards of the old index are marked so that they log
+ * every update, whatever the gateway that sent it knows.  The entries
+ * of the old index are copied to the new one, and the log of the old
+ * index is replayed until it quiesces: for every object it names, the
+ * entries of the new index are made the same as those of the old one.
+ *
+ * To switch, the old shards are marked to turn new updates away; the
+ * gateways look the bucket up again and retry.  The bucket info is
+ * switched to the new index, and the log is replayed until the updates
+ * that were started on the old index before (known from the pending
+ * entries copied and from the log) have completed.  The old index is
+ * then removed.
+ */
+class RGWBucketReshard {
+  RGWRados *store;
+  CephContext *cct;
+  RGWBucketInfo bucket_info;
+  map<string, bufferlist> bucket_attrs;
+
+  librados::IoCtx log_ctx;
+  string status_oid;
+  rados::cls::lock::Lock lock;
+  utime_t lock_renewed;
+  RGWReshardStatus status;
+
+  librados::IoCtx index_ctx;
+  map<int, string> old_oids;
+  string new_oid_base;
+  map<int, string> new_oids;
+  BucketIndexShardsManager log_markers;
+  map<string, utime_t> in_flight;  // tags of updates started on the old index
+
+  int open_log_ctx();
+  int renew_lock();
+  int keep_lock();
+  int store_status();
+  int set_bucket_info(uint32_t index_gen, uint32_t num_shards, uint8_t reshard_status,
+                      uint32_t new_num_shards);
+  int remove_index(const map<int, string>& oids);
+  int set_index_state(map<int, string>& oids, uint8_t state);
+  int do_cancel();
+
+  int get_target_shard(const string& key_name, string *oid);
+  int init_log_markers();
+  int copy_shard(const string& oid);
+  int reconcile(const string& old_oid, const string& name);
+  int catch_up(uint64_t *replayed);
+  int drain();
+
+public:
+  RGWBucketReshard(RGWRados *_store, const RGWBucketInfo& _bucket_info,
+                   const map<string, bufferlist>& _bucket_attrs);
+
+  /*
+   * Reshard the bucket index to num_shards shards.  A reshard that did
+   * not finish is cancelled and started over.
+   */
+  int execute(uint32_t num_shards);
+
+  /* give up on a reshard that did not finish */
+  int cancel();
+
+  int get_status(RGWReshardStatus *s);
+
+  /*
+   * The object name an index entry is placed by: the object itself,
+   * or for multipart uploads and parts, the object being uploaded.
+   */
+  static string get_index_hash_source(const string& key_name);
+};
+
+/*
+ * Look for buckets whose index shards have grown past
+ * rgw_max_objs_per_shard entries, and reshard them.
+ */
+class RGWReshard {
+  CephContext *cct;
+  RGWRados *store;
+  atomic_t down_flag;
+
+  class ReshardWorker : public Thread {
+    CephContext *cct;
+    RGWReshard *reshard;
+    Mutex lock;
+    Cond cond;
+
+  public:
+    ReshardWorker(CephContext *_cct, RGWReshard *_reshard) : cct(_cct), reshard(_reshard), lock("ReshardWorker") {}
+    void *entry();
+    void stop();
+  };
+
+  ReshardWorker *worker;
+
+public:
+  RGWReshard() : cct(NULL), store(NULL), worker(NULL) {}
+  ~RGWReshard() {
+    stop_processor();
+  }
+
+  void initialize(CephContext *_cct, RGWRados *_store);
+
+  /*
+   * The number of shards the bucket should have, if it needs to be
+   * resharded; 0 if it doesn't.
+   */
+  int check_bucket(const string& bucket_name, uint32_t *num_shards);
+  int process();
+
+  bool going_down();
+  void start_processor();
+  void stop_processor();
+};
+
+#endif
@@ -243,6 +243,11 @@ int RGWListBucket_ObjStore_S3::get_params()
     return ret;
   }
   delimiter = s->info.args.get("delimiter");
+  /* not in S3: the keys come a bucket index shard after the other */
+  s->info.args.get_bool("allow-unordered", &allow_unordered, false);
+  if (allow_unordered && !delimiter.empty()) {
+    return -EINVAL;
+  }
   return 0;
 }
 
@@ -169,6 +169,124 @@ TEST(Buffer, constructors) {
     EXPECT_EQ(0, buffer::get_total_alloc());
 }
 
+static void *buffer_pool_free_thread(void *arg) {
+  // drop the last reference from another thread
+  delete static_cast<bufferptr*>(arg);
+  return NULL;
+}
+
+struct pool_idle_thread_t {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int ready;
+  bool done;
+  std::vector<bufferptr*> ptrs;
+};
+
+static void *buffer_pool_idle_thread(void *arg) {
+  // fill this thread's cache, then sit on it until told to exit
+  pool_idle_thread_t *s = static_cast<pool_idle_thread_t*>(arg);
+  pthread_mutex_lock(&s->lock);
+  std::vector<bufferptr*> mine;
+  for (int i = 0; i < 64; ++i) {
+    mine.push_back(s->ptrs.back());
+    s->ptrs.pop_back();
+  }
+  pthread_mutex_unlock(&s->lock);
+  for (unsigned i = 0; i < mine.size(); ++i)
+    delete mine[i];
+  pthread_mutex_lock(&s->lock);
+  ++s->ready;
+  pthread_cond_broadcast(&s->cond);
+  while (!s->done)
+    pthread_cond_wait(&s->cond, &s->lock);
+  pthread_mutex_unlock(&s->lock);
+  return NULL;
+}
+
+TEST(Buffer, pool) {
+  bool was_enabled = buffer::get_pool_enabled();
+  buffer::enable_pool(true);
+  buffer::trim_pool();
+  buffer::pool_stats_t before, after;
+  {
+    buffer::get_pool_stats(&before);
+    { bufferptr ptr(buffer::create(100)); }
+    bufferptr ptr(buffer::create(120));
+    EXPECT_EQ(120u, ptr.length());
+    buffer::get_pool_stats(&after);
+    EXPECT_EQ(before.alloc_cached + 1, after.alloc_cached);
+    EXPECT_EQ(before.free_cached + 1, after.free_cached);
+  }
+  {
+    bufferptr ptr(buffer::create_page_aligned(3 * CEPH_PAGE_SIZE));
+    EXPECT_TRUE(ptr.is_page_aligned());
+    EXPECT_EQ(3 * CEPH_PAGE_SIZE, ptr.length());
+    bufferptr clone = ptr.clone();
+    EXPECT_TRUE(clone.is_page_aligned());
+  }
+  {
+    // larger than the biggest size class
+    buffer::get_pool_stats(&before);
+    bufferptr ptr(buffer::create(1 << 20));
+    buffer::get_pool_stats(&after);
+    EXPECT_EQ(before.alloc_system, after.alloc_system);
+    EXPECT_EQ(before.alloc_cached, after.alloc_cached);
+  }
+  {
+    // freed on another thread, then reused here via the shared cache
+    std::vector<bufferptr*> ptrs;
+    for (int i = 0; i < 5000; ++i) {
+      ptrs.push_back(new bufferptr(buffer::create(4000)));
+      ::memset(ptrs.back()->c_str(), 'X', 4000);
+    }
+    for (unsigned i = 0; i < ptrs.size(); ++i) {
+      pthread_t t;
+      ASSERT_EQ(0, pthread_create(&t, NULL, buffer_pool_free_thread, ptrs[i]));
+      pthread_join(t, NULL);
+    }
+    buffer::get_pool_stats(&before);
+    EXPECT_LT(0u, before.central_bytes);
+    bufferptr ptr(buffer::create(4000));
+    buffer::get_pool_stats(&after);
+    EXPECT_EQ(before.alloc_cached + 1, after.alloc_cached);
+  }
+  {
+    // idle threads don't keep more than the bound between them; each
+    // may be charged up to two 64k steps above what it holds
+    const int num_threads = 16;
+    const uint64_t max = 256 * 1024;
+    buffer::trim_pool();
+    buffer::set_pool_thread_max_bytes(max);
+    pool_idle_thread_t s;
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.cond, NULL);
+    s.ready = 0;
+    s.done = false;
+    for (int i = 0; i < num_threads * 64; ++i)
+      s.ptrs.push_back(new bufferptr(buffer::create(4000)));
+    pthread_t t[num_threads];
+    for (int i = 0; i < num_threads; ++i)
+      ASSERT_EQ(0, pthread_create(&t[i], NULL, buffer_pool_idle_thread, &s));
+    pthread_mutex_lock(&s.lock);
+    while (s.ready < num_threads)
+      pthread_cond_wait(&s.cond, &s.lock);
+    buffer::get_pool_stats(&after);
+    EXPECT_GE(max + num_threads * 128 * 1024, after.thread_bytes);
+    EXPECT_LT(0u, after.central_bytes);
+    s.done = true;
+    pthread_cond_broadcast(&s.cond);
+    pthread_mutex_unlock(&s.lock);
+    for (int i = 0; i < num_threads; ++i)
+      pthread_join(t[i], NULL);
+    buffer::set_pool_thread_max_bytes(64 * 1024 * 1024);
+  }
+  buffer::trim_pool();
+  buffer::get_pool_stats(&after);
+  EXPECT_EQ(0u, after.central_bytes);
+  buffer::enable_pool(was_enabled);
+}
+
 TEST(BufferRaw, ostream) {
   bufferptr ptr(1);
   std::ostringstream stream;
@@ -1789,6 +1907,44 @@ TEST(BufferList, append_zero) {
   EXPECT_EQ('\0', bl[1]);
 }
 
+TEST(BufferList, reserve) {
+  bufferlist bl;
+  bl.append('A');
+  EXPECT_EQ((unsigned)1, bl.buffers().size());
+  bl.reserve(CEPH_PAGE_SIZE * 2);
+  for (unsigned i = 0; i < CEPH_PAGE_SIZE * 2; ++i)
+    bl.append('B');
+  EXPECT_EQ((unsigned)2, bl.buffers().size());
+  EXPECT_EQ(CEPH_PAGE_SIZE * 2 + 1, bl.length());
+  EXPECT_EQ('A', bl[0]);
+  EXPECT_EQ('B', bl[CEPH_PAGE_SIZE * 2]);
+  //
+  // already enough room: nothing changes
+  //
+  bufferlist small(100);
+  small.append('A');
+  small.reserve(50);
+  small.append("BBBB", 4);
+  EXPECT_EQ((unsigned)1, small.buffers().size());
+}
+
+TEST(BufferList, append_hole) {
+  bufferlist bl;
+  bl.append('A');
+  char *hole = bl.append_hole(3);
+  EXPECT_EQ((unsigned)4, bl.length());
+  memcpy(hole, "BCD", 3);
+  bl.append('E');
+  EXPECT_EQ((unsigned)1, bl.buffers().size());
+  EXPECT_EQ(0, memcmp("ABCDE", bl.c_str(), 5));
+  //
+  // no room left: a new buffer, still contiguous
+  //
+  bl.append_hole(CEPH_PAGE_SIZE * 2);
+  EXPECT_EQ((unsigned)2, bl.buffers().size());
+  EXPECT_EQ(CEPH_PAGE_SIZE * 2, bl.buffers().back().length());
+}
+
 TEST(BufferList, operator_brackets) {
   bufferlist bl;
   EXPECT_THROW(bl[1], buffer::end_of_buffer);
@@ -22,6 +22,7 @@
     bucket stats               returns bucket statistics
     bucket rm                  remove bucket
     bucket check               check bucket index
+    bucket reshard             reshard bucket index (use --num-shards)
     object rm                  remove object
     object unlink              unlink object from bucket index
     quota set                  set quota params
@@ -51,6 +52,9 @@
     gc list                    dump expired garbage collection objects (specify
                                --include-all to list all entries, including unexpired)
     gc process                 manually process garbage
+    gc stats                   show the gc backlog of each gc shard
+    reshard status             show the progress of the last reshard of a bucket
+    reshard cancel             cancel an unfinished reshard of a bucket
     metadata get               get metadata info
     metadata put               put metadata info
     metadata rm                remove metadata info
@@ -394,6 +394,77 @@ static bool cmp_objs(cls_rgw_obj& obj1, cls_rgw_obj& obj2)
 }
 
 
+void index_list(librados::IoCtx& ioctx, string& oid, const string& start, const string& delimiter,
+                uint32_t num_entries, rgw_cls_list_ret *result)
+{
+  ObjectReadOperation op;
+  int ret = 0;
+  cls_rgw_bucket_list_op(op, cls_rgw_obj_key(start), string(), delimiter, num_entries, false, result, &ret);
+  ASSERT_EQ(0, ioctx.operate(oid, &op, NULL));
+  ASSERT_EQ(0, ret);
+}
+
+TEST(cls_rgw, index_list_delimiter)
+{
+  string bucket_oid = str_int("bucket", 4);
+
+  OpMgr mgr;
+
+  ObjectWriteOperation *op = mgr.write_op();
+  cls_rgw_bucket_init(*op);
+  ASSERT_EQ(0, ioctx.operate(bucket_oid, op));
+
+  vector<string> names;
+  for (int i = 0; i < 50; i++) {
+    names.push_back(str_int("a/obj", i));
+  }
+  names.push_back("b");
+  for (int i = 0; i < 5; i++) {
+    names.push_back(str_int("c/obj", i));
+  }
+  names.push_back("d");
+
+  for (size_t i = 0; i < names.size(); i++) {
+    string tag = str_int("tag", i);
+    string loc = str_int("loc", i);
+    index_prepare(mgr, ioctx, bucket_oid, CLS_RGW_OP_ADD, tag, names[i], loc);
+
+    rgw_bucket_dir_entry_meta meta;
+    meta.category = 0;
+    meta.size = 1024;
+    index_complete(mgr, ioctx, bucket_oid, CLS_RGW_OP_ADD, tag, 1, names[i], meta);
+  }
+
+  /* one entry for every common prefix */
+  rgw_cls_list_ret result;
+  index_list(ioctx, bucket_oid, "", "/", 100, &result);
+  ASSERT_EQ(4u, result.dir.m.size());
+  ASSERT_FALSE(result.is_truncated);
+  map<string, rgw_bucket_dir_entry>::iterator iter = result.dir.m.begin();
+  ASSERT_EQ("a/obj-0", iter->first);
+  ASSERT_EQ("b", (++iter)->first);
+  ASSERT_EQ("c/obj-0", (++iter)->first);
+  ASSERT_EQ("d", (++iter)->first);
+
+  /* in pages, going on from the marker */
+  rgw_cls_list_ret page;
+  index_list(ioctx, bucket_oid, "", "/", 2, &page);
+  ASSERT_EQ(2u, page.dir.m.size());
+  ASSERT_TRUE(page.is_truncated);
+  ASSERT_EQ("b", page.marker);
+
+  rgw_cls_list_ret next;
+  index_list(ioctx, bucket_oid, page.marker, "/", 2, &next);
+  ASSERT_EQ(2u, next.dir.m.size());
+  ASSERT_EQ("c/obj-0", next.dir.m.begin()->first);
+  ASSERT_EQ("d", next.dir.m.rbegin()->first);
+
+  /* without a delimiter, everything */
+  rgw_cls_list_ret all;
+  index_list(ioctx, bucket_oid, "", "", 100, &all);
+  ASSERT_EQ(names.size(), all.dir.m.size());
+}
+
 TEST(cls_rgw, gc_set)
 {
   /* add chains */
@@ -544,6 +615,262 @@ TEST(cls_rgw, gc_defer)
 }
 
 
+int prepare_op(librados::IoCtx& ioctx, string& oid, RGWModifyOp index_op, string& tag,
+               string& obj, bool log_op)
+{
+  ObjectWriteOperation op;
+  cls_rgw_obj_key key(obj, string());
+  cls_rgw_bucket_prepare_op(op, index_op, tag, key, string(), log_op, 0);
+  return ioctx.operate(oid, &op);
+}
+
+int complete_op(librados::IoCtx& ioctx, string& oid, RGWModifyOp index_op, string& tag,
+                int epoch, string& obj, uint64_t size, bool log_op)
+{
+  ObjectWriteOperation op;
+  cls_rgw_obj_key key(obj, string());
+  rgw_bucket_entry_ver ver;
+  ver.pool = ioctx.get_id();
+  ver.epoch = epoch;
+  rgw_bucket_dir_entry_meta meta;
+  meta.category = 0;
+  meta.size = size;
+  meta.accounted_size = size;
+  cls_rgw_bucket_complete_op(op, index_op, tag, ver, key, meta, NULL, log_op, 0);
+  return ioctx.operate(oid, &op);
+}
+
+int set_reshard_state(librados::IoCtx& ioctx, string& oid, uint8_t state)
+{
+  ObjectWriteOperation op;
+  cls_rgw_bucket_set_reshard_state(op, state);
+  return ioctx.operate(oid, &op);
+}
+
+void get_bi_log(librados::IoCtx& ioctx, string& oid, list<rgw_bi_log_entry> *entries)
+{
+  map<int, string> oids;
+  oids[0] = oid;
+  BucketIndexShardsManager markers;
+  map<int, struct cls_rgw_bi_log_list_ret> logs;
+  ASSERT_EQ(0, CLSRGWIssueBILogList(ioctx, markers, 1000, oids, logs, 8)());
+  entries->swap(logs[0].entries);
+}
+
+void get_dir_entry(rgw_cls_bi_entry& bi_entry, rgw_bucket_dir_entry *entry)
+{
+  bufferlist::iterator iter = bi_entry.data.begin();
+  ::decode(*entry, iter);
+}
+
+TEST(cls_rgw, bi_list_remove)
+{
+  string bucket_oid = "bi-list";
+
+  ObjectWriteOperation op;
+  cls_rgw_bucket_init(op);
+  ASSERT_EQ(0, ioctx.operate(bucket_oid, &op));
+
+  for (int i = 0; i < NUM_OBJS; i++) {
+    string obj = str_int("obj", i);
+    string tag = str_int("tag", i);
+    ASSERT_EQ(0, prepare_op(ioctx, bucket_oid, CLS_RGW_OP_ADD, tag, obj, true));
+    ASSERT_EQ(0, complete_op(ioctx, bucket_oid, CLS_RGW_OP_ADD, tag, 1, obj, 1024, true));
+  }
+
+  /* all entries, without the log */
+  list<rgw_cls_bi_entry> entries;
+  bool truncated;
+  ASSERT_EQ(0, cls_rgw_bi_list(ioctx, bucket_oid, string(), string(), 1000, &entries, &truncated));
+  ASSERT_EQ(NUM_OBJS, (int)entries.size());
+  ASSERT_FALSE(truncated);
+
+  /* the same, a few at a time */
+  string marker;
+  int count = 0;
+  do {
+    entries.clear();
+    ASSERT_EQ(0, cls_rgw_bi_list(ioctx, bucket_oid, string(), marker, 3, &entries, &truncated));
+    ASSERT_GE(3, (int)entries.size());
+    count += entries.size();
+    if (!entries.empty()) {
+      marker = entries.back().idx;
+    }
+  } while (truncated);
+  ASSERT_EQ(NUM_OBJS, count);
+
+  /* the entries of one object */
+  string obj = str_int("obj", 1);
+  entries.clear();
+  ASSERT_EQ(0, cls_rgw_bi_list(ioctx, bucket_oid, obj, string(), 1000, &entries, &truncated));
+  ASSERT_EQ(1, (int)entries.size());
+  rgw_bucket_dir_entry entry;
+  get_dir_entry(entries.front(), &entry);
+  ASSERT_EQ(obj, entry.key.name);
+
+  /* remove it */
+  ObjectWriteOperation rm_op;
+  cls_rgw_bi_remove(rm_op, entries.front().idx);
+  ASSERT_EQ(0, ioctx.operate(bucket_oid, &rm_op));
+  entries.clear();
+  ASSERT_EQ(0, cls_rgw_bi_list(ioctx, bucket_oid, obj, string(), 1000, &entries, &truncated));
+  ASSERT_EQ(0, (int)entries.size());
+  ASSERT_EQ(0, cls_rgw_bi_list(ioctx, bucket_oid, string(), string(), 1000, &entries, &truncated));
+  ASSERT_EQ(NUM_OBJS - 1, (int)entries.size());
+
+  /* removing what is not there is fine */
+  ObjectWriteOperation rm_again_op;
+  cls_rgw_bi_remove(rm_again_op, obj);
+  ASSERT_EQ(0, ioctx.operate(bucket_oid, &rm_again_op));
+}
+
+TEST(cls_rgw, reshard_state_logs)
+{
+  string bucket_oid = "reshard-logs";
+
+  ObjectWriteOperation op;
+  cls_rgw_bucket_init(op);
+  ASSERT_EQ(0, ioctx.operate(bucket_oid, &op));
+
+  /* not logged unless asked to */
+  string obj = str_int("obj", 0);
+  string tag = str_int("tag", 0);
+  ASSERT_EQ(0, prepare_op(ioctx, bucket_oid, CLS_RGW_OP_ADD, tag, obj, false));
+  ASSERT_EQ(0, complete_op(ioctx, bucket_oid, CLS_RGW_OP_ADD, tag, 1, obj, 1024, false));
+  list<rgw_bi_log_entry> log;
+  get_bi_log(ioctx, bucket_oid, &log);
+  ASSERT_EQ(0, (int)log.size());
+
+  /* while resharding, everything is */
+  ASSERT_EQ(0, set_reshard_state(ioctx, bucket_oid, CLS_RGW_RESHARD_IN_PROGRESS));
+  obj = str_int("obj", 1);
+  tag = str_int("tag", 1);
+  ASSERT_EQ(0, prepare_op(ioctx, bucket_oid, CLS_RGW_OP_ADD, tag, obj, false));
+  ASSERT_EQ(0, complete_op(ioctx, bucket_oid, CLS_RGW_OP_ADD, tag, 1, obj, 1024, false));
+  get_bi_log(ioctx, bucket_oid, &log);
+  ASSERT_EQ(2, (int)log.size());
+  ASSERT_EQ(obj, log.front().object);
+  ASSERT_EQ(CLS_RGW_STATE_PENDING_MODIFY, log.front().state);
+  ASSERT_EQ(CLS_RGW_STATE_COMPLETE, log.back().state);
+
+  map<int, string> oids;
+  oids[0] = bucket_oid;
+  map<int, struct rgw_cls_list_ret> headers;
+  ASSERT_EQ(0, CLSRGWIssueGetDirHeader(ioctx, oids, headers, 8)());
+  ASSERT_EQ(CLS_RGW_RESHARD_IN_PROGRESS, (int)headers[0].dir.header.reshard_state);
+
+  /* and a cancelled reshard goes back to how it was */
+  ASSERT_EQ(0, set_reshard_state(ioctx, bucket_oid, CLS_RGW_RESHARD_NONE));
+  obj = str_int("obj", 2);
+  tag = str_int("tag", 2);
+  ASSERT_EQ(0, prepare_op(ioctx, bucket_oid, CLS_RGW_OP_ADD, tag, obj, false));
+  ASSERT_EQ(0, complete_op(ioctx, bucket_oid, CLS_RGW_OP_ADD, tag, 1, obj, 1024, false));
+  get_bi_log(ioctx, bucket_oid, &log);
+  ASSERT_EQ(2, (int)log.size());
+
+  ASSERT_EQ(-EINVAL, set_reshard_state(ioctx, bucket_oid, CLS_RGW_RESHARD_DONE + 1));
+}
+
+/* copy the entries of obj from one index to the other, like a reshard does */
+void copy_entries(librados::IoCtx& ioctx, string& from_oid, string& to_oid, const string& obj)
+{
+  list<rgw_cls_bi_entry> entries;
+  bool truncated;
+  ASSERT_EQ(0, cls_rgw_bi_list(ioctx, from_oid, obj, string(), 1000, &entries, &truncated));
+  ASSERT_FALSE(entries.empty());
+  ObjectWriteOperation op;
+  for (list<rgw_cls_bi_entry>::iterator iter = entries.begin(); iter != entries.end(); ++iter) {
+    cls_rgw_bi_put(op, *iter);
+  }
+  ASSERT_EQ(0, ioctx.operate(to_oid, &op));
+}
+
+TEST(cls_rgw, reshard_write_in_flight)
+{
+  string old_oid = "reshard-old";
+  string new_oid = "reshard-new";
+
+  ObjectWriteOperation init_op;
+  cls_rgw_bucket_init(init_op);
+  ASSERT_EQ(0, ioctx.operate(old_oid, &init_op));
+  ObjectWriteOperation init_new_op;
+  cls_rgw_bucket_init(init_new_op);
+  ASSERT_EQ(0, ioctx.operate(new_oid, &init_new_op));
+
+  string obj0 = str_int("obj", 0);
+  string tag0 = str_int("tag", 0);
+  ASSERT_EQ(0, prepare_op(ioctx, old_oid, CLS_RGW_OP_ADD, tag0, obj0, false));
+  ASSERT_EQ(0, complete_op(ioctx, old_oid, CLS_RGW_OP_ADD, tag0, 1, obj0, 1024, false));
+
+  /* started before the reshard, by a gateway that does not log */
+  string obj1 = str_int("obj", 1);
+  string tag1 = str_int("tag", 1);
+  ASSERT_EQ(0, prepare_op(ioctx, old_oid, CLS_RGW_OP_ADD, tag1, obj1, false));
+
+  /* copy */
+  ASSERT_EQ(0, set_reshard_state(ioctx, old_oid, CLS_RGW_RESHARD_IN_PROGRESS));
+  list<rgw_cls_bi_entry> entries;
+  bool truncated;
+  ASSERT_EQ(0, cls_rgw_bi_list(ioctx, old_oid, string(), string(), 1000, &entries, &truncated));
+  ASSERT_EQ(2, (int)entries.size());
+  ObjectWriteOperation copy_op;
+  for (list<rgw_cls_bi_entry>::iterator iter = entries.begin(); iter != entries.end(); ++iter) {
+    cls_rgw_bi_put(copy_op, *iter);
+  }
+  ASSERT_EQ(0, ioctx.operate(new_oid, &copy_op));
+
+  /* started during the copy */
+  string obj2 = str_int("obj", 2);
+  string tag2 = str_int("tag", 2);
+  ASSERT_EQ(0, prepare_op(ioctx, old_oid, CLS_RGW_OP_ADD, tag2, obj2, false));
+
+  /* switch: nothing new gets in any more */
+  ASSERT_EQ(0, set_reshard_state(ioctx, old_oid, CLS_RGW_RESHARD_DONE));
+  string obj3 = str_int("obj", 3);
+  string tag3 = str_int("tag", 3);
+  ASSERT_EQ(-ESTALE, prepare_op(ioctx, old_oid, CLS_RGW_OP_ADD, tag3, obj3, false));
+  ASSERT_EQ(-ESTALE, complete_op(ioctx, old_oid, CLS_RGW_OP_ADD, tag3, 1, obj3, 1024, false));
+
+  /* but what was in flight lands, and is logged */
+  ASSERT_EQ(0, complete_op(ioctx, old_oid, CLS_RGW_OP_ADD, tag1, 1, obj1, 1024, false));
+  ASSERT_EQ(0, complete_op(ioctx, old_oid, CLS_RGW_OP_ADD, tag2, 1, obj2, 1024, false));
+
+  list<rgw_bi_log_entry> log;
+  get_bi_log(ioctx, old_oid, &log);
+  set<string> pending, completed;
+  for (list<rgw_bi_log_entry>::iterator iter = log.begin(); iter != log.end(); ++iter) {
+    if (iter->state == CLS_RGW_STATE_PENDING_MODIFY) {
+      pending.insert(iter->tag);
+    } else {
+      completed.insert(iter->tag);
+    }
+  }
+  ASSERT_EQ(1, (int)pending.count(tag2));
+  ASSERT_EQ(1, (int)completed.count(tag1));
+  ASSERT_EQ(1, (int)completed.count(tag2));
+  ASSERT_EQ(0, (int)pending.count(tag3) + (int)completed.count(tag3));
+
+  /* replay the log into the new index */
+  for (list<rgw_bi_log_entry>::iterator iter = log.begin(); iter != log.end(); ++iter) {
+    copy_entries(ioctx, old_oid, new_oid, iter->object);
+  }
+  map<int, string> oids;
+  oids[0] = new_oid;
+  ASSERT_EQ(0, CLSRGWIssueBucketRebuild(ioctx, oids, 8)());
+
+  entries.clear();
+  ASSERT_EQ(0, cls_rgw_bi_list(ioctx, new_oid, string(), string(), 1000, &entries, &truncated));
+  ASSERT_EQ(3, (int)entries.size());
+  for (list<rgw_cls_bi_entry>::iterator iter = entries.begin(); iter != entries.end(); ++iter) {
+    rgw_bucket_dir_entry entry;
+    get_dir_entry(*iter, &entry);
+    ASSERT_TRUE(entry.exists);
+    ASSERT_TRUE(entry.pending_map.empty());
+  }
+  test_stats(ioctx, new_oid, 0, 3, 3 * 1024);
+}
+
+
 /* must be last test! */
 
 TEST(cls_rgw, finalize)
@@ -17,6 +17,7 @@
 #include <stdint.h>
 #include <boost/foreach.hpp>
 #include <cstdarg>
+#include <iostream>
 
 
 #define ASSERT_RA(expected_offset, expected_length, ra) \
@@ -128,3 +129,188 @@ TEST(Readahead, alignment) {
   ASSERT_RA(1400, 300, r.update(1290, 10, Readahead::NO_LIMIT)); // internal readahead size 320
   ASSERT_RA(0, 0, r.update(1300, 10, Readahead::NO_LIMIT));
 }
+
+TEST(Readahead, stride) {
+  Readahead r;
+  r.set_trigger_requests(2);
+  r.set_stride_detection(true);
+  vector<Readahead::extent_t> ra;
+  vector<Readahead::extent_t> reads(1, Readahead::extent_t(1000, 10));
+  r.update(reads, Readahead::NO_LIMIT, &ra);
+  ASSERT_TRUE(ra.empty());
+  reads[0].first = 1100;
+  r.update(reads, Readahead::NO_LIMIT, &ra);
+  ASSERT_TRUE(ra.empty());
+  reads[0].first = 1200;
+  r.update(reads, Readahead::NO_LIMIT, &ra);
+  ASSERT_EQ(2u, ra.size());
+  ASSERT_EQ(Readahead::extent_t(1300, 10), ra[0]);
+  ASSERT_EQ(Readahead::extent_t(1400, 10), ra[1]);
+  ra.clear();
+  reads[0].first = 1300;
+  r.update(reads, Readahead::NO_LIMIT, &ra);
+  ASSERT_TRUE(ra.empty());
+  reads[0].first = 1400;
+  r.update(reads, Readahead::NO_LIMIT, &ra);
+  ASSERT_EQ(4u, ra.size());
+  for (unsigned i = 0; i < ra.size(); i++) {
+    ASSERT_EQ(Readahead::extent_t(1500 + i * 100, 10), ra[i]);
+  }
+
+  // the single-extent form returns the span covering the records
+  ASSERT_RA(0, 0, r.update(1500, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r.update(1600, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(1900, 710, r.update(1700, 10, Readahead::NO_LIMIT));
+
+  vector<Readahead::stream_stat_t> stats;
+  r.get_stream_stats(&stats);
+  ASSERT_EQ(1u, stats.size());
+  ASSERT_EQ(100u, stats[0].stride);
+  ASSERT_EQ(8u, stats[0].reads);
+  ASSERT_EQ(3u, stats[0].readahead_requests);
+  ASSERT_EQ(140u, stats[0].readahead_bytes);
+}
+
+TEST(Readahead, stride_dense) {
+  Readahead r;
+  r.set_trigger_requests(2);
+  r.set_stride_detection(true);
+  ASSERT_RA(0, 0, r.update(1000, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r.update(1015, 10, Readahead::NO_LIMIT));
+  // gaps are smaller than the records, so read them too
+  vector<Readahead::extent_t> ra;
+  vector<Readahead::extent_t> reads(1, Readahead::extent_t(1030, 10));
+  r.update(reads, Readahead::NO_LIMIT, &ra);
+  ASSERT_EQ(1u, ra.size());
+  ASSERT_EQ(Readahead::extent_t(1045, 25), ra[0]);
+}
+
+TEST(Readahead, stride_disabled) {
+  Readahead r;
+  r.set_trigger_requests(2);
+  ASSERT_RA(0, 0, r.update(1000, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r.update(1100, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r.update(1200, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r.update(1300, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r.update(1400, 10, Readahead::NO_LIMIT));
+}
+
+TEST(Readahead, streams) {
+  Readahead r;
+  r.set_trigger_requests(2);
+  // one stream: interleaved readers keep resetting each other
+  ASSERT_RA(0, 0, r.update(1000, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r.update(5000, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r.update(1010, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r.update(5010, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r.update(1020, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r.update(5020, 10, Readahead::NO_LIMIT));
+
+  Readahead r2;
+  r2.set_trigger_requests(2);
+  r2.set_max_streams(2);
+  ASSERT_RA(0, 0, r2.update(1000, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r2.update(5000, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r2.update(1010, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r2.update(5010, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(1030, 20, r2.update(1020, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(5030, 20, r2.update(5020, 10, Readahead::NO_LIMIT));
+  // a third reader replaces the least recently used stream
+  ASSERT_RA(0, 0, r2.update(9000, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(5050, 40, r2.update(5030, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r2.update(1030, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r2.update(1040, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(1060, 20, r2.update(1050, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r2.update(5040, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r2.update(5050, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(5090, 80, r2.update(5060, 10, Readahead::NO_LIMIT));
+
+  vector<Readahead::stream_stat_t> stats;
+  r2.get_stream_stats(&stats);
+  ASSERT_EQ(2u, stats.size());
+}
+
+TEST(Readahead, latency) {
+  Readahead r;
+  r.set_trigger_requests(2);
+  r.set_max_readahead_size(1000);
+  // the reader consumes far more than 1000 bytes in the time a
+  // readahead takes, so the window opens straight to the maximum
+  r.record_latency(utime_t(1, 0));
+  ASSERT_RA(0, 0, r.update(1000, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(0, 0, r.update(1010, 10, Readahead::NO_LIMIT));
+  ASSERT_RA(1030, 1000, r.update(1020, 10, Readahead::NO_LIMIT));
+}
+
+/**
+ * Replays a read trace against a simulated cache that holds everything
+ * read or read ahead so far.
+ * @returns the fraction of bytes read that were already cached
+ */
+static double replay(Readahead &r, const vector<Readahead::extent_t>& trace,
+		     uint64_t limit)
+{
+  vector<bool> cached(limit);
+  uint64_t hit = 0, total = 0;
+  vector<Readahead::extent_t> reads(1);
+  vector<Readahead::extent_t> ra;
+  BOOST_FOREACH(const Readahead::extent_t &e, trace) {
+    for (uint64_t i = e.first; i < e.first + e.second; i++) {
+      if (cached[i])
+	hit++;
+      cached[i] = true;
+    }
+    total += e.second;
+    reads[0] = e;
+    ra.clear();
+    r.update(reads, limit, &ra);
+    BOOST_FOREACH(const Readahead::extent_t &p, ra) {
+      for (uint64_t i = p.first; i < p.first + p.second; i++)
+	cached[i] = true;
+    }
+  }
+  return (double)hit / total;
+}
+
+TEST(Readahead, replay) {
+  const uint64_t record = 4096;
+  vector<Readahead::extent_t> sequential, strided, interleaved;
+  for (unsigned i = 0; i < 1000; i++)
+    sequential.push_back(Readahead::extent_t(i * record, record));
+  for (unsigned i = 0; i < 400; i++)
+    strided.push_back(Readahead::extent_t(i * record * 8, record));
+  for (unsigned i = 0; i < 250; i++)
+    for (unsigned s = 0; s < 4; s++)
+      interleaved.push_back(Readahead::extent_t((s * 250 + i) * record, record));
+  uint64_t limit = 400 * record * 8;
+
+  Readahead plain;
+  double seq = replay(plain, sequential, limit);
+  Readahead plain2;
+  double str = replay(plain2, strided, limit);
+  Readahead plain3;
+  double inter = replay(plain3, interleaved, limit);
+  std::cout << "1 stream, no stride detection: sequential " << seq
+	    << " strided " << str << " interleaved " << inter << std::endl;
+  ASSERT_GT(seq, 0.9);
+  ASSERT_EQ(0, str);
+  ASSERT_EQ(0, inter);
+
+  Readahead adaptive;
+  adaptive.set_max_streams(4);
+  adaptive.set_stride_detection(true);
+  seq = replay(adaptive, sequential, limit);
+  Readahead adaptive2;
+  adaptive2.set_max_streams(4);
+  adaptive2.set_stride_detection(true);
+  str = replay(adaptive2, strided, limit);
+  Readahead adaptive3;
+  adaptive3.set_max_streams(4);
+  adaptive3.set_stride_detection(true);
+  inter = replay(adaptive3, interleaved, limit);
+  std::cout << "4 streams, stride detection: sequential " << seq
+	    << " strided " << str << " interleaved " << inter << std::endl;
+  ASSERT_GT(seq, 0.9);
+  ASSERT_GT(str, 0.9);
+  ASSERT_GT(inter, 0.9);
+}
@@ -22,6 +22,8 @@
 #include <dirent.h>
 #include <sys/xattr.h>
 #include <sys/uio.h>
+#include <map>
+#include <string>
 
 #ifdef __linux__
 #include <limits.h>
@@ -1283,3 +1285,239 @@ TEST(LibCephFS, GetOsdAddr) {
 
   ceph_shutdown(cmount);
 }
+
+TEST(LibCephFS, AsyncCreate) {
+  struct ceph_mount_info *cmount;
+  ASSERT_EQ(ceph_create(&cmount, NULL), 0);
+  ASSERT_EQ(0, ceph_conf_parse_env(cmount, NULL));
+  ASSERT_EQ(ceph_conf_read_file(cmount, NULL), 0);
+  ASSERT_EQ(0, ceph_conf_set(cmount, "client_async_create", "true"));
+  ASSERT_EQ(ceph_mount(cmount, NULL), 0);
+
+  char dir[256];
+  sprintf(dir, "/test_asynccreate%d", getpid());
+  ASSERT_EQ(0, ceph_mkdir(cmount, dir, 0755));
+
+  // the first create learns the layout and gets inos delegated; the
+  // rest may not wait for the mds
+  char path[512];
+  const int num = 100;
+  for (int i = 0; i < num; i++) {
+    sprintf(path, "%s/f%d", dir, i);
+    int fd = ceph_open(cmount, path, O_CREAT|O_EXCL|O_WRONLY, 0644);
+    ASSERT_GT(fd, 0);
+    ASSERT_EQ(3, ceph_write(cmount, fd, "foo", 3, 0));
+    if (i == num - 1)
+      ASSERT_EQ(0, ceph_fsync(cmount, fd, 0));
+    ASSERT_EQ(0, ceph_close(cmount, fd));
+  }
+
+  // an existing name must still fail
+  sprintf(path, "%s/f0", dir);
+  ASSERT_EQ(-EEXIST, ceph_open(cmount, path, O_CREAT|O_EXCL|O_WRONLY, 0644));
+
+  // a new layout policy on the dir applies to the next create, not the
+  // layout an earlier one learned
+  ASSERT_EQ(0, ceph_setxattr(cmount, dir, "ceph.dir.layout.object_size",
+			     "8388608", 7, 0));
+  sprintf(path, "%s/after_policy", dir);
+  int fd = ceph_open(cmount, path, O_CREAT|O_EXCL|O_WRONLY, 0644);
+  ASSERT_GT(fd, 0);
+  ASSERT_EQ(8388608, ceph_get_file_object_size(cmount, fd));
+  ASSERT_EQ(0, ceph_close(cmount, fd));
+  ASSERT_EQ(0, ceph_unlink(cmount, path));
+
+  // a second client sees everything
+  struct ceph_mount_info *cmount2;
+  ASSERT_EQ(ceph_create(&cmount2, NULL), 0);
+  ASSERT_EQ(0, ceph_conf_parse_env(cmount2, NULL));
+  ASSERT_EQ(ceph_conf_read_file(cmount2, NULL), 0);
+  ASSERT_EQ(ceph_mount(cmount2, NULL), 0);
+  for (int i = 0; i < num; i++) {
+    struct stat st;
+    sprintf(path, "%s/f%d", dir, i);
+    ASSERT_EQ(0, ceph_stat(cmount2, path, &st));
+    ASSERT_EQ(3, st.st_size);
+  }
+
+  for (int i = 0; i < num; i++) {
+    sprintf(path, "%s/f%d", dir, i);
+    ASSERT_EQ(0, ceph_unlink(cmount, path));
+  }
+  ASSERT_EQ(0, ceph_rmdir(cmount, dir));
+  ceph_shutdown(cmount2);
+  ceph_shutdown(cmount);
+}
+
+TEST(LibCephFS, ReaddirPrefetch) {
+  struct ceph_mount_info *cmount;
+  ASSERT_EQ(ceph_create(&cmount, NULL), 0);
+  ASSERT_EQ(0, ceph_conf_parse_env(cmount, NULL));
+  ASSERT_EQ(ceph_conf_read_file(cmount, NULL), 0);
+  ASSERT_EQ(ceph_mount(cmount, NULL), 0);
+
+  char dir[256];
+  sprintf(dir, "/test_readdirprefetch%d", getpid());
+  ASSERT_EQ(0, ceph_mkdir(cmount, dir, 0755));
+
+  // enough entries for the mds to return several chunks
+  char path[512];
+  const int num = 5000;
+  for (int i = 0; i < num; i++) {
+    sprintf(path, "%s/f%d", dir, i);
+    ASSERT_EQ(0, ceph_mknod(cmount, path, 0644, 0));
+  }
+
+  // list from a second client with a cold cache, several chunks ahead
+  struct ceph_mount_info *cmount2;
+  ASSERT_EQ(ceph_create(&cmount2, NULL), 0);
+  ASSERT_EQ(0, ceph_conf_parse_env(cmount2, NULL));
+  ASSERT_EQ(ceph_conf_read_file(cmount2, NULL), 0);
+  ASSERT_EQ(0, ceph_conf_set(cmount2, "client_readdir_prefetch", "4"));
+  ASSERT_EQ(ceph_mount(cmount2, NULL), 0);
+
+  for (int pass = 0; pass < 2; pass++) {
+    struct ceph_dir_result *ls_dir = NULL;
+    ASSERT_EQ(0, ceph_opendir(cmount2, dir, &ls_dir));
+    std::vector<bool> seen(num, false);
+    int count = 0;
+    struct dirent de;
+    struct stat st;
+    int stmask;
+    int r;
+    while ((r = ceph_readdirplus_r(cmount2, ls_dir, &de, &st, &stmask)) > 0) {
+      if (strcmp(de.d_name, ".") == 0 || strcmp(de.d_name, "..") == 0)
+	continue;
+      int n;
+      ASSERT_EQ(1, sscanf(de.d_name, "f%d", &n));
+      ASSERT_TRUE(n >= 0 && n < num);
+      ASSERT_FALSE(seen[n]);
+      seen[n] = true;
+      ASSERT_TRUE(S_ISREG(st.st_mode));
+      ++count;
+    }
+    ASSERT_EQ(0, r);
+    ASSERT_EQ(num, count);
+    ASSERT_EQ(0, ceph_closedir(cmount2, ls_dir));
+  }
+
+  // stop reading part way with chunks still outstanding
+  struct ceph_dir_result *ls_dir = NULL;
+  ASSERT_EQ(0, ceph_opendir(cmount2, dir, &ls_dir));
+  ASSERT_TRUE(ceph_readdir(cmount2, ls_dir) != NULL);
+  ASSERT_EQ(0, ceph_closedir(cmount2, ls_dir));
+
+  for (int i = 0; i < num; i++) {
+    sprintf(path, "%s/f%d", dir, i);
+    ASSERT_EQ(0, ceph_unlink(cmount, path));
+  }
+  ASSERT_EQ(0, ceph_rmdir(cmount, dir));
+  ceph_shutdown(cmount2);
+  ceph_shutdown(cmount);
+}
+
+static int mds_injectargs(struct ceph_mount_info *cmount, const char *args)
+{
+  std::string cmd = std::string("{\"prefix\": \"injectargs\", "
+				"\"injected_args\": [\"") + args + "\"]}";
+  const char *cmdv[] = { cmd.c_str() };
+  char *outbuf = NULL, *outs = NULL;
+  size_t outbuflen = 0, outslen = 0;
+  int r = ceph_mds_command(cmount, "*", cmdv, 1, "", 0,
+			   &outbuf, &outbuflen, &outs, &outslen);
+  if (outbuf)
+    ceph_buffer_free(outbuf);
+  if (outs)
+    ceph_buffer_free(outs);
+  return r;
+}
+
+static void readdir_count(struct ceph_mount_info *cmount,
+			  struct ceph_dir_result *ls_dir, int max,
+			  std::map<std::string,int>& seen)
+{
+  struct dirent *de;
+  for (int n = 0; (max < 0 || n < max) &&
+	 (de = ceph_readdir(cmount, ls_dir)) != NULL; n++) {
+    if (strcmp(de->d_name, ".") && strcmp(de->d_name, ".."))
+      seen[de->d_name]++;
+  }
+}
+
+/*
+ * Names that are prefixes of one another sort differently by name
+ * ("d1" < "d1-a") and by dentry key ("d1-a_head" < "d1_head").  A
+ * listing the mds streams in key order has to stay in it, though the
+ * same client lists the frag again meanwhile and the frag is trimmed
+ * from the mds cache part way.
+ */
+TEST(LibCephFS, ReaddirStreamPrefixNames) {
+  struct ceph_mount_info *cmount;
+  ASSERT_EQ(ceph_create(&cmount, NULL), 0);
+  ASSERT_EQ(0, ceph_conf_parse_env(cmount, NULL));
+  ASSERT_EQ(ceph_conf_read_file(cmount, NULL), 0);
+  ASSERT_EQ(ceph_mount(cmount, NULL), 0);
+
+  char dir[256];
+  sprintf(dir, "/test_readdirstream%d", getpid());
+  ASSERT_EQ(0, ceph_mkdir(cmount, dir, 0755));
+
+  const char *suffixes[] = { "", "-a", "-a-b", ".c" };
+  const int nsuffixes = sizeof(suffixes) / sizeof(suffixes[0]);
+  const int num = 200;
+  char path[512];
+  for (int i = 0; i < num; i++) {
+    for (int j = 0; j < nsuffixes; j++) {
+      sprintf(path, "%s/d%d%s", dir, i, suffixes[j]);
+      ASSERT_EQ(0, ceph_mknod(cmount, path, 0644, 0));
+    }
+  }
+  ceph_shutdown(cmount);  // drop our caps, so the frag can be trimmed
+
+  struct ceph_mount_info *cmount2;
+  ASSERT_EQ(ceph_create(&cmount2, NULL), 0);
+  ASSERT_EQ(0, ceph_conf_parse_env(cmount2, NULL));
+  ASSERT_EQ(ceph_conf_read_file(cmount2, NULL), 0);
+  ASSERT_EQ(ceph_mount(cmount2, NULL), 0);
+  ASSERT_EQ(0, mds_injectargs(cmount2, "--mds_readdir_stream_min_entries 10 "
+			      "--mds_readdir_stream_page 16 --mds_cache_size 100"));
+  sleep(12);  // a couple of mds ticks, to trim the frag
+
+  std::map<std::string,int> seen;
+  struct ceph_dir_result *ls_dir = NULL;
+  ASSERT_EQ(0, ceph_opendir(cmount2, dir, &ls_dir));
+  readdir_count(cmount2, ls_dir, num, seen);
+
+  // the same client lists the frag again from the start meanwhile
+  std::map<std::string,int> seen2;
+  struct ceph_dir_result *ls_dir2 = NULL;
+  ASSERT_EQ(0, ceph_opendir(cmount2, dir, &ls_dir2));
+  readdir_count(cmount2, ls_dir2, -1, seen2);
+  ASSERT_EQ(0, ceph_closedir(cmount2, ls_dir2));
+
+  sleep(12);  // and the frag is trimmed again
+  readdir_count(cmount2, ls_dir, -1, seen);
+  ASSERT_EQ(0, ceph_closedir(cmount2, ls_dir));
+
+  ASSERT_EQ(0, mds_injectargs(cmount2, "--mds_readdir_stream_min_entries 0 "
+			      "--mds_readdir_stream_page 1024 --mds_cache_size 100000"));
+
+  ASSERT_EQ((size_t)(num * nsuffixes), seen.size());
+  ASSERT_EQ((size_t)(num * nsuffixes), seen2.size());
+  for (int i = 0; i < num; i++) {
+    for (int j = 0; j < nsuffixes; j++) {
+      sprintf(path, "d%d%s", i, suffixes[j]);
+      ASSERT_EQ(1, seen[path]) << path;
+      ASSERT_EQ(1, seen2[path]) << path;
+    }
+  }
+
+  for (int i = 0; i < num; i++) {
+    for (int j = 0; j < nsuffixes; j++) {
+      sprintf(path, "%s/d%d%s", dir, i, suffixes[j]);
+      ASSERT_EQ(0, ceph_unlink(cmount2, path));
+    }
+  }
+  ASSERT_EQ(0, ceph_rmdir(cmount2, dir));
+  ceph_shutdown(cmount2);
+}
@@ -0,0 +1,234 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include "mds/BalancerPlan.h"
+#include "messages/MHeartbeat.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include "gtest/gtest.h"
+
+using std::map;
+using std::vector;
+
+TEST(BalancerPlan, basic)
+{
+  BalancerPlan plan;
+  plan.loads[mds_rank_t(0)] = 100;
+  plan.loads[mds_rank_t(1)] = 0;
+  plan.plan(1);
+  ASSERT_EQ(50, plan.target_load);
+  ASSERT_TRUE(plan.is_exporter(mds_rank_t(0)));
+  ASSERT_FALSE(plan.is_exporter(mds_rank_t(1)));
+  ASSERT_EQ(1u, plan.targets.size());
+  ASSERT_EQ(50, plan.targets[mds_rank_t(0)][mds_rank_t(1)]);
+}
+
+TEST(BalancerPlan, min_rebalance)
+{
+  BalancerPlan plan;
+  plan.loads[mds_rank_t(0)] = 105;
+  plan.loads[mds_rank_t(1)] = 95;
+  plan.plan(1);
+  // over the target, but not by enough to bother
+  ASSERT_FALSE(plan.is_exporter(mds_rank_t(0)));
+  plan.loads[mds_rank_t(0)] = 130;
+  plan.loads[mds_rank_t(1)] = 70;
+  plan.plan(1);
+  ASSERT_TRUE(plan.is_exporter(mds_rank_t(0)));
+}
+
+TEST(BalancerPlan, import_map)
+{
+  // mds.0 imported from mds.2 earlier; that load goes back first
+  BalancerPlan plan;
+  plan.loads[mds_rank_t(0)] = 150;
+  plan.loads[mds_rank_t(1)] = 75;
+  plan.loads[mds_rank_t(2)] = 75;
+  plan.import_map[mds_rank_t(0)][mds_rank_t(2)] = 100;
+  plan.plan(1);
+  ASSERT_EQ(100, plan.target_load);
+  ASSERT_EQ(25, plan.targets[mds_rank_t(0)][mds_rank_t(2)]);
+  ASSERT_EQ(25, plan.targets[mds_rank_t(0)][mds_rank_t(1)]);
+}
+
+TEST(BalancerPlan, hysteresis)
+{
+  BalancerPlan plan;
+  plan.hysteresis = .2;
+  plan.loads[mds_rank_t(0)] = 200;
+  plan.loads[mds_rank_t(1)] = 0;
+  plan.plan(1);
+  ASSERT_EQ(100, plan.targets[mds_rank_t(0)][mds_rank_t(1)]);
+
+  // mds.1 just imported; it must be 30% (not 10%) over to export
+  plan.loads[mds_rank_t(0)] = 75;
+  plan.loads[mds_rank_t(1)] = 125;
+  plan.plan(1);
+  ASSERT_FALSE(plan.is_exporter(mds_rank_t(1)));
+  ASSERT_TRUE(plan.targets.empty());
+
+  plan.loads[mds_rank_t(0)] = 60;
+  plan.loads[mds_rank_t(1)] = 140;
+  plan.plan(1);
+  ASSERT_TRUE(plan.is_exporter(mds_rank_t(1)));
+  ASSERT_EQ(40, plan.targets[mds_rank_t(1)][mds_rank_t(0)]);
+
+  // without the history it exports as soon as it is 10% over
+  plan.reset_history();
+  plan.loads[mds_rank_t(0)] = 75;
+  plan.loads[mds_rank_t(1)] = 125;
+  plan.plan(1);
+  ASSERT_TRUE(plan.is_exporter(mds_rank_t(1)));
+}
+
+/*
+ * Offline replay of the balancer.  Each rank's load is sent through an
+ * MHeartbeat (so that what we plan on is what a rank would receive),
+ * every rank plans, and exporters move the load they were told to.
+ * The load each rank sees is noisy, as it would be in a real cluster.
+ */
+class BalancerSim {
+public:
+  vector<double> work;   ///< load each rank owns
+  map<mds_rank_t, map<mds_rank_t, float> > import_map;
+  BalancerPlan plan;
+  double noise;
+  uint32_t seed;
+
+  unsigned flips;        ///< exports by a rank that imported the epoch before
+  double moved;          ///< total load migrated
+  vector<int> last_dir;  ///< per rank: 1 if it last imported, -1 if exported
+
+  BalancerSim(const vector<double>& w, double n, double hysteresis)
+    : work(w), noise(n), seed(1), flips(0), moved(0), last_dir(w.size(), 0) {
+    plan.hysteresis = hysteresis;
+  }
+
+  double rand_noise() {
+    seed = seed * 1103515245 + 12345;
+    double u = (double)((seed >> 16) & 0x7fff) / 32767.0;  // [0, 1]
+    return 1.0 + noise * (2.0 * u - 1.0);
+  }
+
+  /// what the other ranks learn about rank r from its heartbeat
+  void heartbeat(mds_rank_t r, int beat, double *load,
+		 map<mds_rank_t, float> *imports) {
+    utime_t now = ceph_clock_now(g_ceph_context);
+    mds_load_t l(now);
+    l.req_rate = work[r] * rand_noise();
+    MHeartbeat *hb = new MHeartbeat(l, beat);
+    hb->get_import_map() = import_map[r];
+    hb->encode_payload(0);
+
+    MHeartbeat *rx = new MHeartbeat();
+    rx->set_payload(hb->get_payload());
+    rx->decode_payload();
+    ASSERT_EQ(beat, rx->get_beat());
+    *load = rx->get_load().mds_load();
+    *imports = rx->get_import_map();
+    hb->put();
+    rx->put();
+  }
+
+  void epoch(int beat) {
+    for (mds_rank_t r(0); r < mds_rank_t(work.size()); r++)
+      heartbeat(r, beat, &plan.loads[r], &plan.import_map[r]);
+    plan.plan(beat);
+
+    vector<int> dir(work.size(), 0);
+    for (mds_rank_t ex(0); ex < mds_rank_t(work.size()); ex++) {
+      if (!plan.is_exporter(ex) || !plan.targets.count(ex))
+	continue;
+      map<mds_rank_t, double>& t = plan.targets[ex];
+      for (map<mds_rank_t, double>::iterator p = t.begin(); p != t.end(); ++p) {
+	double amount = MIN(p->second, work[ex]);
+	work[ex] -= amount;
+	work[p->first] += amount;
+	moved += amount;
+	import_map[p->first][ex] += amount;
+	dir[ex] = -1;
+	dir[p->first] = 1;
+      }
+    }
+    for (unsigned r = 0; r < work.size(); r++) {
+      if (dir[r] == -1 && last_dir[r] == 1)
+	flips++;
+      if (dir[r])
+	last_dir[r] = dir[r];
+    }
+  }
+
+  double imbalance() {
+    double total = 0;
+    for (unsigned r = 0; r < work.size(); r++)
+      total += work[r];
+    double mean = total / work.size();
+    double worst = 0;
+    for (unsigned r = 0; r < work.size(); r++)
+      worst = MAX(worst, fabs(work[r] - mean) / mean);
+    return worst;
+  }
+};
+
+TEST(BalancerPlan, replay_converges)
+{
+  vector<double> w(4, 0);
+  w[0] = 4000;
+  BalancerSim sim(w, 0, 0);
+  for (int beat = 1; beat <= 5; beat++)
+    sim.epoch(beat);
+  ASSERT_LT(sim.imbalance(), .1);
+}
+
+TEST(BalancerPlan, replay_hysteresis)
+{
+  vector<double> w;
+  w.push_back(8000);
+  w.push_back(1000);
+  w.push_back(500);
+  w.push_back(500);
+  w.push_back(0);
+  BalancerSim plain(w, .3, 0);
+  BalancerSim damped(w, .3, .2);
+  for (int beat = 1; beat <= 100; beat++) {
+    plain.epoch(beat);
+    damped.epoch(beat);
+  }
+  std::cout << "no hysteresis: " << plain.flips << " flips, moved "
+	    << plain.moved << ", imbalance " << plain.imbalance() << std::endl;
+  std::cout << "hysteresis:    " << damped.flips << " flips, moved "
+	    << damped.moved << ", imbalance " << damped.imbalance() << std::endl;
+  ASSERT_LT(damped.flips, plain.flips);
+  ASSERT_LT(damped.moved, plain.moved);
+  ASSERT_LT(damped.imbalance(), .5);
+}
+
+int main(int argc, char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+// Local Variables:
+// compile-command: "cd ../.. ; make unittest_mds_balancer_plan && ./unittest_mds_balancer_plan"
+// End:
@@ -18,6 +18,7 @@
 #include <stdint.h>
 #include <string>
 #include <iostream>
+#include <new>
 
 using namespace std;
 
@@ -27,9 +28,205 @@ using namespace std;
 #include "global/global_init.h"
 #include "os/ObjectStore.h"
 
+// count every heap allocation so we can compare transaction paths
+static uint64_t alloc_count = 0;
+
+void *operator new(size_t size) throw(std::bad_alloc)
+{
+  __sync_fetch_and_add(&alloc_count, 1);
+  void *p = malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) throw()
+{
+  free(p);
+}
+
+/*
+ * ObjectStore::Transaction's op_bl encoding as it was before ops were
+ * carved contiguously out of op_ptr: every op got a bufferptr of its own
+ * in op_bl, and the iterator copied the collections and objects out of
+ * the index maps up front.  Only the ops the cases below use; it encodes
+ * to the same bytes as the real thing, which main() checks.
+ */
+class LegacyTransaction {
+  typedef ObjectStore::Transaction::Op Op;
+
+  ObjectStore::Transaction::TransactionData data;
+  map<coll_t, __le32> coll_index;
+  map<ghobject_t, __le32> object_index;
+  __le32 coll_id;
+  __le32 object_id;
+  bufferlist data_bl;
+  bufferlist op_bl;
+  bufferptr op_ptr;
+
+  Op* _get_next_op() {
+    if (op_ptr.length() == 0 || op_ptr.offset() >= op_ptr.length()) {
+      op_ptr = bufferptr(sizeof(Op) * OPS_PER_PTR);
+      op_ptr.zero();
+    }
+    bufferptr ptr(op_ptr, 0, sizeof(Op));
+    op_bl.append(ptr);
+
+    op_ptr.set_offset(op_ptr.offset() + sizeof(Op));
+
+    char* p = ptr.c_str();
+    return reinterpret_cast<Op*>(p);
+  }
+  __le32 _get_coll_id(const coll_t& coll) {
+    map<coll_t, __le32>::iterator c = coll_index.find(coll);
+    if (c != coll_index.end())
+      return c->second;
+    __le32 index_id = coll_id++;
+    coll_index[coll] = index_id;
+    return index_id;
+  }
+  __le32 _get_object_id(const ghobject_t& oid) {
+    map<ghobject_t, __le32>::iterator o = object_index.find(oid);
+    if (o != object_index.end())
+      return o->second;
+    __le32 index_id = object_id++;
+    object_index[oid] = index_id;
+    return index_id;
+  }
+
+ public:
+  LegacyTransaction() : coll_id(0), object_id(0) {}
+
+  void write(coll_t cid, const ghobject_t& oid, uint64_t off, uint64_t len,
+             const bufferlist& write_data) {
+    Op* _op = _get_next_op();
+    _op->op = ObjectStore::Transaction::OP_WRITE;
+    _op->cid = _get_coll_id(cid);
+    _op->oid = _get_object_id(oid);
+    _op->off = off;
+    _op->len = len;
+    ::encode(write_data, data_bl);
+    if (write_data.length() > data.largest_data_len) {
+      data.largest_data_len = write_data.length();
+      data.largest_data_off = off;
+      data.largest_data_off_in_tbl = sizeof(__u32);
+    }
+    data.ops++;
+  }
+  void setattr(coll_t cid, const ghobject_t& oid, const string& s, bufferlist& val) {
+    Op* _op = _get_next_op();
+    _op->op = ObjectStore::Transaction::OP_SETATTR;
+    _op->cid = _get_coll_id(cid);
+    _op->oid = _get_object_id(oid);
+    ::encode(s, data_bl);
+    ::encode(val, data_bl);
+    data.ops++;
+  }
+  void omap_setkeys(coll_t cid, const ghobject_t &oid,
+                    const map<string, bufferlist> &attrset) {
+    Op* _op = _get_next_op();
+    _op->op = ObjectStore::Transaction::OP_OMAP_SETKEYS;
+    _op->cid = _get_coll_id(cid);
+    _op->oid = _get_object_id(oid);
+    ::encode(attrset, data_bl);
+    data.ops++;
+  }
+  void omap_rmkeys(coll_t cid, const ghobject_t &oid, const set<string> &keys) {
+    Op* _op = _get_next_op();
+    _op->op = ObjectStore::Transaction::OP_OMAP_RMKEYS;
+    _op->cid = _get_coll_id(cid);
+    _op->oid = _get_object_id(oid);
+    ::encode(keys, data_bl);
+    data.ops++;
+  }
+
+  void encode(bufferlist& bl) const {
+    ENCODE_START(9, 9, bl);
+    ::encode(data_bl, bl);
+    ::encode(op_bl, bl);
+    ::encode(coll_index, bl);
+    ::encode(object_index, bl);
+    data.encode(bl);
+    ENCODE_FINISH(bl);
+  }
+  void decode(bufferlist::iterator &bl) {
+    DECODE_START(9, bl);
+    ::decode(data_bl, bl);
+    ::decode(op_bl, bl);
+    ::decode(coll_index, bl);
+    ::decode(object_index, bl);
+    data.decode(bl);
+    coll_id = coll_index.size();
+    object_id = object_index.size();
+    DECODE_FINISH(bl);
+  }
+
+  class iterator {
+    LegacyTransaction *t;
+    uint64_t ops;
+    char* op_buffer_p;
+    bufferlist::iterator data_bl_p;
+    vector<coll_t> colls;
+    vector<ghobject_t> objects;
+
+   public:
+    iterator(LegacyTransaction *t)
+      : t(t),
+        data_bl_p(t->data_bl.begin()),
+        colls(t->coll_index.size()),
+        objects(t->object_index.size()) {
+      ops = t->data.ops;
+      op_buffer_p = t->op_bl.get_contiguous(0, t->data.ops * sizeof(Op));
+      for (map<coll_t, __le32>::iterator p = t->coll_index.begin();
+           p != t->coll_index.end();
+           ++p)
+        colls[p->second] = p->first;
+      for (map<ghobject_t, __le32>::iterator p = t->object_index.begin();
+           p != t->object_index.end();
+           ++p)
+        objects[p->second] = p->first;
+    }
+
+    bool have_op() {
+      return ops > 0;
+    }
+    Op* decode_op() {
+      Op* op = reinterpret_cast<Op*>(op_buffer_p);
+      op_buffer_p += sizeof(Op);
+      ops--;
+      return op;
+    }
+    string decode_string() {
+      string s;
+      ::decode(s, data_bl_p);
+      return s;
+    }
+    void decode_bl(bufferlist& bl) {
+      ::decode(bl, data_bl_p);
+    }
+    void decode_attrset(map<string,bufferptr>& aset) {
+      ::decode(aset, data_bl_p);
+    }
+    void decode_keyset(set<string> &keys) {
+      ::decode(keys, data_bl_p);
+    }
+    ghobject_t get_oid(__le32 oid_id) {
+      return objects[oid_id];
+    }
+    coll_t get_cid(__le32 cid_id) {
+      return colls[cid_id];
+    }
+  };
+
+  iterator begin() {
+    return iterator(this);
+  }
+};
+
+template <typename T>
 class Transaction {
  private:
-  ObjectStore::Transaction t;
+  T t;
 
  public:
   struct Tick {
@@ -72,7 +269,7 @@ class Transaction {
 
   void apply_encode_decode() {
     bufferlist bl;
-    ObjectStore::Transaction d;
+    T d;
     uint64_t start_time = Cycles::rdtsc();
     t.encode(bl);
     encode_ticks.add(Cycles::rdtsc() - start_time);
@@ -85,7 +282,7 @@ class Transaction {
 
   void apply_iterate() {
     uint64_t start_time = Cycles::rdtsc();
-    ObjectStore::Transaction::iterator i = t.begin();
+    typename T::iterator i = t.begin();
     while (i.have_op()) {
     ObjectStore::Transaction::Op *op = i.decode_op();
 
@@ -130,14 +327,15 @@ class Transaction {
     iterate_ticks.add(Cycles::rdtsc() - start_time);
   }
 
-  static void dump_stat() {
+  static void dump_stat(const char *name) {
+    cerr << name << ":" << std::endl;
     cerr << " write op: " << Cycles::to_microseconds(write_ticks.ticks) << "us count: " << write_ticks.count << std::endl;
     cerr << " setattr op: " << Cycles::to_microseconds(setattr_ticks.ticks) << "us count: " << setattr_ticks.count << std::endl;
-    cerr << " omap_setkeys op: " << Cycles::to_microseconds(Transaction::omap_setkeys_ticks.ticks) << "us count: " << Transaction::omap_setkeys_ticks.count << std::endl;
-    cerr << " omap_rmkeys op: " << Cycles::to_microseconds(Transaction::omap_rmkeys_ticks.ticks) << "us count: " << Transaction::omap_rmkeys_ticks.count << std::endl;
-    cerr << " encode op: " << Cycles::to_microseconds(Transaction::encode_ticks.ticks) << "us count: " << Transaction::encode_ticks.count << std::endl;
-    cerr << " decode op: " << Cycles::to_microseconds(Transaction::decode_ticks.ticks) << "us count: " << Transaction::decode_ticks.count << std::endl;
-    cerr << " iterate op: " << Cycles::to_microseconds(Transaction::iterate_ticks.ticks) << "us count: " << Transaction::iterate_ticks.count << std::endl;
+    cerr << " omap_setkeys op: " << Cycles::to_microseconds(omap_setkeys_ticks.ticks) << "us count: " << omap_setkeys_ticks.count << std::endl;
+    cerr << " omap_rmkeys op: " << Cycles::to_microseconds(omap_rmkeys_ticks.ticks) << "us count: " << omap_rmkeys_ticks.count << std::endl;
+    cerr << " encode op: " << Cycles::to_microseconds(encode_ticks.ticks) << "us count: " << encode_ticks.count << std::endl;
+    cerr << " decode op: " << Cycles::to_microseconds(decode_ticks.ticks) << "us count: " << decode_ticks.count << std::endl;
+    cerr << " iterate op: " << Cycles::to_microseconds(iterate_ticks.ticks) << "us count: " << iterate_ticks.count << std::endl;
   }
 };
 
@@ -191,13 +389,14 @@ class PerfCase {
     data[info_info_attr] = generate_random(560, 1);
   }
 
+  template <typename T>
   uint64_t rados_write_4k(int times) {
     uint64_t ticks = 0;
     uint64_t len = Kib *4;
     for (int i = 0; i < times; i++) {
       uint64_t start_time = 0;
       {
-        Transaction t;
+        Transaction<T> t;
         ghobject_t oid = create_object();
         start_time = Cycles::rdtsc();
         t.write(cid, oid, 0, len, data["4k"]);
@@ -208,7 +407,7 @@ class PerfCase {
         ticks += Cycles::rdtsc() - start_time;
       }
       {
-        Transaction t;
+        Transaction<T> t;
         map<string, bufferlist> pglog_attrset;
         map<string, bufferlist> info_attrset;
         set<string> keys;
@@ -227,6 +426,77 @@ class PerfCase {
     }
     return ticks;
   }
+
+  /**
+   * Count heap allocations for a 4k object write as it goes through
+   * build, encode, journal entry assembly, decode and iteration.
+   */
+  template <typename T>
+  uint64_t alloc_write_4k(int times) {
+    uint64_t len = Kib *4;
+    ghobject_t oid = create_object();
+    uint64_t start = alloc_count;
+    for (int i = 0; i < times; i++) {
+      T t;
+      t.write(cid, oid, 0, len, data["4k"]);
+      t.setattr(cid, oid, attr, data[attr]);
+      t.setattr(cid, oid, snapset_attr, data[snapset_attr]);
+
+      // see JournalingObjectStore::_op_journal_transactions_prepare and
+      // FileJournal::prepare_single_write
+      bufferlist tbl;
+      t.encode(tbl);
+      bufferlist entry;
+      entry.append_zero(sizeof(uint64_t));
+      entry.claim_append(tbl, buffer::list::CLAIM_ALLOW_NONSHAREABLE);
+
+      bufferlist::iterator p = entry.begin();
+      p.advance(sizeof(uint64_t));
+      T d;
+      d.decode(p);
+      for (typename T::iterator it = d.begin(); it.have_op(); ) {
+        ObjectStore::Transaction::Op *op = it.decode_op();
+        coll_t c = it.get_cid(op->cid);
+        ghobject_t o = it.get_oid(op->oid);
+        bufferlist bl;
+        switch (op->op) {
+        case ObjectStore::Transaction::OP_WRITE:
+          it.decode_bl(bl);
+          break;
+        case ObjectStore::Transaction::OP_SETATTR:
+          it.decode_string();
+          it.decode_bl(bl);
+          break;
+        }
+      }
+    }
+    return alloc_count - start;
+  }
+
+  /// the legacy and the current encodings of the same ops must match
+  bool check_same_encoding() {
+    ghobject_t oid = create_object();
+    set<string> keys;
+    keys.insert(pglog_attr);
+    map<string, bufferlist> pglog_attrset;
+    pglog_attrset[pglog_attr] = data[pglog_attr];
+
+    ObjectStore::Transaction t;
+    LegacyTransaction l;
+    t.write(cid, oid, 0, data["4k"].length(), data["4k"]);
+    l.write(cid, oid, 0, data["4k"].length(), data["4k"]);
+    t.setattr(cid, oid, attr, data[attr]);
+    l.setattr(cid, oid, attr, data[attr]);
+    t.omap_setkeys(meta_cid, pglog_oid, pglog_attrset);
+    l.omap_setkeys(meta_cid, pglog_oid, pglog_attrset);
+    t.omap_rmkeys(meta_cid, pglog_oid, keys);
+    l.omap_rmkeys(meta_cid, pglog_oid, keys);
+
+    bufferlist tbl, lbl;
+    t.encode(tbl);
+    l.encode(lbl);
+    return tbl.contents_equal(lbl);
+  }
 };
 const string PerfCase::info_epoch_attr("11.40_epoch");
 const string PerfCase::info_info_attr("11.40_info");
@@ -237,8 +507,20 @@ const coll_t PerfCase::meta_cid;
 const coll_t PerfCase::cid;
 const ghobject_t PerfCase::pglog_oid(hobject_t(sobject_t(object_t("cid_pglog"), 0)));
 const ghobject_t PerfCase::info_oid(hobject_t(sobject_t(object_t("infos"), 0)));
-Transaction::Tick Transaction::write_ticks, Transaction::setattr_ticks, Transaction::omap_setkeys_ticks, Transaction::omap_rmkeys_ticks;
-Transaction::Tick Transaction::encode_ticks, Transaction::decode_ticks, Transaction::iterate_ticks;
+template <typename T>
+typename Transaction<T>::Tick Transaction<T>::write_ticks;
+template <typename T>
+typename Transaction<T>::Tick Transaction<T>::setattr_ticks;
+template <typename T>
+typename Transaction<T>::Tick Transaction<T>::omap_setkeys_ticks;
+template <typename T>
+typename Transaction<T>::Tick Transaction<T>::omap_rmkeys_ticks;
+template <typename T>
+typename Transaction<T>::Tick Transaction<T>::encode_ticks;
+template <typename T>
+typename Transaction<T>::Tick Transaction<T>::decode_ticks;
+template <typename T>
+typename Transaction<T>::Tick Transaction<T>::iterate_ticks;
 
 void usage(const string &name) {
   cerr << "Usage: " << name << " [times] "
@@ -262,9 +544,23 @@ int main(int argc, char **argv)
 
   uint64_t times = atoi(args[0]);
   PerfCase c;
-  uint64_t ticks = c.rados_write_4k(times);
-  Transaction::dump_stat();
+  if (!c.check_same_encoding()) {
+    cerr << "legacy transaction encodes differently, fix it" << std::endl;
+    return 1;
+  }
+
+  // the same workload through the old op carving, then the current one
+  uint64_t legacy_ticks = c.rados_write_4k<LegacyTransaction>(times);
+  Transaction<LegacyTransaction>::dump_stat("legacy");
+  cerr << " Total rados op " << times << " run time " << Cycles::to_microseconds(legacy_ticks) << "us." << std::endl;
+  uint64_t ticks = c.rados_write_4k<ObjectStore::Transaction>(times);
+  Transaction<ObjectStore::Transaction>::dump_stat("current");
   cerr << " Total rados op " << times << " run time " << Cycles::to_microseconds(ticks) << "us." << std::endl;
 
+  uint64_t legacy_allocs = c.alloc_write_4k<LegacyTransaction>(times);
+  uint64_t allocs = c.alloc_write_4k<ObjectStore::Transaction>(times);
+  cerr << " 4k write allocations per op: legacy " << (double)legacy_allocs / times
+       << " current " << (double)allocs / times << std::endl;
+
   return 0;
 }
@@ -250,6 +250,83 @@ TEST_P(StoreTest, SimpleObjectTest) {
   }
 }
 
+TEST_P(StoreTest, CompressedDataTest) {
+  int r;
+  g_ceph_context->_conf->set_val("keyvaluestore_compression", "true");
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  coll_t cid(spg_t(pg_t(0, 1), shard_id_t::NO_SHARD));
+  {
+    ObjectStore::Transaction t;
+    t.create_collection(cid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  ghobject_t hoid(hobject_t(sobject_t("Object 1", CEPH_NOSNAP)));
+  bufferlist expected;
+  {
+    // highly compressible, spanning several strips
+    for (int i = 0; i < 1000; ++i)
+      expected.append("{\"key\": \"value\"}\n");
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, 0, expected.length(), expected);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  {
+    // partial overwrite of a compressed strip
+    bufferlist bl;
+    bl.append("overwritten");
+    ObjectStore::Transaction t;
+    t.write(cid, hoid, 100, bl.length(), bl);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+
+    bufferlist head, tail;
+    expected.copy(0, 100, head);
+    expected.copy(100 + bl.length(), expected.length() - 100 - bl.length(),
+                  tail);
+    expected.clear();
+    expected.claim_append(head);
+    expected.append(bl);
+    expected.claim_append(tail);
+  }
+  {
+    bufferlist in;
+    r = store->read(cid, hoid, 0, expected.length(), in);
+    ASSERT_EQ((int)expected.length(), r);
+    ASSERT_TRUE(in.contents_equal(expected));
+  }
+  {
+    bufferlist in, exp;
+    r = store->read(cid, hoid, 90, 5000, in);
+    ASSERT_EQ(5000, r);
+    expected.copy(90, 5000, exp);
+    ASSERT_TRUE(in.contents_equal(exp));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.truncate(cid, hoid, 6000);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+
+    bufferlist in, exp;
+    r = store->read(cid, hoid, 0, 0, in);
+    ASSERT_EQ(6000, r);
+    expected.copy(0, 6000, exp);
+    ASSERT_TRUE(in.contents_equal(exp));
+  }
+  {
+    ObjectStore::Transaction t;
+    t.remove(cid, hoid);
+    t.remove_collection(cid);
+    r = store->apply_transaction(t);
+    ASSERT_EQ(r, 0);
+  }
+  g_ceph_context->_conf->set_val("keyvaluestore_compression", "false");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
+
 TEST_P(StoreTest, SimpleListTest) {
   int r;
   coll_t cid(spg_t(pg_t(0, 1), shard_id_t(1)));
@@ -1374,6 +1374,184 @@ TEST(ghobject_t, cmp) {
   ASSERT_GT(o, sep);
 }
 
+TEST(pg_log_entry_t, encode_with_checksum) {
+  pg_log_entry_t e(pg_log_entry_t::MODIFY,
+		   hobject_t(object_t("foo"), "", 1, 0x42, 3, ""),
+		   eversion_t(10, 20), eversion_t(10, 19),
+		   1, osd_reqid_t(entity_name_t::CLIENT(777), 8, 999),
+		   utime_t(8, 9));
+  e.snaps.append("snaps", 5);
+
+  // must match the encoding of the entry wrapped in a bufferlist
+  bufferlist expected, ebl;
+  e.encode(ebl);
+  __u32 crc = ebl.crc32c(0);
+  ::encode(ebl, expected);
+  ::encode(crc, expected);
+
+  bufferlist bl;
+  bl.append("prefix", 6);
+  e.encode_with_checksum(bl);
+  bufferlist got;
+  got.substr_of(bl, 6, bl.length() - 6);
+  ASSERT_TRUE(expected.contents_equal(got));
+
+  bufferlist::iterator p = bl.begin();
+  p.advance(6);
+  pg_log_entry_t d;
+  d.decode_with_checksum(p);
+  ASSERT_TRUE(p.end());
+  ASSERT_EQ(e.soid, d.soid);
+  ASSERT_EQ(e.version, d.version);
+  ASSERT_EQ(e.reqid, d.reqid);
+  ASSERT_TRUE(e.snaps.contents_equal(d.snaps));
+}
+
+// one byte per buffer, so that the checked decode is the one used
+static bufferlist fragment(bufferlist& bl)
+{
+  bufferlist out;
+  bl.rebuild();
+  for (unsigned i = 0; i < bl.length(); ++i)
+    out.append(bufferptr(bl.buffers().front(), i, 1));
+  return out;
+}
+
+TEST(pg_log_entry_t, unchecked_encoding) {
+  list<pg_log_entry_t*> o;
+  pg_log_entry_t::generate_test_instances(o);
+  for (list<pg_log_entry_t*>::iterator i = o.begin(); i != o.end(); ++i) {
+    pg_log_entry_t *e = *i;
+    bufferlist bl;
+    bl.append("prefix", 6);
+    e->encode(bl);
+    ASSERT_EQ(6 + e->encoded_size(), bl.length());
+
+    // the fast path
+    bufferlist::iterator p = bl.begin();
+    p.advance(6);
+    pg_log_entry_t fast;
+    ASSERT_TRUE(fast.decode_unchecked(p));
+    ASSERT_TRUE(p.end());
+
+    // the checked one, which must read the same layout
+    bufferlist frag = fragment(bl);
+    bufferlist::iterator q = frag.begin();
+    q.advance(6);
+    pg_log_entry_t checked;
+    ASSERT_FALSE(checked.decode_unchecked(q));
+    checked.decode(q);
+    ASSERT_TRUE(q.end());
+
+    bufferlist a, b, orig;
+    fast.encode(a);
+    checked.encode(b);
+    e->encode(orig);
+    ASSERT_TRUE(orig.contents_equal(a));
+    ASSERT_TRUE(orig.contents_equal(b));
+    ASSERT_EQ(e->reverting_to, fast.reverting_to);
+    ASSERT_EQ(e->prior_version, fast.prior_version);
+    ASSERT_EQ(e->extra_reqids, fast.extra_reqids);
+    delete e;
+  }
+}
+
+TEST(pg_log_entry_t, unchecked_decode_truncated) {
+  pg_log_entry_t e(pg_log_entry_t::MODIFY,
+		   hobject_t(object_t("foo"), "", 1, 0x42, 3, ""),
+		   eversion_t(10, 20), eversion_t(10, 19),
+		   1, osd_reqid_t(entity_name_t::CLIENT(777), 8, 999),
+		   utime_t(8, 9));
+  bufferlist bl;
+  e.encode(bl);
+  // not all of it there: left to the checked decode, which throws
+  for (unsigned len = 1; len < bl.length(); ++len) {
+    bufferlist part;
+    part.substr_of(bl, 0, len);
+    part.rebuild();
+    bufferlist::iterator p = part.begin();
+    pg_log_entry_t d;
+    ASSERT_THROW(d.decode(p), buffer::error);
+  }
+}
+
+TEST(pg_stat_t, unchecked_encoding) {
+  list<pg_stat_t*> o;
+  pg_stat_t::generate_test_instances(o);
+  for (list<pg_stat_t*>::iterator i = o.begin(); i != o.end(); ++i) {
+    pg_stat_t *s = *i;
+    bufferlist bl;
+    ::encode(*s, bl);
+    ASSERT_EQ(s->encoded_size(), bl.length());
+
+    bufferlist::iterator p = bl.begin();
+    pg_stat_t fast;
+    ASSERT_TRUE(fast.decode_unchecked(p));
+    ASSERT_TRUE(p.end());
+    ASSERT_TRUE(*s == fast);
+
+    bufferlist frag = fragment(bl);
+    bufferlist::iterator q = frag.begin();
+    pg_stat_t checked;
+    ::decode(checked, q);
+    ASSERT_TRUE(q.end());
+    ASSERT_TRUE(*s == checked);
+    delete s;
+  }
+}
+
+TEST(object_info_t, unchecked_decode) {
+  list<object_info_t*> o;
+  object_info_t::generate_test_instances(o);
+  for (list<object_info_t*>::iterator i = o.begin(); i != o.end(); ++i) {
+    object_info_t *oi = *i;
+    bufferlist bl;
+    ::encode(*oi, bl);
+    bl.rebuild();
+
+    // the fast path is for objects no one watches
+    bufferlist::iterator p = bl.begin();
+    object_info_t fast;
+    ASSERT_EQ(oi->watchers.empty(), fast.decode_unchecked(p));
+    if (oi->watchers.empty())
+      ASSERT_TRUE(p.end());
+
+    bufferlist frag = fragment(bl);
+    bufferlist::iterator q = frag.begin();
+    object_info_t checked;
+    ASSERT_FALSE(checked.decode_unchecked(q));
+    ::decode(checked, q);
+    ASSERT_TRUE(q.end());
+
+    bufferlist a, b;
+    ::encode(checked, b);
+    ASSERT_TRUE(bl.contents_equal(b));
+    if (oi->watchers.empty()) {
+      ::encode(fast, a);
+      ASSERT_TRUE(bl.contents_equal(a));
+      ASSERT_EQ(oi->soid, fast.soid);
+      ASSERT_EQ(oi->user_version, fast.user_version);
+      ASSERT_EQ(oi->flags, fast.flags);
+    }
+    delete oi;
+  }
+}
+
+TEST(object_info_t, unchecked_decode_truncated) {
+  object_info_t oi(hobject_t(object_t("foo"), "", 4, 0x42, 3, ""));
+  oi.snaps.push_back(4);
+  bufferlist bl;
+  ::encode(oi, bl);
+  for (unsigned len = 1; len < bl.length(); ++len) {
+    bufferlist part;
+    part.substr_of(bl, 0, len);
+    part.rebuild();
+    bufferlist::iterator p = part.begin();
+    object_info_t d;
+    ASSERT_THROW(::decode(d, p), buffer::error);
+  }
+}
+
 /*
  * Local Variables:
  * compile-command: "cd ../.. ;
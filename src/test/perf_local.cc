@@ -53,6 +53,7 @@
 #include "common/Thread.h"
 #include "common/Timer.h"
 #include "msg/async/Event.h"
+#include "osd/osd_types.h"
 #include "global/global_init.h"
 
 #include "test/perf_helper.h"
@@ -183,6 +184,94 @@ double buffer_basic()
   return Cycles::to_seconds(stop - start)/count;
 }
 
+// Measure the cost of allocating and freeing raw buffers of mixed sizes,
+// either through the system allocator or through the buffer pools.
+static double buffer_create_mixed(bool pool)
+{
+  int count = 1000000;
+  bool was_enabled = buffer::get_pool_enabled();
+  buffer::enable_pool(pool);
+  static const unsigned sizes[] = { 96, 512, 4096, 300, 16384, 1000, 65536 };
+  uint64_t start = Cycles::rdtsc();
+  for (int i = 0; i < count; i++) {
+    bufferptr a(buffer::create(sizes[i % 7]));
+    bufferptr b(buffer::create_page_aligned(CEPH_PAGE_SIZE));
+  }
+  uint64_t stop = Cycles::rdtsc();
+  buffer::enable_pool(was_enabled);
+  return Cycles::to_seconds(stop - start)/count;
+}
+
+double buffer_create()
+{
+  return buffer_create_mixed(false);
+}
+
+double buffer_create_pooled()
+{
+  return buffer_create_mixed(true);
+}
+
+// Messenger-style pattern: one thread allocates, another frees.
+static double buffer_cross_thread(bool pool)
+{
+  class Freer : public Thread {
+   public:
+    Mutex lock;
+    Cond cond;
+    list<bufferptr> q;
+    bool done;
+    Freer() : lock("buffer_cross_thread::lock"), done(false) {}
+    void* entry() {
+      Mutex::Locker l(lock);
+      while (!done || !q.empty()) {
+        if (q.empty()) {
+          cond.Wait(lock);
+          continue;
+        }
+        list<bufferptr> ls;
+        ls.swap(q);
+        lock.Unlock();
+        ls.clear();
+        lock.Lock();
+      }
+      return NULL;
+    }
+  } freer;
+  int count = 200000;
+  bool was_enabled = buffer::get_pool_enabled();
+  buffer::enable_pool(pool);
+  freer.create();
+  uint64_t start = Cycles::rdtsc();
+  for (int i = 0; i < count; i += 100) {
+    list<bufferptr> ls;
+    for (int j = 0; j < 100; j++)
+      ls.push_back(bufferptr(buffer::create(4096 + j)));
+    Mutex::Locker l(freer.lock);
+    freer.q.splice(freer.q.end(), ls);
+    freer.cond.Signal();
+  }
+  {
+    Mutex::Locker l(freer.lock);
+    freer.done = true;
+    freer.cond.Signal();
+  }
+  freer.join();
+  uint64_t stop = Cycles::rdtsc();
+  buffer::enable_pool(was_enabled);
+  return Cycles::to_seconds(stop - start)/count;
+}
+
+double buffer_create_cross_thread()
+{
+  return buffer_cross_thread(false);
+}
+
+double buffer_create_cross_thread_pooled()
+{
+  return buffer_cross_thread(true);
+}
+
 struct DummyBlock {
   int a, b, c, d;
   void encode(bufferlist &bl) const {
@@ -221,6 +310,69 @@ double buffer_encode_decode()
   return Cycles::to_seconds(stop - start)/count;
 }
 
+// Measure the cost of encoding a pg log entry with its checksum, the
+// way PGLog writes it out, and decoding it again.
+double pg_log_entry_encode_decode()
+{
+  int count = 1000000;
+  pg_log_entry_t e(pg_log_entry_t::MODIFY,
+                   hobject_t(object_t("rbd_data.1234.0000000000000001"), "",
+                             CEPH_NOSNAP, 0x42, 3, ""),
+                   eversion_t(10, 20), eversion_t(10, 19), 20,
+                   osd_reqid_t(entity_name_t::CLIENT(777), 8, 999),
+                   utime_t(8, 9));
+  pg_log_entry_t d;
+  uint64_t start = Cycles::rdtsc();
+  for (int i = 0; i < count; i++) {
+    bufferlist b(sizeof(e) * 2);
+    e.encode_with_checksum(b);
+    bufferlist::iterator iter = b.begin();
+    d.decode_with_checksum(iter);
+  }
+  uint64_t stop = Cycles::rdtsc();
+  return Cycles::to_seconds(stop - start)/count;
+}
+
+// Measure the cost of encoding and decoding an object_info_t.
+double object_info_encode_decode()
+{
+  int count = 1000000;
+  object_info_t oi(hobject_t(object_t("rbd_data.1234.0000000000000001"), "",
+                             CEPH_NOSNAP, 0x42, 3, ""));
+  oi.size = 4194304;
+  object_info_t d;
+  uint64_t start = Cycles::rdtsc();
+  for (int i = 0; i < count; i++) {
+    bufferlist b(sizeof(oi));
+    ::encode(oi, b);
+    bufferlist::iterator iter = b.begin();
+    ::decode(d, iter);
+  }
+  uint64_t stop = Cycles::rdtsc();
+  return Cycles::to_seconds(stop - start)/count;
+}
+
+// Measure the cost of encoding and decoding a pg_stat_t.
+double pg_stat_encode_decode()
+{
+  int count = 1000000;
+  pg_stat_t s;
+  s.up.push_back(0);
+  s.up.push_back(1);
+  s.up.push_back(2);
+  s.acting = s.up;
+  pg_stat_t d;
+  uint64_t start = Cycles::rdtsc();
+  for (int i = 0; i < count; i++) {
+    bufferlist b;
+    ::encode(s, b);
+    bufferlist::iterator iter = b.begin();
+    ::decode(d, iter);
+  }
+  uint64_t stop = Cycles::rdtsc();
+  return Cycles::to_seconds(stop - start)/count;
+}
+
 // Measure the cost of allocating and deallocating a buffer, plus
 // copying in a small block.
 double buffer_basic_copy()
@@ -908,8 +1060,22 @@ TestInfo tests[] = {
     "Mutex lock/unlock (no blocking)"},
   {"buffer_basic", buffer_basic,
     "buffer create, add one ptr, delete"},
+  {"buffer_create", buffer_create,
+    "create/free raw buffers of mixed sizes, system allocator"},
+  {"buffer_create_pooled", buffer_create_pooled,
+    "create/free raw buffers of mixed sizes, buffer pools"},
+  {"buffer_create_cross_thread", buffer_create_cross_thread,
+    "create buffers, free on another thread, system allocator"},
+  {"buffer_create_cross_thread_pooled", buffer_create_cross_thread_pooled,
+    "create buffers, free on another thread, buffer pools"},
   {"buffer_encode_decode", buffer_encode_decode,
     "buffer create, encode/decode object, delete"},
+  {"pg_log_entry_encode_decode", pg_log_entry_encode_decode,
+    "pg_log_entry_t encode/decode with checksum"},
+  {"object_info_encode_decode", object_info_encode_decode,
+    "object_info_t encode/decode"},
+  {"pg_stat_encode_decode", pg_stat_encode_decode,
+    "pg_stat_t encode/decode"},
   {"buffer_basic_copy", buffer_basic_copy,
     "buffer create, copy small block, delete"},
   {"buffer_copy", buffer_copy,
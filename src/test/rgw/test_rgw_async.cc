@@ -0,0 +1,411 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <iostream>
+#include <list>
+#include <vector>
+
+#include "rgw/rgw_async.h"
+#include "common/ceph_argparse.h"
+#include "common/Clock.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include "gtest/gtest.h"
+
+using namespace std;
+
+/*
+ * Handles the requests with a few threads: a PUT answers with the size
+ * of the body it got, a GET of /size/<n> with n bytes.
+ */
+class TestWorkers : public RGWAsyncDispatcher {
+  class Worker : public Thread {
+    TestWorkers *workers;
+  public:
+    Worker(TestWorkers *w) : workers(w) {}
+    void *entry() {
+      workers->work();
+      return NULL;
+    }
+  };
+
+  Mutex lock;
+  Cond cond;
+  list<RGWAsyncConn *> queue;
+  vector<Worker *> threads;
+  size_t max_queued;
+  bool going_down;
+
+  void handle(RGWAsyncConn *conn) {
+    RGWAsyncIO io(conn, 80);
+    io.init(g_ceph_context);
+    RGWEnv& env = io.get_env();
+    string method = env.get("REQUEST_METHOD");
+    string uri = env.get("REQUEST_URI");
+
+    uint64_t received = 0;
+    char buf[16384];
+    int len;
+    while (io.read(buf, sizeof(buf), &len) == 0 && len > 0) {
+      received += len;
+    }
+
+    string body;
+    if (method == "GET" && uri.compare(0, 6, "/size/") == 0) {
+      body.assign(atoi(uri.c_str() + 6), 'x');
+    } else {
+      char n[32];
+      snprintf(n, sizeof(n), "%llu", (unsigned long long)received);
+      body = n;
+    }
+
+    io.send_status("200", "OK");
+    io.send_content_length(body.size());
+    io.complete_header();
+    for (size_t ofs = 0; ofs < body.size(); ofs += sizeof(buf)) {
+      size_t n = MIN(body.size() - ofs, sizeof(buf));
+      if (io.write(body.data() + ofs, n) < 0)
+	break;
+    }
+    io.complete_request();
+    conn->finish();
+  }
+
+public:
+  TestWorkers(int num_threads, size_t _max_queued)
+    : lock("TestWorkers"), max_queued(_max_queued), going_down(false) {
+    for (int i = 0; i < num_threads; i++) {
+      Worker *w = new Worker(this);
+      w->create();
+      threads.push_back(w);
+    }
+  }
+
+  ~TestWorkers() {
+    lock.Lock();
+    going_down = true;
+    cond.Signal();
+    lock.Unlock();
+    for (size_t i = 0; i < threads.size(); i++) {
+      threads[i]->join();
+      delete threads[i];
+    }
+  }
+
+  bool dispatch(RGWAsyncConn *conn) {
+    Mutex::Locker l(lock);
+    if (queue.size() >= max_queued)
+      return false;
+    conn->get();
+    queue.push_back(conn);
+    cond.Signal();
+    return true;
+  }
+
+  void work() {
+    lock.Lock();
+    for (;;) {
+      while (queue.empty() && !going_down)
+	cond.Wait(lock);
+      if (queue.empty())
+	break;
+      RGWAsyncConn *conn = queue.front();
+      queue.pop_front();
+      lock.Unlock();
+      handle(conn);
+      conn->put();
+      lock.Lock();
+    }
+    lock.Unlock();
+  }
+};
+
+static int connect_to(int port)
+{
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (::connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    ::close(fd);
+    return -errno;
+  }
+  return fd;
+}
+
+static bool send_all(int fd, const string& s)
+{
+  size_t ofs = 0;
+  while (ofs < s.size()) {
+    ssize_t r = ::send(fd, s.data() + ofs, s.size() - ofs, MSG_NOSIGNAL);
+    if (r <= 0)
+      return false;
+    ofs += r;
+  }
+  return true;
+}
+
+/* read a response, leaving what comes after it in pending */
+static int read_response(int fd, string& pending, string *body, useconds_t delay = 0)
+{
+  size_t end;
+  while ((end = pending.find("\r\n\r\n")) == string::npos) {
+    char buf[4096];
+    ssize_t r = ::recv(fd, buf, sizeof(buf), 0);
+    if (r <= 0)
+      return -EIO;
+    pending.append(buf, r);
+  }
+  string header = pending.substr(0, end);
+  pending.erase(0, end + 4);
+
+  int status = atoi(header.c_str() + header.find(' ') + 1);
+  size_t cl = header.find("Content-Length: ");
+  size_t len = (cl == string::npos ? 0 : atoll(header.c_str() + cl + 16));
+  while (pending.size() < len) {
+    char buf[65536];
+    ssize_t r = ::recv(fd, buf, sizeof(buf), 0);
+    if (r <= 0)
+      return -EIO;
+    pending.append(buf, r);
+    if (delay)
+      usleep(delay);
+  }
+  *body = pending.substr(0, len);
+  pending.erase(0, len);
+  return status;
+}
+
+static string put_request(size_t len)
+{
+  char buf[128];
+  snprintf(buf, sizeof(buf), "PUT /bucket/obj HTTP/1.1\r\nContent-Length: %llu\r\n\r\n",
+	   (unsigned long long)len);
+  return string(buf) + string(len, 'y');
+}
+
+class AsyncServerTest : public ::testing::Test {
+protected:
+  TestWorkers *workers;
+  RGWAsyncServer *server;
+  int port;
+
+  void start(int num_threads, size_t max_queued, uint64_t buffer_size) {
+    workers = new TestWorkers(num_threads, max_queued);
+    server = new RGWAsyncServer(g_ceph_context, workers, 2, buffer_size);
+    ASSERT_EQ(0, server->bind("127.0.0.1", 0));
+    ASSERT_EQ(0, server->start());
+    port = server->get_port();
+  }
+
+  void SetUp() {
+    workers = NULL;
+    server = NULL;
+  }
+
+  void TearDown() {
+    if (server)
+      server->stop();
+    delete workers;
+    delete server;
+  }
+};
+
+TEST_F(AsyncServerTest, keepalive)
+{
+  start(2, 100, 65536);
+  int fd = connect_to(port);
+  ASSERT_GE(fd, 0);
+
+  string pending, body;
+  for (int i = 0; i < 3; i++) {
+    ASSERT_TRUE(send_all(fd, "GET /size/10 HTTP/1.1\r\nHost: x\r\n\r\n"));
+    ASSERT_EQ(200, read_response(fd, pending, &body));
+    ASSERT_EQ(string(10, 'x'), body);
+  }
+
+  /* pipelined */
+  ASSERT_TRUE(send_all(fd, "GET /size/1 HTTP/1.1\r\n\r\n" + put_request(5)));
+  ASSERT_EQ(200, read_response(fd, pending, &body));
+  ASSERT_EQ("x", body);
+  ASSERT_EQ(200, read_response(fd, pending, &body));
+  ASSERT_EQ("5", body);
+
+  ::close(fd);
+}
+
+TEST_F(AsyncServerTest, bodies)
+{
+  /* bodies much larger than the buffers */
+  start(2, 100, 65536);
+  int fd = connect_to(port);
+  ASSERT_GE(fd, 0);
+  string pending, body;
+
+  ASSERT_TRUE(send_all(fd, put_request(5 << 20)));
+  ASSERT_EQ(200, read_response(fd, pending, &body));
+  ASSERT_EQ("5242880", body);
+
+  ASSERT_TRUE(send_all(fd, "PUT /bucket/obj HTTP/1.1\r\nContent-Length: 3\r\n"
+		       "Expect: 100-continue\r\n\r\n"));
+  ASSERT_EQ(100, read_response(fd, pending, &body));
+  ASSERT_TRUE(send_all(fd, "abc"));
+  ASSERT_EQ(200, read_response(fd, pending, &body));
+  ASSERT_EQ("3", body);
+
+  ASSERT_TRUE(send_all(fd, "PUT /bucket/obj HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+		       "5\r\nhello\r\n10;ext=1\r\n0123456789abcdef\r\n"));
+  ASSERT_TRUE(send_all(fd, "0\r\n\r\n"));
+  ASSERT_EQ(200, read_response(fd, pending, &body));
+  ASSERT_EQ("21", body);
+
+  /* read slowly */
+  ASSERT_TRUE(send_all(fd, "GET /size/3000000 HTTP/1.1\r\n\r\n"));
+  ASSERT_EQ(200, read_response(fd, pending, &body, 100));
+  ASSERT_EQ(3000000u, body.size());
+
+  ::close(fd);
+}
+
+TEST_F(AsyncServerTest, bad_request)
+{
+  start(1, 100, 65536);
+  int fd = connect_to(port);
+  ASSERT_GE(fd, 0);
+  ASSERT_TRUE(send_all(fd, "GARBAGE\r\n\r\n"));
+  char c;
+  ASSERT_EQ(0, ::recv(fd, &c, 1, 0));
+  ::close(fd);
+}
+
+TEST_F(AsyncServerTest, waiting)
+{
+  /* more requests at once than the workers take */
+  start(1, 1, 65536);
+  vector<int> fds;
+  for (int i = 0; i < 20; i++) {
+    int fd = connect_to(port);
+    ASSERT_GE(fd, 0);
+    ASSERT_TRUE(send_all(fd, "GET /size/100 HTTP/1.0\r\n\r\n"));
+    fds.push_back(fd);
+  }
+  for (size_t i = 0; i < fds.size(); i++) {
+    string pending, body;
+    ASSERT_EQ(200, read_response(fds[i], pending, &body));
+    ASSERT_EQ(100u, body.size());
+    /* HTTP/1.0 without keep-alive */
+    char c;
+    ASSERT_EQ(0, ::recv(fds[i], &c, 1, 0));
+    ::close(fds[i]);
+  }
+}
+
+class Client : public Thread {
+  int port;
+  int num_reqs;
+public:
+  int done;
+  Client(int _port, int _num_reqs) : port(_port), num_reqs(_num_reqs), done(0) {}
+  void *entry() {
+    int fd = connect_to(port);
+    if (fd < 0)
+      return NULL;
+    string pending, body;
+    for (int i = 0; i < num_reqs; i++) {
+      if (!send_all(fd, put_request(4096)) ||
+	  read_response(fd, pending, &body) != 200)
+	break;
+      done++;
+    }
+    ::close(fd);
+    return NULL;
+  }
+};
+
+/*
+ * Many slow clients that have not sent a whole request yet, and a few that
+ * are busy: with a thread per connection each slow client would hold a
+ * thread, here they hold a buffer.
+ */
+TEST_F(AsyncServerTest, bench)
+{
+  const int num_workers = 4;
+  const int num_clients = 16;
+  const int num_reqs = 1000;
+
+  /* both ends of a connection are in this process */
+  struct rlimit rl;
+  getrlimit(RLIMIT_NOFILE, &rl);
+  int num_idle = MIN(5000, ((int)rl.rlim_cur - 200) / 2);
+
+  start(num_workers, num_workers * 2, 65536);
+
+  vector<int> idle;
+  for (int i = 0; i < num_idle; i++) {
+    int fd = connect_to(port);
+    if (fd < 0)
+      break;
+    send_all(fd, "PUT /bucket/slow HTTP/1.1\r\nContent-Le");
+    idle.push_back(fd);
+  }
+
+  utime_t start_time = ceph_clock_now(g_ceph_context);
+  vector<Client *> clients;
+  for (int i = 0; i < num_clients; i++) {
+    Client *c = new Client(port, num_reqs);
+    c->create();
+    clients.push_back(c);
+  }
+  int done = 0;
+  for (int i = 0; i < num_clients; i++) {
+    clients[i]->join();
+    done += clients[i]->done;
+    delete clients[i];
+  }
+  utime_t elapsed = ceph_clock_now(g_ceph_context);
+  elapsed -= start_time;
+  ASSERT_EQ(num_clients * num_reqs, done);
+
+  std::cout << idle.size() << " slow connections, " << num_workers << " workers, "
+	    << num_clients << " clients: " << done << " PUTs of 4k in " << elapsed
+	    << "s, " << (uint64_t)(done / (double)elapsed) << " req/s" << std::endl;
+
+  for (size_t i = 0; i < idle.size(); i++) {
+    ::close(idle[i]);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+// Local Variables:
+// compile-command: "cd ../.. ; make unittest_rgw_async && ./unittest_rgw_async"
+// End:
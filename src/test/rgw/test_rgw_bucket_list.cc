@@ -0,0 +1,307 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <iostream>
+#include <map>
+#include <set>
+#include <vector>
+#include <unistd.h>
+
+#include "rgw/rgw_bucket_list.h"
+#include "common/ceph_argparse.h"
+#include "include/ceph_hash.h"
+#include "common/Clock.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include "gtest/gtest.h"
+
+using namespace std;
+
+/*
+ * Shards of a bucket index in memory.  A listing completes latency_us
+ * after it was started, so that a fetch in the background overlaps with
+ * what the caller does in the meantime.
+ */
+class FakeShards : public RGWBucketListSource {
+  struct Fetch {
+    cls_rgw_obj_key marker;
+    uint32_t max;
+    utime_t ready;
+  };
+  map<int, Fetch> pending;
+
+public:
+  map<int, map<string, rgw_bucket_dir_entry> > shards;
+  set<string> hidden;    ///< looked at but not listed, like an invisible entry
+  bool send_marker;      ///< whether the result says how far the listing got
+  uint64_t latency_us;
+  uint64_t listed;
+
+  FakeShards(int n) : send_marker(true), latency_us(0), listed(0) {
+    for (int i = 0; i < n; i++)
+      shards[i];
+  }
+
+  void add(const string& key) {
+    uint32_t h = ceph_str_hash_linux(key.c_str(), key.size());
+    rgw_bucket_dir_entry& e = shards[h % shards.size()][key];
+    e.key.name = key;
+    e.exists = true;
+  }
+
+  set<int> shard_ids() {
+    set<int> ids;
+    for (map<int, map<string, rgw_bucket_dir_entry> >::iterator p = shards.begin();
+	 p != shards.end(); ++p)
+      ids.insert(p->first);
+    return ids;
+  }
+
+  int aio_list(int shard_id, const cls_rgw_obj_key& marker, uint32_t max) {
+    EXPECT_EQ(0u, pending.count(shard_id));
+    Fetch& f = pending[shard_id];
+    f.marker = marker;
+    f.max = max;
+    f.ready = ceph_clock_now(g_ceph_context);
+    f.ready += (double)latency_us / 1000000;
+    return 0;
+  }
+
+  int wait_list(int shard_id, rgw_cls_list_ret *result) {
+    EXPECT_EQ(1u, pending.count(shard_id));
+    Fetch f = pending[shard_id];
+    pending.erase(shard_id);
+
+    utime_t now = ceph_clock_now(g_ceph_context);
+    if (now < f.ready) {
+      utime_t left = f.ready;
+      left -= now;
+      usleep(left.to_nsec() / 1000);
+    }
+
+    map<string, rgw_bucket_dir_entry>& m = shards[shard_id];
+    map<string, rgw_bucket_dir_entry>::iterator p = m.upper_bound(f.marker.name);
+    for (uint32_t i = 0; i < f.max && p != m.end(); i++, ++p) {
+      if (send_marker)
+	result->marker = p->first;
+      if (hidden.count(p->first))
+	continue;
+      result->dir.m[p->first] = p->second;
+      listed++;
+    }
+    result->is_truncated = (p != m.end());
+    return 0;
+  }
+};
+
+static string key_name(int i)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "obj%08d", i);
+  return buf;
+}
+
+/// list everything, max entries per seek(), as cls_bucket_list() does
+static vector<string> list_all(RGWBucketListMerger& merger, uint32_t max)
+{
+  vector<string> keys;
+  cls_rgw_obj_key marker;
+  bool truncated = true;
+  while (truncated) {
+    EXPECT_EQ(0, merger.seek(marker, max));
+    string key;
+    rgw_bucket_dir_entry entry;
+    int shard_id;
+    for (uint32_t i = 0; i < max && merger.next(&key, &entry, &shard_id) == 0; i++) {
+      EXPECT_EQ(key, entry.key.name);
+      keys.push_back(key);
+      marker = cls_rgw_obj_key(key);
+    }
+    truncated = merger.is_truncated();
+  }
+  return keys;
+}
+
+TEST(BucketListMerger, merge)
+{
+  FakeShards shards(16);
+  for (int i = 0; i < 5000; i++)
+    shards.add(key_name(i));
+  RGWBucketListMerger merger(&shards, shards.shard_ids());
+
+  vector<string> keys = list_all(merger, 100);
+  ASSERT_EQ(5000u, keys.size());
+  for (int i = 0; i < 5000; i++)
+    ASSERT_EQ(key_name(i), keys[i]);
+  // every entry is fetched once
+  ASSERT_EQ(5000u, merger.get_entries_fetched());
+}
+
+TEST(BucketListMerger, one_shard)
+{
+  FakeShards shards(1);
+  for (int i = 0; i < 1000; i++)
+    shards.add(key_name(i));
+  RGWBucketListMerger merger(&shards, shards.shard_ids());
+
+  vector<string> keys = list_all(merger, 7);
+  ASSERT_EQ(1000u, keys.size());
+  ASSERT_EQ(key_name(999), keys.back());
+}
+
+TEST(BucketListMerger, empty)
+{
+  FakeShards shards(8);
+  RGWBucketListMerger merger(&shards, shards.shard_ids());
+  ASSERT_EQ(0, merger.seek(cls_rgw_obj_key(), 1000));
+  string key;
+  rgw_bucket_dir_entry entry;
+  int shard_id;
+  ASSERT_EQ(-ENOENT, merger.next(&key, &entry, &shard_id));
+  ASSERT_FALSE(merger.is_truncated());
+}
+
+TEST(BucketListMerger, skip_and_back)
+{
+  FakeShards shards(8);
+  for (int i = 0; i < 2000; i++)
+    shards.add(key_name(i));
+  RGWBucketListMerger merger(&shards, shards.shard_ids());
+
+  string key;
+  rgw_bucket_dir_entry entry;
+  int shard_id;
+  ASSERT_EQ(0, merger.seek(cls_rgw_obj_key(), 10));
+  for (int i = 0; i < 10; i++) {
+    ASSERT_EQ(0, merger.next(&key, &entry, &shard_id));
+    ASSERT_EQ(key_name(i), key);
+  }
+
+  // forward, the way a listing skips over a common prefix
+  ASSERT_EQ(0, merger.seek(cls_rgw_obj_key(key_name(1500)), 10));
+  ASSERT_EQ(0, merger.next(&key, &entry, &shard_id));
+  ASSERT_EQ(key_name(1501), key);
+
+  // and back
+  ASSERT_EQ(0, merger.seek(cls_rgw_obj_key(key_name(100)), 10));
+  ASSERT_EQ(0, merger.next(&key, &entry, &shard_id));
+  ASSERT_EQ(key_name(101), key);
+
+  // an instance marker starts over from there as well
+  ASSERT_EQ(0, merger.seek(cls_rgw_obj_key(key_name(200), "inst"), 10));
+  ASSERT_EQ(0, merger.next(&key, &entry, &shard_id));
+  ASSERT_EQ(key_name(201), key);
+}
+
+TEST(BucketListMerger, hidden)
+{
+  FakeShards shards(4);
+  for (int i = 0; i < 1000; i++) {
+    shards.add(key_name(i));
+    if (i >= 100 && i < 900)
+      shards.hidden.insert(key_name(i));
+  }
+
+  RGWBucketListMerger merger(&shards, shards.shard_ids());
+  vector<string> keys = list_all(merger, 10);
+  ASSERT_EQ(200u, keys.size());
+  ASSERT_EQ(key_name(99), keys[99]);
+  ASSERT_EQ(key_name(900), keys[100]);
+
+  // without the marker in the result, it looks further each time
+  shards.send_marker = false;
+  RGWBucketListMerger legacy(&shards, shards.shard_ids());
+  keys = list_all(legacy, 10);
+  ASSERT_EQ(200u, keys.size());
+  ASSERT_EQ(key_name(900), keys[100]);
+}
+
+/// what cls_bucket_list() used to do: num_entries from every shard, per page
+static uint64_t list_all_old(FakeShards& shards, uint32_t max, uint64_t *pages)
+{
+  uint64_t fetched = 0;
+  string marker;
+  bool truncated = true;
+  *pages = 0;
+  while (truncated) {
+    map<int, rgw_cls_list_ret> results;
+    for (map<int, map<string, rgw_bucket_dir_entry> >::iterator p = shards.shards.begin();
+	 p != shards.shards.end(); ++p)
+      shards.aio_list(p->first, cls_rgw_obj_key(marker), max);
+    truncated = false;
+    map<string, rgw_bucket_dir_entry> merged;
+    for (map<int, map<string, rgw_bucket_dir_entry> >::iterator p = shards.shards.begin();
+	 p != shards.shards.end(); ++p) {
+      rgw_cls_list_ret& r = results[p->first];
+      shards.wait_list(p->first, &r);
+      fetched += r.dir.m.size();
+      merged.insert(r.dir.m.begin(), r.dir.m.end());
+      truncated = truncated || r.is_truncated;
+    }
+    map<string, rgw_bucket_dir_entry>::iterator q = merged.begin();
+    for (uint32_t i = 0; i < max && q != merged.end(); i++, ++q)
+      marker = q->first;
+    truncated = truncated || q != merged.end();
+    (*pages)++;
+  }
+  return fetched;
+}
+
+TEST(BucketListMerger, bench)
+{
+  const int num_shards = 32;
+  const int num_keys = 50000;
+  const uint32_t page = 1000;
+
+  FakeShards shards(num_shards);
+  for (int i = 0; i < num_keys; i++)
+    shards.add(key_name(i));
+  shards.latency_us = 200;
+
+  utime_t start = ceph_clock_now(g_ceph_context);
+  uint64_t pages;
+  uint64_t old_fetched = list_all_old(shards, page, &pages);
+  utime_t old_time = ceph_clock_now(g_ceph_context);
+  old_time -= start;
+
+  start = ceph_clock_now(g_ceph_context);
+  RGWBucketListMerger merger(&shards, shards.shard_ids());
+  vector<string> keys = list_all(merger, page);
+  utime_t new_time = ceph_clock_now(g_ceph_context);
+  new_time -= start;
+  ASSERT_EQ((size_t)num_keys, keys.size());
+
+  std::cout << num_keys << " entries, " << num_shards << " shards, pages of "
+	    << page << " (" << pages << " pages)" << std::endl;
+  std::cout << "  every shard per page: " << old_fetched << " entries fetched in "
+	    << old_time << "s" << std::endl;
+  std::cout << "  merge:                " << merger.get_entries_fetched()
+	    << " entries fetched in " << merger.get_fetches() << " requests, "
+	    << new_time << "s" << std::endl;
+  ASSERT_LT(merger.get_entries_fetched() * 8, old_fetched);
+}
+
+int main(int argc, char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+// Local Variables:
+// compile-command: "cd ../.. ; make unittest_rgw_bucket_list && ./unittest_rgw_bucket_list"
+// End:
@@ -0,0 +1,297 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <iostream>
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "rgw/rgw_cache.h"
+#include "common/ceph_argparse.h"
+#include "common/Clock.h"
+#include "common/Mutex.h"
+#include "common/Thread.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include "gtest/gtest.h"
+
+using namespace std;
+
+static void setup(ObjectCache& cache, int lru_size, int shards)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%d", lru_size);
+  g_ceph_context->_conf->set_val("rgw_cache_lru_size", buf);
+  snprintf(buf, sizeof(buf), "%d", shards);
+  g_ceph_context->_conf->set_val("rgw_cache_shards", buf);
+  g_ceph_context->_conf->apply_changes(NULL);
+
+  cache.set_ctx(g_ceph_context);
+  cache.set_enabled(true);
+}
+
+static string obj_name(int i)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "bucket+obj%08d", i);
+  return buf;
+}
+
+static void put(ObjectCache& cache, const string& name, rgw_cache_entry_info *cache_info = NULL)
+{
+  ObjectCacheInfo info;
+  info.flags = CACHE_FLAG_DATA;
+  info.data.append(name);
+  string n = name;
+  cache.put(n, info, cache_info);
+}
+
+static bool cached(ObjectCache& cache, const string& name)
+{
+  ObjectCacheInfo info;
+  string n = name;
+  return cache.get(n, info, CACHE_FLAG_DATA, NULL) == 0;
+}
+
+class FakeChainedCache : public RGWChainedCache {
+public:
+  set<string> entries;
+  int invalidated_all;
+
+  FakeChainedCache() : invalidated_all(0) {}
+
+  void chain_cb(const string& key, void *data) {
+    entries.insert(key);
+  }
+  void invalidate(const string& key) {
+    entries.erase(key);
+  }
+  void invalidate_all() {
+    entries.clear();
+    invalidated_all++;
+  }
+};
+
+TEST(ObjectCache, get_put)
+{
+  ObjectCache cache;
+  setup(cache, 100, 4);
+
+  string name = obj_name(1);
+  ObjectCacheInfo info;
+  ASSERT_EQ(-ENOENT, cache.get(name, info, CACHE_FLAG_DATA, NULL));
+
+  put(cache, name);
+  ASSERT_EQ(0, cache.get(name, info, CACHE_FLAG_DATA, NULL));
+  ASSERT_EQ(name.size(), info.data.length());
+  /* it was not cached with the xattrs */
+  ASSERT_EQ(-ENOENT, cache.get(name, info, CACHE_FLAG_DATA | CACHE_FLAG_XATTRS, NULL));
+
+  cache.remove(name);
+  ASSERT_EQ(-ENOENT, cache.get(name, info, CACHE_FLAG_DATA, NULL));
+
+  put(cache, name);
+  cache.set_enabled(false);
+  ASSERT_FALSE(cached(cache, name));
+  put(cache, name);
+  ASSERT_FALSE(cached(cache, name));
+}
+
+TEST(ObjectCache, bounded)
+{
+  ObjectCache cache;
+  setup(cache, 64, 4);
+
+  string hot = obj_name(0);
+  put(cache, hot);
+  for (int i = 1; i < 1000; i++) {
+    put(cache, obj_name(i));
+    /* read again and again, it stays */
+    ASSERT_TRUE(cached(cache, hot));
+  }
+
+  int n = 0;
+  for (int i = 0; i < 1000; i++) {
+    if (cached(cache, obj_name(i)))
+      n++;
+  }
+  ASSERT_LE(n, 64);
+  ASSERT_GT(n, 0);
+}
+
+TEST(ObjectCache, chained)
+{
+  ObjectCache cache;
+  setup(cache, 16, 2);
+  FakeChainedCache chained;
+  cache.chain_cache(&chained);
+
+  /* an entry made of two objects, likely in different shards */
+  rgw_cache_entry_info info_a, info_b;
+  put(cache, obj_name(1), &info_a);
+  put(cache, obj_name(2), &info_b);
+  list<rgw_cache_entry_info *> infos;
+  infos.push_back(&info_a);
+  infos.push_back(&info_b);
+
+  string key = "user";
+  RGWChainedCache::Entry entry(&chained, key, NULL);
+  ASSERT_TRUE(cache.chain_cache_entry(infos, &entry));
+  ASSERT_EQ(1u, chained.entries.count(key));
+
+  /* either of them changing drops it */
+  put(cache, obj_name(2));
+  ASSERT_EQ(0u, chained.entries.count(key));
+  /* and it can't be chained to the old generation any more */
+  ASSERT_FALSE(cache.chain_cache_entry(infos, &entry));
+
+  put(cache, obj_name(1), &info_a);
+  put(cache, obj_name(2), &info_b);
+  ASSERT_TRUE(cache.chain_cache_entry(infos, &entry));
+  ASSERT_EQ(1u, chained.entries.count(key));
+
+  /* so does either of them going out of the cache */
+  for (int i = 3; i < 100; i++)
+    put(cache, obj_name(i));
+  ASSERT_EQ(0u, chained.entries.count(key));
+
+  cache.invalidate_all();
+  ASSERT_EQ(1, chained.invalidated_all);
+}
+
+/*
+ * What the cache was before it was sharded: one lock for all of it, and
+ * the LRU list moved around under it on a hit.
+ */
+class OneLockCache {
+  struct Entry {
+    ObjectCacheInfo info;
+    list<string>::iterator lru_iter;
+  };
+  Mutex lock;
+  map<string, Entry> cache_map;
+  list<string> lru;
+
+public:
+  OneLockCache() : lock("OneLockCache") {}
+
+  void put(const string& name, ObjectCacheInfo& info) {
+    Mutex::Locker l(lock);
+    Entry& e = cache_map[name];
+    e.info = info;
+    e.lru_iter = lru.insert(lru.end(), name);
+  }
+
+  int get(const string& name, ObjectCacheInfo& info) {
+    Mutex::Locker l(lock);
+    map<string, Entry>::iterator iter = cache_map.find(name);
+    if (iter == cache_map.end())
+      return -ENOENT;
+    lru.splice(lru.end(), lru, iter->second.lru_iter);
+    info = iter->second.info;
+    return 0;
+  }
+};
+
+class CacheReader : public Thread {
+  ObjectCache *cache;
+  OneLockCache *one_lock;
+  int num_objs;
+  int num_ops;
+  int seed;
+
+public:
+  int hits;
+
+  CacheReader(ObjectCache *_cache, OneLockCache *_one_lock, int _num_objs, int _num_ops, int _seed)
+    : cache(_cache), one_lock(_one_lock), num_objs(_num_objs), num_ops(_num_ops),
+      seed(_seed), hits(0) {}
+
+  void *entry() {
+    unsigned int r = seed;
+    for (int i = 0; i < num_ops; i++) {
+      string name = obj_name(rand_r(&r) % num_objs);
+      ObjectCacheInfo info;
+      int ret;
+      if (cache)
+	ret = cache->get(name, info, CACHE_FLAG_DATA, NULL);
+      else
+	ret = one_lock->get(name, info);
+      if (ret == 0)
+	hits++;
+    }
+    return NULL;
+  }
+};
+
+static double run_readers(ObjectCache *cache, OneLockCache *one_lock,
+			  int num_threads, int num_objs, int num_ops)
+{
+  vector<CacheReader *> readers;
+  utime_t start = ceph_clock_now(g_ceph_context);
+  for (int i = 0; i < num_threads; i++) {
+    CacheReader *reader = new CacheReader(cache, one_lock, num_objs, num_ops, i);
+    reader->create();
+    readers.push_back(reader);
+  }
+  for (int i = 0; i < num_threads; i++) {
+    readers[i]->join();
+    EXPECT_EQ(num_ops, readers[i]->hits);
+    delete readers[i];
+  }
+  utime_t elapsed = ceph_clock_now(g_ceph_context);
+  elapsed -= start;
+  return (double)num_threads * num_ops / (double)elapsed;
+}
+
+TEST(ObjectCache, bench)
+{
+  const int num_objs = 5000;
+  const int num_ops = 200000;
+
+  ObjectCache cache;
+  setup(cache, num_objs * 2, 16);
+  OneLockCache one_lock;
+  for (int i = 0; i < num_objs; i++) {
+    string name = obj_name(i);
+    ObjectCacheInfo info;
+    info.flags = CACHE_FLAG_DATA;
+    info.data.append(name);
+    one_lock.put(name, info);
+    put(cache, name);
+  }
+
+  std::cout << num_objs << " objects cached, " << num_ops << " hits per thread" << std::endl;
+  for (int threads = 1; threads <= 16; threads *= 2) {
+    double one_lock_rate = run_readers(NULL, &one_lock, threads, num_objs, num_ops);
+    double sharded_rate = run_readers(&cache, NULL, threads, num_objs, num_ops);
+    std::cout << "  " << threads << " threads: one lock " << (uint64_t)one_lock_rate
+	      << " ops/s, sharded " << (uint64_t)sharded_rate << " ops/s" << std::endl;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+// Local Variables:
+// compile-command: "cd ../.. ; make unittest_rgw_cache && ./unittest_rgw_cache"
+// End:
@@ -0,0 +1,170 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <iostream>
+
+#include "rgw/rgw_data_cache.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include "gtest/gtest.h"
+
+using namespace std;
+
+static bufferlist chunk(char c, int len)
+{
+  bufferlist bl;
+  bl.append(string(len, c));
+  return bl;
+}
+
+static int count_files(const string& path)
+{
+  DIR *dir = opendir(path.c_str());
+  if (!dir)
+    return -1;
+  int n = 0;
+  struct dirent *de;
+  while ((de = readdir(dir)) != NULL) {
+    if (de->d_name[0] != '.')
+      n++;
+  }
+  closedir(dir);
+  return n;
+}
+
+/* RAM for 100 bytes, files for 250 more */
+static string setup(bool with_files)
+{
+  g_ceph_context->_conf->set_val("rgw_data_cache_size", "100");
+  g_ceph_context->_conf->set_val("rgw_data_cache_path_size", "250");
+  string path;
+  if (with_files) {
+    char tmpl[] = "/tmp/rgw_data_cache.XXXXXX";
+    path = mkdtemp(tmpl);
+  }
+  g_ceph_context->_conf->set_val("rgw_data_cache_path", path);
+  g_ceph_context->_conf->apply_changes(NULL);
+  return path;
+}
+
+TEST(DataCache, get_put)
+{
+  setup(false);
+  RGWDataCache cache(g_ceph_context);
+  ASSERT_EQ(0, cache.init());
+
+  bufferlist bl = chunk('a', 40);
+  cache.put("obj", "tag1", 0, bl);
+
+  bufferlist out;
+  ASSERT_TRUE(cache.get("obj", "tag1", 0, 40, &out));
+  ASSERT_TRUE(out.contents_equal(bl));
+  /* less than the chunk has, from its start */
+  ASSERT_TRUE(cache.get("obj", "tag1", 0, 10, &out));
+  ASSERT_EQ(10u, out.length());
+  ASSERT_FALSE(cache.get("obj", "tag1", 0, 41, &out));
+  ASSERT_FALSE(cache.get("obj", "tag1", 10, 10, &out));
+
+  ASSERT_TRUE(cache.invalidate("obj"));
+  ASSERT_FALSE(cache.get("obj", "tag1", 0, 40, &out));
+  ASSERT_FALSE(cache.invalidate("obj"));
+}
+
+TEST(DataCache, rewritten)
+{
+  setup(false);
+  RGWDataCache cache(g_ceph_context);
+  ASSERT_EQ(0, cache.init());
+
+  bufferlist bl = chunk('a', 40);
+  cache.put("obj", "tag1", 0, bl);
+
+  /* read with the tag of a newer write: the older data goes */
+  bufferlist out;
+  ASSERT_FALSE(cache.get("obj", "tag2", 0, 40, &out));
+  ASSERT_FALSE(cache.get("obj", "tag1", 0, 40, &out));
+}
+
+TEST(DataCache, ram_only)
+{
+  setup(false);
+  RGWDataCache cache(g_ceph_context);
+  ASSERT_EQ(0, cache.init());
+
+  for (int i = 0; i < 5; i++) {
+    bufferlist bl = chunk('0' + i, 40);
+    cache.put("obj", "tag", i * 40, bl);
+  }
+
+  /* the least recently used ones are gone */
+  bufferlist out;
+  ASSERT_FALSE(cache.get("obj", "tag", 0, 40, &out));
+  ASSERT_FALSE(cache.get("obj", "tag", 40, 40, &out));
+  ASSERT_FALSE(cache.get("obj", "tag", 80, 40, &out));
+  ASSERT_TRUE(cache.get("obj", "tag", 120, 40, &out));
+  ASSERT_TRUE(cache.get("obj", "tag", 160, 40, &out));
+}
+
+TEST(DataCache, files)
+{
+  string path = setup(true);
+  {
+    RGWDataCache cache(g_ceph_context);
+    ASSERT_EQ(0, cache.init());
+
+    for (int i = 0; i < 5; i++) {
+      bufferlist bl = chunk('0' + i, 40);
+      cache.put("obj", "tag", i * 40, bl);
+    }
+    /* pushed out of RAM, to files */
+    ASSERT_EQ(3, count_files(path));
+
+    for (int i = 0; i < 5; i++) {
+      bufferlist out;
+      bufferlist expected = chunk('0' + i, 40);
+      ASSERT_TRUE(cache.get("obj", "tag", i * 40, 40, &out));
+      ASSERT_TRUE(out.contents_equal(expected));
+    }
+
+    /* no more files than there is room for */
+    for (int i = 0; i < 20; i++) {
+      bufferlist bl = chunk('x', 40);
+      cache.put("other", "tag", i * 40, bl);
+    }
+    ASSERT_EQ(6, count_files(path));
+
+    ASSERT_TRUE(cache.invalidate("other"));
+    ASSERT_FALSE(cache.invalidate("obj"));
+    ASSERT_EQ(0, count_files(path));
+  }
+  rmdir(path.c_str());
+}
+
+int main(int argc, char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+// Local Variables:
+// compile-command: "cd ../.. ; make unittest_rgw_data_cache && ./unittest_rgw_data_cache"
+// End:
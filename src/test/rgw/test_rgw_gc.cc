@@ -0,0 +1,130 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <unistd.h>
+
+#include "rgw/rgw_gc.h"
+#include "common/ceph_argparse.h"
+#include "common/Thread.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include "gtest/gtest.h"
+
+using namespace std;
+
+static utime_t fast(0, 1000000);      /* 1ms */
+static utime_t slow_lat(1, 0);
+
+static RGWGCThrottle *new_throttle(int max_window)
+{
+  return new RGWGCThrottle(g_ceph_context, max_window, utime_t(0, 500000000));
+}
+
+TEST(GCThrottle, backs_off)
+{
+  RGWGCThrottle *throttle = new_throttle(8);
+  ASSERT_EQ(8, throttle->get_window());
+
+  for (int i = 0; i < 8; i++)
+    throttle->get();
+
+  /* one failure halves it, the others already in flight don't again */
+  throttle->put(-ETIMEDOUT, fast);
+  ASSERT_EQ(4, throttle->get_window());
+  for (int i = 0; i < 7; i++)
+    throttle->put(-ETIMEDOUT, fast);
+  ASSERT_EQ(4, throttle->get_window());
+
+  /* a slow one counts as a failure */
+  throttle->get();
+  throttle->put(0, slow_lat);
+  ASSERT_EQ(2, throttle->get_window());
+
+  throttle->get();
+  throttle->put(-EIO, fast);
+  throttle->get();
+  throttle->put(-EIO, fast);
+  ASSERT_EQ(1, throttle->get_window());
+
+  delete throttle;
+}
+
+TEST(GCThrottle, grows_back)
+{
+  RGWGCThrottle *throttle = new_throttle(4);
+  throttle->get();
+  throttle->put(-EIO, fast);
+  throttle->get();
+  throttle->put(-EIO, fast);
+  ASSERT_EQ(1, throttle->get_window());
+
+  /* one more for every window's worth of fast removals, up to the max */
+  int expected[] = { 2, 2, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4 };
+  for (int i = 0; i < 12; i++) {
+    throttle->get();
+    throttle->put(0, fast);
+    ASSERT_EQ(expected[i], throttle->get_window());
+  }
+
+  delete throttle;
+}
+
+class Getter : public Thread {
+  RGWGCThrottle *throttle;
+
+public:
+  atomic_t done;
+
+  Getter(RGWGCThrottle *_throttle) : throttle(_throttle) {}
+
+  void *entry() {
+    throttle->get();
+    done.set(1);
+    return NULL;
+  }
+};
+
+TEST(GCThrottle, bounded)
+{
+  RGWGCThrottle *throttle = new_throttle(2);
+  throttle->get();
+  throttle->get();
+
+  Getter getter(throttle);
+  getter.create();
+  usleep(100000);
+  ASSERT_EQ(0u, getter.done.read());
+
+  throttle->put(0, fast);
+  getter.join();
+  ASSERT_EQ(1u, getter.done.read());
+
+  throttle->put(0, fast);
+  throttle->put(0, fast);
+  delete throttle;
+}
+
+int main(int argc, char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+// Local Variables:
+// compile-command: "cd ../.. ; make unittest_rgw_gc && ./unittest_rgw_gc"
+// End:
@@ -0,0 +1,182 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <iostream>
+
+#include "rgw/rgw_log.h"
+#include "common/ceph_argparse.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include "gtest/gtest.h"
+
+using namespace std;
+
+static string socket_path()
+{
+  char buf[64];
+  snprintf(buf, sizeof(buf), "/tmp/rgw_ops_log.%d", getpid());
+  return buf;
+}
+
+static int connect_to(const string& path)
+{
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -errno;
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    int r = -errno;
+    close(fd);
+    return r;
+  }
+  return fd;
+}
+
+/* reads until it has len bytes, or the other end is done */
+static void read_some(int fd, bufferlist& bl, unsigned len)
+{
+  char buf[4096];
+  while (bl.length() < len) {
+    int r = read(fd, buf, sizeof(buf));
+    if (r <= 0)
+      break;
+    bl.append(buf, r);
+  }
+}
+
+static list<rgw_log_entry> make_entries(int n)
+{
+  list<rgw_log_entry> entries;
+  for (int i = 0; i < n; i++) {
+    rgw_log_entry entry;
+    char buf[32];
+    snprintf(buf, sizeof(buf), "obj%d", i);
+    entry.bucket = "bucket";
+    entry.obj = rgw_obj_key(buf);
+    entry.op = "GET";
+    entry.uri = string("/bucket/") + buf;
+    entry.http_status = "200";
+    entry.bytes_sent = i;
+    entry.bytes_received = 0;
+    entry.obj_size = i;
+    entries.push_back(entry);
+  }
+  return entries;
+}
+
+static void set_binary(bool binary)
+{
+  g_ceph_context->_conf->set_val("rgw_ops_log_socket_binary", binary ? "true" : "false");
+  g_ceph_context->_conf->apply_changes(NULL);
+}
+
+TEST(OpsLogSocket, binary)
+{
+  set_binary(true);
+  string path = socket_path();
+  OpsLogSocket olog(g_ceph_context, 1 << 20);
+  ASSERT_TRUE(olog.init(path));
+
+  list<rgw_log_entry> entries = make_entries(3);
+  bufferlist expected;
+  for (list<rgw_log_entry>::iterator iter = entries.begin(); iter != entries.end(); ++iter)
+    ::encode(*iter, expected);
+  ASSERT_TRUE(olog.log(entries));
+
+  int fd = connect_to(path);
+  ASSERT_GE(fd, 0);
+  bufferlist bl;
+  read_some(fd, bl, expected.length());
+  close(fd);
+  ASSERT_EQ(expected.length(), bl.length());
+
+  /* back to back, each one decodes on its own */
+  bufferlist::iterator p = bl.begin();
+  for (int i = 0; i < 3; i++) {
+    rgw_log_entry entry;
+    ::decode(entry, p);
+    ASSERT_EQ((uint64_t)i, entry.bytes_sent);
+    ASSERT_EQ("bucket", entry.bucket);
+  }
+  ASSERT_TRUE(p.end());
+}
+
+TEST(OpsLogSocket, json)
+{
+  set_binary(false);
+  string path = socket_path();
+  OpsLogSocket olog(g_ceph_context, 1 << 20);
+  ASSERT_TRUE(olog.init(path));
+
+  list<rgw_log_entry> entries = make_entries(2);
+  ASSERT_TRUE(olog.log(entries));
+
+  int fd = connect_to(path);
+  ASSERT_GE(fd, 0);
+  bufferlist bl;
+  read_some(fd, bl, 1);
+  /* a batch is more than one entry of the array */
+  string s(bl.c_str(), bl.length());
+  while (s.find("obj1") == string::npos) {
+    bl.clear();
+    read_some(fd, bl, 1);
+    if (!bl.length())
+      break;
+    s.append(bl.c_str(), bl.length());
+  }
+  close(fd);
+  ASSERT_EQ('[', s[0]);
+  size_t first = s.find("obj0");
+  size_t sep = s.find(",\n", first);
+  size_t second = s.find("obj1");
+  ASSERT_NE(string::npos, first);
+  ASSERT_NE(string::npos, sep);
+  ASSERT_NE(string::npos, second);
+  ASSERT_LT(sep, second);
+}
+
+TEST(OpsLogSocket, backlog)
+{
+  set_binary(true);
+  string path = socket_path();
+  OpsLogSocket olog(g_ceph_context, 100);
+  ASSERT_TRUE(olog.init(path));
+
+  /* the first is taken whatever its size, then no more until it's read */
+  list<rgw_log_entry> entries = make_entries(10);
+  ASSERT_TRUE(olog.log(entries));
+  ASSERT_FALSE(olog.log(entries));
+}
+
+int main(int argc, char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+// Local Variables:
+// compile-command: "cd ../.. ; make unittest_rgw_log && ./unittest_rgw_log"
+// End:
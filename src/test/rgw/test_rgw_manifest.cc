@@ -225,3 +225,50 @@ TEST(TestRGWManifest, multipart) {
   ASSERT_EQ(m.get_obj_size(), num_parts * part_size);
 }
 
+
+/*
+ * What completing a 10,000 part upload costs on top of reading the part
+ * info: putting the manifests of the parts together, and encoding the
+ * result for the head.
+ */
+TEST(TestRGWManifest, multipart_10k_parts) {
+  int num_parts = 10000;
+  vector <RGWObjManifest> pm(num_parts);
+  rgw_bucket bucket;
+  uint64_t part_size = 5 * 1024 * 1024;
+  uint64_t stripe_size = 4 * 1024 * 1024;
+
+  string upload_id = "abc123";
+
+  for (int i = 0; i < num_parts; ++i) {
+    RGWObjManifest& manifest = pm[i];
+    RGWObjManifest::generator gen;
+    manifest.set_prefix(upload_id);
+
+    manifest.set_multipart_part_rule(stripe_size, i + 1);
+
+    rgw_obj head;
+    int r = gen.create_begin(g_ceph_context, &manifest, bucket, head);
+    ASSERT_EQ(r, 0);
+    gen.create_next(stripe_size);
+    gen.create_next(part_size);
+  }
+
+  utime_t start = ceph_clock_now(g_ceph_context);
+
+  RGWObjManifest m;
+  for (int i = 0; i < num_parts; i++) {
+    m.append(pm[i]);
+  }
+  bufferlist bl;
+  ::encode(m, bl);
+
+  utime_t elapsed = ceph_clock_now(g_ceph_context);
+  elapsed -= start;
+  cout << num_parts << " parts: manifest put together and encoded in " << elapsed
+       << "s, " << bl.length() << " bytes" << std::endl;
+
+  ASSERT_EQ(m.get_obj_size(), num_parts * part_size);
+  /* parts of the same size make one rule, however many there are */
+  ASSERT_LT(bl.length(), 4096u);
+}
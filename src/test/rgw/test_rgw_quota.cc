@@ -0,0 +1,302 @@
+// -*- mode:C++; tab-width:8; c-basic-offset:2; indent-tabs-mode:t -*-
+// vim: ts=8 sw=2 smarttab
+/*
+ * Ceph - scalable distributed file system
+ *
+ * This is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License version 2.1, as published by the Free Software
+ * Foundation.  See file COPYING.
+ *
+ */
+
+#include <iostream>
+#include <vector>
+
+#include "rgw/rgw_quota_cache.h"
+#include "common/lru_map.h"
+#include "common/ceph_argparse.h"
+#include "common/Thread.h"
+#include "global/global_init.h"
+#include "global/global_context.h"
+#include "gtest/gtest.h"
+
+using namespace std;
+
+static RGWStorageStats make_stats(uint64_t objs, uint64_t kb)
+{
+  RGWStorageStats s;
+  s.num_objects = objs;
+  s.num_kb = kb;
+  s.num_kb_rounded = kb;
+  return s;
+}
+
+static RGWStorageStats get_stats(RGWQuotaCacheStats& qs)
+{
+  RGWStorageStats s;
+  Mutex::Locker l(qs.lock);
+  qs.get(s);
+  return s;
+}
+
+/* a refresh that reads back what storage had as it was sent */
+static void refresh(RGWQuotaCacheStats& qs, RGWStorageStats stored)
+{
+  Mutex::Locker l(qs.lock);
+  qs.start_refresh();
+  qs.set(g_ceph_context, stored);
+}
+
+TEST(QuotaCacheStats, Adjust)
+{
+  RGWQuotaCacheStats qs;
+  refresh(qs, make_stats(10, 100));
+  ASSERT_TRUE(qs.fetched);
+  ASSERT_FALSE(qs.refreshing);
+
+  qs.adjust(2, 20, 24);
+  qs.adjust(-1, -4, -4);
+  RGWStorageStats s = get_stats(qs);
+  ASSERT_EQ(11u, s.num_objects);
+  ASSERT_EQ(116u, s.num_kb);
+  ASSERT_EQ(120u, s.num_kb_rounded);
+}
+
+TEST(QuotaCacheStats, RefreshFoldsInDeltas)
+{
+  RGWQuotaCacheStats qs;
+  refresh(qs, make_stats(10, 100));
+
+  /* storage has the change too, by the time it is read */
+  qs.adjust(5, 50, 50);
+  refresh(qs, make_stats(15, 150));
+  RGWStorageStats s = get_stats(qs);
+  ASSERT_EQ(15u, s.num_objects);
+  ASSERT_EQ(150u, s.num_kb);
+}
+
+TEST(QuotaCacheStats, AdjustDuringRefresh)
+{
+  RGWQuotaCacheStats qs;
+  refresh(qs, make_stats(10, 100));
+
+  qs.adjust(1, 10, 10);
+  qs.lock.Lock();
+  qs.start_refresh();
+  qs.lock.Unlock();
+
+  /* after the read was sent, and not in what it reads */
+  qs.adjust(2, 20, 20);
+  RGWStorageStats s = get_stats(qs);
+  ASSERT_EQ(13u, s.num_objects);
+
+  qs.lock.Lock();
+  RGWStorageStats stored = make_stats(11, 110);
+  qs.set(g_ceph_context, stored);
+  qs.lock.Unlock();
+  s = get_stats(qs);
+  ASSERT_EQ(13u, s.num_objects);
+  ASSERT_EQ(130u, s.num_kb);
+}
+
+TEST(QuotaCacheStats, AdjustRacingRead)
+{
+  RGWQuotaCacheStats qs;
+  refresh(qs, make_stats(10, 100));
+
+  qs.lock.Lock();
+  qs.start_refresh();
+  qs.lock.Unlock();
+
+  /* reaches storage before the read, and us only after the refresh started */
+  qs.adjust(1, 10, 10);
+  qs.lock.Lock();
+  RGWStorageStats stored = make_stats(11, 110);
+  qs.set(g_ceph_context, stored);
+  qs.lock.Unlock();
+  RGWStorageStats s = get_stats(qs);
+  ASSERT_EQ(12u, s.num_objects); /* counted twice... */
+
+  refresh(qs, make_stats(11, 110));
+  s = get_stats(qs);
+  ASSERT_EQ(11u, s.num_objects); /* ...until the next refresh */
+  ASSERT_EQ(110u, s.num_kb);
+}
+
+TEST(QuotaCacheStats, FailedRefreshKeepsDeltas)
+{
+  RGWQuotaCacheStats qs;
+  refresh(qs, make_stats(10, 100));
+  utime_t fetched = qs.fetch_time;
+
+  qs.adjust(1, 10, 10);
+  qs.lock.Lock();
+  qs.start_refresh();
+  qs.fail(-EIO);
+  qs.lock.Unlock();
+  ASSERT_FALSE(qs.refreshing);
+  ASSERT_EQ(-EIO, qs.fetch_ret);
+  ASSERT_EQ(1, qs.refresh_failures);
+  ASSERT_EQ(fetched, qs.fetch_time);
+
+  RGWStorageStats s = get_stats(qs);
+  ASSERT_EQ(11u, s.num_objects);
+
+  refresh(qs, make_stats(11, 110));
+  s = get_stats(qs);
+  ASSERT_EQ(11u, s.num_objects);
+  ASSERT_EQ(0, qs.refresh_failures);
+}
+
+TEST(QuotaCacheStats, Expired)
+{
+  RGWQuotaCacheStats qs;
+  refresh(qs, make_stats(10, 100));
+
+  utime_t now = qs.fetch_time;
+  ASSERT_FALSE(qs.expired(now, 60));
+  now += 59;
+  ASSERT_FALSE(qs.expired(now, 60));
+  now += 1;
+  ASSERT_TRUE(qs.expired(now, 60));
+  ASSERT_FALSE(qs.expired(now, 0));
+}
+
+class Adjuster : public Thread {
+  RGWQuotaCacheStats& qs;
+  int count;
+public:
+  Adjuster(RGWQuotaCacheStats& _qs, int _count) : qs(_qs), count(_count) {}
+  void *entry() {
+    for (int i = 0; i < count; i++) {
+      qs.adjust(1, 4, 4);
+      if (i % 2)
+        qs.adjust(-1, -4, -4);
+    }
+    return NULL;
+  }
+};
+
+/*
+ * Refreshes that read back exactly what they were sent with, while
+ * other threads adjust: nothing is lost or counted twice.
+ */
+TEST(QuotaCacheStats, ConcurrentAdjust)
+{
+  RGWQuotaCacheStats qs;
+  refresh(qs, make_stats(0, 0));
+
+  const int num_threads = 4;
+  const int count = 100000;
+  vector<Adjuster*> threads;
+  for (int i = 0; i < num_threads; i++) {
+    threads.push_back(new Adjuster(qs, count));
+    threads.back()->create();
+  }
+
+  RGWStorageStats stored = make_stats(0, 0);
+  for (int i = 0; i < 1000; i++) {
+    qs.lock.Lock();
+    qs.start_refresh();
+    stored.num_objects += qs.refresh_objs_delta;
+    stored.num_kb += qs.refresh_kb_delta;
+    stored.num_kb_rounded += qs.refresh_kb_rounded_delta;
+    qs.lock.Unlock();
+
+    qs.lock.Lock();
+    RGWStorageStats read = stored;
+    qs.set(g_ceph_context, read);
+    qs.lock.Unlock();
+  }
+
+  for (int i = 0; i < num_threads; i++) {
+    threads[i]->join();
+    delete threads[i];
+  }
+
+  uint64_t objs = num_threads * (count / 2);
+  RGWStorageStats s = get_stats(qs);
+  ASSERT_EQ(objs, s.num_objects);
+  ASSERT_EQ(objs * 4, s.num_kb);
+  ASSERT_EQ(objs * 4, s.num_kb_rounded);
+}
+
+TEST(LRUMap, FindOrAdd)
+{
+  lru_map<string, int> m(2);
+  int v = 1;
+  ASSERT_FALSE(m.find_or_add("a", v));
+  ASSERT_EQ(1, v);
+
+  v = 2;
+  ASSERT_TRUE(m.find_or_add("a", v));
+  ASSERT_EQ(1, v);   /* what was there */
+
+  int w = 3;
+  ASSERT_FALSE(m.find_or_add("b", w));
+  int x = 4;
+  ASSERT_FALSE(m.find_or_add("c", x));
+
+  /* "a" was the least recently used */
+  int found;
+  ASSERT_FALSE(m.find("a", found));
+  ASSERT_TRUE(m.find("b", found));
+  ASSERT_EQ(3, found);
+}
+
+class FindOrAdder : public Thread {
+  lru_map<string, RGWQuotaCacheStatsRef>& m;
+public:
+  RGWQuotaCacheStatsRef qs;
+  bool found;
+  FindOrAdder(lru_map<string, RGWQuotaCacheStatsRef>& _m) : m(_m), found(false) {}
+  void *entry() {
+    qs = RGWQuotaCacheStatsRef(new RGWQuotaCacheStats);
+    found = m.find_or_add("bucket", qs);
+    return NULL;
+  }
+};
+
+/* racing requests for a new entry all end up with the same one */
+TEST(LRUMap, FindOrAddConcurrent)
+{
+  lru_map<string, RGWQuotaCacheStatsRef> m(10);
+
+  const int num_threads = 8;
+  vector<FindOrAdder*> threads;
+  for (int i = 0; i < num_threads; i++) {
+    threads.push_back(new FindOrAdder(m));
+    threads.back()->create();
+  }
+  for (int i = 0; i < num_threads; i++) {
+    threads[i]->join();
+  }
+
+  RGWQuotaCacheStatsRef qs;
+  ASSERT_TRUE(m.find("bucket", qs));
+  int added = 0;
+  for (int i = 0; i < num_threads; i++) {
+    if (!threads[i]->found)
+      added++;
+    ASSERT_EQ(qs.get(), threads[i]->qs.get());
+    delete threads[i];
+  }
+  ASSERT_EQ(1, added);
+}
+
+int main(int argc, char **argv)
+{
+  vector<const char*> args;
+  argv_to_vec(argc, (const char **)argv, args);
+
+  global_init(NULL, args, CEPH_ENTITY_TYPE_CLIENT, CODE_ENVIRONMENT_UTILITY, 0);
+  common_init_finish(g_ceph_context);
+
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+// Local Variables:
+// compile-command: "cd ../.. ; make unittest_rgw_quota && ./unittest_rgw_quota"
+// End: